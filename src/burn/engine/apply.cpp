@@ -7,19 +7,6 @@ const DWORD BURN_CACHE_MAX_RECOMMENDED_VERIFY_TRYAGAIN_ATTEMPTS = 2;
 
 // structs
 
-struct BURN_CACHE_ACQUIRE_PROGRESS_CONTEXT
-{
-    BURN_USER_EXPERIENCE* pUX;
-    BURN_CONTAINER* pContainer;
-    BURN_PACKAGE* pPackage;
-    BURN_PAYLOAD* pPayload;
-    DWORD64 qwCacheProgress;
-    DWORD64 qwTotalCacheSize;
-
-    BOOL fCancel;
-    BOOL fError;
-};
-
 typedef struct _BURN_EXECUTE_CONTEXT
 {
     BURN_USER_EXPERIENCE* pUX;
@@ -73,6 +60,7 @@ static HRESULT AcquireContainerOrPayload(
     __in_opt BURN_PACKAGE* pPackage,
     __in_opt BURN_PAYLOAD* pPayload,
     __in LPCWSTR wzDestinationPath,
+    __in_z_opt LPCWSTR wzAcquiredFrom,
     __in DWORD64 qwSuccessfulCacheProgress,
     __in DWORD64 qwTotalCacheSize
     );
@@ -108,6 +96,9 @@ static HRESULT DownloadPayload(
     __in BURN_CACHE_ACQUIRE_PROGRESS_CONTEXT* pProgress,
     __in_z LPCWSTR wzDestinationPath
     );
+static HRESULT ReportAcquiredProgress(
+    __in BURN_CACHE_ACQUIRE_PROGRESS_CONTEXT* pProgress
+    );
 static DWORD CALLBACK CacheProgressRoutine(
     __in LARGE_INTEGER TotalFileSize,
     __in LARGE_INTEGER TotalBytesTransferred,
@@ -119,6 +110,21 @@ static DWORD CALLBACK CacheProgressRoutine(
     __in HANDLE hDestinationFile,
     __in_opt LPVOID lpData
     );
+static HRESULT CacheVerifyProgressRoutine(
+    __in DWORD64 qwVerified,
+    __in DWORD64 qwTotal,
+    __in_opt LPVOID pvContext
+    );
+static DWORD WINAPI AcquireThreadProc(
+    __in LPVOID lpThreadParameter
+    );
+static HRESULT AcquireAhead(
+    __in BURN_VARIABLES* pVariables,
+    __in BURN_CACHE_ACTION* pCacheAction,
+    __in_z LPCWSTR wzSourcePath,
+    __in BURN_CACHE_ACQUIRE_PROGRESS_CONTEXT* pProgress,
+    __out_z LPWSTR* psczSourceFullPath
+    );
 static void DoRollbackCache(
     __in BURN_USER_EXPERIENCE* pUX,
     __in BURN_PLAN* pPlan,
@@ -399,6 +405,13 @@ extern "C" HRESULT ApplyUnregister(
     {
         hr = ElevationSessionEnd(pEngineState->companionConnection.hPipe, resumeMode, restart, pEngineState->plan.dependencyRegistrationAction);
         ExitOnFailure(hr, "Failed to end session in per-machine process.");
+
+        // A per-machine bundle keeps its search cache in the user's package cache, which
+        // only this process is sure to resolve to the right profile.
+        if (BURN_RESUME_MODE_NONE == resumeMode)
+        {
+            CacheRemoveBundle(FALSE, pEngineState->registration.sczId);
+        }
     }
     else
     {
@@ -430,6 +443,10 @@ extern "C" HRESULT ApplyCache(
     DWORD iRetryAction = BURN_PLAN_INVALID_ACTION_INDEX;
     BURN_PACKAGE* pStartedPackage = NULL;
     DWORD64 qwSuccessfulCachedProgress = 0;
+    BURN_ACQUIRE_THREAD_CONTEXT acquireThreadContext = { };
+    HANDLE rghAcquireThreads[BURN_CACHE_MAX_ACQUIRE_THREADS] = { };
+    DWORD cAcquireThreads = 0;
+    LPWSTR sczAcquiredFrom = NULL;
 
     // Allow us to retry and skip packages.
     DWORD iPackageStartAction = BURN_PLAN_INVALID_ACTION_INDEX;
@@ -439,6 +456,11 @@ extern "C" HRESULT ApplyCache(
     hr = UserExperienceInterpretExecuteResult(pUX, FALSE, MB_OKCANCEL, nResult);
     ExitOnRootFailure(hr, "UX aborted cache.");
 
+    // Containers and payloads found on local or network sources are copied ahead by a pool
+    // of threads, while this thread still walks the plan in order and talks to the BA.
+    hr = ApplyStartAcquireThreads(pPlan, pVariables, &acquireThreadContext, rghAcquireThreads, &cAcquireThreads);
+    ExitOnFailure(hr, "Failed to start acquire threads.");
+
     do
     {
         hr = S_OK;
@@ -504,7 +526,13 @@ extern "C" HRESULT ApplyCache(
                 break;
 
             case BURN_CACHE_ACTION_TYPE_ACQUIRE_CONTAINER:
-                hr = AcquireContainerOrPayload(pUX, pVariables, pCacheAction->resolveContainer.pContainer, NULL, NULL, pCacheAction->resolveContainer.sczUnverifiedPath, qwSuccessfulCachedProgress, pPlan->qwCacheSizeTotal);
+                hr = ApplyTakeAcquiredContainerOrPayload(&acquireThreadContext, i, &sczAcquiredFrom);
+                if (SUCCEEDED(hr))
+                {
+                    hr = AcquireContainerOrPayload(pUX, pVariables, pCacheAction->resolveContainer.pContainer, NULL, NULL, pCacheAction->resolveContainer.sczUnverifiedPath, sczAcquiredFrom, qwSuccessfulCachedProgress, pPlan->qwCacheSizeTotal);
+                    ReleaseNullStr(sczAcquiredFrom);
+                }
+
                 if (SUCCEEDED(hr))
                 {
                     qwSuccessfulCachedProgress += pCacheAction->resolveContainer.pContainer->qwFileSize;
@@ -553,7 +581,13 @@ extern "C" HRESULT ApplyCache(
                 break;
 
             case BURN_CACHE_ACTION_TYPE_ACQUIRE_PAYLOAD:
-                hr = AcquireContainerOrPayload(pUX, pVariables, NULL, pCacheAction->resolvePayload.pPackage, pCacheAction->resolvePayload.pPayload, pCacheAction->resolvePayload.sczUnverifiedPath, qwSuccessfulCachedProgress, pPlan->qwCacheSizeTotal);
+                hr = ApplyTakeAcquiredContainerOrPayload(&acquireThreadContext, i, &sczAcquiredFrom);
+                if (SUCCEEDED(hr))
+                {
+                    hr = AcquireContainerOrPayload(pUX, pVariables, NULL, pCacheAction->resolvePayload.pPackage, pCacheAction->resolvePayload.pPayload, pCacheAction->resolvePayload.sczUnverifiedPath, sczAcquiredFrom, qwSuccessfulCachedProgress, pPlan->qwCacheSizeTotal);
+                    ReleaseNullStr(sczAcquiredFrom);
+                }
+
                 if (SUCCEEDED(hr))
                 {
                     qwSuccessfulCachedProgress += pCacheAction->resolvePayload.pPayload->qwFileSize;
@@ -691,6 +725,12 @@ LExit:
     Assert(BURN_PLAN_INVALID_ACTION_INDEX == iPackageStartAction);
     Assert(BURN_PLAN_INVALID_ACTION_INDEX == iPackageCompleteAction);
 
+    // The acquire threads must be done with the working folder before rollback or cleanup touch it.
+    if (acquireThreadContext.pPlan)
+    {
+        ApplyStopAcquireThreads(&acquireThreadContext, rghAcquireThreads, cAcquireThreads);
+    }
+
     if (FAILED(hr))
     {
         DoRollbackCache(pUX, pPlan, hPipe, dwCheckpoint);
@@ -814,6 +854,218 @@ extern "C" void ApplyClean(
     }
 }
 
+//
+// ApplyStartAcquireThreads - starts the threads that copy containers and payloads
+//                            ahead of the cache thread. Only files found on a
+//                            local or network source are copied there, anything
+//                            that needs the BA (prompting, downloading) is left
+//                            to the cache thread.
+//
+extern "C" HRESULT ApplyStartAcquireThreads(
+    __in BURN_PLAN* pPlan,
+    __in BURN_VARIABLES* pVariables,
+    __in BURN_ACQUIRE_THREAD_CONTEXT* pContext,
+    __in_ecount(BURN_CACHE_MAX_ACQUIRE_THREADS) HANDLE* rghThreads,
+    __out DWORD* pcThreads
+    )
+{
+    HRESULT hr = S_OK;
+    DWORD cThreads = 0;
+
+    *pcThreads = 0;
+
+    pContext->pPlan = pPlan;
+    pContext->pVariables = pVariables;
+    ::InitializeCriticalSection(&pContext->cs);
+
+    for (DWORD i = 0; i < pPlan->cCacheActions; ++i)
+    {
+        BURN_CACHE_ACTION* pCacheAction = pPlan->rgCacheActions + i;
+        LPCWSTR wzSourcePath = NULL;
+
+        if (pCacheAction->fSkipUntilRetried)
+        {
+            continue;
+        }
+        else if (BURN_CACHE_ACTION_TYPE_ACQUIRE_CONTAINER == pCacheAction->type)
+        {
+            wzSourcePath = pCacheAction->resolveContainer.pContainer->sczSourcePath;
+        }
+        else if (BURN_CACHE_ACTION_TYPE_ACQUIRE_PAYLOAD == pCacheAction->type)
+        {
+            wzSourcePath = pCacheAction->resolvePayload.pPayload->sczSourcePath;
+        }
+
+        if (wzSourcePath && *wzSourcePath)
+        {
+            hr = MemEnsureArraySize(reinterpret_cast<LPVOID*>(&pContext->rgiActions), pContext->cActions + 1, sizeof(DWORD), 16);
+            ExitOnFailure(hr, "Failed to grow acquire actions.");
+
+            hr = MemEnsureArraySize(reinterpret_cast<LPVOID*>(&pContext->rgsczSourcePath), pContext->cActions + 1, sizeof(LPWSTR), 16);
+            ExitOnFailure(hr, "Failed to grow acquire source paths.");
+
+            // The BA may change the source while the acquire threads run, so they work from a copy.
+            hr = StrAllocString(pContext->rgsczSourcePath + pContext->cActions, wzSourcePath, 0);
+            ExitOnFailure(hr, "Failed to copy acquire source path.");
+
+            pContext->rgiActions[pContext->cActions] = i;
+            ++pContext->cActions;
+        }
+    }
+
+    // A single acquire is left to the cache thread, there is nothing to overlap it with.
+    if (2 > pContext->cActions)
+    {
+        ExitFunction();
+    }
+
+    pContext->hAcquired = ::CreateEventW(NULL, FALSE, FALSE, NULL);
+    ExitOnNullWithLastError(pContext->hAcquired, hr, "Failed to create acquired event.");
+
+    pContext->rgState = static_cast<BURN_ACQUIRE_STATE*>(MemAlloc(sizeof(BURN_ACQUIRE_STATE) * pPlan->cCacheActions, TRUE));
+    ExitOnNull(pContext->rgState, hr, E_OUTOFMEMORY, "Failed to allocate acquire states.");
+
+    pContext->rgsczAcquiredFrom = static_cast<LPWSTR*>(MemAlloc(sizeof(LPWSTR) * pPlan->cCacheActions, TRUE));
+    ExitOnNull(pContext->rgsczAcquiredFrom, hr, E_OUTOFMEMORY, "Failed to allocate acquired source paths.");
+
+    cThreads = min(pContext->cActions, BURN_CACHE_MAX_ACQUIRE_THREADS);
+    for (DWORD i = 0; i < cThreads; ++i)
+    {
+        rghThreads[*pcThreads] = ::CreateThread(NULL, 0, AcquireThreadProc, pContext, 0, NULL);
+        if (!rghThreads[*pcThreads])
+        {
+            // Fewer threads only means less overlap, so keep what started.
+            TraceError(HRESULT_FROM_WIN32(::GetLastError()), "Failed to create acquire thread.");
+            break;
+        }
+
+        ++*pcThreads;
+    }
+
+LExit:
+    return hr;
+}
+
+//
+// ApplyTakeAcquiredContainerOrPayload - called by the cache thread when it reaches
+//                                       an acquire action. Waits if an acquire
+//                                       thread is copying it and returns where it
+//                                       was copied from, or NULL if the cache
+//                                       thread must acquire it itself.
+//
+extern "C" HRESULT ApplyTakeAcquiredContainerOrPayload(
+    __in BURN_ACQUIRE_THREAD_CONTEXT* pContext,
+    __in DWORD iAction,
+    __out_z LPWSTR* psczAcquiredFrom
+    )
+{
+    HRESULT hr = S_OK;
+    BURN_ACQUIRE_STATE state = BURN_ACQUIRE_STATE_NONE;
+    BURN_CACHE_ACTION* pCacheAction = pContext->pPlan->rgCacheActions + iAction;
+    LPCWSTR wzSourcePath = NULL;
+
+    *psczAcquiredFrom = NULL;
+
+    if (!pContext->rgState)
+    {
+        ExitFunction();
+    }
+
+    for (;;)
+    {
+        ::EnterCriticalSection(&pContext->cs);
+        state = pContext->rgState[iAction];
+        if (BURN_ACQUIRE_STATE_ACQUIRING != state)
+        {
+            // Whatever happened, a retry of this action acquires it on the cache thread.
+            pContext->rgState[iAction] = BURN_ACQUIRE_STATE_TAKEN;
+
+            *psczAcquiredFrom = pContext->rgsczAcquiredFrom[iAction];
+            pContext->rgsczAcquiredFrom[iAction] = NULL;
+        }
+        ::LeaveCriticalSection(&pContext->cs);
+
+        if (BURN_ACQUIRE_STATE_ACQUIRING != state)
+        {
+            break;
+        }
+
+        if (WAIT_OBJECT_0 != ::WaitForSingleObject(pContext->hAcquired, INFINITE))
+        {
+            ExitWithLastError(hr, "Failed to wait for acquired event.");
+        }
+    }
+
+    // If the BA set a new source after the acquire threads started, the copy made ahead
+    // came from the old one, so the cache thread acquires the file again.
+    if (*psczAcquiredFrom)
+    {
+        wzSourcePath = BURN_CACHE_ACTION_TYPE_ACQUIRE_CONTAINER == pCacheAction->type ? pCacheAction->resolveContainer.pContainer->sczSourcePath : pCacheAction->resolvePayload.pPayload->sczSourcePath;
+
+        for (DWORD i = 0; i < pContext->cActions; ++i)
+        {
+            if (iAction == pContext->rgiActions[i])
+            {
+                if (!wzSourcePath || CSTR_EQUAL != ::CompareStringW(LOCALE_NEUTRAL, 0, wzSourcePath, -1, pContext->rgsczSourcePath[i], -1))
+                {
+                    ReleaseNullStr(*psczAcquiredFrom);
+                }
+                break;
+            }
+        }
+    }
+
+LExit:
+    return hr;
+}
+
+extern "C" void ApplyStopAcquireThreads(
+    __in BURN_ACQUIRE_THREAD_CONTEXT* pContext,
+    __in_ecount(cThreads) HANDLE* rghThreads,
+    __in DWORD cThreads
+    )
+{
+    ::EnterCriticalSection(&pContext->cs);
+    pContext->fStop = TRUE;
+
+    for (DWORD i = 0; i < BURN_CACHE_MAX_ACQUIRE_THREADS; ++i)
+    {
+        pContext->rgProgress[i].fCancel = TRUE; // cancels copies in progress.
+    }
+    ::LeaveCriticalSection(&pContext->cs);
+
+    if (cThreads)
+    {
+        ::WaitForMultipleObjects(cThreads, rghThreads, TRUE, INFINITE);
+
+        for (DWORD i = 0; i < cThreads; ++i)
+        {
+            ReleaseHandle(rghThreads[i]);
+        }
+    }
+
+    // Files copied for actions the cache thread never reached are left for cache cleanup.
+    if (pContext->rgsczAcquiredFrom)
+    {
+        for (DWORD i = 0; i < pContext->pPlan->cCacheActions; ++i)
+        {
+            ReleaseStr(pContext->rgsczAcquiredFrom[i]);
+        }
+        MemFree(pContext->rgsczAcquiredFrom);
+    }
+
+    for (DWORD i = 0; i < pContext->cActions; ++i)
+    {
+        ReleaseStr(pContext->rgsczSourcePath[i]);
+    }
+
+    ReleaseMem(pContext->rgsczSourcePath);
+    ReleaseMem(pContext->rgiActions);
+    ReleaseMem(pContext->rgState);
+    ReleaseHandle(pContext->hAcquired);
+    ::DeleteCriticalSection(&pContext->cs);
+}
+
 
 // internal helper functions
 
@@ -857,7 +1109,7 @@ static HRESULT ExtractContainer(
     HRESULT hr = S_OK;
     BURN_CONTAINER_CONTEXT context = { };
     HANDLE hContainerHandle = INVALID_HANDLE_VALUE;
-    LPWSTR sczExtractPayloadId = NULL;
+    BURN_CONTAINER_EXTRACT_STREAM* rgStreams = NULL;
 
     // If the container is actually attached, then it was planned to be acquired through hSourceEngineFile.
     if (pContainer->fActuallyAttached)
@@ -868,40 +1120,52 @@ static HRESULT ExtractContainer(
     hr = ContainerOpen(&context, pContainer, hContainerHandle, wzContainerPath);
     ExitOnFailure1(hr, "Failed to open container: %ls.", pContainer->sczId);
 
-    while (S_OK == (hr = ContainerNextStream(&context, &sczExtractPayloadId)))
+    // Say up front which streams are wanted and where they go so the container can be extracted in a single pass.
+    rgStreams = static_cast<BURN_CONTAINER_EXTRACT_STREAM*>(MemAlloc(sizeof(BURN_CONTAINER_EXTRACT_STREAM) * cExtractPayloads, TRUE));
+    ExitOnNull(rgStreams, hr, E_OUTOFMEMORY, "Failed to allocate memory for streams to extract.");
+
+    for (DWORD iExtract = 0; iExtract < cExtractPayloads; ++iExtract)
     {
-        BOOL fExtracted = FALSE;
+        BURN_EXTRACT_PAYLOAD* pExtract = rgExtractPayloads + iExtract;
+        BURN_PAYLOAD* pPayload = pExtract->pPayload;
+        DWORD dwHashProvType = 0;
+        ALG_ID algidHash = 0;
 
-        for (DWORD iExtract = 0; iExtract < cExtractPayloads; ++iExtract)
+        // Payloads verified by hash are hashed as they are extracted so completing them does not need to
+        // read them back from disk.
+        ReleaseNullStr(pPayload->sczExtractedPath);
+        if (pPayload->pbHash && !pPayload->pbExtractedHash && SUCCEEDED(CacheGetHashAlgorithm(pPayload->cbHash, &dwHashProvType, &algidHash)))
         {
-            BURN_EXTRACT_PAYLOAD* pExtract = rgExtractPayloads + iExtract;
-            if (CSTR_EQUAL == ::CompareStringW(LOCALE_INVARIANT, 0, sczExtractPayloadId, -1, pExtract->pPayload->sczSourcePath, -1))
-            {
-                // TODO: Send progress when extracting stream to file.
-                hr = ContainerStreamToFile(&context, pExtract->sczUnverifiedPath);
-                ExitOnFailure2(hr, "Failed to extract payload: %ls from container: %ls", sczExtractPayloadId, pContainer->sczId);
+            pPayload->pbExtractedHash = static_cast<BYTE*>(MemAlloc(pPayload->cbHash, TRUE));
+            ExitOnNull(pPayload->pbExtractedHash, hr, E_OUTOFMEMORY, "Failed to allocate memory for extracted payload hash.");
 
-                fExtracted = TRUE;
-                break;
-            }
+            pPayload->cbExtractedHash = pPayload->cbHash;
         }
 
-        if (!fExtracted)
-        {
-            hr = ContainerSkipStream(&context);
-            ExitOnFailure2(hr, "Failed to skip the extraction of payload: %ls from container: %ls", sczExtractPayloadId, pContainer->sczId);
-        }
+        rgStreams[iExtract].wzStreamName = pPayload->sczSourcePath;
+        rgStreams[iExtract].wzTargetFile = pExtract->sczUnverifiedPath;
+        rgStreams[iExtract].pbHash = pPayload->pbExtractedHash;
+        rgStreams[iExtract].cbHash = pPayload->cbExtractedHash;
     }
 
-    if (E_NOMOREITEMS == hr)
+    // TODO: Send progress when extracting streams to files.
+    hr = ContainerExtractStreams(&context, rgStreams, cExtractPayloads);
+    ExitOnFailure1(hr, "Failed to extract all payloads from container: %ls", pContainer->sczId);
+
+    for (DWORD iExtract = 0; iExtract < cExtractPayloads; ++iExtract)
     {
-        hr = S_OK;
+        BURN_PAYLOAD* pPayload = rgExtractPayloads[iExtract].pPayload;
+
+        if (rgStreams[iExtract].fHashed)
+        {
+            hr = StrAllocString(&pPayload->sczExtractedPath, rgStreams[iExtract].wzTargetFile, 0);
+            ExitOnFailure(hr, "Failed to copy extracted payload path.");
+        }
     }
-    ExitOnFailure1(hr, "Failed to extract all payloads from container: %ls", pContainer->sczId);
 
 LExit:
-    ReleaseStr(sczExtractPayloadId);
     ContainerClose(&context);
+    ReleaseMem(rgStreams);
 
     return hr;
 }
@@ -1050,6 +1314,7 @@ static HRESULT AcquireContainerOrPayload(
     __in_opt BURN_PACKAGE* pPackage,
     __in_opt BURN_PAYLOAD* pPayload,
     __in LPCWSTR wzDestinationPath,
+    __in_z_opt LPCWSTR wzAcquiredFrom,
     __in DWORD64 qwSuccessfulCacheProgress,
     __in DWORD64 qwTotalCacheSize
     )
@@ -1084,37 +1349,47 @@ static HRESULT AcquireContainerOrPayload(
         fRetry = FALSE;
         progress.fCancel = FALSE;
 
-        hr = CacheFindLocalSource(wzSourcePath, pVariables, &fFoundLocal, &sczSourceFullPath);
-        ExitOnFailure(hr, "Failed to search local source.");
-        
-        if (fFoundLocal) // the file exists locally, so copy it.
+        if (wzAcquiredFrom) // an acquire thread already copied the file from a local source.
         {
-            // If the source path and destination path are different, do the copy (otherwise there's no point).
-            hr = PathCompare(sczSourceFullPath, wzDestinationPath, &nEquivalentPaths);
-            ExitOnFailure(hr, "Failed to determine if payload source path was equivalent to the destination path.");
+            hr = StrAllocString(&sczSourceFullPath, wzAcquiredFrom, 0);
+            ExitOnFailure(hr, "Failed to copy acquired source path.");
 
-            fCopy = (CSTR_EQUAL != nEquivalentPaths);
+            fCopy = TRUE;
         }
-        else // can't find the file locally, so prompt for source.
+        else
         {
-            DWORD dwLogId = pContainer ? (wzPayloadId ? MSG_PROMPT_CONTAINER_PAYLOAD_SOURCE : MSG_PROMPT_CONTAINER_SOURCE) : pPackage ? MSG_PROMPT_PACKAGE_PAYLOAD_SOURCE : MSG_PROMPT_BUNDLE_PAYLOAD_SOURCE;
-            LogId(REPORT_STANDARD, dwLogId, wzPackageOrContainerId ? wzPackageOrContainerId : L"", wzPayloadId ? wzPayloadId : L"", sczSourceFullPath);
+            hr = CacheFindLocalSource(wzSourcePath, pVariables, &fFoundLocal, &sczSourceFullPath);
+            ExitOnFailure(hr, "Failed to search local source.");
 
-            hr = PromptForSource(pUX, wzPackageOrContainerId, wzPayloadId, sczSourceFullPath, wzDownloadUrl, &fRetry, &fDownload);
+            if (fFoundLocal) // the file exists locally, so copy it.
+            {
+                // If the source path and destination path are different, do the copy (otherwise there's no point).
+                hr = PathCompare(sczSourceFullPath, wzDestinationPath, &nEquivalentPaths);
+                ExitOnFailure(hr, "Failed to determine if payload source path was equivalent to the destination path.");
 
-            // If the BA requested download then ensure a download url is available (it may have been set
-            // during PromptForSource so we need to check again).
-            if (fDownload)
+                fCopy = (CSTR_EQUAL != nEquivalentPaths);
+            }
+            else // can't find the file locally, so prompt for source.
             {
-                wzDownloadUrl = pContainer ? pContainer->downloadSource.sczUrl : pPayload->downloadSource.sczUrl;
-                if (!wzDownloadUrl || !*wzDownloadUrl)
+                DWORD dwLogId = pContainer ? (wzPayloadId ? MSG_PROMPT_CONTAINER_PAYLOAD_SOURCE : MSG_PROMPT_CONTAINER_SOURCE) : pPackage ? MSG_PROMPT_PACKAGE_PAYLOAD_SOURCE : MSG_PROMPT_BUNDLE_PAYLOAD_SOURCE;
+                LogId(REPORT_STANDARD, dwLogId, wzPackageOrContainerId ? wzPackageOrContainerId : L"", wzPayloadId ? wzPayloadId : L"", sczSourceFullPath);
+
+                hr = PromptForSource(pUX, wzPackageOrContainerId, wzPayloadId, sczSourceFullPath, wzDownloadUrl, &fRetry, &fDownload);
+
+                // If the BA requested download then ensure a download url is available (it may have been set
+                // during PromptForSource so we need to check again).
+                if (fDownload)
                 {
-                    hr = E_INVALIDARG;
+                    wzDownloadUrl = pContainer ? pContainer->downloadSource.sczUrl : pPayload->downloadSource.sczUrl;
+                    if (!wzDownloadUrl || !*wzDownloadUrl)
+                    {
+                        hr = E_INVALIDARG;
+                    }
                 }
-            }
 
-            // Log the error
-            LogExitOnFailure1(hr, MSG_PAYLOAD_FILE_NOT_PRESENT, "Failed while prompting for source (original path '%ls').", sczSourceFullPath);
+                // Log the error
+                LogExitOnFailure1(hr, MSG_PAYLOAD_FILE_NOT_PRESENT, "Failed while prompting for source (original path '%ls').", sczSourceFullPath);
+            }
         }
 
         if (fCopy)
@@ -1123,7 +1398,17 @@ static HRESULT AcquireContainerOrPayload(
             hr = UserExperienceInterpretExecuteResult(pUX, FALSE, MB_OKCANCEL, nResult);
             ExitOnRootFailure(hr, "BA aborted cache acquire begin.");
 
-            hr = CopyPayload(&progress, sczSourceFullPath, wzDestinationPath);
+            if (wzAcquiredFrom)
+            {
+                hr = ReportAcquiredProgress(&progress);
+
+                // If the BA asks to retry, the file is acquired again on this thread.
+                wzAcquiredFrom = NULL;
+            }
+            else
+            {
+                hr = CopyPayload(&progress, sczSourceFullPath, wzDestinationPath);
+            }
             // Error handling happens after sending complete message to BA.
 
             // We successfully copied from a source location, set that as the last used source.
@@ -1205,17 +1490,17 @@ static HRESULT LayoutOrCacheContainerOrPayload(
 
         if (INVALID_HANDLE_VALUE != hPipe) // pass the decision off to the elevated process.
         {
-            hr = ElevationCacheOrLayoutContainerOrPayload(hPipe, pContainer, pPackage, pPayload, wzLayoutDirectory, wzUnverifiedPath, fMove);
+            hr = ElevationCacheOrLayoutContainerOrPayload(hPipe, pContainer, pPackage, pPayload, wzLayoutDirectory, wzUnverifiedPath, fMove, CacheVerifyProgressRoutine, &progress);
         }
         else if (wzLayoutDirectory) // layout the container or payload.
         {
             if (pContainer)
             {
-                hr = CacheLayoutContainer(pContainer, wzLayoutDirectory, wzUnverifiedPath, fMove);
+                hr = CacheLayoutContainer(pContainer, wzLayoutDirectory, wzUnverifiedPath, fMove, CacheVerifyProgressRoutine, &progress);
             }
             else
             {
-                hr = CacheLayoutPayload(pPayload, wzLayoutDirectory, wzUnverifiedPath, fMove);
+                hr = CacheLayoutPayload(pPayload, wzLayoutDirectory, wzUnverifiedPath, fMove, CacheVerifyProgressRoutine, &progress);
             }
         }
         else // complete the payload.
@@ -1223,7 +1508,7 @@ static HRESULT LayoutOrCacheContainerOrPayload(
             Assert(!pContainer);
             Assert(pPackage);
 
-            hr = CacheCompletePayload(pPackage->fPerMachine, pPayload, pPackage->sczCacheId, wzUnverifiedPath, fMove);
+            hr = CacheCompletePayload(pPackage->fPerMachine, pPayload, pPackage->sczCacheId, wzUnverifiedPath, fMove, CacheVerifyProgressRoutine, &progress);
         }
 
         // If succeeded, send 100% complete here. If the payload was already cached this is the first progress the BA
@@ -1231,14 +1516,12 @@ static HRESULT LayoutOrCacheContainerOrPayload(
         if (SUCCEEDED(hr))
         {
             CacheProgressRoutine(liContainerOrPayloadSize, liContainerOrPayloadSize, liZero, liZero, 0, 0, INVALID_HANDLE_VALUE, INVALID_HANDLE_VALUE, &progress);
-            if (progress.fCancel)
-            {
-                hr = HRESULT_FROM_WIN32(ERROR_INSTALL_USEREXIT);
-            }
-            else if (progress.fError)
-            {
-                hr = HRESULT_FROM_WIN32(ERROR_INSTALL_FAILURE);
-            }
+        }
+
+        // The BA may have stopped the verification itself, so check even when it failed.
+        if (progress.fCancel || progress.fError)
+        {
+            hr = progress.fCancel ? HRESULT_FROM_WIN32(ERROR_INSTALL_USEREXIT) : HRESULT_FROM_WIN32(ERROR_INSTALL_FAILURE);
             ExitOnRootFailure2(hr, "BA aborted verify of %hs: %ls", pContainer ? "container" : "payload", pContainer ? wzPackageOrContainerId : wzPayloadId);
         }
 
@@ -1488,6 +1771,13 @@ static DWORD CALLBACK CacheProgressRoutine(
 {
     DWORD dwResult = PROGRESS_CONTINUE;
     BURN_CACHE_ACQUIRE_PROGRESS_CONTEXT* pProgress = static_cast<BURN_CACHE_ACQUIRE_PROGRESS_CONTEXT*>(lpData);
+
+    // Acquire threads copy without a BA to report to, they only need to know when to stop.
+    if (!pProgress->pUX)
+    {
+        return pProgress->fCancel ? PROGRESS_CANCEL : PROGRESS_CONTINUE;
+    }
+
     LPCWSTR wzPackageOrContainerId = pProgress->pContainer ? pProgress->pContainer->sczId : pProgress->pPackage ? pProgress->pPackage->sczId : NULL;
     LPCWSTR wzPayloadId = pProgress->pPayload ? pProgress->pPayload->sczKey : NULL;
     DWORD64 qwCacheProgress = pProgress->qwCacheProgress + TotalBytesTransferred.QuadPart;
@@ -1528,6 +1818,194 @@ static DWORD CALLBACK CacheProgressRoutine(
     return dwResult;
 }
 
+//
+// CacheVerifyProgressRoutine - tells the BA how much of a container or payload
+//                              has been hashed while it is verified.
+//
+static HRESULT CacheVerifyProgressRoutine(
+    __in DWORD64 qwVerified,
+    __in DWORD64 qwTotal,
+    __in_opt LPVOID pvContext
+    )
+{
+    HRESULT hr = S_OK;
+    BURN_CACHE_ACQUIRE_PROGRESS_CONTEXT* pProgress = static_cast<BURN_CACHE_ACQUIRE_PROGRESS_CONTEXT*>(pvContext);
+    LPCWSTR wzPackageOrContainerId = pProgress->pContainer ? pProgress->pContainer->sczId : pProgress->pPackage ? pProgress->pPackage->sczId : NULL;
+    LPCWSTR wzPayloadId = pProgress->pPayload ? pProgress->pPayload->sczKey : NULL;
+
+    // The container or payload was counted when it was acquired so verifying it does not move overall progress.
+    DWORD64 qwCacheProgress = pProgress->qwCacheProgress + (pProgress->pContainer ? pProgress->pContainer->qwFileSize : pProgress->pPayload->qwFileSize);
+    if (qwCacheProgress > pProgress->qwTotalCacheSize)
+    {
+        qwCacheProgress = pProgress->qwTotalCacheSize;
+    }
+    DWORD dwOverallPercentage = pProgress->qwTotalCacheSize ? static_cast<DWORD>(qwCacheProgress * 100 / pProgress->qwTotalCacheSize) : 0;
+
+    int nResult = pProgress->pUX->pUserExperience->OnCacheVerifyProgress(wzPackageOrContainerId, wzPayloadId, qwVerified, qwTotal, dwOverallPercentage);
+    nResult = UserExperienceCheckExecuteResult(pProgress->pUX, FALSE, MB_OKCANCEL, nResult);
+    switch (nResult)
+    {
+    case IDOK: __fallthrough;
+    case IDNOACTION: __fallthrough;
+    case IDYES: __fallthrough;
+    case IDRETRY: __fallthrough;
+    case IDIGNORE: __fallthrough;
+    case IDTRYAGAIN: __fallthrough;
+    case IDCONTINUE:
+        break;
+
+    case IDCANCEL: __fallthrough;
+    case IDABORT: __fallthrough;
+    case IDNO:
+        hr = HRESULT_FROM_WIN32(ERROR_INSTALL_USEREXIT);
+        pProgress->fCancel = TRUE;
+        break;
+
+    case IDERROR: __fallthrough;
+    default:
+        hr = HRESULT_FROM_WIN32(ERROR_INSTALL_FAILURE);
+        pProgress->fError = TRUE;
+        break;
+    }
+
+    return hr;
+}
+
+//
+// ReportAcquiredProgress - tells the BA that a container or payload an acquire
+//                          thread already copied was transferred completely.
+//
+static HRESULT ReportAcquiredProgress(
+    __in BURN_CACHE_ACQUIRE_PROGRESS_CONTEXT* pProgress
+    )
+{
+    HRESULT hr = S_OK;
+    LARGE_INTEGER liFileSize = { };
+    LARGE_INTEGER liZero = { };
+
+    liFileSize.QuadPart = pProgress->pContainer ? pProgress->pContainer->qwFileSize : pProgress->pPayload->qwFileSize;
+
+    CacheProgressRoutine(liFileSize, liFileSize, liZero, liZero, 0, 0, INVALID_HANDLE_VALUE, INVALID_HANDLE_VALUE, pProgress);
+    if (pProgress->fCancel)
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_INSTALL_USEREXIT);
+    }
+    else if (pProgress->fError)
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_INSTALL_FAILURE);
+    }
+    ExitOnRootFailure(hr, "BA aborted acquire progress.");
+
+LExit:
+    return hr;
+}
+
+static DWORD WINAPI AcquireThreadProc(
+    __in LPVOID lpThreadParameter
+    )
+{
+    BURN_ACQUIRE_THREAD_CONTEXT* pContext = reinterpret_cast<BURN_ACQUIRE_THREAD_CONTEXT*>(lpThreadParameter);
+    BURN_CACHE_ACQUIRE_PROGRESS_CONTEXT* pProgress = pContext->rgProgress + (::InterlockedIncrement(&pContext->lNextThread) - 1);
+    LPWSTR sczSourceFullPath = NULL;
+
+    for (;;)
+    {
+        DWORD iEntry = static_cast<DWORD>(::InterlockedIncrement(&pContext->lNextAction) - 1);
+        if (iEntry >= pContext->cActions)
+        {
+            break;
+        }
+
+        DWORD iAction = pContext->rgiActions[iEntry];
+        BURN_CACHE_ACTION* pCacheAction = pContext->pPlan->rgCacheActions + iAction;
+        BOOL fTake = FALSE;
+        BOOL fStop = FALSE;
+
+        ::EnterCriticalSection(&pContext->cs);
+        fStop = pContext->fStop;
+        fTake = !fStop && BURN_ACQUIRE_STATE_NONE == pContext->rgState[iAction];
+        if (fTake)
+        {
+            pContext->rgState[iAction] = BURN_ACQUIRE_STATE_ACQUIRING;
+
+            memset(pProgress, 0, sizeof(BURN_CACHE_ACQUIRE_PROGRESS_CONTEXT));
+            pProgress->pContainer = BURN_CACHE_ACTION_TYPE_ACQUIRE_CONTAINER == pCacheAction->type ? pCacheAction->resolveContainer.pContainer : NULL;
+            pProgress->pPackage = BURN_CACHE_ACTION_TYPE_ACQUIRE_PAYLOAD == pCacheAction->type ? pCacheAction->resolvePayload.pPackage : NULL;
+            pProgress->pPayload = BURN_CACHE_ACTION_TYPE_ACQUIRE_PAYLOAD == pCacheAction->type ? pCacheAction->resolvePayload.pPayload : NULL;
+        }
+        ::LeaveCriticalSection(&pContext->cs);
+
+        if (fStop)
+        {
+            break;
+        }
+        else if (!fTake) // the cache thread got there first.
+        {
+            continue;
+        }
+
+        HRESULT hr = AcquireAhead(pContext->pVariables, pCacheAction, pContext->rgsczSourcePath[iEntry], pProgress, &sczSourceFullPath);
+
+        ::EnterCriticalSection(&pContext->cs);
+        if (S_OK == hr)
+        {
+            pContext->rgState[iAction] = BURN_ACQUIRE_STATE_ACQUIRED;
+            pContext->rgsczAcquiredFrom[iAction] = sczSourceFullPath;
+            sczSourceFullPath = NULL;
+        }
+        else
+        {
+            pContext->rgState[iAction] = BURN_ACQUIRE_STATE_NOT_ACQUIRED;
+        }
+        ::LeaveCriticalSection(&pContext->cs);
+
+        ReleaseNullStr(sczSourceFullPath);
+        ::SetEvent(pContext->hAcquired);
+    }
+
+    return 0;
+}
+
+//
+// AcquireAhead - copies a container or payload to its working path on an acquire
+//                thread. Returns S_FALSE when there is nothing to copy or the file
+//                was not found, so the cache thread acquires it the usual way.
+//
+static HRESULT AcquireAhead(
+    __in BURN_VARIABLES* pVariables,
+    __in BURN_CACHE_ACTION* pCacheAction,
+    __in_z LPCWSTR wzSourcePath,
+    __in BURN_CACHE_ACQUIRE_PROGRESS_CONTEXT* pProgress,
+    __out_z LPWSTR* psczSourceFullPath
+    )
+{
+    HRESULT hr = S_OK;
+    LPCWSTR wzDestinationPath = BURN_CACHE_ACTION_TYPE_ACQUIRE_CONTAINER == pCacheAction->type ? pCacheAction->resolveContainer.sczUnverifiedPath : pCacheAction->resolvePayload.sczUnverifiedPath;
+    BOOL fFoundLocal = FALSE;
+    int nEquivalentPaths = 0;
+
+    hr = CacheFindLocalSource(wzSourcePath, pVariables, &fFoundLocal, psczSourceFullPath);
+    ExitOnFailure(hr, "Failed to search local source.");
+
+    if (!fFoundLocal)
+    {
+        ExitFunction1(hr = S_FALSE);
+    }
+
+    hr = PathCompare(*psczSourceFullPath, wzDestinationPath, &nEquivalentPaths);
+    ExitOnFailure(hr, "Failed to determine if payload source path was equivalent to the destination path.");
+
+    if (CSTR_EQUAL == nEquivalentPaths)
+    {
+        ExitFunction1(hr = S_FALSE);
+    }
+
+    hr = CopyPayload(pProgress, *psczSourceFullPath, wzDestinationPath);
+
+LExit:
+    return hr;
+}
+
 static void DoRollbackCache(
     __in BURN_USER_EXPERIENCE* /*pUX*/,
     __in BURN_PLAN* pPlan,
@@ -7,6 +7,49 @@ extern "C" {
 #endif
 
 
+const DWORD BURN_CACHE_MAX_ACQUIRE_THREADS = 4;
+
+enum BURN_ACQUIRE_STATE
+{
+    BURN_ACQUIRE_STATE_NONE,        // no acquire thread took the action (yet).
+    BURN_ACQUIRE_STATE_ACQUIRING,   // an acquire thread is copying the container or payload.
+    BURN_ACQUIRE_STATE_ACQUIRED,    // an acquire thread copied the container or payload to its working path.
+    BURN_ACQUIRE_STATE_NOT_ACQUIRED, // an acquire thread could not (or did not need to) copy it.
+    BURN_ACQUIRE_STATE_TAKEN,       // the cache thread reached the action, so acquire threads leave it alone.
+};
+
+typedef struct _BURN_CACHE_ACQUIRE_PROGRESS_CONTEXT
+{
+    BURN_USER_EXPERIENCE* pUX;
+    BURN_CONTAINER* pContainer;
+    BURN_PACKAGE* pPackage;
+    BURN_PAYLOAD* pPayload;
+    DWORD64 qwCacheProgress;
+    DWORD64 qwTotalCacheSize;
+
+    BOOL fCancel;
+    BOOL fError;
+} BURN_CACHE_ACQUIRE_PROGRESS_CONTEXT;
+
+typedef struct _BURN_ACQUIRE_THREAD_CONTEXT
+{
+    BURN_PLAN* pPlan;
+    BURN_VARIABLES* pVariables;
+    CRITICAL_SECTION cs;
+    HANDLE hAcquired;               // auto-reset, set each time an acquire thread finishes an action.
+    volatile LONG lNextAction;      // next entry in rgiActions for an acquire thread to take.
+    volatile LONG lNextThread;      // next entry in rgProgress for a starting acquire thread.
+    BOOL fStop;                     // guarded by cs, set when cache ends so the acquire threads stop taking actions.
+
+    DWORD* rgiActions;              // acquire actions the acquire threads may take, in plan order.
+    LPWSTR* rgsczSourcePath;        // source paths captured before the BA can change them, parallel to rgiActions.
+    DWORD cActions;
+
+    BURN_ACQUIRE_STATE* rgState;    // guarded by cs, one per cache action.
+    LPWSTR* rgsczAcquiredFrom;      // guarded by cs, one per cache action.
+    BURN_CACHE_ACQUIRE_PROGRESS_CONTEXT rgProgress[BURN_CACHE_MAX_ACQUIRE_THREADS]; // fCancel guarded by cs.
+} BURN_ACQUIRE_THREAD_CONTEXT;
+
 enum GENERIC_EXECUTE_MESSAGE_TYPE
 {
     GENERIC_EXECUTE_MESSAGE_NONE,
@@ -99,6 +142,23 @@ void ApplyClean(
     __in BURN_PLAN* pPlan,
     __in HANDLE hPipe
     );
+HRESULT ApplyStartAcquireThreads(
+    __in BURN_PLAN* pPlan,
+    __in BURN_VARIABLES* pVariables,
+    __in BURN_ACQUIRE_THREAD_CONTEXT* pContext,
+    __in_ecount(BURN_CACHE_MAX_ACQUIRE_THREADS) HANDLE* rghThreads,
+    __out DWORD* pcThreads
+    );
+HRESULT ApplyTakeAcquiredContainerOrPayload(
+    __in BURN_ACQUIRE_THREAD_CONTEXT* pContext,
+    __in DWORD iAction,
+    __out_z LPWSTR* psczAcquiredFrom
+    );
+void ApplyStopAcquireThreads(
+    __in BURN_ACQUIRE_THREAD_CONTEXT* pContext,
+    __in_ecount(cThreads) HANDLE* rghThreads,
+    __in DWORD cThreads
+    );
 
 
 #ifdef __cplusplus
@@ -55,6 +55,10 @@ static INT_PTR CloseFileInfoCallback(
     __in BURN_CONTAINER_CONTEXT* pContext,
     __inout FDINOTIFICATION *pFDINotify
     );
+static HRESULT CreateTargetFile(
+    __in BURN_CONTAINER_CONTEXT* pContext,
+    __in LONG cbFile
+    );
 static LPVOID DIAMONDAPI CabAlloc(
     __in DWORD dwSize
     );
@@ -109,6 +113,9 @@ static BURN_CONTAINER_CONTEXT_CABINET_VIRTUAL_FILE_POINTER* GetVirtualFilePointe
     __in BURN_CONTAINER_CONTEXT_CABINET* pCabinetContext,
     __in HANDLE hFile
     );
+static void ReleaseTargetHash(
+    __in BURN_CONTAINER_CONTEXT_CABINET* pCabinetContext
+    );
 
 
 // internal variables
@@ -178,7 +185,9 @@ LExit:
 
 extern "C" HRESULT CabExtractStreamToFile(
     __in BURN_CONTAINER_CONTEXT* pContext,
-    __in_z LPCWSTR wzFileName
+    __in_z LPCWSTR wzFileName,
+    __out_bcount_opt(cbHash) BYTE* pbHash,
+    __in DWORD cbHash
     )
 {
     HRESULT hr = S_OK;
@@ -187,6 +196,10 @@ extern "C" HRESULT CabExtractStreamToFile(
     pContext->Cabinet.operation = BURN_CAB_OPERATION_STREAM_TO_FILE;
     pContext->Cabinet.wzTargetFile = wzFileName;
 
+    // if requested, hash the stream as it is written
+    pContext->Cabinet.pbTargetHash = pbHash;
+    pContext->Cabinet.cbTargetHash = cbHash;
+
     // begin operation and wait
     hr = BeginAndWaitForOperation(pContext);
     ExitOnFailure(hr, "Failed to begin and wait for operation.");
@@ -195,6 +208,9 @@ extern "C" HRESULT CabExtractStreamToFile(
     pContext->Cabinet.wzTargetFile = NULL;
 
 LExit:
+    pContext->Cabinet.pbTargetHash = NULL;
+    pContext->Cabinet.cbTargetHash = 0;
+
     return hr;
 }
 
@@ -243,6 +259,53 @@ LExit:
     return hr;
 }
 
+extern "C" HRESULT CabExtractStreams(
+    __in BURN_CONTAINER_CONTEXT* pContext,
+    __in_ecount(cStreams) BURN_CONTAINER_EXTRACT_STREAM* rgStreams,
+    __in DWORD cStreams
+    )
+{
+    HRESULT hr = S_OK;
+
+    // index the wanted streams so the extraction thread can look them up without asking the caller
+    hr = DictCreateWithEmbeddedKey(&pContext->Cabinet.sdExtractStreams, cStreams, NULL, offsetof(BURN_CONTAINER_EXTRACT_STREAM, wzStreamName), DICT_FLAG_NONE);
+    ExitOnFailure(hr, "Failed to create dictionary for streams to extract.");
+
+    for (DWORD i = 0; i < cStreams; ++i)
+    {
+        rgStreams[i].fExtracted = FALSE;
+
+        // the first request for a stream wins
+        hr = DictKeyExists(pContext->Cabinet.sdExtractStreams, rgStreams[i].wzStreamName);
+        if (E_NOTFOUND != hr)
+        {
+            ExitOnFailure1(hr, "Failed to check for stream to extract: %ls", rgStreams[i].wzStreamName);
+            continue;
+        }
+
+        hr = DictAddValue(pContext->Cabinet.sdExtractStreams, rgStreams + i);
+        ExitOnFailure1(hr, "Failed to add stream to extract: %ls", rgStreams[i].wzStreamName);
+    }
+
+    pContext->Cabinet.rgExtractStreams = rgStreams;
+    pContext->Cabinet.cExtractStreams = cStreams;
+
+    // set operation to extract the rest of the cabinet in a single pass
+    pContext->Cabinet.operation = BURN_CAB_OPERATION_EXTRACT_STREAMS;
+
+    // begin operation and wait, the operation completes when the end of the cabinet is reached
+    hr = BeginAndWaitForOperation(pContext);
+    ExitOnFailure(hr, "Failed to begin and wait for operation.");
+
+LExit:
+    ReleaseNullDict(pContext->Cabinet.sdExtractStreams);
+    pContext->Cabinet.rgExtractStreams = NULL;
+    pContext->Cabinet.cExtractStreams = 0;
+    pContext->Cabinet.pExtractStream = NULL;
+
+    return hr;
+}
+
 extern "C" HRESULT CabExtractClose(
     __in BURN_CONTAINER_CONTEXT* pContext
     )
@@ -274,6 +337,12 @@ LExit:
     ReleaseHandle(pContext->Cabinet.hOperationCompleteEvent);
     ReleaseMem(pContext->Cabinet.rgVirtualFilePointers);
     ReleaseStr(pContext->Cabinet.sczFile);
+    ReleaseTargetHash(&pContext->Cabinet);
+    if (pContext->Cabinet.hTargetHashProv)
+    {
+        ::CryptReleaseContext(pContext->Cabinet.hTargetHashProv, 0);
+        pContext->Cabinet.hTargetHashProv = NULL;
+    }
 
     return hr;
 }
@@ -423,36 +492,43 @@ static DWORD WINAPI ExtractThreadProc(
         ExitOnFailure3(hr, "Failed to extract all files from container, erf: %d:%X:%d", erf.fError, erf.erfOper, erf.erfType);
     }
 
-    // set operation complete event
-    if (!::SetEvent(pContext->Cabinet.hOperationCompleteEvent))
+    for (;;)
     {
-        ExitWithLastError(hr, "Failed to set operation complete event.");
-    }
+        // set operation complete event
+        if (!::SetEvent(pContext->Cabinet.hOperationCompleteEvent))
+        {
+            ExitWithLastError(hr, "Failed to set operation complete event.");
+        }
 
-    // wait for begin operation event
-    if (WAIT_FAILED == ::WaitForSingleObject(pContext->Cabinet.hBeginOperationEvent, INFINITE))
-    {
-        ExitWithLastError(hr, "Failed to wait for begin operation event.");
-    }
+        // wait for begin operation event
+        if (WAIT_FAILED == ::WaitForSingleObject(pContext->Cabinet.hBeginOperationEvent, INFINITE))
+        {
+            ExitWithLastError(hr, "Failed to wait for begin operation event.");
+        }
 
-    if (!::ResetEvent(pContext->Cabinet.hBeginOperationEvent))
-    {
-        ExitWithLastError(hr, "Failed to reset begin operation event.");
-    }
+        if (!::ResetEvent(pContext->Cabinet.hBeginOperationEvent))
+        {
+            ExitWithLastError(hr, "Failed to reset begin operation event.");
+        }
 
-    // read operation
-    switch (pContext->Cabinet.operation)
-    {
-    case BURN_CAB_OPERATION_NEXT_STREAM:
-        ExitFunction1(hr = E_NOMOREITEMS);
-        break;
+        // read operation
+        switch (pContext->Cabinet.operation)
+        {
+        case BURN_CAB_OPERATION_NEXT_STREAM:
+            ExitFunction1(hr = E_NOMOREITEMS);
+            break;
 
-    case BURN_CAB_OPERATION_CLOSE:
-        ExitFunction1(hr = S_OK);
+        case BURN_CAB_OPERATION_EXTRACT_STREAMS:
+            // there are no streams left so there is nothing to extract, complete the operation and wait for the next one
+            break;
 
-    default:
-        hr = E_INVALIDSTATE;
-        ExitOnRootFailure(hr, "Invalid operation for this state.");
+        case BURN_CAB_OPERATION_CLOSE:
+            ExitFunction1(hr = S_OK);
+
+        default:
+            hr = E_INVALIDSTATE;
+            ExitOnRootFailure(hr, "Invalid operation for this state.");
+        }
     }
 
 LExit:
@@ -508,23 +584,28 @@ static INT_PTR CopyFileCallback(
     HRESULT hr = S_OK;
     INT_PTR ipResult = 1; // result to return on success
     LPWSTR pwzPath = NULL;
-    LARGE_INTEGER li = { };
+    BURN_CONTAINER_EXTRACT_STREAM* pExtractStream = NULL;
 
-    // set operation complete event
-    if (!::SetEvent(pContext->Cabinet.hOperationCompleteEvent))
+    // When extracting streams in a single pass, the caller already said which streams it wants and is waiting
+    // for the end of the cabinet so there is no need to stop at every stream.
+    if (BURN_CAB_OPERATION_EXTRACT_STREAMS != pContext->Cabinet.operation)
     {
-        ExitWithLastError(hr, "Failed to set operation complete event.");
-    }
+        // set operation complete event
+        if (!::SetEvent(pContext->Cabinet.hOperationCompleteEvent))
+        {
+            ExitWithLastError(hr, "Failed to set operation complete event.");
+        }
 
-    // wait for begin operation event
-    if (WAIT_FAILED == ::WaitForSingleObject(pContext->Cabinet.hBeginOperationEvent, INFINITE))
-    {
-        ExitWithLastError(hr, "Failed to wait for begin operation event.");
-    }
+        // wait for begin operation event
+        if (WAIT_FAILED == ::WaitForSingleObject(pContext->Cabinet.hBeginOperationEvent, INFINITE))
+        {
+            ExitWithLastError(hr, "Failed to wait for begin operation event.");
+        }
 
-    if (!::ResetEvent(pContext->Cabinet.hBeginOperationEvent))
-    {
-        ExitWithLastError(hr, "Failed to reset begin operation event.");
+        if (!::ResetEvent(pContext->Cabinet.hBeginOperationEvent))
+        {
+            ExitWithLastError(hr, "Failed to reset begin operation event.");
+        }
     }
 
     // read operation
@@ -533,6 +614,28 @@ static INT_PTR CopyFileCallback(
     case BURN_CAB_OPERATION_NEXT_STREAM:
         break;
 
+    case BURN_CAB_OPERATION_EXTRACT_STREAMS:
+        hr = StrAllocStringAnsi(&pwzPath, pFDINotify->psz1, 0, CP_UTF8);
+        ExitOnFailure1(hr, "Failed to copy stream name: %hs", pFDINotify->psz1);
+
+        hr = DictGetValue(pContext->Cabinet.sdExtractStreams, pwzPath, reinterpret_cast<void**>(&pExtractStream));
+        if (E_NOTFOUND == hr)
+        {
+            // not wanted, skip it
+            ipResult = 0;
+            ExitFunction1(hr = S_OK);
+        }
+        ExitOnFailure1(hr, "Failed to find stream to extract: %ls", pwzPath);
+
+        pContext->Cabinet.pExtractStream = pExtractStream;
+        pContext->Cabinet.wzTargetFile = pExtractStream->wzTargetFile;
+        pContext->Cabinet.pbTargetHash = pExtractStream->pbHash;
+        pContext->Cabinet.cbTargetHash = pExtractStream->cbHash;
+
+        hr = CreateTargetFile(pContext, pFDINotify->cb);
+        ExitOnFailure1(hr, "Failed to create target for stream: %ls", pwzPath);
+        ExitFunction();
+
     case BURN_CAB_OPERATION_CLOSE:
         ExitFunction1(hr = E_ABORT);
 
@@ -566,31 +669,8 @@ static INT_PTR CopyFileCallback(
     switch (pContext->Cabinet.operation)
     {
     case BURN_CAB_OPERATION_STREAM_TO_FILE:
-        // create file
-        pContext->Cabinet.hTargetFile = ::CreateFileW(pContext->Cabinet.wzTargetFile, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
-        if (INVALID_HANDLE_VALUE == pContext->Cabinet.hTargetFile)
-        {
-            ExitWithLastError1(hr, "Failed to create file: %ls", pContext->Cabinet.wzTargetFile);
-        }
-
-        // set file size
-        li.QuadPart = pFDINotify->cb;
-        if (!::SetFilePointerEx(pContext->Cabinet.hTargetFile, li, NULL, FILE_BEGIN))
-        {
-            ExitWithLastError(hr, "Failed to set file pointer to end of file.");
-        }
-
-        if (!::SetEndOfFile(pContext->Cabinet.hTargetFile))
-        {
-            ExitWithLastError(hr, "Failed to set end of file.");
-        }
-
-        li.QuadPart = 0;
-        if (!::SetFilePointerEx(pContext->Cabinet.hTargetFile, li, NULL, FILE_BEGIN))
-        {
-            ExitWithLastError(hr, "Failed to set file pointer to beginning of file.");
-        }
-
+        hr = CreateTargetFile(pContext, pFDINotify->cb);
+        ExitOnFailure(hr, "Failed to create target for stream.");
         break;
 
     case BURN_CAB_OPERATION_STREAM_TO_BUFFER:
@@ -636,6 +716,7 @@ static INT_PTR CloseFileInfoCallback(
     // read operation
     switch (pContext->Cabinet.operation)
     {
+    case BURN_CAB_OPERATION_EXTRACT_STREAMS: __fallthrough;
     case BURN_CAB_OPERATION_STREAM_TO_FILE:
         // Make a best effort to set the time on the new file before
         // we close it.
@@ -649,6 +730,33 @@ static INT_PTR CloseFileInfoCallback(
 
         // close file
         ReleaseFile(pContext->Cabinet.hTargetFile);
+
+        // get hash value
+        if (pContext->Cabinet.hTargetHash)
+        {
+            DWORD cbHash = pContext->Cabinet.cbTargetHash;
+            if (!::CryptGetHashParam(pContext->Cabinet.hTargetHash, HP_HASHVAL, pContext->Cabinet.pbTargetHash, &cbHash, 0))
+            {
+                ExitWithLastError(hr, "Failed to get hash value.");
+            }
+
+            ReleaseTargetHash(&pContext->Cabinet);
+
+            if (pContext->Cabinet.pExtractStream)
+            {
+                pContext->Cabinet.pExtractStream->fHashed = TRUE;
+            }
+        }
+
+        // in a single pass the target belongs to this stream only
+        if (pContext->Cabinet.pExtractStream)
+        {
+            pContext->Cabinet.pExtractStream->fExtracted = TRUE;
+            pContext->Cabinet.pExtractStream = NULL;
+            pContext->Cabinet.wzTargetFile = NULL;
+            pContext->Cabinet.pbTargetHash = NULL;
+            pContext->Cabinet.cbTargetHash = 0;
+        }
         break;
 
     case BURN_CAB_OPERATION_STREAM_TO_BUFFER:
@@ -682,6 +790,75 @@ LExit:
     return SUCCEEDED(hr) ? ipResult : -1;
 }
 
+static HRESULT CreateTargetFile(
+    __in BURN_CONTAINER_CONTEXT* pContext,
+    __in LONG cbFile
+    )
+{
+    HRESULT hr = S_OK;
+    LARGE_INTEGER li = { };
+    DWORD dwHashProvType = 0;
+    ALG_ID algidHash = 0;
+
+    // create file
+    pContext->Cabinet.hTargetFile = ::CreateFileW(pContext->Cabinet.wzTargetFile, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (INVALID_HANDLE_VALUE == pContext->Cabinet.hTargetFile)
+    {
+        ExitWithLastError1(hr, "Failed to create file: %ls", pContext->Cabinet.wzTargetFile);
+    }
+
+    // set file size
+    li.QuadPart = cbFile;
+    if (!::SetFilePointerEx(pContext->Cabinet.hTargetFile, li, NULL, FILE_BEGIN))
+    {
+        ExitWithLastError(hr, "Failed to set file pointer to end of file.");
+    }
+
+    if (!::SetEndOfFile(pContext->Cabinet.hTargetFile))
+    {
+        ExitWithLastError(hr, "Failed to set end of file.");
+    }
+
+    li.QuadPart = 0;
+    if (!::SetFilePointerEx(pContext->Cabinet.hTargetFile, li, NULL, FILE_BEGIN))
+    {
+        ExitWithLastError(hr, "Failed to set file pointer to beginning of file.");
+    }
+
+    // begin hash of the stream, the crypto context is reused while the streams use the same provider
+    if (pContext->Cabinet.pbTargetHash)
+    {
+        hr = CacheGetHashAlgorithm(pContext->Cabinet.cbTargetHash, &dwHashProvType, &algidHash);
+        ExitOnFailure(hr, "Failed to get hash algorithm for stream.");
+
+        ReleaseTargetHash(&pContext->Cabinet);
+
+        if (pContext->Cabinet.hTargetHashProv && dwHashProvType != pContext->Cabinet.dwTargetHashProvType)
+        {
+            ::CryptReleaseContext(pContext->Cabinet.hTargetHashProv, 0);
+            pContext->Cabinet.hTargetHashProv = NULL;
+        }
+
+        if (!pContext->Cabinet.hTargetHashProv)
+        {
+            if (!::CryptAcquireContextW(&pContext->Cabinet.hTargetHashProv, NULL, NULL, dwHashProvType, CRYPT_VERIFYCONTEXT | CRYPT_SILENT))
+            {
+                ExitWithLastError(hr, "Failed to acquire crypto context.");
+            }
+
+            pContext->Cabinet.dwTargetHashProvType = dwHashProvType;
+        }
+
+        if (!::CryptCreateHash(pContext->Cabinet.hTargetHashProv, algidHash, 0, 0, &pContext->Cabinet.hTargetHash))
+        {
+            ExitWithLastError(hr, "Failed to initiate hash.");
+        }
+    }
+
+LExit:
+    return hr;
+}
+
 static LPVOID DIAMONDAPI CabAlloc(
     __in DWORD dwSize
     )
@@ -765,12 +942,19 @@ static UINT FAR DIAMONDAPI CabWrite(
 
     switch (pContext->Cabinet.operation)
     {
+    case BURN_CAB_OPERATION_EXTRACT_STREAMS: __fallthrough;
     case BURN_CAB_OPERATION_STREAM_TO_FILE:
         // write file
         if (!::WriteFile(pContext->Cabinet.hTargetFile, pv, cb, &cbWrite, NULL))
         {
             ExitWithLastError(hr, "Failed to write during cabinet extraction.");
         }
+
+        // hash what was written
+        if (pContext->Cabinet.hTargetHash && !::CryptHashData(pContext->Cabinet.hTargetHash, reinterpret_cast<BYTE*>(pv), cbWrite, 0))
+        {
+            ExitWithLastError(hr, "Failed to hash data block during cabinet extraction.");
+        }
         break;
 
     case BURN_CAB_OPERATION_STREAM_TO_BUFFER:
@@ -972,3 +1156,14 @@ static BURN_CONTAINER_CONTEXT_CABINET_VIRTUAL_FILE_POINTER* GetVirtualFilePointe
 
     return NULL;
 }
+
+static void ReleaseTargetHash(
+    __in BURN_CONTAINER_CONTEXT_CABINET* pCabinetContext
+    )
+{
+    if (pCabinetContext->hTargetHash)
+    {
+        ::CryptDestroyHash(pCabinetContext->hTargetHash);
+        pCabinetContext->hTargetHash = NULL;
+    }
+}
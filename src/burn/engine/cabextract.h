@@ -20,7 +20,9 @@ HRESULT CabExtractNextStream(
     );
 HRESULT CabExtractStreamToFile(
     __in BURN_CONTAINER_CONTEXT* pContext,
-    __in_z LPCWSTR wzFileName
+    __in_z LPCWSTR wzFileName,
+    __out_bcount_opt(cbHash) BYTE* pbHash,
+    __in DWORD cbHash
     );
 HRESULT CabExtractStreamToBuffer(
     __in BURN_CONTAINER_CONTEXT* pContext,
@@ -30,6 +32,11 @@ HRESULT CabExtractStreamToBuffer(
 HRESULT CabExtractSkipStream(
     __in BURN_CONTAINER_CONTEXT* pContext
     );
+HRESULT CabExtractStreams(
+    __in BURN_CONTAINER_CONTEXT* pContext,
+    __in_ecount(cStreams) BURN_CONTAINER_EXTRACT_STREAM* rgStreams,
+    __in DWORD cStreams
+    );
 HRESULT CabExtractClose(
     __in BURN_CONTAINER_CONTEXT* pContext
     );
@@ -5,6 +5,9 @@
 static const LPCWSTR BUNDLE_CLEAN_ROOM_WORKING_FOLDER_NAME = L".cr";
 static const LPCWSTR BUNDLE_WORKING_FOLDER_NAME = L".be";
 static const LPCWSTR UNVERIFIED_CACHE_FOLDER_NAME = L".unverified";
+static const LPCWSTR CONTENT_STORE_FOLDER_NAME = L".store";
+static const LPCWSTR VERIFIED_JOURNAL_FOLDER_NAME = L".journal";
+static const DWORD VERIFIED_JOURNAL_RECORD_VERSION = 1;
 static const LPCWSTR PACKAGE_CACHE_FOLDER_NAME = L"Package Cache";
 static const DWORD FILE_OPERATION_RETRY_COUNT = 3;
 static const DWORD FILE_OPERATION_RETRY_WAIT = 2000;
@@ -46,13 +49,17 @@ static HRESULT VerifyThenTransferContainer(
     __in BURN_CONTAINER* pContainer,
     __in_z LPCWSTR wzCachedPath,
     __in_z LPCWSTR wzUnverifiedContainerPath,
-    __in BOOL fMove
+    __in BOOL fMove,
+    __in_opt PFN_CRYPHASHPROGRESS pfnVerifyProgress,
+    __in_opt LPVOID pvContext
     );
 static HRESULT VerifyThenTransferPayload(
     __in BURN_PAYLOAD* pPayload,
     __in_z LPCWSTR wzCachedPath,
     __in_z LPCWSTR wzUnverifiedPayloadPath,
-    __in BOOL fMove
+    __in BOOL fMove,
+    __in_opt PFN_CRYPHASHPROGRESS pfnVerifyProgress,
+    __in_opt LPVOID pvContext
     );
 static HRESULT TransferWorkingPathToUnverifiedPath(
     __in_z LPCWSTR wzWorkingPath,
@@ -61,7 +68,15 @@ static HRESULT TransferWorkingPathToUnverifiedPath(
     );
 static HRESULT VerifyFileAgainstPayload(
     __in BURN_PAYLOAD* pPayload,
-    __in_z LPCWSTR wzVerifyPath
+    __in_z LPCWSTR wzVerifyPath,
+    __in_bcount_opt(pPayload->cbHash) BYTE* pbActualHash,
+    __in BOOL fPerMachine,
+    __in_z_opt LPCWSTR wzJournalFolder,
+    __in_opt PFN_CRYPHASHPROGRESS pfnVerifyProgress,
+    __in_opt LPVOID pvContext
+    );
+static DWORD GetPayloadVerifyFileFlags(
+    __in BURN_PAYLOAD* pPayload
     );
 static HRESULT ResetPathPermissions(
     __in BOOL fPerMachine,
@@ -70,6 +85,9 @@ static HRESULT ResetPathPermissions(
 static HRESULT SecurePath(
     __in LPCWSTR wzPath
     );
+static BOOL IsOwnedByAdministratorsOrSystem(
+    __in_z LPCWSTR wzPath
+    );
 static HRESULT CopyEngineToWorkingFolder(
     __in_z LPCWSTR wzSourcePath,
     __in_z LPCWSTR wzWorkingFolderName,
@@ -90,11 +108,63 @@ static HRESULT RemoveBundleOrPackage(
     __in_z LPCWSTR wzBundleOrPackageId,
     __in_z LPCWSTR wzCacheId
     );
+static HRESULT GetContentStorePath(
+    __in BOOL fPerMachine,
+    __in BURN_PAYLOAD* pPayload,
+    __out_z LPWSTR* psczStorePath
+    );
+static HRESULT LinkFromContentStore(
+    __in BOOL fPerMachine,
+    __in_z LPCWSTR wzStorePath,
+    __in_z LPCWSTR wzCachedPath
+    );
+static void AddToContentStore(
+    __in_z LPCWSTR wzCachedPath,
+    __in_z LPCWSTR wzStorePath
+    );
+static void RemoveUnreferencedContent(
+    __in BOOL fPerMachine
+    );
+static HRESULT CreateJournalRecord(
+    __in BURN_PAYLOAD* pPayload,
+    __in const BY_HANDLE_FILE_INFORMATION* pFileInfo,
+    __deref_out_bcount(*pcbRecord) BYTE** ppbRecord,
+    __out SIZE_T* pcbRecord
+    );
+static HRESULT GetJournalRecordPath(
+    __in_z LPCWSTR wzJournalFolder,
+    __in const BY_HANDLE_FILE_INFORMATION* pFileInfo,
+    __out_z LPWSTR* psczRecordPath
+    );
+static BOOL JournalFindVerified(
+    __in BOOL fPerMachine,
+    __in_z LPCWSTR wzJournalFolder,
+    __in BURN_PAYLOAD* pPayload,
+    __in HANDLE hFile
+    );
+static void JournalRecordVerified(
+    __in BOOL fPerMachine,
+    __in_z LPCWSTR wzJournalFolder,
+    __in BURN_PAYLOAD* pPayload,
+    __in_z LPCWSTR wzPath
+    );
+static void JournalForgetFile(
+    __in_z LPCWSTR wzJournalFolder,
+    __in_z LPCWSTR wzPath,
+    __in BOOL fLastLinkOnly
+    );
+static void JournalForgetDirectory(
+    __in_z LPCWSTR wzJournalFolder,
+    __in_z LPCWSTR wzDirectory
+    );
 static HRESULT VerifyHash(
     __in BYTE* pbHash,
     __in DWORD cbHash,
+    __in_bcount_opt(cbHash) BYTE* pbActualHash,
     __in_z LPCWSTR wzUnverifiedPayloadPath,
-    __in HANDLE hFile
+    __in HANDLE hFile,
+    __in_opt PFN_CRYPHASHPROGRESS pfnVerifyProgress,
+    __in_opt LPVOID pvContext
     );
 static HRESULT VerifyPayloadWithCatalog(
     __in BURN_PAYLOAD* pPayload,
@@ -119,10 +189,18 @@ extern "C" HRESULT CacheInitialize(
     LPWSTR sczCompletedPath = NULL;
     LPWSTR sczOriginalSource = NULL;
     LPWSTR sczOriginalSourceFolder = NULL;
+    LPWSTR sczRootPath = NULL;
     int nCompare = 0;
 
     if (!vfInitializedCache)
     {
+        // Resolve both package cache roots up front because detect may read them from several threads at once.
+        hr = GetRootPath(TRUE, TRUE, &sczRootPath);
+        ExitOnFailure1(hr, "Failed to get %hs package cache root directory.", "per-machine");
+
+        hr = GetRootPath(FALSE, TRUE, &sczRootPath);
+        ExitOnFailure1(hr, "Failed to get %hs package cache root directory.", "per-user");
+
         hr = PathForCurrentProcess(&sczCurrentPath, NULL);
         ExitOnFailure(hr, "Failed to get current process path.");
 
@@ -186,6 +264,7 @@ LExit:
     ReleaseStr(sczCompletedPath);
     ReleaseStr(sczOriginalSource);
     ReleaseStr(sczOriginalSourceFolder);
+    ReleaseStr(sczRootPath);
 
     return hr;
 }
@@ -803,7 +882,7 @@ extern "C" HRESULT CacheCompleteBundle(
             hr = PathConcat(sczSourceDirectory, pPayload->sczSourcePath, &sczPayloadSourcePath);
             ExitOnFailure(hr, "Failed to build payload source path.");
 
-            hr = CacheCompletePayload(fPerMachine, pPayload, wzBundleId, sczPayloadSourcePath, FALSE);
+            hr = CacheCompletePayload(fPerMachine, pPayload, wzBundleId, sczPayloadSourcePath, FALSE, NULL, NULL);
             ExitOnFailure1(hr, "Failed to complete the cache of payload: %ls", pPayload->sczKey);
         }
     }
@@ -821,7 +900,9 @@ extern "C" HRESULT CacheLayoutContainer(
     __in BURN_CONTAINER* pContainer,
     __in_z_opt LPCWSTR wzLayoutDirectory,
     __in_z LPCWSTR wzUnverifiedContainerPath,
-    __in BOOL fMove
+    __in BOOL fMove,
+    __in_opt PFN_CRYPHASHPROGRESS pfnVerifyProgress,
+    __in_opt LPVOID pvContext
     )
 {
     HRESULT hr = S_OK;
@@ -830,7 +911,7 @@ extern "C" HRESULT CacheLayoutContainer(
     hr = PathConcat(wzLayoutDirectory, pContainer->sczFilePath, &sczCachedPath);
     ExitOnFailure(hr, "Failed to concat complete cached path.");
 
-    hr = VerifyThenTransferContainer(pContainer, sczCachedPath, wzUnverifiedContainerPath, fMove);
+    hr = VerifyThenTransferContainer(pContainer, sczCachedPath, wzUnverifiedContainerPath, fMove, pfnVerifyProgress, pvContext);
     ExitOnFailure1(hr, "Failed to layout container from cached path: %ls", sczCachedPath);
 
 LExit:
@@ -843,7 +924,9 @@ extern "C" HRESULT CacheLayoutPayload(
     __in BURN_PAYLOAD* pPayload,
     __in_z_opt LPCWSTR wzLayoutDirectory,
     __in_z LPCWSTR wzUnverifiedPayloadPath,
-    __in BOOL fMove
+    __in BOOL fMove,
+    __in_opt PFN_CRYPHASHPROGRESS pfnVerifyProgress,
+    __in_opt LPVOID pvContext
     )
 {
     HRESULT hr = S_OK;
@@ -852,7 +935,7 @@ extern "C" HRESULT CacheLayoutPayload(
     hr = PathConcat(wzLayoutDirectory, pPayload->sczFilePath, &sczCachedPath);
     ExitOnFailure(hr, "Failed to concat complete cached path.");
 
-    hr = VerifyThenTransferPayload(pPayload, sczCachedPath, wzUnverifiedPayloadPath, fMove);
+    hr = VerifyThenTransferPayload(pPayload, sczCachedPath, wzUnverifiedPayloadPath, fMove, pfnVerifyProgress, pvContext);
     ExitOnFailure1(hr, "Failed to layout payload from cached payload: %ls", sczCachedPath);
 
 LExit:
@@ -866,13 +949,26 @@ extern "C" HRESULT CacheCompletePayload(
     __in BURN_PAYLOAD* pPayload,
     __in_z_opt LPCWSTR wzCacheId,
     __in_z LPCWSTR wzWorkingPayloadPath,
-    __in BOOL fMove
+    __in BOOL fMove,
+    __in_opt PFN_CRYPHASHPROGRESS pfnVerifyProgress,
+    __in_opt LPVOID pvContext
     )
 {
     HRESULT hr = S_OK;
     LPWSTR sczCachedDirectory = NULL;
     LPWSTR sczCachedPath = NULL;
     LPWSTR sczUnverifiedPayloadPath = NULL;
+    LPWSTR sczStorePath = NULL;
+    LPWSTR sczJournalFolder = NULL;
+    BYTE* pbExtractedHash = NULL;
+
+    // If the working path is where the payload was just extracted, use the hash calculated during extraction. The
+    // hash is only ever recorded in the process that extracted the payload, so the elevated process always re-hashes.
+    if (pPayload->sczExtractedPath && CSTR_EQUAL == ::CompareStringW(LOCALE_INVARIANT, 0, pPayload->sczExtractedPath, -1, wzWorkingPayloadPath, -1))
+    {
+        pbExtractedHash = pPayload->pbExtractedHash;
+    }
+    ReleaseNullStr(pPayload->sczExtractedPath); // the extracted hash can only be used once.
 
     hr = CreateCompletedPath(fPerMachine, wzCacheId, &sczCachedDirectory);
     ExitOnFailure1(hr, "Failed to get cached path for package with cache id: %ls", wzCacheId);
@@ -880,12 +976,50 @@ extern "C" HRESULT CacheCompletePayload(
     hr = PathConcat(sczCachedDirectory, pPayload->sczFilePath, &sczCachedPath);
     ExitOnFailure(hr, "Failed to concat complete cached path.");
 
+    hr = CreateCompletedPath(fPerMachine, VERIFIED_JOURNAL_FOLDER_NAME, &sczJournalFolder);
+    ExitOnFailure(hr, "Failed to get verified payload journal directory.");
+
+    // Payloads verified by hash are shared between packages through the content store, so linking
+    // to stored content needs no copy. The link is still verified, which the journal makes cheap,
+    // so a repair replaces stored content that was damaged since it was added.
+    if (pPayload->pbHash && !pPayload->pbCertificateRootPublicKeyIdentifier && !pPayload->pCatalog)
+    {
+        hr = GetContentStorePath(fPerMachine, pPayload, &sczStorePath);
+        ExitOnFailure1(hr, "Failed to get content store path for payload: %ls", pPayload->sczKey);
+
+        hr = LinkFromContentStore(fPerMachine, sczStorePath, sczCachedPath);
+        if (S_OK == hr)
+        {
+            hr = VerifyFileAgainstPayload(pPayload, sczCachedPath, NULL, fPerMachine, sczJournalFolder, pfnVerifyProgress, pvContext);
+            if (SUCCEEDED(hr))
+            {
+                LogId(REPORT_STANDARD, MSG_LINKED_STORED_PAYLOAD, pPayload->sczKey, sczStorePath, sczCachedPath);
+                ExitFunction();
+            }
+
+            LogErrorId(hr, MSG_FAILED_VERIFY_PAYLOAD, pPayload->sczKey, sczCachedPath, NULL);
+
+            // The damaged content must not be linked again, the payload is stored anew once it is cached below.
+            FileEnsureDelete(sczCachedPath);
+            FileEnsureDelete(sczStorePath);
+        }
+        else if (FAILED(hr))
+        {
+            LogId(REPORT_STANDARD, MSG_FAILED_LINK_STORED_PAYLOAD, pPayload->sczKey, sczStorePath, hr);
+        }
+    }
+
     // If the cached file matches what we expected, we're good.
-    hr = VerifyFileAgainstPayload(pPayload, sczCachedPath);
+    hr = VerifyFileAgainstPayload(pPayload, sczCachedPath, NULL, fPerMachine, sczJournalFolder, pfnVerifyProgress, pvContext);
     if (SUCCEEDED(hr))
     {
         ::DecryptFileW(sczCachedPath, 0);  // Let's try to make sure it's not encrypted.
         LogId(REPORT_STANDARD, MSG_VERIFIED_EXISTING_PAYLOAD, pPayload->sczKey, sczCachedPath);
+
+        if (sczStorePath)
+        {
+            AddToContentStore(sczCachedPath, sczStorePath);
+        }
         ExitFunction();
     }
     else if (E_PATHNOTFOUND != hr && E_FILENOTFOUND != hr)
@@ -909,11 +1043,15 @@ extern "C" HRESULT CacheCompletePayload(
         hr = E_FILENOTFOUND;
         ExitOnFailure3(hr, "Failed to find payload: %ls in working path: %ls and unverified path: %ls", pPayload->sczKey, wzWorkingPayloadPath, sczUnverifiedPayloadPath);
     }
+    else // the unverified path was not written by the extraction so the extracted hash does not apply.
+    {
+        pbExtractedHash = NULL;
+    }
 
     hr = ResetPathPermissions(fPerMachine, sczUnverifiedPayloadPath);
     ExitOnFailure1(hr, "Failed to reset permissions on unverified cached payload: %ls", pPayload->sczKey);
 
-    hr = VerifyFileAgainstPayload(pPayload, sczUnverifiedPayloadPath);
+    hr = VerifyFileAgainstPayload(pPayload, sczUnverifiedPayloadPath, pbExtractedHash, fPerMachine, NULL, pfnVerifyProgress, pvContext);
     if (FAILED(hr))
     {
         LogErrorId(hr, MSG_FAILED_VERIFY_PAYLOAD, pPayload->sczKey, sczUnverifiedPayloadPath, NULL);
@@ -929,7 +1067,17 @@ extern "C" HRESULT CacheCompletePayload(
 
     ::DecryptFileW(sczCachedPath, 0);  // Let's try to make sure it's not encrypted.
 
+    // Moving kept the file's identity and timestamps so the verification can be journaled for the cached path.
+    JournalRecordVerified(fPerMachine, sczJournalFolder, pPayload, sczCachedPath);
+
+    if (sczStorePath)
+    {
+        AddToContentStore(sczCachedPath, sczStorePath);
+    }
+
 LExit:
+    ReleaseStr(sczJournalFolder);
+    ReleaseStr(sczStorePath);
     ReleaseStr(sczUnverifiedPayloadPath);
     ReleaseStr(sczCachedPath);
     ReleaseStr(sczCachedDirectory);
@@ -989,6 +1137,41 @@ LExit:
     return hr;
 }
 
+extern "C" HRESULT CacheGetHashAlgorithm(
+    __in DWORD cbHash,
+    __out DWORD* pdwProvType,
+    __out ALG_ID* pAlgid
+    )
+{
+    HRESULT hr = S_OK;
+
+    // The manifest does not name the algorithm, the length of the hash implies it.
+    switch (cbHash)
+    {
+    case SHA1_HASH_LEN:
+        *pdwProvType = PROV_RSA_FULL;
+        *pAlgid = CALG_SHA1;
+        break;
+
+    case SHA256_HASH_LEN:
+        *pdwProvType = PROV_RSA_AES;
+        *pAlgid = CALG_SHA_256;
+        break;
+
+    case SHA512_HASH_LEN:
+        *pdwProvType = PROV_RSA_AES;
+        *pAlgid = CALG_SHA_512;
+        break;
+
+    default:
+        hr = E_INVALIDDATA;
+        ExitOnRootFailure1(hr, "Unsupported hash length: %u", cbHash);
+    }
+
+LExit:
+    return hr;
+}
+
 extern "C" HRESULT CacheVerifyPayloadSignature(
     __in BURN_PAYLOAD* pPayload,
     __in_z LPCWSTR wzUnverifiedPayloadPath,
@@ -1364,14 +1547,16 @@ static HRESULT VerifyThenTransferContainer(
     __in BURN_CONTAINER* pContainer,
     __in_z LPCWSTR wzCachedPath,
     __in_z LPCWSTR wzUnverifiedContainerPath,
-    __in BOOL fMove
+    __in BOOL fMove,
+    __in_opt PFN_CRYPHASHPROGRESS pfnVerifyProgress,
+    __in_opt LPVOID pvContext
     )
 {
     HRESULT hr = S_OK;
     HANDLE hFile = INVALID_HANDLE_VALUE;
 
     // Get the container on disk actual hash.
-    hFile = ::CreateFileW(wzUnverifiedContainerPath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    hFile = ::CreateFileW(wzUnverifiedContainerPath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN | FILE_FLAG_OVERLAPPED, NULL);
     if (INVALID_HANDLE_VALUE == hFile)
     {
         ExitWithLastError1(hr, "Failed to open container in working path: %ls", wzUnverifiedContainerPath);
@@ -1380,7 +1565,7 @@ static HRESULT VerifyThenTransferContainer(
     // Container should have a hash we can use to verify with.
     if (pContainer->pbHash)
     {
-        hr = VerifyHash(pContainer->pbHash, pContainer->cbHash, wzUnverifiedContainerPath, hFile);
+        hr = VerifyHash(pContainer->pbHash, pContainer->cbHash, NULL, wzUnverifiedContainerPath, hFile, pfnVerifyProgress, pvContext);
         ExitOnFailure1(hr, "Failed to verify container hash: %ls", wzCachedPath);
     }
 
@@ -1407,21 +1592,32 @@ static HRESULT VerifyThenTransferPayload(
     __in BURN_PAYLOAD* pPayload,
     __in_z LPCWSTR wzCachedPath,
     __in_z LPCWSTR wzUnverifiedPayloadPath,
-    __in BOOL fMove
+    __in BOOL fMove,
+    __in_opt PFN_CRYPHASHPROGRESS pfnVerifyProgress,
+    __in_opt LPVOID pvContext
     )
 {
     HRESULT hr = S_OK;
     HANDLE hFile = INVALID_HANDLE_VALUE;
+    LPWSTR sczJournalFolder = NULL;
 
     // Get the payload on disk actual hash.
-    hFile = ::CreateFileW(wzUnverifiedPayloadPath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    hFile = ::CreateFileW(wzUnverifiedPayloadPath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, GetPayloadVerifyFileFlags(pPayload), NULL);
     if (INVALID_HANDLE_VALUE == hFile)
     {
         ExitWithLastError1(hr, "Failed to open payload in working path: %ls", wzUnverifiedPayloadPath);
     }
 
-    // If the payload has a certificate root public key identifier provided, verify the certificate.
-    if (pPayload->pbCertificateRootPublicKeyIdentifier)
+    // Laying out from the per-machine package cache can trust its journal since only administrators
+    // can write it. The per-user journal is never trusted here because layout may run elevated.
+    hr = CacheGetCompletedPath(TRUE, VERIFIED_JOURNAL_FOLDER_NAME, &sczJournalFolder);
+    ExitOnFailure(hr, "Failed to get per-machine verified payload journal directory.");
+
+    if (JournalFindVerified(TRUE, sczJournalFolder, pPayload, hFile))
+    {
+        LogId(REPORT_STANDARD, MSG_VERIFIED_JOURNALED_PAYLOAD, pPayload->sczKey, wzUnverifiedPayloadPath);
+    }
+    else if (pPayload->pbCertificateRootPublicKeyIdentifier) // If the payload has a certificate root public key identifier provided, verify the certificate.
     {
         hr = CacheVerifyPayloadSignature(pPayload, wzUnverifiedPayloadPath, hFile);
         ExitOnFailure1(hr, "Failed to verify payload signature: %ls", wzCachedPath);
@@ -1433,7 +1629,7 @@ static HRESULT VerifyThenTransferPayload(
     }
     else if (pPayload->pbHash) // the payload should have a hash we can use to verify it.
     {
-        hr = VerifyHash(pPayload->pbHash, pPayload->cbHash, wzUnverifiedPayloadPath, hFile);
+        hr = VerifyHash(pPayload->pbHash, pPayload->cbHash, NULL, wzUnverifiedPayloadPath, hFile, pfnVerifyProgress, pvContext);
         ExitOnFailure1(hr, "Failed to verify payload hash: %ls", wzCachedPath);
     }
 
@@ -1451,6 +1647,7 @@ static HRESULT VerifyThenTransferPayload(
     }
 
 LExit:
+    ReleaseStr(sczJournalFolder);
     ReleaseFileHandle(hFile);
 
     return hr;
@@ -1481,14 +1678,19 @@ LExit:
 
 static HRESULT VerifyFileAgainstPayload(
     __in BURN_PAYLOAD* pPayload,
-    __in_z LPCWSTR wzVerifyPath
+    __in_z LPCWSTR wzVerifyPath,
+    __in_bcount_opt(pPayload->cbHash) BYTE* pbActualHash,
+    __in BOOL fPerMachine,
+    __in_z_opt LPCWSTR wzJournalFolder,
+    __in_opt PFN_CRYPHASHPROGRESS pfnVerifyProgress,
+    __in_opt LPVOID pvContext
     )
 {
     HRESULT hr = S_OK;
     HANDLE hFile = INVALID_HANDLE_VALUE;
 
     // Get the payload on disk actual hash.
-    hFile = ::CreateFileW(wzVerifyPath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    hFile = ::CreateFileW(wzVerifyPath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, GetPayloadVerifyFileFlags(pPayload), NULL);
     if (INVALID_HANDLE_VALUE == hFile)
     {
         hr = HRESULT_FROM_WIN32(::GetLastError());
@@ -1499,6 +1701,13 @@ static HRESULT VerifyFileAgainstPayload(
         ExitOnRootFailure1(hr, "Failed to open payload at path: %ls", wzVerifyPath);
     }
 
+    // A file that has not changed since it was last verified does not need to be read again.
+    if (wzJournalFolder && JournalFindVerified(fPerMachine, wzJournalFolder, pPayload, hFile))
+    {
+        LogId(REPORT_STANDARD, MSG_VERIFIED_JOURNALED_PAYLOAD, pPayload->sczKey, wzVerifyPath);
+        ExitFunction();
+    }
+
     // If the payload has a certificate root public key identifier provided, verify the certificate.
     if (pPayload->pbCertificateRootPublicKeyIdentifier)
     {
@@ -1512,16 +1721,37 @@ static HRESULT VerifyFileAgainstPayload(
     }
     else if (pPayload->pbHash) // the payload should have a hash we can use to verify it.
     {
-        hr = VerifyHash(pPayload->pbHash, pPayload->cbHash, wzVerifyPath, hFile);
+        hr = VerifyHash(pPayload->pbHash, pPayload->cbHash, pbActualHash, wzVerifyPath, hFile, pfnVerifyProgress, pvContext);
         ExitOnFailure1(hr, "Failed to verify hash of payload: %ls", pPayload->sczKey);
     }
 
+    if (wzJournalFolder)
+    {
+        JournalRecordVerified(fPerMachine, wzJournalFolder, pPayload, wzVerifyPath);
+    }
+
 LExit:
     ReleaseFileHandle(hFile);
 
     return hr;
 }
 
+static DWORD GetPayloadVerifyFileFlags(
+    __in BURN_PAYLOAD* pPayload
+    )
+{
+    DWORD dwFlags = FILE_FLAG_SEQUENTIAL_SCAN;
+
+    // Signature and catalog verification read through the handle synchronously so only
+    // payloads verified by hash can overlap reading with hashing.
+    if (!pPayload->pbCertificateRootPublicKeyIdentifier && !pPayload->pCatalog)
+    {
+        dwFlags |= FILE_FLAG_OVERLAPPED;
+    }
+
+    return dwFlags;
+}
+
 static HRESULT AllocateSid(
     __in WELL_KNOWN_SID_TYPE type,
     __out PSID* ppSid
@@ -1651,6 +1881,36 @@ LExit:
 }
 
 
+static BOOL IsOwnedByAdministratorsOrSystem(
+    __in_z LPCWSTR wzPath
+    )
+{
+    HRESULT hr = S_OK;
+    SECURITY_DESCRIPTOR* pSecurityDescriptor = NULL;
+    PSID pOwner = NULL;
+    BOOL fOwnerDefaulted = FALSE;
+    BOOL fOwned = FALSE;
+
+    hr = AclGetSecurityDescriptor(wzPath, SE_FILE_OBJECT, OWNER_SECURITY_INFORMATION, &pSecurityDescriptor);
+    ExitOnFailure1(hr, "Failed to get owner of path: %ls", wzPath);
+
+    if (!::GetSecurityDescriptorOwner(pSecurityDescriptor, &pOwner, &fOwnerDefaulted))
+    {
+        ExitWithLastError1(hr, "Failed to get owner from security descriptor of path: %ls", wzPath);
+    }
+
+    fOwned = pOwner && (::IsWellKnownSid(pOwner, WinBuiltinAdministratorsSid) || ::IsWellKnownSid(pOwner, WinLocalSystemSid));
+
+LExit:
+    if (pSecurityDescriptor)
+    {
+        AclFreeSecurityDescriptor(pSecurityDescriptor);
+    }
+
+    return fOwned;
+}
+
+
 static HRESULT CopyEngineToWorkingFolder(
     __in_z LPCWSTR wzSourcePath,
     __in_z LPCWSTR wzWorkingFolderName,
@@ -1804,12 +2064,21 @@ static HRESULT RemoveBundleOrPackage(
     HRESULT hr = S_OK;
     LPWSTR sczRootCacheDirectory = NULL;
     LPWSTR sczDirectory = NULL;
+    LPWSTR sczJournalFolder = NULL;
 
     hr = CacheGetCompletedPath(fPerMachine, wzCacheId, &sczDirectory);
     ExitOnFailure(hr, "Failed to calculate cache path.");
 
     LogId(REPORT_STANDARD, fBundle ? MSG_UNCACHE_BUNDLE : MSG_UNCACHE_PACKAGE, wzBundleOrPackageId, sczDirectory);
 
+    if (!fBundle)
+    {
+        hr = CacheGetCompletedPath(fPerMachine, VERIFIED_JOURNAL_FOLDER_NAME, &sczJournalFolder);
+        ExitOnFailure(hr, "Failed to get verified payload journal directory.");
+
+        JournalForgetDirectory(sczJournalFolder, sczDirectory);
+    }
+
     // Try really hard to remove the cache directory.
     hr = E_FAIL;
     for (DWORD iRetry = 0; FAILED(hr) && iRetry < FILE_OPERATION_RETRY_COUNT; ++iRetry)
@@ -1833,6 +2102,12 @@ static HRESULT RemoveBundleOrPackage(
     }
     else
     {
+        // Stored content no longer linked from any package directory can go.
+        if (!fBundle)
+        {
+            RemoveUnreferencedContent(fPerMachine);
+        }
+
         // Try to remove root package cache in the off chance it is now empty.
         hr = GetRootPath(fPerMachine, TRUE, &sczRootCacheDirectory);
         ExitOnFailure1(hr, "Failed to get %hs package cache root directory.", fPerMachine ? "per-machine" : "per-user");
@@ -1848,40 +2123,516 @@ static HRESULT RemoveBundleOrPackage(
     }
 
 LExit:
+    ReleaseStr(sczJournalFolder);
     ReleaseStr(sczDirectory);
     ReleaseStr(sczRootCacheDirectory);
 
     return hr;
 }
 
+static HRESULT GetContentStorePath(
+    __in BOOL fPerMachine,
+    __in BURN_PAYLOAD* pPayload,
+    __out_z LPWSTR* psczStorePath
+    )
+{
+    HRESULT hr = S_OK;
+    LPWSTR sczStoreFolder = NULL;
+    LPWSTR sczHash = NULL;
+
+    hr = CacheGetCompletedPath(fPerMachine, CONTENT_STORE_FOLDER_NAME, &sczStoreFolder);
+    ExitOnFailure(hr, "Failed to get content store directory.");
+
+    hr = DirEnsureExists(sczStoreFolder, NULL);
+    ExitOnFailure1(hr, "Failed to create content store directory: %ls", sczStoreFolder);
+
+    ResetPathPermissions(fPerMachine, sczStoreFolder);
+
+    // Stored content is named by its hash so every package caching the same content finds the same file.
+    hr = StrAllocHexEncode(pPayload->pbHash, pPayload->cbHash, &sczHash);
+    ExitOnFailure(hr, "Failed to convert payload hash to string.");
+
+    hr = PathConcat(sczStoreFolder, sczHash, psczStorePath);
+    ExitOnFailure(hr, "Failed to concat payload hash to content store path.");
+
+LExit:
+    ReleaseStr(sczHash);
+    ReleaseStr(sczStoreFolder);
+
+    return hr;
+}
+
+//
+// LinkFromContentStore - hard links the cached path to the stored content.
+//                        Returns S_FALSE if the content is not in the store
+//                        or is not trusted.
+//
+static HRESULT LinkFromContentStore(
+    __in BOOL fPerMachine,
+    __in_z LPCWSTR wzStorePath,
+    __in_z LPCWSTR wzCachedPath
+    )
+{
+    HRESULT hr = S_OK;
+    BOOL fCachedExists = FALSE;
+    BOOL fSameFile = FALSE;
+    LPWSTR sczCachedDirectory = NULL;
+
+    if (!FileExistsEx(wzStorePath, NULL))
+    {
+        ExitFunction1(hr = S_FALSE);
+    }
+
+    fCachedExists = FileExistsEx(wzCachedPath, NULL);
+    if (fCachedExists)
+    {
+        hr = FileIsSame(wzStorePath, wzCachedPath, &fSameFile);
+        fSameFile = SUCCEEDED(hr) && fSameFile;
+    }
+
+    // A standard user could have put content in the per-machine store before it was secured. The
+    // engine only stores files whose owner it reset, so content owned by anyone else is removed.
+    if (fPerMachine && !IsOwnedByAdministratorsOrSystem(wzStorePath))
+    {
+        LogStringLine(REPORT_STANDARD, "Removing stored content not owned by Administrators or SYSTEM: %ls", wzStorePath);
+
+        if (fSameFile)
+        {
+            hr = FileEnsureDelete(wzCachedPath);
+            ExitOnFailure1(hr, "Failed to delete cached file linked to untrusted stored content: %ls", wzCachedPath);
+        }
+
+        hr = FileEnsureDelete(wzStorePath);
+        ExitOnFailure1(hr, "Failed to delete untrusted stored content: %ls", wzStorePath);
+
+        ExitFunction1(hr = S_FALSE);
+    }
+
+    if (fSameFile) // already linked by an earlier cache of this package.
+    {
+        ExitFunction1(hr = S_OK);
+    }
+    else if (fCachedExists)
+    {
+        hr = FileEnsureDelete(wzCachedPath);
+        ExitOnFailure1(hr, "Failed to delete cached file to replace it with stored content: %ls", wzCachedPath);
+    }
+    else
+    {
+        hr = PathGetDirectory(wzCachedPath, &sczCachedDirectory);
+        ExitOnFailure1(hr, "Failed to get directory of cached path: %ls", wzCachedPath);
+
+        hr = DirEnsureExists(sczCachedDirectory, NULL);
+        ExitOnFailure1(hr, "Failed to create cache directory: %ls", sczCachedDirectory);
+    }
+
+    if (!::CreateHardLinkW(wzCachedPath, wzStorePath, NULL))
+    {
+        ExitWithLastError2(hr, "Failed to link %ls to stored content: %ls", wzCachedPath, wzStorePath);
+    }
+
+LExit:
+    ReleaseStr(sczCachedDirectory);
+
+    return hr;
+}
+
+static void AddToContentStore(
+    __in_z LPCWSTR wzCachedPath,
+    __in_z LPCWSTR wzStorePath
+    )
+{
+    HRESULT hr = S_OK;
+
+    // Another package may have stored the same content already, which is just as good. Any other
+    // failure (for example a redirected cache on another volume) only costs sharing, so ignore it.
+    if (!::CreateHardLinkW(wzStorePath, wzCachedPath, NULL))
+    {
+        hr = HRESULT_FROM_WIN32(::GetLastError());
+        if (HRESULT_FROM_WIN32(ERROR_ALREADY_EXISTS) != hr)
+        {
+            TraceError2(hr, "Failed to add %ls to content store: %ls", wzCachedPath, wzStorePath);
+        }
+    }
+}
+
+//
+// RemoveUnreferencedContent - deletes stored content that is no longer linked from any
+//                             package cache directory, then the store if it is empty.
+//
+static void RemoveUnreferencedContent(
+    __in BOOL fPerMachine
+    )
+{
+    HRESULT hr = S_OK;
+    LPWSTR sczStoreFolder = NULL;
+    LPWSTR sczSearch = NULL;
+    LPWSTR sczPath = NULL;
+    LPWSTR sczJournalFolder = NULL;
+    HANDLE hFind = INVALID_HANDLE_VALUE;
+    HANDLE hFile = INVALID_HANDLE_VALUE;
+    WIN32_FIND_DATAW wfd = { };
+    BY_HANDLE_FILE_INFORMATION fileInfo = { };
+
+    hr = CacheGetCompletedPath(fPerMachine, CONTENT_STORE_FOLDER_NAME, &sczStoreFolder);
+    ExitOnFailure(hr, "Failed to get content store directory.");
+
+    hr = CacheGetCompletedPath(fPerMachine, VERIFIED_JOURNAL_FOLDER_NAME, &sczJournalFolder);
+    ExitOnFailure(hr, "Failed to get verified payload journal directory.");
+
+    hr = StrAllocFormatted(&sczSearch, L"%ls*", sczStoreFolder);
+    ExitOnFailure(hr, "Failed to allocate content store search string.");
+
+    hFind = ::FindFirstFileExW(sczSearch, FindExInfoBasic, &wfd, FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+    if (INVALID_HANDLE_VALUE == hFind && ERROR_INVALID_PARAMETER == ::GetLastError())
+    {
+        // Before Windows 7 neither the basic info level nor the large fetch flag is supported.
+        hFind = ::FindFirstFileExW(sczSearch, FindExInfoStandard, &wfd, FindExSearchNameMatch, NULL, 0);
+    }
+
+    if (INVALID_HANDLE_VALUE == hFind)
+    {
+        ExitFunction(); // no store, nothing to remove.
+    }
+
+    do
+    {
+        if (FILE_ATTRIBUTE_DIRECTORY & wfd.dwFileAttributes)
+        {
+            continue;
+        }
+
+        hr = PathConcat(sczStoreFolder, wfd.cFileName, &sczPath);
+        ExitOnFailure(hr, "Failed to concat stored content path.");
+
+        // The link count includes the store's own link, so one means no package uses the content.
+        hFile = ::CreateFileW(sczPath, FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, 0, NULL);
+        if (INVALID_HANDLE_VALUE != hFile && ::GetFileInformationByHandle(hFile, &fileInfo) && 1 >= fileInfo.nNumberOfLinks)
+        {
+            ReleaseFileHandle(hFile);
+
+            JournalForgetFile(sczJournalFolder, sczPath, FALSE);
+
+            hr = FileEnsureDelete(sczPath);
+            TraceError1(hr, "Failed to remove unreferenced stored content: %ls", sczPath);
+        }
+
+        ReleaseFileHandle(hFile);
+    } while (::FindNextFileW(hFind, &wfd));
+
+    DirEnsureDelete(sczStoreFolder, FALSE, FALSE);
+
+LExit:
+    ReleaseFileFindHandle(hFind);
+    ReleaseFileHandle(hFile);
+    ReleaseStr(sczPath);
+    ReleaseStr(sczSearch);
+    ReleaseStr(sczJournalFolder);
+    ReleaseStr(sczStoreFolder);
+}
+
+//
+// CreateJournalRecord - serializes the validation stamp of a file together with what the
+//                       payload was verified against. Returns S_FALSE if the payload's
+//                       verification cannot be journaled.
+//
+static HRESULT CreateJournalRecord(
+    __in BURN_PAYLOAD* pPayload,
+    __in const BY_HANDLE_FILE_INFORMATION* pFileInfo,
+    __deref_out_bcount(*pcbRecord) BYTE** ppbRecord,
+    __out SIZE_T* pcbRecord
+    )
+{
+    HRESULT hr = S_OK;
+
+    // Catalog verification depends on the catalog file as well, so it is always repeated.
+    if (pPayload->pCatalog || (!pPayload->pbCertificateRootPublicKeyIdentifier && !pPayload->pbHash))
+    {
+        ExitFunction1(hr = S_FALSE);
+    }
+
+    hr = BuffWriteNumber(ppbRecord, pcbRecord, VERIFIED_JOURNAL_RECORD_VERSION);
+    ExitOnFailure(hr, "Failed to write journal record version.");
+
+    hr = BuffWriteNumber(ppbRecord, pcbRecord, pFileInfo->dwVolumeSerialNumber);
+    ExitOnFailure(hr, "Failed to write volume serial number.");
+
+    hr = BuffWriteNumber64(ppbRecord, pcbRecord, (static_cast<DWORD64>(pFileInfo->nFileIndexHigh) << 32) | pFileInfo->nFileIndexLow);
+    ExitOnFailure(hr, "Failed to write file index.");
+
+    hr = BuffWriteNumber64(ppbRecord, pcbRecord, (static_cast<DWORD64>(pFileInfo->nFileSizeHigh) << 32) | pFileInfo->nFileSizeLow);
+    ExitOnFailure(hr, "Failed to write file size.");
+
+    hr = BuffWriteNumber64(ppbRecord, pcbRecord, (static_cast<DWORD64>(pFileInfo->ftLastWriteTime.dwHighDateTime) << 32) | pFileInfo->ftLastWriteTime.dwLowDateTime);
+    ExitOnFailure(hr, "Failed to write last write time.");
+
+    hr = BuffWriteStream(ppbRecord, pcbRecord, pPayload->pbHash, pPayload->pbHash ? pPayload->cbHash : 0);
+    ExitOnFailure(hr, "Failed to write payload hash.");
+
+    hr = BuffWriteStream(ppbRecord, pcbRecord, pPayload->pbCertificateRootPublicKeyIdentifier, pPayload->pbCertificateRootPublicKeyIdentifier ? pPayload->cbCertificateRootPublicKeyIdentifier : 0);
+    ExitOnFailure(hr, "Failed to write certificate root public key identifier.");
+
+    hr = BuffWriteStream(ppbRecord, pcbRecord, pPayload->pbCertificateRootThumbprint, pPayload->pbCertificateRootThumbprint ? pPayload->cbCertificateRootThumbprint : 0);
+    ExitOnFailure(hr, "Failed to write certificate root thumbprint.");
+
+LExit:
+    return hr;
+}
+
+static HRESULT GetJournalRecordPath(
+    __in_z LPCWSTR wzJournalFolder,
+    __in const BY_HANDLE_FILE_INFORMATION* pFileInfo,
+    __out_z LPWSTR* psczRecordPath
+    )
+{
+    HRESULT hr = S_OK;
+
+    // Records are named by file identity so every hard link to the same content shares one record.
+    hr = StrAllocFormatted(psczRecordPath, L"%ls%08x%08x%08x", wzJournalFolder, pFileInfo->dwVolumeSerialNumber, pFileInfo->nFileIndexHigh, pFileInfo->nFileIndexLow);
+    ExitOnFailure(hr, "Failed to allocate journal record path.");
+
+LExit:
+    return hr;
+}
+
+//
+// JournalFindVerified - returns TRUE if the journal shows the file was verified against
+//                       the payload and the file has not changed since.
+//
+static BOOL JournalFindVerified(
+    __in BOOL fPerMachine,
+    __in_z LPCWSTR wzJournalFolder,
+    __in BURN_PAYLOAD* pPayload,
+    __in HANDLE hFile
+    )
+{
+    HRESULT hr = S_OK;
+    BOOL fVerified = FALSE;
+    BY_HANDLE_FILE_INFORMATION fileInfo = { };
+    LPWSTR sczRecordPath = NULL;
+    BYTE* pbExpected = NULL;
+    SIZE_T cbExpected = 0;
+    BYTE* pbRecord = NULL;
+    DWORD cbRecord = 0;
+
+    if (!::GetFileInformationByHandle(hFile, &fileInfo))
+    {
+        ExitWithLastError(hr, "Failed to get file information to look up verified payload journal.");
+    }
+
+    hr = CreateJournalRecord(pPayload, &fileInfo, &pbExpected, &cbExpected);
+    ExitOnFailure(hr, "Failed to create expected journal record.");
+
+    if (S_FALSE == hr)
+    {
+        ExitFunction();
+    }
+
+    hr = GetJournalRecordPath(wzJournalFolder, &fileInfo, &sczRecordPath);
+    ExitOnFailure(hr, "Failed to get journal record path.");
+
+    // A missing, truncated or tampered record simply does not match so the file gets verified again.
+    // A per-machine record is only trusted if a standard user could not have written it.
+    hr = FileRead(&pbRecord, &cbRecord, sczRecordPath);
+    if (SUCCEEDED(hr) && cbRecord == cbExpected && 0 == memcmp(pbRecord, pbExpected, cbExpected))
+    {
+        fVerified = !fPerMachine || IsOwnedByAdministratorsOrSystem(sczRecordPath);
+    }
+
+LExit:
+    ReleaseMem(pbRecord);
+    ReleaseBuffer(pbExpected);
+    ReleaseStr(sczRecordPath);
+
+    return fVerified;
+}
+
+static void JournalRecordVerified(
+    __in BOOL fPerMachine,
+    __in_z LPCWSTR wzJournalFolder,
+    __in BURN_PAYLOAD* pPayload,
+    __in_z LPCWSTR wzPath
+    )
+{
+    HRESULT hr = S_OK;
+    HANDLE hFile = INVALID_HANDLE_VALUE;
+    BY_HANDLE_FILE_INFORMATION fileInfo = { };
+    LPWSTR sczRecordPath = NULL;
+    BYTE* pbRecord = NULL;
+    SIZE_T cbRecord = 0;
+
+    hFile = ::CreateFileW(wzPath, FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, 0, NULL);
+    ExitOnInvalidHandleWithLastError1(hFile, hr, "Failed to open verified payload to journal it: %ls", wzPath);
+
+    if (!::GetFileInformationByHandle(hFile, &fileInfo))
+    {
+        ExitWithLastError1(hr, "Failed to get file information of verified payload: %ls", wzPath);
+    }
+
+    hr = CreateJournalRecord(pPayload, &fileInfo, &pbRecord, &cbRecord);
+    ExitOnFailure(hr, "Failed to create journal record.");
+
+    if (S_FALSE == hr)
+    {
+        ExitFunction();
+    }
+
+    hr = GetJournalRecordPath(wzJournalFolder, &fileInfo, &sczRecordPath);
+    ExitOnFailure(hr, "Failed to get journal record path.");
+
+    hr = FileWrite(sczRecordPath, FILE_ATTRIBUTE_NORMAL, pbRecord, static_cast<DWORD>(cbRecord), NULL);
+    ExitOnFailure1(hr, "Failed to write journal record: %ls", sczRecordPath);
+
+    // Overwriting keeps the security of a record that already existed, which may not be ours.
+    if (fPerMachine)
+    {
+        hr = ResetPathPermissions(fPerMachine, sczRecordPath);
+        ExitOnFailure1(hr, "Failed to reset permissions on journal record: %ls", sczRecordPath);
+    }
+
+LExit:
+    ReleaseBuffer(pbRecord);
+    ReleaseStr(sczRecordPath);
+    ReleaseFileHandle(hFile);
+}
+
+//
+// JournalForgetFile - removes the journal record of a file that is about to be deleted.
+//
+static void JournalForgetFile(
+    __in_z LPCWSTR wzJournalFolder,
+    __in_z LPCWSTR wzPath,
+    __in BOOL fLastLinkOnly
+    )
+{
+    HRESULT hr = S_OK;
+    HANDLE hFile = INVALID_HANDLE_VALUE;
+    BY_HANDLE_FILE_INFORMATION fileInfo = { };
+    LPWSTR sczRecordPath = NULL;
+
+    hFile = ::CreateFileW(wzPath, FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, 0, NULL);
+    if (INVALID_HANDLE_VALUE == hFile || !::GetFileInformationByHandle(hFile, &fileInfo))
+    {
+        ExitFunction();
+    }
+
+    // Content still linked from elsewhere, such as the content store, keeps its record.
+    if (fLastLinkOnly && 1 < fileInfo.nNumberOfLinks)
+    {
+        ExitFunction();
+    }
+
+    hr = GetJournalRecordPath(wzJournalFolder, &fileInfo, &sczRecordPath);
+    ExitOnFailure(hr, "Failed to get journal record path.");
+
+    FileEnsureDelete(sczRecordPath);
+
+LExit:
+    ReleaseStr(sczRecordPath);
+    ReleaseFileHandle(hFile);
+}
+
+static void JournalForgetDirectory(
+    __in_z LPCWSTR wzJournalFolder,
+    __in_z LPCWSTR wzDirectory
+    )
+{
+    HRESULT hr = S_OK;
+    LPWSTR sczSearch = NULL;
+    LPWSTR sczPath = NULL;
+    HANDLE hFind = INVALID_HANDLE_VALUE;
+    WIN32_FIND_DATAW wfd = { };
+
+    hr = StrAllocFormatted(&sczSearch, L"%ls*", wzDirectory);
+    ExitOnFailure(hr, "Failed to allocate journal search string.");
+
+    hFind = ::FindFirstFileExW(sczSearch, FindExInfoBasic, &wfd, FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+    if (INVALID_HANDLE_VALUE == hFind && ERROR_INVALID_PARAMETER == ::GetLastError())
+    {
+        // Before Windows 7 neither the basic info level nor the large fetch flag is supported.
+        hFind = ::FindFirstFileExW(sczSearch, FindExInfoStandard, &wfd, FindExSearchNameMatch, NULL, 0);
+    }
+
+    if (INVALID_HANDLE_VALUE == hFind)
+    {
+        ExitFunction();
+    }
+
+    do
+    {
+        if (L'.' == wfd.cFileName[0] && (L'\0' == wfd.cFileName[1] || (L'.' == wfd.cFileName[1] && L'\0' == wfd.cFileName[2])))
+        {
+            continue;
+        }
+
+        hr = PathConcat(wzDirectory, wfd.cFileName, &sczPath);
+        ExitOnFailure(hr, "Failed to concat path to forget in journal.");
+
+        if (FILE_ATTRIBUTE_DIRECTORY & wfd.dwFileAttributes)
+        {
+            if (!(FILE_ATTRIBUTE_REPARSE_POINT & wfd.dwFileAttributes))
+            {
+                hr = PathBackslashTerminate(&sczPath);
+                ExitOnFailure(hr, "Failed to backslash terminate directory to forget in journal.");
+
+                JournalForgetDirectory(wzJournalFolder, sczPath);
+            }
+        }
+        else
+        {
+            JournalForgetFile(wzJournalFolder, sczPath, TRUE);
+        }
+    } while (::FindNextFileW(hFind, &wfd));
+
+LExit:
+    ReleaseFileFindHandle(hFind);
+    ReleaseStr(sczPath);
+    ReleaseStr(sczSearch);
+}
+
 
 static HRESULT VerifyHash(
     __in BYTE* pbHash,
     __in DWORD cbHash,
+    __in_bcount_opt(cbHash) BYTE* pbActualHash,
     __in_z LPCWSTR wzUnverifiedPayloadPath,
-    __in HANDLE hFile
+    __in HANDLE hFile,
+    __in_opt PFN_CRYPHASHPROGRESS pfnVerifyProgress,
+    __in_opt LPVOID pvContext
     )
 {
     UNREFERENCED_PARAMETER(wzUnverifiedPayloadPath);
 
     HRESULT hr = S_OK;
-    BYTE rgbActualHash[SHA1_HASH_LEN] = { };
+    BYTE rgbActualHash[SHA512_HASH_LEN] = { };
+    DWORD dwProvType = 0;
+    ALG_ID algid = 0;
     DWORD64 qwHashedBytes;
     LPWSTR pszExpected = NULL;
     LPWSTR pszActual = NULL;
 
-    // TODO: create a cryp hash file that sends progress.
-    hr = CrypHashFileHandle(hFile, PROV_RSA_FULL, CALG_SHA1, rgbActualHash, sizeof(rgbActualHash), &qwHashedBytes);
-    ExitOnFailure1(hr, "Failed to calculate hash for path: %ls", wzUnverifiedPayloadPath);
+    hr = CacheGetHashAlgorithm(cbHash, &dwProvType, &algid);
+    ExitOnFailure1(hr, "Failed to get hash algorithm for path: %ls", wzUnverifiedPayloadPath);
+
+    // Use the hash calculated when the file was written if there is one, otherwise read the file to hash it.
+    if (pbActualHash)
+    {
+        memcpy_s(rgbActualHash, sizeof(rgbActualHash), pbActualHash, cbHash);
+    }
+    else
+    {
+        hr = CrypHashFileHandleWithProgress(hFile, dwProvType, algid, rgbActualHash, cbHash, pfnVerifyProgress, pvContext, &qwHashedBytes);
+        ExitOnFailure1(hr, "Failed to calculate hash for path: %ls", wzUnverifiedPayloadPath);
+    }
 
     // Compare hashes.
-    if (cbHash != sizeof(rgbActualHash) || 0 != memcmp(pbHash, rgbActualHash, SHA1_HASH_LEN))
+    if (0 != memcmp(pbHash, rgbActualHash, cbHash))
     {
         hr = CRYPT_E_HASH_VALUE;
 
         // Best effort to log the expected and actual hash value strings.
         if (SUCCEEDED(StrAllocHexEncode(pbHash, cbHash, &pszExpected)) &&
-            SUCCEEDED(StrAllocHexEncode(rgbActualHash, SHA1_HASH_LEN, &pszActual)))
+            SUCCEEDED(StrAllocHexEncode(rgbActualHash, cbHash, &pszActual)))
         {
             ExitOnFailure3(hr, "Hash mismatch for path: %ls, expected: %ls, actual: %ls", wzUnverifiedPayloadPath, pszExpected, pszActual);
         }
@@ -107,20 +107,26 @@ HRESULT CacheLayoutContainer(
     __in BURN_CONTAINER* pContainer,
     __in_z_opt LPCWSTR wzLayoutDirectory,
     __in_z LPCWSTR wzUnverifiedContainerPath,
-    __in BOOL fMove
+    __in BOOL fMove,
+    __in_opt PFN_CRYPHASHPROGRESS pfnVerifyProgress,
+    __in_opt LPVOID pvContext
     );
 HRESULT CacheLayoutPayload(
     __in BURN_PAYLOAD* pPayload,
     __in_z_opt LPCWSTR wzLayoutDirectory,
     __in_z LPCWSTR wzUnverifiedPayloadPath,
-    __in BOOL fMove
+    __in BOOL fMove,
+    __in_opt PFN_CRYPHASHPROGRESS pfnVerifyProgress,
+    __in_opt LPVOID pvContext
     );
 HRESULT CacheCompletePayload(
     __in BOOL fPerMachine,
     __in BURN_PAYLOAD* pPayload,
     __in_z_opt LPCWSTR wzCacheId,
     __in_z LPCWSTR wzUnverifiedPayloadPath,
-    __in BOOL fMove
+    __in BOOL fMove,
+    __in_opt PFN_CRYPHASHPROGRESS pfnVerifyProgress,
+    __in_opt LPVOID pvContext
     );
 HRESULT CacheRemoveWorkingFolder(
     __in_z_opt LPCWSTR wzBundleId
@@ -134,6 +140,11 @@ HRESULT CacheRemovePackage(
     __in_z LPCWSTR wzPackageId,
     __in_z LPCWSTR wzCacheId
     );
+HRESULT CacheGetHashAlgorithm(
+    __in DWORD cbHash,
+    __out DWORD* pdwProvType,
+    __out ALG_ID* pAlgid
+    );
 HRESULT CacheVerifyPayloadSignature(
     __in BURN_PAYLOAD* pPayload,
     __in_z LPCWSTR wzUnverifiedPayloadPath,
@@ -0,0 +1,141 @@
+// Copyright (c) .NET Foundation and contributors. All rights reserved. Licensed under the Microsoft Reciprocal License. See LICENSE.TXT file in the project root for full license information.
+
+#include "precomp.h"
+
+
+// function definitions
+
+extern "C" HRESULT ChunkExtractOpen(
+    __in BURN_CONTAINER_CONTEXT* pContext,
+    __in LPCWSTR wzFilePath
+    )
+{
+    HRESULT hr = S_OK;
+
+    // The reader works from the index so it does not depend on the file pointer set by the caller.
+    hr = ChunkReadOpen(pContext->hFile, pContext->qwOffset, pContext->qwSize, &pContext->Chunked.hReader);
+    ExitOnFailure1(hr, "Failed to open chunked container: %ls", wzFilePath);
+
+LExit:
+    return hr;
+}
+
+extern "C" HRESULT ChunkExtractNextStream(
+    __in BURN_CONTAINER_CONTEXT* pContext,
+    __inout_z LPWSTR* psczStreamName
+    )
+{
+    HRESULT hr = S_OK;
+    LPCWSTR wzStreamName = NULL;
+
+    if (pContext->Chunked.iNextStream >= ChunkReadGetStreamCount(pContext->Chunked.hReader))
+    {
+        ExitFunction1(hr = E_NOMOREITEMS);
+    }
+
+    hr = ChunkReadGetStream(pContext->Chunked.hReader, pContext->Chunked.iNextStream, &wzStreamName, NULL);
+    ExitOnFailure(hr, "Failed to get next stream.");
+
+    hr = StrAllocString(psczStreamName, wzStreamName, 0);
+    ExitOnFailure(hr, "Failed to copy stream name.");
+
+    pContext->Chunked.iStream = pContext->Chunked.iNextStream;
+    ++pContext->Chunked.iNextStream;
+
+LExit:
+    return hr;
+}
+
+extern "C" HRESULT ChunkExtractStreamToFile(
+    __in BURN_CONTAINER_CONTEXT* pContext,
+    __in_z LPCWSTR wzFileName,
+    __out_bcount_opt(cbHash) BYTE* pbHash,
+    __in DWORD cbHash
+    )
+{
+    HRESULT hr = S_OK;
+    DWORD dwHashProvType = 0;
+    ALG_ID algidHash = 0;
+
+    hr = ChunkReadStreamToFile(pContext->Chunked.hReader, pContext->Chunked.iStream, wzFileName);
+    ExitOnFailure1(hr, "Failed to extract stream to file: %ls", wzFileName);
+
+    // Chunks are not hashed as they are written, so read the file back when asked for its hash.
+    if (pbHash)
+    {
+        hr = CacheGetHashAlgorithm(cbHash, &dwHashProvType, &algidHash);
+        ExitOnFailure(hr, "Failed to get hash algorithm for stream.");
+
+        hr = CrypHashFile(wzFileName, dwHashProvType, algidHash, pbHash, cbHash, NULL);
+        ExitOnFailure1(hr, "Failed to hash extracted file: %ls", wzFileName);
+    }
+
+LExit:
+    return hr;
+}
+
+extern "C" HRESULT ChunkExtractStreamToBuffer(
+    __in BURN_CONTAINER_CONTEXT* pContext,
+    __out BYTE** ppbBuffer,
+    __out SIZE_T* pcbBuffer
+    )
+{
+    HRESULT hr = S_OK;
+
+    hr = ChunkReadStreamToBuffer(pContext->Chunked.hReader, pContext->Chunked.iStream, ppbBuffer, pcbBuffer);
+    ExitOnFailure(hr, "Failed to extract stream to buffer.");
+
+LExit:
+    return hr;
+}
+
+extern "C" HRESULT ChunkExtractSkipStream(
+    __in BURN_CONTAINER_CONTEXT* /*pContext*/
+    )
+{
+    // Streams are read through the index, there is nothing to skip over.
+    return S_OK;
+}
+
+extern "C" HRESULT ChunkExtractStreams(
+    __in BURN_CONTAINER_CONTEXT* pContext,
+    __in_ecount(cStreams) BURN_CONTAINER_EXTRACT_STREAM* rgStreams,
+    __in DWORD cStreams
+    )
+{
+    HRESULT hr = S_OK;
+    CHUNK_EXTRACT_STREAM* rgChunkStreams = NULL;
+
+    rgChunkStreams = static_cast<CHUNK_EXTRACT_STREAM*>(MemAlloc(sizeof(CHUNK_EXTRACT_STREAM) * cStreams, TRUE));
+    ExitOnNull(rgChunkStreams, hr, E_OUTOFMEMORY, "Failed to allocate memory for streams to extract.");
+
+    for (DWORD i = 0; i < cStreams; ++i)
+    {
+        rgChunkStreams[i].wzStreamName = rgStreams[i].wzStreamName;
+        rgChunkStreams[i].wzTargetFile = rgStreams[i].wzTargetFile;
+    }
+
+    // Decompress the chunks on one thread per processor. The streams are not hashed on the way so the
+    // payloads are verified from disk as usual.
+    hr = ChunkReadStreamsToFiles(pContext->Chunked.hReader, rgChunkStreams, cStreams, 0);
+    ExitOnFailure(hr, "Failed to extract streams from chunked container.");
+
+    for (DWORD i = 0; i < cStreams; ++i)
+    {
+        rgStreams[i].fExtracted = rgChunkStreams[i].fExtracted;
+    }
+
+LExit:
+    ReleaseMem(rgChunkStreams);
+
+    return hr;
+}
+
+extern "C" HRESULT ChunkExtractClose(
+    __in BURN_CONTAINER_CONTEXT* pContext
+    )
+{
+    ReleaseNullChunkReader(pContext->Chunked.hReader);
+
+    return S_OK;
+}
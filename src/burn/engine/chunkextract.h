@@ -0,0 +1,46 @@
+#pragma once
+// Copyright (c) .NET Foundation and contributors. All rights reserved. Licensed under the Microsoft Reciprocal License. See LICENSE.TXT file in the project root for full license information.
+
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+
+// function declarations
+
+HRESULT ChunkExtractOpen(
+    __in BURN_CONTAINER_CONTEXT* pContext,
+    __in LPCWSTR wzFilePath
+    );
+HRESULT ChunkExtractNextStream(
+    __in BURN_CONTAINER_CONTEXT* pContext,
+    __inout_z LPWSTR* psczStreamName
+    );
+HRESULT ChunkExtractStreamToFile(
+    __in BURN_CONTAINER_CONTEXT* pContext,
+    __in_z LPCWSTR wzFileName,
+    __out_bcount_opt(cbHash) BYTE* pbHash,
+    __in DWORD cbHash
+    );
+HRESULT ChunkExtractStreamToBuffer(
+    __in BURN_CONTAINER_CONTEXT* pContext,
+    __out BYTE** ppbBuffer,
+    __out SIZE_T* pcbBuffer
+    );
+HRESULT ChunkExtractSkipStream(
+    __in BURN_CONTAINER_CONTEXT* pContext
+    );
+HRESULT ChunkExtractStreams(
+    __in BURN_CONTAINER_CONTEXT* pContext,
+    __in_ecount(cStreams) BURN_CONTAINER_EXTRACT_STREAM* rgStreams,
+    __in DWORD cStreams
+    );
+HRESULT ChunkExtractClose(
+    __in BURN_CONTAINER_CONTEXT* pContext
+    );
+
+
+#if defined(__cplusplus)
+}
+#endif
@@ -20,6 +20,10 @@
 #define COMPARISON  0x00010000
 #define INSENSITIVE 0x00020000
 
+const DWORD CONDITION_PROGRAM_CACHE_BUCKETS = 1024; // must be a power of two.
+const DWORD MAX_CONDITION_PROGRAMS = CONDITION_PROGRAM_CACHE_BUCKETS / 2;
+const DWORD CONDITION_STACK_SIZE = 16;
+
 enum BURN_SYMBOL_TYPE
 {
     // terminals
@@ -54,6 +58,17 @@ enum BURN_SYMBOL_TYPE
     BURN_SYMBOL_TYPE_VERSION    = 19,
 };
 
+enum BURN_CONDITION_OPCODE
+{
+    BURN_CONDITION_OPCODE_VARIABLE, // push the value of a variable.
+    BURN_CONDITION_OPCODE_CONSTANT, // push a constant.
+    BURN_CONDITION_OPCODE_TEST,     // pop a value, push whether it is non-empty and non-zero.
+    BURN_CONDITION_OPCODE_COMPARE,  // pop two values, push the result of comparing them.
+    BURN_CONDITION_OPCODE_NOT,
+    BURN_CONDITION_OPCODE_AND,
+    BURN_CONDITION_OPCODE_OR,
+};
+
 
 // structs
 
@@ -64,6 +79,32 @@ struct BURN_SYMBOL
     BURN_VARIANT Value;
 };
 
+struct BURN_CONDITION_INSTRUCTION
+{
+    BURN_CONDITION_OPCODE opcode;
+    BURN_SYMBOL_TYPE comparison;
+    BURN_VARIANT constant;
+    LPWSTR sczVariable;
+    DWORD dwVariableReference; // see VariableGetVariantByReference.
+};
+
+typedef struct _BURN_CONDITION_PROGRAM
+{
+    LPWSTR sczCondition;
+    DWORD dwHash;
+
+    BURN_CONDITION_INSTRUCTION* rgInstructions;
+    DWORD cInstructions;
+
+    DWORD cStack; // depth of the boolean stack while compiling.
+    DWORD cMaxStack;
+
+    // last result, valid until one of the variables the program reads changes after qwResultGeneration.
+    BOOL fHasResult;
+    BOOL fResult;
+    DWORD64 qwResultGeneration;
+} BURN_CONDITION_PROGRAM;
+
 struct BURN_CONDITION_PARSE_CONTEXT
 {
     BURN_VARIABLES* pVariables;
@@ -71,6 +112,8 @@ struct BURN_CONDITION_PARSE_CONTEXT
     LPCWSTR wzRead;
     BURN_SYMBOL NextSymbol;
     BOOL fError;
+
+    BURN_CONDITION_PROGRAM* pProgram; // only set when compiling.
 };
 
 
@@ -96,6 +139,57 @@ static HRESULT ParseValue(
     __in BURN_CONDITION_PARSE_CONTEXT* pContext,
     __out BURN_VARIANT* pValue
     );
+static HRESULT TestValue(
+    __in BURN_VARIANT* pValue,
+    __out BOOL* pf
+    );
+static HRESULT GetConditionProgram(
+    __in BURN_VARIABLES* pVariables,
+    __in_z LPCWSTR wzCondition,
+    __out BURN_CONDITION_PROGRAM** ppProgram
+    );
+static HRESULT CompileCondition(
+    __in BURN_VARIABLES* pVariables,
+    __in_z LPCWSTR wzCondition,
+    __in DWORD dwHash,
+    __out BURN_CONDITION_PROGRAM** ppProgram
+    );
+static HRESULT CompileExpression(
+    __in BURN_CONDITION_PARSE_CONTEXT* pContext
+    );
+static HRESULT CompileBooleanTerm(
+    __in BURN_CONDITION_PARSE_CONTEXT* pContext
+    );
+static HRESULT CompileBooleanFactor(
+    __in BURN_CONDITION_PARSE_CONTEXT* pContext
+    );
+static HRESULT CompileTerm(
+    __in BURN_CONDITION_PARSE_CONTEXT* pContext
+    );
+static HRESULT CompileValue(
+    __in BURN_CONDITION_PARSE_CONTEXT* pContext
+    );
+static HRESULT EmitInstruction(
+    __in BURN_CONDITION_PROGRAM* pProgram,
+    __in BURN_CONDITION_OPCODE opcode,
+    __out_opt BURN_CONDITION_INSTRUCTION** ppInstruction
+    );
+static HRESULT EvaluateProgram(
+    __in BURN_VARIABLES* pVariables,
+    __in BURN_CONDITION_PROGRAM* pProgram,
+    __out BOOL* pf
+    );
+static BOOL ProgramInputsChangedSince(
+    __in BURN_VARIABLES* pVariables,
+    __in BURN_CONDITION_PROGRAM* pProgram,
+    __in DWORD64 qwGeneration
+    );
+static DWORD HashCondition(
+    __in_z LPCWSTR wzCondition
+    );
+static void FreeConditionProgram(
+    __in BURN_CONDITION_PROGRAM* pProgram
+    );
 static HRESULT Expect(
     __in BURN_CONDITION_PARSE_CONTEXT* pContext,
     __in BURN_SYMBOL_TYPE symbolType
@@ -136,6 +230,82 @@ extern "C" HRESULT ConditionEvaluate(
     __in_z LPCWSTR wzCondition,
     __out BOOL* pf
     )
+{
+    HRESULT hr = S_OK;
+    BOOL fCacheLocked = FALSE;
+    BURN_CONDITION_PROGRAM* pProgram = NULL;
+    BOOL fHasResult = FALSE;
+    BOOL f = FALSE;
+    DWORD64 qwGeneration = 0;
+
+    // the cache is only locked while it is looked at, the program reads its variables like any other caller
+    ::EnterCriticalSection(&pVariables->csCache);
+    fCacheLocked = TRUE;
+
+    hr = GetConditionProgram(pVariables, wzCondition, &pProgram);
+    ExitOnFailure(hr, "Failed to compile condition.");
+
+    if (S_OK == hr)
+    {
+        fHasResult = pProgram->fHasResult && !ProgramInputsChangedSince(pVariables, pProgram, pProgram->qwResultGeneration);
+        f = pProgram->fResult;
+
+        // taken before anything is read so a variable set while evaluating makes the result stale
+        qwGeneration = VariableGetGeneration(pVariables);
+    }
+
+    ::LeaveCriticalSection(&pVariables->csCache);
+    fCacheLocked = FALSE;
+
+    if (!pProgram)
+    {
+        // the cache is full, parsing and evaluating in one pass is cheaper than compiling a throw away program
+        hr = ConditionEvaluateInterpreted(pVariables, wzCondition, &f);
+        ExitOnFailure(hr, "Failed to evaluate condition.");
+    }
+    else
+    {
+        if (!fHasResult)
+        {
+            hr = EvaluateProgram(pVariables, pProgram, &f);
+            ExitOnFailure(hr, "Failed to evaluate compiled condition.");
+
+            ::EnterCriticalSection(&pVariables->csCache);
+
+            // another thread may have kept a newer result while this one was evaluating
+            if (!pProgram->fHasResult || pProgram->qwResultGeneration <= qwGeneration)
+            {
+                pProgram->fHasResult = TRUE;
+                pProgram->fResult = f;
+                pProgram->qwResultGeneration = qwGeneration;
+            }
+
+            ::LeaveCriticalSection(&pVariables->csCache);
+        }
+
+        LogId(REPORT_VERBOSE, MSG_CONDITION_RESULT, wzCondition, LoggingTrueFalseToString(f));
+    }
+
+    *pf = f;
+
+LExit:
+    if (fCacheLocked)
+    {
+        ::LeaveCriticalSection(&pVariables->csCache);
+    }
+
+    return hr;
+}
+
+//
+// ConditionEvaluateInterpreted - parses and evaluates a condition in one pass without compiling or
+// caching it. ConditionEvaluate falls back to this when its cache of compiled conditions is full.
+//
+extern "C" HRESULT ConditionEvaluateInterpreted(
+    __in BURN_VARIABLES* pVariables,
+    __in_z LPCWSTR wzCondition,
+    __out BOOL* pf
+    )
 {
     HRESULT hr = S_OK;
     BURN_CONDITION_PARSE_CONTEXT context = { };
@@ -166,9 +336,44 @@ LExit:
         LogErrorId(hr, MSG_FAILED_PARSE_CONDITION, wzCondition, NULL, NULL);
     }
 
+    BVariantUninitialize(&context.NextSymbol.Value);
+
     return hr;
 }
 
+//
+// ConditionInputsChangedSince - returns whether any variable the condition reads was set after
+// generation qwGeneration of the store. A condition that was never evaluated is always reported as
+// changed.
+//
+extern "C" BOOL ConditionInputsChangedSince(
+    __in BURN_VARIABLES* pVariables,
+    __in_z LPCWSTR wzCondition,
+    __in DWORD64 qwGeneration
+    )
+{
+    HRESULT hr = S_OK;
+    BOOL fChanged = TRUE;
+    BURN_CONDITION_PROGRAM* pProgram = NULL;
+
+    ::EnterCriticalSection(&pVariables->csCache);
+
+    hr = GetConditionProgram(pVariables, wzCondition, &pProgram);
+    if (FAILED(hr))
+    {
+        TraceError(hr, "Failed to compile condition, assuming its inputs changed.");
+    }
+    else if (S_OK == hr && pProgram->fHasResult)
+    {
+        // only an evaluated program knows which variables it read.
+        fChanged = ProgramInputsChangedSince(pVariables, pProgram, qwGeneration);
+    }
+
+    ::LeaveCriticalSection(&pVariables->csCache);
+
+    return fChanged;
+}
+
 extern "C" HRESULT ConditionGlobalCheck(
     __in BURN_VARIABLES* pVariables,
     __in BURN_CONDITION* pCondition,
@@ -246,6 +451,27 @@ LExit:
 }
 
 
+extern "C" void ConditionUninitializeCache(
+    __in BURN_VARIABLES* pVariables
+    )
+{
+    if (pVariables->rgpConditionProgramBuckets)
+    {
+        for (DWORD i = 0; i < CONDITION_PROGRAM_CACHE_BUCKETS; ++i)
+        {
+            if (pVariables->rgpConditionProgramBuckets[i])
+            {
+                FreeConditionProgram(pVariables->rgpConditionProgramBuckets[i]);
+            }
+        }
+        MemFree(pVariables->rgpConditionProgramBuckets);
+        pVariables->rgpConditionProgramBuckets = NULL;
+    }
+
+    pVariables->cConditionPrograms = 0;
+}
+
+
 // internal function definitions
 
 static HRESULT ParseExpression(
@@ -377,41 +603,7 @@ static HRESULT ParseTerm(
     }
     else
     {
-        LONGLONG llValue = 0;
-        LPWSTR sczValue = NULL;
-        DWORD64 qwValue = 0;
-        switch (firstValue.Type)
-        {
-        case BURN_VARIANT_TYPE_NONE:
-            *pf = FALSE;
-            break;
-        case BURN_VARIANT_TYPE_STRING:
-            hr = BVariantGetString(&firstValue, &sczValue);
-            if (SUCCEEDED(hr))
-            {
-                *pf = sczValue && *sczValue;
-            }
-            StrSecureZeroFreeString(sczValue);
-            break;
-        case BURN_VARIANT_TYPE_NUMERIC:
-            hr = BVariantGetNumeric(&firstValue, &llValue);
-            if (SUCCEEDED(hr))
-            {
-                *pf = 0 != llValue;
-            }
-            SecureZeroMemory(&llValue, sizeof(llValue));
-            break;
-        case BURN_VARIANT_TYPE_VERSION:
-            hr = BVariantGetVersion(&firstValue, &qwValue);
-            if (SUCCEEDED(hr))
-            {
-                *pf = 0 != qwValue;
-            }
-            SecureZeroMemory(&llValue, sizeof(qwValue));
-            break;
-        default:
-            ExitFunction1(hr = E_UNEXPECTED);
-        }
+        hr = TestValue(&firstValue, pf);
     }
 
 LExit:
@@ -463,6 +655,554 @@ LExit:
     return hr;
 }
 
+//
+// TestValue - a value on its own is true when it is set, non-empty and non-zero.
+//
+static HRESULT TestValue(
+    __in BURN_VARIANT* pValue,
+    __out BOOL* pf
+    )
+{
+    HRESULT hr = S_OK;
+    LONGLONG llValue = 0;
+    LPWSTR sczValue = NULL;
+    DWORD64 qwValue = 0;
+
+    switch (pValue->Type)
+    {
+    case BURN_VARIANT_TYPE_NONE:
+        *pf = FALSE;
+        break;
+    case BURN_VARIANT_TYPE_STRING:
+        hr = BVariantGetString(pValue, &sczValue);
+        if (SUCCEEDED(hr))
+        {
+            *pf = sczValue && *sczValue;
+        }
+        StrSecureZeroFreeString(sczValue);
+        break;
+    case BURN_VARIANT_TYPE_NUMERIC:
+        hr = BVariantGetNumeric(pValue, &llValue);
+        if (SUCCEEDED(hr))
+        {
+            *pf = 0 != llValue;
+        }
+        SecureZeroMemory(&llValue, sizeof(llValue));
+        break;
+    case BURN_VARIANT_TYPE_VERSION:
+        hr = BVariantGetVersion(pValue, &qwValue);
+        if (SUCCEEDED(hr))
+        {
+            *pf = 0 != qwValue;
+        }
+        SecureZeroMemory(&qwValue, sizeof(qwValue));
+        break;
+    default:
+        hr = E_UNEXPECTED;
+    }
+
+    return hr;
+}
+
+//
+// GetConditionProgram - finds the compiled program for a condition in the
+//                       cache, compiling it on a miss. Returns S_FALSE
+//                       without a program when the cache is full.
+//
+static HRESULT GetConditionProgram(
+    __in BURN_VARIABLES* pVariables,
+    __in_z LPCWSTR wzCondition,
+    __out BURN_CONDITION_PROGRAM** ppProgram
+    )
+{
+    HRESULT hr = S_OK;
+    DWORD dwHash = HashCondition(wzCondition);
+    DWORD iBucket = 0;
+    BURN_CONDITION_PROGRAM* pProgram = NULL;
+
+    if (pVariables->rgpConditionProgramBuckets)
+    {
+        for (iBucket = dwHash & (CONDITION_PROGRAM_CACHE_BUCKETS - 1); pVariables->rgpConditionProgramBuckets[iBucket]; iBucket = (iBucket + 1) & (CONDITION_PROGRAM_CACHE_BUCKETS - 1))
+        {
+            pProgram = pVariables->rgpConditionProgramBuckets[iBucket];
+            if (dwHash == pProgram->dwHash && 0 == lstrcmpW(wzCondition, pProgram->sczCondition))
+            {
+                *ppProgram = pProgram;
+                ExitFunction();
+            }
+        }
+    }
+
+    if (MAX_CONDITION_PROGRAMS <= pVariables->cConditionPrograms)
+    {
+        ExitFunction1(hr = S_FALSE);
+    }
+
+    if (!pVariables->rgpConditionProgramBuckets)
+    {
+        pVariables->rgpConditionProgramBuckets = (BURN_CONDITION_PROGRAM**)MemAlloc(sizeof(BURN_CONDITION_PROGRAM*) * CONDITION_PROGRAM_CACHE_BUCKETS, TRUE);
+        ExitOnNull(pVariables->rgpConditionProgramBuckets, hr, E_OUTOFMEMORY, "Failed to allocate condition cache.");
+    }
+
+    hr = CompileCondition(pVariables, wzCondition, dwHash, &pProgram);
+    ExitOnFailure(hr, "Failed to compile condition: %ls", wzCondition);
+
+    iBucket = dwHash & (CONDITION_PROGRAM_CACHE_BUCKETS - 1);
+    while (pVariables->rgpConditionProgramBuckets[iBucket])
+    {
+        iBucket = (iBucket + 1) & (CONDITION_PROGRAM_CACHE_BUCKETS - 1);
+    }
+
+    pVariables->rgpConditionProgramBuckets[iBucket] = pProgram;
+    ++pVariables->cConditionPrograms;
+
+    *ppProgram = pProgram;
+
+LExit:
+    return hr;
+}
+
+//
+// CompileCondition - parses a condition with the same grammar as the
+//                    interpreter, emitting postfix instructions instead of
+//                    evaluating as it goes.
+//
+static HRESULT CompileCondition(
+    __in BURN_VARIABLES* pVariables,
+    __in_z LPCWSTR wzCondition,
+    __in DWORD dwHash,
+    __out BURN_CONDITION_PROGRAM** ppProgram
+    )
+{
+    HRESULT hr = S_OK;
+    BURN_CONDITION_PARSE_CONTEXT context = { };
+
+    context.pProgram = (BURN_CONDITION_PROGRAM*)MemAlloc(sizeof(BURN_CONDITION_PROGRAM), TRUE);
+    ExitOnNull(context.pProgram, hr, E_OUTOFMEMORY, "Failed to allocate condition program.");
+
+    hr = StrAllocString(&context.pProgram->sczCondition, wzCondition, 0);
+    ExitOnFailure(hr, "Failed to copy condition.");
+
+    context.pProgram->dwHash = dwHash;
+    context.pVariables = pVariables;
+    context.wzCondition = wzCondition;
+    context.wzRead = wzCondition;
+
+    hr = NextSymbol(&context);
+    ExitOnFailure(hr, "Failed to read next symbol.");
+
+    hr = CompileExpression(&context);
+    ExitOnFailure(hr, "Failed to compile expression.");
+
+    hr = Expect(&context, BURN_SYMBOL_TYPE_END);
+    ExitOnFailure(hr, "Failed to expect end symbol.");
+
+    Assert(1 == context.pProgram->cStack);
+
+    *ppProgram = context.pProgram;
+    context.pProgram = NULL;
+
+LExit:
+    if (context.fError)
+    {
+        Assert(FAILED(hr));
+        LogErrorId(hr, MSG_FAILED_PARSE_CONDITION, wzCondition, NULL, NULL);
+    }
+
+    BVariantUninitialize(&context.NextSymbol.Value);
+
+    if (context.pProgram)
+    {
+        FreeConditionProgram(context.pProgram);
+    }
+
+    return hr;
+}
+
+static HRESULT CompileExpression(
+    __in BURN_CONDITION_PARSE_CONTEXT* pContext
+    )
+{
+    HRESULT hr = S_OK;
+
+    hr = CompileBooleanTerm(pContext);
+    ExitOnFailure(hr, "Failed to compile boolean-term.");
+
+    if (BURN_SYMBOL_TYPE_OR == pContext->NextSymbol.Type)
+    {
+        hr = NextSymbol(pContext);
+        ExitOnFailure(hr, "Failed to read next symbol.");
+
+        hr = CompileExpression(pContext);
+        ExitOnFailure(hr, "Failed to compile expression.");
+
+        hr = EmitInstruction(pContext->pProgram, BURN_CONDITION_OPCODE_OR, NULL);
+        ExitOnFailure(hr, "Failed to emit OR.");
+    }
+
+LExit:
+    return hr;
+}
+
+static HRESULT CompileBooleanTerm(
+    __in BURN_CONDITION_PARSE_CONTEXT* pContext
+    )
+{
+    HRESULT hr = S_OK;
+
+    hr = CompileBooleanFactor(pContext);
+    ExitOnFailure(hr, "Failed to compile boolean-factor.");
+
+    if (BURN_SYMBOL_TYPE_AND == pContext->NextSymbol.Type)
+    {
+        hr = NextSymbol(pContext);
+        ExitOnFailure(hr, "Failed to read next symbol.");
+
+        hr = CompileBooleanTerm(pContext);
+        ExitOnFailure(hr, "Failed to compile boolean-term.");
+
+        hr = EmitInstruction(pContext->pProgram, BURN_CONDITION_OPCODE_AND, NULL);
+        ExitOnFailure(hr, "Failed to emit AND.");
+    }
+
+LExit:
+    return hr;
+}
+
+static HRESULT CompileBooleanFactor(
+    __in BURN_CONDITION_PARSE_CONTEXT* pContext
+    )
+{
+    HRESULT hr = S_OK;
+    BOOL fNot = FALSE;
+
+    if (BURN_SYMBOL_TYPE_NOT == pContext->NextSymbol.Type)
+    {
+        hr = NextSymbol(pContext);
+        ExitOnFailure(hr, "Failed to read next symbol.");
+
+        fNot = TRUE;
+    }
+
+    hr = CompileTerm(pContext);
+    ExitOnFailure(hr, "Failed to compile term.");
+
+    if (fNot)
+    {
+        hr = EmitInstruction(pContext->pProgram, BURN_CONDITION_OPCODE_NOT, NULL);
+        ExitOnFailure(hr, "Failed to emit NOT.");
+    }
+
+LExit:
+    return hr;
+}
+
+static HRESULT CompileTerm(
+    __in BURN_CONDITION_PARSE_CONTEXT* pContext
+    )
+{
+    HRESULT hr = S_OK;
+    BURN_CONDITION_INSTRUCTION* pInstruction = NULL;
+
+    if (BURN_SYMBOL_TYPE_LPAREN == pContext->NextSymbol.Type)
+    {
+        hr = NextSymbol(pContext);
+        ExitOnFailure(hr, "Failed to read next symbol.");
+
+        hr = CompileExpression(pContext);
+        ExitOnFailure(hr, "Failed to compile expression.");
+
+        hr = Expect(pContext, BURN_SYMBOL_TYPE_RPAREN);
+        ExitOnFailure(hr, "Failed to expect right parenthesis.");
+
+        ExitFunction1(hr = S_OK);
+    }
+
+    hr = CompileValue(pContext);
+    ExitOnFailure(hr, "Failed to compile value.");
+
+    if (COMPARISON & pContext->NextSymbol.Type)
+    {
+        BURN_SYMBOL_TYPE comparison = pContext->NextSymbol.Type;
+
+        hr = NextSymbol(pContext);
+        ExitOnFailure(hr, "Failed to read next symbol.");
+
+        hr = CompileValue(pContext);
+        ExitOnFailure(hr, "Failed to compile value.");
+
+        hr = EmitInstruction(pContext->pProgram, BURN_CONDITION_OPCODE_COMPARE, &pInstruction);
+        ExitOnFailure(hr, "Failed to emit comparison.");
+
+        pInstruction->comparison = comparison;
+    }
+    else
+    {
+        hr = EmitInstruction(pContext->pProgram, BURN_CONDITION_OPCODE_TEST, NULL);
+        ExitOnFailure(hr, "Failed to emit test.");
+    }
+
+LExit:
+    return hr;
+}
+
+static HRESULT CompileValue(
+    __in BURN_CONDITION_PARSE_CONTEXT* pContext
+    )
+{
+    HRESULT hr = S_OK;
+    BURN_CONDITION_INSTRUCTION* pInstruction = NULL;
+
+    // Symbols don't encrypt their value, so can access the value directly.
+    switch (pContext->NextSymbol.Type)
+    {
+    case BURN_SYMBOL_TYPE_IDENTIFIER:
+        Assert(BURN_VARIANT_TYPE_STRING == pContext->NextSymbol.Value.Type);
+
+        hr = EmitInstruction(pContext->pProgram, BURN_CONDITION_OPCODE_VARIABLE, &pInstruction);
+        ExitOnFailure(hr, "Failed to emit variable.");
+
+        hr = StrAllocString(&pInstruction->sczVariable, pContext->NextSymbol.Value.sczValue, 0);
+        ExitOnFailure(hr, "Failed to copy variable name.");
+        break;
+
+    case BURN_SYMBOL_TYPE_NUMBER: __fallthrough;
+    case BURN_SYMBOL_TYPE_LITERAL: __fallthrough;
+    case BURN_SYMBOL_TYPE_VERSION:
+        hr = EmitInstruction(pContext->pProgram, BURN_CONDITION_OPCODE_CONSTANT, &pInstruction);
+        ExitOnFailure(hr, "Failed to emit constant.");
+
+        // steal value of symbol
+        memcpy_s(&pInstruction->constant, sizeof(BURN_VARIANT), &pContext->NextSymbol.Value, sizeof(BURN_VARIANT));
+        memset(&pContext->NextSymbol.Value, 0, sizeof(BURN_VARIANT));
+        break;
+
+    default:
+        pContext->fError = TRUE;
+        hr = E_INVALIDDATA;
+        ExitOnRootFailure2(hr, "Failed to parse condition '%ls' at position: %u", pContext->wzCondition, pContext->NextSymbol.iPosition);
+    }
+
+    // get next symbol
+    hr = NextSymbol(pContext);
+    ExitOnFailure(hr, "Failed to read next symbol.");
+
+LExit:
+    return hr;
+}
+
+static HRESULT EmitInstruction(
+    __in BURN_CONDITION_PROGRAM* pProgram,
+    __in BURN_CONDITION_OPCODE opcode,
+    __out_opt BURN_CONDITION_INSTRUCTION** ppInstruction
+    )
+{
+    HRESULT hr = S_OK;
+    BURN_CONDITION_INSTRUCTION* pInstruction = NULL;
+
+    hr = MemEnsureArraySize(reinterpret_cast<LPVOID*>(&pProgram->rgInstructions), pProgram->cInstructions + 1, sizeof(BURN_CONDITION_INSTRUCTION), 8);
+    ExitOnFailure(hr, "Failed to grow condition instruction array.");
+
+    pInstruction = &pProgram->rgInstructions[pProgram->cInstructions];
+    pInstruction->opcode = opcode;
+    ++pProgram->cInstructions;
+
+    // track how deep the boolean stack gets so evaluation can size it up front
+    switch (opcode)
+    {
+    case BURN_CONDITION_OPCODE_TEST: __fallthrough;
+    case BURN_CONDITION_OPCODE_COMPARE:
+        ++pProgram->cStack;
+        if (pProgram->cMaxStack < pProgram->cStack)
+        {
+            pProgram->cMaxStack = pProgram->cStack;
+        }
+        break;
+
+    case BURN_CONDITION_OPCODE_AND: __fallthrough;
+    case BURN_CONDITION_OPCODE_OR:
+        --pProgram->cStack;
+        break;
+    }
+
+    if (ppInstruction)
+    {
+        *ppInstruction = pInstruction;
+    }
+
+LExit:
+    return hr;
+}
+
+//
+// EvaluateProgram - runs a compiled condition on a small stack machine.
+//                   Both operands of AND and OR are always evaluated, just
+//                   like the interpreter, so errors surface the same way.
+//
+static HRESULT EvaluateProgram(
+    __in BURN_VARIABLES* pVariables,
+    __in BURN_CONDITION_PROGRAM* pProgram,
+    __out BOOL* pf
+    )
+{
+    HRESULT hr = S_OK;
+    BOOL rgfStackBuffer[CONDITION_STACK_SIZE] = { };
+    BOOL* rgfStack = rgfStackBuffer;
+    DWORD cStack = 0;
+    BURN_VARIANT rgValues[2] = { };
+    BURN_VARIANT* rgpValues[2] = { };
+    DWORD cValues = 0;
+    BOOL f = FALSE;
+
+    if (countof(rgfStackBuffer) < pProgram->cMaxStack)
+    {
+        rgfStack = (BOOL*)MemAlloc(sizeof(BOOL) * pProgram->cMaxStack, TRUE);
+        ExitOnNull(rgfStack, hr, E_OUTOFMEMORY, "Failed to allocate condition stack.");
+    }
+
+    for (DWORD i = 0; i < pProgram->cInstructions; ++i)
+    {
+        BURN_CONDITION_INSTRUCTION* pInstruction = &pProgram->rgInstructions[i];
+
+        switch (pInstruction->opcode)
+        {
+        case BURN_CONDITION_OPCODE_VARIABLE:
+            hr = VariableGetVariantByReference(pVariables, pInstruction->sczVariable, &pInstruction->dwVariableReference, &rgValues[cValues]);
+            if (E_NOTFOUND != hr)
+            {
+                ExitOnRootFailure(hr, "Failed to find variable.");
+            }
+            hr = S_OK;
+
+            rgpValues[cValues] = &rgValues[cValues];
+            ++cValues;
+            break;
+
+        case BURN_CONDITION_OPCODE_CONSTANT:
+            rgpValues[cValues] = &pInstruction->constant;
+            ++cValues;
+            break;
+
+        case BURN_CONDITION_OPCODE_TEST:
+            hr = TestValue(rgpValues[0], &f);
+            ExitOnFailure(hr, "Failed to test value.");
+
+            rgfStack[cStack++] = f;
+            break;
+
+        case BURN_CONDITION_OPCODE_COMPARE:
+            hr = CompareValues(pInstruction->comparison, *rgpValues[0], *rgpValues[1], &f);
+            ExitOnFailure(hr, "Failed to compare value.");
+
+            rgfStack[cStack++] = f;
+            break;
+
+        case BURN_CONDITION_OPCODE_NOT:
+            rgfStack[cStack - 1] = !rgfStack[cStack - 1];
+            break;
+
+        case BURN_CONDITION_OPCODE_AND:
+            --cStack;
+            rgfStack[cStack - 1] = rgfStack[cStack - 1] && rgfStack[cStack];
+            break;
+
+        case BURN_CONDITION_OPCODE_OR:
+            --cStack;
+            rgfStack[cStack - 1] = rgfStack[cStack - 1] || rgfStack[cStack];
+            break;
+
+        default:
+            ExitFunction1(hr = E_UNEXPECTED);
+        }
+
+        // the values of a term are consumed as soon as it is decided
+        if (BURN_CONDITION_OPCODE_TEST == pInstruction->opcode || BURN_CONDITION_OPCODE_COMPARE == pInstruction->opcode)
+        {
+            BVariantUninitialize(&rgValues[0]);
+            BVariantUninitialize(&rgValues[1]);
+            cValues = 0;
+        }
+    }
+
+    Assert(1 == cStack);
+    *pf = rgfStack[0];
+
+LExit:
+    BVariantUninitialize(&rgValues[0]);
+    BVariantUninitialize(&rgValues[1]);
+
+    if (rgfStack != rgfStackBuffer)
+    {
+        MemFree(rgfStack);
+    }
+
+    return hr;
+}
+
+//
+// ProgramInputsChangedSince - the variable instructions are the program's
+//                             inputs, so its last result still holds when
+//                             none of them changed.
+//
+static BOOL ProgramInputsChangedSince(
+    __in BURN_VARIABLES* pVariables,
+    __in BURN_CONDITION_PROGRAM* pProgram,
+    __in DWORD64 qwGeneration
+    )
+{
+    if (VariableGetGeneration(pVariables) == qwGeneration)
+    {
+        return FALSE;
+    }
+
+    for (DWORD i = 0; i < pProgram->cInstructions; ++i)
+    {
+        BURN_CONDITION_INSTRUCTION* pInstruction = &pProgram->rgInstructions[i];
+
+        if (BURN_CONDITION_OPCODE_VARIABLE == pInstruction->opcode && VariableHasChangedSince(pVariables, pInstruction->dwVariableReference, qwGeneration))
+        {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+//
+// HashCondition - FNV-1a over the UTF-16 code units of the condition.
+//
+static DWORD HashCondition(
+    __in_z LPCWSTR wzCondition
+    )
+{
+    DWORD dwHash = 2166136261;
+
+    for (LPCWSTR wz = wzCondition; *wz; ++wz)
+    {
+        dwHash = (dwHash ^ *wz) * 16777619;
+    }
+
+    return dwHash;
+}
+
+static void FreeConditionProgram(
+    __in BURN_CONDITION_PROGRAM* pProgram
+    )
+{
+    if (pProgram->rgInstructions)
+    {
+        for (DWORD i = 0; i < pProgram->cInstructions; ++i)
+        {
+            BVariantUninitialize(&pProgram->rgInstructions[i].constant);
+            ReleaseStr(pProgram->rgInstructions[i].sczVariable);
+        }
+        MemFree(pProgram->rgInstructions);
+    }
+
+    ReleaseStr(pProgram->sczCondition);
+    MemFree(pProgram);
+}
+
 //
 // Expect - expects a symbol.
 //
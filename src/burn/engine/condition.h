@@ -21,6 +21,19 @@ HRESULT ConditionEvaluate(
     __in_z LPCWSTR wzCondition,
     __out BOOL* pf
     );
+HRESULT ConditionEvaluateInterpreted(
+    __in BURN_VARIABLES* pVariables,
+    __in_z LPCWSTR wzCondition,
+    __out BOOL* pf
+    );
+BOOL ConditionInputsChangedSince(
+    __in BURN_VARIABLES* pVariables,
+    __in_z LPCWSTR wzCondition,
+    __in DWORD64 qwGeneration
+    );
+void ConditionUninitializeCache(
+    __in BURN_VARIABLES* pVariables
+    );
 HRESULT ConditionGlobalCheck(
     __in BURN_VARIABLES* pVariables,
     __in BURN_CONDITION* pBlock,
@@ -47,6 +47,9 @@ extern "C" HRESULT ContainersParseFromXml(
 
     pContainers->cContainers = cNodes;
 
+    hr = DictCreateWithEmbeddedKey(&pContainers->sdContainers, cNodes, reinterpret_cast<void**>(&pContainers->rgContainers), offsetof(BURN_CONTAINER, sczId), DICT_FLAG_NONE);
+    ExitOnFailure(hr, "Failed to create container id index.");
+
     // parse search elements
     for (DWORD i = 0; i < cNodes; ++i)
     {
@@ -55,13 +58,34 @@ extern "C" HRESULT ContainersParseFromXml(
         hr = XmlNextElement(pixnNodes, &pixnNode, NULL);
         ExitOnFailure(hr, "Failed to get next node.");
 
-        // TODO: Read type from manifest. Today only CABINET is supported.
-        pContainer->type = BURN_CONTAINER_TYPE_CABINET;
-
         // @Id
         hr = XmlGetAttributeEx(pixnNode, L"Id", &pContainer->sczId);
         ExitOnFailure(hr, "Failed to get @Id.");
 
+        hr = DictAddValue(pContainers->sdContainers, pContainer);
+        ExitOnFailure(hr, "Failed to index container: %ls", pContainer->sczId);
+
+        // @Type
+        hr = XmlGetAttributeEx(pixnNode, L"Type", &scz);
+        if (E_NOTFOUND == hr || (SUCCEEDED(hr) && CSTR_EQUAL == ::CompareStringW(LOCALE_INVARIANT, 0, scz, -1, L"cabinet", -1)))
+        {
+            pContainer->type = BURN_CONTAINER_TYPE_CABINET;
+        }
+        else
+        {
+            ExitOnFailure(hr, "Failed to get @Type.");
+
+            if (CSTR_EQUAL == ::CompareStringW(LOCALE_INVARIANT, 0, scz, -1, L"chunked", -1))
+            {
+                pContainer->type = BURN_CONTAINER_TYPE_CHUNKED;
+            }
+            else
+            {
+                hr = E_INVALIDARG;
+                ExitOnFailure1(hr, "Invalid value for @Type: %ls", scz);
+            }
+        }
+
         // @Primary
         hr = XmlGetYesNoAttribute(pixnNode, L"Primary", &pContainer->fPrimary);
         if (E_NOTFOUND != hr)
@@ -172,6 +196,8 @@ extern "C" void ContainersUninitialize(
         MemFree(pContainers->rgContainers);
     }
 
+    ReleaseDict(pContainers->sdContainers);
+
     // clear struct
     memset(pContainers, 0, sizeof(BURN_CONTAINERS));
 }
@@ -254,6 +280,10 @@ extern "C" HRESULT ContainerOpen(
     case BURN_CONTAINER_TYPE_CABINET:
         hr = CabExtractOpen(pContext, wzFilePath);
         break;
+
+    case BURN_CONTAINER_TYPE_CHUNKED:
+        hr = ChunkExtractOpen(pContext, wzFilePath);
+        break;
     }
     ExitOnFailure(hr, "Failed to open container.");
 
@@ -273,6 +303,10 @@ extern "C" HRESULT ContainerNextStream(
     case BURN_CONTAINER_TYPE_CABINET:
         hr = CabExtractNextStream(pContext, psczStreamName);
         break;
+
+    case BURN_CONTAINER_TYPE_CHUNKED:
+        hr = ChunkExtractNextStream(pContext, psczStreamName);
+        break;
     }
 
 //LExit:
@@ -281,7 +315,9 @@ extern "C" HRESULT ContainerNextStream(
 
 extern "C" HRESULT ContainerStreamToFile(
     __in BURN_CONTAINER_CONTEXT* pContext,
-    __in_z LPCWSTR wzFileName
+    __in_z LPCWSTR wzFileName,
+    __out_bcount_opt(cbHash) BYTE* pbHash,
+    __in DWORD cbHash
     )
 {
     HRESULT hr = S_OK;
@@ -289,7 +325,11 @@ extern "C" HRESULT ContainerStreamToFile(
     switch (pContext->type)
     {
     case BURN_CONTAINER_TYPE_CABINET:
-        hr = CabExtractStreamToFile(pContext, wzFileName);
+        hr = CabExtractStreamToFile(pContext, wzFileName, pbHash, cbHash);
+        break;
+
+    case BURN_CONTAINER_TYPE_CHUNKED:
+        hr = ChunkExtractStreamToFile(pContext, wzFileName, pbHash, cbHash);
         break;
     }
 
@@ -310,6 +350,10 @@ extern "C" HRESULT ContainerStreamToBuffer(
     case BURN_CONTAINER_TYPE_CABINET:
         hr = CabExtractStreamToBuffer(pContext, ppbBuffer, pcbBuffer);
         break;
+
+    case BURN_CONTAINER_TYPE_CHUNKED:
+        hr = ChunkExtractStreamToBuffer(pContext, ppbBuffer, pcbBuffer);
+        break;
     }
 
 //LExit:
@@ -327,6 +371,33 @@ extern "C" HRESULT ContainerSkipStream(
     case BURN_CONTAINER_TYPE_CABINET:
         hr = CabExtractSkipStream(pContext);
         break;
+
+    case BURN_CONTAINER_TYPE_CHUNKED:
+        hr = ChunkExtractSkipStream(pContext);
+        break;
+    }
+
+//LExit:
+    return hr;
+}
+
+extern "C" HRESULT ContainerExtractStreams(
+    __in BURN_CONTAINER_CONTEXT* pContext,
+    __in_ecount(cStreams) BURN_CONTAINER_EXTRACT_STREAM* rgStreams,
+    __in DWORD cStreams
+    )
+{
+    HRESULT hr = S_OK;
+
+    switch (pContext->type)
+    {
+    case BURN_CONTAINER_TYPE_CABINET:
+        hr = CabExtractStreams(pContext, rgStreams, cStreams);
+        break;
+
+    case BURN_CONTAINER_TYPE_CHUNKED:
+        hr = ChunkExtractStreams(pContext, rgStreams, cStreams);
+        break;
     }
 
 //LExit:
@@ -346,6 +417,11 @@ extern "C" HRESULT ContainerClose(
         hr = CabExtractClose(pContext);
         ExitOnFailure(hr, "Failed to close cabinet.");
         break;
+
+    case BURN_CONTAINER_TYPE_CHUNKED:
+        hr = ChunkExtractClose(pContext);
+        ExitOnFailure(hr, "Failed to close chunked container.");
+        break;
     }
 
 LExit:
@@ -368,18 +444,18 @@ extern "C" HRESULT ContainerFindById(
     HRESULT hr = S_OK;
     BURN_CONTAINER* pContainer = NULL;
 
-    for (DWORD i = 0; i < pContainers->cContainers; ++i)
+    if (!pContainers->sdContainers)
     {
-        pContainer = &pContainers->rgContainers[i];
-
-        if (CSTR_EQUAL == ::CompareStringW(LOCALE_INVARIANT, 0, pContainer->sczId, -1, wzId, -1))
-        {
-            *ppContainer = pContainer;
-            ExitFunction1(hr = S_OK);
-        }
+        ExitFunction1(hr = E_NOTFOUND);
     }
 
-    hr = E_NOTFOUND;
+    hr = DictGetValue(pContainers->sdContainers, wzId, reinterpret_cast<void**>(&pContainer));
+    if (E_NOTFOUND != hr)
+    {
+        ExitOnFailure(hr, "Failed to look up container: %ls", wzId);
+
+        *ppContainer = pContainer;
+    }
 
 LExit:
     return hr;
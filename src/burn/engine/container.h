@@ -40,6 +40,7 @@ enum BURN_CONTAINER_TYPE
     BURN_CONTAINER_TYPE_NONE,
     BURN_CONTAINER_TYPE_CABINET,
     BURN_CONTAINER_TYPE_SEVENZIP,
+    BURN_CONTAINER_TYPE_CHUNKED,
 };
 
 enum BURN_CAB_OPERATION
@@ -49,6 +50,7 @@ enum BURN_CAB_OPERATION
     BURN_CAB_OPERATION_STREAM_TO_FILE,
     BURN_CAB_OPERATION_STREAM_TO_BUFFER,
     BURN_CAB_OPERATION_SKIP_STREAM,
+    BURN_CAB_OPERATION_EXTRACT_STREAMS,
     BURN_CAB_OPERATION_CLOSE,
 };
 
@@ -81,8 +83,20 @@ typedef struct _BURN_CONTAINERS
 {
     BURN_CONTAINER* rgContainers;
     DWORD cContainers;
+    STRINGDICT_HANDLE sdContainers; // index of rgContainers by id.
 } BURN_CONTAINERS;
 
+typedef struct _BURN_CONTAINER_EXTRACT_STREAM
+{
+    LPCWSTR wzStreamName;
+    LPCWSTR wzTargetFile;
+    BYTE* pbHash;               // optional, receives the hash of the stream as it is written.
+    DWORD cbHash;
+
+    BOOL fExtracted;            // set when the stream was found in the container and written to wzTargetFile.
+    BOOL fHashed;               // set when pbHash received the hash of the stream, not all container types hash.
+} BURN_CONTAINER_EXTRACT_STREAM;
+
 typedef struct _BURN_CONTAINER_CONTEXT_CABINET_VIRTUAL_FILE_POINTER
 {
     HANDLE hFile;
@@ -106,11 +120,28 @@ typedef struct _BURN_CONTAINER_CONTEXT_CABINET
     BYTE* pbTargetBuffer;
     DWORD cbTargetBuffer;
     DWORD iTargetBuffer;
+    BYTE* pbTargetHash;
+    DWORD cbTargetHash;
+    DWORD dwTargetHashProvType;
+    HCRYPTPROV hTargetHashProv;
+    HCRYPTHASH hTargetHash;
+
+    BURN_CONTAINER_EXTRACT_STREAM* rgExtractStreams;
+    DWORD cExtractStreams;
+    STRINGDICT_HANDLE sdExtractStreams; // index of rgExtractStreams by stream name.
+    BURN_CONTAINER_EXTRACT_STREAM* pExtractStream;
 
     BURN_CONTAINER_CONTEXT_CABINET_VIRTUAL_FILE_POINTER* rgVirtualFilePointers;
     DWORD cVirtualFilePointers;
 } BURN_CONTAINER_CONTEXT_CABINET;
 
+typedef struct _BURN_CONTAINER_CONTEXT_CHUNKED
+{
+    HANDLE hReader;
+    DWORD iNextStream;
+    DWORD iStream;              // stream returned by the last call to next stream.
+} BURN_CONTAINER_CONTEXT_CHUNKED;
+
 typedef struct _BURN_CONTAINER_CONTEXT
 {
     HANDLE hFile;
@@ -127,6 +158,7 @@ typedef struct _BURN_CONTAINER_CONTEXT
     union
     {
         BURN_CONTAINER_CONTEXT_CABINET Cabinet;
+        BURN_CONTAINER_CONTEXT_CHUNKED Chunked;
     };
 
 } BURN_CONTAINER_CONTEXT;
@@ -158,7 +190,9 @@ HRESULT ContainerNextStream(
     );
 HRESULT ContainerStreamToFile(
     __in BURN_CONTAINER_CONTEXT* pContext,
-    __in_z LPCWSTR wzFileName
+    __in_z LPCWSTR wzFileName,
+    __out_bcount_opt(cbHash) BYTE* pbHash,
+    __in DWORD cbHash
     );
 HRESULT ContainerStreamToBuffer(
     __in BURN_CONTAINER_CONTEXT* pContext,
@@ -168,6 +202,11 @@ HRESULT ContainerStreamToBuffer(
 HRESULT ContainerSkipStream(
     __in BURN_CONTAINER_CONTEXT* pContext
     );
+HRESULT ContainerExtractStreams(
+    __in BURN_CONTAINER_CONTEXT* pContext,
+    __in_ecount(cStreams) BURN_CONTAINER_EXTRACT_STREAM* rgStreams,
+    __in DWORD cStreams
+    );
 HRESULT ContainerClose(
     __in BURN_CONTAINER_CONTEXT* pContext
     );
@@ -3,6 +3,11 @@
 #include "precomp.h"
 
 
+// constants
+
+static const DWORD DETECT_MAX_THREADS = 8;
+
+
 // structs
 
 struct BURN_CACHE_THREAD_CONTEXT
@@ -12,6 +17,19 @@ struct BURN_CACHE_THREAD_CONTEXT
     BOOL* pfRollback;
 };
 
+struct BURN_DETECT_THREAD_CONTEXT
+{
+    BURN_ENGINE_STATE* pEngineState;
+    CRITICAL_SECTION cs;
+    HANDLE hPackageDetected;        // auto-reset, set each time a detect thread finishes a package.
+    volatile LONG lNextPackage;     // next package for a detect thread to take.
+    volatile BOOL fStop;            // set when detect ends early so the detect threads stop taking packages.
+
+    BOOL* rgfDetected;              // guarded by cs.
+    HRESULT* rghrPayloadsCached;    // guarded by cs.
+    HRESULT* rghrDetect;            // guarded by cs.
+};
+
 
 // internal function declarations
 
@@ -39,9 +57,28 @@ static HRESULT ParsePipeConnection(
     __in LPWSTR* rgArgs,
     __in BURN_PIPE_CONNECTION* pConnection
     );
-static HRESULT DetectPackagePayloadsCached(
+static HRESULT DetectPackage(
+    __in BURN_ENGINE_STATE* pEngineState,
     __in BURN_PACKAGE* pPackage
     );
+static HRESULT StartDetectThreads(
+    __in BURN_ENGINE_STATE* pEngineState,
+    __in BURN_DETECT_THREAD_CONTEXT* pContext,
+    __in_ecount(DETECT_MAX_THREADS) HANDLE* rghThreads,
+    __out DWORD* pcThreads
+    );
+static DWORD WINAPI DetectThreadProc(
+    __in LPVOID lpThreadParameter
+    );
+static HRESULT WaitForDetectedPackage(
+    __in BURN_DETECT_THREAD_CONTEXT* pContext,
+    __in DWORD iPackage
+    );
+static void StopDetectThreads(
+    __in BURN_DETECT_THREAD_CONTEXT* pContext,
+    __in_ecount(cThreads) HANDLE* rghThreads,
+    __in DWORD cThreads
+    );
 static DWORD WINAPI CacheThreadProc(
     __in LPVOID lpThreadParameter
     );
@@ -226,6 +263,9 @@ extern "C" HRESULT CoreDetect(
     BOOL fActivated = FALSE;
     BURN_PACKAGE* pPackage = NULL;
     HRESULT hrFirstPackageFailure = S_OK;
+    BURN_DETECT_THREAD_CONTEXT detectThreadContext = { };
+    HANDLE rghDetectThreads[DETECT_MAX_THREADS] = { };
+    DWORD cDetectThreads = 0;
 
     LogId(REPORT_STANDARD, MSG_DETECT_BEGIN, pEngineState->packages.cPackages);
 
@@ -242,7 +282,8 @@ extern "C" HRESULT CoreDetect(
     DetectReset(&pEngineState->registration, &pEngineState->packages);
     PlanReset(&pEngineState->plan, &pEngineState->packages);
 
-    hr = SearchesExecute(&pEngineState->searches, &pEngineState->variables);
+    // Only an installed bundle keeps its search results, it is what gets launched again to modify or repair.
+    hr = SearchesExecute(&pEngineState->searches, &pEngineState->variables, pEngineState->registration.fInstalled ? pEngineState->registration.sczSearchCacheFile : NULL);
     ExitOnFailure(hr, "Failed to execute searches.");
 
     // Load all of the related bundles.
@@ -285,6 +326,14 @@ extern "C" HRESULT CoreDetect(
         ExitOnFailure(hr, "Failed to initialize MSP engine detection.");
     }
 
+    // When the chain allows it, packages are detected on a pool of threads while the
+    // callbacks to the BA still come from this thread in chain order.
+    if (pEngineState->fParallelDetect && 1 < pEngineState->packages.cPackages)
+    {
+        hr = StartDetectThreads(pEngineState, &detectThreadContext, rghDetectThreads, &cDetectThreads);
+        ExitOnFailure(hr, "Failed to start detect threads.");
+    }
+
     for (DWORD i = 0; i < pEngineState->packages.cPackages; ++i)
     {
         pPackage = pEngineState->packages.rgPackages + i;
@@ -294,31 +343,32 @@ extern "C" HRESULT CoreDetect(
         ExitOnRootFailure(hr, "UX aborted detect package begin.");
 
         // Detect the cache state of the package.
-        hr = DetectPackagePayloadsCached(pPackage);
-        ExitOnFailure(hr, "Failed to detect if payloads are all cached for package: %ls", pPackage->sczId);
-
-        // Use the correct engine to detect the package.
-        switch (pPackage->type)
+        if (cDetectThreads)
         {
-        case BURN_PACKAGE_TYPE_EXE:
-            hr = ExeEngineDetectPackage(pPackage, &pEngineState->variables);
-            break;
-
-        case BURN_PACKAGE_TYPE_MSI:
-            hr = MsiEngineDetectPackage(pPackage, &pEngineState->userExperience);
-            break;
-
-        case BURN_PACKAGE_TYPE_MSP:
-            hr = MspEngineDetectPackage(pPackage, &pEngineState->userExperience);
-            break;
+            hr = WaitForDetectedPackage(&detectThreadContext, i);
+            ExitOnFailure(hr, "Failed to wait for detection of package: %ls", pPackage->sczId);
 
-        case BURN_PACKAGE_TYPE_MSU:
-            hr = MsuEngineDetectPackage(pPackage, &pEngineState->variables);
-            break;
+            hr = detectThreadContext.rghrPayloadsCached[i];
+        }
+        else
+        {
+            hr = DetectPackagePayloadsCached(pPackage);
+        }
+        ExitOnFailure(hr, "Failed to detect if payloads are all cached for package: %ls", pPackage->sczId);
 
-        default:
-            hr = E_NOTIMPL;
-            ExitOnRootFailure(hr, "Package type not supported by detect yet.");
+        if (pPackage->fDeferDetectMessages)
+        {
+            // The package was already detected by a detect thread, so pass on what it
+            // found before reporting how its detection went.
+            hr = DetectDeliverPackageMessages(&pEngineState->userExperience, pPackage);
+            if (SUCCEEDED(hr))
+            {
+                hr = detectThreadContext.rghrDetect[i];
+            }
+        }
+        else
+        {
+            hr = DetectPackage(pEngineState, pPackage);
         }
 
         // If the package detection failed, ensure the package state is set to unknown.
@@ -367,6 +417,11 @@ extern "C" HRESULT CoreDetect(
     }
 
 LExit:
+    if (detectThreadContext.pEngineState)
+    {
+        StopDetectThreads(&detectThreadContext, rghDetectThreads, cDetectThreads);
+    }
+
     if (SUCCEEDED(hr))
     {
         hr = hrFirstPackageFailure;
@@ -1487,66 +1542,211 @@ LExit:
     return hr;
 }
 
-static HRESULT DetectPackagePayloadsCached(
+//
+// DetectPackage - uses the correct engine to detect the package.
+//
+static HRESULT DetectPackage(
+    __in BURN_ENGINE_STATE* pEngineState,
     __in BURN_PACKAGE* pPackage
     )
 {
     HRESULT hr = S_OK;
-    LPWSTR sczCachePath = NULL;
-    BURN_CACHE_STATE cache = BURN_CACHE_STATE_NONE; // assume the package will not be cached.
-    LPWSTR sczPayloadCachePath = NULL;
-    LONGLONG llSize = 0;
 
-    if (pPackage->sczCacheId && *pPackage->sczCacheId)
+    switch (pPackage->type)
     {
-        hr = CacheGetCompletedPath(pPackage->fPerMachine, pPackage->sczCacheId, &sczCachePath);
-        ExitOnFailure(hr, "Failed to get completed cache path.");
+    case BURN_PACKAGE_TYPE_EXE:
+        hr = ExeEngineDetectPackage(pPackage, &pEngineState->variables);
+        break;
+
+    case BURN_PACKAGE_TYPE_MSI:
+        hr = MsiEngineDetectPackage(pPackage, &pEngineState->userExperience);
+        break;
+
+    case BURN_PACKAGE_TYPE_MSP:
+        hr = MspEngineDetectPackage(pPackage, &pEngineState->userExperience);
+        break;
+
+    case BURN_PACKAGE_TYPE_MSU:
+        hr = MsuEngineDetectPackage(pPackage, &pEngineState->variables);
+        break;
+
+    default:
+        hr = E_NOTIMPL;
+        ExitOnRootFailure(hr, "Package type not supported by detect yet.");
+    }
+
+LExit:
+    return hr;
+}
+
+//
+// StartDetectThreads - starts the threads that detect the packages ahead of
+//                      the engine thread. MSI and MSP packages are detected
+//                      completely there, their callbacks are deferred. EXE and
+//                      MSU packages evaluate conditions over variables the BA
+//                      may change from its callbacks, so only their cache
+//                      state is detected there.
+//
+static HRESULT StartDetectThreads(
+    __in BURN_ENGINE_STATE* pEngineState,
+    __in BURN_DETECT_THREAD_CONTEXT* pContext,
+    __in_ecount(DETECT_MAX_THREADS) HANDLE* rghThreads,
+    __out DWORD* pcThreads
+    )
+{
+    HRESULT hr = S_OK;
+    DWORD cPackages = pEngineState->packages.cPackages;
+    DWORD cThreads = min(cPackages, DETECT_MAX_THREADS);
+
+    pContext->pEngineState = pEngineState;
+    ::InitializeCriticalSection(&pContext->cs);
+
+    pContext->hPackageDetected = ::CreateEventW(NULL, FALSE, FALSE, NULL);
+    ExitOnNullWithLastError(pContext->hPackageDetected, hr, "Failed to create package detected event.");
 
-        // If the cached directory exists, we have something.
-        if (DirExists(sczCachePath, NULL))
+    pContext->rgfDetected = static_cast<BOOL*>(MemAlloc(sizeof(BOOL) * cPackages, TRUE));
+    ExitOnNull(pContext->rgfDetected, hr, E_OUTOFMEMORY, "Failed to allocate detected package flags.");
+
+    pContext->rghrPayloadsCached = static_cast<HRESULT*>(MemAlloc(sizeof(HRESULT) * cPackages, TRUE));
+    ExitOnNull(pContext->rghrPayloadsCached, hr, E_OUTOFMEMORY, "Failed to allocate payloads cached results.");
+
+    pContext->rghrDetect = static_cast<HRESULT*>(MemAlloc(sizeof(HRESULT) * cPackages, TRUE));
+    ExitOnNull(pContext->rghrDetect, hr, E_OUTOFMEMORY, "Failed to allocate detect results.");
+
+    for (DWORD i = 0; i < cPackages; ++i)
+    {
+        BURN_PACKAGE* pPackage = pEngineState->packages.rgPackages + i;
+
+        pPackage->fDeferDetectMessages = BURN_PACKAGE_TYPE_MSI == pPackage->type || BURN_PACKAGE_TYPE_MSP == pPackage->type;
+    }
+
+    for (DWORD i = 0; i < cThreads; ++i)
+    {
+        rghThreads[*pcThreads] = ::CreateThread(NULL, 0, DetectThreadProc, pContext, 0, NULL);
+        if (!rghThreads[*pcThreads])
         {
-            cache = BURN_CACHE_STATE_COMPLETE; // assume all payloads are cached.
+            // Fewer threads only means less parallelism, so keep what started.
+            TraceError(HRESULT_FROM_WIN32(::GetLastError()), "Failed to create detect thread.");
+            break;
+        }
 
-            // Check all payloads to see if any are missing or not the right size.
-            for (DWORD i = 0; i < pPackage->cPayloads; ++i)
-            {
-                BURN_PACKAGE_PAYLOAD* pPackagePayload = pPackage->rgPayloads + i;
+        ++*pcThreads;
+    }
 
-                hr = PathConcat(sczCachePath, pPackagePayload->pPayload->sczFilePath, &sczPayloadCachePath);
-                ExitOnFailure(hr, "Failed to concat payload cache path.");
+    // If no thread started, everything is detected on the engine thread after all.
+    if (!*pcThreads)
+    {
+        for (DWORD i = 0; i < cPackages; ++i)
+        {
+            pEngineState->packages.rgPackages[i].fDeferDetectMessages = FALSE;
+        }
+    }
 
-                hr = FileSize(sczPayloadCachePath, &llSize);
-                if (SUCCEEDED(hr) && static_cast<DWORD64>(llSize) != pPackagePayload->pPayload->qwFileSize)
-                {
-                    hr = HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT); // size did not match expectations, so cache must have the wrong file.
-                }
+LExit:
+    return hr;
+}
 
-                if (SUCCEEDED(hr))
-                {
-                    // TODO: should we do a full on hash verification on the file to ensure
-                    //       the exact right file is cached?
+static DWORD WINAPI DetectThreadProc(
+    __in LPVOID lpThreadParameter
+    )
+{
+    BURN_DETECT_THREAD_CONTEXT* pContext = reinterpret_cast<BURN_DETECT_THREAD_CONTEXT*>(lpThreadParameter);
+    BURN_PACKAGES* pPackages = &pContext->pEngineState->packages;
 
-                    pPackagePayload->fCached = TRUE;
-                }
-                else
-                {
-                    LogId(REPORT_STANDARD, MSG_DETECT_PACKAGE_NOT_FULLY_CACHED, pPackage->sczId, pPackagePayload->pPayload->sczKey, hr);
+    while (!pContext->fStop)
+    {
+        DWORD iPackage = static_cast<DWORD>(::InterlockedIncrement(&pContext->lNextPackage) - 1);
+        if (iPackage >= pPackages->cPackages)
+        {
+            break;
+        }
 
-                    cache = BURN_CACHE_STATE_PARTIAL; // found a payload that was not cached so we are partial.
-                    hr = S_OK;
-                }
-            }
+        BURN_PACKAGE* pPackage = pPackages->rgPackages + iPackage;
+        HRESULT hrPayloadsCached = DetectPackagePayloadsCached(pPackage);
+        HRESULT hrDetect = S_OK;
+
+        if (SUCCEEDED(hrPayloadsCached) && pPackage->fDeferDetectMessages)
+        {
+            hrDetect = DetectPackage(pContext->pEngineState, pPackage);
         }
+
+        ::EnterCriticalSection(&pContext->cs);
+        pContext->rghrPayloadsCached[iPackage] = hrPayloadsCached;
+        pContext->rghrDetect[iPackage] = hrDetect;
+        pContext->rgfDetected[iPackage] = TRUE;
+        ::LeaveCriticalSection(&pContext->cs);
+
+        ::SetEvent(pContext->hPackageDetected);
     }
 
-    pPackage->cache = cache;
+    return 0;
+}
+
+static HRESULT WaitForDetectedPackage(
+    __in BURN_DETECT_THREAD_CONTEXT* pContext,
+    __in DWORD iPackage
+    )
+{
+    HRESULT hr = S_OK;
+    BOOL fDetected = FALSE;
+
+    for (;;)
+    {
+        ::EnterCriticalSection(&pContext->cs);
+        fDetected = pContext->rgfDetected[iPackage];
+        ::LeaveCriticalSection(&pContext->cs);
+
+        if (fDetected)
+        {
+            break;
+        }
+
+        if (WAIT_OBJECT_0 != ::WaitForSingleObject(pContext->hPackageDetected, INFINITE))
+        {
+            ExitWithLastError(hr, "Failed to wait for package detected event.");
+        }
+    }
 
 LExit:
-    ReleaseStr(sczPayloadCachePath);
-    ReleaseStr(sczCachePath);
     return hr;
 }
 
+static void StopDetectThreads(
+    __in BURN_DETECT_THREAD_CONTEXT* pContext,
+    __in_ecount(cThreads) HANDLE* rghThreads,
+    __in DWORD cThreads
+    )
+{
+    BURN_PACKAGES* pPackages = &pContext->pEngineState->packages;
+
+    pContext->fStop = TRUE;
+
+    if (cThreads)
+    {
+        ::WaitForMultipleObjects(cThreads, rghThreads, TRUE, INFINITE);
+
+        for (DWORD i = 0; i < cThreads; ++i)
+        {
+            ReleaseHandle(rghThreads[i]);
+        }
+    }
+
+    // Callbacks that were never delivered because detect ended early are dropped.
+    for (DWORD i = 0; i < pPackages->cPackages; ++i)
+    {
+        BURN_PACKAGE* pPackage = pPackages->rgPackages + i;
+
+        pPackage->fDeferDetectMessages = FALSE;
+        DetectReleasePackageMessages(pPackage);
+    }
+
+    ReleaseMem(pContext->rghrDetect);
+    ReleaseMem(pContext->rghrPayloadsCached);
+    ReleaseMem(pContext->rgfDetected);
+    ReleaseHandle(pContext->hPackageDetected);
+    ::DeleteCriticalSection(&pContext->cs);
+}
+
 static DWORD WINAPI CacheThreadProc(
     __in LPVOID lpThreadParameter
     )
@@ -110,6 +110,7 @@ typedef struct _BURN_ENGINE_STATE
     BOOL fDisableRollback;
     BOOL fDisableSystemRestore;
     BOOL fParallelCacheAndExecute;
+    BOOL fParallelDetect;
 
     BURN_LOGGING log;
 
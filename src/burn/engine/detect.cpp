@@ -8,6 +8,20 @@ typedef struct _DETECT_AUTHENTICATION_REQUIRED_DATA
     LPCWSTR wzPackageOrContainerId;
 } DETECT_AUTHENTICATION_REQUIRED_DATA;
 
+typedef struct _DETECT_CACHED_FILE
+{
+    LPWSTR sczPath;     // relative to the package's completed cache directory.
+    DWORD64 qwSize;
+    BOOL fReparsePoint;
+} DETECT_CACHED_FILE;
+
+typedef struct _DETECT_CACHED_FILES
+{
+    STRINGDICT_HANDLE sdFiles;
+    DETECT_CACHED_FILE* rgFiles;
+    DWORD cFiles;
+} DETECT_CACHED_FILES;
+
 // internal function definitions
 static HRESULT AuthenticationRequired(
     __in LPVOID pData,
@@ -30,6 +44,28 @@ static HRESULT DownloadUpdateFeed(
     __deref_inout_z LPWSTR* psczTempFile
     );
 
+static HRESULT EnumerateCachedFiles(
+    __in_z LPCWSTR wzCachePath,
+    __in_z_opt LPCWSTR wzRelativePath,
+    __in DETECT_CACHED_FILES* pFiles
+    );
+
+static void UninitializeCachedFiles(
+    __in DETECT_CACHED_FILES* pFiles
+    );
+
+static HRESULT ReportDetectMessage(
+    __in BURN_USER_EXPERIENCE* pUX,
+    __in BURN_PACKAGE* pPackage,
+    __in const BURN_DETECT_MESSAGE* pMessage
+    );
+
+static HRESULT SendDetectMessage(
+    __in BURN_USER_EXPERIENCE* pUX,
+    __in BURN_PACKAGE* pPackage,
+    __in const BURN_DETECT_MESSAGE* pMessage
+    );
+
 // function definitions
 
 extern "C" void DetectReset(
@@ -69,6 +105,8 @@ extern "C" void DetectReset(
             ReleaseNullMem(pPackage->Msp.rgTargetProducts);
             pPackage->Msp.cTargetProductCodes = 0;
         }
+
+        DetectReleasePackageMessages(pPackage);
     }
 
     for (DWORD iPatchInfo = 0; iPatchInfo < pPackages->cPatchInfo; ++iPatchInfo)
@@ -87,6 +125,7 @@ extern "C" HRESULT DetectForwardCompatibleBundle(
 {
     HRESULT hr = S_OK;
     int nRecommendation = IDNOACTION;
+    CHAR szVersion[BURN_LOGGING_VERSION_LENGTH] = { };
 
     if (pRegistration->sczDetectedProviderKeyBundleId &&
         CSTR_EQUAL != ::CompareStringW(LOCALE_NEUTRAL, NORM_IGNORECASE, pRegistration->sczDetectedProviderKeyBundleId, -1, pRegistration->sczId, -1))
@@ -133,7 +172,7 @@ extern "C" HRESULT DetectForwardCompatibleBundle(
                     pRegistration->fEnabledForwardCompatibleBundle = TRUE;
                 }
 
-                LogId(REPORT_STANDARD, MSG_DETECTED_FORWARD_COMPATIBLE_BUNDLE, pRelatedBundle->package.sczId, LoggingRelationTypeToString(pRelatedBundle->relationType), LoggingPerMachineToString(pRelatedBundle->package.fPerMachine), LoggingVersionToString(pRelatedBundle->qwVersion), LoggingBoolToString(pRegistration->fEnabledForwardCompatibleBundle));
+                LogId(REPORT_STANDARD, MSG_DETECTED_FORWARD_COMPATIBLE_BUNDLE, pRelatedBundle->package.sczId, LoggingRelationTypeToString(pRelatedBundle->relationType), LoggingPerMachineToString(pRelatedBundle->package.fPerMachine), LoggingVersionToString(pRelatedBundle->qwVersion, szVersion, countof(szVersion)), LoggingBoolToString(pRegistration->fEnabledForwardCompatibleBundle));
                 break;
             }
         }
@@ -151,6 +190,7 @@ extern "C" HRESULT DetectReportRelatedBundles(
     )
 {
     HRESULT hr = S_OK;
+    CHAR szVersion[BURN_LOGGING_VERSION_LENGTH] = { };
 
     for (DWORD iRelatedBundle = 0; iRelatedBundle < pRegistration->relatedBundles.cRelatedBundles; ++iRelatedBundle)
     {
@@ -199,7 +239,7 @@ extern "C" HRESULT DetectReportRelatedBundles(
             break;
         }
 
-        LogId(REPORT_STANDARD, MSG_DETECTED_RELATED_BUNDLE, pRelatedBundle->package.sczId, LoggingRelationTypeToString(pRelatedBundle->relationType), LoggingPerMachineToString(pRelatedBundle->package.fPerMachine), LoggingVersionToString(pRelatedBundle->qwVersion), LoggingRelatedOperationToString(operation));
+        LogId(REPORT_STANDARD, MSG_DETECTED_RELATED_BUNDLE, pRelatedBundle->package.sczId, LoggingRelationTypeToString(pRelatedBundle->relationType), LoggingPerMachineToString(pRelatedBundle->package.fPerMachine), LoggingVersionToString(pRelatedBundle->qwVersion, szVersion, countof(szVersion)), LoggingRelatedOperationToString(operation));
 
         int nResult = pUX->pUserExperience->OnDetectRelatedBundle(pRelatedBundle->package.sczId, pRelatedBundle->relationType, pRelatedBundle->sczTag, pRelatedBundle->package.fPerMachine, pRelatedBundle->qwVersion, operation);
         hr = UserExperienceInterpretResult(pUX, MB_OKCANCEL, nResult);
@@ -210,6 +250,214 @@ LExit:
     return hr;
 }
 
+extern "C" HRESULT DetectReportRelatedMsiPackage(
+    __in BURN_USER_EXPERIENCE* pUX,
+    __in BURN_PACKAGE* pPackage,
+    __in_z LPCWSTR wzProductCode,
+    __in BOOL fPerMachine,
+    __in DWORD64 qwVersion,
+    __in BOOTSTRAPPER_RELATED_OPERATION operation
+    )
+{
+    BURN_DETECT_MESSAGE message = { };
+    message.type = BURN_DETECT_MESSAGE_TYPE_RELATED_MSI_PACKAGE;
+    message.sczId = const_cast<LPWSTR>(wzProductCode);
+    message.fPerMachine = fPerMachine;
+    message.qwVersion = qwVersion;
+    message.operation = operation;
+
+    return ReportDetectMessage(pUX, pPackage, &message);
+}
+
+extern "C" HRESULT DetectReportCompatiblePackage(
+    __in BURN_USER_EXPERIENCE* pUX,
+    __in BURN_PACKAGE* pPackage,
+    __in_z LPCWSTR wzCompatiblePackageId
+    )
+{
+    BURN_DETECT_MESSAGE message = { };
+    message.type = BURN_DETECT_MESSAGE_TYPE_COMPATIBLE_PACKAGE;
+    message.sczId = const_cast<LPWSTR>(wzCompatiblePackageId);
+
+    return ReportDetectMessage(pUX, pPackage, &message);
+}
+
+extern "C" HRESULT DetectReportMsiFeature(
+    __in BURN_USER_EXPERIENCE* pUX,
+    __in BURN_PACKAGE* pPackage,
+    __in_z LPCWSTR wzFeatureId,
+    __in BOOTSTRAPPER_FEATURE_STATE state
+    )
+{
+    BURN_DETECT_MESSAGE message = { };
+    message.type = BURN_DETECT_MESSAGE_TYPE_MSI_FEATURE;
+    message.sczId = const_cast<LPWSTR>(wzFeatureId);
+    message.featureState = state;
+
+    return ReportDetectMessage(pUX, pPackage, &message);
+}
+
+extern "C" HRESULT DetectReportTargetMsiPackage(
+    __in BURN_USER_EXPERIENCE* pUX,
+    __in BURN_PACKAGE* pPackage,
+    __in_z LPCWSTR wzProductCode,
+    __in BOOTSTRAPPER_PACKAGE_STATE patchState
+    )
+{
+    BURN_DETECT_MESSAGE message = { };
+    message.type = BURN_DETECT_MESSAGE_TYPE_TARGET_MSI_PACKAGE;
+    message.sczId = const_cast<LPWSTR>(wzProductCode);
+    message.packageState = patchState;
+
+    return ReportDetectMessage(pUX, pPackage, &message);
+}
+
+//
+// DetectDeliverPackageMessages - sends the detect callbacks a package recorded while it was
+// detected off the engine thread, in the order they were recorded, and stops deferring them.
+//
+extern "C" HRESULT DetectDeliverPackageMessages(
+    __in BURN_USER_EXPERIENCE* pUX,
+    __in BURN_PACKAGE* pPackage
+    )
+{
+    HRESULT hr = S_OK;
+
+    pPackage->fDeferDetectMessages = FALSE;
+
+    for (DWORD i = 0; i < pPackage->cDetectMessages; ++i)
+    {
+        hr = SendDetectMessage(pUX, pPackage, pPackage->rgDetectMessages + i);
+        ExitOnFailure(hr, "Failed to deliver detect message.");
+    }
+
+LExit:
+    DetectReleasePackageMessages(pPackage);
+
+    return hr;
+}
+
+extern "C" void DetectReleasePackageMessages(
+    __in BURN_PACKAGE* pPackage
+    )
+{
+    for (DWORD i = 0; i < pPackage->cDetectMessages; ++i)
+    {
+        ReleaseStr(pPackage->rgDetectMessages[i].sczId);
+    }
+
+    ReleaseNullMem(pPackage->rgDetectMessages);
+    pPackage->cDetectMessages = 0;
+}
+
+//
+// DetectPackagePayloadsCached - determines the cache state of a package and of each of its payloads
+// from a single enumeration of the package's completed cache directory.
+//
+extern "C" HRESULT DetectPackagePayloadsCached(
+    __in BURN_PACKAGE* pPackage
+    )
+{
+    HRESULT hr = S_OK;
+    LPWSTR sczCachePath = NULL;
+    BURN_CACHE_STATE cache = BURN_CACHE_STATE_NONE; // assume the package will not be cached.
+    LPWSTR sczPayloadCachePath = NULL;
+    LONGLONG llSize = 0;
+    DETECT_CACHED_FILES files = { };
+    DETECT_CACHED_FILE* pFile = NULL;
+    HRESULT hrEnumerate = S_OK;
+
+    if (pPackage->sczCacheId && *pPackage->sczCacheId)
+    {
+        hr = CacheGetCompletedPath(pPackage->fPerMachine, pPackage->sczCacheId, &sczCachePath);
+        ExitOnFailure(hr, "Failed to get completed cache path.");
+
+        hr = DictCreateWithEmbeddedKey(&files.sdFiles, pPackage->cPayloads, reinterpret_cast<void**>(&files.rgFiles), offsetof(DETECT_CACHED_FILE, sczPath), DICT_FLAG_CASEINSENSITIVE);
+        ExitOnFailure(hr, "Failed to create dictionary of cached files.");
+
+        // If the cached directory exists, we have something.
+        hr = EnumerateCachedFiles(sczCachePath, NULL, &files);
+        if (E_FILENOTFOUND == hr || E_PATHNOTFOUND == hr)
+        {
+            hr = S_OK;
+        }
+        else
+        {
+            // A cache directory we are not allowed to list leaves every payload not cached
+            // rather than failing detect.
+            if (E_ACCESSDENIED == hr)
+            {
+                hrEnumerate = hr;
+                hr = S_OK;
+            }
+            ExitOnFailure1(hr, "Failed to enumerate cached files for package: %ls", pPackage->sczId);
+
+            cache = BURN_CACHE_STATE_COMPLETE; // assume all payloads are cached.
+
+            // Check all payloads to see if any are missing or not the right size.
+            for (DWORD i = 0; i < pPackage->cPayloads; ++i)
+            {
+                BURN_PACKAGE_PAYLOAD* pPackagePayload = pPackage->rgPayloads + i;
+
+                if (FAILED(hrEnumerate))
+                {
+                    hr = hrEnumerate;
+                }
+                else
+                {
+                    hr = DictGetValue(files.sdFiles, pPackagePayload->pPayload->sczFilePath, reinterpret_cast<void**>(&pFile));
+                }
+
+                if (E_NOTFOUND == hr)
+                {
+                    hr = E_FILENOTFOUND;
+                }
+                else if (SUCCEEDED(hr))
+                {
+                    llSize = static_cast<LONGLONG>(pFile->qwSize);
+
+                    // The enumeration reports the size of a link, not of the file it points to.
+                    if (pFile->fReparsePoint)
+                    {
+                        hr = PathConcat(sczCachePath, pPackagePayload->pPayload->sczFilePath, &sczPayloadCachePath);
+                        ExitOnFailure(hr, "Failed to concat payload cache path.");
+
+                        hr = FileSize(sczPayloadCachePath, &llSize);
+                    }
+                }
+
+                if (SUCCEEDED(hr) && static_cast<DWORD64>(llSize) != pPackagePayload->pPayload->qwFileSize)
+                {
+                    hr = HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT); // size did not match expectations, so cache must have the wrong file.
+                }
+
+                if (SUCCEEDED(hr))
+                {
+                    // TODO: should we do a full on hash verification on the file to ensure
+                    //       the exact right file is cached?
+
+                    pPackagePayload->fCached = TRUE;
+                }
+                else
+                {
+                    LogId(REPORT_STANDARD, MSG_DETECT_PACKAGE_NOT_FULLY_CACHED, pPackage->sczId, pPackagePayload->pPayload->sczKey, hr);
+
+                    cache = BURN_CACHE_STATE_PARTIAL; // found a payload that was not cached so we are partial.
+                    hr = S_OK;
+                }
+            }
+        }
+    }
+
+    pPackage->cache = cache;
+
+LExit:
+    UninitializeCachedFiles(&files);
+    ReleaseStr(sczPayloadCachePath);
+    ReleaseStr(sczCachePath);
+    return hr;
+}
+
 extern "C" HRESULT DetectUpdate(
     __in_z LPCWSTR wzBundleId,
     __in BURN_USER_EXPERIENCE* pUX,
@@ -377,7 +625,6 @@ static HRESULT DetectAtomFeedUpdate(
     int nResult = IDNOACTION;
     LPWSTR sczUpdateFeedTempFile = NULL;
 
-    ATOM_FEED* pAtomFeed = NULL;
     APPLICATION_UPDATE_CHAIN* pApupChain = NULL;
 
     hr = AtomInitialize();
@@ -386,12 +633,10 @@ static HRESULT DetectAtomFeedUpdate(
     hr = DownloadUpdateFeed(wzBundleId, pUX, pUpdate, &sczUpdateFeedTempFile);
     ExitOnFailure(hr, "Failed to download update feed.");
 
-    hr = AtomParseFromFile(sczUpdateFeedTempFile, &pAtomFeed);
+    // Stream the feed straight into the update chain. Every entry is kept since the BA decides which update to take.
+    hr = ApupAllocChainFromAtomFile(sczUpdateFeedTempFile, 0, &pApupChain);
     ExitOnFailure1(hr, "Failed to parse update atom feed: %ls.", sczUpdateFeedTempFile);
 
-    hr = ApupAllocChainFromAtom(pAtomFeed, &pApupChain);
-    ExitOnFailure(hr, "Failed to allocate update chain from atom feed.");
-
     if (0 < pApupChain->cEntries)
     {
         for (DWORD i = 0; i < pApupChain->cEntries; ++i)
@@ -429,9 +674,193 @@ LExit:
     }
 
     ApupFreeChain(pApupChain);
-    AtomFreeFeed(pAtomFeed);
     ReleaseStr(sczUpdateFeedTempFile);
     AtomUninitialize();
 
     return hr;
 }
+
+//
+// EnumerateCachedFiles - adds every file under the directory to the dictionary,
+//                        keyed by its path relative to the cache directory.
+//
+static HRESULT EnumerateCachedFiles(
+    __in_z LPCWSTR wzCachePath,
+    __in_z_opt LPCWSTR wzRelativePath,
+    __in DETECT_CACHED_FILES* pFiles
+    )
+{
+    HRESULT hr = S_OK;
+    LPWSTR sczSearch = NULL;
+    LPWSTR sczRelativePath = NULL;
+    HANDLE hFind = INVALID_HANDLE_VALUE;
+    WIN32_FIND_DATAW wfd = { };
+    DETECT_CACHED_FILE* pFile = NULL;
+
+    hr = StrAllocFormatted(&sczSearch, L"%ls%ls%ls*", wzCachePath, wzRelativePath ? wzRelativePath : L"", wzRelativePath ? L"\\" : L"");
+    ExitOnFailure(hr, "Failed to allocate cached file search string.");
+
+    hFind = ::FindFirstFileExW(sczSearch, FindExInfoBasic, &wfd, FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+    if (INVALID_HANDLE_VALUE == hFind && ERROR_INVALID_PARAMETER == ::GetLastError())
+    {
+        // Before Windows 7 neither the basic info level nor the large fetch flag is supported.
+        hFind = ::FindFirstFileExW(sczSearch, FindExInfoStandard, &wfd, FindExSearchNameMatch, NULL, 0);
+    }
+
+    if (INVALID_HANDLE_VALUE == hFind)
+    {
+        ExitWithLastError1(hr, "Failed to find files in cache directory: %ls", sczSearch);
+    }
+
+    do
+    {
+        if (L'.' == wfd.cFileName[0] && (L'\0' == wfd.cFileName[1] || (L'.' == wfd.cFileName[1] && L'\0' == wfd.cFileName[2])))
+        {
+            continue;
+        }
+
+        if (wzRelativePath)
+        {
+            hr = StrAllocFormatted(&sczRelativePath, L"%ls\\%ls", wzRelativePath, wfd.cFileName);
+        }
+        else
+        {
+            hr = StrAllocString(&sczRelativePath, wfd.cFileName, 0);
+        }
+        ExitOnFailure(hr, "Failed to allocate relative path of cached file.");
+
+        if (FILE_ATTRIBUTE_DIRECTORY & wfd.dwFileAttributes)
+        {
+            // Payloads are only ever cached into real directories.
+            if (!(FILE_ATTRIBUTE_REPARSE_POINT & wfd.dwFileAttributes))
+            {
+                hr = EnumerateCachedFiles(wzCachePath, sczRelativePath, pFiles);
+                ExitOnFailure1(hr, "Failed to enumerate cached files in: %ls", sczRelativePath);
+            }
+        }
+        else
+        {
+            hr = MemEnsureArraySize(reinterpret_cast<LPVOID*>(&pFiles->rgFiles), pFiles->cFiles + 1, sizeof(DETECT_CACHED_FILE), 64);
+            ExitOnFailure(hr, "Failed to grow array of cached files.");
+
+            pFile = pFiles->rgFiles + pFiles->cFiles;
+            pFile->sczPath = sczRelativePath;
+            sczRelativePath = NULL;
+            pFile->qwSize = (static_cast<DWORD64>(wfd.nFileSizeHigh) << 32) | wfd.nFileSizeLow;
+            pFile->fReparsePoint = FILE_ATTRIBUTE_REPARSE_POINT & wfd.dwFileAttributes;
+            ++pFiles->cFiles;
+
+            hr = DictAddValue(pFiles->sdFiles, pFile);
+            ExitOnFailure1(hr, "Failed to add cached file to dictionary: %ls", pFile->sczPath);
+        }
+    } while (::FindNextFileW(hFind, &wfd));
+
+    if (ERROR_NO_MORE_FILES != ::GetLastError())
+    {
+        ExitWithLastError1(hr, "Failed to find next file in cache directory: %ls", sczSearch);
+    }
+
+LExit:
+    if (INVALID_HANDLE_VALUE != hFind)
+    {
+        ::FindClose(hFind);
+    }
+
+    ReleaseStr(sczRelativePath);
+    ReleaseStr(sczSearch);
+
+    return hr;
+}
+
+static void UninitializeCachedFiles(
+    __in DETECT_CACHED_FILES* pFiles
+    )
+{
+    for (DWORD i = 0; i < pFiles->cFiles; ++i)
+    {
+        ReleaseStr(pFiles->rgFiles[i].sczPath);
+    }
+
+    ReleaseMem(pFiles->rgFiles);
+    ReleaseDict(pFiles->sdFiles);
+}
+
+//
+// ReportDetectMessage - sends the message to the BA now or, while the package
+//                       is being detected off the engine thread, keeps a copy
+//                       to be delivered later in package order.
+//
+static HRESULT ReportDetectMessage(
+    __in BURN_USER_EXPERIENCE* pUX,
+    __in BURN_PACKAGE* pPackage,
+    __in const BURN_DETECT_MESSAGE* pMessage
+    )
+{
+    HRESULT hr = S_OK;
+    BURN_DETECT_MESSAGE* pRecorded = NULL;
+
+    if (!pPackage->fDeferDetectMessages)
+    {
+        hr = SendDetectMessage(pUX, pPackage, pMessage);
+        ExitFunction();
+    }
+
+    hr = MemEnsureArraySize(reinterpret_cast<LPVOID*>(&pPackage->rgDetectMessages), pPackage->cDetectMessages + 1, sizeof(BURN_DETECT_MESSAGE), 5);
+    ExitOnFailure(hr, "Failed to grow array of detect messages.");
+
+    pRecorded = pPackage->rgDetectMessages + pPackage->cDetectMessages;
+    *pRecorded = *pMessage;
+    pRecorded->sczId = NULL;
+
+    hr = StrAllocString(&pRecorded->sczId, pMessage->sczId, 0);
+    ExitOnFailure(hr, "Failed to copy id of detect message.");
+
+    ++pPackage->cDetectMessages;
+
+LExit:
+    return hr;
+}
+
+static HRESULT SendDetectMessage(
+    __in BURN_USER_EXPERIENCE* pUX,
+    __in BURN_PACKAGE* pPackage,
+    __in const BURN_DETECT_MESSAGE* pMessage
+    )
+{
+    HRESULT hr = S_OK;
+    int nResult = IDOK;
+
+    switch (pMessage->type)
+    {
+    case BURN_DETECT_MESSAGE_TYPE_RELATED_MSI_PACKAGE:
+        nResult = pUX->pUserExperience->OnDetectRelatedMsiPackage(pPackage->sczId, pMessage->sczId, pMessage->fPerMachine, pMessage->qwVersion, pMessage->operation);
+        hr = UserExperienceInterpretResult(pUX, MB_OKCANCEL, nResult);
+        ExitOnRootFailure(hr, "UX aborted detect related MSI package.");
+        break;
+
+    case BURN_DETECT_MESSAGE_TYPE_COMPATIBLE_PACKAGE:
+        nResult = pUX->pUserExperience->OnDetectCompatiblePackage(pPackage->sczId, pMessage->sczId);
+        hr = UserExperienceInterpretResult(pUX, MB_OKCANCEL, nResult);
+        ExitOnRootFailure(hr, "UX aborted detect compatible MSI package.");
+        break;
+
+    case BURN_DETECT_MESSAGE_TYPE_MSI_FEATURE:
+        nResult = pUX->pUserExperience->OnDetectMsiFeature(pPackage->sczId, pMessage->sczId, pMessage->featureState);
+        hr = UserExperienceInterpretResult(pUX, MB_OKCANCEL, nResult);
+        ExitOnRootFailure(hr, "UX aborted detect.");
+        break;
+
+    case BURN_DETECT_MESSAGE_TYPE_TARGET_MSI_PACKAGE:
+        nResult = pUX->pUserExperience->OnDetectTargetMsiPackage(pPackage->sczId, pMessage->sczId, pMessage->packageState);
+        hr = UserExperienceInterpretResult(pUX, MB_OKCANCEL, nResult);
+        ExitOnRootFailure(hr, "UX aborted detect target MSI package.");
+        break;
+
+    default:
+        hr = E_UNEXPECTED;
+        ExitOnRootFailure1(hr, "Unexpected detect message type: %d", pMessage->type);
+    }
+
+LExit:
+    return hr;
+}
@@ -33,12 +33,54 @@ HRESULT DetectReportRelatedBundles(
     __in BOOTSTRAPPER_ACTION action
     );
 
+HRESULT DetectPackagePayloadsCached(
+    __in BURN_PACKAGE* pPackage
+    );
+
 HRESULT DetectUpdate(
     __in_z LPCWSTR wzBundleId,
     __in BURN_USER_EXPERIENCE* pUX,
     __in BURN_UPDATE* pUpdate
     );
 
+HRESULT DetectReportRelatedMsiPackage(
+    __in BURN_USER_EXPERIENCE* pUX,
+    __in BURN_PACKAGE* pPackage,
+    __in_z LPCWSTR wzProductCode,
+    __in BOOL fPerMachine,
+    __in DWORD64 qwVersion,
+    __in BOOTSTRAPPER_RELATED_OPERATION operation
+    );
+
+HRESULT DetectReportCompatiblePackage(
+    __in BURN_USER_EXPERIENCE* pUX,
+    __in BURN_PACKAGE* pPackage,
+    __in_z LPCWSTR wzCompatiblePackageId
+    );
+
+HRESULT DetectReportMsiFeature(
+    __in BURN_USER_EXPERIENCE* pUX,
+    __in BURN_PACKAGE* pPackage,
+    __in_z LPCWSTR wzFeatureId,
+    __in BOOTSTRAPPER_FEATURE_STATE state
+    );
+
+HRESULT DetectReportTargetMsiPackage(
+    __in BURN_USER_EXPERIENCE* pUX,
+    __in BURN_PACKAGE* pPackage,
+    __in_z LPCWSTR wzProductCode,
+    __in BOOTSTRAPPER_PACKAGE_STATE patchState
+    );
+
+HRESULT DetectDeliverPackageMessages(
+    __in BURN_USER_EXPERIENCE* pUX,
+    __in BURN_PACKAGE* pPackage
+    );
+
+void DetectReleasePackageMessages(
+    __in BURN_PACKAGE* pPackage
+    );
+
 #if defined(__cplusplus)
 }
 #endif
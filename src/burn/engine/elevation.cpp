@@ -34,6 +34,7 @@ typedef enum _BURN_ELEVATION_MESSAGE_TYPE
     BURN_ELEVATION_MESSAGE_TYPE_EXECUTE_MSI_MESSAGE,
     BURN_ELEVATION_MESSAGE_TYPE_EXECUTE_FILES_IN_USE,
     BURN_ELEVATION_MESSAGE_TYPE_LAUNCH_APPROVED_EXE_PROCESSID,
+    BURN_ELEVATION_MESSAGE_TYPE_CACHE_VERIFY_PROGRESS,
 } BURN_ELEVATION_MESSAGE_TYPE;
 
 
@@ -51,6 +52,12 @@ typedef struct _BURN_ELEVATION_MSI_MESSAGE_CONTEXT
     LPVOID pvContext;
 } BURN_ELEVATION_MSI_MESSAGE_CONTEXT;
 
+typedef struct _BURN_ELEVATION_CACHE_MESSAGE_CONTEXT
+{
+    PFN_CRYPHASHPROGRESS pfnVerifyProgress;
+    LPVOID pvContext;
+} BURN_ELEVATION_CACHE_MESSAGE_CONTEXT;
+
 typedef struct _BURN_ELEVATION_LAUNCH_APPROVED_EXE_MESSAGE_CONTEXT
 {
     DWORD dwProcessId;
@@ -96,6 +103,11 @@ static HRESULT ProcessMsiPackageMessages(
     __in_opt LPVOID pvContext,
     __out DWORD* pdwResult
     );
+static HRESULT ProcessCacheMessages(
+    __in BURN_PIPE_MESSAGE* pMsg,
+    __in_opt LPVOID pvContext,
+    __out DWORD* pdwResult
+    );
 static HRESULT ProcessLaunchApprovedExeMessages(
     __in BURN_PIPE_MESSAGE* pMsg,
     __in_opt LPVOID pvContext,
@@ -156,12 +168,18 @@ static HRESULT OnLayoutBundle(
     __in DWORD cbData
     );
 static HRESULT OnCacheOrLayoutContainerOrPayload(
+    __in HANDLE hPipe,
     __in BURN_CONTAINERS* pContainers,
     __in BURN_PACKAGES* pPackages,
     __in BURN_PAYLOADS* pPayloads,
     __in BYTE* pbData,
     __in DWORD cbData
     );
+static HRESULT CacheVerifyProgressMessageHandler(
+    __in DWORD64 qwVerified,
+    __in DWORD64 qwTotal,
+    __in_opt LPVOID pvContext
+    );
 static void OnCacheCleanup(
     __in_z LPCWSTR wzBundleId
     );
@@ -282,6 +300,9 @@ extern "C" HRESULT ElevationElevate(
             ExitOnFailure(hr, "Failed to connect to elevated child process.");
 
             LogId(REPORT_STANDARD, MSG_CONNECT_TO_ELEVATED_ENGINE_SUCCESS);
+
+            // a new elevated process starts out without any of our variables
+            VariableResetChanges(&pEngineState->variables);
         }
         else if (HRESULT_FROM_WIN32(ERROR_CANCELLED) == hr)
         {
@@ -326,7 +347,7 @@ extern "C" HRESULT ElevationApplyInitialize(
     hr = BuffWriteNumber(&pbData, &cbData, (DWORD)fTakeSystemRestorePoint);
     ExitOnFailure(hr, "Failed to write system restore point action to message buffer.");
     
-    hr = VariableSerialize(pVariables, FALSE, &pbData, &cbData);
+    hr = VariableSerializeChanges(pVariables, &pbData, &cbData);
     ExitOnFailure(hr, "Failed to write variables.");
 
     // send message
@@ -335,6 +356,12 @@ extern "C" HRESULT ElevationApplyInitialize(
 
     hr = (HRESULT)dwResult;
 
+    // the elevated process has these variables now, only later changes need to be sent
+    if (SUCCEEDED(hr))
+    {
+        VariableAcknowledgeChanges(pVariables);
+    }
+
 LExit:
     ReleaseBuffer(pbData);
 
@@ -401,7 +428,7 @@ extern "C" HRESULT ElevationSessionBegin(
     hr = BuffWriteNumber64(&pbData, &cbData, qwEstimatedSize);
     ExitOnFailure(hr, "Failed to write estimated size to message buffer.");
 
-    hr = VariableSerialize(pVariables, FALSE, &pbData, &cbData);
+    hr = VariableSerializeChanges(pVariables, &pbData, &cbData);
     ExitOnFailure(hr, "Failed to write variables.");
 
     // send message
@@ -410,6 +437,12 @@ extern "C" HRESULT ElevationSessionBegin(
 
     hr = (HRESULT)dwResult;
 
+    // the elevated process has these variables now, only later changes need to be sent
+    if (SUCCEEDED(hr))
+    {
+        VariableAcknowledgeChanges(pVariables);
+    }
+
 LExit:
     ReleaseBuffer(pbData);
 
@@ -439,7 +472,7 @@ extern "C" HRESULT ElevationSessionResume(
     hr = BuffWriteNumber(&pbData, &cbData, fDisableResume);
     ExitOnFailure(hr, "Failed to write resume flag.");
 
-    hr = VariableSerialize(pVariables, FALSE, &pbData, &cbData);
+    hr = VariableSerializeChanges(pVariables, &pbData, &cbData);
     ExitOnFailure(hr, "Failed to write variables.");
 
     // send message
@@ -448,6 +481,12 @@ extern "C" HRESULT ElevationSessionResume(
 
     hr = (HRESULT)dwResult;
 
+    // the elevated process has these variables now, only later changes need to be sent
+    if (SUCCEEDED(hr))
+    {
+        VariableAcknowledgeChanges(pVariables);
+    }
+
 LExit:
     ReleaseBuffer(pbData);
 
@@ -560,13 +599,19 @@ extern "C" HRESULT ElevationCacheOrLayoutContainerOrPayload(
     __in_opt BURN_PAYLOAD* pPayload,
     __in_z_opt LPCWSTR wzLayoutDirectory,
     __in_z LPCWSTR wzUnverifiedPath,
-    __in BOOL fMove
+    __in BOOL fMove,
+    __in_opt PFN_CRYPHASHPROGRESS pfnVerifyProgress,
+    __in_opt LPVOID pvContext
     )
 {
     HRESULT hr = S_OK;
     BYTE* pbData = NULL;
     SIZE_T cbData = 0;
     DWORD dwResult = 0;
+    BURN_ELEVATION_CACHE_MESSAGE_CONTEXT context = { };
+
+    context.pfnVerifyProgress = pfnVerifyProgress;
+    context.pvContext = pvContext;
 
     // serialize message data
     hr = BuffWriteString(&pbData, &cbData, pContainer ? pContainer->sczId : NULL);
@@ -588,7 +633,7 @@ extern "C" HRESULT ElevationCacheOrLayoutContainerOrPayload(
     ExitOnFailure(hr, "Failed to write move flag to message buffer.");
 
     // send message
-    hr = PipeSendMessage(hPipe, BURN_ELEVATION_MESSAGE_TYPE_CACHE_OR_LAYOUT_CONTAINER_OR_PAYLOAD, pbData, cbData, NULL, NULL, &dwResult);
+    hr = PipeSendMessage(hPipe, BURN_ELEVATION_MESSAGE_TYPE_CACHE_OR_LAYOUT_CONTAINER_OR_PAYLOAD, pbData, cbData, ProcessCacheMessages, &context, &dwResult);
     ExitOnFailure(hr, "Failed to send BURN_ELEVATION_MESSAGE_TYPE_CACHE_OR_LAYOUT_CONTAINER_OR_PAYLOAD message to per-machine process.");
 
     hr = (HRESULT)dwResult;
@@ -688,7 +733,7 @@ extern "C" HRESULT ElevationExecuteExePackage(
     hr = BuffWriteString(&pbData, &cbData, pExecuteAction->exePackage.sczAncestors);
     ExitOnFailure(hr, "Failed to write the list of ancestors to the message buffer.");
 
-    hr = VariableSerialize(pVariables, FALSE, &pbData, &cbData);
+    hr = VariableSerializeChanges(pVariables, &pbData, &cbData);
     ExitOnFailure(hr, "Failed to write variables.");
 
     // send message
@@ -700,6 +745,12 @@ extern "C" HRESULT ElevationExecuteExePackage(
 
     hr = ProcessResult(dwResult, pRestart);
 
+    // the elevated process has these variables now, only later changes need to be sent
+    if (SUCCEEDED(hr))
+    {
+        VariableAcknowledgeChanges(pVariables);
+    }
+
 LExit:
     ReleaseBuffer(pbData);
 
@@ -758,7 +809,7 @@ extern "C" HRESULT ElevationExecuteMsiPackage(
         ExitOnFailure(hr, "Failed to write slipstream patch action to message buffer.");
     }
 
-    hr = VariableSerialize(pVariables, FALSE, &pbData, &cbData);
+    hr = VariableSerializeChanges(pVariables, &pbData, &cbData);
     ExitOnFailure(hr, "Failed to write variables.");
 
     hr = BuffWriteNumber(&pbData, &cbData, (DWORD)fRollback);
@@ -774,6 +825,12 @@ extern "C" HRESULT ElevationExecuteMsiPackage(
 
     hr = ProcessResult(dwResult, pRestart);
 
+    // the elevated process has these variables now, only later changes need to be sent
+    if (SUCCEEDED(hr))
+    {
+        VariableAcknowledgeChanges(pVariables);
+    }
+
 LExit:
     ReleaseBuffer(pbData);
 
@@ -832,7 +889,7 @@ extern "C" HRESULT ElevationExecuteMspPackage(
         ExitOnFailure(hr, "Failed to write ordered patch id to message buffer.");
     }
 
-    hr = VariableSerialize(pVariables, FALSE, &pbData, &cbData);
+    hr = VariableSerializeChanges(pVariables, &pbData, &cbData);
     ExitOnFailure(hr, "Failed to write variables.");
 
     hr = BuffWriteNumber(&pbData, &cbData, (DWORD)fRollback);
@@ -847,6 +904,12 @@ extern "C" HRESULT ElevationExecuteMspPackage(
 
     hr = ProcessResult(dwResult, pRestart);
 
+    // the elevated process has these variables now, only later changes need to be sent
+    if (SUCCEEDED(hr))
+    {
+        VariableAcknowledgeChanges(pVariables);
+    }
+
 LExit:
     ReleaseBuffer(pbData);
 
@@ -1402,6 +1465,49 @@ LExit:
     return hr;
 }
 
+static HRESULT ProcessCacheMessages(
+    __in BURN_PIPE_MESSAGE* pMsg,
+    __in_opt LPVOID pvContext,
+    __out DWORD* pdwResult
+    )
+{
+    HRESULT hr = S_OK;
+    SIZE_T iData = 0;
+    BURN_ELEVATION_CACHE_MESSAGE_CONTEXT* pContext = static_cast<BURN_ELEVATION_CACHE_MESSAGE_CONTEXT*>(pvContext);
+    DWORD64 qwVerified = 0;
+    DWORD64 qwTotal = 0;
+    HRESULT hrResult = S_OK;
+
+    // Process the message.
+    switch (pMsg->dwMessage)
+    {
+    case BURN_ELEVATION_MESSAGE_TYPE_CACHE_VERIFY_PROGRESS:
+        // read message parameters
+        hr = BuffReadNumber64((BYTE*)pMsg->pvData, pMsg->cbData, &iData, &qwVerified);
+        ExitOnFailure(hr, "Failed to read verified bytes.");
+
+        hr = BuffReadNumber64((BYTE*)pMsg->pvData, pMsg->cbData, &iData, &qwTotal);
+        ExitOnFailure(hr, "Failed to read total bytes.");
+
+        // send message
+        if (pContext->pfnVerifyProgress)
+        {
+            hrResult = pContext->pfnVerifyProgress(qwVerified, qwTotal, pContext->pvContext);
+        }
+        break;
+
+    default:
+        hr = E_INVALIDARG;
+        ExitOnRootFailure(hr, "Invalid cache message.");
+        break;
+    }
+
+    *pdwResult = static_cast<DWORD>(hrResult);
+
+LExit:
+    return hr;
+}
+
 static HRESULT ProcessLaunchApprovedExeMessages(
     __in BURN_PIPE_MESSAGE* pMsg,
     __in_opt LPVOID pvContext,
@@ -1540,7 +1646,7 @@ static HRESULT ProcessElevatedChildCacheMessage(
         break;
 
     case BURN_ELEVATION_MESSAGE_TYPE_CACHE_OR_LAYOUT_CONTAINER_OR_PAYLOAD:
-        hrResult = OnCacheOrLayoutContainerOrPayload(pContext->pContainers, pContext->pPackages, pContext->pPayloads, (BYTE*)pMsg->pvData, pMsg->cbData);
+        hrResult = OnCacheOrLayoutContainerOrPayload(pContext->hPipe, pContext->pContainers, pContext->pPackages, pContext->pPayloads, (BYTE*)pMsg->pvData, pMsg->cbData);
         break;
 
     case BURN_ELEVATION_MESSAGE_TYPE_CACHE_CLEANUP:
@@ -1609,7 +1715,7 @@ static HRESULT OnApplyInitialize(
     hr = BuffReadNumber(pbData, cbData, &iData, &dwTakeSystemRestorePoint);
     ExitOnFailure(hr, "Failed to read system restore point action.");
 
-    hr = VariableDeserialize(pVariables, FALSE, pbData, cbData, &iData);
+    hr = VariableDeserializeChanges(pVariables, pbData, cbData, &iData);
     ExitOnFailure(hr, "Failed to read variables.");
 
     // Initialize.
@@ -1730,7 +1836,7 @@ static HRESULT OnSessionBegin(
     hr = BuffReadNumber64(pbData, cbData, &iData, &qwEstimatedSize);
     ExitOnFailure(hr, "Failed to read estimated size.");
 
-    hr = VariableDeserialize(pVariables, FALSE, pbData, cbData, &iData);
+    hr = VariableDeserializeChanges(pVariables, pbData, cbData, &iData);
     ExitOnFailure(hr, "Failed to read variables.");
 
     // Begin session in per-machine process.
@@ -1760,7 +1866,7 @@ static HRESULT OnSessionResume(
     hr = BuffReadNumber(pbData, cbData, &iData, (DWORD*)&pRegistration->fDisableResume);
     ExitOnFailure(hr, "Failed to read resume flag.");
 
-    hr = VariableDeserialize(pVariables, FALSE, pbData, cbData, &iData);
+    hr = VariableDeserializeChanges(pVariables, pbData, cbData, &iData);
     ExitOnFailure(hr, "Failed to read variables.");
 
     // resume session in per-machine process
@@ -1848,6 +1954,7 @@ LExit:
 }
 
 static HRESULT OnCacheOrLayoutContainerOrPayload(
+    __in HANDLE hPipe,
     __in BURN_CONTAINERS* pContainers,
     __in BURN_PACKAGES* pPackages,
     __in BURN_PAYLOADS* pPayloads,
@@ -1910,12 +2017,12 @@ static HRESULT OnCacheOrLayoutContainerOrPayload(
             Assert(!pPackage);
             Assert(!pPayload);
 
-            hr = CacheLayoutContainer(pContainer, sczLayoutDirectory, sczUnverifiedPath, fMove);
+            hr = CacheLayoutContainer(pContainer, sczLayoutDirectory, sczUnverifiedPath, fMove, CacheVerifyProgressMessageHandler, hPipe);
             ExitOnFailure(hr, "Failed to layout container from: %ls to %ls", sczUnverifiedPath, sczLayoutDirectory);
         }
         else
         {
-            hr = CacheLayoutPayload(pPayload, sczLayoutDirectory, sczUnverifiedPath, fMove);
+            hr = CacheLayoutPayload(pPayload, sczLayoutDirectory, sczUnverifiedPath, fMove, CacheVerifyProgressMessageHandler, hPipe);
             ExitOnFailure(hr, "Failed to layout payload from: %ls to %ls", sczUnverifiedPath, sczLayoutDirectory);
         }
     }
@@ -1923,7 +2030,7 @@ static HRESULT OnCacheOrLayoutContainerOrPayload(
     {
         Assert(!pContainer);
 
-        hr = CacheCompletePayload(pPackage->fPerMachine, pPayload, pPackage->sczCacheId, sczUnverifiedPath, fMove);
+        hr = CacheCompletePayload(pPackage->fPerMachine, pPayload, pPackage->sczCacheId, sczUnverifiedPath, fMove, CacheVerifyProgressMessageHandler, hPipe);
         ExitOnFailure(hr, "Failed to cache payload: %ls", pPayload->sczKey);
     }
     else
@@ -1940,6 +2047,37 @@ LExit:
     return hr;
 }
 
+static HRESULT CacheVerifyProgressMessageHandler(
+    __in DWORD64 qwVerified,
+    __in DWORD64 qwTotal,
+    __in_opt LPVOID pvContext
+    )
+{
+    HRESULT hr = S_OK;
+    HANDLE hPipe = (HANDLE)pvContext;
+    BYTE* pbData = NULL;
+    SIZE_T cbData = 0;
+    DWORD dwResult = 0;
+
+    // serialize message data
+    hr = BuffWriteNumber64(&pbData, &cbData, qwVerified);
+    ExitOnFailure(hr, "Failed to write verified bytes to message buffer.");
+
+    hr = BuffWriteNumber64(&pbData, &cbData, qwTotal);
+    ExitOnFailure(hr, "Failed to write total bytes to message buffer.");
+
+    // send message
+    hr = PipeSendMessage(hPipe, BURN_ELEVATION_MESSAGE_TYPE_CACHE_VERIFY_PROGRESS, pbData, cbData, NULL, NULL, &dwResult);
+    ExitOnFailure(hr, "Failed to send message to per-user process.");
+
+    hr = static_cast<HRESULT>(dwResult);
+
+LExit:
+    ReleaseBuffer(pbData);
+
+    return hr;
+}
+
 static void OnCacheCleanup(
     __in_z LPCWSTR wzBundleId
     )
@@ -2016,7 +2154,7 @@ static HRESULT OnExecuteExePackage(
     hr = BuffReadString(pbData, cbData, &iData, &sczAncestors);
     ExitOnFailure(hr, "Failed to read the list of ancestors.");
 
-    hr = VariableDeserialize(pVariables, FALSE, pbData, cbData, &iData);
+    hr = VariableDeserializeChanges(pVariables, pbData, cbData, &iData);
     ExitOnFailure(hr, "Failed to read variables.");
 
     hr = PackageFindById(pPackages, sczPackage, &executeAction.exePackage.pPackage);
@@ -2128,7 +2266,7 @@ static HRESULT OnExecuteMsiPackage(
         }
     }
 
-    hr = VariableDeserialize(pVariables, FALSE, pbData, cbData, &iData);
+    hr = VariableDeserializeChanges(pVariables, pbData, cbData, &iData);
     ExitOnFailure(hr, "Failed to read variables.");
 
     hr = BuffReadNumber(pbData, cbData, &iData, (DWORD*)&fRollback);
@@ -2220,7 +2358,7 @@ static HRESULT OnExecuteMspPackage(
         }
     }
 
-    hr = VariableDeserialize(pVariables, FALSE, pbData, cbData, &iData);
+    hr = VariableDeserializeChanges(pVariables, pbData, cbData, &iData);
     ExitOnFailure(hr, "Failed to read variables.");
 
     hr = BuffReadNumber(pbData, cbData, &iData, (DWORD*)&fRollback);
@@ -61,7 +61,9 @@ HRESULT ElevationCacheOrLayoutContainerOrPayload(
     __in_opt BURN_PAYLOAD* pPayload,
     __in_z_opt LPCWSTR wzLayoutDirectory,
     __in_z LPCWSTR wzUnverifiedPath,
-    __in BOOL fMove
+    __in BOOL fMove,
+    __in_opt PFN_CRYPHASHPROGRESS pfnVerifyProgress,
+    __in_opt LPVOID pvContext
     );
 HRESULT ElevationCacheCleanup(
     __in HANDLE hPipe
@@ -582,18 +582,19 @@ extern "C" LPWSTR LoggingStringOrUnknownIfNull(
     return wz ? wz : L"Unknown";
 }
 
-// Note: this function is not thread safe.
+// Formats into the caller's buffer since packages may be detected on several threads at once.
 extern "C" LPCSTR LoggingVersionToString(
-    __in DWORD64 dw64Version
+    __in DWORD64 dw64Version,
+    __out_ecount(cchVersion) LPSTR szVersion,
+    __in DWORD cchVersion
     )
 {
-    static CHAR szVersion[40] = { 0 };
     HRESULT hr = S_OK;
 
-    hr = ::StringCchPrintfA(szVersion, countof(szVersion), "%I64u.%I64u.%I64u.%I64u", dw64Version >> 48 & 0xFFFF, dw64Version >> 32 & 0xFFFF, dw64Version >> 16 & 0xFFFF, dw64Version  & 0xFFFF);
+    hr = ::StringCchPrintfA(szVersion, cchVersion, "%I64u.%I64u.%I64u.%I64u", dw64Version >> 48 & 0xFFFF, dw64Version >> 32 & 0xFFFF, dw64Version >> 16 & 0xFFFF, dw64Version  & 0xFFFF);
     if (FAILED(hr))
     {
-        memset(szVersion, 0, sizeof(szVersion));
+        memset(szVersion, 0, cchVersion * sizeof(CHAR));
     }
 
     return szVersion;
@@ -9,6 +9,8 @@ extern "C" {
 
 // constants
 
+const DWORD BURN_LOGGING_VERSION_LENGTH = 40;
+
 enum BURN_LOGGING_STATE
 {
     BURN_LOGGING_STATE_CLOSED,
@@ -133,9 +135,10 @@ LPWSTR LoggingStringOrUnknownIfNull(
     __in LPCWSTR wz
     );
 
-// Note: this function is not thread safe.
 LPCSTR LoggingVersionToString(
-    __in DWORD64 dw64Version
+    __in DWORD64 dw64Version,
+    __out_ecount(cchVersion) LPSTR szVersion,
+    __in DWORD cchVersion
     );
 
 
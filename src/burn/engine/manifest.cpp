@@ -70,6 +70,13 @@ extern "C" HRESULT ManifestLoadXmlFromBuffer(
         {
             ExitOnFailure(hr, "Failed to get Chain/@ParallelCache");
         }
+
+        // parse parallel detect
+        hr = XmlGetYesNoAttribute(pixnChain, L"ParallelDetect", &pEngineState->fParallelDetect);
+        if (E_NOTFOUND != hr)
+        {
+            ExitOnFailure(hr, "Failed to get Chain/@ParallelDetect");
+        }
     }
 
     // parse built-in condition 
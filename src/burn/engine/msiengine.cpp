@@ -395,7 +395,7 @@ extern "C" HRESULT MsiEngineDetectPackage(
     DWORD64 qwVersion = 0;
     UINT uLcid = 0;
     BOOL fPerMachine = FALSE;
-    int nResult = 0;
+    CHAR szVersion[BURN_LOGGING_VERSION_LENGTH] = { };
 
     // detect self by product code
     // TODO: what to do about MSIINSTALLCONTEXT_USERMANAGED?
@@ -424,11 +424,10 @@ extern "C" HRESULT MsiEngineDetectPackage(
         // report related MSI package to UX
         if (BOOTSTRAPPER_RELATED_OPERATION_NONE != operation)
         {
-            LogId(REPORT_STANDARD, MSG_DETECTED_RELATED_PACKAGE, pPackage->Msi.sczProductCode, LoggingPerMachineToString(pPackage->fPerMachine), LoggingVersionToString(pPackage->Msi.qwInstalledVersion), pPackage->Msi.dwLanguage, LoggingRelatedOperationToString(operation));
+            LogId(REPORT_STANDARD, MSG_DETECTED_RELATED_PACKAGE, pPackage->Msi.sczProductCode, LoggingPerMachineToString(pPackage->fPerMachine), LoggingVersionToString(pPackage->Msi.qwInstalledVersion, szVersion, countof(szVersion)), pPackage->Msi.dwLanguage, LoggingRelatedOperationToString(operation));
 
-            nResult = pUserExperience->pUserExperience->OnDetectRelatedMsiPackage(pPackage->sczId, pPackage->Msi.sczProductCode, pPackage->fPerMachine, pPackage->Msi.qwInstalledVersion, operation);
-            hr = UserExperienceInterpretResult(pUserExperience, MB_OKCANCEL, nResult);
-            ExitOnRootFailure(hr, "UX aborted detect related MSI package.");
+            hr = DetectReportRelatedMsiPackage(pUserExperience, pPackage, pPackage->Msi.sczProductCode, pPackage->fPerMachine, pPackage->Msi.qwInstalledVersion, operation);
+            ExitOnFailure(hr, "Failed to report related MSI package.");
         }
     }
     else if (HRESULT_FROM_WIN32(ERROR_UNKNOWN_PRODUCT) == hr || HRESULT_FROM_WIN32(ERROR_UNKNOWN_PROPERTY) == hr) // package not present.
@@ -447,9 +446,8 @@ extern "C" HRESULT MsiEngineDetectPackage(
                 {
                     LogId(REPORT_STANDARD, MSG_DETECTED_COMPATIBLE_PACKAGE_FROM_PROVIDER, pPackage->sczId, sczInstalledProviderKey, sczInstalledProductCode, sczInstalledVersion, pPackage->Msi.sczProductCode);
 
-                    nResult = pUserExperience->pUserExperience->OnDetectCompatiblePackage(pPackage->sczId, sczInstalledProductCode);
-                    hr = UserExperienceInterpretResult(pUserExperience, MB_OKCANCEL, nResult);
-                    ExitOnRootFailure(hr, "UX aborted detect compatible MSI package.");
+                    hr = DetectReportCompatiblePackage(pUserExperience, pPackage, sczInstalledProductCode);
+                    ExitOnFailure(hr, "Failed to report compatible MSI package.");
 
                     hr = StrAllocString(&pPackage->Msi.sczInstalledProductCode, sczInstalledProductCode, 0);
                     ExitOnFailure(hr, "Failed to copy the installed ProductCode to the package.");
@@ -591,12 +589,11 @@ extern "C" HRESULT MsiEngineDetectPackage(
                 operation = BOOTSTRAPPER_RELATED_OPERATION_MAJOR_UPGRADE;
             }
 
-            LogId(REPORT_STANDARD, MSG_DETECTED_RELATED_PACKAGE, wzProductCode, LoggingPerMachineToString(fPerMachine), LoggingVersionToString(qwVersion), uLcid, LoggingRelatedOperationToString(relatedMsiOperation));
+            LogId(REPORT_STANDARD, MSG_DETECTED_RELATED_PACKAGE, wzProductCode, LoggingPerMachineToString(fPerMachine), LoggingVersionToString(qwVersion, szVersion, countof(szVersion)), uLcid, LoggingRelatedOperationToString(relatedMsiOperation));
 
             // pass to UX
-            nResult = pUserExperience->pUserExperience->OnDetectRelatedMsiPackage(pPackage->sczId, wzProductCode, fPerMachine, qwVersion, relatedMsiOperation);
-            hr = UserExperienceInterpretResult(pUserExperience, MB_OKCANCEL, nResult);
-            ExitOnRootFailure(hr, "UX aborted detect related MSI package.");
+            hr = DetectReportRelatedMsiPackage(pUserExperience, pPackage, wzProductCode, fPerMachine, qwVersion, relatedMsiOperation);
+            ExitOnFailure(hr, "Failed to report related MSI package.");
         }
     }
 
@@ -644,9 +641,8 @@ extern "C" HRESULT MsiEngineDetectPackage(
             }
 
             // pass to UX
-            nResult = pUserExperience->pUserExperience->OnDetectMsiFeature(pPackage->sczId, pFeature->sczId, pFeature->currentState);
-            hr = UserExperienceInterpretResult(pUserExperience, MB_OKCANCEL, nResult);
-            ExitOnRootFailure(hr, "UX aborted detect.");
+            hr = DetectReportMsiFeature(pUserExperience, pPackage, pFeature->sczId, pFeature->currentState);
+            ExitOnFailure(hr, "Failed to report MSI feature.");
         }
     }
 
@@ -201,7 +201,6 @@ extern "C" HRESULT MspEngineDetectPackage(
     )
 {
     HRESULT hr = S_OK;
-    int nResult = IDOK;
     LPWSTR sczState = NULL;
 
     if (0 == pPackage->Msp.cTargetProductCodes)
@@ -253,9 +252,8 @@ extern "C" HRESULT MspEngineDetectPackage(
                 pPackage->currentState = pTargetProduct->patchPackageState;
             }
 
-            nResult = pUserExperience->pUserExperience->OnDetectTargetMsiPackage(pPackage->sczId, pTargetProduct->wzTargetProductCode, pTargetProduct->patchPackageState);
-            hr = UserExperienceInterpretResult(pUserExperience, MB_OKCANCEL, nResult);
-            ExitOnRootFailure(hr, "UX aborted detect target MSI package.");
+            hr = DetectReportTargetMsiPackage(pUserExperience, pPackage, pTargetProduct->wzTargetProductCode, pTargetProduct->patchPackageState);
+            ExitOnFailure(hr, "Failed to report target MSI package.");
         }
     }
 
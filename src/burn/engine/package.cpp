@@ -96,6 +96,9 @@ extern "C" HRESULT PackagesParseFromXml(
 
     pPackages->cPackages = cNodes;
 
+    hr = DictCreateWithEmbeddedKey(&pPackages->sdPackages, cNodes, reinterpret_cast<void**>(&pPackages->rgPackages), offsetof(BURN_PACKAGE, sczId), DICT_FLAG_NONE);
+    ExitOnFailure(hr, "Failed to create package id index.");
+
     // parse package elements
     for (DWORD i = 0; i < cNodes; ++i)
     {
@@ -108,6 +111,9 @@ extern "C" HRESULT PackagesParseFromXml(
         hr = XmlGetAttributeEx(pixnNode, L"Id", &pPackage->sczId);
         ExitOnFailure(hr, "Failed to get @Id.");
 
+        hr = DictAddValue(pPackages->sdPackages, pPackage);
+        ExitOnFailure(hr, "Failed to index package: %ls", pPackage->sczId);
+
         // @Cache
         hr = XmlGetAttributeEx(pixnNode, L"Cache", &scz);
         if (SUCCEEDED(hr))
@@ -326,6 +332,8 @@ extern "C" void PackageUninitialize(
 
     ReleaseMem(pPackage->rgPayloads);
 
+    DetectReleasePackageMessages(pPackage);
+
     switch (pPackage->type)
     {
     case BURN_PACKAGE_TYPE_EXE:
@@ -385,6 +393,7 @@ extern "C" void PackagesUninitialize(
 
     ReleaseMem(pPackages->rgPatchInfo);
     ReleaseMem(pPackages->rgPatchInfoToPackage);
+    ReleaseDict(pPackages->sdPackages);
 
     // clear struct
     memset(pPackages, 0, sizeof(BURN_PACKAGES));
@@ -399,17 +408,19 @@ extern "C" HRESULT PackageFindById(
     HRESULT hr = S_OK;
     BURN_PACKAGE* pPackage = NULL;
 
-    for (DWORD i = 0; i < pPackages->cPackages; ++i)
+    if (pPackages->sdPackages)
     {
-        pPackage = &pPackages->rgPackages[i];
-
-        if (CSTR_EQUAL == ::CompareStringW(LOCALE_INVARIANT, 0, pPackage->sczId, -1, wzId, -1))
+        hr = DictGetValue(pPackages->sdPackages, wzId, reinterpret_cast<void**>(&pPackage));
+        if (E_NOTFOUND != hr)
         {
+            ExitOnFailure(hr, "Failed to look up package: %ls", wzId);
+
             *ppPackage = pPackage;
-            ExitFunction1(hr = S_OK);
+            ExitFunction();
         }
     }
 
+    // Compatible packages are only added during detect and there is at most one per MSI package, so they are not indexed.
     for (DWORD i = 0; i < pPackages->cCompatiblePackages; ++i)
     {
         pPackage = &pPackages->rgCompatiblePackages[i];
@@ -67,6 +67,15 @@ enum BURN_PATCH_TARGETCODE_TYPE
     BURN_PATCH_TARGETCODE_TYPE_UPGRADE,
 };
 
+enum BURN_DETECT_MESSAGE_TYPE
+{
+    BURN_DETECT_MESSAGE_TYPE_NONE,
+    BURN_DETECT_MESSAGE_TYPE_RELATED_MSI_PACKAGE,
+    BURN_DETECT_MESSAGE_TYPE_COMPATIBLE_PACKAGE,
+    BURN_DETECT_MESSAGE_TYPE_MSI_FEATURE,
+    BURN_DETECT_MESSAGE_TYPE_TARGET_MSI_PACKAGE,
+};
+
 // structs
 
 typedef struct _BURN_EXE_EXIT_CODE
@@ -161,6 +170,17 @@ typedef struct _BURN_PATCH_TARGETCODE
     BURN_PATCH_TARGETCODE_TYPE type;
 } BURN_PATCH_TARGETCODE;
 
+typedef struct _BURN_DETECT_MESSAGE
+{
+    BURN_DETECT_MESSAGE_TYPE type;
+    LPWSTR sczId;                               // product code, or feature id for MSI features.
+    BOOL fPerMachine;
+    DWORD64 qwVersion;
+    BOOTSTRAPPER_RELATED_OPERATION operation;
+    BOOTSTRAPPER_FEATURE_STATE featureState;
+    BOOTSTRAPPER_PACKAGE_STATE packageState;
+} BURN_DETECT_MESSAGE;
+
 typedef struct _BURN_PACKAGE
 {
     LPWSTR sczId;
@@ -199,6 +219,10 @@ typedef struct _BURN_PACKAGE
     BOOL fDependencyManagerWasHere;             // only valid during Plan.
     HRESULT hrCacheResult;                      // only valid during Apply.
 
+    BOOL fDeferDetectMessages;                  // only valid during Detect.
+    BURN_DETECT_MESSAGE* rgDetectMessages;      // only valid during Detect.
+    DWORD cDetectMessages;                      // only valid during Detect.
+
     BURN_PACKAGE_PAYLOAD* rgPayloads;
     DWORD cPayloads;
 
@@ -281,6 +305,7 @@ typedef struct _BURN_PACKAGES
 
     BURN_PACKAGE* rgPackages;
     DWORD cPackages;
+    STRINGDICT_HANDLE sdPackages; // index of rgPackages by id.
 
     BURN_PACKAGE* rgCompatiblePackages;
     DWORD cCompatiblePackages;
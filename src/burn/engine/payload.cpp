@@ -47,6 +47,9 @@ extern "C" HRESULT PayloadsParseFromXml(
 
     pPayloads->cPayloads = cNodes;
 
+    hr = DictCreateWithEmbeddedKey(&pPayloads->sdPayloads, cNodes, reinterpret_cast<void**>(&pPayloads->rgPayloads), offsetof(BURN_PAYLOAD, sczKey), DICT_FLAG_NONE);
+    ExitOnFailure(hr, "Failed to create payload id index.");
+
     // parse search elements
     for (DWORD i = 0; i < cNodes; ++i)
     {
@@ -59,6 +62,9 @@ extern "C" HRESULT PayloadsParseFromXml(
         hr = XmlGetAttributeEx(pixnNode, L"Id", &pPayload->sczKey);
         ExitOnFailure(hr, "Failed to get @Id.");
 
+        hr = DictAddValue(pPayloads->sdPayloads, pPayload);
+        ExitOnFailure(hr, "Failed to index payload: %ls", pPayload->sczKey);
+
         // @FilePath
         hr = XmlGetAttributeEx(pixnNode, L"FilePath", &pPayload->sczFilePath);
         ExitOnFailure(hr, "Failed to get @FilePath.");
@@ -198,6 +204,8 @@ extern "C" void PayloadsUninitialize(
             ReleaseMem(pPayload->pbCertificateRootPublicKeyIdentifier);
             ReleaseStr(pPayload->sczSourcePath);
             ReleaseStr(pPayload->sczLocalFilePath);
+            ReleaseStr(pPayload->sczExtractedPath);
+            ReleaseMem(pPayload->pbExtractedHash);
             ReleaseStr(pPayload->downloadSource.sczUrl);
             ReleaseStr(pPayload->downloadSource.sczUser);
             ReleaseStr(pPayload->downloadSource.sczPassword);
@@ -205,6 +213,8 @@ extern "C" void PayloadsUninitialize(
         MemFree(pPayloads->rgPayloads);
     }
 
+    ReleaseDict(pPayloads->sdPayloads);
+
     // clear struct
     memset(pPayloads, 0, sizeof(BURN_PAYLOADS));
 }
@@ -248,7 +258,7 @@ extern "C" HRESULT PayloadExtractFromContainer(
         hr = DirEnsureExists(sczDirectory, NULL);
         ExitOnFailure(hr, "Failed to ensure directory exists");
 
-        hr = ContainerStreamToFile(pContainerContext, pPayload->sczLocalFilePath);
+        hr = ContainerStreamToFile(pContainerContext, pPayload->sczLocalFilePath, NULL, 0);
         ExitOnFailure(hr, "Failed to extract file.");
 
         // flag that the payload has been acquired
@@ -288,18 +298,18 @@ extern "C" HRESULT PayloadFindById(
     HRESULT hr = S_OK;
     BURN_PAYLOAD* pPayload = NULL;
 
-    for (DWORD i = 0; i < pPayloads->cPayloads; ++i)
+    if (!pPayloads->sdPayloads)
     {
-        pPayload = &pPayloads->rgPayloads[i];
-
-        if (CSTR_EQUAL == ::CompareStringW(LOCALE_INVARIANT, 0, pPayload->sczKey, -1, wzId, -1))
-        {
-            *ppPayload = pPayload;
-            ExitFunction1(hr = S_OK);
-        }
+        ExitFunction1(hr = E_NOTFOUND);
     }
 
-    hr = E_NOTFOUND;
+    hr = DictGetValue(pPayloads->sdPayloads, wzId, reinterpret_cast<void**>(&pPayload));
+    if (E_NOTFOUND != hr)
+    {
+        ExitOnFailure(hr, "Failed to look up payload: %ls", wzId);
+
+        *ppPayload = pPayload;
+    }
 
 LExit:
     return hr;
@@ -50,12 +50,16 @@ typedef struct _BURN_PAYLOAD
     // mutable members
     BURN_PAYLOAD_STATE state;
     LPWSTR sczLocalFilePath; // location of extracted or downloaded copy
+    LPWSTR sczExtractedPath; // working path the payload was last extracted to, hashed as it was written
+    BYTE* pbExtractedHash;
+    DWORD cbExtractedHash;
 } BURN_PAYLOAD;
 
 typedef struct _BURN_PAYLOADS
 {
     BURN_PAYLOAD* rgPayloads;
     DWORD cPayloads;
+    STRINGDICT_HANDLE sdPayloads; // index of rgPayloads by id.
 } BURN_PAYLOADS;
 
 
@@ -132,6 +132,22 @@ static BURN_CACHE_ACTION* ProcessSharedPayload(
     __in BURN_PLAN* pPlan,
     __in BURN_PAYLOAD* pPayload
     );
+static HRESULT IndexCacheAction(
+    __in BURN_PLAN* pPlan,
+    __in DWORD iCacheAction
+    );
+static BURN_CACHE_ACTION_INDEX_ENTRY* FindCacheIndexEntry(
+    __in_opt STRINGDICT_HANDLE sdIndex,
+    __in_z LPCWSTR wzKey
+    );
+static void FormatCacheIndexKey(
+    __in const void* pv,
+    __out_ecount(cchKey) LPWSTR wzKey,
+    __in DWORD cchKey
+    );
+static DWORD GetArrayGrowthCount(
+    __in DWORD cItems
+    );
 static HRESULT RemoveUnnecessaryActions(
     __in BOOL fExecute,
     __in BURN_EXECUTE_ACTION* rgActions,
@@ -157,6 +173,65 @@ static BOOL NeedsCache(
     __in BURN_PLAN* pPlan,
     __in BURN_PACKAGE* pPackage
     );
+static HRESULT AddPackageActions(
+    __in BOOTSTRAPPER_DISPLAY display,
+    __in BURN_PLAN* pPlan,
+    __in BURN_PACKAGE* pPackage,
+    __in BURN_LOGGING* pLog,
+    __in BURN_VARIABLES* pVariables,
+    __in_opt HANDLE hCacheEvent,
+    __in DWORD64 qwConditionGeneration
+    );
+static HRESULT RecordPlannedPackageInputs(
+    __in BOOTSTRAPPER_DISPLAY display,
+    __in BURN_PLAN* pPlan,
+    __in BURN_PACKAGE* pPackage,
+    __in BURN_LOGGING* pLog,
+    __in_opt HANDLE hCacheEvent,
+    __in DWORD64 qwConditionGeneration,
+    __in BURN_PLANNED_PACKAGE* pPlannedPackage
+    );
+static BOOL PlannedPackageInputsMatch(
+    __in BURN_VARIABLES* pVariables,
+    __in BURN_PLANNED_PACKAGE* pPreviousPlannedPackage,
+    __in BURN_PLANNED_PACKAGE* pPlannedPackage
+    );
+static BOOL PackageConditionsChangedSince(
+    __in BURN_VARIABLES* pVariables,
+    __in BURN_PACKAGE* pPackage,
+    __in DWORD64 qwGeneration
+    );
+static BURN_PLANNED_PACKAGE* FindPreviousPlannedPackage(
+    __in BURN_PLAN* pPlan,
+    __in BURN_PACKAGE* pPackage
+    );
+static HRESULT SplicePlannedPackage(
+    __in BURN_PLAN* pPlan,
+    __in BURN_PLANNED_PACKAGE* pPreviousPlannedPackage,
+    __in BURN_LOGGING* pLog,
+    __in BURN_VARIABLES* pVariables,
+    __in_opt HANDLE hCacheEvent
+    );
+static void MoveSplicedAction(
+    __in BURN_EXECUTE_ACTION* pPreviousAction,
+    __in BOOL fRollback,
+    __in BURN_LOGGING* pLog,
+    __in BURN_VARIABLES* pVariables,
+    __in_opt HANDLE hCacheEvent,
+    __in BURN_EXECUTE_ACTION* pAction
+    );
+static void ShiftPlannedPackages(
+    __in BURN_PLAN* pPlan,
+    __in DWORD dwIndex,
+    __in BOOL fRollback
+    );
+static void ReleasePlannedPackages(
+    __in_ecount_opt(cPlannedPackages) BURN_PLANNED_PACKAGE* rgPlannedPackages,
+    __in DWORD cPlannedPackages
+    );
+static void ReleasePreviousPlan(
+    __in BURN_PLAN* pPlan
+    );
 
 // function definitions
 
@@ -165,6 +240,15 @@ extern "C" void PlanReset(
     __in BURN_PACKAGES* pPackages
     )
 {
+    BURN_PLANNED_PACKAGE* rgPlannedPackages = pPlan->rgPlannedPackages;
+    DWORD cPlannedPackages = pPlan->cPlannedPackages;
+    BURN_EXECUTE_ACTION* rgExecuteActions = pPlan->rgExecuteActions;
+    DWORD cExecuteActions = pPlan->cExecuteActions;
+    BURN_EXECUTE_ACTION* rgRollbackActions = pPlan->rgRollbackActions;
+    DWORD cRollbackActions = pPlan->cRollbackActions;
+
+    ReleasePreviousPlan(pPlan);
+
     if (pPlan->rgRegistrationActions)
     {
         for (DWORD i = 0; i < pPlan->cRegistrationActions; ++i)
@@ -192,23 +276,20 @@ extern "C" void PlanReset(
         MemFree(pPlan->rgCacheActions);
     }
 
-    if (pPlan->rgExecuteActions)
+    if (pPlan->rgCacheIndexEntries)
     {
-        for (DWORD i = 0; i < pPlan->cExecuteActions; ++i)
+        for (DWORD i = 0; i < pPlan->cCacheIndexEntries; ++i)
         {
-            PlanUninitializeExecuteAction(&pPlan->rgExecuteActions[i]);
+            ReleaseStr(pPlan->rgCacheIndexEntries[i].sczKey);
+            ReleaseMem(pPlan->rgCacheIndexEntries[i].rgiAcquireActions);
+            ReleaseMem(pPlan->rgCacheIndexEntries[i].rgiExtractActions);
         }
-        MemFree(pPlan->rgExecuteActions);
+        MemFree(pPlan->rgCacheIndexEntries);
     }
 
-    if (pPlan->rgRollbackActions)
-    {
-        for (DWORD i = 0; i < pPlan->cRollbackActions; ++i)
-        {
-            PlanUninitializeExecuteAction(&pPlan->rgRollbackActions[i]);
-        }
-        MemFree(pPlan->rgRollbackActions);
-    }
+    ReleaseDict(pPlan->sdCachePackages);
+    ReleaseDict(pPlan->sdCacheContainers);
+    ReleaseDict(pPlan->sdCachePayloads);
 
     if (pPlan->rgCleanActions)
     {
@@ -223,6 +304,15 @@ extern "C" void PlanReset(
 
     memset(pPlan, 0, sizeof(BURN_PLAN));
 
+    // Keep the execute and rollback actions so the next plan can splice back in the ones
+    // planned for packages that did not change.
+    pPlan->rgPreviousPlannedPackages = rgPlannedPackages;
+    pPlan->cPreviousPlannedPackages = cPlannedPackages;
+    pPlan->rgPreviousExecuteActions = rgExecuteActions;
+    pPlan->cPreviousExecuteActions = cExecuteActions;
+    pPlan->rgPreviousRollbackActions = rgRollbackActions;
+    pPlan->cPreviousRollbackActions = cRollbackActions;
+
     // Reset the planned actions for each package.
     if (pPackages->rgPackages)
     {
@@ -1002,6 +1092,9 @@ extern "C" HRESULT PlanLayoutPackage(
     pCacheAction->type = BURN_CACHE_ACTION_TYPE_PACKAGE_STOP;
     pCacheAction->packageStop.pPackage = pPackage;
 
+    hr = IndexCacheAction(pPlan, pPlan->cCacheActions - 1);
+    ExitOnFailure(hr, "Failed to index package stop action.");
+
     // Update the start action with the location of the complete action.
     pPlan->rgCacheActions[iPackageStartAction].packageStart.iPackageCompleteAction = pPlan->cCacheActions - 1;
 
@@ -1064,6 +1157,7 @@ extern "C" HRESULT PlanExecutePackage(
 {
     HRESULT hr = S_OK;
     BOOL fBARequestedCache = FALSE;
+    DWORD64 qwConditionGeneration = VariableGetGeneration(pVariables);
 
     hr = CalculateExecuteActions(pUserExperience, pPackage, pVariables, &fBARequestedCache);
     ExitOnFailure(hr, "Failed to calculate plan actions for package: %ls", pPackage->sczId);
@@ -1112,28 +1206,7 @@ extern "C" HRESULT PlanExecutePackage(
     }
 
     // Add execute actions.
-    switch (pPackage->type)
-    {
-    case BURN_PACKAGE_TYPE_EXE:
-        hr = ExeEnginePlanAddPackage(NULL, pPackage, pPlan, pLog, pVariables, *phSyncpointEvent, pPackage->fAcquire);
-        break;
-
-    case BURN_PACKAGE_TYPE_MSI:
-        hr = MsiEnginePlanAddPackage(display, pPackage, pPlan, pLog, pVariables, *phSyncpointEvent, pPackage->fAcquire);
-        break;
-
-    case BURN_PACKAGE_TYPE_MSP:
-        hr = MspEnginePlanAddPackage(display, pPackage, pPlan, pLog, pVariables, *phSyncpointEvent, pPackage->fAcquire);
-        break;
-
-    case BURN_PACKAGE_TYPE_MSU:
-        hr = MsuEnginePlanAddPackage(pPackage, pPlan, pLog, pVariables, *phSyncpointEvent, pPackage->fAcquire);
-        break;
-
-    default:
-        hr = E_UNEXPECTED;
-        ExitOnFailure(hr, "Invalid package type.");
-    }
+    hr = AddPackageActions(display, pPlan, pPackage, pLog, pVariables, *phSyncpointEvent, qwConditionGeneration);
     ExitOnFailure(hr, "Failed to add plan actions for package: %ls", pPackage->sczId);
 
     // Plan certain dependency actions after planning the package execute action.
@@ -1464,6 +1537,9 @@ extern "C" HRESULT PlanFinalizeActions(
 {
     HRESULT hr = S_OK;
 
+    // Whatever is left of the previous plan was not spliced into this one.
+    ReleasePreviousPlan(pPlan);
+
     hr = RemoveUnnecessaryActions(TRUE, pPlan->rgExecuteActions, pPlan->cExecuteActions);
     ExitOnFailure(hr, "Failed to remove unnecessary execute actions.");
 
@@ -1528,7 +1604,7 @@ extern "C" HRESULT PlanCleanPackage(
 
     if (fPlanCleanPackage)
     {
-        hr = MemEnsureArraySize(reinterpret_cast<LPVOID*>(&pPlan->rgCleanActions), pPlan->cCleanActions + 1, sizeof(BURN_CLEAN_ACTION), 5);
+        hr = MemEnsureArraySize(reinterpret_cast<LPVOID*>(&pPlan->rgCleanActions), pPlan->cCleanActions + 1, sizeof(BURN_CLEAN_ACTION), GetArrayGrowthCount(pPlan->cCleanActions));
         ExitOnFailure(hr, "Failed to grow plan's array of clean actions.");
 
         pCleanAction = pPlan->rgCleanActions + pPlan->cCleanActions;
@@ -1609,12 +1685,14 @@ extern "C" HRESULT PlanInsertExecuteAction(
 {
     HRESULT hr = S_OK;
 
-    hr = MemInsertIntoArray((void**)&pPlan->rgExecuteActions, dwIndex, 1, pPlan->cExecuteActions + 1, sizeof(BURN_EXECUTE_ACTION), 5);
+    hr = MemInsertIntoArray((void**)&pPlan->rgExecuteActions, dwIndex, 1, pPlan->cExecuteActions + 1, sizeof(BURN_EXECUTE_ACTION), GetArrayGrowthCount(pPlan->cExecuteActions));
     ExitOnFailure(hr, "Failed to grow plan's array of execute actions.");
 
     *ppExecuteAction = pPlan->rgExecuteActions + dwIndex;
     ++pPlan->cExecuteActions;
 
+    ShiftPlannedPackages(pPlan, dwIndex, FALSE);
+
 LExit:
     return hr;
 }
@@ -1627,12 +1705,14 @@ extern "C" HRESULT PlanInsertRollbackAction(
 {
     HRESULT hr = S_OK;
 
-    hr = MemInsertIntoArray((void**)&pPlan->rgRollbackActions, dwIndex, 1, pPlan->cRollbackActions + 1, sizeof(BURN_EXECUTE_ACTION), 5);
+    hr = MemInsertIntoArray((void**)&pPlan->rgRollbackActions, dwIndex, 1, pPlan->cRollbackActions + 1, sizeof(BURN_EXECUTE_ACTION), GetArrayGrowthCount(pPlan->cRollbackActions));
     ExitOnFailure(hr, "Failed to grow plan's array of rollback actions.");
 
     *ppRollbackAction = pPlan->rgRollbackActions + dwIndex;
     ++pPlan->cRollbackActions;
 
+    ShiftPlannedPackages(pPlan, dwIndex, TRUE);
+
 LExit:
     return hr;
 }
@@ -1644,7 +1724,7 @@ extern "C" HRESULT PlanAppendExecuteAction(
 {
     HRESULT hr = S_OK;
 
-    hr = MemEnsureArraySize((void**)&pPlan->rgExecuteActions, pPlan->cExecuteActions + 1, sizeof(BURN_EXECUTE_ACTION), 5);
+    hr = MemEnsureArraySize((void**)&pPlan->rgExecuteActions, pPlan->cExecuteActions + 1, sizeof(BURN_EXECUTE_ACTION), GetArrayGrowthCount(pPlan->cExecuteActions));
     ExitOnFailure(hr, "Failed to grow plan's array of execute actions.");
 
     *ppExecuteAction = pPlan->rgExecuteActions + pPlan->cExecuteActions;
@@ -1661,7 +1741,7 @@ extern "C" HRESULT PlanAppendRollbackAction(
 {
     HRESULT hr = S_OK;
 
-    hr = MemEnsureArraySize((void**)&pPlan->rgRollbackActions, pPlan->cRollbackActions + 1, sizeof(BURN_EXECUTE_ACTION), 5);
+    hr = MemEnsureArraySize((void**)&pPlan->rgRollbackActions, pPlan->cRollbackActions + 1, sizeof(BURN_EXECUTE_ACTION), GetArrayGrowthCount(pPlan->cRollbackActions));
     ExitOnFailure(hr, "Failed to grow plan's array of rollback actions.");
 
     *ppRollbackAction = pPlan->rgRollbackActions + pPlan->cRollbackActions;
@@ -1978,7 +2058,7 @@ static HRESULT AddRegistrationAction(
     BURN_DEPENDENT_REGISTRATION_ACTION* pAction = NULL;
 
     // Create forward registration action.
-    hr = MemEnsureArraySize((void**)&pPlan->rgRegistrationActions, pPlan->cRegistrationActions + 1, sizeof(BURN_DEPENDENT_REGISTRATION_ACTION), 5);
+    hr = MemEnsureArraySize((void**)&pPlan->rgRegistrationActions, pPlan->cRegistrationActions + 1, sizeof(BURN_DEPENDENT_REGISTRATION_ACTION), GetArrayGrowthCount(pPlan->cRegistrationActions));
     ExitOnFailure(hr, "Failed to grow plan's array of registration actions.");
 
     pAction = pPlan->rgRegistrationActions + pPlan->cRegistrationActions;
@@ -1993,7 +2073,7 @@ static HRESULT AddRegistrationAction(
     ExitOnFailure(hr, "Failed to copy dependent provider key to registration action.");
 
     // Create rollback registration action.
-    hr = MemEnsureArraySize((void**)&pPlan->rgRollbackRegistrationActions, pPlan->cRollbackRegistrationActions + 1, sizeof(BURN_DEPENDENT_REGISTRATION_ACTION), 5);
+    hr = MemEnsureArraySize((void**)&pPlan->rgRollbackRegistrationActions, pPlan->cRollbackRegistrationActions + 1, sizeof(BURN_DEPENDENT_REGISTRATION_ACTION), GetArrayGrowthCount(pPlan->cRollbackRegistrationActions));
     ExitOnFailure(hr, "Failed to grow plan's array of rollback registration actions.");
 
     pAction = pPlan->rgRollbackRegistrationActions + pPlan->cRollbackRegistrationActions;
@@ -2118,6 +2198,9 @@ static HRESULT AddCachePackageHelper(
     pCacheAction->type = BURN_CACHE_ACTION_TYPE_PACKAGE_STOP;
     pCacheAction->packageStop.pPackage = pPackage;
 
+    hr = IndexCacheAction(pPlan, pPlan->cCacheActions - 1);
+    ExitOnFailure(hr, "Failed to index package stop action.");
+
     // Update the start action with the location of the complete action.
     pPlan->rgCacheActions[iPackageStartAction].packageStart.iPackageCompleteAction = pPlan->cCacheActions - 1;
 
@@ -2171,24 +2254,19 @@ static BOOL AlreadyPlannedCachePackage(
     )
 {
     BOOL fPlanned = FALSE;
+    BURN_CACHE_ACTION_INDEX_ENTRY* pEntry = FindCacheIndexEntry(pPlan->sdCachePackages, wzPackageId);
 
-    for (DWORD iCacheAction = 0; iCacheAction < pPlan->cCacheActions; ++iCacheAction)
+    if (pEntry)
     {
-        BURN_CACHE_ACTION* pCacheAction = pPlan->rgCacheActions + iCacheAction;
+        DWORD iCacheAction = pEntry->iAction;
+        Assert(BURN_CACHE_ACTION_TYPE_PACKAGE_STOP == pPlan->rgCacheActions[iCacheAction].type);
 
-        if (BURN_CACHE_ACTION_TYPE_PACKAGE_STOP == pCacheAction->type)
+        if (iCacheAction + 1 < pPlan->cCacheActions && BURN_CACHE_ACTION_TYPE_SIGNAL_SYNCPOINT == pPlan->rgCacheActions[iCacheAction + 1].type)
         {
-            if (CSTR_EQUAL == ::CompareStringW(LOCALE_NEUTRAL, 0, pCacheAction->packageStop.pPackage->sczId, -1, wzPackageId, -1))
-            {
-                if (iCacheAction + 1 < pPlan->cCacheActions && BURN_CACHE_ACTION_TYPE_SIGNAL_SYNCPOINT == pPlan->rgCacheActions[iCacheAction + 1].type)
-                {
-                    *phSyncpointEvent = pPlan->rgCacheActions[iCacheAction + 1].syncpoint.hEvent;
-                }
-
-                fPlanned = TRUE;
-                break;
-            }
+            *phSyncpointEvent = pPlan->rgCacheActions[iCacheAction + 1].syncpoint.hEvent;
         }
+
+        fPlanned = TRUE;
     }
 
     return fPlanned;
@@ -2207,7 +2285,7 @@ static HRESULT AppendCacheAction(
 {
     HRESULT hr = S_OK;
 
-    hr = MemEnsureArraySize(reinterpret_cast<LPVOID*>(&pPlan->rgCacheActions), pPlan->cCacheActions + 1, sizeof(BURN_CACHE_ACTION), 5);
+    hr = MemEnsureArraySize(reinterpret_cast<LPVOID*>(&pPlan->rgCacheActions), pPlan->cCacheActions + 1, sizeof(BURN_CACHE_ACTION), GetArrayGrowthCount(pPlan->cCacheActions));
     ExitOnFailure(hr, "Failed to grow plan's array of cache actions.");
 
     *ppCacheAction = pPlan->rgCacheActions + pPlan->cCacheActions;
@@ -2224,7 +2302,7 @@ static HRESULT AppendRollbackCacheAction(
 {
     HRESULT hr = S_OK;
 
-    hr = MemEnsureArraySize(reinterpret_cast<LPVOID*>(&pPlan->rgRollbackCacheActions), pPlan->cRollbackCacheActions + 1, sizeof(BURN_CACHE_ACTION), 5);
+    hr = MemEnsureArraySize(reinterpret_cast<LPVOID*>(&pPlan->rgRollbackCacheActions), pPlan->cRollbackCacheActions + 1, sizeof(BURN_CACHE_ACTION), GetArrayGrowthCount(pPlan->cRollbackCacheActions));
     ExitOnFailure(hr, "Failed to grow plan's array of rollback cache actions.");
 
     *ppCacheAction = pPlan->rgRollbackCacheActions + pPlan->cRollbackCacheActions;
@@ -2377,6 +2455,9 @@ static HRESULT AppendCacheOrLayoutPayloadAction(
             pCacheAction->resolvePayload.pPayload = pPayload;
             hr = StrAllocString(&pCacheAction->resolvePayload.sczUnverifiedPath, sczPayloadWorkingPath, 0);
             ExitOnFailure(hr, "Failed to copy unverified path for payload to acquire.");
+
+            hr = IndexCacheAction(pPlan, pPlan->cCacheActions - 1);
+            ExitOnFailure(hr, "Failed to index acquire payload action.");
         }
 
         iTryAgainAction = static_cast<DWORD>(pCacheAction - pPlan->rgCacheActions);
@@ -2417,6 +2498,9 @@ static HRESULT AppendCacheOrLayoutPayloadAction(
 
     pCacheAction = NULL;
 
+    hr = IndexCacheAction(pPlan, pPlan->cCacheActions - 1);
+    ExitOnFailure(hr, "Failed to index cache payload action.");
+
     pPlan->qwCacheSizeTotal += pPayload->qwFileSize;
 
 LExit:
@@ -2436,31 +2520,54 @@ static BOOL FindContainerCacheAction(
     )
 {
     BOOL fFound = FALSE; // assume we won't find what we are looking for.
+    WCHAR wzKey[2 * sizeof(void*) + 1] = { };
+    BURN_CACHE_ACTION_INDEX_ENTRY* pEntry = NULL;
+    DWORD* rgiActions = NULL;
+    DWORD cActions = 0;
+    DWORD iLow = 0;
+    DWORD iHigh = 0;
 
     Assert(BURN_CACHE_ACTION_TYPE_ACQUIRE_CONTAINER == type || BURN_CACHE_ACTION_TYPE_EXTRACT_CONTAINER == type);
 
     iSearchStart = (BURN_PLAN_INVALID_ACTION_INDEX == iSearchStart) ? 0 : iSearchStart;
     iSearchEnd = (BURN_PLAN_INVALID_ACTION_INDEX == iSearchEnd) ? pPlan->cCacheActions : iSearchEnd;
 
-    for (DWORD iSearch = iSearchStart; iSearch < iSearchEnd; ++iSearch)
+    FormatCacheIndexKey(pContainer, wzKey, countof(wzKey));
+    pEntry = FindCacheIndexEntry(pPlan->sdCacheContainers, wzKey);
+    if (pEntry)
     {
-        BURN_CACHE_ACTION* pCacheAction = pPlan->rgCacheActions + iSearch;
-        if (pCacheAction->type == type &&
-            ((BURN_CACHE_ACTION_TYPE_ACQUIRE_CONTAINER == pCacheAction->type && pCacheAction->resolveContainer.pContainer == pContainer) ||
-             (BURN_CACHE_ACTION_TYPE_EXTRACT_CONTAINER == pCacheAction->type && pCacheAction->extractContainer.pContainer == pContainer)))
+        rgiActions = (BURN_CACHE_ACTION_TYPE_ACQUIRE_CONTAINER == type) ? pEntry->rgiAcquireActions : pEntry->rgiExtractActions;
+        cActions = (BURN_CACHE_ACTION_TYPE_ACQUIRE_CONTAINER == type) ? pEntry->cAcquireActions : pEntry->cExtractActions;
+
+        // The actions are in plan order so find the first one at or after the start of the search.
+        iLow = 0;
+        iHigh = cActions;
+        while (iLow < iHigh)
+        {
+            DWORD iMiddle = iLow + (iHigh - iLow) / 2;
+            if (rgiActions[iMiddle] < iSearchStart)
+            {
+                iLow = iMiddle + 1;
+            }
+            else
+            {
+                iHigh = iMiddle;
+            }
+        }
+
+        if (iLow < cActions && rgiActions[iLow] < iSearchEnd)
         {
             if (ppCacheAction)
             {
-                *ppCacheAction = pCacheAction;
+                *ppCacheAction = pPlan->rgCacheActions + rgiActions[iLow];
             }
 
             if (piCacheAction)
             {
-                *piCacheAction = iSearch;
+                *piCacheAction = rgiActions[iLow];
             }
 
             fFound = TRUE;
-            break;
         }
     }
 
@@ -2537,6 +2644,9 @@ static HRESULT CreateContainerAcquireAndExtractAction(
         pContainerExtractAction->extractContainer.iSkipUntilAcquiredByAction = iAcquireAction;
         pContainerExtractAction->extractContainer.sczContainerUnverifiedPath = sczContainerWorkingPath;
         sczContainerWorkingPath = NULL;
+
+        hr = IndexCacheAction(pPlan, iExtractAction);
+        ExitOnFailure(hr, "Failed to index extract container action.");
     }
 
     Assert(BURN_CACHE_ACTION_TYPE_EXTRACT_CONTAINER == pContainerExtractAction->type);
@@ -2592,6 +2702,9 @@ static HRESULT AddAcquireContainer(
     pAcquireContainerAction->resolveContainer.sczUnverifiedPath = sczContainerWorkingPath;
     sczContainerWorkingPath = NULL;
 
+    hr = IndexCacheAction(pPlan, pPlan->cCacheActions - 1);
+    ExitOnFailure(hr, "Failed to index acquire container action.");
+
     if (ppCacheAction)
     {
         *ppCacheAction = pAcquireContainerAction;
@@ -2619,7 +2732,7 @@ static HRESULT AddExtractPayload(
 
     Assert(BURN_CACHE_ACTION_TYPE_EXTRACT_CONTAINER == pCacheAction->type);
 
-    hr = MemEnsureArraySize(reinterpret_cast<LPVOID*>(&pCacheAction->extractContainer.rgPayloads), pCacheAction->extractContainer.cPayloads + 1, sizeof(BURN_EXTRACT_PAYLOAD), 5);
+    hr = MemEnsureArraySize(reinterpret_cast<LPVOID*>(&pCacheAction->extractContainer.rgPayloads), pCacheAction->extractContainer.cPayloads + 1, sizeof(BURN_EXTRACT_PAYLOAD), GetArrayGrowthCount(pCacheAction->extractContainer.cPayloads));
     ExitOnFailure(hr, "Failed to grow list of payloads to extract from container.");
 
     BURN_EXTRACT_PAYLOAD* pExtractPayload = pCacheAction->extractContainer.rgPayloads + pCacheAction->extractContainer.cPayloads;
@@ -2641,47 +2754,206 @@ static BURN_CACHE_ACTION* ProcessSharedPayload(
     )
 {
     BURN_CACHE_ACTION* pAcquireAction = NULL;
-#ifdef DEBUG
-    DWORD cMove = 0;
-#endif
+    WCHAR wzKey[2 * sizeof(void*) + 1] = { };
+    BURN_CACHE_ACTION_INDEX_ENTRY* pEntry = NULL;
 
-    for (DWORD i = 0; i < pPlan->cCacheActions; ++i)
+    FormatCacheIndexKey(pPayload, wzKey, countof(wzKey));
+    pEntry = FindCacheIndexEntry(pPlan->sdCachePayloads, wzKey);
+    if (pEntry)
     {
-        BURN_CACHE_ACTION* pCacheAction = pPlan->rgCacheActions + i;
-
-        if (BURN_CACHE_ACTION_TYPE_ACQUIRE_PAYLOAD == pCacheAction->type &&
-            pCacheAction->resolvePayload.pPayload == pPayload)
+        if (BURN_PLAN_INVALID_ACTION_INDEX != pEntry->iAction)
         {
-            AssertSz(!pAcquireAction, "There should be at most one acquire cache action per payload.");
-            pAcquireAction = pCacheAction;
+            pAcquireAction = pPlan->rgCacheActions + pEntry->iAction;
+            Assert(BURN_CACHE_ACTION_TYPE_ACQUIRE_PAYLOAD == pAcquireAction->type && pAcquireAction->resolvePayload.pPayload == pPayload);
         }
-        else if (BURN_CACHE_ACTION_TYPE_CACHE_PAYLOAD == pCacheAction->type &&
-                 pCacheAction->cachePayload.pPayload == pPayload &&
-                 pCacheAction->cachePayload.fMove)
+
+        // Since we found a shared payload, change the operation of the action that
+        // would move it from MOVE to COPY. Only the last action planned moves it.
+        if (BURN_PLAN_INVALID_ACTION_INDEX != pEntry->iMoveAction)
         {
-            // Since we found a shared payload, change its operation from MOVE to COPY.
-            pCacheAction->cachePayload.fMove = FALSE;
+            BURN_CACHE_ACTION* pCacheAction = pPlan->rgCacheActions + pEntry->iMoveAction;
 
-            AssertSz(1 == ++cMove, "Shared payload should be moved once and only once.");
-#ifndef DEBUG
-            break;
-#endif
+            if (BURN_CACHE_ACTION_TYPE_CACHE_PAYLOAD == pCacheAction->type)
+            {
+                pCacheAction->cachePayload.fMove = FALSE;
+            }
+            else
+            {
+                Assert(BURN_CACHE_ACTION_TYPE_LAYOUT_PAYLOAD == pCacheAction->type);
+                pCacheAction->layoutPayload.fMove = FALSE;
+            }
+
+            pEntry->iMoveAction = BURN_PLAN_INVALID_ACTION_INDEX;
         }
-        else if (BURN_CACHE_ACTION_TYPE_LAYOUT_PAYLOAD == pCacheAction->type &&
-                 pCacheAction->layoutPayload.pPayload == pPayload &&
-                 pCacheAction->layoutPayload.fMove)
+    }
+
+    return pAcquireAction;
+}
+
+//
+// IndexCacheAction - records a newly planned cache action in the plan's indices so
+//                    finding it later does not require scanning every cache action.
+//
+static HRESULT IndexCacheAction(
+    __in BURN_PLAN* pPlan,
+    __in DWORD iCacheAction
+    )
+{
+    HRESULT hr = S_OK;
+    BURN_CACHE_ACTION* pCacheAction = pPlan->rgCacheActions + iCacheAction;
+    STRINGDICT_HANDLE sdIndex = NULL;
+    WCHAR wzKey[2 * sizeof(void*) + 1] = { };
+    LPCWSTR wzKeyToIndex = wzKey;
+    BURN_CACHE_ACTION_INDEX_ENTRY* pEntry = NULL;
+
+    if (!pPlan->sdCachePackages)
+    {
+        hr = DictCreateWithEmbeddedKey(&pPlan->sdCachePackages, 0, reinterpret_cast<void**>(&pPlan->rgCacheIndexEntries), offsetof(BURN_CACHE_ACTION_INDEX_ENTRY, sczKey), DICT_FLAG_NONE);
+        ExitOnFailure(hr, "Failed to create package cache action index.");
+
+        hr = DictCreateWithEmbeddedKey(&pPlan->sdCacheContainers, 0, reinterpret_cast<void**>(&pPlan->rgCacheIndexEntries), offsetof(BURN_CACHE_ACTION_INDEX_ENTRY, sczKey), DICT_FLAG_NONE);
+        ExitOnFailure(hr, "Failed to create container cache action index.");
+
+        hr = DictCreateWithEmbeddedKey(&pPlan->sdCachePayloads, 0, reinterpret_cast<void**>(&pPlan->rgCacheIndexEntries), offsetof(BURN_CACHE_ACTION_INDEX_ENTRY, sczKey), DICT_FLAG_NONE);
+        ExitOnFailure(hr, "Failed to create payload cache action index.");
+    }
+
+    switch (pCacheAction->type)
+    {
+    case BURN_CACHE_ACTION_TYPE_PACKAGE_STOP:
+        sdIndex = pPlan->sdCachePackages;
+        wzKeyToIndex = pCacheAction->packageStop.pPackage->sczId;
+        break;
+
+    case BURN_CACHE_ACTION_TYPE_ACQUIRE_CONTAINER:
+        sdIndex = pPlan->sdCacheContainers;
+        FormatCacheIndexKey(pCacheAction->resolveContainer.pContainer, wzKey, countof(wzKey));
+        break;
+
+    case BURN_CACHE_ACTION_TYPE_EXTRACT_CONTAINER:
+        sdIndex = pPlan->sdCacheContainers;
+        FormatCacheIndexKey(pCacheAction->extractContainer.pContainer, wzKey, countof(wzKey));
+        break;
+
+    case BURN_CACHE_ACTION_TYPE_ACQUIRE_PAYLOAD:
+        sdIndex = pPlan->sdCachePayloads;
+        FormatCacheIndexKey(pCacheAction->resolvePayload.pPayload, wzKey, countof(wzKey));
+        break;
+
+    case BURN_CACHE_ACTION_TYPE_CACHE_PAYLOAD:
+        sdIndex = pPlan->sdCachePayloads;
+        FormatCacheIndexKey(pCacheAction->cachePayload.pPayload, wzKey, countof(wzKey));
+        break;
+
+    case BURN_CACHE_ACTION_TYPE_LAYOUT_PAYLOAD:
+        sdIndex = pPlan->sdCachePayloads;
+        FormatCacheIndexKey(pCacheAction->layoutPayload.pPayload, wzKey, countof(wzKey));
+        break;
+
+    default:
+        ExitFunction();
+    }
+
+    pEntry = FindCacheIndexEntry(sdIndex, wzKeyToIndex);
+    if (!pEntry)
+    {
+        hr = MemEnsureArraySize(reinterpret_cast<LPVOID*>(&pPlan->rgCacheIndexEntries), pPlan->cCacheIndexEntries + 1, sizeof(BURN_CACHE_ACTION_INDEX_ENTRY), GetArrayGrowthCount(pPlan->cCacheIndexEntries));
+        ExitOnFailure(hr, "Failed to grow plan's array of cache action index entries.");
+
+        pEntry = pPlan->rgCacheIndexEntries + pPlan->cCacheIndexEntries;
+        pEntry->iAction = BURN_PLAN_INVALID_ACTION_INDEX;
+        pEntry->iMoveAction = BURN_PLAN_INVALID_ACTION_INDEX;
+
+        hr = StrAllocString(&pEntry->sczKey, wzKeyToIndex, 0);
+        ExitOnFailure(hr, "Failed to copy cache action index key.");
+
+        ++pPlan->cCacheIndexEntries;
+
+        hr = DictAddValue(sdIndex, pEntry);
+        ExitOnFailure(hr, "Failed to add cache action index entry.");
+    }
+
+    switch (pCacheAction->type)
+    {
+    case BURN_CACHE_ACTION_TYPE_PACKAGE_STOP:
+        // The first package stop action is the one that counts.
+        if (BURN_PLAN_INVALID_ACTION_INDEX == pEntry->iAction)
         {
-            // Since we found a shared payload, change its operation from MOVE to COPY if necessary
-            pCacheAction->layoutPayload.fMove = FALSE;
+            pEntry->iAction = iCacheAction;
+        }
+        break;
 
-            AssertSz(1 == ++cMove, "Shared payload should be moved once and only once.");
-#ifndef DEBUG
-            break;
-#endif
+    case BURN_CACHE_ACTION_TYPE_ACQUIRE_CONTAINER:
+        hr = MemEnsureArraySize(reinterpret_cast<LPVOID*>(&pEntry->rgiAcquireActions), pEntry->cAcquireActions + 1, sizeof(DWORD), GetArrayGrowthCount(pEntry->cAcquireActions));
+        ExitOnFailure(hr, "Failed to grow container's acquire actions.");
+
+        pEntry->rgiAcquireActions[pEntry->cAcquireActions] = iCacheAction;
+        ++pEntry->cAcquireActions;
+        break;
+
+    case BURN_CACHE_ACTION_TYPE_EXTRACT_CONTAINER:
+        hr = MemEnsureArraySize(reinterpret_cast<LPVOID*>(&pEntry->rgiExtractActions), pEntry->cExtractActions + 1, sizeof(DWORD), GetArrayGrowthCount(pEntry->cExtractActions));
+        ExitOnFailure(hr, "Failed to grow container's extract actions.");
+
+        pEntry->rgiExtractActions[pEntry->cExtractActions] = iCacheAction;
+        ++pEntry->cExtractActions;
+        break;
+
+    case BURN_CACHE_ACTION_TYPE_ACQUIRE_PAYLOAD:
+        AssertSz(BURN_PLAN_INVALID_ACTION_INDEX == pEntry->iAction, "There should be at most one acquire cache action per payload.");
+        pEntry->iAction = iCacheAction;
+        break;
+
+    case BURN_CACHE_ACTION_TYPE_CACHE_PAYLOAD: __fallthrough;
+    case BURN_CACHE_ACTION_TYPE_LAYOUT_PAYLOAD:
+        // Every cache or layout payload action starts out moving the payload, so the
+        // latest one is the action ProcessSharedPayload() changes to a copy.
+        pEntry->iMoveAction = iCacheAction;
+        break;
+    }
+
+LExit:
+    return hr;
+}
+
+static BURN_CACHE_ACTION_INDEX_ENTRY* FindCacheIndexEntry(
+    __in_opt STRINGDICT_HANDLE sdIndex,
+    __in_z LPCWSTR wzKey
+    )
+{
+    BURN_CACHE_ACTION_INDEX_ENTRY* pEntry = NULL;
+
+    if (sdIndex)
+    {
+        HRESULT hr = DictGetValue(sdIndex, wzKey, reinterpret_cast<void**>(&pEntry));
+        if (FAILED(hr))
+        {
+            pEntry = NULL;
         }
     }
 
-    return pAcquireAction;
+    return pEntry;
+}
+
+static void FormatCacheIndexKey(
+    __in const void* pv,
+    __out_ecount(cchKey) LPWSTR wzKey,
+    __in DWORD cchKey
+    )
+{
+    // Containers and payloads are indexed by address, the same identity the plan compares them by.
+    ::StringCchPrintfW(wzKey, cchKey, L"%p", pv);
+}
+
+//
+// GetArrayGrowthCount - plans can hold tens of thousands of actions so their
+//                       arrays grow geometrically rather than a few items at a time.
+//
+static DWORD GetArrayGrowthCount(
+    __in DWORD cItems
+    )
+{
+    return max(5, cItems);
 }
 
 static HRESULT RemoveUnnecessaryActions(
@@ -2855,6 +3127,385 @@ static BOOL NeedsCache(
 }
 
 
+//
+// AddPackageActions - adds the package's execute and rollback actions to the plan,
+//                     splicing in the ones the previous plan had for it when nothing
+//                     they were planned from has changed.
+//
+static HRESULT AddPackageActions(
+    __in BOOTSTRAPPER_DISPLAY display,
+    __in BURN_PLAN* pPlan,
+    __in BURN_PACKAGE* pPackage,
+    __in BURN_LOGGING* pLog,
+    __in BURN_VARIABLES* pVariables,
+    __in_opt HANDLE hCacheEvent,
+    __in DWORD64 qwConditionGeneration
+    )
+{
+    HRESULT hr = S_OK;
+    DWORD iPlannedPackage = 0;
+    BURN_PLANNED_PACKAGE* pPlannedPackage = NULL;
+    BURN_PLANNED_PACKAGE* pPreviousPlannedPackage = NULL;
+
+    hr = MemEnsureArraySize(reinterpret_cast<LPVOID*>(&pPlan->rgPlannedPackages), pPlan->cPlannedPackages + 1, sizeof(BURN_PLANNED_PACKAGE), GetArrayGrowthCount(pPlan->cPlannedPackages));
+    ExitOnFailure(hr, "Failed to grow plan's array of planned packages.");
+
+    iPlannedPackage = pPlan->cPlannedPackages;
+    ++pPlan->cPlannedPackages;
+
+    pPlannedPackage = pPlan->rgPlannedPackages + iPlannedPackage;
+    pPlannedPackage->iExecuteAction = pPlan->cExecuteActions;
+    pPlannedPackage->iRollbackAction = pPlan->cRollbackActions;
+
+    hr = RecordPlannedPackageInputs(display, pPlan, pPackage, pLog, hCacheEvent, qwConditionGeneration, pPlannedPackage);
+    ExitOnFailure(hr, "Failed to record plan inputs for package: %ls", pPackage->sczId);
+
+    pPreviousPlannedPackage = FindPreviousPlannedPackage(pPlan, pPackage);
+    if (pPreviousPlannedPackage && PlannedPackageInputsMatch(pVariables, pPreviousPlannedPackage, pPlannedPackage))
+    {
+        hr = SplicePlannedPackage(pPlan, pPreviousPlannedPackage, pLog, pVariables, hCacheEvent);
+        ExitOnFailure(hr, "Failed to splice previously planned actions for package: %ls", pPackage->sczId);
+
+        LogId(REPORT_VERBOSE, MSG_PLAN_SPLICED_PACKAGE, pPackage->sczId);
+        ++pPlan->cSplicedPackages;
+    }
+    else
+    {
+        switch (pPackage->type)
+        {
+        case BURN_PACKAGE_TYPE_EXE:
+            hr = ExeEnginePlanAddPackage(NULL, pPackage, pPlan, pLog, pVariables, hCacheEvent, pPackage->fAcquire);
+            break;
+
+        case BURN_PACKAGE_TYPE_MSI:
+            hr = MsiEnginePlanAddPackage(display, pPackage, pPlan, pLog, pVariables, hCacheEvent, pPackage->fAcquire);
+            break;
+
+        case BURN_PACKAGE_TYPE_MSP:
+            hr = MspEnginePlanAddPackage(display, pPackage, pPlan, pLog, pVariables, hCacheEvent, pPackage->fAcquire);
+            break;
+
+        case BURN_PACKAGE_TYPE_MSU:
+            hr = MsuEnginePlanAddPackage(pPackage, pPlan, pLog, pVariables, hCacheEvent, pPackage->fAcquire);
+            break;
+
+        default:
+            hr = E_UNEXPECTED;
+            ExitOnFailure(hr, "Invalid package type.");
+        }
+        ExitOnFailure(hr, "Failed to add plan actions.");
+    }
+
+    // Patches may have inserted actions in front of this package's, so its range is only known now.
+    pPlannedPackage = pPlan->rgPlannedPackages + iPlannedPackage;
+    pPlannedPackage->cExecuteActions = pPlan->cExecuteActions - pPlannedPackage->iExecuteAction;
+    pPlannedPackage->cRollbackActions = pPlan->cRollbackActions - pPlannedPackage->iRollbackAction;
+
+LExit:
+    return hr;
+}
+
+//
+// RecordPlannedPackageInputs - remembers the package state its actions are planned from.
+//
+static HRESULT RecordPlannedPackageInputs(
+    __in BOOTSTRAPPER_DISPLAY display,
+    __in BURN_PLAN* pPlan,
+    __in BURN_PACKAGE* pPackage,
+    __in BURN_LOGGING* pLog,
+    __in_opt HANDLE hCacheEvent,
+    __in DWORD64 qwConditionGeneration,
+    __in BURN_PLANNED_PACKAGE* pPlannedPackage
+    )
+{
+    HRESULT hr = S_OK;
+
+    pPlannedPackage->pPackage = pPackage;
+    pPlannedPackage->action = pPlan->action;
+    pPlannedPackage->display = display;
+    pPlannedPackage->currentState = pPackage->currentState;
+    pPlannedPackage->cache = pPackage->cache;
+    pPlannedPackage->requested = pPackage->requested;
+    pPlannedPackage->execute = pPackage->execute;
+    pPlannedPackage->rollback = pPackage->rollback;
+    pPlannedPackage->providerExecute = pPackage->providerExecute;
+    pPlannedPackage->providerRollback = pPackage->providerRollback;
+    pPlannedPackage->dependencyExecute = pPackage->dependencyExecute;
+    pPlannedPackage->dependencyRollback = pPackage->dependencyRollback;
+    pPlannedPackage->fWaitForCache = (NULL != hCacheEvent);
+    pPlannedPackage->fAcquire = pPackage->fAcquire;
+    pPlannedPackage->dwLoggingAttributes = pLog->dwAttributes;
+    pPlannedPackage->qwConditionGeneration = qwConditionGeneration;
+
+    // Patches add themselves to the actions of other patches and slipstream patches are
+    // finalized with their target, so neither has actions of its own to splice.
+    pPlannedPackage->fSpliceable = BURN_PACKAGE_TYPE_MSP != pPackage->type && !(BURN_PACKAGE_TYPE_MSI == pPackage->type && pPackage->Msi.cSlipstreamMspPackages);
+
+    if (BURN_PACKAGE_TYPE_MSI == pPackage->type && pPackage->Msi.cFeatures)
+    {
+        pPlannedPackage->rgFeatureActions = (BOOTSTRAPPER_FEATURE_ACTION*)MemAlloc(sizeof(BOOTSTRAPPER_FEATURE_ACTION) * pPackage->Msi.cFeatures * 2, TRUE);
+        ExitOnNull(pPlannedPackage->rgFeatureActions, hr, E_OUTOFMEMORY, "Failed to allocate memory for planned feature actions.");
+
+        for (DWORD i = 0; i < pPackage->Msi.cFeatures; ++i)
+        {
+            pPlannedPackage->rgFeatureActions[i * 2] = pPackage->Msi.rgFeatures[i].execute;
+            pPlannedPackage->rgFeatureActions[i * 2 + 1] = pPackage->Msi.rgFeatures[i].rollback;
+        }
+    }
+
+LExit:
+    return hr;
+}
+
+//
+// PlannedPackageInputsMatch - returns whether the previous plan planned the package
+//                             from exactly the same state.
+//
+static BOOL PlannedPackageInputsMatch(
+    __in BURN_VARIABLES* pVariables,
+    __in BURN_PLANNED_PACKAGE* pPreviousPlannedPackage,
+    __in BURN_PLANNED_PACKAGE* pPlannedPackage
+    )
+{
+    BURN_PACKAGE* pPackage = pPlannedPackage->pPackage;
+
+    if (!pPreviousPlannedPackage->fSpliceable || !pPlannedPackage->fSpliceable ||
+        pPreviousPlannedPackage->action != pPlannedPackage->action ||
+        pPreviousPlannedPackage->display != pPlannedPackage->display ||
+        pPreviousPlannedPackage->currentState != pPlannedPackage->currentState ||
+        pPreviousPlannedPackage->cache != pPlannedPackage->cache ||
+        pPreviousPlannedPackage->requested != pPlannedPackage->requested ||
+        pPreviousPlannedPackage->execute != pPlannedPackage->execute ||
+        pPreviousPlannedPackage->rollback != pPlannedPackage->rollback ||
+        pPreviousPlannedPackage->providerExecute != pPlannedPackage->providerExecute ||
+        pPreviousPlannedPackage->providerRollback != pPlannedPackage->providerRollback ||
+        pPreviousPlannedPackage->dependencyExecute != pPlannedPackage->dependencyExecute ||
+        pPreviousPlannedPackage->dependencyRollback != pPlannedPackage->dependencyRollback ||
+        pPreviousPlannedPackage->fWaitForCache != pPlannedPackage->fWaitForCache ||
+        pPreviousPlannedPackage->fAcquire != pPlannedPackage->fAcquire ||
+        pPreviousPlannedPackage->dwLoggingAttributes != pPlannedPackage->dwLoggingAttributes)
+    {
+        return FALSE;
+    }
+
+    if (pPlannedPackage->rgFeatureActions && 0 != memcmp(pPreviousPlannedPackage->rgFeatureActions, pPlannedPackage->rgFeatureActions, sizeof(BOOTSTRAPPER_FEATURE_ACTION) * pPackage->Msi.cFeatures * 2))
+    {
+        return FALSE;
+    }
+
+    return !PackageConditionsChangedSince(pVariables, pPackage, pPreviousPlannedPackage->qwConditionGeneration);
+}
+
+//
+// PackageConditionsChangedSince - returns whether a variable read by the package's install
+//                                 condition or its features' conditions changed.
+//
+static BOOL PackageConditionsChangedSince(
+    __in BURN_VARIABLES* pVariables,
+    __in BURN_PACKAGE* pPackage,
+    __in DWORD64 qwGeneration
+    )
+{
+    if (pPackage->sczInstallCondition && *pPackage->sczInstallCondition && ConditionInputsChangedSince(pVariables, pPackage->sczInstallCondition, qwGeneration))
+    {
+        return TRUE;
+    }
+
+    if (BURN_PACKAGE_TYPE_MSI == pPackage->type)
+    {
+        for (DWORD i = 0; i < pPackage->Msi.cFeatures; ++i)
+        {
+            BURN_MSIFEATURE* pFeature = pPackage->Msi.rgFeatures + i;
+            LPCWSTR rgwzConditions[] = { pFeature->sczAddLocalCondition, pFeature->sczAddSourceCondition, pFeature->sczAdvertiseCondition, pFeature->sczRollbackAddLocalCondition, pFeature->sczRollbackAddSourceCondition, pFeature->sczRollbackAdvertiseCondition };
+
+            for (DWORD j = 0; j < countof(rgwzConditions); ++j)
+            {
+                if (rgwzConditions[j] && *rgwzConditions[j] && ConditionInputsChangedSince(pVariables, rgwzConditions[j], qwGeneration))
+                {
+                    return TRUE;
+                }
+            }
+        }
+    }
+
+    return FALSE;
+}
+
+static BURN_PLANNED_PACKAGE* FindPreviousPlannedPackage(
+    __in BURN_PLAN* pPlan,
+    __in BURN_PACKAGE* pPackage
+    )
+{
+    for (DWORD i = 0; i < pPlan->cPreviousPlannedPackages; ++i)
+    {
+        DWORD iPlannedPackage = (pPlan->iNextPreviousPlannedPackage + i) % pPlan->cPreviousPlannedPackages;
+
+        if (pPackage == pPlan->rgPreviousPlannedPackages[iPlannedPackage].pPackage)
+        {
+            pPlan->iNextPreviousPlannedPackage = iPlannedPackage + 1;
+            return pPlan->rgPreviousPlannedPackages + iPlannedPackage;
+        }
+    }
+
+    return NULL;
+}
+
+//
+// SplicePlannedPackage - moves the package's actions out of the previous plan onto the end of this one.
+//
+static HRESULT SplicePlannedPackage(
+    __in BURN_PLAN* pPlan,
+    __in BURN_PLANNED_PACKAGE* pPreviousPlannedPackage,
+    __in BURN_LOGGING* pLog,
+    __in BURN_VARIABLES* pVariables,
+    __in_opt HANDLE hCacheEvent
+    )
+{
+    HRESULT hr = S_OK;
+    BURN_EXECUTE_ACTION* pAction = NULL;
+
+    for (DWORD i = 0; i < pPreviousPlannedPackage->cExecuteActions; ++i)
+    {
+        hr = PlanAppendExecuteAction(pPlan, &pAction);
+        ExitOnFailure(hr, "Failed to append spliced execute action.");
+
+        MoveSplicedAction(pPlan->rgPreviousExecuteActions + pPreviousPlannedPackage->iExecuteAction + i, FALSE, pLog, pVariables, hCacheEvent, pAction);
+    }
+
+    for (DWORD i = 0; i < pPreviousPlannedPackage->cRollbackActions; ++i)
+    {
+        hr = PlanAppendRollbackAction(pPlan, &pAction);
+        ExitOnFailure(hr, "Failed to append spliced rollback action.");
+
+        MoveSplicedAction(pPlan->rgPreviousRollbackActions + pPreviousPlannedPackage->iRollbackAction + i, TRUE, pLog, pVariables, hCacheEvent, pAction);
+    }
+
+    // The actions are gone from the previous plan now.
+    pPreviousPlannedPackage->fSpliceable = FALSE;
+
+LExit:
+    return hr;
+}
+
+//
+// MoveSplicedAction - takes ownership of an action from the previous plan and updates the
+//                     parts of it that were specific to that plan.
+//
+static void MoveSplicedAction(
+    __in BURN_EXECUTE_ACTION* pPreviousAction,
+    __in BOOL fRollback,
+    __in BURN_LOGGING* pLog,
+    __in BURN_VARIABLES* pVariables,
+    __in_opt HANDLE hCacheEvent,
+    __in BURN_EXECUTE_ACTION* pAction
+    )
+{
+    memcpy(pAction, pPreviousAction, sizeof(BURN_EXECUTE_ACTION));
+    memset(pPreviousAction, 0, sizeof(BURN_EXECUTE_ACTION));
+
+    pAction->fDeleted = FALSE;
+
+    // Checkpoint ids are only ever compared for equality and each was handed out once,
+    // so the checkpoints keep theirs.
+    switch (pAction->type)
+    {
+    case BURN_EXECUTE_ACTION_TYPE_WAIT_SYNCPOINT:
+        // The previous plan's events were closed along with its cache actions.
+        pAction->syncpoint.hEvent = hCacheEvent;
+        break;
+
+    // Log paths carry the package sequence so they are formatted again, which also sets the log variables.
+    case BURN_EXECUTE_ACTION_TYPE_EXE_PACKAGE:
+        LoggingSetPackageVariable(pAction->exePackage.pPackage, NULL, fRollback, pLog, pVariables, NULL); // ignore errors.
+        break;
+
+    case BURN_EXECUTE_ACTION_TYPE_MSI_PACKAGE:
+        ReleaseNullStr(pAction->msiPackage.sczLogPath);
+        LoggingSetPackageVariable(pAction->msiPackage.pPackage, NULL, fRollback, pLog, pVariables, &pAction->msiPackage.sczLogPath); // ignore errors.
+        break;
+
+    case BURN_EXECUTE_ACTION_TYPE_MSU_PACKAGE:
+        ReleaseNullStr(pAction->msuPackage.sczLogPath);
+        LoggingSetPackageVariable(pAction->msuPackage.pPackage, NULL, fRollback, pLog, pVariables, &pAction->msuPackage.sczLogPath); // ignore errors.
+        break;
+    }
+}
+
+//
+// ShiftPlannedPackages - keeps the planned packages' action ranges pointing at their
+//                        actions when an action is inserted in front of them.
+//
+static void ShiftPlannedPackages(
+    __in BURN_PLAN* pPlan,
+    __in DWORD dwIndex,
+    __in BOOL fRollback
+    )
+{
+    for (DWORD i = 0; i < pPlan->cPlannedPackages; ++i)
+    {
+        BURN_PLANNED_PACKAGE* pPlannedPackage = pPlan->rgPlannedPackages + i;
+        DWORD* piAction = fRollback ? &pPlannedPackage->iRollbackAction : &pPlannedPackage->iExecuteAction;
+        DWORD cActions = fRollback ? pPlannedPackage->cRollbackActions : pPlannedPackage->cExecuteActions;
+
+        if (dwIndex <= *piAction)
+        {
+            ++(*piAction);
+        }
+        else if (dwIndex < *piAction + cActions)
+        {
+            pPlannedPackage->fSpliceable = FALSE;
+        }
+    }
+}
+
+static void ReleasePlannedPackages(
+    __in_ecount_opt(cPlannedPackages) BURN_PLANNED_PACKAGE* rgPlannedPackages,
+    __in DWORD cPlannedPackages
+    )
+{
+    if (rgPlannedPackages)
+    {
+        for (DWORD i = 0; i < cPlannedPackages; ++i)
+        {
+            ReleaseMem(rgPlannedPackages[i].rgFeatureActions);
+        }
+        MemFree(rgPlannedPackages);
+    }
+}
+
+static void ReleasePreviousPlan(
+    __in BURN_PLAN* pPlan
+    )
+{
+    if (pPlan->rgPreviousExecuteActions)
+    {
+        for (DWORD i = 0; i < pPlan->cPreviousExecuteActions; ++i)
+        {
+            PlanUninitializeExecuteAction(&pPlan->rgPreviousExecuteActions[i]);
+        }
+        MemFree(pPlan->rgPreviousExecuteActions);
+    }
+
+    if (pPlan->rgPreviousRollbackActions)
+    {
+        for (DWORD i = 0; i < pPlan->cPreviousRollbackActions; ++i)
+        {
+            PlanUninitializeExecuteAction(&pPlan->rgPreviousRollbackActions[i]);
+        }
+        MemFree(pPlan->rgPreviousRollbackActions);
+    }
+
+    ReleasePlannedPackages(pPlan->rgPreviousPlannedPackages, pPlan->cPreviousPlannedPackages);
+
+    pPlan->rgPreviousPlannedPackages = NULL;
+    pPlan->cPreviousPlannedPackages = 0;
+    pPlan->iNextPreviousPlannedPackage = 0;
+    pPlan->rgPreviousExecuteActions = NULL;
+    pPlan->cPreviousExecuteActions = 0;
+    pPlan->rgPreviousRollbackActions = NULL;
+    pPlan->cPreviousRollbackActions = 0;
+}
+
 #ifdef DEBUG
 
 static void CacheActionLog(
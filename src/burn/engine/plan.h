@@ -291,6 +291,47 @@ typedef struct _BURN_CLEAN_ACTION
     BURN_PACKAGE* pPackage;
 } BURN_CLEAN_ACTION;
 
+typedef struct _BURN_CACHE_ACTION_INDEX_ENTRY
+{
+    LPWSTR sczKey;                  // package id, or the address of the container or payload.
+    DWORD iAction;                  // package stop action, or the acquire payload action.
+    DWORD iMoveAction;              // cache or layout payload action that moves the payload.
+    DWORD* rgiAcquireActions;       // acquire container actions, in plan order.
+    DWORD cAcquireActions;
+    DWORD* rgiExtractActions;       // extract container actions, in plan order.
+    DWORD cExtractActions;
+} BURN_CACHE_ACTION_INDEX_ENTRY;
+
+typedef struct _BURN_PLANNED_PACKAGE
+{
+    BURN_PACKAGE* pPackage;
+
+    // inputs the package's execute and rollback actions were planned from.
+    BOOTSTRAPPER_ACTION action;
+    BOOTSTRAPPER_DISPLAY display;
+    BOOTSTRAPPER_PACKAGE_STATE currentState;
+    BURN_CACHE_STATE cache;
+    BOOTSTRAPPER_REQUEST_STATE requested;
+    BOOTSTRAPPER_ACTION_STATE execute;
+    BOOTSTRAPPER_ACTION_STATE rollback;
+    BURN_DEPENDENCY_ACTION providerExecute;
+    BURN_DEPENDENCY_ACTION providerRollback;
+    BURN_DEPENDENCY_ACTION dependencyExecute;
+    BURN_DEPENDENCY_ACTION dependencyRollback;
+    BOOL fWaitForCache;
+    BOOL fAcquire;
+    DWORD dwLoggingAttributes;
+    BOOTSTRAPPER_FEATURE_ACTION* rgFeatureActions; // execute then rollback action of each MSI feature.
+    DWORD64 qwConditionGeneration; // variables read by the package's conditions have not changed since this generation.
+
+    // actions planned from those inputs.
+    DWORD iExecuteAction;
+    DWORD cExecuteActions;
+    DWORD iRollbackAction;
+    DWORD cRollbackActions;
+    BOOL fSpliceable; // FALSE when the actions depend on other packages or something was later inserted between them.
+} BURN_PLANNED_PACKAGE;
+
 typedef struct _BURN_PLAN
 {
     BOOTSTRAPPER_ACTION action;
@@ -320,6 +361,12 @@ typedef struct _BURN_PLAN
     BURN_CACHE_ACTION* rgCacheActions;
     DWORD cCacheActions;
 
+    STRINGDICT_HANDLE sdCachePackages;      // package id to its package stop action.
+    STRINGDICT_HANDLE sdCacheContainers;    // container to its acquire and extract actions.
+    STRINGDICT_HANDLE sdCachePayloads;      // payload to its acquire and cache or layout actions.
+    BURN_CACHE_ACTION_INDEX_ENTRY* rgCacheIndexEntries;
+    DWORD cCacheIndexEntries;
+
     BURN_CACHE_ACTION* rgRollbackCacheActions;
     DWORD cRollbackCacheActions;
 
@@ -334,6 +381,21 @@ typedef struct _BURN_PLAN
 
     DEPENDENCY* rgPlannedProviders;
     UINT cPlannedProviders;
+
+    BURN_PLANNED_PACKAGE* rgPlannedPackages;
+    DWORD cPlannedPackages;
+    DWORD cSplicedPackages;     // packages whose actions were taken from the previous plan.
+
+    // the previous plan's packages and actions, kept by PlanReset until the plan is finalized so unchanged packages can be spliced back in.
+    BURN_PLANNED_PACKAGE* rgPreviousPlannedPackages;
+    DWORD cPreviousPlannedPackages;
+    DWORD iNextPreviousPlannedPackage; // packages are planned in the same order every time, so the search for the next one starts here.
+
+    BURN_EXECUTE_ACTION* rgPreviousExecuteActions;
+    DWORD cPreviousExecuteActions;
+
+    BURN_EXECUTE_ACTION* rgPreviousRollbackActions;
+    DWORD cPreviousRollbackActions;
 } BURN_PLAN;
 
 
@@ -29,6 +29,7 @@
 #include <apputil.h>
 #include <buffutil.h>
 #include <cabutil.h>
+#include <chunkutil.h>
 #include <certutil.h>
 #include <cryputil.h>
 #include <dirutil.h>
@@ -69,6 +70,7 @@
 #include "catalog.h"
 #include "payload.h"
 #include "cabextract.h"
+#include "chunkextract.h"
 #include "userexperience.h"
 #include "package.h"
 #include "update.h"
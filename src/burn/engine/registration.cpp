@@ -361,6 +361,7 @@ extern "C" void RegistrationUninitialize(
     ReleaseStr(pRegistration->sczCacheExecutablePath);
     ReleaseStr(pRegistration->sczResumeCommandLine);
     ReleaseStr(pRegistration->sczStateFile);
+    ReleaseStr(pRegistration->sczSearchCacheFile);
 
     ReleaseStr(pRegistration->sczDisplayName);
     ReleaseStr(pRegistration->sczDisplayVersion);
@@ -1120,6 +1121,18 @@ static HRESULT SetPaths(
     hr = StrAllocFormatted(&pRegistration->sczStateFile, L"%s\\state.rsm", sczCacheDirectory);
     ExitOnFailure(hr, "Failed to build state file path.");
 
+    // build search cache file path
+    if (pRegistration->fPerMachine)
+    {
+        ReleaseNullStr(sczCacheDirectory);
+
+        hr = CacheGetCompletedPath(FALSE, pRegistration->sczId, &sczCacheDirectory);
+        ExitOnFailure(hr, "Failed to build per-user cache directory.");
+    }
+
+    hr = StrAllocFormatted(&pRegistration->sczSearchCacheFile, L"%s\\searches.rsc", sczCacheDirectory);
+    ExitOnFailure(hr, "Failed to build search cache file path.");
+
 LExit:
     ReleaseStr(sczCacheDirectory);
     return hr;
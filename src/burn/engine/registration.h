@@ -117,6 +117,7 @@ typedef struct _BURN_REGISTRATION
     LPWSTR sczCacheExecutablePath;
     LPWSTR sczResumeCommandLine;
     LPWSTR sczStateFile;
+    LPWSTR sczSearchCacheFile; // always per-user so the unelevated engine can write it.
 
     // ARP registration
     LPWSTR sczDisplayName;
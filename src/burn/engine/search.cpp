@@ -3,8 +3,156 @@
 #include "precomp.h"
 
 
+// constants
+
+static const DWORD SEARCH_MAX_WORKERS = 8;
+static const DWORD SEARCH_CACHE_FORMAT_VERSION = 1;
+
+
+// structs
+
+struct SEARCH_VARIABLE_ACCESS
+{
+    LPCWSTR wzVariable; // points at the sczVariable of the first search that sets it.
+    DWORD dwLastWriter; // index + 1 of the last search so far that sets the variable.
+    DWORD* rgdwReaders; // searches that read the variable since it was last set.
+    DWORD cReaders;
+};
+
+struct SEARCH_CACHE_ENTRY
+{
+    LPWSTR sczKey; // kind of search and its formatted input.
+    DWORD64 qwSize; // stamp that must still match for the result to be reused.
+    DWORD64 qwCreationTime;
+    DWORD64 qwLastWriteTime;
+    DWORD64 qwValue;
+    BOOL fUsed; // only entries this run looked up or added are saved.
+};
+
+struct SEARCH_CACHE
+{
+    LPCWSTR wzPath;
+    CRITICAL_SECTION cs;
+    STRINGDICT_HANDLE sdEntries;
+    SEARCH_CACHE_ENTRY* rgEntries;
+    DWORD cEntries;
+    BOOL fDirty;
+};
+
+struct SEARCH_REGISTRY_KEY
+{
+    LPWSTR sczKey; // root, view and formatted path of the key.
+    REG_SNAPSHOT_HANDLE hSnapshot; // NULL when the key does not exist.
+};
+
+struct SEARCH_REGISTRY
+{
+    CRITICAL_SECTION cs;
+    STRINGDICT_HANDLE sdKeys;
+    SEARCH_REGISTRY_KEY* rgKeys;
+    DWORD cKeys;
+};
+
+struct SEARCH_EXECUTE_CONTEXT
+{
+    BURN_SEARCHES* pSearches;
+    BURN_VARIABLES* pVariables;
+    SEARCH_CACHE* pCache;
+    SEARCH_REGISTRY* pRegistry;
+    DWORD iFirst; // the workers run searches iFirst up to but not including iLast.
+    DWORD iLast;
+
+    CRITICAL_SECTION cs;
+    HANDLE hSearchReady; // semaphore released once for each search added to the queue.
+    HANDLE hSearchesDone; // manual reset event set when every search in the range has run.
+    DWORD* rgdwQueue; // searches whose dependencies have all run, in the order they became ready.
+    DWORD iQueueHead;
+    DWORD iQueueTail;
+    DWORD* rgcWaiting; // for each search in the range, how many of its dependencies have not run yet.
+    DWORD cRemaining;
+    HRESULT hrSearches; // first failure that stops the remaining searches.
+};
+
+
 // internal function declarations
 
+static HRESULT BuildSearchDependencies(
+    __in BURN_SEARCHES* pSearches
+    );
+static HRESULT RecordSearchReads(
+    __in BURN_SEARCHES* pSearches,
+    __in STRINGDICT_HANDLE sdVariables,
+    __in DWORD iSearch,
+    __in_z_opt LPCWSTR wzReads,
+    __in BOOL fFormatted
+    );
+static HRESULT AddSearchDependency(
+    __in BURN_SEARCHES* pSearches,
+    __in DWORD iSearch,
+    __in DWORD iDependent
+    );
+static void GetSearchFormatStrings(
+    __in BURN_SEARCH* pSearch,
+    __out LPCWSTR* pwzFirst,
+    __out LPCWSTR* pwzSecond
+    );
+static LPCWSTR FindVariableReference(
+    __in_z LPCWSTR wz,
+    __in BOOL fFormatted,
+    __out DWORD* pcch
+    );
+static BOOL IsIdentifierCharacter(
+    __in WCHAR wch
+    );
+static HRESULT SearchFormatsIndirectly(
+    __in BURN_SEARCH* pSearch,
+    __in BURN_VARIABLES* pVariables,
+    __out BOOL* pfIndirect
+    );
+static HRESULT ExecuteSearchesInParallel(
+    __in BURN_SEARCHES* pSearches,
+    __in BURN_VARIABLES* pVariables,
+    __in_opt SEARCH_CACHE* pCache,
+    __in SEARCH_REGISTRY* pRegistry,
+    __in DWORD iFirst,
+    __in DWORD iLast
+    );
+static DWORD WINAPI SearchWorkerThreadProc(
+    __in LPVOID lpThreadParameter
+    );
+static HRESULT RunSearchWorker(
+    __in SEARCH_EXECUTE_CONTEXT* pContext
+    );
+static HRESULT ExecuteSearch(
+    __in BURN_SEARCH* pSearch,
+    __in BURN_VARIABLES* pVariables,
+    __in_opt SEARCH_CACHE* pCache,
+    __in SEARCH_REGISTRY* pRegistry
+    );
+static HRESULT LoadSearchCache(
+    __in SEARCH_CACHE* pCache
+    );
+static HRESULT SaveSearchCache(
+    __in SEARCH_CACHE* pCache
+    );
+static void UninitializeSearchCache(
+    __in SEARCH_CACHE* pCache
+    );
+static HRESULT GetFileVersionFromCache(
+    __in_opt SEARCH_CACHE* pCache,
+    __in_z LPCWSTR wzPath,
+    __out DWORD64* pqwVersion
+    );
+static void UninitializeSearchRegistry(
+    __in SEARCH_REGISTRY* pRegistry
+    );
+static HRESULT GetRegistrySnapshot(
+    __in SEARCH_REGISTRY* pRegistry,
+    __in HKEY hRoot,
+    __in_z LPCWSTR wzKey,
+    __in BOOL fWin64,
+    __out REG_SNAPSHOT_HANDLE* phSnapshot
+    );
 static HRESULT DirectorySearchExists(
     __in BURN_SEARCH* pSearch,
     __in BURN_VARIABLES* pVariables
@@ -19,7 +167,8 @@ static HRESULT FileSearchExists(
     );
 static HRESULT FileSearchVersion(
     __in BURN_SEARCH* pSearch,
-    __in BURN_VARIABLES* pVariables
+    __in BURN_VARIABLES* pVariables,
+    __in_opt SEARCH_CACHE* pCache
     );
 static HRESULT FileSearchPath(
     __in BURN_SEARCH* pSearch,
@@ -27,11 +176,13 @@ static HRESULT FileSearchPath(
     );
 static HRESULT RegistrySearchExists(
     __in BURN_SEARCH* pSearch,
-    __in BURN_VARIABLES* pVariables
+    __in BURN_VARIABLES* pVariables,
+    __in SEARCH_REGISTRY* pRegistry
     );
 static HRESULT RegistrySearchValue(
     __in BURN_SEARCH* pSearch,
-    __in BURN_VARIABLES* pVariables
+    __in BURN_VARIABLES* pVariables,
+    __in SEARCH_REGISTRY* pRegistry
     );
 static HRESULT MsiComponentSearch(
     __in BURN_SEARCH* pSearch,
@@ -384,6 +535,9 @@ extern "C" HRESULT SearchesParseFromXml(
         ReleaseNullBSTR(bstrNodeName);
     }
 
+    hr = BuildSearchDependencies(pSearches);
+    ExitOnFailure(hr, "Failed to build search dependencies.");
+
     hr = S_OK;
 
 LExit:
@@ -394,103 +548,90 @@ LExit:
     return hr;
 }
 
+//
+// SearchesExecute - runs the searches on a pool of worker threads. Searches that depend on each
+// other through the variables they read and set still run in document order. If wzCacheFile is
+// given, results that are expensive to find are kept there with a stamp of what they were found
+// from and reused by later runs while the stamp still matches.
+//
 extern "C" HRESULT SearchesExecute(
     __in BURN_SEARCHES* pSearches,
-    __in BURN_VARIABLES* pVariables
+    __in BURN_VARIABLES* pVariables,
+    __in_z_opt LPCWSTR wzCacheFile
     )
 {
     HRESULT hr = S_OK;
-    BOOL f = FALSE;
+    SEARCH_CACHE cache = { };
+    SEARCH_CACHE* pCache = NULL;
+    SEARCH_REGISTRY registry = { };
+    DWORD iFirst = 0;
+    BOOL fIndirect = FALSE;
+
+    ::InitializeCriticalSection(&registry.cs);
+
+    hr = DictCreateWithEmbeddedKey(&registry.sdKeys, pSearches->cSearches, reinterpret_cast<void**>(&registry.rgKeys), offsetof(SEARCH_REGISTRY_KEY, sczKey), DICT_FLAG_CASEINSENSITIVE);
+    ExitOnFailure(hr, "Failed to create registry key dictionary.");
+
+    if (wzCacheFile && pSearches->cSearches)
+    {
+        cache.wzPath = wzCacheFile;
+        ::InitializeCriticalSection(&cache.cs);
+        pCache = &cache;
+
+        hr = DictCreateWithEmbeddedKey(&cache.sdEntries, pSearches->cSearches, reinterpret_cast<void**>(&cache.rgEntries), offsetof(SEARCH_CACHE_ENTRY, sczKey), DICT_FLAG_NONE);
+        ExitOnFailure(hr, "Failed to create search cache dictionary.");
+
+        // The cache only saves time, the searches just run when it can't be read.
+        hr = LoadSearchCache(pCache);
+        if (FAILED(hr))
+        {
+            TraceError1(hr, "Failed to load search cache: %ls", wzCacheFile);
+            hr = S_OK;
+        }
+    }
 
     for (DWORD i = 0; i < pSearches->cSearches; ++i)
     {
         BURN_SEARCH* pSearch = &pSearches->rgSearches[i];
 
-        // evaluate condition
-        if (pSearch->sczCondition && *pSearch->sczCondition)
+        hr = SearchFormatsIndirectly(pSearch, pVariables, &fIndirect);
+        ExitOnFailure1(hr, "Failed to check search for indirect variable references. Id = '%ls'", pSearch->sczKey);
+
+        // A variable whose value has references of its own can read anything, so everything
+        // before the search has to finish and everything after it has to wait.
+        if (fIndirect)
         {
-            hr = ConditionEvaluate(pVariables, pSearch->sczCondition, &f);
-            if (E_INVALIDDATA == hr)
-            {
-                TraceError2(hr, "Failed to parse search condition. Id = '%ls', Condition = '%ls'", pSearch->sczKey, pSearch->sczCondition);
-                hr = S_OK;
-                continue;
-            }
-            ExitOnFailure2(hr, "Failed to evaluate search condition. Id = '%ls', Condition = '%ls'", pSearch->sczKey, pSearch->sczCondition);
+            hr = ExecuteSearchesInParallel(pSearches, pVariables, pCache, &registry, iFirst, i);
+            ExitOnFailure(hr, "Failed to execute searches.");
 
-            if (!f)
-            {
-                continue; // condition evaluated to false, skip
-            }
-        }
+            hr = ExecuteSearch(pSearch, pVariables, pCache, &registry);
+            ExitOnFailure(hr, "Failed to execute search.");
 
-        switch (pSearch->Type)
-        {
-        case BURN_SEARCH_TYPE_DIRECTORY:
-            switch (pSearch->DirectorySearch.Type)
-            {
-            case BURN_DIRECTORY_SEARCH_TYPE_EXISTS:
-                hr = DirectorySearchExists(pSearch, pVariables);
-                break;
-            case BURN_DIRECTORY_SEARCH_TYPE_PATH:
-                hr = DirectorySearchPath(pSearch, pVariables);
-                break;
-            default:
-                hr = E_UNEXPECTED;
-            }
-            break;
-        case BURN_SEARCH_TYPE_FILE:
-            switch (pSearch->FileSearch.Type)
-            {
-            case BURN_FILE_SEARCH_TYPE_EXISTS:
-                hr = FileSearchExists(pSearch, pVariables);
-                break;
-            case BURN_FILE_SEARCH_TYPE_VERSION:
-                hr = FileSearchVersion(pSearch, pVariables);
-                break;
-            case BURN_FILE_SEARCH_TYPE_PATH:
-                hr = FileSearchPath(pSearch, pVariables);
-                break;
-            default:
-                hr = E_UNEXPECTED;
-            }
-            break;
-        case BURN_SEARCH_TYPE_REGISTRY:
-            switch (pSearch->RegistrySearch.Type)
-            {
-            case BURN_REGISTRY_SEARCH_TYPE_EXISTS:
-                hr = RegistrySearchExists(pSearch, pVariables);
-                break;
-            case BURN_REGISTRY_SEARCH_TYPE_VALUE:
-                hr = RegistrySearchValue(pSearch, pVariables);
-                break;
-            default:
-                hr = E_UNEXPECTED;
-            }
-            break;
-        case BURN_SEARCH_TYPE_MSI_COMPONENT:
-            hr = MsiComponentSearch(pSearch, pVariables);
-            break;
-        case BURN_SEARCH_TYPE_MSI_PRODUCT:
-            hr = MsiProductSearch(pSearch, pVariables);
-            break;
-        case BURN_SEARCH_TYPE_MSI_FEATURE:
-            hr = MsiFeatureSearch(pSearch, pVariables);
-            break;
-        default:
-            hr = E_UNEXPECTED;
+            iFirst = i + 1;
         }
+    }
 
+    hr = ExecuteSearchesInParallel(pSearches, pVariables, pCache, &registry, iFirst, pSearches->cSearches);
+    ExitOnFailure(hr, "Failed to execute searches.");
+
+    if (pCache)
+    {
+        hr = SaveSearchCache(pCache);
         if (FAILED(hr))
         {
-            TraceError1(hr, "Search failed. Id = '%ls'", pSearch->sczKey);
-            continue;
+            TraceError1(hr, "Failed to save search cache: %ls", wzCacheFile);
+            hr = S_OK;
         }
     }
 
-    hr = S_OK;
-
 LExit:
+    if (pCache)
+    {
+        UninitializeSearchCache(pCache);
+    }
+
+    UninitializeSearchRegistry(&registry);
+
     return hr;
 }
 
@@ -507,6 +648,7 @@ extern "C" void SearchesUninitialize(
             ReleaseStr(pSearch->sczKey);
             ReleaseStr(pSearch->sczVariable);
             ReleaseStr(pSearch->sczCondition);
+            ReleaseMem(pSearch->rgdwDependents);
 
             switch (pSearch->Type)
             {
@@ -540,185 +682,1218 @@ extern "C" void SearchesUninitialize(
 
 // internal function definitions
 
-static HRESULT DirectorySearchExists(
-    __in BURN_SEARCH* pSearch,
-    __in BURN_VARIABLES* pVariables
+static HRESULT BuildSearchDependencies(
+    __in BURN_SEARCHES* pSearches
     )
 {
     HRESULT hr = S_OK;
-    LPWSTR sczPath = NULL;
-    BOOL fExists = FALSE;
+    STRINGDICT_HANDLE sdVariables = NULL;
+    SEARCH_VARIABLE_ACCESS* rgAccess = NULL;
+    DWORD cAccess = 0;
+    SEARCH_VARIABLE_ACCESS* pAccess = NULL;
+    LPCWSTR wzFirst = NULL;
+    LPCWSTR wzSecond = NULL;
+
+    if (!pSearches->cSearches)
+    {
+        ExitFunction();
+    }
 
-    // format path
-    hr = VariableFormatString(pVariables, pSearch->DirectorySearch.sczPath, &sczPath, NULL);
-    ExitOnFailure(hr, "Failed to format variable string.");
+    rgAccess = static_cast<SEARCH_VARIABLE_ACCESS*>(MemAlloc(sizeof(SEARCH_VARIABLE_ACCESS) * pSearches->cSearches, TRUE));
+    ExitOnNull(rgAccess, hr, E_OUTOFMEMORY, "Failed to allocate memory for search variable access.");
 
-    DWORD dwAttributes = ::GetFileAttributesW(sczPath);
-    if (INVALID_FILE_ATTRIBUTES == dwAttributes)
+    hr = DictCreateWithEmbeddedKey(&sdVariables, pSearches->cSearches, NULL, offsetof(SEARCH_VARIABLE_ACCESS, wzVariable), DICT_FLAG_NONE);
+    ExitOnFailure(hr, "Failed to create dictionary of search variables.");
+
+    // Only the variables searches set can order them, the rest don't change while searching.
+    for (DWORD i = 0; i < pSearches->cSearches; ++i)
     {
-        hr = HRESULT_FROM_WIN32(::GetLastError());
-        if (E_FILENOTFOUND == hr || E_PATHNOTFOUND == hr)
+        BURN_SEARCH* pSearch = &pSearches->rgSearches[i];
+
+        hr = DictGetValue(sdVariables, pSearch->sczVariable, reinterpret_cast<void**>(&pAccess));
+        if (E_NOTFOUND == hr)
         {
-            hr = S_OK; // didn't find file, fExists still is false.
+            pAccess = &rgAccess[cAccess];
+            pAccess->wzVariable = pSearch->sczVariable;
+
+            hr = DictAddValue(sdVariables, pAccess);
+            ExitOnFailure1(hr, "Failed to add search variable to dictionary: %ls", pSearch->sczVariable);
+
+            ++cAccess;
         }
+        ExitOnFailure1(hr, "Failed to find search variable in dictionary: %ls", pSearch->sczVariable);
     }
-    else if (dwAttributes & FILE_ATTRIBUTE_DIRECTORY)
+
+    for (DWORD i = 0; i < pSearches->cSearches; ++i)
     {
-        fExists = TRUE;
-    }
+        BURN_SEARCH* pSearch = &pSearches->rgSearches[i];
 
-    // else must have found a file.
-    // What if there is a hidden variable in sczPath?
-    ExitOnFailure2(hr, "Failed while searching directory search: %ls, for path: %ls", pSearch->sczKey, sczPath);
+        hr = RecordSearchReads(pSearches, sdVariables, i, pSearch->sczCondition, FALSE);
+        ExitOnFailure1(hr, "Failed to record variables read by search condition. Id = '%ls'", pSearch->sczKey);
 
-    // set variable
-    hr = VariableSetNumeric(pVariables, pSearch->sczVariable, fExists, FALSE);
-    ExitOnFailure(hr, "Failed to set variable.");
+        GetSearchFormatStrings(pSearch, &wzFirst, &wzSecond);
 
-LExit:
-    StrSecureZeroFreeString(sczPath);
+        hr = RecordSearchReads(pSearches, sdVariables, i, wzFirst, TRUE);
+        ExitOnFailure1(hr, "Failed to record variables read by search. Id = '%ls'", pSearch->sczKey);
 
-    return hr;
-}
+        hr = RecordSearchReads(pSearches, sdVariables, i, wzSecond, TRUE);
+        ExitOnFailure1(hr, "Failed to record variables read by search. Id = '%ls'", pSearch->sczKey);
 
-static HRESULT DirectorySearchPath(
-    __in BURN_SEARCH* pSearch,
-    __in BURN_VARIABLES* pVariables
-    )
-{
-    HRESULT hr = S_OK;
-    LPWSTR sczPath = NULL;
+        // Setting the variable has to wait for the search that set it before and everything that read that value.
+        hr = DictGetValue(sdVariables, pSearch->sczVariable, reinterpret_cast<void**>(&pAccess));
+        ExitOnFailure1(hr, "Failed to find search variable in dictionary: %ls", pSearch->sczVariable);
 
-    // format path
-    hr = VariableFormatString(pVariables, pSearch->DirectorySearch.sczPath, &sczPath, NULL);
-    ExitOnFailure(hr, "Failed to format variable string.");
+        if (pAccess->dwLastWriter)
+        {
+            hr = AddSearchDependency(pSearches, pAccess->dwLastWriter - 1, i);
+            ExitOnFailure(hr, "Failed to add search dependency.");
+        }
 
-    DWORD dwAttributes = ::GetFileAttributesW(sczPath);
-    if (INVALID_FILE_ATTRIBUTES == dwAttributes)
-    {
-        hr = HRESULT_FROM_WIN32(::GetLastError());
-    }
-    else if (dwAttributes & FILE_ATTRIBUTE_DIRECTORY)
-    {
-        hr = VariableSetLiteralString(pVariables, pSearch->sczVariable, sczPath, FALSE);
-        ExitOnFailure(hr, "Failed to set directory search path variable.");
-    }
-    else // must have found a file.
-    {
-        hr = E_PATHNOTFOUND;
+        for (DWORD j = 0; j < pAccess->cReaders; ++j)
+        {
+            hr = AddSearchDependency(pSearches, pAccess->rgdwReaders[j], i);
+            ExitOnFailure(hr, "Failed to add search dependency.");
+        }
+
+        pAccess->cReaders = 0;
+        pAccess->dwLastWriter = i + 1;
     }
 
-    // What if there is a hidden variable in sczPath?
-    if (E_FILENOTFOUND == hr || E_PATHNOTFOUND == hr)
+LExit:
+    if (rgAccess)
     {
-        LogStringLine(REPORT_STANDARD, "Directory search: %ls, did not find path: %ls, reason: 0x%x", pSearch->sczKey, sczPath, hr);
-        ExitFunction1(hr = S_OK);
+        for (DWORD i = 0; i < cAccess; ++i)
+        {
+            ReleaseMem(rgAccess[i].rgdwReaders);
+        }
+
+        MemFree(rgAccess);
     }
-    ExitOnFailure2(hr, "Failed while searching directory search: %ls, for path: %ls", pSearch->sczKey, sczPath);
 
-LExit:
-    StrSecureZeroFreeString(sczPath);
+    ReleaseDict(sdVariables);
 
     return hr;
 }
 
-static HRESULT FileSearchExists(
-    __in BURN_SEARCH* pSearch,
-    __in BURN_VARIABLES* pVariables
+static HRESULT RecordSearchReads(
+    __in BURN_SEARCHES* pSearches,
+    __in STRINGDICT_HANDLE sdVariables,
+    __in DWORD iSearch,
+    __in_z_opt LPCWSTR wzReads,
+    __in BOOL fFormatted
     )
 {
     HRESULT hr = S_OK;
-    DWORD er = ERROR_SUCCESS;
-    LPWSTR sczPath = NULL;
-    BOOL fExists = FALSE;
+    LPWSTR sczName = NULL;
+    SEARCH_VARIABLE_ACCESS* pAccess = NULL;
+    DWORD cch = 0;
 
-    // format path
-    hr = VariableFormatString(pVariables, pSearch->FileSearch.sczPath, &sczPath, NULL);
-    ExitOnFailure(hr, "Failed to format variable string.");
+    if (!wzReads)
+    {
+        ExitFunction();
+    }
 
-    // find file
-    DWORD dwAttributes = ::GetFileAttributesW(sczPath);
-    if (INVALID_FILE_ATTRIBUTES == dwAttributes)
+    for (LPCWSTR wz = FindVariableReference(wzReads, fFormatted, &cch); wz; wz = FindVariableReference(wz + cch, fFormatted, &cch))
     {
-        er = ::GetLastError();
-        if (ERROR_FILE_NOT_FOUND == er || ERROR_PATH_NOT_FOUND == er)
+        hr = StrAllocString(&sczName, wz, cch);
+        ExitOnFailure(hr, "Failed to copy variable reference.");
+
+        hr = DictGetValue(sdVariables, sczName, reinterpret_cast<void**>(&pAccess));
+        if (E_NOTFOUND == hr)
         {
-            // What if there is a hidden variable in sczPath?
-            LogStringLine(REPORT_STANDARD, "File search: %ls, did not find path: %ls", pSearch->sczKey, sczPath);
+            hr = S_OK;
+            continue;
         }
-        else
+        ExitOnFailure1(hr, "Failed to find search variable in dictionary: %ls", sczName);
+
+        if (pAccess->dwLastWriter)
         {
-            ExitOnWin32Error1(er, hr, "Failed get to file attributes. '%ls'", pSearch->DirectorySearch.sczPath);
+            hr = AddSearchDependency(pSearches, pAccess->dwLastWriter - 1, iSearch);
+            ExitOnFailure(hr, "Failed to add search dependency.");
         }
-    }
-    else if (FILE_ATTRIBUTE_DIRECTORY != (dwAttributes & FILE_ATTRIBUTE_DIRECTORY))
-    {
-        fExists = TRUE;
-    }
 
-    // set variable
-    hr = VariableSetNumeric(pVariables, pSearch->sczVariable, fExists, FALSE);
-    ExitOnFailure(hr, "Failed to set variable.");
+        if (!pAccess->cReaders || iSearch != pAccess->rgdwReaders[pAccess->cReaders - 1])
+        {
+            hr = MemEnsureArraySize(reinterpret_cast<LPVOID*>(&pAccess->rgdwReaders), pAccess->cReaders + 1, sizeof(DWORD), 8);
+            ExitOnFailure(hr, "Failed to grow search variable readers.");
+
+            pAccess->rgdwReaders[pAccess->cReaders] = iSearch;
+            ++pAccess->cReaders;
+        }
+    }
 
 LExit:
-    StrSecureZeroFreeString(sczPath);
+    ReleaseStr(sczName);
+
     return hr;
 }
 
-static HRESULT FileSearchVersion(
-    __in BURN_SEARCH* pSearch,
-    __in BURN_VARIABLES* pVariables
+static HRESULT AddSearchDependency(
+    __in BURN_SEARCHES* pSearches,
+    __in DWORD iSearch,
+    __in DWORD iDependent
     )
 {
     HRESULT hr = S_OK;
-    ULARGE_INTEGER uliVersion = { };
-    LPWSTR sczPath = NULL;
-
-    // format path
-    hr = VariableFormatString(pVariables, pSearch->FileSearch.sczPath, &sczPath, NULL);
-    ExitOnFailure(hr, "Failed to format path string.");
+    BURN_SEARCH* pSearch = &pSearches->rgSearches[iSearch];
 
-    // get file version
-    hr = FileVersion(sczPath, &uliVersion.HighPart, &uliVersion.LowPart);
-    if (E_FILENOTFOUND == hr || E_PATHNOTFOUND == hr)
+    // dependents are added in document order so a repeat is always the last one.
+    if (iSearch == iDependent || (pSearch->cDependents && iDependent == pSearch->rgdwDependents[pSearch->cDependents - 1]))
     {
-        // What if there is a hidden variable in sczPath?
-        LogStringLine(REPORT_STANDARD, "File search: %ls, did not find path: %ls", pSearch->sczKey, sczPath);
-        ExitFunction1(hr = S_OK);
+        ExitFunction();
     }
-    ExitOnFailure(hr, "Failed get file version.");
 
-    // set variable
-    hr = VariableSetVersion(pVariables, pSearch->sczVariable, uliVersion.QuadPart, FALSE);
-    ExitOnFailure(hr, "Failed to set variable.");
+    hr = MemEnsureArraySize(reinterpret_cast<LPVOID*>(&pSearch->rgdwDependents), pSearch->cDependents + 1, sizeof(DWORD), 4);
+    ExitOnFailure(hr, "Failed to grow search dependents.");
+
+    pSearch->rgdwDependents[pSearch->cDependents] = iDependent;
+    ++pSearch->cDependents;
 
 LExit:
-    StrSecureZeroFreeString(sczPath);
     return hr;
 }
 
-static HRESULT FileSearchPath(
+static void GetSearchFormatStrings(
     __in BURN_SEARCH* pSearch,
-    __in BURN_VARIABLES* pVariables
+    __out LPCWSTR* pwzFirst,
+    __out LPCWSTR* pwzSecond
     )
 {
-    HRESULT hr = S_OK;
-    LPWSTR sczPath = NULL;
-
-    // format path
-    hr = VariableFormatString(pVariables, pSearch->FileSearch.sczPath, &sczPath, NULL);
-    ExitOnFailure(hr, "Failed to format variable string.");
+    *pwzFirst = NULL;
+    *pwzSecond = NULL;
 
-    DWORD dwAttributes = ::GetFileAttributesW(sczPath);
-    if (INVALID_FILE_ATTRIBUTES == dwAttributes)
-    {
-        hr = HRESULT_FROM_WIN32(::GetLastError());
-    }
-    else if (dwAttributes & FILE_ATTRIBUTE_DIRECTORY) // found a directory.
+    switch (pSearch->Type)
     {
-        hr = E_FILENOTFOUND;
+    case BURN_SEARCH_TYPE_DIRECTORY:
+        *pwzFirst = pSearch->DirectorySearch.sczPath;
+        break;
+    case BURN_SEARCH_TYPE_FILE:
+        *pwzFirst = pSearch->FileSearch.sczPath;
+        break;
+    case BURN_SEARCH_TYPE_REGISTRY:
+        *pwzFirst = pSearch->RegistrySearch.sczKey;
+        *pwzSecond = pSearch->RegistrySearch.sczValue;
+        break;
+    case BURN_SEARCH_TYPE_MSI_COMPONENT:
+        *pwzFirst = pSearch->MsiComponentSearch.sczComponentId;
+        *pwzSecond = pSearch->MsiComponentSearch.sczProductCode;
+        break;
+    case BURN_SEARCH_TYPE_MSI_PRODUCT:
+        *pwzFirst = pSearch->MsiProductSearch.sczGuid;
+        break;
     }
-    else // found our file.
+}
+
+//
+// FindVariableReference - finds the next variable name in a formatted string or a condition.
+//                         Conditions name variables as bare identifiers so keywords and quoted
+//                         text come back too, they just never match a variable a search sets.
+//
+static LPCWSTR FindVariableReference(
+    __in_z LPCWSTR wz,
+    __in BOOL fFormatted,
+    __out DWORD* pcch
+    )
+{
+    LPCWSTR wzReference = NULL;
+    LPCWSTR wzEnd = NULL;
+
+    *pcch = 0;
+
+    if (fFormatted)
+    {
+        // skip [\x], [#File], [$Component], [!File] and [~] since they don't read variables.
+        for (LPCWSTR wzOpen = wcschr(wz, L'['); wzOpen && !wzReference; wzOpen = wcschr(wzOpen + 1, L'['))
+        {
+            wzEnd = wzOpen + 1;
+            while (*wzEnd && L'[' != *wzEnd && L']' != *wzEnd)
+            {
+                ++wzEnd;
+            }
+
+            if (L']' == *wzEnd && wzEnd > wzOpen + 1 && !wcschr(L"\\#$!~", wzOpen[1]))
+            {
+                wzReference = wzOpen + 1;
+            }
+        }
+    }
+    else
+    {
+        while (*wz && !IsIdentifierCharacter(*wz))
+        {
+            ++wz;
+        }
+
+        if (*wz)
+        {
+            wzReference = wz;
+
+            wzEnd = wz;
+            while (IsIdentifierCharacter(*wzEnd))
+            {
+                ++wzEnd;
+            }
+        }
+    }
+
+    if (wzReference)
+    {
+        *pcch = static_cast<DWORD>(wzEnd - wzReference);
+    }
+
+    return wzReference;
+}
+
+static BOOL IsIdentifierCharacter(
+    __in WCHAR wch
+    )
+{
+    WORD charType = 0;
+
+    if (!wch || !::GetStringTypeW(CT_CTYPE1, &wch, 1, &charType))
+    {
+        return FALSE;
+    }
+
+    return (C1_ALPHA & charType) || (C1_DIGIT & charType) || L'_' == wch;
+}
+
+//
+// SearchFormatsIndirectly - checks whether formatting the search could read variables that aren't
+//                           named in it, through nested references or a variable whose value has
+//                           references of its own.
+//
+static HRESULT SearchFormatsIndirectly(
+    __in BURN_SEARCH* pSearch,
+    __in BURN_VARIABLES* pVariables,
+    __out BOOL* pfIndirect
+    )
+{
+    HRESULT hr = S_OK;
+    LPCWSTR rgwzFormats[2] = { };
+    LPWSTR sczName = NULL;
+    LPWSTR sczValue = NULL;
+    DWORD cch = 0;
+    DWORD dwDepth = 0;
+
+    *pfIndirect = FALSE;
+
+    GetSearchFormatStrings(pSearch, &rgwzFormats[0], &rgwzFormats[1]);
+
+    for (DWORD i = 0; i < countof(rgwzFormats); ++i)
+    {
+        if (!rgwzFormats[i])
+        {
+            continue;
+        }
+
+        dwDepth = 0;
+        for (LPCWSTR wz = rgwzFormats[i]; *wz; ++wz)
+        {
+            if (L'[' == *wz && 1 < ++dwDepth)
+            {
+                *pfIndirect = TRUE;
+                ExitFunction();
+            }
+            else if (L']' == *wz && dwDepth)
+            {
+                --dwDepth;
+            }
+        }
+
+        for (LPCWSTR wz = FindVariableReference(rgwzFormats[i], TRUE, &cch); wz; wz = FindVariableReference(wz + cch, TRUE, &cch))
+        {
+            hr = StrAllocString(&sczName, wz, cch);
+            ExitOnFailure(hr, "Failed to copy variable reference.");
+
+            hr = VariableGetString(pVariables, sczName, &sczValue);
+            if (E_NOTFOUND == hr)
+            {
+                hr = S_OK;
+                continue;
+            }
+            ExitOnFailure1(hr, "Failed to get variable: %ls", sczName);
+
+            if (wcschr(sczValue, L'['))
+            {
+                *pfIndirect = TRUE;
+                ExitFunction();
+            }
+        }
+    }
+
+LExit:
+    ReleaseStr(sczName);
+    StrSecureZeroFreeString(sczValue);
+
+    return hr;
+}
+
+static HRESULT ExecuteSearchesInParallel(
+    __in BURN_SEARCHES* pSearches,
+    __in BURN_VARIABLES* pVariables,
+    __in_opt SEARCH_CACHE* pCache,
+    __in SEARCH_REGISTRY* pRegistry,
+    __in DWORD iFirst,
+    __in DWORD iLast
+    )
+{
+    HRESULT hr = S_OK;
+    SEARCH_EXECUTE_CONTEXT context = { };
+    BOOL fInitializedCriticalSection = FALSE;
+    HANDLE rghThreads[SEARCH_MAX_WORKERS - 1] = { };
+    DWORD cThreads = 0;
+    DWORD cSearches = iLast - iFirst;
+    DWORD cWorkers = min(cSearches, SEARCH_MAX_WORKERS);
+
+    if (1 >= cSearches)
+    {
+        if (cSearches)
+        {
+            hr = ExecuteSearch(&pSearches->rgSearches[iFirst], pVariables, pCache, pRegistry);
+        }
+
+        ExitFunction();
+    }
+
+    context.pSearches = pSearches;
+    context.pVariables = pVariables;
+    context.pCache = pCache;
+    context.pRegistry = pRegistry;
+    context.iFirst = iFirst;
+    context.iLast = iLast;
+    context.cRemaining = cSearches;
+
+    context.rgdwQueue = static_cast<DWORD*>(MemAlloc(sizeof(DWORD) * cSearches, TRUE));
+    ExitOnNull(context.rgdwQueue, hr, E_OUTOFMEMORY, "Failed to allocate memory for search queue.");
+
+    context.rgcWaiting = static_cast<DWORD*>(MemAlloc(sizeof(DWORD) * cSearches, TRUE));
+    ExitOnNull(context.rgcWaiting, hr, E_OUTOFMEMORY, "Failed to allocate memory for search dependency counts.");
+
+    // Dependencies before the range have already run.
+    for (DWORD i = iFirst; i < iLast; ++i)
+    {
+        BURN_SEARCH* pSearch = &pSearches->rgSearches[i];
+
+        for (DWORD j = 0; j < pSearch->cDependents; ++j)
+        {
+            if (pSearch->rgdwDependents[j] < iLast)
+            {
+                ++context.rgcWaiting[pSearch->rgdwDependents[j] - iFirst];
+            }
+        }
+    }
+
+    for (DWORD i = 0; i < cSearches; ++i)
+    {
+        if (!context.rgcWaiting[i])
+        {
+            context.rgdwQueue[context.iQueueTail] = iFirst + i;
+            ++context.iQueueTail;
+        }
+    }
+
+    context.hSearchReady = ::CreateSemaphoreW(NULL, context.iQueueTail, cSearches, NULL);
+    ExitOnNullWithLastError(context.hSearchReady, hr, "Failed to create search ready semaphore.");
+
+    context.hSearchesDone = ::CreateEventW(NULL, TRUE, FALSE, NULL);
+    ExitOnNullWithLastError(context.hSearchesDone, hr, "Failed to create searches done event.");
+
+    ::InitializeCriticalSection(&context.cs);
+    fInitializedCriticalSection = TRUE;
+
+    // This thread is a worker too, so the searches still all run if no more threads can be created.
+    for (DWORD i = 1; i < cWorkers; ++i)
+    {
+        rghThreads[cThreads] = ::CreateThread(NULL, 0, SearchWorkerThreadProc, &context, 0, NULL);
+        if (!rghThreads[cThreads])
+        {
+            TraceError(HRESULT_FROM_WIN32(::GetLastError()), "Failed to create search worker thread.");
+            break;
+        }
+
+        ++cThreads;
+    }
+
+    hr = RunSearchWorker(&context);
+    ExitOnFailure(hr, "Failed to run searches.");
+
+LExit:
+    if (cThreads)
+    {
+        ::WaitForMultipleObjects(cThreads, rghThreads, TRUE, INFINITE);
+
+        for (DWORD i = 0; i < cThreads; ++i)
+        {
+            ReleaseHandle(rghThreads[i]);
+        }
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = context.hrSearches;
+    }
+
+    if (fInitializedCriticalSection)
+    {
+        ::DeleteCriticalSection(&context.cs);
+    }
+
+    ReleaseHandle(context.hSearchesDone);
+    ReleaseHandle(context.hSearchReady);
+    ReleaseMem(context.rgcWaiting);
+    ReleaseMem(context.rgdwQueue);
+
+    return hr;
+}
+
+static DWORD WINAPI SearchWorkerThreadProc(
+    __in LPVOID lpThreadParameter
+    )
+{
+    SEARCH_EXECUTE_CONTEXT* pContext = reinterpret_cast<SEARCH_EXECUTE_CONTEXT*>(lpThreadParameter);
+
+    return (DWORD)RunSearchWorker(pContext);
+}
+
+static HRESULT RunSearchWorker(
+    __in SEARCH_EXECUTE_CONTEXT* pContext
+    )
+{
+    HRESULT hr = S_OK;
+    HRESULT hrSearch = S_OK;
+    HANDLE rghWait[2] = { pContext->hSearchReady, pContext->hSearchesDone };
+    DWORD dwResult = 0;
+    DWORD iSearch = 0;
+    BOOL fSkip = FALSE;
+
+    for (;;)
+    {
+        dwResult = ::WaitForMultipleObjects(countof(rghWait), rghWait, FALSE, INFINITE);
+        if (WAIT_OBJECT_0 + 1 == dwResult)
+        {
+            break;
+        }
+        else if (WAIT_OBJECT_0 != dwResult)
+        {
+            ExitWithLastError(hr, "Failed to wait for a search to be ready.");
+        }
+
+        ::EnterCriticalSection(&pContext->cs);
+        iSearch = pContext->rgdwQueue[pContext->iQueueHead];
+        ++pContext->iQueueHead;
+        fSkip = FAILED(pContext->hrSearches);
+        ::LeaveCriticalSection(&pContext->cs);
+
+        // After a failure the rest of the searches are only marked done so the workers can stop.
+        hrSearch = fSkip ? S_OK : ExecuteSearch(&pContext->pSearches->rgSearches[iSearch], pContext->pVariables, pContext->pCache, pContext->pRegistry);
+
+        ::EnterCriticalSection(&pContext->cs);
+
+        if (FAILED(hrSearch) && SUCCEEDED(pContext->hrSearches))
+        {
+            pContext->hrSearches = hrSearch;
+        }
+
+        BURN_SEARCH* pSearch = &pContext->pSearches->rgSearches[iSearch];
+        for (DWORD i = 0; i < pSearch->cDependents; ++i)
+        {
+            DWORD iDependent = pSearch->rgdwDependents[i];
+            if (iDependent < pContext->iLast && 0 == --pContext->rgcWaiting[iDependent - pContext->iFirst])
+            {
+                pContext->rgdwQueue[pContext->iQueueTail] = iDependent;
+                ++pContext->iQueueTail;
+
+                ::ReleaseSemaphore(pContext->hSearchReady, 1, NULL);
+            }
+        }
+
+        if (0 == --pContext->cRemaining)
+        {
+            ::SetEvent(pContext->hSearchesDone);
+        }
+
+        ::LeaveCriticalSection(&pContext->cs);
+    }
+
+LExit:
+    return hr;
+}
+
+static HRESULT ExecuteSearch(
+    __in BURN_SEARCH* pSearch,
+    __in BURN_VARIABLES* pVariables,
+    __in_opt SEARCH_CACHE* pCache,
+    __in SEARCH_REGISTRY* pRegistry
+    )
+{
+    HRESULT hr = S_OK;
+    BOOL f = FALSE;
+
+    // evaluate condition
+    if (pSearch->sczCondition && *pSearch->sczCondition)
+    {
+        hr = ConditionEvaluate(pVariables, pSearch->sczCondition, &f);
+        if (E_INVALIDDATA == hr)
+        {
+            TraceError2(hr, "Failed to parse search condition. Id = '%ls', Condition = '%ls'", pSearch->sczKey, pSearch->sczCondition);
+            ExitFunction1(hr = S_OK);
+        }
+        ExitOnFailure2(hr, "Failed to evaluate search condition. Id = '%ls', Condition = '%ls'", pSearch->sczKey, pSearch->sczCondition);
+
+        if (!f)
+        {
+            ExitFunction(); // condition evaluated to false, skip
+        }
+    }
+
+    switch (pSearch->Type)
+    {
+    case BURN_SEARCH_TYPE_DIRECTORY:
+        switch (pSearch->DirectorySearch.Type)
+        {
+        case BURN_DIRECTORY_SEARCH_TYPE_EXISTS:
+            hr = DirectorySearchExists(pSearch, pVariables);
+            break;
+        case BURN_DIRECTORY_SEARCH_TYPE_PATH:
+            hr = DirectorySearchPath(pSearch, pVariables);
+            break;
+        default:
+            hr = E_UNEXPECTED;
+        }
+        break;
+    case BURN_SEARCH_TYPE_FILE:
+        switch (pSearch->FileSearch.Type)
+        {
+        case BURN_FILE_SEARCH_TYPE_EXISTS:
+            hr = FileSearchExists(pSearch, pVariables);
+            break;
+        case BURN_FILE_SEARCH_TYPE_VERSION:
+            hr = FileSearchVersion(pSearch, pVariables, pCache);
+            break;
+        case BURN_FILE_SEARCH_TYPE_PATH:
+            hr = FileSearchPath(pSearch, pVariables);
+            break;
+        default:
+            hr = E_UNEXPECTED;
+        }
+        break;
+    case BURN_SEARCH_TYPE_REGISTRY:
+        switch (pSearch->RegistrySearch.Type)
+        {
+        case BURN_REGISTRY_SEARCH_TYPE_EXISTS:
+            hr = RegistrySearchExists(pSearch, pVariables, pRegistry);
+            break;
+        case BURN_REGISTRY_SEARCH_TYPE_VALUE:
+            hr = RegistrySearchValue(pSearch, pVariables, pRegistry);
+            break;
+        default:
+            hr = E_UNEXPECTED;
+        }
+        break;
+    case BURN_SEARCH_TYPE_MSI_COMPONENT:
+        hr = MsiComponentSearch(pSearch, pVariables);
+        break;
+    case BURN_SEARCH_TYPE_MSI_PRODUCT:
+        hr = MsiProductSearch(pSearch, pVariables);
+        break;
+    case BURN_SEARCH_TYPE_MSI_FEATURE:
+        hr = MsiFeatureSearch(pSearch, pVariables);
+        break;
+    default:
+        hr = E_UNEXPECTED;
+    }
+
+    if (FAILED(hr))
+    {
+        TraceError1(hr, "Search failed. Id = '%ls'", pSearch->sczKey);
+        hr = S_OK;
+    }
+
+LExit:
+    return hr;
+}
+
+static HRESULT LoadSearchCache(
+    __in SEARCH_CACHE* pCache
+    )
+{
+    HRESULT hr = S_OK;
+    BYTE* pbBuffer = NULL;
+    DWORD cbBuffer = 0;
+    SIZE_T iBuffer = 0;
+    DWORD dwVersion = 0;
+    DWORD cEntries = 0;
+    SEARCH_CACHE_ENTRY entry = { };
+
+    hr = FileRead(&pbBuffer, &cbBuffer, pCache->wzPath);
+    if (E_FILENOTFOUND == hr || E_PATHNOTFOUND == hr)
+    {
+        ExitFunction1(hr = S_OK);
+    }
+    ExitOnFailure1(hr, "Failed to read search cache: %ls", pCache->wzPath);
+
+    // Anything not read back is searched again and the file rewritten.
+    pCache->fDirty = TRUE;
+
+    hr = BuffReadNumber(pbBuffer, cbBuffer, &iBuffer, &dwVersion);
+    ExitOnFailure(hr, "Failed to read search cache version.");
+
+    if (SEARCH_CACHE_FORMAT_VERSION != dwVersion)
+    {
+        ExitFunction();
+    }
+
+    hr = BuffReadNumber(pbBuffer, cbBuffer, &iBuffer, &cEntries);
+    ExitOnFailure(hr, "Failed to read search cache entry count.");
+
+    for (DWORD i = 0; i < cEntries; ++i)
+    {
+        hr = BuffReadString(pbBuffer, cbBuffer, &iBuffer, &entry.sczKey);
+        ExitOnFailure(hr, "Failed to read search cache key.");
+
+        hr = BuffReadNumber64(pbBuffer, cbBuffer, &iBuffer, &entry.qwSize);
+        ExitOnFailure(hr, "Failed to read search cache size stamp.");
+
+        hr = BuffReadNumber64(pbBuffer, cbBuffer, &iBuffer, &entry.qwCreationTime);
+        ExitOnFailure(hr, "Failed to read search cache creation time stamp.");
+
+        hr = BuffReadNumber64(pbBuffer, cbBuffer, &iBuffer, &entry.qwLastWriteTime);
+        ExitOnFailure(hr, "Failed to read search cache last write time stamp.");
+
+        hr = BuffReadNumber64(pbBuffer, cbBuffer, &iBuffer, &entry.qwValue);
+        ExitOnFailure(hr, "Failed to read search cache value.");
+
+        hr = MemEnsureArraySize(reinterpret_cast<LPVOID*>(&pCache->rgEntries), pCache->cEntries + 1, sizeof(SEARCH_CACHE_ENTRY), 16);
+        ExitOnFailure(hr, "Failed to grow search cache.");
+
+        SEARCH_CACHE_ENTRY* pEntry = &pCache->rgEntries[pCache->cEntries];
+        *pEntry = entry;
+        entry.sczKey = NULL;
+
+        ++pCache->cEntries;
+
+        hr = DictAddValue(pCache->sdEntries, pEntry);
+        ExitOnFailure1(hr, "Failed to add search cache entry: %ls", pEntry->sczKey);
+    }
+
+    pCache->fDirty = FALSE;
+
+LExit:
+    ReleaseStr(entry.sczKey);
+    ReleaseMem(pbBuffer);
+
+    return hr;
+}
+
+static HRESULT SaveSearchCache(
+    __in SEARCH_CACHE* pCache
+    )
+{
+    HRESULT hr = S_OK;
+    BYTE* pbBuffer = NULL;
+    SIZE_T cbBuffer = 0;
+    LPWSTR sczDirectory = NULL;
+    DWORD cUsed = 0;
+
+    for (DWORD i = 0; i < pCache->cEntries; ++i)
+    {
+        if (pCache->rgEntries[i].fUsed)
+        {
+            ++cUsed;
+        }
+    }
+
+    // Entries no search looked up this time are dropped so the cache doesn't grow without bound.
+    if (!pCache->fDirty && cUsed == pCache->cEntries)
+    {
+        ExitFunction();
+    }
+
+    hr = BuffWriteNumber(&pbBuffer, &cbBuffer, SEARCH_CACHE_FORMAT_VERSION);
+    ExitOnFailure(hr, "Failed to write search cache version.");
+
+    hr = BuffWriteNumber(&pbBuffer, &cbBuffer, cUsed);
+    ExitOnFailure(hr, "Failed to write search cache entry count.");
+
+    for (DWORD i = 0; i < pCache->cEntries; ++i)
+    {
+        SEARCH_CACHE_ENTRY* pEntry = &pCache->rgEntries[i];
+        if (!pEntry->fUsed)
+        {
+            continue;
+        }
+
+        hr = BuffWriteString(&pbBuffer, &cbBuffer, pEntry->sczKey);
+        ExitOnFailure(hr, "Failed to write search cache key.");
+
+        hr = BuffWriteNumber64(&pbBuffer, &cbBuffer, pEntry->qwSize);
+        ExitOnFailure(hr, "Failed to write search cache size stamp.");
+
+        hr = BuffWriteNumber64(&pbBuffer, &cbBuffer, pEntry->qwCreationTime);
+        ExitOnFailure(hr, "Failed to write search cache creation time stamp.");
+
+        hr = BuffWriteNumber64(&pbBuffer, &cbBuffer, pEntry->qwLastWriteTime);
+        ExitOnFailure(hr, "Failed to write search cache last write time stamp.");
+
+        hr = BuffWriteNumber64(&pbBuffer, &cbBuffer, pEntry->qwValue);
+        ExitOnFailure(hr, "Failed to write search cache value.");
+    }
+
+    hr = PathGetDirectory(pCache->wzPath, &sczDirectory);
+    ExitOnFailure1(hr, "Failed to get search cache directory: %ls", pCache->wzPath);
+
+    hr = DirEnsureExists(sczDirectory, NULL);
+    ExitOnFailure1(hr, "Failed to create search cache directory: %ls", sczDirectory);
+
+    hr = FileWrite(pCache->wzPath, FILE_ATTRIBUTE_NORMAL, pbBuffer, cbBuffer, NULL);
+    ExitOnFailure1(hr, "Failed to write search cache: %ls", pCache->wzPath);
+
+LExit:
+    ReleaseStr(sczDirectory);
+    ReleaseBuffer(pbBuffer);
+
+    return hr;
+}
+
+static void UninitializeSearchCache(
+    __in SEARCH_CACHE* pCache
+    )
+{
+    for (DWORD i = 0; i < pCache->cEntries; ++i)
+    {
+        ReleaseStr(pCache->rgEntries[i].sczKey);
+    }
+
+    ReleaseMem(pCache->rgEntries);
+    ReleaseDict(pCache->sdEntries);
+
+    ::DeleteCriticalSection(&pCache->cs);
+
+    memset(pCache, 0, sizeof(SEARCH_CACHE));
+}
+
+//
+// GetFileVersionFromCache - gets a file's version, reusing the version an earlier run found
+//                           when the file's size and times still match.
+//
+static HRESULT GetFileVersionFromCache(
+    __in_opt SEARCH_CACHE* pCache,
+    __in_z LPCWSTR wzPath,
+    __out DWORD64* pqwVersion
+    )
+{
+    HRESULT hr = S_OK;
+    WIN32_FILE_ATTRIBUTE_DATA fad = { };
+    ULARGE_INTEGER uliSize = { };
+    ULARGE_INTEGER uliCreationTime = { };
+    ULARGE_INTEGER uliLastWriteTime = { };
+    ULARGE_INTEGER uliVersion = { };
+    LPWSTR sczKey = NULL;
+    SEARCH_CACHE_ENTRY* pEntry = NULL;
+    BOOL fLocked = FALSE;
+
+    if (!pCache)
+    {
+        hr = FileVersion(wzPath, &uliVersion.HighPart, &uliVersion.LowPart);
+        ExitFunction();
+    }
+
+    if (!::GetFileAttributesExW(wzPath, GetFileExInfoStandard, &fad))
+    {
+        ExitWithLastError1(hr, "Failed to get attributes of file: %ls", wzPath);
+    }
+
+    uliSize.HighPart = fad.nFileSizeHigh;
+    uliSize.LowPart = fad.nFileSizeLow;
+    uliCreationTime.HighPart = fad.ftCreationTime.dwHighDateTime;
+    uliCreationTime.LowPart = fad.ftCreationTime.dwLowDateTime;
+    uliLastWriteTime.HighPart = fad.ftLastWriteTime.dwHighDateTime;
+    uliLastWriteTime.LowPart = fad.ftLastWriteTime.dwLowDateTime;
+
+    hr = StrAllocFormatted(&sczKey, L"FileVersion|%ls", wzPath);
+    ExitOnFailure(hr, "Failed to allocate search cache key.");
+
+    ::EnterCriticalSection(&pCache->cs);
+    fLocked = TRUE;
+
+    hr = DictGetValue(pCache->sdEntries, sczKey, reinterpret_cast<void**>(&pEntry));
+    if (E_NOTFOUND != hr)
+    {
+        ExitOnFailure1(hr, "Failed to look up search cache entry: %ls", sczKey);
+
+        if (uliSize.QuadPart == pEntry->qwSize && uliCreationTime.QuadPart == pEntry->qwCreationTime && uliLastWriteTime.QuadPart == pEntry->qwLastWriteTime)
+        {
+            pEntry->fUsed = TRUE;
+            uliVersion.QuadPart = pEntry->qwValue;
+
+            ExitFunction();
+        }
+    }
+
+    ::LeaveCriticalSection(&pCache->cs);
+    fLocked = FALSE;
+
+    hr = FileVersion(wzPath, &uliVersion.HighPart, &uliVersion.LowPart);
+    if (FAILED(hr))
+    {
+        ExitFunction();
+    }
+
+    ::EnterCriticalSection(&pCache->cs);
+    fLocked = TRUE;
+
+    // another worker may have added the same file while the version was read.
+    hr = DictGetValue(pCache->sdEntries, sczKey, reinterpret_cast<void**>(&pEntry));
+    if (E_NOTFOUND == hr)
+    {
+        hr = MemEnsureArraySize(reinterpret_cast<LPVOID*>(&pCache->rgEntries), pCache->cEntries + 1, sizeof(SEARCH_CACHE_ENTRY), 16);
+        ExitOnFailure(hr, "Failed to grow search cache.");
+
+        pEntry = &pCache->rgEntries[pCache->cEntries];
+        pEntry->sczKey = sczKey;
+        sczKey = NULL;
+
+        ++pCache->cEntries;
+
+        hr = DictAddValue(pCache->sdEntries, pEntry);
+        ExitOnFailure1(hr, "Failed to add search cache entry: %ls", pEntry->sczKey);
+    }
+    ExitOnFailure(hr, "Failed to look up search cache entry.");
+
+    pEntry->qwSize = uliSize.QuadPart;
+    pEntry->qwCreationTime = uliCreationTime.QuadPart;
+    pEntry->qwLastWriteTime = uliLastWriteTime.QuadPart;
+    pEntry->qwValue = uliVersion.QuadPart;
+    pEntry->fUsed = TRUE;
+    pCache->fDirty = TRUE;
+
+LExit:
+    if (fLocked)
+    {
+        ::LeaveCriticalSection(&pCache->cs);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        *pqwVersion = uliVersion.QuadPart;
+    }
+
+    ReleaseStr(sczKey);
+
+    return hr;
+}
+
+static void UninitializeSearchRegistry(
+    __in SEARCH_REGISTRY* pRegistry
+    )
+{
+    for (DWORD i = 0; i < pRegistry->cKeys; ++i)
+    {
+        StrSecureZeroFreeString(pRegistry->rgKeys[i].sczKey);
+        ReleaseRegSnapshot(pRegistry->rgKeys[i].hSnapshot);
+    }
+
+    ReleaseMem(pRegistry->rgKeys);
+    ReleaseDict(pRegistry->sdKeys);
+
+    ::DeleteCriticalSection(&pRegistry->cs);
+
+    memset(pRegistry, 0, sizeof(SEARCH_REGISTRY));
+}
+
+//
+// GetRegistrySnapshot - gets a snapshot of all the values of a registry key, shared by every
+//                       search of the key in this execution. Returns E_FILENOTFOUND when the
+//                       key does not exist.
+//
+static HRESULT GetRegistrySnapshot(
+    __in SEARCH_REGISTRY* pRegistry,
+    __in HKEY hRoot,
+    __in_z LPCWSTR wzKey,
+    __in BOOL fWin64,
+    __out REG_SNAPSHOT_HANDLE* phSnapshot
+    )
+{
+    HRESULT hr = S_OK;
+    LPWSTR sczKey = NULL;
+    SEARCH_REGISTRY_KEY* pKey = NULL;
+    REG_SNAPSHOT_HANDLE hSnapshot = NULL;
+    REG_SNAPSHOT_HANDLE hShared = NULL;
+    REGSAM samDesired = KEY_QUERY_VALUE;
+    BOOL fLocked = FALSE;
+
+    if (fWin64)
+    {
+        samDesired = samDesired | KEY_WOW64_64KEY;
+    }
+
+    hr = StrAllocFormatted(&sczKey, L"%p|%u|%ls", hRoot, fWin64 ? 64 : 0, wzKey);
+    ExitOnFailure(hr, "Failed to allocate registry key id.");
+
+    ::EnterCriticalSection(&pRegistry->cs);
+    fLocked = TRUE;
+
+    hr = DictGetValue(pRegistry->sdKeys, sczKey, reinterpret_cast<void**>(&pKey));
+    if (E_NOTFOUND != hr)
+    {
+        ExitOnFailure(hr, "Failed to look up registry key.");
+
+        hShared = pKey->hSnapshot;
+        ExitFunction();
+    }
+
+    ::LeaveCriticalSection(&pRegistry->cs);
+    fLocked = FALSE;
+
+    // The key is read outside the lock so searches of other keys don't wait for it.
+    hr = RegSnapshotOpen(hRoot, wzKey, samDesired, &hSnapshot);
+    if (E_FILENOTFOUND == hr)
+    {
+        // Remember the key is missing too.
+        hr = S_OK;
+    }
+    ExitOnFailure(hr, "Failed to read registry key.");
+
+    ::EnterCriticalSection(&pRegistry->cs);
+    fLocked = TRUE;
+
+    // another worker may have read the same key in the meantime.
+    hr = DictGetValue(pRegistry->sdKeys, sczKey, reinterpret_cast<void**>(&pKey));
+    if (E_NOTFOUND == hr)
+    {
+        hr = MemEnsureArraySize(reinterpret_cast<LPVOID*>(&pRegistry->rgKeys), pRegistry->cKeys + 1, sizeof(SEARCH_REGISTRY_KEY), 16);
+        ExitOnFailure(hr, "Failed to grow registry keys.");
+
+        pKey = &pRegistry->rgKeys[pRegistry->cKeys];
+        pKey->sczKey = sczKey;
+        sczKey = NULL;
+        pKey->hSnapshot = hSnapshot;
+        hSnapshot = NULL;
+
+        ++pRegistry->cKeys;
+
+        hr = DictAddValue(pRegistry->sdKeys, pKey);
+        ExitOnFailure(hr, "Failed to add registry key.");
+    }
+    ExitOnFailure(hr, "Failed to look up registry key.");
+
+    hShared = pKey->hSnapshot;
+
+LExit:
+    if (fLocked)
+    {
+        ::LeaveCriticalSection(&pRegistry->cs);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        // The snapshots are never invalidated while the searches run so the workers only
+        // read them and can share them without holding the lock.
+        *phSnapshot = hShared;
+        hr = hShared ? S_OK : E_FILENOTFOUND;
+    }
+
+    ReleaseRegSnapshot(hSnapshot);
+    StrSecureZeroFreeString(sczKey);
+
+    return hr;
+}
+
+static HRESULT DirectorySearchExists(
+    __in BURN_SEARCH* pSearch,
+    __in BURN_VARIABLES* pVariables
+    )
+{
+    HRESULT hr = S_OK;
+    LPWSTR sczPath = NULL;
+    BOOL fExists = FALSE;
+
+    // format path
+    hr = VariableFormatString(pVariables, pSearch->DirectorySearch.sczPath, &sczPath, NULL);
+    ExitOnFailure(hr, "Failed to format variable string.");
+
+    DWORD dwAttributes = ::GetFileAttributesW(sczPath);
+    if (INVALID_FILE_ATTRIBUTES == dwAttributes)
+    {
+        hr = HRESULT_FROM_WIN32(::GetLastError());
+        if (E_FILENOTFOUND == hr || E_PATHNOTFOUND == hr)
+        {
+            hr = S_OK; // didn't find file, fExists still is false.
+        }
+    }
+    else if (dwAttributes & FILE_ATTRIBUTE_DIRECTORY)
+    {
+        fExists = TRUE;
+    }
+
+    // else must have found a file.
+    // What if there is a hidden variable in sczPath?
+    ExitOnFailure2(hr, "Failed while searching directory search: %ls, for path: %ls", pSearch->sczKey, sczPath);
+
+    // set variable
+    hr = VariableSetNumeric(pVariables, pSearch->sczVariable, fExists, FALSE);
+    ExitOnFailure(hr, "Failed to set variable.");
+
+LExit:
+    StrSecureZeroFreeString(sczPath);
+
+    return hr;
+}
+
+static HRESULT DirectorySearchPath(
+    __in BURN_SEARCH* pSearch,
+    __in BURN_VARIABLES* pVariables
+    )
+{
+    HRESULT hr = S_OK;
+    LPWSTR sczPath = NULL;
+
+    // format path
+    hr = VariableFormatString(pVariables, pSearch->DirectorySearch.sczPath, &sczPath, NULL);
+    ExitOnFailure(hr, "Failed to format variable string.");
+
+    DWORD dwAttributes = ::GetFileAttributesW(sczPath);
+    if (INVALID_FILE_ATTRIBUTES == dwAttributes)
+    {
+        hr = HRESULT_FROM_WIN32(::GetLastError());
+    }
+    else if (dwAttributes & FILE_ATTRIBUTE_DIRECTORY)
+    {
+        hr = VariableSetLiteralString(pVariables, pSearch->sczVariable, sczPath, FALSE);
+        ExitOnFailure(hr, "Failed to set directory search path variable.");
+    }
+    else // must have found a file.
+    {
+        hr = E_PATHNOTFOUND;
+    }
+
+    // What if there is a hidden variable in sczPath?
+    if (E_FILENOTFOUND == hr || E_PATHNOTFOUND == hr)
+    {
+        LogStringLine(REPORT_STANDARD, "Directory search: %ls, did not find path: %ls, reason: 0x%x", pSearch->sczKey, sczPath, hr);
+        ExitFunction1(hr = S_OK);
+    }
+    ExitOnFailure2(hr, "Failed while searching directory search: %ls, for path: %ls", pSearch->sczKey, sczPath);
+
+LExit:
+    StrSecureZeroFreeString(sczPath);
+
+    return hr;
+}
+
+static HRESULT FileSearchExists(
+    __in BURN_SEARCH* pSearch,
+    __in BURN_VARIABLES* pVariables
+    )
+{
+    HRESULT hr = S_OK;
+    DWORD er = ERROR_SUCCESS;
+    LPWSTR sczPath = NULL;
+    BOOL fExists = FALSE;
+
+    // format path
+    hr = VariableFormatString(pVariables, pSearch->FileSearch.sczPath, &sczPath, NULL);
+    ExitOnFailure(hr, "Failed to format variable string.");
+
+    // find file
+    DWORD dwAttributes = ::GetFileAttributesW(sczPath);
+    if (INVALID_FILE_ATTRIBUTES == dwAttributes)
+    {
+        er = ::GetLastError();
+        if (ERROR_FILE_NOT_FOUND == er || ERROR_PATH_NOT_FOUND == er)
+        {
+            // What if there is a hidden variable in sczPath?
+            LogStringLine(REPORT_STANDARD, "File search: %ls, did not find path: %ls", pSearch->sczKey, sczPath);
+        }
+        else
+        {
+            ExitOnWin32Error1(er, hr, "Failed get to file attributes. '%ls'", pSearch->DirectorySearch.sczPath);
+        }
+    }
+    else if (FILE_ATTRIBUTE_DIRECTORY != (dwAttributes & FILE_ATTRIBUTE_DIRECTORY))
+    {
+        fExists = TRUE;
+    }
+
+    // set variable
+    hr = VariableSetNumeric(pVariables, pSearch->sczVariable, fExists, FALSE);
+    ExitOnFailure(hr, "Failed to set variable.");
+
+LExit:
+    StrSecureZeroFreeString(sczPath);
+    return hr;
+}
+
+static HRESULT FileSearchVersion(
+    __in BURN_SEARCH* pSearch,
+    __in BURN_VARIABLES* pVariables,
+    __in_opt SEARCH_CACHE* pCache
+    )
+{
+    HRESULT hr = S_OK;
+    ULARGE_INTEGER uliVersion = { };
+    LPWSTR sczPath = NULL;
+    LPWSTR sczObfuscatedPath = NULL;
+
+    // format path
+    hr = VariableFormatString(pVariables, pSearch->FileSearch.sczPath, &sczPath, NULL);
+    ExitOnFailure(hr, "Failed to format path string.");
+
+    // the cache is written to disk so a path with a hidden variable in it isn't kept there.
+    if (pCache)
+    {
+        hr = VariableFormatStringObfuscated(pVariables, pSearch->FileSearch.sczPath, &sczObfuscatedPath, NULL);
+        ExitOnFailure(hr, "Failed to format obfuscated path string.");
+
+        if (CSTR_EQUAL != ::CompareStringW(LOCALE_INVARIANT, 0, sczPath, -1, sczObfuscatedPath, -1))
+        {
+            pCache = NULL;
+        }
+    }
+
+    // get file version
+    hr = GetFileVersionFromCache(pCache, sczPath, &uliVersion.QuadPart);
+    if (E_FILENOTFOUND == hr || E_PATHNOTFOUND == hr)
+    {
+        // What if there is a hidden variable in sczPath?
+        LogStringLine(REPORT_STANDARD, "File search: %ls, did not find path: %ls", pSearch->sczKey, sczPath);
+        ExitFunction1(hr = S_OK);
+    }
+    ExitOnFailure(hr, "Failed get file version.");
+
+    // set variable
+    hr = VariableSetVersion(pVariables, pSearch->sczVariable, uliVersion.QuadPart, FALSE);
+    ExitOnFailure(hr, "Failed to set variable.");
+
+LExit:
+    StrSecureZeroFreeString(sczPath);
+    ReleaseStr(sczObfuscatedPath);
+    return hr;
+}
+
+static HRESULT FileSearchPath(
+    __in BURN_SEARCH* pSearch,
+    __in BURN_VARIABLES* pVariables
+    )
+{
+    HRESULT hr = S_OK;
+    LPWSTR sczPath = NULL;
+
+    // format path
+    hr = VariableFormatString(pVariables, pSearch->FileSearch.sczPath, &sczPath, NULL);
+    ExitOnFailure(hr, "Failed to format variable string.");
+
+    DWORD dwAttributes = ::GetFileAttributesW(sczPath);
+    if (INVALID_FILE_ATTRIBUTES == dwAttributes)
+    {
+        hr = HRESULT_FROM_WIN32(::GetLastError());
+    }
+    else if (dwAttributes & FILE_ATTRIBUTE_DIRECTORY) // found a directory.
+    {
+        hr = E_FILENOTFOUND;
+    }
+    else // found our file.
     {
         hr = VariableSetLiteralString(pVariables, pSearch->sczVariable, sczPath, FALSE);
         ExitOnFailure(hr, "Failed to set variable to file search path.");
@@ -740,29 +1915,23 @@ LExit:
 
 static HRESULT RegistrySearchExists(
     __in BURN_SEARCH* pSearch,
-    __in BURN_VARIABLES* pVariables
+    __in BURN_VARIABLES* pVariables,
+    __in SEARCH_REGISTRY* pRegistry
     )
 {
     HRESULT hr = S_OK;
-    DWORD er = ERROR_SUCCESS;
     LPWSTR sczKey = NULL;
     LPWSTR sczValue = NULL;
-    HKEY hKey = NULL;
+    REG_SNAPSHOT_HANDLE hSnapshot = NULL;
     DWORD dwType = 0;
     BOOL fExists = FALSE;
-    REGSAM samDesired = KEY_QUERY_VALUE;
-
-    if (pSearch->RegistrySearch.fWin64)
-    {
-        samDesired = samDesired | KEY_WOW64_64KEY;
-    }
 
     // format key string
     hr = VariableFormatString(pVariables, pSearch->RegistrySearch.sczKey, &sczKey, NULL);
     ExitOnFailure(hr, "Failed to format key string.");
 
     // open key
-    hr = RegOpen(pSearch->RegistrySearch.hRoot, sczKey, samDesired, &hKey);
+    hr = GetRegistrySnapshot(pRegistry, pSearch->RegistrySearch.hRoot, sczKey, pSearch->RegistrySearch.fWin64, &hSnapshot);
     if (SUCCEEDED(hr))
     {
         fExists = TRUE;
@@ -787,19 +1956,21 @@ static HRESULT RegistrySearchExists(
         ExitOnFailure(hr, "Failed to format value string.");
 
         // query value
-        er = ::RegQueryValueExW(hKey, sczValue, NULL, &dwType, NULL, NULL);
-        switch (er)
+        hr = RegSnapshotGetType(hSnapshot, sczValue, &dwType);
+        if (SUCCEEDED(hr))
         {
-        case ERROR_SUCCESS:
             fExists = TRUE;
-            break;
-        case ERROR_FILE_NOT_FOUND:
+        }
+        else if (E_FILENOTFOUND == hr)
+        {
             // What if there is a hidden variable in sczKey or sczValue?
             LogStringLine(REPORT_STANDARD, "Registry value not found. Key = '%ls', Value = '%ls'", sczKey, sczValue);
             fExists = FALSE;
-            break;
-        default:
-            ExitOnWin32Error(er, hr, "Failed to query registry key value.");
+            hr = S_OK;
+        }
+        else
+        {
+            ExitOnFailure(hr, "Failed to query registry key value.");
         }
     }
 
@@ -816,32 +1987,25 @@ LExit:
 
     StrSecureZeroFreeString(sczKey);
     StrSecureZeroFreeString(sczValue);
-    ReleaseRegKey(hKey);
 
     return hr;
 }
 
 static HRESULT RegistrySearchValue(
     __in BURN_SEARCH* pSearch,
-    __in BURN_VARIABLES* pVariables
+    __in BURN_VARIABLES* pVariables,
+    __in SEARCH_REGISTRY* pRegistry
     )
 {
     HRESULT hr = S_OK;
-    DWORD er = ERROR_SUCCESS;
     LPWSTR sczKey = NULL;
     LPWSTR sczValue = NULL;
-    HKEY hKey = NULL;
+    REG_SNAPSHOT_HANDLE hSnapshot = NULL;
     DWORD dwType = 0;
     DWORD cbData = 0;
     LPBYTE pData = NULL;
     DWORD cch = 0;
     BURN_VARIANT value = { };
-    REGSAM samDesired = KEY_QUERY_VALUE;
-
-    if (pSearch->RegistrySearch.fWin64)
-    {
-        samDesired = samDesired | KEY_WOW64_64KEY;
-    }
 
     // format key string
     hr = VariableFormatString(pVariables, pSearch->RegistrySearch.sczKey, &sczKey, NULL);
@@ -855,7 +2019,7 @@ static HRESULT RegistrySearchValue(
     }
 
     // open key
-    hr = RegOpen(pSearch->RegistrySearch.hRoot, sczKey, samDesired, &hKey);
+    hr = GetRegistrySnapshot(pRegistry, pSearch->RegistrySearch.hRoot, sczKey, pSearch->RegistrySearch.fWin64, &hSnapshot);
     if (E_FILENOTFOUND == hr)
     {
         // What if there is a hidden variable in sczKey?
@@ -866,9 +2030,9 @@ static HRESULT RegistrySearchValue(
     }
     ExitOnFailure(hr, "Failed to open registry key.");
 
-    // get value
-    er = ::RegQueryValueExW(hKey, sczValue, NULL, &dwType, NULL, &cbData);
-    if (ERROR_FILE_NOT_FOUND == er)
+    // get value, the snapshot always null terminates the data for REG_SZ
+    hr = RegSnapshotReadValue(hSnapshot, sczValue, &dwType, &pData, &cbData);
+    if (E_FILENOTFOUND == hr)
     {
         // What if there is a hidden variable in sczKey or sczValue?
         LogStringLine(REPORT_STANDARD, "Registry value not found. Key = '%ls', Value = '%ls'", sczKey, sczValue);
@@ -876,13 +2040,7 @@ static HRESULT RegistrySearchValue(
         ExitOnFailure(hr, "Failed to clear variable.");
         ExitFunction1(hr = S_OK);
     }
-    ExitOnWin32Error(er, hr, "Failed to query registry key value size.");
-
-    pData = (LPBYTE)MemAlloc(cbData + sizeof(WCHAR), TRUE); // + sizeof(WCHAR) here to ensure that we always have a null terminator for REG_SZ
-    ExitOnNull(pData, hr, E_OUTOFMEMORY, "Failed to allocate memory registry value.");
-
-    er = ::RegQueryValueExW(hKey, sczValue, NULL, &dwType, pData, &cbData);
-    ExitOnWin32Error(er, hr, "Failed to query registry key value.");
+    ExitOnFailure(hr, "Failed to query registry key value.");
 
     switch (dwType)
     {
@@ -946,7 +2104,6 @@ LExit:
 
     StrSecureZeroFreeString(sczKey);
     StrSecureZeroFreeString(sczValue);
-    ReleaseRegKey(hKey);
     ReleaseMem(pData);
     BVariantUninitialize(&value);
 
@@ -123,6 +123,10 @@ typedef struct _BURN_SEARCH
             LPWSTR sczFeatureId;
         } MsiFeatureSearch;
     };
+
+    // later searches that read or set a variable this search reads or sets, so must run after it.
+    DWORD* rgdwDependents;
+    DWORD cDependents;
 } BURN_SEARCH;
 
 typedef struct _BURN_SEARCHES
@@ -140,7 +144,8 @@ HRESULT SearchesParseFromXml(
     );
 HRESULT SearchesExecute(
     __in BURN_SEARCHES* pSearches,
-    __in BURN_VARIABLES* pVariables
+    __in BURN_VARIABLES* pVariables,
+    __in_z_opt LPCWSTR wzCacheFile
     );
 void SearchesUninitialize(
     __in BURN_SEARCHES* pSearches
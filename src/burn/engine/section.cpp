@@ -269,13 +269,14 @@ extern "C" HRESULT SectionGetAttachedContainerInfo(
 {
     HRESULT hr = S_OK;
 
-    // validate container info
+    // validate container info, the section format is that of the UX container while attached payload
+    // containers may also be chunked, which their own header identifies.
     if (iContainerIndex >= pSection->cContainers)
     {
         hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
         ExitOnRootFailure1(hr, "Failed to find container info, too few elements: %u", pSection->cContainers);
     }
-    else if (dwExpectedType != pSection->dwFormat)
+    else if (dwExpectedType != pSection->dwFormat && (0 == iContainerIndex || BURN_CONTAINER_TYPE_CHUNKED != dwExpectedType))
     {
         hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
         ExitOnRootFailure(hr, "Unexpected container format.");
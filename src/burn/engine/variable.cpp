@@ -17,7 +17,10 @@ typedef const struct _BUILT_IN_VARIABLE_DECLARATION
 
 // constants
 
-const DWORD GROW_VARIABLE_ARRAY = 3;
+const DWORD INITIAL_VARIABLE_ARRAY_SIZE = 128;
+const DWORD INITIAL_VARIABLE_HASH_BUCKETS = 256;
+const DWORD FORMAT_TEMPLATE_CACHE_BUCKETS = 1024; // must be a power of two.
+const DWORD MAX_FORMAT_TEMPLATES = FORMAT_TEMPLATE_CACHE_BUCKETS / 2;
 
 enum OS_INFO_VARIABLE
 {
@@ -47,14 +50,101 @@ enum SET_VARIABLE
     SET_VARIABLE_ANY,
 };
 
+typedef VOID (WINAPI *PFN_SRWLOCK)(
+    __inout PVOID pvSrwLock
+    );
+
+
+// internal globals
+
+// slim reader/writer locks only exist on Vista and later, so they are looked up at runtime
+// and the variables fall back to csAccess (which serializes readers too) when they are missing.
+static PFN_SRWLOCK vpfnAcquireSRWLockShared = NULL;
+static PFN_SRWLOCK vpfnReleaseSRWLockShared = NULL;
+static PFN_SRWLOCK vpfnAcquireSRWLockExclusive = NULL;
+static PFN_SRWLOCK vpfnReleaseSRWLockExclusive = NULL;
+
+
 // internal function declarations
 
+static void LockVariables(
+    __in BURN_VARIABLES* pVariables,
+    __in BOOL fExclusive
+    );
+static void UnlockVariables(
+    __in BURN_VARIABLES* pVariables,
+    __in BOOL fExclusive
+    );
+static HRESULT LockVariableForRead(
+    __in BURN_VARIABLES* pVariables,
+    __in_z LPCWSTR wzVariable,
+    __inout_opt DWORD* pdwReference,
+    __out BURN_VARIABLE** ppVariable,
+    __out BOOL* pfExclusive
+    );
+static HRESULT GetFormattedVariable(
+    __in BURN_VARIABLES* pVariables,
+    __in_z LPCWSTR wzVariable,
+    __out_z LPWSTR* psczValue,
+    __in_opt BURN_FORMAT_DEPENDENCIES* pDependencies
+    );
 static HRESULT FormatString(
     __in BURN_VARIABLES* pVariables,
     __in_z LPCWSTR wzIn,
     __out_z_opt LPWSTR* psczOut,
     __out_opt DWORD* pcchOut,
-    __in BOOL fObfuscateHiddenVariables
+    __in BOOL fObfuscateHiddenVariables,
+    __in BOOL fCacheTemplate,
+    __in_opt BURN_FORMAT_DEPENDENCIES* pDependencies
+    );
+static HRESULT FormatTemplateWithMsi(
+    __in BURN_FORMAT_TEMPLATE* pTemplate,
+    __in_ecount(pTemplate->cSlots) LPWSTR* rgsczValues,
+    __in BOOL fObfuscateHiddenVariables,
+    __out_z_opt LPWSTR* psczOut,
+    __out DWORD* pcchOut
+    );
+static HRESULT GetFormatTemplate(
+    __in BURN_VARIABLES* pVariables,
+    __in_z LPCWSTR wzIn,
+    __in BOOL fCacheTemplate,
+    __out BURN_FORMAT_TEMPLATE** ppTemplate,
+    __out BURN_FORMAT_TEMPLATE** ppUncachedTemplate
+    );
+static HRESULT CompileFormatTemplate(
+    __in_z LPCWSTR wzIn,
+    __in DWORD dwHash,
+    __out BURN_FORMAT_TEMPLATE** ppTemplate
+    );
+static HRESULT AppendFormatToken(
+    __in BURN_FORMAT_TEMPLATE* pTemplate,
+    __in BURN_FORMAT_TOKEN_TYPE type,
+    __in_ecount(cch) LPCWSTR wz,
+    __in DWORD cch,
+    __inout DWORD* pcOpenGroups
+    );
+static void FreeFormatTemplate(
+    __in BURN_FORMAT_TEMPLATE* pTemplate
+    );
+static void ClearFormatTemplateCache(
+    __in BURN_VARIABLES* pVariables
+    );
+static HRESULT RecordFormatDependency(
+    __in_opt BURN_FORMAT_DEPENDENCIES* pDependencies,
+    __in DWORD dwReference,
+    __in BOOL fHidden
+    );
+static HRESULT MergeFormatDependencies(
+    __in_opt BURN_FORMAT_DEPENDENCIES* pDependencies,
+    __in BURN_FORMAT_DEPENDENCIES* pSource
+    );
+static BOOL FormatDependenciesChangedSince(
+    __in BURN_VARIABLES* pVariables,
+    __in BURN_FORMAT_DEPENDENCIES* pDependencies,
+    __in DWORD64 qwGeneration
+    );
+static void ReleaseFormatDependencies(
+    __in BURN_FORMAT_DEPENDENCIES* pDependencies
     );
 static HRESULT AddBuiltInVariable(
     __in BURN_VARIABLES* pVariables,
@@ -64,9 +154,9 @@ static HRESULT AddBuiltInVariable(
     __in BOOL fPersist,
     __in BOOL fOverridable
     );
-static HRESULT GetVariable(
+static HRESULT GetVariableByIndex(
     __in BURN_VARIABLES* pVariables,
-    __in_z LPCWSTR wzVariable,
+    __in DWORD iVariable,
     __out BURN_VARIABLE** ppVariable
     );
 static HRESULT FindVariableIndexByName(
@@ -77,7 +167,17 @@ static HRESULT FindVariableIndexByName(
 static HRESULT InsertVariable(
     __in BURN_VARIABLES* pVariables,
     __in_z LPCWSTR wzVariable,
-    __in DWORD iPosition
+    __out DWORD* piVariable
+    );
+static HRESULT GrowVariableHashBuckets(
+    __in BURN_VARIABLES* pVariables
+    );
+static DWORD HashVariableName(
+    __in_z LPCWSTR wzVariable
+    );
+static BOOL VariableNameEquals(
+    __in_z LPCWSTR wzVariable1,
+    __in_z LPCWSTR wzVariable2
     );
 static HRESULT SetVariableValue(
     __in BURN_VARIABLES* pVariables,
@@ -87,6 +187,14 @@ static HRESULT SetVariableValue(
     __in SET_VARIABLE setBuiltin,
     __in BOOL fLog
     );
+static HRESULT SetVariableValueLocked(
+    __in BURN_VARIABLES* pVariables,
+    __in_z LPCWSTR wzVariable,
+    __in BURN_VARIANT* pVariant,
+    __in BOOL fLiteral,
+    __in SET_VARIABLE setBuiltin,
+    __in BOOL fLog
+    );
 static HRESULT InitializeVariableVersionNT(
     __in DWORD_PTR dwpData,
     __inout BURN_VARIANT* pValue
@@ -196,8 +304,36 @@ extern "C" HRESULT VariableInitialize(
     )
 {
     HRESULT hr = S_OK;
+    HMODULE hKernel32 = NULL;
+    PFN_SRWLOCK pfnAcquireShared = NULL;
+    PFN_SRWLOCK pfnReleaseShared = NULL;
+    PFN_SRWLOCK pfnAcquireExclusive = NULL;
+    PFN_SRWLOCK pfnReleaseExclusive = NULL;
 
     ::InitializeCriticalSection(&pVariables->csAccess);
+    ::InitializeCriticalSection(&pVariables->csCache);
+    pVariables->pvSrwLock = NULL; // same as SRWLOCK_INIT.
+
+    if (!vpfnAcquireSRWLockShared)
+    {
+        hKernel32 = ::GetModuleHandleW(L"kernel32");
+        if (hKernel32)
+        {
+            pfnAcquireShared = reinterpret_cast<PFN_SRWLOCK>(::GetProcAddress(hKernel32, "AcquireSRWLockShared"));
+            pfnReleaseShared = reinterpret_cast<PFN_SRWLOCK>(::GetProcAddress(hKernel32, "ReleaseSRWLockShared"));
+            pfnAcquireExclusive = reinterpret_cast<PFN_SRWLOCK>(::GetProcAddress(hKernel32, "AcquireSRWLockExclusive"));
+            pfnReleaseExclusive = reinterpret_cast<PFN_SRWLOCK>(::GetProcAddress(hKernel32, "ReleaseSRWLockExclusive"));
+        }
+
+        // use them only if the whole set is there
+        if (pfnAcquireShared && pfnReleaseShared && pfnAcquireExclusive && pfnReleaseExclusive)
+        {
+            vpfnReleaseSRWLockShared = pfnReleaseShared;
+            vpfnAcquireSRWLockExclusive = pfnAcquireExclusive;
+            vpfnReleaseSRWLockExclusive = pfnReleaseExclusive;
+            vpfnAcquireSRWLockShared = pfnAcquireShared;
+        }
+    }
 
     const BUILT_IN_VARIABLE_DECLARATION vrgBuiltInVariables[] = {
         {L"AdminToolsFolder", InitializeVariableCsidlFolder, CSIDL_ADMINTOOLS},
@@ -306,7 +442,7 @@ extern "C" HRESULT VariablesParseFromXml(
     BOOL fPersisted = FALSE;
     DWORD iVariable = 0;
 
-    ::EnterCriticalSection(&pVariables->csAccess);
+    LockVariables(pVariables, TRUE);
 
     // select variable nodes
     hr = XmlSelectNodes(pixnBundle, L"Variable", &pixnNodes);
@@ -398,7 +534,7 @@ extern "C" HRESULT VariablesParseFromXml(
         // insert element if not found
         if (S_FALSE == hr)
         {
-            hr = InsertVariable(pVariables, sczId, iVariable);
+            hr = InsertVariable(pVariables, sczId, &iVariable);
             ExitOnFailure(hr, "Failed to insert variable '%ls'.", sczId);
         }
         else if (BURN_VARIABLE_INTERNAL_TYPE_NORMAL < pVariables->rgVariables[iVariable].internalType)
@@ -416,6 +552,8 @@ extern "C" HRESULT VariablesParseFromXml(
         hr = BVariantSetEncryption(&pVariables->rgVariables[iVariable].Value, fHidden);
         ExitOnFailure(hr, "Failed to set variant encryption");
 
+        pVariables->rgVariables[iVariable].qwGeneration = ++pVariables->qwGeneration;
+
         // prepare next iteration
         ReleaseNullObject(pixnNode);
         BVariantUninitialize(&value);
@@ -423,7 +561,7 @@ extern "C" HRESULT VariablesParseFromXml(
     }
 
 LExit:
-    ::LeaveCriticalSection(&pVariables->csAccess);
+    UnlockVariables(pVariables, TRUE);
 
     ReleaseObject(pixnNodes);
     ReleaseObject(pixnNode);
@@ -439,6 +577,7 @@ extern "C" void VariablesUninitialize(
     )
 {
     ::DeleteCriticalSection(&pVariables->csAccess);
+    ::DeleteCriticalSection(&pVariables->csCache);
 
     if (pVariables->rgVariables)
     {
@@ -453,6 +592,23 @@ extern "C" void VariablesUninitialize(
         }
         MemFree(pVariables->rgVariables);
     }
+
+    ReleaseMem(pVariables->rgdwHashBuckets);
+    ReleaseMem(pVariables->sync.rgdwIndexes);
+
+    ConditionUninitializeCache(pVariables);
+
+    if (pVariables->rgpFormatTemplateBuckets)
+    {
+        for (DWORD i = 0; i < FORMAT_TEMPLATE_CACHE_BUCKETS; ++i)
+        {
+            if (pVariables->rgpFormatTemplateBuckets[i])
+            {
+                FreeFormatTemplate(pVariables->rgpFormatTemplateBuckets[i]);
+            }
+        }
+        MemFree(pVariables->rgpFormatTemplateBuckets);
+    }
 }
 
 extern "C" void VariablesDump(
@@ -470,14 +626,8 @@ extern "C" void VariablesDump(
             hr = StrAllocFormatted(&sczValue, L"%ls = [%ls]", pVariable->sczName, pVariable->sczName);
             if (SUCCEEDED(hr))
             {
-                if (pVariable->fHidden)
-                {
-                    hr = VariableFormatStringObfuscated(pVariables, sczValue, &sczValue, NULL);
-                }
-                else
-                {
-                    hr = VariableFormatString(pVariables, sczValue, &sczValue, NULL);
-                }
+                // every dumped string is different so don't let them crowd out the format template cache
+                hr = FormatString(pVariables, sczValue, &sczValue, NULL, pVariable->fHidden, FALSE, NULL);
             }
 
             if (FAILED(hr))
@@ -504,10 +654,9 @@ extern "C" HRESULT VariableGetNumeric(
 {
     HRESULT hr = S_OK;
     BURN_VARIABLE* pVariable = NULL;
+    BOOL fExclusive = FALSE;
 
-    ::EnterCriticalSection(&pVariables->csAccess);
-
-    hr = GetVariable(pVariables, wzVariable, &pVariable);
+    hr = LockVariableForRead(pVariables, wzVariable, NULL, &pVariable, &fExclusive);
     if (SUCCEEDED(hr) && BURN_VARIANT_TYPE_NONE == pVariable->Value.Type)
     {
         ExitFunction1(hr = E_NOTFOUND);
@@ -522,7 +671,7 @@ extern "C" HRESULT VariableGetNumeric(
     ExitOnFailure(hr, "Failed to get value as numeric for variable: %ls", wzVariable);
 
 LExit:
-    ::LeaveCriticalSection(&pVariables->csAccess);
+    UnlockVariables(pVariables, fExclusive);
 
     return hr;
 }
@@ -536,10 +685,9 @@ extern "C" HRESULT VariableGetString(
 {
     HRESULT hr = S_OK;
     BURN_VARIABLE* pVariable = NULL;
+    BOOL fExclusive = FALSE;
 
-    ::EnterCriticalSection(&pVariables->csAccess);
-
-    hr = GetVariable(pVariables, wzVariable, &pVariable);
+    hr = LockVariableForRead(pVariables, wzVariable, NULL, &pVariable, &fExclusive);
     if (SUCCEEDED(hr) && BURN_VARIANT_TYPE_NONE == pVariable->Value.Type)
     {
         ExitFunction1(hr = E_NOTFOUND);
@@ -554,7 +702,7 @@ extern "C" HRESULT VariableGetString(
     ExitOnFailure(hr, "Failed to get value as string for variable: %ls", wzVariable);
 
 LExit:
-    ::LeaveCriticalSection(&pVariables->csAccess);
+    UnlockVariables(pVariables, fExclusive);
 
     return hr;
 }
@@ -568,10 +716,9 @@ extern "C" HRESULT VariableGetVersion(
 {
     HRESULT hr = S_OK;
     BURN_VARIABLE* pVariable = NULL;
+    BOOL fExclusive = FALSE;
 
-    ::EnterCriticalSection(&pVariables->csAccess);
-
-    hr = GetVariable(pVariables, wzVariable, &pVariable);
+    hr = LockVariableForRead(pVariables, wzVariable, NULL, &pVariable, &fExclusive);
     if (SUCCEEDED(hr) && BURN_VARIANT_TYPE_NONE == pVariable->Value.Type)
     {
         ExitFunction1(hr = E_NOTFOUND);
@@ -586,7 +733,7 @@ extern "C" HRESULT VariableGetVersion(
     ExitOnFailure(hr, "Failed to get value as version for variable: %ls", wzVariable);
 
 LExit:
-    ::LeaveCriticalSection(&pVariables->csAccess);
+    UnlockVariables(pVariables, fExclusive);
 
     return hr;
 }
@@ -599,10 +746,9 @@ extern "C" HRESULT VariableGetVariant(
 {
     HRESULT hr = S_OK;
     BURN_VARIABLE* pVariable = NULL;
+    BOOL fExclusive = FALSE;
 
-    ::EnterCriticalSection(&pVariables->csAccess);
-
-    hr = GetVariable(pVariables, wzVariable, &pVariable);
+    hr = LockVariableForRead(pVariables, wzVariable, NULL, &pVariable, &fExclusive);
     if (E_NOTFOUND == hr)
     {
         ExitFunction();
@@ -613,57 +759,97 @@ extern "C" HRESULT VariableGetVariant(
     ExitOnFailure(hr, "Failed to copy value of variable: %ls", wzVariable);
 
 LExit:
-    ::LeaveCriticalSection(&pVariables->csAccess);
+    UnlockVariables(pVariables, fExclusive);
 
     return hr;
 }
 
-// The contents of psczValue may be sensitive, should keep encrypted and SecureZeroFree.
-extern "C" HRESULT VariableGetFormatted(
+//
+// VariableGetVariantByReference - gets a copy of a variable's value like VariableGetVariant.
+// pdwReference must start at zero and is filled in the first time the variable is found so later
+// calls with the same pVariables skip the lookup.
+//
+extern "C" HRESULT VariableGetVariantByReference(
     __in BURN_VARIABLES* pVariables,
     __in_z LPCWSTR wzVariable,
-    __out_z LPWSTR* psczValue
+    __inout DWORD* pdwReference,
+    __in BURN_VARIANT* pValue
     )
 {
     HRESULT hr = S_OK;
     BURN_VARIABLE* pVariable = NULL;
-    LPWSTR scz = NULL;
-
-    ::EnterCriticalSection(&pVariables->csAccess);
+    BOOL fExclusive = FALSE;
 
-    hr = GetVariable(pVariables, wzVariable, &pVariable);
-    if (SUCCEEDED(hr) && BURN_VARIANT_TYPE_NONE == pVariable->Value.Type)
-    {
-        ExitFunction1(hr = E_NOTFOUND);
-    }
-    else if (E_NOTFOUND == hr)
+    hr = LockVariableForRead(pVariables, wzVariable, pdwReference, &pVariable, &fExclusive);
+    if (E_NOTFOUND == hr)
     {
         ExitFunction();
     }
-    ExitOnFailure(hr, "Failed to get variable: %ls", wzVariable);
+    ExitOnFailure(hr, "Failed to get value of variable: %ls", wzVariable);
 
-    // Strings need to get expanded unless they're built-in or literal because they're guaranteed not to have embedded variables.
-    if (BURN_VARIANT_TYPE_STRING == pVariable->Value.Type &&
-        BURN_VARIABLE_INTERNAL_TYPE_NORMAL == pVariable->internalType &&
-        !pVariable->fLiteral)
-    {
-        hr = BVariantGetString(&pVariable->Value, &scz);
-        ExitOnFailure(hr, "Failed to get unformatted string.");
+    hr = BVariantCopy(&pVariable->Value, pValue);
+    ExitOnFailure(hr, "Failed to copy value of variable: %ls", wzVariable);
+
+LExit:
+    UnlockVariables(pVariables, fExclusive);
+
+    return hr;
+}
+
+//
+// VariableHasChangedSince - returns whether the variable behind dwReference (see
+// VariableGetVariantByReference) was set after generation qwGeneration of the store. A zero
+// reference means the variable did not exist, so the answer is whether any variable was added.
+//
+extern "C" BOOL VariableHasChangedSince(
+    __in BURN_VARIABLES* pVariables,
+    __in DWORD dwReference,
+    __in DWORD64 qwGeneration
+    )
+{
+    BOOL fChanged = FALSE;
+
+    LockVariables(pVariables, FALSE);
 
-        hr = VariableFormatString(pVariables, scz, psczValue, NULL);
-        ExitOnFailure(hr, "Failed to format value '%ls' of variable: %ls", pVariable->fHidden ? L"*****" : pVariable->Value.sczValue, wzVariable);
+    if (dwReference)
+    {
+        fChanged = qwGeneration < pVariables->rgVariables[dwReference - 1].qwGeneration;
     }
     else
     {
-        hr = BVariantGetString(&pVariable->Value, psczValue);
-        ExitOnFailure(hr, "Failed to get value as string for variable: %ls", wzVariable);
+        fChanged = qwGeneration < pVariables->qwInsertGeneration;
     }
 
-LExit:
-    ::LeaveCriticalSection(&pVariables->csAccess);
-    StrSecureZeroFreeString(scz);
+    UnlockVariables(pVariables, FALSE);
 
-    return hr;
+    return fChanged;
+}
+
+//
+// VariableGetGeneration - returns the current generation of the store. Results computed from the
+// variables can be tagged with it and checked later with VariableHasChangedSince.
+//
+extern "C" DWORD64 VariableGetGeneration(
+    __in BURN_VARIABLES* pVariables
+    )
+{
+    DWORD64 qwGeneration = 0;
+
+    LockVariables(pVariables, FALSE);
+    qwGeneration = pVariables->qwGeneration;
+    UnlockVariables(pVariables, FALSE);
+
+    return qwGeneration;
+}
+
+// The contents of psczValue may be sensitive, should keep encrypted and SecureZeroFree.
+extern "C" HRESULT VariableGetFormatted(
+    __in BURN_VARIABLES* pVariables,
+    __in_z LPCWSTR wzVariable,
+    __out_z LPWSTR* psczValue
+    )
+{
+    return GetFormattedVariable(pVariables, wzVariable, psczValue, NULL);
 }
 
 extern "C" HRESULT VariableSetNumeric(
@@ -747,7 +933,7 @@ extern "C" HRESULT VariableFormatString(
     __out_opt DWORD* pcchOut
     )
 {
-    return FormatString(pVariables, wzIn, psczOut, pcchOut, FALSE);
+    return FormatString(pVariables, wzIn, psczOut, pcchOut, FALSE, TRUE, NULL);
 }
 
 extern "C" HRESULT VariableFormatStringObfuscated(
@@ -757,7 +943,7 @@ extern "C" HRESULT VariableFormatStringObfuscated(
     __out_opt DWORD* pcchOut
     )
 {
-    return FormatString(pVariables, wzIn, psczOut, pcchOut, TRUE);
+    return FormatString(pVariables, wzIn, psczOut, pcchOut, TRUE, TRUE, NULL);
 }
 
 extern "C" HRESULT VariableEscapeString(
@@ -828,7 +1014,8 @@ extern "C" HRESULT VariableSerialize(
     LPWSTR scz = NULL;
     DWORD64 qw = 0;
 
-    ::EnterCriticalSection(&pVariables->csAccess);
+    // Hidden values are decrypted in place while they are read so this needs the lock to itself.
+    LockVariables(pVariables, TRUE);
 
     // Write variable count.
     hr = BuffWriteNumber(ppbBuffer, piBuffer, pVariables->cVariables);
@@ -904,7 +1091,7 @@ extern "C" HRESULT VariableSerialize(
     }
 
 LExit:
-    ::LeaveCriticalSection(&pVariables->csAccess);
+    UnlockVariables(pVariables, TRUE);
     SecureZeroMemory(&ll, sizeof(ll));
     SecureZeroMemory(&qw, sizeof(qw));
     StrSecureZeroFreeString(scz);
@@ -929,7 +1116,7 @@ extern "C" HRESULT VariableDeserialize(
     LPWSTR scz = NULL;
     DWORD64 qw = 0;
 
-    ::EnterCriticalSection(&pVariables->csAccess);
+    LockVariables(pVariables, TRUE);
 
     // Read variable count.
     hr = BuffReadNumber(pbBuffer, cbBuffer, piBuffer, &cVariables);
@@ -997,7 +1184,7 @@ extern "C" HRESULT VariableDeserialize(
         ExitOnFailure(hr, "Failed to read variable literal flag.");
 
         // Set variable.
-        hr = SetVariableValue(pVariables, sczName, &value, fLiteral, fWasPersisted ? SET_VARIABLE_OVERRIDE_PERSISTED_BUILTINS : SET_VARIABLE_ANY, FALSE);
+        hr = SetVariableValueLocked(pVariables, sczName, &value, fLiteral, fWasPersisted ? SET_VARIABLE_OVERRIDE_PERSISTED_BUILTINS : SET_VARIABLE_ANY, FALSE);
         ExitOnFailure(hr, "Failed to set variable.");
 
         // Clean up.
@@ -1005,7 +1192,7 @@ extern "C" HRESULT VariableDeserialize(
     }
 
 LExit:
-    ::LeaveCriticalSection(&pVariables->csAccess);
+    UnlockVariables(pVariables, TRUE);
 
     ReleaseStr(sczName);
     BVariantUninitialize(&value);
@@ -1015,117 +1202,407 @@ LExit:
     return hr;
 }
 
-extern "C" HRESULT VariableStrAlloc(
-    __in BOOL fZeroOnRealloc,
-    __deref_out_ecount_part(cch, 0) LPWSTR* ppwz,
-    __in DWORD_PTR cch
+//
+// VariableSerializeChanges - writes the variables that changed since the other process last
+// acknowledged a sync with VariableAcknowledgeChanges. Variables the other process has seen before
+// are written by index instead of by name.
+//
+// The changes are written as a count followed by one entry per variable. All
+// numbers use BuffWriteVarNumber64 so most of them take a single byte:
+//   index << 1 | name follows, the variable's index in the sending process.
+//   name, only the first time the variable is sent.
+//   type << 1 | literal.
+//   value, zig-zag encoded for numerics so small negative values stay short.
+//
+extern "C" HRESULT VariableSerializeChanges(
+    __in BURN_VARIABLES* pVariables,
+    __inout BYTE** ppbBuffer,
+    __inout SIZE_T* piBuffer
     )
 {
     HRESULT hr = S_OK;
+    BURN_VARIABLES_SYNC* pSync = &pVariables->sync;
+    DWORD cChanged = 0;
+    BOOL fWriteName = FALSE;
+    LONGLONG ll = 0;
+    LPWSTR scz = NULL;
+    DWORD64 qw = 0;
 
-    if (fZeroOnRealloc)
+    // Hidden values are decrypted in place while they are read so this needs the lock to itself.
+    LockVariables(pVariables, TRUE);
+
+    // Built-in variables that the elevated process rejects are never sent.
+    for (DWORD i = 0; i < pVariables->cVariables; ++i)
     {
-        hr = StrAllocSecure(ppwz, cch);
+        BURN_VARIABLE* pVariable = &pVariables->rgVariables[i];
+        if (BURN_VARIABLE_INTERNAL_TYPE_BUILTIN != pVariable->internalType && pSync->qwGeneration < pVariable->qwGeneration)
+        {
+            ++cChanged;
+        }
     }
-    else
+
+    hr = BuffWriteVarNumber64(ppbBuffer, piBuffer, cChanged);
+    ExitOnFailure(hr, "Failed to write changed variable count.");
+
+    for (DWORD i = 0; i < pVariables->cVariables; ++i)
     {
-        hr = StrAlloc(ppwz, cch);
-    }
+        BURN_VARIABLE* pVariable = &pVariables->rgVariables[i];
+        if (BURN_VARIABLE_INTERNAL_TYPE_BUILTIN == pVariable->internalType || pSync->qwGeneration >= pVariable->qwGeneration)
+        {
+            continue;
+        }
 
-    return hr;
-}
+        // Variables added since the last sync are new to the other process.
+        fWriteName = pSync->cVariables <= i;
 
-extern "C" HRESULT VariableStrAllocString(
-    __in BOOL fZeroOnRealloc,
-    __deref_out_ecount_z(cchSource + 1) LPWSTR* ppwz,
-    __in_z LPCWSTR wzSource,
-    __in DWORD_PTR cchSource
-    )
-{
-    HRESULT hr = S_OK;
+        hr = BuffWriteVarNumber64(ppbBuffer, piBuffer, (static_cast<DWORD64>(i) << 1) | (fWriteName ? 1 : 0));
+        ExitOnFailure(hr, "Failed to write variable index.");
 
-    if (fZeroOnRealloc)
-    {
-        hr = StrAllocStringSecure(ppwz, wzSource, cchSource);
-    }
-    else
-    {
-        hr = StrAllocString(ppwz, wzSource, cchSource);
+        if (fWriteName)
+        {
+            hr = BuffWriteVarString(ppbBuffer, piBuffer, pVariable->sczName);
+            ExitOnFailure(hr, "Failed to write variable name.");
+        }
+
+        hr = BuffWriteVarNumber64(ppbBuffer, piBuffer, (static_cast<DWORD64>(pVariable->Value.Type) << 1) | (pVariable->fLiteral ? 1 : 0));
+        ExitOnFailure(hr, "Failed to write variable value type.");
+
+        switch (pVariable->Value.Type)
+        {
+        case BURN_VARIANT_TYPE_NONE:
+            break;
+        case BURN_VARIANT_TYPE_NUMERIC:
+            hr = BVariantGetNumeric(&pVariable->Value, &ll);
+            ExitOnFailure(hr, "Failed to get numeric.");
+
+            qw = (static_cast<DWORD64>(ll) << 1) ^ static_cast<DWORD64>(ll >> 63);
+
+            hr = BuffWriteVarNumber64(ppbBuffer, piBuffer, qw);
+            ExitOnFailure(hr, "Failed to write variable value as number.");
+
+            SecureZeroMemory(&ll, sizeof(ll));
+            SecureZeroMemory(&qw, sizeof(qw));
+            break;
+        case BURN_VARIANT_TYPE_VERSION:
+            hr = BVariantGetVersion(&pVariable->Value, &qw);
+            ExitOnFailure(hr, "Failed to get version.");
+
+            hr = BuffWriteVarNumber64(ppbBuffer, piBuffer, qw);
+            ExitOnFailure(hr, "Failed to write variable value as number.");
+
+            SecureZeroMemory(&qw, sizeof(qw));
+            break;
+        case BURN_VARIANT_TYPE_STRING:
+            hr = BVariantGetString(&pVariable->Value, &scz);
+            ExitOnFailure(hr, "Failed to get string.");
+
+            hr = BuffWriteVarString(ppbBuffer, piBuffer, scz);
+            ExitOnFailure(hr, "Failed to write variable value as string.");
+
+            ReleaseNullStrSecure(scz);
+            break;
+        default:
+            hr = E_INVALIDARG;
+            ExitOnFailure(hr, "Unsupported variable type.");
+        }
     }
 
+    pSync->qwPendingGeneration = pVariables->qwGeneration;
+    pSync->cPendingVariables = pVariables->cVariables;
+
+LExit:
+    UnlockVariables(pVariables, TRUE);
+    SecureZeroMemory(&ll, sizeof(ll));
+    SecureZeroMemory(&qw, sizeof(qw));
+    StrSecureZeroFreeString(scz);
+
     return hr;
 }
 
-extern "C" HRESULT VariableStrAllocConcat(
-    __in BOOL fZeroOnRealloc,
-    __deref_out_z LPWSTR* ppwz,
-    __in_z LPCWSTR wzSource,
-    __in DWORD_PTR cchSource
+//
+// VariableAcknowledgeChanges - records that the other process applied the changes written by the
+// last call to VariableSerializeChanges.
+//
+extern "C" void VariableAcknowledgeChanges(
+    __in BURN_VARIABLES* pVariables
     )
 {
-    HRESULT hr = S_OK;
+    LockVariables(pVariables, TRUE);
 
-    if (fZeroOnRealloc)
-    {
-        hr = StrAllocConcatSecure(ppwz, wzSource, cchSource);
-    }
-    else
-    {
-        hr = StrAllocConcat(ppwz, wzSource, cchSource);
-    }
+    pVariables->sync.qwGeneration = pVariables->sync.qwPendingGeneration;
+    pVariables->sync.cVariables = pVariables->sync.cPendingVariables;
 
-    return hr;
+    UnlockVariables(pVariables, TRUE);
 }
 
-extern "C" HRESULT __cdecl VariableStrAllocFormatted(
-    __in BOOL fZeroOnRealloc,
-    __deref_out_z LPWSTR* ppwz,
-    __in __format_string LPCWSTR wzFormat,
-    ...
+//
+// VariableResetChanges - forgets what the other process has so the next VariableSerializeChanges
+// writes every variable.
+//
+extern "C" void VariableResetChanges(
+    __in BURN_VARIABLES* pVariables
     )
 {
-    HRESULT hr = S_OK;
-    va_list args;
+    LockVariables(pVariables, TRUE);
 
-    va_start(args, wzFormat);
-    if (fZeroOnRealloc)
-    {
-        hr = StrAllocFormattedArgsSecure(ppwz, wzFormat, args);
-    }
-    else
-    {
-        hr = StrAllocFormattedArgs(ppwz, wzFormat, args);
-    }
-    va_end(args);
+    pVariables->sync.qwGeneration = 0;
+    pVariables->sync.cVariables = 0;
+    pVariables->sync.qwPendingGeneration = 0;
+    pVariables->sync.cPendingVariables = 0;
 
-    return hr;
+    UnlockVariables(pVariables, TRUE);
 }
 
-extern "C" HRESULT VariableIsHidden(
+//
+// VariableDeserializeChanges - applies variables written by VariableSerializeChanges in the other
+// process.
+//
+// Only the variables the other process changed are applied, so a variable this
+// process set itself keeps its value until the other process sets it again, where
+// sending every variable used to reset it at each sync. The per-user process sets the
+// variables the BA and the plan use, including the package log path variables, and
+// sends them before the elevated process acts on them, so its changes still win.
+// After the first sync the elevated process only sets built-in variables, which are
+// never sent either way.
+//
+extern "C" HRESULT VariableDeserializeChanges(
     __in BURN_VARIABLES* pVariables,
-    __in_z LPCWSTR wzVariable,
-    __out BOOL* pfHidden
+    __in_bcount(cbBuffer) BYTE* pbBuffer,
+    __in SIZE_T cbBuffer,
+    __inout SIZE_T* piBuffer
     )
 {
     HRESULT hr = S_OK;
-    BURN_VARIABLE* pVariable = NULL;
-
-    ::EnterCriticalSection(&pVariables->csAccess);
-
-    hr = GetVariable(pVariables, wzVariable, &pVariable);
-    if (E_NOTFOUND == hr)
-    {
-        // A missing variable does not need its data hidden.
-        *pfHidden = FALSE;
-
-        ExitFunction1(hr = S_OK);
+    BURN_VARIABLES_SYNC* pSync = &pVariables->sync;
+    DWORD64 qwChanged = 0;
+    DWORD64 qwIndex = 0;
+    DWORD64 qwType = 0;
+    DWORD iSender = 0;
+    DWORD iVariable = 0;
+    LPWSTR sczName = NULL;
+    LPCWSTR wzName = NULL;
+    BOOL fLiteral = FALSE;
+    BURN_VARIANT value = { };
+    LPWSTR scz = NULL;
+    DWORD64 qw = 0;
+
+    LockVariables(pVariables, TRUE);
+
+    hr = BuffReadVarNumber64(pbBuffer, cbBuffer, piBuffer, &qwChanged);
+    ExitOnFailure(hr, "Failed to read changed variable count.");
+
+    for (DWORD64 i = 0; i < qwChanged; ++i)
+    {
+        hr = BuffReadVarNumber64(pbBuffer, cbBuffer, piBuffer, &qwIndex);
+        ExitOnFailure(hr, "Failed to read variable index.");
+
+        if (DWORD_MAX <= (qwIndex >> 1))
+        {
+            hr = E_INVALIDARG;
+            ExitOnRootFailure(hr, "Invalid variable index.");
+        }
+        iSender = static_cast<DWORD>(qwIndex >> 1);
+
+        if (qwIndex & 1)
+        {
+            hr = BuffReadVarString(pbBuffer, cbBuffer, piBuffer, &sczName);
+            ExitOnFailure(hr, "Failed to read variable name.");
+
+            wzName = sczName;
+        }
+        else if (pSync->cIndexes <= iSender || !pSync->rgdwIndexes[iSender])
+        {
+            hr = E_INVALIDARG;
+            ExitOnRootFailure(hr, "Variable index was sent before its name: %u", iSender);
+        }
+        else
+        {
+            wzName = pVariables->rgVariables[pSync->rgdwIndexes[iSender] - 1].sczName;
+        }
+
+        hr = BuffReadVarNumber64(pbBuffer, cbBuffer, piBuffer, &qwType);
+        ExitOnFailure(hr, "Failed to read variable value type.");
+
+        fLiteral = static_cast<BOOL>(qwType & 1);
+        value.Type = static_cast<BURN_VARIANT_TYPE>(qwType >> 1);
+
+        switch (value.Type)
+        {
+        case BURN_VARIANT_TYPE_NONE:
+            break;
+        case BURN_VARIANT_TYPE_NUMERIC:
+            hr = BuffReadVarNumber64(pbBuffer, cbBuffer, piBuffer, &qw);
+            ExitOnFailure(hr, "Failed to read variable value as number.");
+
+            hr = BVariantSetNumeric(&value, static_cast<LONGLONG>((qw >> 1) ^ (0 - (qw & 1))));
+            ExitOnFailure(hr, "Failed to set variable value.");
+
+            SecureZeroMemory(&qw, sizeof(qw));
+            break;
+        case BURN_VARIANT_TYPE_VERSION:
+            hr = BuffReadVarNumber64(pbBuffer, cbBuffer, piBuffer, &qw);
+            ExitOnFailure(hr, "Failed to read variable value as number.");
+
+            hr = BVariantSetVersion(&value, qw);
+            ExitOnFailure(hr, "Failed to set variable value.");
+
+            SecureZeroMemory(&qw, sizeof(qw));
+            break;
+        case BURN_VARIANT_TYPE_STRING:
+            hr = BuffReadVarString(pbBuffer, cbBuffer, piBuffer, &scz);
+            ExitOnFailure(hr, "Failed to read variable value as string.");
+
+            hr = BVariantSetString(&value, scz, NULL);
+            ExitOnFailure(hr, "Failed to set variable value.");
+
+            ReleaseNullStrSecure(scz);
+            break;
+        default:
+            hr = E_INVALIDARG;
+            ExitOnFailure(hr, "Unsupported variable type.");
+        }
+
+        hr = SetVariableValueLocked(pVariables, wzName, &value, fLiteral, SET_VARIABLE_ANY, FALSE);
+        ExitOnFailure(hr, "Failed to set variable.");
+
+        // Remember where the name went so later changes can refer to the variable by index.
+        if (qwIndex & 1)
+        {
+            hr = FindVariableIndexByName(pVariables, sczName, &iVariable);
+            ExitOnFailure(hr, "Failed to find variable: %ls", sczName);
+
+            if (pSync->cIndexes <= iSender)
+            {
+                hr = MemEnsureArraySize(reinterpret_cast<LPVOID*>(&pSync->rgdwIndexes), iSender + 1, sizeof(DWORD), 64);
+                ExitOnFailure(hr, "Failed to grow variable index map.");
+
+                pSync->cIndexes = iSender + 1;
+            }
+
+            pSync->rgdwIndexes[iSender] = iVariable + 1;
+        }
+
+        BVariantUninitialize(&value);
+    }
+
+LExit:
+    UnlockVariables(pVariables, TRUE);
+
+    ReleaseStr(sczName);
+    BVariantUninitialize(&value);
+    SecureZeroMemory(&qw, sizeof(qw));
+    StrSecureZeroFreeString(scz);
+
+    return hr;
+}
+
+extern "C" HRESULT VariableStrAlloc(
+    __in BOOL fZeroOnRealloc,
+    __deref_out_ecount_part(cch, 0) LPWSTR* ppwz,
+    __in DWORD_PTR cch
+    )
+{
+    HRESULT hr = S_OK;
+
+    if (fZeroOnRealloc)
+    {
+        hr = StrAllocSecure(ppwz, cch);
+    }
+    else
+    {
+        hr = StrAlloc(ppwz, cch);
+    }
+
+    return hr;
+}
+
+extern "C" HRESULT VariableStrAllocString(
+    __in BOOL fZeroOnRealloc,
+    __deref_out_ecount_z(cchSource + 1) LPWSTR* ppwz,
+    __in_z LPCWSTR wzSource,
+    __in DWORD_PTR cchSource
+    )
+{
+    HRESULT hr = S_OK;
+
+    if (fZeroOnRealloc)
+    {
+        hr = StrAllocStringSecure(ppwz, wzSource, cchSource);
+    }
+    else
+    {
+        hr = StrAllocString(ppwz, wzSource, cchSource);
+    }
+
+    return hr;
+}
+
+extern "C" HRESULT VariableStrAllocConcat(
+    __in BOOL fZeroOnRealloc,
+    __deref_out_z LPWSTR* ppwz,
+    __in_z LPCWSTR wzSource,
+    __in DWORD_PTR cchSource
+    )
+{
+    HRESULT hr = S_OK;
+
+    if (fZeroOnRealloc)
+    {
+        hr = StrAllocConcatSecure(ppwz, wzSource, cchSource);
+    }
+    else
+    {
+        hr = StrAllocConcat(ppwz, wzSource, cchSource);
+    }
+
+    return hr;
+}
+
+extern "C" HRESULT __cdecl VariableStrAllocFormatted(
+    __in BOOL fZeroOnRealloc,
+    __deref_out_z LPWSTR* ppwz,
+    __in __format_string LPCWSTR wzFormat,
+    ...
+    )
+{
+    HRESULT hr = S_OK;
+    va_list args;
+
+    va_start(args, wzFormat);
+    if (fZeroOnRealloc)
+    {
+        hr = StrAllocFormattedArgsSecure(ppwz, wzFormat, args);
+    }
+    else
+    {
+        hr = StrAllocFormattedArgs(ppwz, wzFormat, args);
     }
+    va_end(args);
+
+    return hr;
+}
+
+extern "C" HRESULT VariableIsHidden(
+    __in BURN_VARIABLES* pVariables,
+    __in_z LPCWSTR wzVariable,
+    __out BOOL* pfHidden
+    )
+{
+    HRESULT hr = S_OK;
+    DWORD iVariable = 0;
+
+    LockVariables(pVariables, FALSE);
+
+    // Visibility doesn't depend on the value so built-in variables don't need to be initialized here.
+    hr = FindVariableIndexByName(pVariables, wzVariable, &iVariable);
     ExitOnFailure(hr, "Failed to get visibility of variable: %ls", wzVariable);
 
-    *pfHidden = pVariable->fHidden;
+    // A missing variable does not need its data hidden.
+    *pfHidden = S_OK == hr && pVariables->rgVariables[iVariable].fHidden;
+    hr = S_OK;
 
 LExit:
-    ::LeaveCriticalSection(&pVariables->csAccess);
+    UnlockVariables(pVariables, FALSE);
 
     return hr;
 }
@@ -1133,46 +1610,662 @@ LExit:
 
 // internal function definitions
 
-// The contents of psczOut may be sensitive, should keep encrypted and SecureZeroFree.
-static HRESULT FormatString(
+static void LockVariables(
     __in BURN_VARIABLES* pVariables,
-    __in_z LPCWSTR wzIn,
-    __out_z_opt LPWSTR* psczOut,
-    __out_opt DWORD* pcchOut,
-    __in BOOL fObfuscateHiddenVariables
+    __in BOOL fExclusive
+    )
+{
+    if (!vpfnAcquireSRWLockShared)
+    {
+        ::EnterCriticalSection(&pVariables->csAccess);
+    }
+    else if (fExclusive)
+    {
+        vpfnAcquireSRWLockExclusive(&pVariables->pvSrwLock);
+    }
+    else
+    {
+        vpfnAcquireSRWLockShared(&pVariables->pvSrwLock);
+    }
+}
+
+static void UnlockVariables(
+    __in BURN_VARIABLES* pVariables,
+    __in BOOL fExclusive
+    )
+{
+    if (!vpfnAcquireSRWLockShared)
+    {
+        ::LeaveCriticalSection(&pVariables->csAccess);
+    }
+    else if (fExclusive)
+    {
+        vpfnReleaseSRWLockExclusive(&pVariables->pvSrwLock);
+    }
+    else
+    {
+        vpfnReleaseSRWLockShared(&pVariables->pvSrwLock);
+    }
+}
+
+//
+// LockVariableForRead - finds a variable and locks the variables so its value
+//                       can be read. The lock is shared unless a built-in value
+//                       must be initialized first or the value is encrypted,
+//                       since both write to the variable. The lock is held on
+//                       return even on failure and must be released with
+//                       UnlockVariables(pVariables, *pfExclusive).
+//
+static HRESULT LockVariableForRead(
+    __in BURN_VARIABLES* pVariables,
+    __in_z LPCWSTR wzVariable,
+    __inout_opt DWORD* pdwReference,
+    __out BURN_VARIABLE** ppVariable,
+    __out BOOL* pfExclusive
+    )
+{
+    HRESULT hr = S_OK;
+    DWORD iVariable = 0;
+    BURN_VARIABLE* pVariable = NULL;
+
+    *pfExclusive = FALSE;
+    LockVariables(pVariables, FALSE);
+
+    // variables are never removed so once resolved the index stays valid
+    if (pdwReference && *pdwReference)
+    {
+        iVariable = *pdwReference - 1;
+    }
+    else
+    {
+        hr = FindVariableIndexByName(pVariables, wzVariable, &iVariable);
+        ExitOnFailure(hr, "Failed to find variable value '%ls'.", wzVariable);
+
+        if (S_FALSE == hr)
+        {
+            ExitFunction1(hr = E_NOTFOUND);
+        }
+
+        if (pdwReference)
+        {
+            ::InterlockedExchange(reinterpret_cast<LONG volatile*>(pdwReference), static_cast<LONG>(iVariable + 1));
+        }
+    }
+
+    pVariable = &pVariables->rgVariables[iVariable];
+    if (pVariable->Value.fEncryptValue || (BURN_VARIANT_TYPE_NONE == pVariable->Value.Type && BURN_VARIABLE_INTERNAL_TYPE_NORMAL < pVariable->internalType))
+    {
+        // SRW locks can't be upgraded so start over exclusively, the array may move while nothing is held
+        UnlockVariables(pVariables, FALSE);
+        LockVariables(pVariables, TRUE);
+        *pfExclusive = TRUE;
+    }
+
+    hr = GetVariableByIndex(pVariables, iVariable, ppVariable);
+    ExitOnFailure(hr, "Failed to get value of variable: %ls", wzVariable);
+
+LExit:
+    return hr;
+}
+
+// The contents of psczValue may be sensitive, should keep encrypted and SecureZeroFree.
+static HRESULT GetFormattedVariable(
+    __in BURN_VARIABLES* pVariables,
+    __in_z LPCWSTR wzVariable,
+    __out_z LPWSTR* psczValue,
+    __in_opt BURN_FORMAT_DEPENDENCIES* pDependencies
+    )
+{
+    HRESULT hr = S_OK;
+    BOOL fExclusive = FALSE;
+    BOOL fLocked = TRUE;
+    BURN_VARIABLE* pVariable = NULL;
+    BOOL fFormat = FALSE;
+    BOOL fHidden = FALSE;
+    LPWSTR scz = NULL;
+
+    hr = LockVariableForRead(pVariables, wzVariable, NULL, &pVariable, &fExclusive);
+    if (E_NOTFOUND == hr)
+    {
+        hr = RecordFormatDependency(pDependencies, 0, FALSE);
+        ExitOnFailure(hr, "Failed to record missing variable: %ls", wzVariable);
+
+        ExitFunction1(hr = E_NOTFOUND);
+    }
+    ExitOnFailure(hr, "Failed to get variable: %ls", wzVariable);
+
+    // let the template being rendered know which variables its result came from
+    hr = RecordFormatDependency(pDependencies, static_cast<DWORD>(pVariable - pVariables->rgVariables) + 1, pVariable->fHidden);
+    ExitOnFailure(hr, "Failed to record variable: %ls", wzVariable);
+
+    if (BURN_VARIANT_TYPE_NONE == pVariable->Value.Type)
+    {
+        ExitFunction1(hr = E_NOTFOUND);
+    }
+
+    // Strings need to get expanded unless they're built-in or literal because they're guaranteed not to have embedded variables.
+    fFormat = BURN_VARIANT_TYPE_STRING == pVariable->Value.Type &&
+              BURN_VARIABLE_INTERNAL_TYPE_NORMAL == pVariable->internalType &&
+              !pVariable->fLiteral;
+    fHidden = pVariable->fHidden;
+
+    hr = BVariantGetString(&pVariable->Value, fFormat ? &scz : psczValue);
+    ExitOnFailure(hr, "Failed to get value as string for variable: %ls", wzVariable);
+
+    // the value is a copy now, so other threads can read and write the variables while it is formatted
+    UnlockVariables(pVariables, fExclusive);
+    fLocked = FALSE;
+
+    if (fFormat)
+    {
+        // don't cache templates of hidden values since the template keeps a copy of the value
+        hr = FormatString(pVariables, scz, psczValue, NULL, FALSE, !fHidden, pDependencies);
+        ExitOnFailure(hr, "Failed to format value '%ls' of variable: %ls", fHidden ? L"*****" : scz, wzVariable);
+    }
+
+LExit:
+    if (fLocked)
+    {
+        UnlockVariables(pVariables, fExclusive);
+    }
+    StrSecureZeroFreeString(scz);
+
+    return hr;
+}
+
+// The contents of psczOut may be sensitive, should keep encrypted and SecureZeroFree.
+static HRESULT FormatString(
+    __in BURN_VARIABLES* pVariables,
+    __in_z LPCWSTR wzIn,
+    __out_z_opt LPWSTR* psczOut,
+    __out_opt DWORD* pcchOut,
+    __in BOOL fObfuscateHiddenVariables,
+    __in BOOL fCacheTemplate,
+    __in_opt BURN_FORMAT_DEPENDENCIES* pDependencies
+    )
+{
+    HRESULT hr = S_OK;
+    BOOL fCacheLocked = FALSE;
+    BURN_FORMAT_TEMPLATE* pTemplate = NULL;
+    BURN_FORMAT_TEMPLATE* pUncachedTemplate = NULL;
+    BURN_FORMAT_TOKEN* pToken = NULL;
+    LPWSTR* rgsczValues = NULL;
+    DWORD cValues = 0;
+    LPWSTR sczOut = NULL;
+    LPWSTR wzWrite = NULL;
+    LPCWSTR wzValue = NULL;
+    DWORD cchValue = 0;
+    DWORD cch = 0;
+    BOOL fHidden = FALSE;
+    BOOL fRecordDependencies = FALSE;
+    BURN_FORMAT_DEPENDENCIES dependencies = { };
+    DWORD64 qwGeneration = 0;
+
+    // nothing to expand, the string formats to itself
+    if (!wcschr(wzIn, L'['))
+    {
+        cch = lstrlenW(wzIn);
+
+        if (psczOut)
+        {
+            hr = VariableStrAllocString(!fObfuscateHiddenVariables, &sczOut, wzIn, cch);
+            ExitOnFailure(hr, "Failed to copy string.");
+        }
+
+        ExitFunction();
+    }
+
+    // the cache is only locked while it is looked at, never while variables are being read
+    ::EnterCriticalSection(&pVariables->csCache);
+    fCacheLocked = TRUE;
+
+    hr = GetFormatTemplate(pVariables, wzIn, fCacheTemplate, &pTemplate, &pUncachedTemplate);
+    ExitOnFailure(hr, "Failed to get format template.");
+
+    // cached templates remember their last result until a variable it was built from changes
+    if (!fObfuscateHiddenVariables && !pUncachedTemplate)
+    {
+        if (pTemplate->sczResult && !FormatDependenciesChangedSince(pVariables, &pTemplate->resultDependencies, pTemplate->qwResultGeneration))
+        {
+            cch = pTemplate->cchResult;
+
+            if (psczOut)
+            {
+                hr = VariableStrAllocString(TRUE, &sczOut, pTemplate->sczResult, cch);
+                ExitOnFailure(hr, "Failed to copy formatted result.");
+            }
+
+            // a template being rendered around this one depends on the same variables
+            hr = MergeFormatDependencies(pDependencies, &pTemplate->resultDependencies);
+            ExitOnFailure(hr, "Failed to record format dependencies.");
+
+            ExitFunction();
+        }
+
+        // taken before anything is read so a variable set while rendering makes the result stale
+        fRecordDependencies = TRUE;
+        qwGeneration = VariableGetGeneration(pVariables);
+    }
+
+    ::LeaveCriticalSection(&pVariables->csCache);
+    fCacheLocked = FALSE;
+
+    if (pTemplate->cSlots)
+    {
+        rgsczValues = (LPWSTR*)MemAlloc(sizeof(LPWSTR) * pTemplate->cSlots, TRUE);
+        ExitOnNull(rgsczValues, hr, E_OUTOFMEMORY, "Failed to allocate variable array.");
+    }
+
+    // resolve the slots, tallying the length of the formatted string as we go
+    cch = pTemplate->cchLiteral;
+
+    for (DWORD i = 0; i < pTemplate->cTokens; ++i)
+    {
+        pToken = &pTemplate->rgTokens[i];
+
+        if (BURN_FORMAT_TOKEN_TYPE_ESCAPE == pToken->type)
+        {
+            hr = VariableStrAllocString(!fObfuscateHiddenVariables, &rgsczValues[cValues], pToken->wz, pToken->cch);
+        }
+        else if (BURN_FORMAT_TOKEN_TYPE_VARIABLE == pToken->type)
+        {
+            if (fObfuscateHiddenVariables)
+            {
+                hr = VariableIsHidden(pVariables, pToken->sczName, &fHidden);
+                ExitOnFailure(hr, "Failed to determine variable visibility: '%ls'.", pToken->sczName);
+            }
+
+            if (fHidden)
+            {
+                hr = StrAllocString(&rgsczValues[cValues], L"*****", 0);
+            }
+            else
+            {
+                // get formatted variable value
+                hr = GetFormattedVariable(pVariables, pToken->sczName, &rgsczValues[cValues], fRecordDependencies ? &dependencies : pDependencies);
+                if (E_NOTFOUND == hr) // variable not found
+                {
+                    hr = StrAllocStringSecure(&rgsczValues[cValues], L"", 0);
+                }
+            }
+        }
+        else
+        {
+            continue;
+        }
+        ExitOnFailure(hr, "Failed to set variable value.");
+
+        hr = ::DWordAdd(cch, lstrlenW(rgsczValues[cValues]), &cch);
+        ExitOnRootFailure(hr, "Overflow while calculating formatted string length.");
+
+        ++cValues;
+    }
+
+    if (pTemplate->fRequiresMsi)
+    {
+        hr = FormatTemplateWithMsi(pTemplate, rgsczValues, fObfuscateHiddenVariables, psczOut ? &sczOut : NULL, &cch);
+        ExitOnFailure(hr, "Failed to format string with MSI.");
+    }
+    else if (psczOut)
+    {
+        // the lengths are known up front so write everything into a single buffer
+        hr = VariableStrAlloc(!fObfuscateHiddenVariables, &sczOut, static_cast<DWORD_PTR>(cch) + 1);
+        ExitOnFailure(hr, "Failed to allocate string.");
+
+        wzWrite = sczOut;
+        cValues = 0;
+
+        for (DWORD i = 0; i < pTemplate->cTokens; ++i)
+        {
+            pToken = &pTemplate->rgTokens[i];
+
+            if (BURN_FORMAT_TOKEN_TYPE_LITERAL == pToken->type)
+            {
+                wzValue = pToken->wz;
+                cchValue = pToken->cch;
+            }
+            else
+            {
+                wzValue = rgsczValues[cValues];
+                cchValue = lstrlenW(wzValue);
+                ++cValues;
+            }
+
+            memcpy(wzWrite, wzValue, sizeof(WCHAR) * cchValue);
+            wzWrite += cchValue;
+        }
+
+        *wzWrite = L'\0';
+    }
+
+    if (fRecordDependencies)
+    {
+        hr = MergeFormatDependencies(pDependencies, &dependencies);
+        ExitOnFailure(hr, "Failed to record format dependencies.");
+
+        // results that include hidden values are never kept
+        if (sczOut && !dependencies.fHidden)
+        {
+            ::EnterCriticalSection(&pVariables->csCache);
+            fCacheLocked = TRUE;
+
+            // another thread may have kept a newer result while this one was rendering
+            if (!pTemplate->sczResult || pTemplate->qwResultGeneration <= qwGeneration)
+            {
+                hr = StrAllocStringSecure(&pTemplate->sczResult, sczOut, cch);
+                ExitOnFailure(hr, "Failed to keep formatted result.");
+
+                ReleaseFormatDependencies(&pTemplate->resultDependencies);
+                memcpy(&pTemplate->resultDependencies, &dependencies, sizeof(BURN_FORMAT_DEPENDENCIES));
+                memset(&dependencies, 0, sizeof(BURN_FORMAT_DEPENDENCIES));
+
+                pTemplate->cchResult = cch;
+                pTemplate->qwResultGeneration = qwGeneration;
+            }
+        }
+    }
+
+LExit:
+    if (pTemplate && !pUncachedTemplate)
+    {
+        if (!fCacheLocked)
+        {
+            ::EnterCriticalSection(&pVariables->csCache);
+            fCacheLocked = TRUE;
+        }
+
+        --pTemplate->cRenders;
+        if (pTemplate->fEvicted && !pTemplate->cRenders)
+        {
+            FreeFormatTemplate(pTemplate);
+        }
+    }
+
+    if (fCacheLocked)
+    {
+        ::LeaveCriticalSection(&pVariables->csCache);
+    }
+
+    // return formatted string, the input may be the old value of psczOut so it is only replaced now
+    if (SUCCEEDED(hr))
+    {
+        if (psczOut)
+        {
+            if (fObfuscateHiddenVariables)
+            {
+                ReleaseStr(*psczOut);
+            }
+            else
+            {
+                ReleaseNullStrSecure(*psczOut);
+            }
+
+            *psczOut = sczOut;
+            sczOut = NULL;
+        }
+
+        // return character count
+        if (pcchOut)
+        {
+            *pcchOut = cch;
+        }
+    }
+
+    if (rgsczValues)
+    {
+        for (DWORD i = 0; i < cValues; ++i)
+        {
+            if (fObfuscateHiddenVariables)
+            {
+                ReleaseStr(rgsczValues[i]);
+            }
+            else
+            {
+                StrSecureZeroFreeString(rgsczValues[i]);
+            }
+        }
+        MemFree(rgsczValues);
+    }
+
+    if (pUncachedTemplate)
+    {
+        FreeFormatTemplate(pUncachedTemplate);
+    }
+
+    ReleaseFormatDependencies(&dependencies);
+
+    if (fObfuscateHiddenVariables)
+    {
+        ReleaseStr(sczOut);
+    }
+    else
+    {
+        StrSecureZeroFreeString(sczOut);
+    }
+
+    return hr;
+}
+
+//
+// FormatTemplateWithMsi - formats a template using MsiFormatRecord. Only used
+//                         when a slot appears inside a {} group because MSI
+//                         drops the whole group when any of its fields are blank.
+//
+static HRESULT FormatTemplateWithMsi(
+    __in BURN_FORMAT_TEMPLATE* pTemplate,
+    __in_ecount(pTemplate->cSlots) LPWSTR* rgsczValues,
+    __in BOOL fObfuscateHiddenVariables,
+    __out_z_opt LPWSTR* psczOut,
+    __out DWORD* pcchOut
+    )
+{
+    HRESULT hr = S_OK;
+    DWORD er = ERROR_SUCCESS;
+    LPWSTR sczFormat = NULL;
+    LPWSTR scz = NULL;
+    DWORD iSlot = 0;
+    DWORD cch = 0;
+    MSIHANDLE hRecord = NULL;
+
+    // build a format string with numbered placeholders for the slots
+    hr = VariableStrAlloc(!fObfuscateHiddenVariables, &sczFormat, lstrlenW(pTemplate->sczFormat) + 1);
+    ExitOnFailure(hr, "Failed to allocate buffer for format string.");
+
+    for (DWORD i = 0; i < pTemplate->cTokens; ++i)
+    {
+        BURN_FORMAT_TOKEN* pToken = &pTemplate->rgTokens[i];
+
+        if (BURN_FORMAT_TOKEN_TYPE_LITERAL == pToken->type)
+        {
+            hr = VariableStrAllocConcat(!fObfuscateHiddenVariables, &sczFormat, pToken->wz, pToken->cch);
+            ExitOnFailure(hr, "Failed to append string.");
+        }
+        else
+        {
+            hr = VariableStrAllocFormatted(!fObfuscateHiddenVariables, &scz, L"[%u]", ++iSlot);
+            ExitOnFailure(hr, "Failed to format placeholder string.");
+
+            hr = VariableStrAllocConcat(!fObfuscateHiddenVariables, &sczFormat, scz, 0);
+            ExitOnFailure(hr, "Failed to append placeholder.");
+        }
+    }
+
+    // create record
+    hRecord = ::MsiCreateRecord(pTemplate->cSlots);
+    ExitOnNull(hRecord, hr, E_OUTOFMEMORY, "Failed to allocate record.");
+
+    // set format string
+    er = ::MsiRecordSetStringW(hRecord, 0, sczFormat);
+    ExitOnWin32Error(er, hr, "Failed to set record format string.");
+
+    // copy record fields
+    for (DWORD i = 0; i < pTemplate->cSlots; ++i)
+    {
+        if (*rgsczValues[i]) // not setting if blank
+        {
+            er = ::MsiRecordSetStringW(hRecord, i + 1, rgsczValues[i]);
+            ExitOnWin32Error(er, hr, "Failed to set record string.");
+        }
+    }
+
+    // get formatted character count
+#pragma prefast(push)
+#pragma prefast(disable:6298)
+    er = ::MsiFormatRecordW(NULL, hRecord, L"", &cch);
+#pragma prefast(pop)
+    if (ERROR_MORE_DATA != er)
+    {
+        ExitOnWin32Error(er, hr, "Failed to get formatted length.");
+    }
+
+    // return formatted string
+    if (psczOut)
+    {
+        hr = VariableStrAlloc(!fObfuscateHiddenVariables, psczOut, ++cch);
+        ExitOnFailure(hr, "Failed to allocate string.");
+
+        er = ::MsiFormatRecordW(NULL, hRecord, *psczOut, &cch);
+        ExitOnWin32Error(er, hr, "Failed to format record.");
+    }
+
+    *pcchOut = cch;
+
+LExit:
+    if (hRecord)
+    {
+        ::MsiCloseHandle(hRecord);
+    }
+
+    if (fObfuscateHiddenVariables)
+    {
+        ReleaseStr(sczFormat);
+        ReleaseStr(scz);
+    }
+    else
+    {
+        StrSecureZeroFreeString(sczFormat);
+        StrSecureZeroFreeString(scz);
+    }
+
+    return hr;
+}
+
+//
+// GetFormatTemplate - finds the compiled template for a format string in the
+//                     cache, compiling it on a miss. Templates that are not
+//                     cached are returned in ppUncachedTemplate and must be
+//                     freed by the caller.
+//
+static HRESULT GetFormatTemplate(
+    __in BURN_VARIABLES* pVariables,
+    __in_z LPCWSTR wzIn,
+    __in BOOL fCacheTemplate,
+    __out BURN_FORMAT_TEMPLATE** ppTemplate,
+    __out BURN_FORMAT_TEMPLATE** ppUncachedTemplate
+    )
+{
+    HRESULT hr = S_OK;
+    DWORD dwHash = HashVariableName(wzIn);
+    DWORD iBucket = 0;
+    BURN_FORMAT_TEMPLATE* pTemplate = NULL;
+
+    if (pVariables->rgpFormatTemplateBuckets)
+    {
+        for (iBucket = dwHash & (FORMAT_TEMPLATE_CACHE_BUCKETS - 1); pVariables->rgpFormatTemplateBuckets[iBucket]; iBucket = (iBucket + 1) & (FORMAT_TEMPLATE_CACHE_BUCKETS - 1))
+        {
+            pTemplate = pVariables->rgpFormatTemplateBuckets[iBucket];
+            if (dwHash == pTemplate->dwHash && VariableNameEquals(wzIn, pTemplate->sczFormat))
+            {
+                ++pTemplate->cRenders;
+                *ppTemplate = pTemplate;
+                ExitFunction();
+            }
+        }
+    }
+
+    hr = CompileFormatTemplate(wzIn, dwHash, &pTemplate);
+    ExitOnFailure(hr, "Failed to compile format string.");
+
+    if (fCacheTemplate)
+    {
+        // start over when full so the templates in use now get cached, renders in progress keep theirs
+        if (MAX_FORMAT_TEMPLATES <= pVariables->cFormatTemplates)
+        {
+            ClearFormatTemplateCache(pVariables);
+        }
+
+        if (!pVariables->rgpFormatTemplateBuckets)
+        {
+            pVariables->rgpFormatTemplateBuckets = (BURN_FORMAT_TEMPLATE**)MemAlloc(sizeof(BURN_FORMAT_TEMPLATE*) * FORMAT_TEMPLATE_CACHE_BUCKETS, TRUE);
+            ExitOnNull(pVariables->rgpFormatTemplateBuckets, hr, E_OUTOFMEMORY, "Failed to allocate format template cache.");
+        }
+
+        iBucket = dwHash & (FORMAT_TEMPLATE_CACHE_BUCKETS - 1);
+        while (pVariables->rgpFormatTemplateBuckets[iBucket])
+        {
+            iBucket = (iBucket + 1) & (FORMAT_TEMPLATE_CACHE_BUCKETS - 1);
+        }
+
+        pVariables->rgpFormatTemplateBuckets[iBucket] = pTemplate;
+        ++pVariables->cFormatTemplates;
+        ++pTemplate->cRenders;
+    }
+    else
+    {
+        *ppUncachedTemplate = pTemplate;
+    }
+
+    *ppTemplate = pTemplate;
+    pTemplate = NULL;
+
+LExit:
+    if (pTemplate)
+    {
+        FreeFormatTemplate(pTemplate);
+    }
+
+    return hr;
+}
+
+//
+// CompileFormatTemplate - splits a format string into literal text and slots.
+//                         This uses the same rules the MsiFormatRecord based
+//                         formatter always did: an unterminated '[' and "[]"
+//                         are literal text, "[\x]" escapes the character x and
+//                         anything else in brackets names a variable.
+//
+static HRESULT CompileFormatTemplate(
+    __in_z LPCWSTR wzIn,
+    __in DWORD dwHash,
+    __out BURN_FORMAT_TEMPLATE** ppTemplate
     )
 {
     HRESULT hr = S_OK;
-    DWORD er = ERROR_SUCCESS;
-    LPWSTR sczUnformatted = NULL;
-    LPWSTR sczFormat = NULL;
+    BURN_FORMAT_TEMPLATE* pTemplate = NULL;
     LPCWSTR wzRead = NULL;
     LPCWSTR wzOpen = NULL;
     LPCWSTR wzClose = NULL;
-    LPWSTR scz = NULL;
-    LPWSTR* rgVariables = NULL;
-    DWORD cVariables = 0;
     DWORD cch = 0;
-    BOOL fHidden = FALSE;
-    MSIHANDLE hRecord = NULL;
+    DWORD cOpenGroups = 0;
 
-    ::EnterCriticalSection(&pVariables->csAccess);
+    pTemplate = (BURN_FORMAT_TEMPLATE*)MemAlloc(sizeof(BURN_FORMAT_TEMPLATE), TRUE);
+    ExitOnNull(pTemplate, hr, E_OUTOFMEMORY, "Failed to allocate format template.");
 
-    // allocate buffer for format string
-    hr = StrAlloc(&sczFormat, lstrlenW(wzIn) + 1);
-    ExitOnFailure(hr, "Failed to allocate buffer for format string.");
+    hr = StrAllocString(&pTemplate->sczFormat, wzIn, 0);
+    ExitOnFailure(hr, "Failed to copy format string.");
 
-    // read out variables from the unformatted string and build a format string
-    wzRead = wzIn;
+    pTemplate->dwHash = dwHash;
+
+    wzRead = pTemplate->sczFormat;
     for (;;)
     {
         // scan for opening '['
         wzOpen = wcschr(wzRead, L'[');
         if (!wzOpen)
         {
-            // end reached, append the remainder of the string and end loop
-            hr = VariableStrAllocConcat(!fObfuscateHiddenVariables, &sczFormat, wzRead, 0);
-            ExitOnFailure(hr, "Failed to append string.");
+            // end reached, the remainder of the string is literal
+            hr = AppendFormatToken(pTemplate, BURN_FORMAT_TOKEN_TYPE_LITERAL, wzRead, lstrlenW(wzRead), &cOpenGroups);
+            ExitOnFailure(hr, "Failed to append literal.");
             break;
         }
 
@@ -1181,175 +2274,271 @@ static HRESULT FormatString(
         if (!wzClose)
         {
             // end reached, treat unterminated expander as literal
-            hr = VariableStrAllocConcat(!fObfuscateHiddenVariables, &sczFormat, wzRead, 0);
-            ExitOnFailure(hr, "Failed to append string.");
+            hr = AppendFormatToken(pTemplate, BURN_FORMAT_TOKEN_TYPE_LITERAL, wzRead, lstrlenW(wzRead), &cOpenGroups);
+            ExitOnFailure(hr, "Failed to append literal.");
             break;
         }
-        cch = wzClose - wzOpen - 1;
+        cch = static_cast<DWORD>(wzClose - wzOpen - 1);
 
         if (0 == cch)
         {
-            // blank, copy all text including the terminator
-            hr = VariableStrAllocConcat(!fObfuscateHiddenVariables, &sczFormat, wzRead, (DWORD_PTR)(wzClose - wzRead) + 1);
-            ExitOnFailure(hr, "Failed to append string.");
+            // blank, all text including the terminator is literal
+            hr = AppendFormatToken(pTemplate, BURN_FORMAT_TOKEN_TYPE_LITERAL, wzRead, static_cast<DWORD>(wzClose - wzRead) + 1, &cOpenGroups);
+            ExitOnFailure(hr, "Failed to append literal.");
         }
         else
         {
-            // append text preceding expander
-            if (wzOpen > wzRead)
-            {
-                hr = VariableStrAllocConcat(!fObfuscateHiddenVariables, &sczFormat, wzRead, (DWORD_PTR)(wzOpen - wzRead));
-                ExitOnFailure(hr, "Failed to append string.");
-            }
-
-            // get variable name
-            hr = VariableStrAllocString(!fObfuscateHiddenVariables, &scz, wzOpen + 1, cch);
-            ExitOnFailure(hr, "Failed to get variable name.");
+            // text preceding expander is literal
+            hr = AppendFormatToken(pTemplate, BURN_FORMAT_TOKEN_TYPE_LITERAL, wzRead, static_cast<DWORD>(wzOpen - wzRead), &cOpenGroups);
+            ExitOnFailure(hr, "Failed to append literal.");
 
-            // allocate space in variable array
-            if (rgVariables)
-            {
-                LPVOID pv = MemReAlloc(rgVariables, sizeof(LPWSTR) * (cVariables + 1), TRUE);
-                ExitOnNull(pv, hr, E_OUTOFMEMORY, "Failed to reallocate variable array.");
-                rgVariables = (LPWSTR*)pv;
-            }
-            else
-            {
-                rgVariables = (LPWSTR*)MemAlloc(sizeof(LPWSTR) * (cVariables + 1), TRUE);
-                ExitOnNull(rgVariables, hr, E_OUTOFMEMORY, "Failed to allocate variable array.");
-            }
-
-            // set variable value
             if (2 <= cch && L'\\' == wzOpen[1])
             {
-                // escape sequence, copy character
-                hr = VariableStrAllocString(!fObfuscateHiddenVariables, &rgVariables[cVariables], &wzOpen[2], 1);
+                // escape sequence, only the first character counts
+                hr = AppendFormatToken(pTemplate, BURN_FORMAT_TOKEN_TYPE_ESCAPE, &wzOpen[2], 1, &cOpenGroups);
             }
             else
             {
-                if (fObfuscateHiddenVariables)
-                {
-                    hr = VariableIsHidden(pVariables, scz, &fHidden);
-                    ExitOnFailure1(hr, "Failed to determine variable visibility: '%ls'.", scz);
-                }
-
-                if (fHidden)
-                {
-                    hr = StrAllocString(&rgVariables[cVariables], L"*****", 0);
-                }
-                else
-                {
-                    // get formatted variable value
-                    hr = VariableGetFormatted(pVariables, scz, &rgVariables[cVariables]);
-                    if (E_NOTFOUND == hr) // variable not found
-                    {
-                        hr = StrAllocStringSecure(&rgVariables[cVariables], L"", 0);
-                    }
-                }
+                hr = AppendFormatToken(pTemplate, BURN_FORMAT_TOKEN_TYPE_VARIABLE, wzOpen + 1, cch, &cOpenGroups);
             }
-            ExitOnFailure(hr, "Failed to set variable value.");
-            ++cVariables;
-
-            // append placeholder to format string
-            hr = VariableStrAllocFormatted(!fObfuscateHiddenVariables, &scz, L"[%d]", cVariables);
-            ExitOnFailure(hr, "Failed to format placeholder string.");
-
-            hr = VariableStrAllocConcat(!fObfuscateHiddenVariables, &sczFormat, scz, 0);
-            ExitOnFailure(hr, "Failed to append placeholder.");
+            ExitOnFailure(hr, "Failed to append slot.");
         }
 
         // update read pointer
         wzRead = wzClose + 1;
     }
 
-    // create record
-    hRecord = ::MsiCreateRecord(cVariables);
-    ExitOnNull(hRecord, hr, E_OUTOFMEMORY, "Failed to allocate record.");
+    *ppTemplate = pTemplate;
+    pTemplate = NULL;
 
-    // set format string
-    er = ::MsiRecordSetStringW(hRecord, 0, sczFormat);
-    ExitOnWin32Error(er, hr, "Failed to set record format string.");
+LExit:
+    if (pTemplate)
+    {
+        FreeFormatTemplate(pTemplate);
+    }
 
-    // copy record fields
-    for (DWORD i = 0; i < cVariables; ++i)
+    return hr;
+}
+
+static HRESULT AppendFormatToken(
+    __in BURN_FORMAT_TEMPLATE* pTemplate,
+    __in BURN_FORMAT_TOKEN_TYPE type,
+    __in_ecount(cch) LPCWSTR wz,
+    __in DWORD cch,
+    __inout DWORD* pcOpenGroups
+    )
+{
+    HRESULT hr = S_OK;
+    BURN_FORMAT_TOKEN* pToken = NULL;
+
+    if (BURN_FORMAT_TOKEN_TYPE_LITERAL == type)
     {
-        if (*rgVariables[i]) // not setting if blank
+        if (!cch)
         {
-            er = ::MsiRecordSetStringW(hRecord, i + 1, rgVariables[i]);
-            ExitOnWin32Error(er, hr, "Failed to set record string.");
+            ExitFunction();
         }
-    }
 
-    // get formatted character count
-    cch = 0;
-#pragma prefast(push)
-#pragma prefast(disable:6298)
-    er = ::MsiFormatRecordW(NULL, hRecord, L"", &cch);
-#pragma prefast(pop)
-    if (ERROR_MORE_DATA != er)
+        // track {} groups, brackets inside a group have to be left to MSI
+        for (DWORD i = 0; i < cch; ++i)
+        {
+            if (L'{' == wz[i])
+            {
+                ++*pcOpenGroups;
+            }
+            else if (L'}' == wz[i] && *pcOpenGroups)
+            {
+                --*pcOpenGroups;
+            }
+            else if ((L'[' == wz[i] || L']' == wz[i]) && *pcOpenGroups)
+            {
+                pTemplate->fRequiresMsi = TRUE;
+            }
+        }
+
+        pTemplate->cchLiteral += cch;
+    }
+    else
     {
-        ExitOnWin32Error(er, hr, "Failed to get formatted length.");
+        if (*pcOpenGroups)
+        {
+            pTemplate->fRequiresMsi = TRUE;
+        }
+
+        ++pTemplate->cSlots;
     }
 
-    // return formatted string
-    if (psczOut)
-    {
-        hr = VariableStrAlloc(!fObfuscateHiddenVariables, &scz, ++cch);
-        ExitOnFailure(hr, "Failed to allocate string.");
+    hr = MemEnsureArraySize(reinterpret_cast<LPVOID*>(&pTemplate->rgTokens), pTemplate->cTokens + 1, sizeof(BURN_FORMAT_TOKEN), 8);
+    ExitOnFailure(hr, "Failed to grow format token array.");
 
-        er = ::MsiFormatRecordW(NULL, hRecord, scz, &cch);
-        ExitOnWin32Error(er, hr, "Failed to format record.");
+    pToken = &pTemplate->rgTokens[pTemplate->cTokens];
+    pToken->type = type;
+    pToken->wz = wz;
+    pToken->cch = cch;
 
-        hr = VariableStrAllocString(!fObfuscateHiddenVariables, psczOut, scz, 0);
-        ExitOnFailure(hr, "Failed to copy string.");
+    if (BURN_FORMAT_TOKEN_TYPE_VARIABLE == type)
+    {
+        hr = StrAllocString(&pToken->sczName, wz, cch);
+        ExitOnFailure(hr, "Failed to get variable name.");
     }
 
-    // return character count
-    if (pcchOut)
+    ++pTemplate->cTokens;
+
+LExit:
+    return hr;
+}
+
+static void FreeFormatTemplate(
+    __in BURN_FORMAT_TEMPLATE* pTemplate
+    )
+{
+    if (pTemplate->rgTokens)
     {
-        *pcchOut = cch;
+        for (DWORD i = 0; i < pTemplate->cTokens; ++i)
+        {
+            ReleaseStr(pTemplate->rgTokens[i].sczName);
+        }
+        MemFree(pTemplate->rgTokens);
     }
 
-LExit:
-    ::LeaveCriticalSection(&pVariables->csAccess);
+    StrSecureZeroFreeString(pTemplate->sczFormat);
+    ReleaseNullStrSecure(pTemplate->sczResult);
+    ReleaseFormatDependencies(&pTemplate->resultDependencies);
+    MemFree(pTemplate);
+}
+
+//
+// ClearFormatTemplateCache - empties the format template cache. Templates that
+//                            are being rendered, possibly by a caller further
+//                            up the stack, are freed when their render ends.
+//                            Must be called with csCache held.
+//
+static void ClearFormatTemplateCache(
+    __in BURN_VARIABLES* pVariables
+    )
+{
+    BURN_FORMAT_TEMPLATE* pTemplate = NULL;
 
-    if (rgVariables)
+    for (DWORD i = 0; i < FORMAT_TEMPLATE_CACHE_BUCKETS; ++i)
     {
-        for (DWORD i = 0; i < cVariables; ++i)
+        pTemplate = pVariables->rgpFormatTemplateBuckets[i];
+        if (pTemplate)
         {
-            if (fObfuscateHiddenVariables)
+            if (pTemplate->cRenders)
             {
-                ReleaseStr(rgVariables[i]);
+                pTemplate->fEvicted = TRUE;
             }
             else
             {
-                StrSecureZeroFreeString(rgVariables[i]);
+                FreeFormatTemplate(pTemplate);
             }
+
+            pVariables->rgpFormatTemplateBuckets[i] = NULL;
         }
-        MemFree(rgVariables);
     }
 
-    if (hRecord)
+    pVariables->cFormatTemplates = 0;
+}
+
+static HRESULT RecordFormatDependency(
+    __in_opt BURN_FORMAT_DEPENDENCIES* pDependencies,
+    __in DWORD dwReference,
+    __in BOOL fHidden
+    )
+{
+    HRESULT hr = S_OK;
+
+    if (!pDependencies)
     {
-        ::MsiCloseHandle(hRecord);
+        ExitFunction();
     }
 
-    if (fObfuscateHiddenVariables)
+    pDependencies->fHidden |= fHidden;
+
+    if (!dwReference)
     {
-        ReleaseStr(sczUnformatted);
-        ReleaseStr(sczFormat);
-        ReleaseStr(scz);
+        pDependencies->fMissing = TRUE;
+        ExitFunction();
     }
-    else
+
+    for (DWORD i = 0; i < pDependencies->cReferences; ++i)
     {
-        StrSecureZeroFreeString(sczUnformatted);
-        StrSecureZeroFreeString(sczFormat);
-        StrSecureZeroFreeString(scz);
+        if (dwReference == pDependencies->rgdwReferences[i])
+        {
+            ExitFunction();
+        }
+    }
+
+    hr = MemEnsureArraySize(reinterpret_cast<LPVOID*>(&pDependencies->rgdwReferences), pDependencies->cReferences + 1, sizeof(DWORD), 8);
+    ExitOnFailure(hr, "Failed to grow format dependency array.");
+
+    pDependencies->rgdwReferences[pDependencies->cReferences] = dwReference;
+    ++pDependencies->cReferences;
+
+LExit:
+    return hr;
+}
+
+static HRESULT MergeFormatDependencies(
+    __in_opt BURN_FORMAT_DEPENDENCIES* pDependencies,
+    __in BURN_FORMAT_DEPENDENCIES* pSource
+    )
+{
+    HRESULT hr = S_OK;
+
+    if (!pDependencies)
+    {
+        ExitFunction();
+    }
+
+    pDependencies->fMissing |= pSource->fMissing;
+    pDependencies->fHidden |= pSource->fHidden;
+
+    for (DWORD i = 0; i < pSource->cReferences; ++i)
+    {
+        hr = RecordFormatDependency(pDependencies, pSource->rgdwReferences[i], FALSE);
+        ExitOnFailure(hr, "Failed to merge format dependency.");
     }
 
+LExit:
     return hr;
 }
 
+static BOOL FormatDependenciesChangedSince(
+    __in BURN_VARIABLES* pVariables,
+    __in BURN_FORMAT_DEPENDENCIES* pDependencies,
+    __in DWORD64 qwGeneration
+    )
+{
+    // nothing at all has changed
+    if (VariableGetGeneration(pVariables) == qwGeneration)
+    {
+        return FALSE;
+    }
+
+    if (pDependencies->fMissing && VariableHasChangedSince(pVariables, 0, qwGeneration))
+    {
+        return TRUE;
+    }
+
+    for (DWORD i = 0; i < pDependencies->cReferences; ++i)
+    {
+        if (VariableHasChangedSince(pVariables, pDependencies->rgdwReferences[i], qwGeneration))
+        {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static void ReleaseFormatDependencies(
+    __in BURN_FORMAT_DEPENDENCIES* pDependencies
+    )
+{
+    ReleaseMem(pDependencies->rgdwReferences);
+    memset(pDependencies, 0, sizeof(BURN_FORMAT_DEPENDENCIES));
+}
+
 static HRESULT AddBuiltInVariable(
     __in BURN_VARIABLES* pVariables,
     __in LPCWSTR wzVariable,
@@ -1369,7 +2558,7 @@ static HRESULT AddBuiltInVariable(
     // insert element if not found
     if (S_FALSE == hr)
     {
-        hr = InsertVariable(pVariables, wzVariable, iVariable);
+        hr = InsertVariable(pVariables, wzVariable, &iVariable);
         ExitOnFailure(hr, "Failed to insert variable.");
     }
 
@@ -1384,31 +2573,22 @@ LExit:
     return hr;
 }
 
-static HRESULT GetVariable(
+static HRESULT GetVariableByIndex(
     __in BURN_VARIABLES* pVariables,
-    __in_z LPCWSTR wzVariable,
+    __in DWORD iVariable,
     __out BURN_VARIABLE** ppVariable
     )
 {
     HRESULT hr = S_OK;
-    DWORD iVariable = 0;
-    BURN_VARIABLE* pVariable = NULL;
-
-    hr = FindVariableIndexByName(pVariables, wzVariable, &iVariable);
-    ExitOnFailure(hr, "Failed to find variable value '%ls'.", wzVariable);
-
-    if (S_FALSE == hr)
-    {
-        ExitFunction1(hr = E_NOTFOUND);
-    }
-
-    pVariable = &pVariables->rgVariables[iVariable];
+    BURN_VARIABLE* pVariable = &pVariables->rgVariables[iVariable];
 
     // initialize built-in variable
     if (BURN_VARIANT_TYPE_NONE == pVariable->Value.Type && BURN_VARIABLE_INTERNAL_TYPE_NORMAL < pVariable->internalType)
     {
         hr = pVariable->pfnInitialize(pVariable->dwpInitializeData, &pVariable->Value);
-        ExitOnFailure(hr, "Failed to initialize built-in variable value '%ls'.", wzVariable);
+        ExitOnFailure(hr, "Failed to initialize built-in variable value '%ls'.", pVariable->sczName);
+
+        pVariable->qwGeneration = ++pVariables->qwGeneration;
     }
 
     *ppVariable = pVariable;
@@ -1423,39 +2603,26 @@ static HRESULT FindVariableIndexByName(
     __out DWORD* piVariable
     )
 {
-    HRESULT hr = S_OK;
-    DWORD iRangeFirst = 0;
-    DWORD cRangeLength = pVariables->cVariables;
+    HRESULT hr = S_FALSE; // assume variable will not be found.
+    DWORD dwHash = HashVariableName(wzVariable);
 
-    while (cRangeLength)
+    if (pVariables->cHashBuckets)
     {
-        // get variable in middle of range
-        DWORD iPosition = cRangeLength / 2;
-        BURN_VARIABLE* pVariable = &pVariables->rgVariables[iRangeFirst + iPosition];
+        DWORD dwMask = pVariables->cHashBuckets - 1;
 
-        switch (::CompareStringW(LOCALE_INVARIANT, SORT_STRINGSORT, wzVariable, -1, pVariable->sczName, -1))
+        for (DWORD iBucket = dwHash & dwMask; pVariables->rgdwHashBuckets[iBucket]; iBucket = (iBucket + 1) & dwMask)
         {
-        case CSTR_LESS_THAN:
-            // restrict range to elements before the current
-            cRangeLength = iPosition;
-            break;
-        case CSTR_EQUAL:
-            // variable found
-            *piVariable = iRangeFirst + iPosition;
-            ExitFunction1(hr = S_OK);
-        case CSTR_GREATER_THAN:
-            // restrict range to elements after the current
-            iRangeFirst += iPosition + 1;
-            cRangeLength -= iPosition + 1;
-            break;
-        default:
-            ExitWithLastError(hr, "Failed to compare strings.");
+            DWORD iVariable = pVariables->rgdwHashBuckets[iBucket] - 1;
+            BURN_VARIABLE* pVariable = &pVariables->rgVariables[iVariable];
+
+            if (dwHash == pVariable->dwNameHash && VariableNameEquals(wzVariable, pVariable->sczName))
+            {
+                *piVariable = iVariable;
+                ExitFunction1(hr = S_OK);
+            }
         }
     }
 
-    *piVariable = iRangeFirst;
-    hr = S_FALSE; // variable not found
-
 LExit:
     return hr;
 }
@@ -1463,60 +2630,148 @@ LExit:
 static HRESULT InsertVariable(
     __in BURN_VARIABLES* pVariables,
     __in_z LPCWSTR wzVariable,
-    __in DWORD iPosition
+    __out DWORD* piVariable
     )
 {
     HRESULT hr = S_OK;
     size_t cbAllocSize = 0;
+    DWORD dwMaxVariables = 0;
+    DWORD iVariable = pVariables->cVariables;
+    BURN_VARIABLE* pVariable = NULL;
 
-    // ensure there is room in the variable array
+    // ensure there is room in the variable array, growing geometrically so appends stay cheap
     if (pVariables->cVariables == pVariables->dwMaxVariables)
     {
-        hr = ::DWordAdd(pVariables->dwMaxVariables, GROW_VARIABLE_ARRAY, &(pVariables->dwMaxVariables));
-        ExitOnRootFailure(hr, "Overflow while growing variable array size");
-
         if (pVariables->rgVariables)
         {
-            hr = ::SizeTMult(sizeof(BURN_VARIABLE), pVariables->dwMaxVariables, &cbAllocSize);
+            hr = ::DWordMult(pVariables->dwMaxVariables, 2, &dwMaxVariables);
+            ExitOnRootFailure(hr, "Overflow while growing variable array size");
+
+            hr = ::SizeTMult(sizeof(BURN_VARIABLE), dwMaxVariables, &cbAllocSize);
             ExitOnRootFailure(hr, "Overflow while calculating size of variable array buffer");
 
             LPVOID pv = MemReAlloc(pVariables->rgVariables, cbAllocSize, FALSE);
             ExitOnNull(pv, hr, E_OUTOFMEMORY, "Failed to allocate room for more variables.");
 
-            // Prefast claims it's possible to hit this. Putting the check in just in case.
-            if (pVariables->dwMaxVariables < pVariables->cVariables)
-            {
-                hr = INTSAFE_E_ARITHMETIC_OVERFLOW;
-                ExitOnRootFailure(hr, "Overflow while dealing with variable array buffer allocation");
-            }
-
             pVariables->rgVariables = (BURN_VARIABLE*)pv;
-            memset(&pVariables->rgVariables[pVariables->cVariables], 0, sizeof(BURN_VARIABLE) * (pVariables->dwMaxVariables - pVariables->cVariables));
+            memset(&pVariables->rgVariables[pVariables->cVariables], 0, sizeof(BURN_VARIABLE) * (dwMaxVariables - pVariables->cVariables));
         }
         else
         {
-            pVariables->rgVariables = (BURN_VARIABLE*)MemAlloc(sizeof(BURN_VARIABLE) * pVariables->dwMaxVariables, TRUE);
+            dwMaxVariables = INITIAL_VARIABLE_ARRAY_SIZE;
+
+            pVariables->rgVariables = (BURN_VARIABLE*)MemAlloc(sizeof(BURN_VARIABLE) * dwMaxVariables, TRUE);
             ExitOnNull(pVariables->rgVariables, hr, E_OUTOFMEMORY, "Failed to allocate room for variables.");
         }
+
+        pVariables->dwMaxVariables = dwMaxVariables;
     }
 
-    // move variables
-    if (0 < pVariables->cVariables - iPosition)
+    // keep the hash table at most half full so probe sequences stay short
+    if (pVariables->cHashBuckets < (pVariables->cVariables + 1) * 2)
     {
-        memmove(&pVariables->rgVariables[iPosition + 1], &pVariables->rgVariables[iPosition], sizeof(BURN_VARIABLE) * (pVariables->cVariables - iPosition));
-        memset(&pVariables->rgVariables[iPosition], 0, sizeof(BURN_VARIABLE));
+        hr = GrowVariableHashBuckets(pVariables);
+        ExitOnFailure(hr, "Failed to grow variable hash table.");
     }
 
-    ++pVariables->cVariables;
-
     // allocate name
-    hr = StrAllocString(&pVariables->rgVariables[iPosition].sczName, wzVariable, 0);
+    pVariable = &pVariables->rgVariables[iVariable];
+
+    hr = StrAllocString(&pVariable->sczName, wzVariable, 0);
     ExitOnFailure(hr, "Failed to copy variable name.");
 
+    pVariable->dwNameHash = HashVariableName(wzVariable);
+    pVariable->qwGeneration = ++pVariables->qwGeneration;
+    pVariables->qwInsertGeneration = pVariable->qwGeneration;
+
+    ++pVariables->cVariables;
+
+    // add to the hash table
+    for (DWORD iBucket = pVariable->dwNameHash & (pVariables->cHashBuckets - 1); ; iBucket = (iBucket + 1) & (pVariables->cHashBuckets - 1))
+    {
+        if (!pVariables->rgdwHashBuckets[iBucket])
+        {
+            pVariables->rgdwHashBuckets[iBucket] = iVariable + 1;
+            break;
+        }
+    }
+
+    *piVariable = iVariable;
+
+LExit:
+    return hr;
+}
+
+static HRESULT GrowVariableHashBuckets(
+    __in BURN_VARIABLES* pVariables
+    )
+{
+    HRESULT hr = S_OK;
+    DWORD cHashBuckets = INITIAL_VARIABLE_HASH_BUCKETS;
+    DWORD* rgdwHashBuckets = NULL;
+
+    if (pVariables->cHashBuckets)
+    {
+        hr = ::DWordMult(pVariables->cHashBuckets, 2, &cHashBuckets);
+        ExitOnRootFailure(hr, "Overflow while growing variable hash table size");
+    }
+
+    rgdwHashBuckets = (DWORD*)MemAlloc(sizeof(DWORD) * cHashBuckets, TRUE);
+    ExitOnNull(rgdwHashBuckets, hr, E_OUTOFMEMORY, "Failed to allocate variable hash table.");
+
+    // rehash the existing variables using their cached name hashes
+    for (DWORD i = 0; i < pVariables->cVariables; ++i)
+    {
+        DWORD iBucket = pVariables->rgVariables[i].dwNameHash & (cHashBuckets - 1);
+        while (rgdwHashBuckets[iBucket])
+        {
+            iBucket = (iBucket + 1) & (cHashBuckets - 1);
+        }
+
+        rgdwHashBuckets[iBucket] = i + 1;
+    }
+
+    ReleaseMem(pVariables->rgdwHashBuckets);
+    pVariables->rgdwHashBuckets = rgdwHashBuckets;
+    pVariables->cHashBuckets = cHashBuckets;
+
 LExit:
     return hr;
 }
 
+//
+// HashVariableName - FNV-1a over the UTF-16 code units. Variable names are
+//                    case-sensitive so no case folding is done here. Also
+//                    keys the format template cache.
+//
+static DWORD HashVariableName(
+    __in_z LPCWSTR wzVariable
+    )
+{
+    DWORD dwHash = 2166136261;
+
+    for (LPCWSTR wz = wzVariable; *wz; ++wz)
+    {
+        dwHash = (dwHash ^ *wz) * 16777619;
+    }
+
+    return dwHash;
+}
+
+static BOOL VariableNameEquals(
+    __in_z LPCWSTR wzVariable1,
+    __in_z LPCWSTR wzVariable2
+    )
+{
+    while (*wzVariable1 && *wzVariable1 == *wzVariable2)
+    {
+        ++wzVariable1;
+        ++wzVariable2;
+    }
+
+    return *wzVariable1 == *wzVariable2;
+}
+
 static HRESULT SetVariableValue(
     __in BURN_VARIABLES* pVariables,
     __in_z LPCWSTR wzVariable,
@@ -1527,9 +2782,29 @@ static HRESULT SetVariableValue(
     )
 {
     HRESULT hr = S_OK;
-    DWORD iVariable = 0;
 
-    ::EnterCriticalSection(&pVariables->csAccess);
+    LockVariables(pVariables, TRUE);
+    hr = SetVariableValueLocked(pVariables, wzVariable, pVariant, fLiteral, setBuiltin, fLog);
+    UnlockVariables(pVariables, TRUE);
+
+    return hr;
+}
+
+//
+// SetVariableValueLocked - sets a variable's value. The caller must hold the
+//                          variables lock exclusively.
+//
+static HRESULT SetVariableValueLocked(
+    __in BURN_VARIABLES* pVariables,
+    __in_z LPCWSTR wzVariable,
+    __in BURN_VARIANT* pVariant,
+    __in BOOL fLiteral,
+    __in SET_VARIABLE setBuiltin,
+    __in BOOL fLog
+    )
+{
+    HRESULT hr = S_OK;
+    DWORD iVariable = 0;
 
     hr = FindVariableIndexByName(pVariables, wzVariable, &iVariable);
     ExitOnFailure(hr, "Failed to find variable value '%ls'.", wzVariable);
@@ -1537,7 +2812,7 @@ static HRESULT SetVariableValue(
     // Insert element if not found.
     if (S_FALSE == hr)
     {
-        hr = InsertVariable(pVariables, wzVariable, iVariable);
+        hr = InsertVariable(pVariables, wzVariable, &iVariable);
         ExitOnFailure(hr, "Failed to insert variable '%ls'.", wzVariable);
     }
     else if (BURN_VARIABLE_INTERNAL_TYPE_NORMAL < pVariables->rgVariables[iVariable].internalType) // built-in variables must be overridden.
@@ -1612,9 +2887,10 @@ static HRESULT SetVariableValue(
     // Update variable literal flag.
     pVariables->rgVariables[iVariable].fLiteral = fLiteral;
 
-LExit:
-    ::LeaveCriticalSection(&pVariables->csAccess);
+    // Let cached conditions and format results know the variable changed.
+    pVariables->rgVariables[iVariable].qwGeneration = ++pVariables->qwGeneration;
 
+LExit:
     if (FAILED(hr) && fLog)
     {
         LogStringLine(REPORT_STANDARD, "Setting variable failed: ID '%ls', HRESULT 0x%x", wzVariable, hr);
@@ -33,15 +33,63 @@ enum BURN_VARIABLE_INTERNAL_TYPE
 };
 
 
+enum BURN_FORMAT_TOKEN_TYPE
+{
+    BURN_FORMAT_TOKEN_TYPE_LITERAL, // text copied as is.
+    BURN_FORMAT_TOKEN_TYPE_VARIABLE, // [Variable] replaced with the formatted value of the variable.
+    BURN_FORMAT_TOKEN_TYPE_ESCAPE, // [\x] replaced with the escaped character.
+};
+
+
 // structs
 
+typedef struct _BURN_FORMAT_TOKEN
+{
+    BURN_FORMAT_TOKEN_TYPE type;
+    LPCWSTR wz; // points into the owning template's sczFormat.
+    DWORD cch;
+    LPWSTR sczName; // only for variable tokens.
+} BURN_FORMAT_TOKEN;
+
+typedef struct _BURN_FORMAT_DEPENDENCIES
+{
+    DWORD* rgdwReferences; // index + 1 of each variable read.
+    DWORD cReferences;
+    BOOL fMissing; // a variable that did not exist was read, so adding any variable invalidates the result.
+    BOOL fHidden; // a hidden variable was read, so the result must not be kept.
+} BURN_FORMAT_DEPENDENCIES;
+
+typedef struct _BURN_FORMAT_TEMPLATE
+{
+    LPWSTR sczFormat;
+    DWORD dwHash;
+
+    BURN_FORMAT_TOKEN* rgTokens;
+    DWORD cTokens;
+    DWORD cSlots; // number of variable and escape tokens.
+    DWORD cchLiteral; // total length of the literal tokens.
+
+    BOOL fRequiresMsi; // if fRequiresMsi, then a slot appears inside a {} group so MSI must apply its group rules.
+
+    DWORD cRenders; // renders in progress with this template, guarded by csCache.
+    BOOL fEvicted; // removed from the cache while in use, freed when the last render finishes with it.
+
+    // last formatted result, valid until one of its dependencies changes after qwResultGeneration.
+    LPWSTR sczResult;
+    DWORD cchResult;
+    DWORD64 qwResultGeneration;
+    BURN_FORMAT_DEPENDENCIES resultDependencies;
+} BURN_FORMAT_TEMPLATE;
+
 typedef struct _BURN_VARIABLE
 {
     LPWSTR sczName;
+    DWORD dwNameHash;
     BURN_VARIANT Value;
     BOOL fHidden;    
     BOOL fLiteral; // if fLiteral, then when formatting this variable its value should be used as is (don't continue recursively formatting).
     BOOL fPersisted;
+    DWORD64 qwGeneration; // generation of the store when this variable was last set.
 
     // used for late initialization of built-in variables
     BURN_VARIABLE_INTERNAL_TYPE internalType;
@@ -49,12 +97,41 @@ typedef struct _BURN_VARIABLE
     DWORD_PTR dwpInitializeData;
 } BURN_VARIABLE;
 
+typedef struct _BURN_VARIABLES_SYNC
+{
+    // sending side, only one message at a time is sent to the other process.
+    DWORD64 qwGeneration; // generation the other process was last brought up to.
+    DWORD cVariables; // the other process knows the names of this many variables by index.
+    DWORD64 qwPendingGeneration; // written by the last VariableSerializeChanges but not acknowledged yet.
+    DWORD cPendingVariables;
+
+    // receiving side
+    DWORD* rgdwIndexes; // index + 1 of the local variable for each index used by the sending process, zero if not seen yet.
+    DWORD cIndexes;
+} BURN_VARIABLES_SYNC;
+
 typedef struct _BURN_VARIABLES
 {
-    CRITICAL_SECTION csAccess;
+    CRITICAL_SECTION csAccess; // only used when slim reader/writer locks are not available.
+    PVOID pvSrwLock; // slim reader/writer lock guarding the variables, readers share it.
+    CRITICAL_SECTION csCache; // guards the format template and condition caches, always taken before the variables lock.
     DWORD dwMaxVariables;
     DWORD cVariables;
-    BURN_VARIABLE* rgVariables;
+    BURN_VARIABLE* rgVariables; // in insertion order.
+
+    DWORD cHashBuckets; // always a power of two.
+    DWORD* rgdwHashBuckets; // index + 1 into rgVariables, zero for an empty bucket.
+
+    DWORD64 qwGeneration; // incremented every time a variable is added or set.
+    DWORD64 qwInsertGeneration; // generation when the last variable was added.
+
+    DWORD cFormatTemplates;
+    BURN_FORMAT_TEMPLATE** rgpFormatTemplateBuckets; // compiled format strings keyed by the unformatted string, NULL for an empty bucket.
+
+    DWORD cConditionPrograms;
+    struct _BURN_CONDITION_PROGRAM** rgpConditionProgramBuckets; // owned by condition.cpp, compiled conditions keyed by the condition string.
+
+    BURN_VARIABLES_SYNC sync; // what the elevated process already has.
 } BURN_VARIABLES;
 
 
@@ -93,6 +170,20 @@ HRESULT VariableGetVariant(
     __in_z LPCWSTR wzVariable,
     __in BURN_VARIANT* pValue
     );
+HRESULT VariableGetVariantByReference(
+    __in BURN_VARIABLES* pVariables,
+    __in_z LPCWSTR wzVariable,
+    __inout DWORD* pdwReference,
+    __in BURN_VARIANT* pValue
+    );
+BOOL VariableHasChangedSince(
+    __in BURN_VARIABLES* pVariables,
+    __in DWORD dwReference,
+    __in DWORD64 qwGeneration
+    );
+DWORD64 VariableGetGeneration(
+    __in BURN_VARIABLES* pVariables
+    );
 HRESULT VariableGetFormatted(
     __in BURN_VARIABLES* pVariables,
     __in_z LPCWSTR wzVariable,
@@ -156,6 +247,23 @@ HRESULT VariableDeserialize(
     __in SIZE_T cbBuffer,
     __inout SIZE_T* piBuffer
     );
+HRESULT VariableSerializeChanges(
+    __in BURN_VARIABLES* pVariables,
+    __inout BYTE** ppbBuffer,
+    __inout SIZE_T* piBuffer
+    );
+void VariableAcknowledgeChanges(
+    __in BURN_VARIABLES* pVariables
+    );
+void VariableResetChanges(
+    __in BURN_VARIABLES* pVariables
+    );
+HRESULT VariableDeserializeChanges(
+    __in BURN_VARIABLES* pVariables,
+    __in_bcount(cbBuffer) BYTE* pbBuffer,
+    __in SIZE_T cbBuffer,
+    __inout SIZE_T* piBuffer
+    );
 HRESULT VariableStrAlloc(
     __in BOOL fZeroOnRealloc,
     __deref_out_ecount_part(cch, 0) LPWSTR* ppwz,
@@ -743,6 +743,21 @@ DECLARE_INTERFACE_IID_(IBootstrapperApplication, IUnknown, "53C31D56-49C0-426B-A
         __in HRESULT hrStatus,
         __in DWORD dwProcessId
         ) = 0;
+
+    // OnCacheVerifyProgress - called when the engine makes progress hashing
+    //                         a payload or container to verify it.
+    //
+    // Return:
+    //  IDCANCEL instructs the engine to stop caching.
+    //
+    //  IDNOACTION instructs the engine to continue.
+    STDMETHOD_(int, OnCacheVerifyProgress)(
+        __in_z_opt LPCWSTR wzPackageOrContainerId,
+        __in_z_opt LPCWSTR wzPayloadId,
+        __in DWORD64 dw64Progress,
+        __in DWORD64 dw64Total,
+        __in DWORD dwOverallPercentage
+        ) = 0;
 };
 
 
@@ -320,6 +320,11 @@ namespace Microsoft.Tools.WindowsInstallerXml.Bootstrapper
         /// </summary>
         public event EventHandler<LaunchApprovedExeCompleteArgs> LaunchApprovedExeComplete;
 
+        /// <summary>
+        /// Fired when the engine has progress verifying a container or payload.
+        /// </summary>
+        public event EventHandler<CacheVerifyProgressEventArgs> CacheVerifyProgress;
+
         /// <summary>
         /// Specifies whether this bootstrapper should run asynchronously. The default is true.
         /// </summary>
@@ -1112,6 +1117,19 @@ namespace Microsoft.Tools.WindowsInstallerXml.Bootstrapper
             }
         }
 
+        /// <summary>
+        /// Called when the engine has progressed on verifying the container or payload.
+        /// </summary>
+        /// <param name="args">Additional arguments for this event.</param>
+        protected virtual void OnCacheVerifyProgress(CacheVerifyProgressEventArgs args)
+        {
+            EventHandler<CacheVerifyProgressEventArgs> handler = this.CacheVerifyProgress;
+            if (null != handler)
+            {
+                handler(this, args);
+            }
+        }
+
         #region IBootstrapperApplication Members
 
         void IBootstrapperApplication.OnStartup()
@@ -1517,6 +1535,14 @@ namespace Microsoft.Tools.WindowsInstallerXml.Bootstrapper
             this.OnLaunchApprovedExeComplete(new LaunchApprovedExeCompleteArgs(hrStatus, processId));
         }
 
+        Result IBootstrapperApplication.OnCacheVerifyProgress(string wzPackageOrContainerId, string wzPayloadId, long dw64Progress, long dw64Total, int dwOverallPercentage)
+        {
+            CacheVerifyProgressEventArgs args = new CacheVerifyProgressEventArgs(wzPackageOrContainerId, wzPayloadId, dw64Progress, dw64Total, dwOverallPercentage);
+            this.OnCacheVerifyProgress(args);
+
+            return args.Result;
+        }
+
         #endregion
     }
 }
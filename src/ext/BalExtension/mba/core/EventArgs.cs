@@ -2249,4 +2249,69 @@ namespace Microsoft.Tools.WindowsInstallerXml.Bootstrapper
             get { return this.processId; }
         }
     }
+
+    /// <summary>
+    /// Additional arguments used when the engine verifies some part of a container or payload.
+    /// </summary>
+    [Serializable]
+    public class CacheVerifyProgressEventArgs : ResultEventArgs
+    {
+        private string packageOrContainerId;
+        private string payloadId;
+        private long progress;
+        private long total;
+        private int overallPercentage;
+
+        /// <summary>
+        /// Creates a new instance of the <see cref="CacheVerifyProgressEventArgs"/> class.
+        /// </summary>
+        public CacheVerifyProgressEventArgs(string packageOrContainerId, string payloadId, long progress, long total, int overallPercentage)
+        {
+            this.packageOrContainerId = packageOrContainerId;
+            this.payloadId = payloadId;
+            this.progress = progress;
+            this.total = total;
+            this.overallPercentage = overallPercentage;
+        }
+
+        /// <summary>
+        /// Gets the identifier of the container or package.
+        /// </summary>
+        public string PackageOrContainerId
+        {
+            get { return this.packageOrContainerId; }
+        }
+
+        /// <summary>
+        /// Gets the identifier of the payload (if verifying a payload).
+        /// </summary>
+        public string PayloadId
+        {
+            get { return this.payloadId; }
+        }
+
+        /// <summary>
+        /// Gets the number of bytes verified thus far.
+        /// </summary>
+        public long Progress
+        {
+            get { return this.progress; }
+        }
+
+        /// <summary>
+        /// Gets the total bytes to verify.
+        /// </summary>
+        public long Total
+        {
+            get { return this.total; }
+        }
+
+        /// <summary>
+        /// Gets the overall percentage of progress of caching.
+        /// </summary>
+        public int OverallPercentage
+        {
+            get { return this.overallPercentage; }
+        }
+    }
 }
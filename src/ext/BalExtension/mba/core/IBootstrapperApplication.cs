@@ -386,6 +386,16 @@ namespace Microsoft.Tools.WindowsInstallerXml.Bootstrapper
             int hrStatus,
             int processId
             );
+
+        [PreserveSig]
+        [return: MarshalAs(UnmanagedType.I4)]
+        Result OnCacheVerifyProgress(
+            [MarshalAs(UnmanagedType.LPWStr)] string wzPackageOrContainerId,
+            [MarshalAs(UnmanagedType.LPWStr)] string wzPayloadId,
+            [MarshalAs(UnmanagedType.U8)] long dw64Progress,
+            [MarshalAs(UnmanagedType.U8)] long dw64Total,
+            [MarshalAs(UnmanagedType.U4)] int dwOverallPercentage
+            );
     }
 
     /// <summary>
@@ -7,6 +7,10 @@ static HRESULT ParsePackagesFromXml(
     __in BAL_INFO_PACKAGES* pPackages,
     __in IXMLDOMDocument* pixdManifest
     );
+static HRESULT IndexPackage(
+    __in BAL_INFO_PACKAGES* pPackages,
+    __in BAL_INFO_PACKAGE* pPackage
+    );
 
 
 DAPI_(HRESULT) BalInfoParseFromXml(
@@ -81,10 +85,12 @@ DAPI_(HRESULT) BalInfoAddRelatedBundleAsPackage(
     }
 
     // Check to see if the bundle is already in the list of packages.
-    for (DWORD i = 0; i < pPackages->cPackages; ++i)
+    if (pPackages->sdPackages)
     {
-        if (CSTR_EQUAL == ::CompareStringW(LOCALE_NEUTRAL, 0, wzId, -1, pPackages->rgPackages[i].sczId, -1))
+        hr = DictKeyExists(pPackages->sdPackages, wzId);
+        if (E_NOTFOUND != hr)
         {
+            ExitOnFailure(hr, "Failed to look up related bundle package.");
             ExitFunction1(hr = HRESULT_FROM_WIN32(ERROR_ALREADY_EXISTS));
         }
     }
@@ -101,6 +107,9 @@ DAPI_(HRESULT) BalInfoAddRelatedBundleAsPackage(
 
     pPackage->type = type;
 
+    hr = IndexPackage(pPackages, pPackage);
+    ExitOnFailure(hr, "Failed to index related bundle package.");
+
     // TODO: try to look up the DisplayName and Description in Add/Remove Programs with the wzId.
 
 LExit:
@@ -114,18 +123,16 @@ DAPI_(HRESULT) BalInfoFindPackageById(
     __out BAL_INFO_PACKAGE** ppPackage
     )
 {
+    HRESULT hr = E_NOTFOUND;
+
     *ppPackage = NULL;
 
-    for (DWORD i = 0; i < pPackages->cPackages; ++i)
+    if (pPackages->sdPackages)
     {
-        if (CSTR_EQUAL == ::CompareStringW(LOCALE_NEUTRAL, 0, wzId, -1, pPackages->rgPackages[i].sczId, -1))
-        {
-            *ppPackage = pPackages->rgPackages + i;
-            break;
-        }
+        hr = DictGetValue(pPackages->sdPackages, wzId, reinterpret_cast<void**>(ppPackage));
     }
 
-    return *ppPackage ? S_OK : E_NOTFOUND;
+    return hr;
 }
 
 
@@ -145,6 +152,7 @@ DAPI_(void) BalInfoUninitialize(
     }
 
     ReleaseMem(pBundle->packages.rgPackages);
+    ReleaseDict(pBundle->packages.sdPackages);
 
     ReleaseStr(pBundle->sczName);
     ReleaseStr(pBundle->sczLogVariable);
@@ -274,6 +282,12 @@ static HRESULT ParsePackagesFromXml(
     pPackages->rgPackages = prgPackages;
     prgPackages = NULL;
 
+    for (DWORD i = 0; i < pPackages->cPackages; ++i)
+    {
+        hr = IndexPackage(pPackages, pPackages->rgPackages + i);
+        ExitOnFailure(hr, "Failed to index package.");
+    }
+
 LExit:
     ReleaseStr(scz);
     ReleaseMem(prgPackages);
@@ -282,3 +296,24 @@ LExit:
 
     return hr;
 }
+
+static HRESULT IndexPackage(
+    __in BAL_INFO_PACKAGES* pPackages,
+    __in BAL_INFO_PACKAGE* pPackage
+    )
+{
+    HRESULT hr = S_OK;
+
+    // The index holds offsets into rgPackages so it survives the array growing when related bundles are added.
+    if (!pPackages->sdPackages)
+    {
+        hr = DictCreateWithEmbeddedKey(&pPackages->sdPackages, pPackages->cPackages, reinterpret_cast<void**>(&pPackages->rgPackages), offsetof(BAL_INFO_PACKAGE, sczId), DICT_FLAG_NONE);
+        ExitOnFailure(hr, "Failed to create package id index.");
+    }
+
+    hr = DictAddValue(pPackages->sdPackages, pPackage);
+    ExitOnFailure1(hr, "Failed to add package to index: %ls", pPackage->sczId);
+
+LExit:
+    return hr;
+}
@@ -596,6 +596,29 @@ public: // IBootstrapperApplication
     {
     }
 
+    virtual STDMETHODIMP_(int) OnCacheVerifyProgress(
+        __in_z_opt LPCWSTR /*wzPackageOrContainerId*/,
+        __in_z_opt LPCWSTR /*wzPayloadId*/,
+        __in DWORD64 /*dw64Progress*/,
+        __in DWORD64 /*dw64Total*/,
+        __in DWORD /*dwOverallPercentage*/
+        )
+    {
+        HRESULT hr = S_OK;
+        int nResult = IDNOACTION;
+
+        // Send progress even though we don't update the numbers to at least give the caller an opportunity
+        // to cancel.
+        if (BOOTSTRAPPER_DISPLAY_EMBEDDED == m_display)
+        {
+            hr = m_pEngine->SendEmbeddedProgress(m_dwProgressPercentage, m_dwOverallProgressPercentage, &nResult);
+            BalExitOnFailure(hr, "Failed to send embedded cache verify progress.");
+        }
+
+    LExit:
+        return FAILED(hr) ? IDERROR : CheckCanceled() ? IDCANCEL : nResult;
+    }
+
 protected:
     //
     // PromptCancel - prompts the user to close (if not forced).
@@ -1,6 +1,7 @@
 #pragma once
 // Copyright (c) .NET Foundation and contributors. All rights reserved. Licensed under the Microsoft Reciprocal License. See LICENSE.TXT file in the project root for full license information.
 
+#include "dictutil.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -49,6 +50,7 @@ typedef struct _BAL_INFO_PACKAGES
 {
     BAL_INFO_PACKAGE* rgPackages;
     DWORD cPackages;
+    STRINGDICT_HANDLE sdPackages; // index of rgPackages by id.
 } BAL_INFO_PACKAGES;
 
 
@@ -38,14 +38,14 @@ DAPI_(HRESULT) DepGetProviderInformation(
 {
     HRESULT hr = S_OK;
     LPWSTR sczKey = NULL;
-    HKEY hkKey = NULL;
+    REG_SNAPSHOT_HANDLE hSnapshot = NULL;
 
     // Format the provider dependency registry key.
     hr = AllocDependencyKeyName(wzProviderKey, &sczKey);
     ExitOnFailure1(hr, "Failed to allocate the registry key for dependency \"%ls\".", wzProviderKey);
 
-    // Try to open the dependency key.
-    hr = RegOpen(hkHive, sczKey, KEY_READ, &hkKey);
+    // Try to open the dependency key and read all its values at once.
+    hr = RegSnapshotOpen(hkHive, sczKey, KEY_READ, &hSnapshot);
     if (E_FILENOTFOUND == hr)
     {
         ExitFunction1(hr = E_NOTFOUND);
@@ -55,7 +55,7 @@ DAPI_(HRESULT) DepGetProviderInformation(
     // Get the Id if requested and available.
     if (psczId)
     {
-        hr = RegReadString(hkKey, NULL, psczId);
+        hr = RegSnapshotReadString(hSnapshot, NULL, psczId);
         if (E_FILENOTFOUND == hr)
         {
             hr = S_OK;
@@ -66,7 +66,7 @@ DAPI_(HRESULT) DepGetProviderInformation(
     // Get the DisplayName if requested and available.
     if (psczName)
     {
-        hr = RegReadString(hkKey, vcszDisplayNameValue, psczName);
+        hr = RegSnapshotReadString(hSnapshot, vcszDisplayNameValue, psczName);
         if (E_FILENOTFOUND == hr)
         {
             hr = S_OK;
@@ -77,7 +77,7 @@ DAPI_(HRESULT) DepGetProviderInformation(
     // Get the Version if requested and available.
     if (pqwVersion)
     {
-        hr = RegReadVersion(hkKey, vcszVersionValue, pqwVersion);
+        hr = RegSnapshotReadVersion(hSnapshot, vcszVersionValue, pqwVersion);
         if (E_FILENOTFOUND == hr)
         {
             hr = S_OK;
@@ -86,7 +86,7 @@ DAPI_(HRESULT) DepGetProviderInformation(
     }
 
 LExit:
-    ReleaseRegKey(hkKey);
+    ReleaseRegSnapshot(hSnapshot);
     ReleaseStr(sczKey);
 
     return hr;
@@ -14,6 +14,19 @@ static HRESULT ParseEnclosure(
     __in ATOM_LINK* pLink,
     __in APPLICATION_UPDATE_ENCLOSURE* pEnclosure
     );
+static APUP_HASH_ALGORITHM ParseDigestAlgorithm(
+    __in_ecount(cchAlgorithm) LPCWSTR wzAlgorithm,
+    __in int cchAlgorithm
+    );
+static HRESULT ParseDigest(
+    __in_z LPCWSTR wzDigest,
+    __in APPLICATION_UPDATE_ENCLOSURE* pEnclosure
+    );
+static HRESULT ParseAtomStream(
+    __in VARIANT* pvarSource,
+    __in DWORD64 dw64MinimumVersion,
+    __out APPLICATION_UPDATE_CHAIN** ppChain
+    );
 static __callback int __cdecl CompareEntries(
     void* pvContext,
     const void* pvLeft,
@@ -42,6 +55,596 @@ static void FreeEnclosure(
     );
 
 
+// constants
+
+#define APUP_STREAM_ENTRY_GROWTH 16
+#define APUP_STREAM_ENCLOSURE_GROWTH 2
+
+
+// class
+
+//
+// CApupAtomStreamHandler - SAX handler that builds application update entries directly
+//   from an ATOM feed as it is read. Entries older than the minimum version are released
+//   as soon as their closing tag is seen so they never reach the chain.
+//
+class CApupAtomStreamHandler : public ISAXContentHandler
+{
+public: // IUnknown
+    virtual STDMETHODIMP QueryInterface(
+        __in const IID& riid,
+        __out void** ppvObject
+        )
+    {
+        HRESULT hr = S_OK;
+
+        ExitOnNull(ppvObject, hr, E_INVALIDARG, "Invalid argument ppvObject");
+        *ppvObject = NULL;
+
+        if (::IsEqualIID(__uuidof(ISAXContentHandler), riid))
+        {
+            *ppvObject = static_cast<ISAXContentHandler*>(this);
+        }
+        else if (::IsEqualIID(IID_IUnknown, riid))
+        {
+            *ppvObject = reinterpret_cast<IUnknown*>(this);
+        }
+        else // no interface for requested iid
+        {
+            ExitFunction1(hr = E_NOINTERFACE);
+        }
+
+        AddRef();
+
+    LExit:
+        return hr;
+    }
+
+    virtual STDMETHODIMP_(ULONG) AddRef()
+    {
+        return ::InterlockedIncrement(&this->m_cReferences);
+    }
+
+    virtual STDMETHODIMP_(ULONG) Release()
+    {
+        long l = ::InterlockedDecrement(&this->m_cReferences);
+        if (0 < l)
+        {
+            return l;
+        }
+
+        delete this;
+        return 0;
+    }
+
+public: // ISAXContentHandler
+    virtual STDMETHODIMP putDocumentLocator(
+        __in ISAXLocator* /*pLocator*/
+        )
+    {
+        return S_OK;
+    }
+
+    virtual STDMETHODIMP startDocument()
+    {
+        return S_OK;
+    }
+
+    virtual STDMETHODIMP endDocument()
+    {
+        return S_OK;
+    }
+
+    virtual STDMETHODIMP startPrefixMapping(
+        __in_ecount(cchPrefix) const wchar_t* /*pwchPrefix*/,
+        __in int /*cchPrefix*/,
+        __in_ecount(cchUri) const wchar_t* /*pwchUri*/,
+        __in int /*cchUri*/
+        )
+    {
+        return S_OK;
+    }
+
+    virtual STDMETHODIMP endPrefixMapping(
+        __in_ecount(cchPrefix) const wchar_t* /*pwchPrefix*/,
+        __in int /*cchPrefix*/
+        )
+    {
+        return S_OK;
+    }
+
+    virtual STDMETHODIMP startElement(
+        __in_ecount(cchNamespaceUri) const wchar_t* pwchNamespaceUri,
+        __in int cchNamespaceUri,
+        __in_ecount(cchLocalName) const wchar_t* pwchLocalName,
+        __in int cchLocalName,
+        __in_ecount(cchQName) const wchar_t* /*pwchQName*/,
+        __in int /*cchQName*/,
+        __in ISAXAttributes* pAttributes
+        )
+    {
+        HRESULT hr = S_OK;
+        BOOL fAppsyn = FALSE;
+
+        ++m_dwDepth;
+
+        // Markup nested inside an element being captured only contributes its text.
+        if (m_psczCapture)
+        {
+            ExitFunction();
+        }
+
+        fAppsyn = IsName(pwchNamespaceUri, cchNamespaceUri, APPLICATION_SYNDICATION_NAMESPACE);
+
+        if (2 == m_dwDepth)
+        {
+            if (fAppsyn && IsName(pwchLocalName, cchLocalName, L"application"))
+            {
+                hr = AllocAttribute(pAttributes, L"type", &m_pChain->wzDefaultApplicationType);
+                ExitOnFailure(hr, "Failed to allocate default application type.");
+
+                hr = BeginCapture(&m_pChain->wzDefaultApplicationId);
+                ExitOnFailure(hr, "Failed to allocate default application id.");
+            }
+            else if (!fAppsyn && IsName(pwchLocalName, cchLocalName, L"entry"))
+            {
+                m_fInEntry = TRUE;
+            }
+        }
+        else if (3 == m_dwDepth && m_fInEntry)
+        {
+            hr = BeginEntryElement(fAppsyn, pwchLocalName, cchLocalName, pAttributes);
+            ExitOnFailure(hr, "Failed to process ATOM entry element.");
+        }
+        else if (4 == m_dwDepth && m_fInEnclosure && fAppsyn)
+        {
+            hr = BeginEnclosureElement(pwchLocalName, cchLocalName, pAttributes);
+            ExitOnFailure(hr, "Failed to process ATOM enclosure element.");
+        }
+
+    LExit:
+        return SaveResult(hr);
+    }
+
+    virtual STDMETHODIMP endElement(
+        __in_ecount(cchNamespaceUri) const wchar_t* /*pwchNamespaceUri*/,
+        __in int /*cchNamespaceUri*/,
+        __in_ecount(cchLocalName) const wchar_t* /*pwchLocalName*/,
+        __in int /*cchLocalName*/,
+        __in_ecount(cchQName) const wchar_t* /*pwchQName*/,
+        __in int /*cchQName*/
+        )
+    {
+        HRESULT hr = S_OK;
+
+        if (m_psczCapture)
+        {
+            if (m_dwDepth == m_dwCaptureDepth)
+            {
+                m_psczCapture = NULL;
+            }
+        }
+        else if (3 == m_dwDepth && m_fInEnclosure)
+        {
+            m_fInEnclosure = FALSE;
+        }
+        else if (2 == m_dwDepth && m_fInEntry)
+        {
+            m_fInEntry = FALSE;
+
+            hr = CompleteEntry();
+            ExitOnFailure(hr, "Failed to complete ATOM entry.");
+        }
+
+    LExit:
+        --m_dwDepth;
+
+        return SaveResult(hr);
+    }
+
+    virtual STDMETHODIMP characters(
+        __in_ecount(cchChars) const wchar_t* pwchChars,
+        __in int cchChars
+        )
+    {
+        HRESULT hr = S_OK;
+
+        if (m_psczCapture && 0 < cchChars)
+        {
+            hr = StrAllocConcat(m_psczCapture, pwchChars, cchChars);
+            ExitOnFailure(hr, "Failed to append ATOM element text.");
+        }
+
+    LExit:
+        return SaveResult(hr);
+    }
+
+    virtual STDMETHODIMP ignorableWhitespace(
+        __in_ecount(cchChars) const wchar_t* /*pwchChars*/,
+        __in int /*cchChars*/
+        )
+    {
+        return S_OK;
+    }
+
+    virtual STDMETHODIMP processingInstruction(
+        __in_ecount(cchTarget) const wchar_t* /*pwchTarget*/,
+        __in int /*cchTarget*/,
+        __in_ecount(cchData) const wchar_t* /*pwchData*/,
+        __in int /*cchData*/
+        )
+    {
+        return S_OK;
+    }
+
+    virtual STDMETHODIMP skippedEntity(
+        __in_ecount(cchName) const wchar_t* /*pwchName*/,
+        __in int /*cchName*/
+        )
+    {
+        return S_OK;
+    }
+
+public:
+    HRESULT GetError()
+    {
+        return m_hrError;
+    }
+
+private:
+    HRESULT SaveResult(
+        __in HRESULT hr
+        )
+    {
+        if (FAILED(hr) && SUCCEEDED(m_hrError))
+        {
+            m_hrError = hr;
+        }
+
+        return hr;
+    }
+
+    static BOOL IsName(
+        __in_ecount(cchName) const wchar_t* pwchName,
+        __in int cchName,
+        __in_z LPCWSTR wzExpected
+        )
+    {
+        return CSTR_EQUAL == ::CompareStringW(LOCALE_INVARIANT, 0, pwchName, cchName, wzExpected, -1);
+    }
+
+    //
+    // AllocAttribute - copies an unqualified attribute value, returning S_FALSE if it is not present.
+    //
+    static HRESULT AllocAttribute(
+        __in ISAXAttributes* pAttributes,
+        __in_z LPCWSTR wzName,
+        __deref_out_z LPWSTR* psczValue
+        )
+    {
+        HRESULT hr = S_OK;
+        const wchar_t* pwchValue = NULL;
+        int cchValue = 0;
+
+        hr = pAttributes->getValueFromName(L"", 0, wzName, lstrlenW(wzName), &pwchValue, &cchValue);
+        if (E_INVALIDARG == hr)
+        {
+            ExitFunction1(hr = S_FALSE);
+        }
+        ExitOnFailure1(hr, "Failed to get ATOM attribute: %ls", wzName);
+
+        // A zero length would make StrAllocString treat the unterminated value as a null-terminated string.
+        hr = StrAllocString(psczValue, 0 < cchValue ? pwchValue : L"", cchValue);
+        ExitOnFailure1(hr, "Failed to allocate ATOM attribute: %ls", wzName);
+
+    LExit:
+        return hr;
+    }
+
+    HRESULT BeginCapture(
+        __deref_inout_z LPWSTR* psczTarget
+        )
+    {
+        HRESULT hr = StrAllocString(psczTarget, L"", 0);
+        if (SUCCEEDED(hr))
+        {
+            m_psczCapture = psczTarget;
+            m_dwCaptureDepth = m_dwDepth;
+        }
+
+        return hr;
+    }
+
+    HRESULT BeginEntryElement(
+        __in BOOL fAppsyn,
+        __in_ecount(cchLocalName) const wchar_t* pwchLocalName,
+        __in int cchLocalName,
+        __in ISAXAttributes* pAttributes
+        )
+    {
+        HRESULT hr = S_OK;
+        LPWSTR sczValue = NULL;
+        DWORD dwMajor = 0;
+        DWORD dwMinor = 0;
+
+        if (fAppsyn)
+        {
+            if (IsName(pwchLocalName, cchLocalName, L"application"))
+            {
+                hr = AllocAttribute(pAttributes, L"type", &m_entry.wzApplicationType);
+                ExitOnFailure(hr, "Failed to allocate application type.");
+
+                hr = BeginCapture(&m_entry.wzApplicationId);
+                ExitOnFailure(hr, "Failed to allocate application identity.");
+            }
+            else if (IsName(pwchLocalName, cchLocalName, L"upgrade"))
+            {
+                hr = AllocAttribute(pAttributes, L"version", &sczValue);
+                ExitOnFailure(hr, "Failed to get upgrade version.");
+
+                if (S_OK == hr)
+                {
+                    hr = FileVersionFromString(sczValue, &dwMajor, &dwMinor);
+                    ExitOnFailure(hr, "Failed to parse version string from ATOM entry.");
+
+                    m_entry.dw64UpgradeVersion = static_cast<DWORD64>(dwMajor) << 32 | dwMinor;
+                }
+
+                hr = AllocAttribute(pAttributes, L"exclusive", &sczValue);
+                ExitOnFailure(hr, "Failed to get upgrade exclusive.");
+
+                if (S_OK == hr && CSTR_EQUAL == ::CompareStringW(LOCALE_INVARIANT, 0, sczValue, -1, L"true", -1))
+                {
+                    m_entry.fUpgradeExclusive = TRUE;
+                }
+
+                hr = BeginCapture(&m_entry.wzUpgradeId);
+                ExitOnFailure(hr, "Failed to allocate upgrade id.");
+            }
+            else if (IsName(pwchLocalName, cchLocalName, L"version"))
+            {
+                hr = BeginCapture(&m_sczVersion);
+                ExitOnFailure(hr, "Failed to allocate version.");
+            }
+        }
+        else if (IsName(pwchLocalName, cchLocalName, L"title"))
+        {
+            hr = BeginCapture(&m_entry.wzTitle);
+            ExitOnFailure(hr, "Failed to allocate application title.");
+        }
+        else if (IsName(pwchLocalName, cchLocalName, L"summary"))
+        {
+            hr = BeginCapture(&m_entry.wzSummary);
+            ExitOnFailure(hr, "Failed to allocate application summary.");
+        }
+        else if (IsName(pwchLocalName, cchLocalName, L"content"))
+        {
+            hr = AllocAttribute(pAttributes, L"type", &m_entry.wzContentType);
+            ExitOnFailure(hr, "Failed to allocate content type.");
+
+            hr = BeginCapture(&m_entry.wzContent);
+            ExitOnFailure(hr, "Failed to allocate content.");
+        }
+        else if (IsName(pwchLocalName, cchLocalName, L"link"))
+        {
+            hr = BeginEnclosure(pAttributes);
+            ExitOnFailure(hr, "Failed to parse enclosure.");
+        }
+
+        hr = S_OK;
+
+    LExit:
+        ReleaseStr(sczValue);
+
+        return hr;
+    }
+
+    HRESULT BeginEnclosure(
+        __in ISAXAttributes* pAttributes
+        )
+    {
+        HRESULT hr = S_OK;
+        LPWSTR sczValue = NULL;
+        APPLICATION_UPDATE_ENCLOSURE* pEnclosure = NULL;
+
+        // Only links with rel="enclosure" become enclosures.
+        hr = AllocAttribute(pAttributes, L"rel", &sczValue);
+        ExitOnFailure(hr, "Failed to get ATOM link rel.");
+
+        if (S_FALSE == hr || CSTR_EQUAL != ::CompareStringW(LOCALE_INVARIANT, 0, sczValue, -1, L"enclosure", -1))
+        {
+            ExitFunction1(hr = S_OK);
+        }
+
+        hr = MemEnsureArraySize(reinterpret_cast<LPVOID*>(&m_entry.rgEnclosures), m_entry.cEnclosures + 1, sizeof(APPLICATION_UPDATE_ENCLOSURE), APUP_STREAM_ENCLOSURE_GROWTH);
+        ExitOnFailure(hr, "Failed to allocate enclosures for application update entry.");
+
+        hr = MemEnsureArraySize(reinterpret_cast<LPVOID*>(&m_rgsczDigests), m_entry.cEnclosures + 1, sizeof(LPWSTR), APUP_STREAM_ENCLOSURE_GROWTH);
+        ExitOnFailure(hr, "Failed to allocate digests for application update entry.");
+
+        pEnclosure = m_entry.rgEnclosures + m_entry.cEnclosures;
+        ++m_entry.cEnclosures;
+        m_cDigests = m_entry.cEnclosures;
+
+        hr = AllocAttribute(pAttributes, L"href", &pEnclosure->wzUrl);
+        ExitOnFailure(hr, "Failed to allocate enclosure URL.");
+
+        hr = AllocAttribute(pAttributes, L"length", &sczValue);
+        ExitOnFailure(hr, "Failed to get ATOM link length.");
+
+        if (S_OK == hr)
+        {
+            hr = StrStringToUInt64(sczValue, 0, &pEnclosure->dw64Size);
+            if (E_INVALIDARG == hr)
+            {
+                hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+            }
+            ExitOnFailure(hr, "Failed to parse ATOM link length.");
+        }
+
+        m_fInEnclosure = TRUE;
+        hr = S_OK;
+
+    LExit:
+        ReleaseStr(sczValue);
+
+        return hr;
+    }
+
+    HRESULT BeginEnclosureElement(
+        __in_ecount(cchLocalName) const wchar_t* pwchLocalName,
+        __in int cchLocalName,
+        __in ISAXAttributes* pAttributes
+        )
+    {
+        HRESULT hr = S_OK;
+        LPWSTR sczValue = NULL;
+        DWORD iEnclosure = m_entry.cEnclosures - 1;
+        APPLICATION_UPDATE_ENCLOSURE* pEnclosure = m_entry.rgEnclosures + iEnclosure;
+
+        // Only the first digest is used. It is decoded once the entry is known to be kept.
+        if (IsName(pwchLocalName, cchLocalName, L"digest") && !m_rgsczDigests[iEnclosure])
+        {
+            hr = AllocAttribute(pAttributes, L"algorithm", &sczValue);
+            ExitOnFailure(hr, "Failed to get digest algorithm.");
+
+            if (S_OK == hr)
+            {
+                pEnclosure->digestAlgorithm = ParseDigestAlgorithm(sczValue, -1);
+            }
+
+            hr = BeginCapture(m_rgsczDigests + iEnclosure);
+            ExitOnFailure(hr, "Failed to allocate digest.");
+        }
+        else if (IsName(pwchLocalName, cchLocalName, L"name"))
+        {
+            hr = BeginCapture(&pEnclosure->wzLocalName);
+            ExitOnFailure(hr, "Failed to copy local name.");
+        }
+
+    LExit:
+        ReleaseStr(sczValue);
+
+        return hr;
+    }
+
+    HRESULT CompleteEntry()
+    {
+        HRESULT hr = S_OK;
+        DWORD dwMajor = 0;
+        DWORD dwMinor = 0;
+
+        // Entries without a version or older than the minimum are dropped here rather than
+        // being carried through the sort and filter.
+        if (!m_sczVersion)
+        {
+            ExitFunction();
+        }
+
+        hr = FileVersionFromString(m_sczVersion, &dwMajor, &dwMinor);
+        ExitOnFailure(hr, "Failed to parse version string from ATOM entry.");
+
+        m_entry.dw64Version = static_cast<DWORD64>(dwMajor) << 32 | dwMinor;
+
+        if (m_entry.dw64Version < m_dw64MinimumVersion)
+        {
+            ExitFunction();
+        }
+
+        if (m_entry.dw64UpgradeVersion >= m_entry.dw64Version)
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+            ExitOnRootFailure(hr, "Upgrade version is greater than or equal to application version.");
+        }
+
+        for (DWORD i = 0; i < m_entry.cEnclosures; ++i)
+        {
+            if (m_rgsczDigests[i])
+            {
+                hr = ParseDigest(m_rgsczDigests[i], m_entry.rgEnclosures + i);
+                ExitOnFailure(hr, "Failed to parse enclosure digest.");
+            }
+
+            m_entry.dw64TotalSize += m_entry.rgEnclosures[i].dw64Size;
+        }
+
+        hr = MemEnsureArraySize(reinterpret_cast<LPVOID*>(&m_pChain->rgEntries), m_pChain->cEntries + 1, sizeof(APPLICATION_UPDATE_ENTRY), APUP_STREAM_ENTRY_GROWTH);
+        ExitOnFailure(hr, "Failed to allocate memory for update entries.");
+
+        memcpy_s(m_pChain->rgEntries + m_pChain->cEntries, sizeof(APPLICATION_UPDATE_ENTRY), &m_entry, sizeof(APPLICATION_UPDATE_ENTRY));
+        memset(&m_entry, 0, sizeof(APPLICATION_UPDATE_ENTRY));
+        ++m_pChain->cEntries;
+
+    LExit:
+        ResetEntry();
+
+        return hr;
+    }
+
+    void ResetEntry()
+    {
+        FreeEntry(&m_entry);
+        memset(&m_entry, 0, sizeof(APPLICATION_UPDATE_ENTRY));
+
+        for (DWORD i = 0; i < m_cDigests; ++i)
+        {
+            ReleaseNullStr(m_rgsczDigests[i]);
+        }
+        m_cDigests = 0;
+
+        ReleaseNullStr(m_sczVersion);
+    }
+
+public:
+    CApupAtomStreamHandler(
+        __in APPLICATION_UPDATE_CHAIN* pChain,
+        __in DWORD64 dw64MinimumVersion
+        )
+    {
+        m_cReferences = 1;
+        m_hrError = S_OK;
+
+        m_pChain = pChain;
+        m_dw64MinimumVersion = dw64MinimumVersion;
+
+        m_dwDepth = 0;
+        m_psczCapture = NULL;
+        m_dwCaptureDepth = 0;
+        m_fInEntry = FALSE;
+        m_fInEnclosure = FALSE;
+
+        memset(&m_entry, 0, sizeof(APPLICATION_UPDATE_ENTRY));
+        m_sczVersion = NULL;
+        m_rgsczDigests = NULL;
+        m_cDigests = 0;
+    }
+
+    ~CApupAtomStreamHandler()
+    {
+        ResetEntry();
+        ReleaseMem(m_rgsczDigests);
+    }
+
+private:
+    long m_cReferences;
+    HRESULT m_hrError;
+
+    APPLICATION_UPDATE_CHAIN* m_pChain;
+    DWORD64 m_dw64MinimumVersion;
+
+    DWORD m_dwDepth;
+    LPWSTR* m_psczCapture;
+    DWORD m_dwCaptureDepth;
+    BOOL m_fInEntry;
+    BOOL m_fInEnclosure;
+
+    APPLICATION_UPDATE_ENTRY m_entry;
+    LPWSTR m_sczVersion;
+    LPWSTR* m_rgsczDigests;
+    DWORD m_cDigests;
+};
+
+
 //
 // ApupCalculateChainFromAtom - returns the chain of application updates found in an ATOM feed.
 //
@@ -123,6 +726,69 @@ LExit:
 }
 
 
+//
+// ApupAllocChainFromAtomFile - streams an ATOM feed from disk into a chain of application updates
+//   without building a DOM. Entries with a version lower than dw64MinimumVersion are skipped as they
+//   are read; pass the current version to keep only entries ApupFilterChain could select, or zero
+//   to keep every entry.
+//
+extern "C" HRESULT DAPI ApupAllocChainFromAtomFile(
+    __in_z LPCWSTR wzAtomFile,
+    __in DWORD64 dw64MinimumVersion,
+    __out APPLICATION_UPDATE_CHAIN** ppChain
+    )
+{
+    HRESULT hr = S_OK;
+    IStream* pStream = NULL;
+    VARIANT varSource;
+
+    ::VariantInit(&varSource);
+
+    hr = ::SHCreateStreamOnFileEx(wzAtomFile, STGM_READ | STGM_SHARE_DENY_WRITE, 0, FALSE, NULL, &pStream);
+    ExitOnFailure1(hr, "Failed to open ATOM feed: %ls", wzAtomFile);
+
+    varSource.vt = VT_UNKNOWN;
+    varSource.punkVal = pStream;
+
+    hr = ParseAtomStream(&varSource, dw64MinimumVersion, ppChain);
+    ExitOnFailure1(hr, "Failed to parse ATOM feed: %ls", wzAtomFile);
+
+LExit:
+    ReleaseObject(pStream);
+
+    return hr;
+}
+
+
+//
+// ApupAllocChainFromAtomString - streams an ATOM feed from a string into a chain of application updates
+//   without building a DOM. See ApupAllocChainFromAtomFile for how dw64MinimumVersion is applied.
+//
+extern "C" HRESULT DAPI ApupAllocChainFromAtomString(
+    __in_z LPCWSTR wzAtomString,
+    __in DWORD64 dw64MinimumVersion,
+    __out APPLICATION_UPDATE_CHAIN** ppChain
+    )
+{
+    HRESULT hr = S_OK;
+    VARIANT varSource;
+
+    ::VariantInit(&varSource);
+
+    varSource.vt = VT_BSTR;
+    varSource.bstrVal = ::SysAllocString(wzAtomString);
+    ExitOnNull(varSource.bstrVal, hr, E_OUTOFMEMORY, "Failed to allocate ATOM string.");
+
+    hr = ParseAtomStream(&varSource, dw64MinimumVersion, ppChain);
+    ExitOnFailure(hr, "Failed to parse ATOM string.");
+
+LExit:
+    ::VariantClear(&varSource);
+
+    return hr;
+}
+
+
 //
 // ApupFilterChain - remove the unneeded update elements from the chain.
 //
@@ -343,42 +1009,13 @@ static HRESULT ParseEnclosure(
                 {
                     if (CSTR_EQUAL == ::CompareStringW(LOCALE_INVARIANT, 0, L"algorithm", -1, pAttribute->wzAttribute, -1))
                     {
-                        if (CSTR_EQUAL == ::CompareStringW(LOCALE_INVARIANT, NORM_IGNORECASE, L"md5", -1, pAttribute->wzValue, -1))
-                        {
-                            pEnclosure->digestAlgorithm = APUP_HASH_ALGORITHM_MD5;
-                        }
-                        else if (CSTR_EQUAL == ::CompareStringW(LOCALE_INVARIANT, NORM_IGNORECASE, L"sha1", -1, pAttribute->wzValue, -1))
-                        {
-                            pEnclosure->digestAlgorithm = APUP_HASH_ALGORITHM_SHA1;
-                        }
-                        if (CSTR_EQUAL == ::CompareStringW(LOCALE_INVARIANT, NORM_IGNORECASE, L"sha256", -1, pAttribute->wzValue, -1))
-                        {
-                            pEnclosure->digestAlgorithm = APUP_HASH_ALGORITHM_SHA256;
-                        }
+                        pEnclosure->digestAlgorithm = ParseDigestAlgorithm(pAttribute->wzValue, -1);
                         break;
                     }
                 }
 
-                if (APUP_HASH_ALGORITHM_SHA256 == pEnclosure->digestAlgorithm)
-                {
-                    if (64 != lstrlenW(pElement->wzValue))
-                    {
-                        hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
-                        ExitOnRootFailure(hr, "Invalid digest length for SHA256 algorithm.");
-                    }
-
-                    pEnclosure->cbDigest = sizeof(BYTE) * SHA256_DIGEST_LEN;
-                    pEnclosure->rgbDigest = static_cast<BYTE*>(MemAlloc(pEnclosure->cbDigest, TRUE));
-                    ExitOnNull(pEnclosure->rgbDigest, hr, E_OUTOFMEMORY, "Failed to allocate memory for digest.");
-
-                    hr = StrHexDecode(pElement->wzValue, pEnclosure->rgbDigest, pEnclosure->cbDigest);
-                    ExitOnFailure(hr, "Failed to decode digest value.");
-                }
-                else
-                {
-                    hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
-                    ExitOnRootFailure(hr, "Unknown algorithm type for digest.");
-                }
+                hr = ParseDigest(pElement->wzValue, pEnclosure);
+                ExitOnFailure(hr, "Failed to parse enclosure digest.");
 
                 break;
             }
@@ -403,6 +1040,137 @@ LExit:
 }
 
 
+static APUP_HASH_ALGORITHM ParseDigestAlgorithm(
+    __in_ecount(cchAlgorithm) LPCWSTR wzAlgorithm,
+    __in int cchAlgorithm
+    )
+{
+    APUP_HASH_ALGORITHM algorithm = APUP_HASH_ALGORITHM_UNKNOWN;
+
+    if (CSTR_EQUAL == ::CompareStringW(LOCALE_INVARIANT, NORM_IGNORECASE, L"md5", -1, wzAlgorithm, cchAlgorithm))
+    {
+        algorithm = APUP_HASH_ALGORITHM_MD5;
+    }
+    else if (CSTR_EQUAL == ::CompareStringW(LOCALE_INVARIANT, NORM_IGNORECASE, L"sha1", -1, wzAlgorithm, cchAlgorithm))
+    {
+        algorithm = APUP_HASH_ALGORITHM_SHA1;
+    }
+    else if (CSTR_EQUAL == ::CompareStringW(LOCALE_INVARIANT, NORM_IGNORECASE, L"sha256", -1, wzAlgorithm, cchAlgorithm))
+    {
+        algorithm = APUP_HASH_ALGORITHM_SHA256;
+    }
+
+    return algorithm;
+}
+
+
+static HRESULT ParseDigest(
+    __in_z LPCWSTR wzDigest,
+    __in APPLICATION_UPDATE_ENCLOSURE* pEnclosure
+    )
+{
+    HRESULT hr = S_OK;
+
+    // The digest[@algorithm='sha256'] is required. Everything else is rejected.
+    if (APUP_HASH_ALGORITHM_SHA256 == pEnclosure->digestAlgorithm)
+    {
+        if (64 != lstrlenW(wzDigest))
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+            ExitOnRootFailure(hr, "Invalid digest length for SHA256 algorithm.");
+        }
+
+        pEnclosure->cbDigest = sizeof(BYTE) * SHA256_DIGEST_LEN;
+        pEnclosure->rgbDigest = static_cast<BYTE*>(MemAlloc(pEnclosure->cbDigest, TRUE));
+        ExitOnNull(pEnclosure->rgbDigest, hr, E_OUTOFMEMORY, "Failed to allocate memory for digest.");
+
+        hr = StrHexDecode(wzDigest, pEnclosure->rgbDigest, pEnclosure->cbDigest);
+        ExitOnFailure(hr, "Failed to decode digest value.");
+    }
+    else
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+        ExitOnRootFailure(hr, "Unknown algorithm type for digest.");
+    }
+
+LExit:
+    return hr;
+}
+
+
+static HRESULT ParseAtomStream(
+    __in VARIANT* pvarSource,
+    __in DWORD64 dw64MinimumVersion,
+    __out APPLICATION_UPDATE_CHAIN** ppChain
+    )
+{
+    HRESULT hr = S_OK;
+    ISAXXMLReader* pReader = NULL;
+    CApupAtomStreamHandler* pHandler = NULL;
+    APPLICATION_UPDATE_CHAIN* pChain = NULL;
+    DWORD cEntries = 0;
+
+    pChain = static_cast<APPLICATION_UPDATE_CHAIN*>(MemAlloc(sizeof(APPLICATION_UPDATE_CHAIN), TRUE));
+    ExitOnNull(pChain, hr, E_OUTOFMEMORY, "Failed to allocate update chain.");
+
+    pHandler = new CApupAtomStreamHandler(pChain, dw64MinimumVersion);
+    ExitOnNull(pHandler, hr, E_OUTOFMEMORY, "Failed to create ATOM stream handler.");
+
+    hr = ::CoCreateInstance(__uuidof(SAXXMLReader), NULL, CLSCTX_INPROC_SERVER, __uuidof(ISAXXMLReader), reinterpret_cast<LPVOID*>(&pReader));
+    ExitOnFailure(hr, "Failed to create SAX reader.");
+
+    hr = pReader->putContentHandler(pHandler);
+    ExitOnFailure(hr, "Failed to set SAX content handler.");
+
+    hr = pReader->parse(*pvarSource);
+    if (FAILED(pHandler->GetError()))
+    {
+        hr = pHandler->GetError();
+    }
+    ExitOnFailure(hr, "Failed to read ATOM feed.");
+
+    // The feed's default application id can follow the entries that rely on it, so entries
+    // without any application identity can only be dropped once the whole feed has been read.
+    if (!pChain->wzDefaultApplicationId)
+    {
+        for (DWORD i = 0; i < pChain->cEntries; ++i)
+        {
+            if (pChain->rgEntries[i].wzApplicationId)
+            {
+                pChain->rgEntries[cEntries] = pChain->rgEntries[i];
+                ++cEntries;
+            }
+            else
+            {
+                FreeEntry(pChain->rgEntries + i);
+            }
+        }
+
+        pChain->cEntries = cEntries;
+    }
+
+    if (pChain->cEntries)
+    {
+        // Sort the chain by descending version and ascending total size.
+        qsort_s(pChain->rgEntries, pChain->cEntries, sizeof(APPLICATION_UPDATE_ENTRY), CompareEntries, NULL);
+    }
+    else
+    {
+        ReleaseNullMem(pChain->rgEntries);
+    }
+
+    *ppChain = pChain;
+    pChain = NULL;
+
+LExit:
+    ReleaseObject(pReader);
+    ReleaseObject(pHandler);
+    ReleaseApupChain(pChain);
+
+    return hr;
+}
+
+
 static __callback int __cdecl CompareEntries(
     void* pvContext,
     const void* pvLeft,
@@ -634,6 +1402,7 @@ static void FreeEntry(
             FreeEnclosure(pEntry->rgEnclosures + i);
         }
 
+        ReleaseMem(pEntry->rgEnclosures);
         ReleaseStr(pEntry->wzUpgradeId);
         ReleaseStr(pEntry->wzApplicationType);
         ReleaseStr(pEntry->wzApplicationId);
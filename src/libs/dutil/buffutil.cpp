@@ -254,6 +254,97 @@ LExit:
     return hr;
 }
 
+extern "C" HRESULT BuffReadVarNumber64(
+    __in_bcount(cbBuffer) const BYTE* pbBuffer,
+    __in SIZE_T cbBuffer,
+    __inout SIZE_T* piBuffer,
+    __out DWORD64* pdw64
+    )
+{
+    Assert(pbBuffer);
+    Assert(piBuffer);
+    Assert(pdw64);
+
+    HRESULT hr = S_OK;
+    SIZE_T iBuffer = *piBuffer;
+    DWORD64 dw64 = 0;
+    BYTE b = 0;
+
+    for (DWORD dwShift = 0; ; dwShift += 7)
+    {
+        // verify buffer size, a DWORD64 never takes more than ten bytes
+        if (iBuffer >= cbBuffer || 63 < dwShift)
+        {
+            hr = E_INVALIDARG;
+            ExitOnRootFailure(hr, "Buffer too small or number too long.");
+        }
+
+        b = pbBuffer[iBuffer++];
+        dw64 |= static_cast<DWORD64>(b & 0x7F) << dwShift;
+
+        if (!(b & 0x80))
+        {
+            break;
+        }
+    }
+
+    *pdw64 = dw64;
+    *piBuffer = iBuffer;
+
+LExit:
+    return hr;
+}
+
+extern "C" HRESULT BuffReadVarString(
+    __in_bcount(cbBuffer) const BYTE* pbBuffer,
+    __in SIZE_T cbBuffer,
+    __inout SIZE_T* piBuffer,
+    __deref_out_z LPWSTR* pscz
+    )
+{
+    Assert(pbBuffer);
+    Assert(piBuffer);
+    Assert(pscz);
+
+    HRESULT hr = S_OK;
+    DWORD64 cch = 0;
+    SIZE_T cb = 0;
+    SIZE_T cbAvailable = 0;
+
+    // read character count
+    hr = BuffReadVarNumber64(pbBuffer, cbBuffer, piBuffer, &cch);
+    ExitOnFailure(hr, "Failed to read character count.");
+
+    if (DWORD_MAX < cch)
+    {
+        hr = E_INVALIDARG;
+        ExitOnRootFailure(hr, "Character count too large.");
+    }
+
+    hr = ::SIZETMult(static_cast<SIZE_T>(cch), sizeof(WCHAR), &cb);
+    ExitOnRootFailure(hr, "Overflow while multiplying to calculate buffer size");
+
+    // get availiable data size
+    hr = ::SIZETSub(cbBuffer, *piBuffer, &cbAvailable);
+    ExitOnRootFailure(hr, "Failed to calculate available data size for character buffer.");
+
+    // verify buffer size
+    if (cb > cbAvailable)
+    {
+        hr = E_INVALIDARG;
+        ExitOnRootFailure(hr, "Buffer too small to hold character data.");
+    }
+
+    // copy character data
+    hr = StrAllocString(pscz, cch ? (LPCWSTR)(pbBuffer + *piBuffer) : L"", static_cast<DWORD_PTR>(cch));
+    ExitOnFailure(hr, "Failed to copy character data.");
+
+    *piBuffer += cb;
+
+LExit:
+    return hr;
+}
+
 extern "C" HRESULT BuffWriteNumber(
     __deref_out_bcount(*piBuffer) BYTE** ppbBuffer,
     __inout SIZE_T* piBuffer,
@@ -388,6 +479,63 @@ LExit:
     return hr;
 }
 
+extern "C" HRESULT BuffWriteVarNumber64(
+    __deref_out_bcount(*piBuffer) BYTE** ppbBuffer,
+    __inout SIZE_T* piBuffer,
+    __in DWORD64 dw64
+    )
+{
+    Assert(ppbBuffer);
+    Assert(piBuffer);
+
+    HRESULT hr = S_OK;
+
+    // make sure we have a buffer with sufficient space for the longest encoding
+    hr = EnsureBufferSize(ppbBuffer, *piBuffer + 10);
+    ExitOnFailure(hr, "Failed to ensure buffer size.");
+
+    // copy data to buffer seven bits at a time, low bits first, the high bit of each byte says whether more follow
+    while (0x7F < dw64)
+    {
+        (*ppbBuffer)[(*piBuffer)++] = static_cast<BYTE>(dw64 & 0x7F) | 0x80;
+        dw64 >>= 7;
+    }
+
+    (*ppbBuffer)[(*piBuffer)++] = static_cast<BYTE>(dw64);
+
+LExit:
+    return hr;
+}
+
+extern "C" HRESULT BuffWriteVarString(
+    __deref_out_bcount(*piBuffer) BYTE** ppbBuffer,
+    __inout SIZE_T* piBuffer,
+    __in_z_opt LPCWSTR scz
+    )
+{
+    Assert(ppbBuffer);
+    Assert(piBuffer);
+
+    HRESULT hr = S_OK;
+    DWORD cch = (DWORD)lstrlenW(scz);
+    SIZE_T cb = cch * sizeof(WCHAR);
+
+    // copy character count to buffer
+    hr = BuffWriteVarNumber64(ppbBuffer, piBuffer, cch);
+    ExitOnFailure(hr, "Failed to write character count.");
+
+    // make sure we have a buffer with sufficient space
+    hr = EnsureBufferSize(ppbBuffer, *piBuffer + cb);
+    ExitOnFailure(hr, "Failed to ensure buffer size.");
+
+    // copy data to buffer
+    memcpy_s(*ppbBuffer + *piBuffer, cb, scz, cb);
+    *piBuffer += cb;
+
+LExit:
+    return hr;
+}
+
 
 // helper functions
 
@@ -10,10 +10,10 @@ const LPCWSTR BUNDLE_REGISTRATION_REGISTRY_BUNDLE_UPGRADE_CODE = L"BundleUpgrade
 const LPCWSTR BUNDLE_REGISTRATION_REGISTRY_BUNDLE_PROVIDER_KEY = L"BundleProviderKey";
 
 // Forward declarations.
-static HRESULT OpenBundleKey(
+static HRESULT OpenBundleSnapshot(
     __in LPCWSTR wzBundleId,
     __in BUNDLE_INSTALL_CONTEXT context, 
-    __inout HKEY *key);
+    __inout REG_SNAPSHOT_HANDLE *phSnapshot);
 
 /********************************************************************
 BundleGetBundleInfo - Queries the bundle installation metadata for a given property
@@ -44,7 +44,7 @@ extern "C" HRESULT DAPI BundleGetBundleInfo(
     HRESULT hr = S_OK;
     BUNDLE_INSTALL_CONTEXT context = BUNDLE_INSTALL_CONTEXT_MACHINE;
     LPWSTR sczValue = NULL;
-    HKEY hkBundle = NULL;
+    REG_SNAPSHOT_HANDLE hBundle = NULL;
     DWORD cchSource = 0;
     DWORD dwType = 0;
     DWORD dwValue = 0;
@@ -54,24 +54,24 @@ extern "C" HRESULT DAPI BundleGetBundleInfo(
         ExitOnFailure(hr = E_INVALIDARG, "An invalid parameter was passed to the function.");
     }
 
-    if (FAILED(hr = OpenBundleKey(wzBundleId, context = BUNDLE_INSTALL_CONTEXT_MACHINE, &hkBundle)) &&
-        FAILED(hr = OpenBundleKey(wzBundleId, context = BUNDLE_INSTALL_CONTEXT_USER, &hkBundle)))
+    if (FAILED(hr = OpenBundleSnapshot(wzBundleId, context = BUNDLE_INSTALL_CONTEXT_MACHINE, &hBundle)) &&
+        FAILED(hr = OpenBundleSnapshot(wzBundleId, context = BUNDLE_INSTALL_CONTEXT_USER, &hBundle)))
     {
         ExitOnFailure(E_FILENOTFOUND == hr ? HRESULT_FROM_WIN32(ERROR_UNKNOWN_PRODUCT) : hr, "Failed to locate bundle uninstall key path.");
     }
 
     // If the bundle doesn't have the property defined, return ERROR_UNKNOWN_PROPERTY
-    hr = RegGetType(hkBundle, wzAttribute, &dwType);
+    hr = RegSnapshotGetType(hBundle, wzAttribute, &dwType);
     ExitOnFailure(E_FILENOTFOUND == hr ? HRESULT_FROM_WIN32(ERROR_UNKNOWN_PROPERTY) : hr, "Failed to locate bundle property.");
 
     switch (dwType)
     {
         case REG_SZ:
-            hr = RegReadString(hkBundle, wzAttribute, &sczValue);
+            hr = RegSnapshotReadString(hBundle, wzAttribute, &sczValue);
             ExitOnFailure(hr, "Failed to read string property.");
             break;
         case REG_DWORD:
-            hr = RegReadNumber(hkBundle, wzAttribute, &dwValue);
+            hr = RegSnapshotReadNumber(hBundle, wzAttribute, &dwValue);
             ExitOnFailure(hr, "Failed to read dword property.");
 
             hr = StrAllocFormatted(&sczValue, L"%d", dwValue);
@@ -101,7 +101,7 @@ extern "C" HRESULT DAPI BundleGetBundleInfo(
     }
 
 LExit:
-    ReleaseRegKey(hkBundle);
+    ReleaseRegSnapshot(hBundle);
     ReleaseStr(sczValue);
 
     return hr;
@@ -242,17 +242,18 @@ LExit:
 }
 
 /********************************************************************
-OpenBundleKey - Opens the bundle uninstallation key for a given bundle
+OpenBundleSnapshot - Opens the bundle uninstallation key for a given bundle
+                     and reads all of its values
 
-NOTE: caller is responsible for closing key
+NOTE: caller is responsible for releasing the snapshot
 ********************************************************************/
-HRESULT OpenBundleKey(
+HRESULT OpenBundleSnapshot(
     __in LPCWSTR wzBundleId,
     __in BUNDLE_INSTALL_CONTEXT context, 
-    __inout HKEY *key)
+    __inout REG_SNAPSHOT_HANDLE *phSnapshot)
 {
-    Assert(key && wzBundleId);
-    AssertSz(NULL == *key, "*key should be null");
+    Assert(phSnapshot && wzBundleId);
+    AssertSz(NULL == *phSnapshot, "*phSnapshot should be null");
 
     HRESULT hr = S_OK;
     HKEY hkRoot = BUNDLE_INSTALL_CONTEXT_USER == context ? HKEY_CURRENT_USER : HKEY_LOCAL_MACHINE;
@@ -261,7 +262,7 @@ HRESULT OpenBundleKey(
     hr = StrAllocFormatted(&sczKeypath, L"%ls\\%ls", BUNDLE_REGISTRATION_REGISTRY_UNINSTALL_KEY, wzBundleId);
     ExitOnFailure(hr, "Failed to allocate bundle uninstall key path.");
     
-    hr = RegOpen(hkRoot, sczKeypath, KEY_READ, key);
+    hr = RegSnapshotOpen(hkRoot, sczKeypath, KEY_READ, phSnapshot);
     ExitOnFailure(hr, "Failed to open bundle uninstall key path.");
 
 LExit:
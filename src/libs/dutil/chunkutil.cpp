@@ -0,0 +1,1391 @@
+// Copyright (c) .NET Foundation and contributors. All rights reserved. Licensed under the Microsoft Reciprocal License. See LICENSE.TXT file in the project root for full license information.
+
+#include "precomp.h"
+
+// A chunked container holds named streams concatenated one after the other and cut into chunks of a fixed
+// uncompressed size. Each chunk is compressed on its own so the chunks can be decompressed in any order and
+// on any number of threads. The index at the end of the container gives the location of every chunk and
+// every stream so a single stream can be read without reading the streams before it.
+//
+//   CHUNK_CONTAINER_HEADER
+//   chunk data
+//   index, written with buffutil:
+//     for each chunk: offset in the container, compressed size, uncompressed size, compression format
+//     for each stream: name, offset in the concatenated streams, size
+
+static const DWORD CHUNK_CONTAINER_MAGIC = 0x4B4E4843; // "CHNK"
+static const DWORD CHUNK_CONTAINER_VERSION = 1;
+static const DWORD CHUNK_NONE = 0xFFFFFFFF;
+static const USHORT CHUNK_COMPRESSION_ENGINE = COMPRESSION_FORMAT_LZNT1 | COMPRESSION_ENGINE_MAXIMUM;
+static const ULONG CHUNK_COMPRESSION_UNIT = 4096;
+static const LONG CHUNK_STATUS_BUFFER_TOO_SMALL = static_cast<LONG>(0xC0000023);
+
+// smallest serialized size of an index entry, used to reject counts the index could not hold
+static const DWORD CHUNK_MIN_INDEX_CHUNK_SIZE = sizeof(DWORD64) + 3 * sizeof(DWORD);
+static const DWORD CHUNK_MIN_INDEX_STREAM_SIZE = sizeof(DWORD) + 2 * sizeof(DWORD64);
+
+// external prototypes
+typedef LONG (NTAPI *PFN_RTLGETCOMPRESSIONWORKSPACESIZE)(USHORT, PULONG, PULONG);
+typedef LONG (NTAPI *PFN_RTLCOMPRESSBUFFER)(USHORT, PUCHAR, ULONG, PUCHAR, ULONG, ULONG, PULONG, PVOID);
+typedef LONG (NTAPI *PFN_RTLDECOMPRESSBUFFER)(USHORT, PUCHAR, ULONG, PUCHAR, ULONG, PULONG);
+
+//
+// static globals
+//
+static PFN_RTLGETCOMPRESSIONWORKSPACESIZE vpfnRtlGetCompressionWorkSpaceSize = NULL;
+static PFN_RTLCOMPRESSBUFFER vpfnRtlCompressBuffer = NULL;
+static PFN_RTLDECOMPRESSBUFFER vpfnRtlDecompressBuffer = NULL;
+
+//
+// structs
+//
+struct CHUNK_CONTAINER_HEADER
+{
+    DWORD dwMagic;
+    DWORD dwVersion;
+    DWORD cbChunk;
+    DWORD cChunks;
+    DWORD cStreams;
+    DWORD cbIndex;
+    DWORD64 qwIndexOffset;
+};
+
+struct CHUNK_INDEX_CHUNK
+{
+    DWORD64 qwOffset;
+    DWORD cbCompressed;
+    DWORD cbUncompressed;
+    DWORD dwCompression;
+};
+
+struct CHUNK_INDEX_STREAM
+{
+    LPWSTR sczName;
+    DWORD64 qwOffset;
+    DWORD64 qwSize;
+};
+
+struct CHUNK_WRITER
+{
+    HANDLE hFile;
+    LPWSTR sczPath;
+    HRESULT hrError;            // an add that fails part way leaves a partial stream behind so the container cannot be finished.
+
+    DWORD cbChunk;
+    BYTE* pbChunk;
+    DWORD cbChunkData;
+    BYTE* pbCompressed;
+    BYTE* pbWorkspace;
+    DWORD64 qwFileOffset;
+    DWORD64 qwStreamOffset;
+
+    CHUNK_INDEX_CHUNK* rgChunks;
+    DWORD cChunks;
+    CHUNK_INDEX_STREAM* rgStreams;
+    DWORD cStreams;
+    STRINGDICT_HANDLE sdStreams;
+};
+
+struct CHUNK_READER
+{
+    HANDLE hFile;
+    DWORD64 qwOffset;
+
+    DWORD cbChunk;
+    CHUNK_INDEX_CHUNK* rgChunks;
+    DWORD cChunks;
+    CHUNK_INDEX_STREAM* rgStreams;
+    DWORD cStreams;
+    STRINGDICT_HANDLE sdStreams;
+
+    // last chunk decompressed when reading a single stream, consecutive small streams usually share it
+    DWORD iCachedChunk;
+    BYTE* pbCachedChunk;
+    BYTE* pbCompressed;
+};
+
+struct CHUNK_EXTRACT_TARGET
+{
+    CHUNK_EXTRACT_STREAM* pRequest;
+    CHUNK_INDEX_STREAM* pStream;
+    HANDLE hFile;
+};
+
+struct CHUNK_EXTRACT_CONTEXT
+{
+    CHUNK_READER* pReader;
+
+    CHUNK_EXTRACT_TARGET* rgTargets;    // sorted by the offset of their stream.
+    DWORD cTargets;
+    DWORD* rgiChunks;                   // chunks holding data of any target.
+    DWORD cChunks;
+
+    LONG volatile iNextChunk;
+    LONG volatile hrError;
+};
+
+//
+// prototypes
+//
+static HRESULT LoadCompression();
+static HRESULT WriteChunk(
+    __in CHUNK_WRITER* pWriter
+    );
+static void FreeWriter(
+    __in CHUNK_WRITER* pWriter,
+    __in BOOL fDeleteContainer
+    );
+static HRESULT ReadIndex(
+    __in CHUNK_READER* pReader,
+    __in DWORD64 qwSize
+    );
+static HRESULT ReadChunk(
+    __in CHUNK_READER* pReader,
+    __in DWORD iChunk,
+    __in_bcount(pReader->cbChunk) BYTE* pbCompressed,
+    __out_bcount(pReader->cbChunk) BYTE* pbChunk
+    );
+static HRESULT CopyStream(
+    __in CHUNK_READER* pReader,
+    __in DWORD iStream,
+    __out_bcount_opt(pReader->rgStreams[iStream].qwSize) BYTE* pbTarget,
+    __in HANDLE hTarget
+    );
+static DWORD WINAPI ExtractChunksThreadProc(
+    __in LPVOID lpThreadParameter
+    );
+static HRESULT ExtractChunks(
+    __in CHUNK_EXTRACT_CONTEXT* pContext
+    );
+static DWORD FindFirstTarget(
+    __in CHUNK_EXTRACT_CONTEXT* pContext,
+    __in DWORD64 qwOffset
+    );
+static int __cdecl CompareTargets(
+    __in const void* pvLeft,
+    __in const void* pvRight
+    );
+static HRESULT ReadAt(
+    __in HANDLE hFile,
+    __in DWORD64 qwOffset,
+    __out_bcount(cb) LPVOID pv,
+    __in DWORD cb
+    );
+static HRESULT WriteAt(
+    __in HANDLE hFile,
+    __in DWORD64 qwOffset,
+    __in_bcount(cb) LPCVOID pv,
+    __in DWORD cb
+    );
+
+
+/********************************************************************
+ChunkWriteBegin - begins creating a chunked container
+
+NOTE: cbChunk can be 0 to use CHUNK_DEFAULT_SIZE.
+      phWriter must be passed to ChunkWriteFinish or ChunkWriteCancel.
+********************************************************************/
+extern "C" HRESULT DAPI ChunkWriteBegin(
+    __in_z LPCWSTR wzContainer,
+    __in DWORD cbChunk,
+    __out HANDLE* phWriter
+    )
+{
+    HRESULT hr = S_OK;
+    CHUNK_WRITER* pWriter = NULL;
+    CHUNK_CONTAINER_HEADER header = { };
+    ULONG cbWorkspace = 0;
+    ULONG cbFragmentWorkspace = 0;
+    LONG status = 0;
+
+    if (!cbChunk)
+    {
+        cbChunk = CHUNK_DEFAULT_SIZE;
+    }
+    else if (CHUNK_MAX_SIZE < cbChunk)
+    {
+        hr = E_INVALIDARG;
+        ExitOnRootFailure1(hr, "Chunk size too large: %u", cbChunk);
+    }
+
+    hr = LoadCompression();
+    ExitOnFailure(hr, "Failed to load compression functions.");
+
+    pWriter = static_cast<CHUNK_WRITER*>(MemAlloc(sizeof(CHUNK_WRITER), TRUE));
+    ExitOnNull(pWriter, hr, E_OUTOFMEMORY, "Failed to allocate chunked container writer.");
+
+    pWriter->hFile = INVALID_HANDLE_VALUE;
+    pWriter->cbChunk = cbChunk;
+
+    hr = StrAllocString(&pWriter->sczPath, wzContainer, 0);
+    ExitOnFailure(hr, "Failed to copy container path.");
+
+    pWriter->pbChunk = static_cast<BYTE*>(MemAlloc(cbChunk, FALSE));
+    ExitOnNull(pWriter->pbChunk, hr, E_OUTOFMEMORY, "Failed to allocate chunk buffer.");
+
+    pWriter->pbCompressed = static_cast<BYTE*>(MemAlloc(cbChunk, FALSE));
+    ExitOnNull(pWriter->pbCompressed, hr, E_OUTOFMEMORY, "Failed to allocate compressed chunk buffer.");
+
+    status = vpfnRtlGetCompressionWorkSpaceSize(CHUNK_COMPRESSION_ENGINE, &cbWorkspace, &cbFragmentWorkspace);
+    if (0 > status)
+    {
+        hr = HRESULT_FROM_NT(status);
+        ExitOnRootFailure(hr, "Failed to get compression workspace size.");
+    }
+
+    pWriter->pbWorkspace = static_cast<BYTE*>(MemAlloc(cbWorkspace, FALSE));
+    ExitOnNull(pWriter->pbWorkspace, hr, E_OUTOFMEMORY, "Failed to allocate compression workspace.");
+
+    hr = DictCreateWithEmbeddedKey(&pWriter->sdStreams, 0, reinterpret_cast<void**>(&pWriter->rgStreams), offsetof(CHUNK_INDEX_STREAM, sczName), DICT_FLAG_NONE);
+    ExitOnFailure(hr, "Failed to create stream name index.");
+
+    pWriter->hFile = ::CreateFileW(wzContainer, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    ExitOnInvalidHandleWithLastError1(pWriter->hFile, hr, "Failed to create container: %ls", wzContainer);
+
+    // Reserve room for the header, it is written once the index is.
+    hr = FileWriteHandle(pWriter->hFile, reinterpret_cast<LPCBYTE>(&header), sizeof(header));
+    ExitOnFailure1(hr, "Failed to write header placeholder to container: %ls", wzContainer);
+
+    pWriter->qwFileOffset = sizeof(header);
+
+    *phWriter = pWriter;
+    pWriter = NULL;
+
+LExit:
+    if (pWriter)
+    {
+        FreeWriter(pWriter, INVALID_HANDLE_VALUE != pWriter->hFile);
+    }
+
+    return hr;
+}
+
+
+/********************************************************************
+ChunkWriteAddFile - appends the content of a file as a named stream
+
+********************************************************************/
+extern "C" HRESULT DAPI ChunkWriteAddFile(
+    __in HANDLE hWriter,
+    __in_z LPCWSTR wzFile,
+    __in_z LPCWSTR wzStreamName
+    )
+{
+    HRESULT hr = S_OK;
+    CHUNK_WRITER* pWriter = static_cast<CHUNK_WRITER*>(hWriter);
+    CHUNK_INDEX_STREAM* pStream = NULL;
+    HANDLE hFile = INVALID_HANDLE_VALUE;
+    DWORD cbRead = 0;
+    DWORD64 qwSize = 0;
+
+    hr = pWriter->hrError;
+    ExitOnFailure(hr, "Cannot add to a container after a failure.");
+
+    hr = DictKeyExists(pWriter->sdStreams, wzStreamName);
+    if (E_NOTFOUND != hr)
+    {
+        ExitOnFailure1(hr, "Failed to check for existing stream: %ls", wzStreamName);
+
+        hr = HRESULT_FROM_WIN32(ERROR_DUP_NAME);
+        ExitOnRootFailure1(hr, "Stream already in container: %ls", wzStreamName);
+    }
+
+    hFile = ::CreateFileW(wzFile, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    ExitOnInvalidHandleWithLastError1(hFile, hr, "Failed to open file: %ls", wzFile);
+
+    hr = MemEnsureArraySize(reinterpret_cast<LPVOID*>(&pWriter->rgStreams), pWriter->cStreams + 1, sizeof(CHUNK_INDEX_STREAM), 64);
+    ExitOnFailure(hr, "Failed to grow stream index.");
+
+    pStream = pWriter->rgStreams + pWriter->cStreams;
+
+    hr = StrAllocString(&pStream->sczName, wzStreamName, 0);
+    ExitOnFailure(hr, "Failed to copy stream name.");
+
+    pStream->qwOffset = pWriter->qwStreamOffset;
+
+    // Fill the chunk buffer straight from the file, writing out chunks as they fill up.
+    for (;;)
+    {
+        if (!::ReadFile(hFile, pWriter->pbChunk + pWriter->cbChunkData, pWriter->cbChunk - pWriter->cbChunkData, &cbRead, NULL))
+        {
+            ExitWithLastError1(hr, "Failed to read file: %ls", wzFile);
+        }
+
+        if (!cbRead)
+        {
+            break;
+        }
+
+        pWriter->cbChunkData += cbRead;
+        qwSize += cbRead;
+
+        if (pWriter->cbChunkData == pWriter->cbChunk)
+        {
+            hr = WriteChunk(pWriter);
+            ExitOnFailure(hr, "Failed to write chunk.");
+        }
+    }
+
+    pStream->qwSize = qwSize;
+    pWriter->qwStreamOffset += qwSize;
+    ++pWriter->cStreams;
+
+    hr = DictAddValue(pWriter->sdStreams, pStream);
+    ExitOnFailure1(hr, "Failed to index stream: %ls", wzStreamName);
+
+LExit:
+    ReleaseFile(hFile);
+
+    // Once the stream is started part of it may be in the written chunks, so the container is unusable.
+    if (FAILED(hr) && pStream)
+    {
+        if (pWriter->rgStreams + pWriter->cStreams == pStream)
+        {
+            ReleaseNullStr(pStream->sczName);
+        }
+
+        if (SUCCEEDED(pWriter->hrError))
+        {
+            pWriter->hrError = hr;
+        }
+    }
+
+    return hr;
+}
+
+
+/********************************************************************
+ChunkWriteFinish - writes the last chunk and the index
+
+NOTE: hWriter is freed even on failure, in which case the container
+      is deleted.
+********************************************************************/
+extern "C" HRESULT DAPI ChunkWriteFinish(
+    __in HANDLE hWriter
+    )
+{
+    HRESULT hr = S_OK;
+    CHUNK_WRITER* pWriter = static_cast<CHUNK_WRITER*>(hWriter);
+    CHUNK_CONTAINER_HEADER header = { };
+    BYTE* pbIndex = NULL;
+    SIZE_T cbIndex = 0;
+    LARGE_INTEGER li = { };
+
+    hr = pWriter->hrError;
+    ExitOnFailure(hr, "Cannot finish a container after a failure.");
+
+    if (pWriter->cbChunkData)
+    {
+        hr = WriteChunk(pWriter);
+        ExitOnFailure(hr, "Failed to write last chunk.");
+    }
+
+    for (DWORD i = 0; i < pWriter->cChunks; ++i)
+    {
+        CHUNK_INDEX_CHUNK* pChunk = pWriter->rgChunks + i;
+
+        hr = BuffWriteNumber64(&pbIndex, &cbIndex, pChunk->qwOffset);
+        ExitOnFailure(hr, "Failed to write chunk offset.");
+
+        hr = BuffWriteNumber(&pbIndex, &cbIndex, pChunk->cbCompressed);
+        ExitOnFailure(hr, "Failed to write chunk compressed size.");
+
+        hr = BuffWriteNumber(&pbIndex, &cbIndex, pChunk->cbUncompressed);
+        ExitOnFailure(hr, "Failed to write chunk uncompressed size.");
+
+        hr = BuffWriteNumber(&pbIndex, &cbIndex, pChunk->dwCompression);
+        ExitOnFailure(hr, "Failed to write chunk compression.");
+    }
+
+    for (DWORD i = 0; i < pWriter->cStreams; ++i)
+    {
+        CHUNK_INDEX_STREAM* pStream = pWriter->rgStreams + i;
+
+        hr = BuffWriteString(&pbIndex, &cbIndex, pStream->sczName);
+        ExitOnFailure(hr, "Failed to write stream name.");
+
+        hr = BuffWriteNumber64(&pbIndex, &cbIndex, pStream->qwOffset);
+        ExitOnFailure(hr, "Failed to write stream offset.");
+
+        hr = BuffWriteNumber64(&pbIndex, &cbIndex, pStream->qwSize);
+        ExitOnFailure(hr, "Failed to write stream size.");
+    }
+
+    if (DWORD_MAX < cbIndex)
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_ARITHMETIC_OVERFLOW);
+        ExitOnRootFailure(hr, "Container index too large.");
+    }
+
+    hr = FileWriteHandle(pWriter->hFile, pbIndex, static_cast<DWORD>(cbIndex));
+    ExitOnFailure1(hr, "Failed to write index to container: %ls", pWriter->sczPath);
+
+    header.dwMagic = CHUNK_CONTAINER_MAGIC;
+    header.dwVersion = CHUNK_CONTAINER_VERSION;
+    header.cbChunk = pWriter->cbChunk;
+    header.cChunks = pWriter->cChunks;
+    header.cStreams = pWriter->cStreams;
+    header.cbIndex = static_cast<DWORD>(cbIndex);
+    header.qwIndexOffset = pWriter->qwFileOffset;
+
+    if (!::SetFilePointerEx(pWriter->hFile, li, NULL, FILE_BEGIN))
+    {
+        ExitWithLastError1(hr, "Failed to seek to start of container: %ls", pWriter->sczPath);
+    }
+
+    hr = FileWriteHandle(pWriter->hFile, reinterpret_cast<LPCBYTE>(&header), sizeof(header));
+    ExitOnFailure1(hr, "Failed to write header to container: %ls", pWriter->sczPath);
+
+LExit:
+    ReleaseMem(pbIndex);
+    FreeWriter(pWriter, FAILED(hr));
+
+    return hr;
+}
+
+
+/********************************************************************
+ChunkWriteCancel - stops creating a container and deletes it
+
+********************************************************************/
+extern "C" void DAPI ChunkWriteCancel(
+    __in HANDLE hWriter
+    )
+{
+    FreeWriter(static_cast<CHUNK_WRITER*>(hWriter), TRUE);
+}
+
+
+/********************************************************************
+ChunkReadOpen - opens a chunked container and reads its index
+
+NOTE: hFile is duplicated, it must be a synchronous handle.
+      qwOffset is where the container starts in the file.
+      qwSize can be 0 for the rest of the file.
+********************************************************************/
+extern "C" HRESULT DAPI ChunkReadOpen(
+    __in HANDLE hFile,
+    __in DWORD64 qwOffset,
+    __in DWORD64 qwSize,
+    __out HANDLE* phReader
+    )
+{
+    HRESULT hr = S_OK;
+    CHUNK_READER* pReader = NULL;
+    LONGLONG llFileSize = 0;
+
+    hr = LoadCompression();
+    ExitOnFailure(hr, "Failed to load compression functions.");
+
+    pReader = static_cast<CHUNK_READER*>(MemAlloc(sizeof(CHUNK_READER), TRUE));
+    ExitOnNull(pReader, hr, E_OUTOFMEMORY, "Failed to allocate chunked container reader.");
+
+    pReader->hFile = INVALID_HANDLE_VALUE;
+    pReader->qwOffset = qwOffset;
+    pReader->iCachedChunk = CHUNK_NONE;
+
+    if (!::DuplicateHandle(::GetCurrentProcess(), hFile, ::GetCurrentProcess(), &pReader->hFile, 0, FALSE, DUPLICATE_SAME_ACCESS))
+    {
+        ExitWithLastError(hr, "Failed to duplicate handle to container.");
+    }
+
+    if (!qwSize)
+    {
+        hr = FileSizeByHandle(pReader->hFile, &llFileSize);
+        ExitOnFailure(hr, "Failed to get size of container file.");
+
+        if (static_cast<DWORD64>(llFileSize) < qwOffset)
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+            ExitOnRootFailure(hr, "Container starts past the end of the file.");
+        }
+
+        qwSize = static_cast<DWORD64>(llFileSize) - qwOffset;
+    }
+
+    hr = ReadIndex(pReader, qwSize);
+    ExitOnFailure(hr, "Failed to read container index.");
+
+    *phReader = pReader;
+    pReader = NULL;
+
+LExit:
+    ReleaseChunkReader(pReader);
+
+    return hr;
+}
+
+
+/********************************************************************
+ChunkReadGetStreamCount - returns the number of streams in a container
+
+********************************************************************/
+extern "C" DWORD DAPI ChunkReadGetStreamCount(
+    __in HANDLE hReader
+    )
+{
+    return static_cast<CHUNK_READER*>(hReader)->cStreams;
+}
+
+
+/********************************************************************
+ChunkReadGetStream - returns the name and size of a stream
+
+NOTE: the name is owned by the reader.
+********************************************************************/
+extern "C" HRESULT DAPI ChunkReadGetStream(
+    __in HANDLE hReader,
+    __in DWORD iStream,
+    __out_z LPCWSTR* pwzStreamName,
+    __out_opt DWORD64* pqwSize
+    )
+{
+    HRESULT hr = S_OK;
+    CHUNK_READER* pReader = static_cast<CHUNK_READER*>(hReader);
+
+    if (iStream >= pReader->cStreams)
+    {
+        hr = E_INVALIDARG;
+        ExitOnRootFailure1(hr, "Invalid stream index: %u", iStream);
+    }
+
+    *pwzStreamName = pReader->rgStreams[iStream].sczName;
+
+    if (pqwSize)
+    {
+        *pqwSize = pReader->rgStreams[iStream].qwSize;
+    }
+
+LExit:
+    return hr;
+}
+
+
+/********************************************************************
+ChunkReadFindStream - finds a stream by name
+
+NOTE: returns E_NOTFOUND if the container has no such stream.
+********************************************************************/
+extern "C" HRESULT DAPI ChunkReadFindStream(
+    __in HANDLE hReader,
+    __in_z LPCWSTR wzStreamName,
+    __out DWORD* piStream
+    )
+{
+    HRESULT hr = S_OK;
+    CHUNK_READER* pReader = static_cast<CHUNK_READER*>(hReader);
+    CHUNK_INDEX_STREAM* pStream = NULL;
+
+    hr = DictGetValue(pReader->sdStreams, wzStreamName, reinterpret_cast<void**>(&pStream));
+    if (E_NOTFOUND == hr)
+    {
+        ExitFunction();
+    }
+    ExitOnFailure1(hr, "Failed to find stream: %ls", wzStreamName);
+
+    *piStream = static_cast<DWORD>(pStream - pReader->rgStreams);
+
+LExit:
+    return hr;
+}
+
+
+/********************************************************************
+ChunkReadStreamToBuffer - decompresses a single stream into memory
+
+NOTE: only the chunks holding the stream are read.
+********************************************************************/
+extern "C" HRESULT DAPI ChunkReadStreamToBuffer(
+    __in HANDLE hReader,
+    __in DWORD iStream,
+    __deref_out_bcount(*pcbBuffer) BYTE** ppbBuffer,
+    __out SIZE_T* pcbBuffer
+    )
+{
+    HRESULT hr = S_OK;
+    CHUNK_READER* pReader = static_cast<CHUNK_READER*>(hReader);
+    BYTE* pbBuffer = NULL;
+    DWORD64 qwSize = 0;
+
+    if (iStream >= pReader->cStreams)
+    {
+        hr = E_INVALIDARG;
+        ExitOnRootFailure1(hr, "Invalid stream index: %u", iStream);
+    }
+
+    qwSize = pReader->rgStreams[iStream].qwSize;
+    if (static_cast<SIZE_T>(-1) < qwSize)
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_ARITHMETIC_OVERFLOW);
+        ExitOnRootFailure1(hr, "Stream too large to read into memory: %ls", pReader->rgStreams[iStream].sczName);
+    }
+
+    pbBuffer = static_cast<BYTE*>(MemAlloc(static_cast<SIZE_T>(qwSize), FALSE));
+    ExitOnNull(pbBuffer, hr, E_OUTOFMEMORY, "Failed to allocate buffer for stream.");
+
+    hr = CopyStream(pReader, iStream, pbBuffer, INVALID_HANDLE_VALUE);
+    ExitOnFailure1(hr, "Failed to read stream: %ls", pReader->rgStreams[iStream].sczName);
+
+    *ppbBuffer = pbBuffer;
+    pbBuffer = NULL;
+    *pcbBuffer = static_cast<SIZE_T>(qwSize);
+
+LExit:
+    ReleaseMem(pbBuffer);
+
+    return hr;
+}
+
+
+/********************************************************************
+ChunkReadStreamToFile - decompresses a single stream into a file
+
+NOTE: only the chunks holding the stream are read.
+********************************************************************/
+extern "C" HRESULT DAPI ChunkReadStreamToFile(
+    __in HANDLE hReader,
+    __in DWORD iStream,
+    __in_z LPCWSTR wzTargetFile
+    )
+{
+    HRESULT hr = S_OK;
+    CHUNK_READER* pReader = static_cast<CHUNK_READER*>(hReader);
+    HANDLE hTarget = INVALID_HANDLE_VALUE;
+
+    if (iStream >= pReader->cStreams)
+    {
+        hr = E_INVALIDARG;
+        ExitOnRootFailure1(hr, "Invalid stream index: %u", iStream);
+    }
+
+    hTarget = ::CreateFileW(wzTargetFile, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    ExitOnInvalidHandleWithLastError1(hTarget, hr, "Failed to create file: %ls", wzTargetFile);
+
+    hr = CopyStream(pReader, iStream, NULL, hTarget);
+    ExitOnFailure2(hr, "Failed to extract stream: %ls to file: %ls", pReader->rgStreams[iStream].sczName, wzTargetFile);
+
+LExit:
+    ReleaseFile(hTarget);
+
+    return hr;
+}
+
+
+/********************************************************************
+ChunkReadStreamsToFiles - decompresses many streams into files,
+                          spreading the chunks over several threads
+
+NOTE: cThreads can be 0 to use one thread per processor.
+      Streams that are not in the container are left with fExtracted
+      set to FALSE.
+********************************************************************/
+extern "C" HRESULT DAPI ChunkReadStreamsToFiles(
+    __in HANDLE hReader,
+    __in_ecount(cStreams) CHUNK_EXTRACT_STREAM* rgStreams,
+    __in DWORD cStreams,
+    __in DWORD cThreads
+    )
+{
+    HRESULT hr = S_OK;
+    CHUNK_READER* pReader = static_cast<CHUNK_READER*>(hReader);
+    CHUNK_EXTRACT_CONTEXT context = { };
+    BYTE* rgfChunks = NULL;
+    HANDLE rghThreads[MAXIMUM_WAIT_OBJECTS] = { };
+    DWORD cStartedThreads = 0;
+    SYSTEM_INFO systemInfo = { };
+    LARGE_INTEGER li = { };
+
+    context.pReader = pReader;
+
+    context.rgTargets = static_cast<CHUNK_EXTRACT_TARGET*>(MemAlloc(sizeof(CHUNK_EXTRACT_TARGET) * cStreams, TRUE));
+    ExitOnNull(context.rgTargets, hr, E_OUTOFMEMORY, "Failed to allocate extraction targets.");
+
+    rgfChunks = static_cast<BYTE*>(MemAlloc(pReader->cChunks, TRUE));
+    ExitOnNull(rgfChunks, hr, E_OUTOFMEMORY, "Failed to allocate wanted chunks.");
+
+    // Create every target up front so the chunks can be written in any order.
+    for (DWORD i = 0; i < cStreams; ++i)
+    {
+        CHUNK_EXTRACT_STREAM* pRequest = rgStreams + i;
+        CHUNK_INDEX_STREAM* pStream = NULL;
+        CHUNK_EXTRACT_TARGET* pTarget = NULL;
+
+        pRequest->fExtracted = FALSE;
+
+        hr = DictGetValue(pReader->sdStreams, pRequest->wzStreamName, reinterpret_cast<void**>(&pStream));
+        if (E_NOTFOUND == hr)
+        {
+            continue;
+        }
+        ExitOnFailure1(hr, "Failed to find stream: %ls", pRequest->wzStreamName);
+
+        pTarget = context.rgTargets + context.cTargets;
+        pTarget->pRequest = pRequest;
+        pTarget->pStream = pStream;
+
+        pTarget->hFile = ::CreateFileW(pRequest->wzTargetFile, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        ExitOnInvalidHandleWithLastError1(pTarget->hFile, hr, "Failed to create file: %ls", pRequest->wzTargetFile);
+
+        ++context.cTargets;
+
+        li.QuadPart = static_cast<LONGLONG>(pStream->qwSize);
+        if (!::SetFilePointerEx(pTarget->hFile, li, NULL, FILE_BEGIN) || !::SetEndOfFile(pTarget->hFile))
+        {
+            ExitWithLastError1(hr, "Failed to set size of file: %ls", pRequest->wzTargetFile);
+        }
+
+        if (pStream->qwSize)
+        {
+            DWORD iLastChunk = static_cast<DWORD>((pStream->qwOffset + pStream->qwSize - 1) / pReader->cbChunk);
+            for (DWORD iChunk = static_cast<DWORD>(pStream->qwOffset / pReader->cbChunk); iChunk <= iLastChunk; ++iChunk)
+            {
+                rgfChunks[iChunk] = TRUE;
+            }
+        }
+    }
+
+    qsort(context.rgTargets, context.cTargets, sizeof(CHUNK_EXTRACT_TARGET), CompareTargets);
+
+    context.rgiChunks = static_cast<DWORD*>(MemAlloc(sizeof(DWORD) * pReader->cChunks, FALSE));
+    ExitOnNull(context.rgiChunks, hr, E_OUTOFMEMORY, "Failed to allocate chunk list.");
+
+    for (DWORD iChunk = 0; iChunk < pReader->cChunks; ++iChunk)
+    {
+        if (rgfChunks[iChunk])
+        {
+            context.rgiChunks[context.cChunks] = iChunk;
+            ++context.cChunks;
+        }
+    }
+
+    if (!cThreads)
+    {
+        ::GetSystemInfo(&systemInfo);
+        cThreads = systemInfo.dwNumberOfProcessors;
+    }
+
+    cThreads = min(cThreads, countof(rghThreads));
+    cThreads = min(cThreads, context.cChunks);
+
+    if (1 >= cThreads)
+    {
+        hr = ExtractChunks(&context);
+        ExitOnFailure(hr, "Failed to extract chunks.");
+    }
+    else
+    {
+        for (; cStartedThreads < cThreads; ++cStartedThreads)
+        {
+            rghThreads[cStartedThreads] = ::CreateThread(NULL, 0, ExtractChunksThreadProc, &context, 0, NULL);
+            if (!rghThreads[cStartedThreads])
+            {
+                hr = HRESULT_FROM_WIN32(::GetLastError());
+                ::InterlockedCompareExchange(&context.hrError, hr, S_OK);
+                break;
+            }
+        }
+
+        if (cStartedThreads && WAIT_FAILED == ::WaitForMultipleObjects(cStartedThreads, rghThreads, TRUE, INFINITE))
+        {
+            ExitWithLastError(hr, "Failed to wait for extraction threads.");
+        }
+
+        hr = context.hrError;
+        ExitOnFailure(hr, "Failed to extract chunks.");
+    }
+
+    for (DWORD i = 0; i < context.cTargets; ++i)
+    {
+        context.rgTargets[i].pRequest->fExtracted = TRUE;
+    }
+
+LExit:
+    for (DWORD i = 0; i < cStartedThreads; ++i)
+    {
+        ReleaseHandle(rghThreads[i]);
+    }
+
+    if (context.rgTargets)
+    {
+        for (DWORD i = 0; i < context.cTargets; ++i)
+        {
+            ReleaseFile(context.rgTargets[i].hFile);
+        }
+    }
+
+    ReleaseMem(context.rgiChunks);
+    ReleaseMem(context.rgTargets);
+    ReleaseMem(rgfChunks);
+
+    return hr;
+}
+
+
+/********************************************************************
+ChunkReadClose - closes a chunked container
+
+********************************************************************/
+extern "C" void DAPI ChunkReadClose(
+    __in HANDLE hReader
+    )
+{
+    CHUNK_READER* pReader = static_cast<CHUNK_READER*>(hReader);
+
+    ReleaseFile(pReader->hFile);
+
+    if (pReader->rgStreams)
+    {
+        for (DWORD i = 0; i < pReader->cStreams; ++i)
+        {
+            ReleaseStr(pReader->rgStreams[i].sczName);
+        }
+    }
+
+    ReleaseDict(pReader->sdStreams);
+    ReleaseMem(pReader->rgStreams);
+    ReleaseMem(pReader->rgChunks);
+    ReleaseMem(pReader->pbCachedChunk);
+    ReleaseMem(pReader->pbCompressed);
+    MemFree(pReader);
+}
+
+
+//
+// LoadCompression - finds the compression functions in ntdll, which is loaded in every process.
+//
+static HRESULT LoadCompression()
+{
+    HRESULT hr = S_OK;
+    HMODULE hNtdll = NULL;
+
+    if (!vpfnRtlDecompressBuffer)
+    {
+        hNtdll = ::GetModuleHandleW(L"ntdll.dll");
+        ExitOnNullWithLastError(hNtdll, hr, "Failed to get handle to ntdll.dll.");
+
+        vpfnRtlGetCompressionWorkSpaceSize = reinterpret_cast<PFN_RTLGETCOMPRESSIONWORKSPACESIZE>(::GetProcAddress(hNtdll, "RtlGetCompressionWorkSpaceSize"));
+        ExitOnNullWithLastError(vpfnRtlGetCompressionWorkSpaceSize, hr, "Failed to import RtlGetCompressionWorkSpaceSize from ntdll.dll.");
+
+        vpfnRtlCompressBuffer = reinterpret_cast<PFN_RTLCOMPRESSBUFFER>(::GetProcAddress(hNtdll, "RtlCompressBuffer"));
+        ExitOnNullWithLastError(vpfnRtlCompressBuffer, hr, "Failed to import RtlCompressBuffer from ntdll.dll.");
+
+        vpfnRtlDecompressBuffer = reinterpret_cast<PFN_RTLDECOMPRESSBUFFER>(::GetProcAddress(hNtdll, "RtlDecompressBuffer"));
+        ExitOnNullWithLastError(vpfnRtlDecompressBuffer, hr, "Failed to import RtlDecompressBuffer from ntdll.dll.");
+    }
+
+LExit:
+    return hr;
+}
+
+//
+// WriteChunk - compresses the filled part of the chunk buffer and appends it to the container.
+//
+static HRESULT WriteChunk(
+    __in CHUNK_WRITER* pWriter
+    )
+{
+    HRESULT hr = S_OK;
+    CHUNK_INDEX_CHUNK* pChunk = NULL;
+    LONG status = 0;
+    ULONG cbCompressed = 0;
+    BYTE* pbData = pWriter->pbCompressed;
+    DWORD dwCompression = COMPRESSION_FORMAT_LZNT1;
+
+    status = vpfnRtlCompressBuffer(CHUNK_COMPRESSION_ENGINE, pWriter->pbChunk, pWriter->cbChunkData, pWriter->pbCompressed, pWriter->cbChunk, CHUNK_COMPRESSION_UNIT, &cbCompressed, pWriter->pbWorkspace);
+    if (CHUNK_STATUS_BUFFER_TOO_SMALL == status || (0 <= status && cbCompressed >= pWriter->cbChunkData))
+    {
+        // Keep data that does not compress as it is.
+        pbData = pWriter->pbChunk;
+        cbCompressed = pWriter->cbChunkData;
+        dwCompression = COMPRESSION_FORMAT_NONE;
+    }
+    else if (0 > status)
+    {
+        hr = HRESULT_FROM_NT(status);
+        ExitOnRootFailure(hr, "Failed to compress chunk.");
+    }
+
+    hr = MemEnsureArraySize(reinterpret_cast<LPVOID*>(&pWriter->rgChunks), pWriter->cChunks + 1, sizeof(CHUNK_INDEX_CHUNK), 64);
+    ExitOnFailure(hr, "Failed to grow chunk index.");
+
+    hr = FileWriteHandle(pWriter->hFile, pbData, cbCompressed);
+    ExitOnFailure1(hr, "Failed to write chunk to container: %ls", pWriter->sczPath);
+
+    pChunk = pWriter->rgChunks + pWriter->cChunks;
+    pChunk->qwOffset = pWriter->qwFileOffset;
+    pChunk->cbCompressed = cbCompressed;
+    pChunk->cbUncompressed = pWriter->cbChunkData;
+    pChunk->dwCompression = dwCompression;
+    ++pWriter->cChunks;
+
+    pWriter->qwFileOffset += cbCompressed;
+    pWriter->cbChunkData = 0;
+
+LExit:
+    return hr;
+}
+
+//
+// FreeWriter - releases a writer, deleting the container if it was not finished.
+//
+static void FreeWriter(
+    __in CHUNK_WRITER* pWriter,
+    __in BOOL fDeleteContainer
+    )
+{
+    ReleaseFile(pWriter->hFile);
+
+    if (fDeleteContainer && pWriter->sczPath)
+    {
+        ::DeleteFileW(pWriter->sczPath);
+    }
+
+    if (pWriter->rgStreams)
+    {
+        for (DWORD i = 0; i < pWriter->cStreams; ++i)
+        {
+            ReleaseStr(pWriter->rgStreams[i].sczName);
+        }
+    }
+
+    ReleaseDict(pWriter->sdStreams);
+    ReleaseMem(pWriter->rgStreams);
+    ReleaseMem(pWriter->rgChunks);
+    ReleaseMem(pWriter->pbWorkspace);
+    ReleaseMem(pWriter->pbCompressed);
+    ReleaseMem(pWriter->pbChunk);
+    ReleaseStr(pWriter->sczPath);
+    MemFree(pWriter);
+}
+
+//
+// ReadIndex - reads and validates the header and index so later reads can trust the offsets and sizes.
+//
+static HRESULT ReadIndex(
+    __in CHUNK_READER* pReader,
+    __in DWORD64 qwSize
+    )
+{
+    HRESULT hr = S_OK;
+    CHUNK_CONTAINER_HEADER header = { };
+    BYTE* pbIndex = NULL;
+    SIZE_T iIndex = 0;
+    DWORD64 qwUncompressed = 0;
+    DWORD64 qwStreamEnd = 0;
+
+    if (sizeof(header) > qwSize)
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+        ExitOnRootFailure(hr, "Container too small for header.");
+    }
+
+    hr = ReadAt(pReader->hFile, pReader->qwOffset, &header, sizeof(header));
+    ExitOnFailure(hr, "Failed to read container header.");
+
+    if (CHUNK_CONTAINER_MAGIC != header.dwMagic || CHUNK_CONTAINER_VERSION != header.dwVersion)
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+        ExitOnRootFailure2(hr, "Not a supported chunked container, magic: %08x, version: %u", header.dwMagic, header.dwVersion);
+    }
+    else if (!header.cbChunk || CHUNK_MAX_SIZE < header.cbChunk)
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+        ExitOnRootFailure1(hr, "Invalid container chunk size: %u", header.cbChunk);
+    }
+    else if (sizeof(header) > header.qwIndexOffset || header.qwIndexOffset > qwSize || header.cbIndex > qwSize - header.qwIndexOffset)
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+        ExitOnRootFailure(hr, "Container index is outside of the container.");
+    }
+    else if (header.cChunks > header.cbIndex / CHUNK_MIN_INDEX_CHUNK_SIZE || header.cStreams > header.cbIndex / CHUNK_MIN_INDEX_STREAM_SIZE)
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+        ExitOnRootFailure(hr, "Container index too small for its entries.");
+    }
+
+    pReader->cbChunk = header.cbChunk;
+
+    pbIndex = static_cast<BYTE*>(MemAlloc(header.cbIndex, FALSE));
+    ExitOnNull(pbIndex, hr, E_OUTOFMEMORY, "Failed to allocate container index.");
+
+    hr = ReadAt(pReader->hFile, pReader->qwOffset + header.qwIndexOffset, pbIndex, header.cbIndex);
+    ExitOnFailure(hr, "Failed to read container index.");
+
+    if (header.cChunks)
+    {
+        pReader->rgChunks = static_cast<CHUNK_INDEX_CHUNK*>(MemAlloc(sizeof(CHUNK_INDEX_CHUNK) * header.cChunks, TRUE));
+        ExitOnNull(pReader->rgChunks, hr, E_OUTOFMEMORY, "Failed to allocate chunk index.");
+    }
+
+    for (DWORD i = 0; i < header.cChunks; ++i)
+    {
+        CHUNK_INDEX_CHUNK* pChunk = pReader->rgChunks + i;
+
+        hr = BuffReadNumber64(pbIndex, header.cbIndex, &iIndex, &pChunk->qwOffset);
+        ExitOnFailure(hr, "Failed to read chunk offset.");
+
+        hr = BuffReadNumber(pbIndex, header.cbIndex, &iIndex, &pChunk->cbCompressed);
+        ExitOnFailure(hr, "Failed to read chunk compressed size.");
+
+        hr = BuffReadNumber(pbIndex, header.cbIndex, &iIndex, &pChunk->cbUncompressed);
+        ExitOnFailure(hr, "Failed to read chunk uncompressed size.");
+
+        hr = BuffReadNumber(pbIndex, header.cbIndex, &iIndex, &pChunk->dwCompression);
+        ExitOnFailure(hr, "Failed to read chunk compression.");
+
+        // Every chunk but the last is full, which is what lets an offset in the streams map to a chunk.
+        if ((i + 1 < header.cChunks) ? header.cbChunk != pChunk->cbUncompressed : (!pChunk->cbUncompressed || header.cbChunk < pChunk->cbUncompressed))
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+            ExitOnRootFailure1(hr, "Invalid uncompressed size for chunk: %u", i);
+        }
+        else if (COMPRESSION_FORMAT_NONE == pChunk->dwCompression ? pChunk->cbUncompressed != pChunk->cbCompressed : (COMPRESSION_FORMAT_LZNT1 != pChunk->dwCompression || header.cbChunk < pChunk->cbCompressed))
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+            ExitOnRootFailure1(hr, "Invalid compression for chunk: %u", i);
+        }
+        else if (sizeof(header) > pChunk->qwOffset || pChunk->qwOffset > header.qwIndexOffset || pChunk->cbCompressed > header.qwIndexOffset - pChunk->qwOffset)
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+            ExitOnRootFailure1(hr, "Chunk is outside of the container data: %u", i);
+        }
+
+        qwUncompressed += pChunk->cbUncompressed;
+        ++pReader->cChunks;
+    }
+
+    if (header.cStreams)
+    {
+        pReader->rgStreams = static_cast<CHUNK_INDEX_STREAM*>(MemAlloc(sizeof(CHUNK_INDEX_STREAM) * header.cStreams, TRUE));
+        ExitOnNull(pReader->rgStreams, hr, E_OUTOFMEMORY, "Failed to allocate stream index.");
+    }
+
+    hr = DictCreateWithEmbeddedKey(&pReader->sdStreams, header.cStreams, NULL, offsetof(CHUNK_INDEX_STREAM, sczName), DICT_FLAG_NONE);
+    ExitOnFailure(hr, "Failed to create stream name index.");
+
+    for (DWORD i = 0; i < header.cStreams; ++i)
+    {
+        CHUNK_INDEX_STREAM* pStream = pReader->rgStreams + i;
+
+        hr = BuffReadString(pbIndex, header.cbIndex, &iIndex, &pStream->sczName);
+        ExitOnFailure(hr, "Failed to read stream name.");
+
+        ++pReader->cStreams;
+
+        hr = BuffReadNumber64(pbIndex, header.cbIndex, &iIndex, &pStream->qwOffset);
+        ExitOnFailure(hr, "Failed to read stream offset.");
+
+        hr = BuffReadNumber64(pbIndex, header.cbIndex, &iIndex, &pStream->qwSize);
+        ExitOnFailure(hr, "Failed to read stream size.");
+
+        // Streams follow one another so the extraction can find the streams in a chunk with a binary search.
+        if (qwStreamEnd > pStream->qwOffset || pStream->qwOffset > qwUncompressed || pStream->qwSize > qwUncompressed - pStream->qwOffset)
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+            ExitOnRootFailure1(hr, "Invalid location for stream: %ls", pStream->sczName);
+        }
+
+        qwStreamEnd = pStream->qwOffset + pStream->qwSize;
+
+        hr = DictKeyExists(pReader->sdStreams, pStream->sczName);
+        if (E_NOTFOUND != hr)
+        {
+            ExitOnFailure1(hr, "Failed to check for duplicate stream: %ls", pStream->sczName);
+
+            hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+            ExitOnRootFailure1(hr, "Duplicate stream in container: %ls", pStream->sczName);
+        }
+
+        hr = DictAddValue(pReader->sdStreams, pStream);
+        ExitOnFailure1(hr, "Failed to index stream: %ls", pStream->sczName);
+    }
+
+LExit:
+    ReleaseMem(pbIndex);
+
+    return hr;
+}
+
+//
+// ReadChunk - reads a chunk and decompresses it into a buffer of the chunk size.
+//
+static HRESULT ReadChunk(
+    __in CHUNK_READER* pReader,
+    __in DWORD iChunk,
+    __in_bcount(pReader->cbChunk) BYTE* pbCompressed,
+    __out_bcount(pReader->cbChunk) BYTE* pbChunk
+    )
+{
+    HRESULT hr = S_OK;
+    CHUNK_INDEX_CHUNK* pChunk = pReader->rgChunks + iChunk;
+    LONG status = 0;
+    ULONG cbDecompressed = 0;
+
+    if (COMPRESSION_FORMAT_NONE == pChunk->dwCompression)
+    {
+        hr = ReadAt(pReader->hFile, pReader->qwOffset + pChunk->qwOffset, pbChunk, pChunk->cbUncompressed);
+        ExitOnFailure1(hr, "Failed to read chunk: %u", iChunk);
+    }
+    else
+    {
+        hr = ReadAt(pReader->hFile, pReader->qwOffset + pChunk->qwOffset, pbCompressed, pChunk->cbCompressed);
+        ExitOnFailure1(hr, "Failed to read chunk: %u", iChunk);
+
+        status = vpfnRtlDecompressBuffer(static_cast<USHORT>(pChunk->dwCompression), pbChunk, pChunk->cbUncompressed, pbCompressed, pChunk->cbCompressed, &cbDecompressed);
+        if (0 > status)
+        {
+            hr = HRESULT_FROM_NT(status);
+            ExitOnRootFailure1(hr, "Failed to decompress chunk: %u", iChunk);
+        }
+        else if (pChunk->cbUncompressed != cbDecompressed)
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+            ExitOnRootFailure1(hr, "Chunk decompressed to the wrong size: %u", iChunk);
+        }
+    }
+
+LExit:
+    return hr;
+}
+
+//
+// CopyStream - copies a single stream to a buffer or a file through the cached chunk.
+//
+static HRESULT CopyStream(
+    __in CHUNK_READER* pReader,
+    __in DWORD iStream,
+    __out_bcount_opt(pReader->rgStreams[iStream].qwSize) BYTE* pbTarget,
+    __in HANDLE hTarget
+    )
+{
+    HRESULT hr = S_OK;
+    CHUNK_INDEX_STREAM* pStream = pReader->rgStreams + iStream;
+    DWORD64 qwPosition = pStream->qwOffset;
+    DWORD64 qwEnd = pStream->qwOffset + pStream->qwSize;
+
+    if (!pReader->pbCachedChunk)
+    {
+        pReader->pbCachedChunk = static_cast<BYTE*>(MemAlloc(pReader->cbChunk, FALSE));
+        ExitOnNull(pReader->pbCachedChunk, hr, E_OUTOFMEMORY, "Failed to allocate chunk buffer.");
+
+        pReader->pbCompressed = static_cast<BYTE*>(MemAlloc(pReader->cbChunk, FALSE));
+        ExitOnNull(pReader->pbCompressed, hr, E_OUTOFMEMORY, "Failed to allocate compressed chunk buffer.");
+    }
+
+    while (qwPosition < qwEnd)
+    {
+        DWORD iChunk = static_cast<DWORD>(qwPosition / pReader->cbChunk);
+        DWORD iInChunk = static_cast<DWORD>(qwPosition % pReader->cbChunk);
+        DWORD cbCopy = static_cast<DWORD>(min(static_cast<DWORD64>(pReader->rgChunks[iChunk].cbUncompressed - iInChunk), qwEnd - qwPosition));
+
+        if (pReader->iCachedChunk != iChunk)
+        {
+            pReader->iCachedChunk = CHUNK_NONE;
+
+            hr = ReadChunk(pReader, iChunk, pReader->pbCompressed, pReader->pbCachedChunk);
+            ExitOnFailure(hr, "Failed to read chunk for stream.");
+
+            pReader->iCachedChunk = iChunk;
+        }
+
+        if (pbTarget)
+        {
+            memcpy(pbTarget + (qwPosition - pStream->qwOffset), pReader->pbCachedChunk + iInChunk, cbCopy);
+        }
+        else
+        {
+            hr = FileWriteHandle(hTarget, pReader->pbCachedChunk + iInChunk, cbCopy);
+            ExitOnFailure(hr, "Failed to write stream to file.");
+        }
+
+        qwPosition += cbCopy;
+    }
+
+LExit:
+    return hr;
+}
+
+static DWORD WINAPI ExtractChunksThreadProc(
+    __in LPVOID lpThreadParameter
+    )
+{
+    HRESULT hr = ExtractChunks(static_cast<CHUNK_EXTRACT_CONTEXT*>(lpThreadParameter));
+
+    return static_cast<DWORD>(hr);
+}
+
+//
+// ExtractChunks - takes the next wanted chunk until there are none left, decompresses it and writes
+//                 the parts of the targets it holds. Runs on every extraction thread.
+//
+static HRESULT ExtractChunks(
+    __in CHUNK_EXTRACT_CONTEXT* pContext
+    )
+{
+    HRESULT hr = S_OK;
+    CHUNK_READER* pReader = pContext->pReader;
+    BYTE* pbCompressed = NULL;
+    BYTE* pbChunk = NULL;
+    LONG i = 0;
+
+    pbCompressed = static_cast<BYTE*>(MemAlloc(pReader->cbChunk, FALSE));
+    ExitOnNull(pbCompressed, hr, E_OUTOFMEMORY, "Failed to allocate compressed chunk buffer.");
+
+    pbChunk = static_cast<BYTE*>(MemAlloc(pReader->cbChunk, FALSE));
+    ExitOnNull(pbChunk, hr, E_OUTOFMEMORY, "Failed to allocate chunk buffer.");
+
+    // Stop early when another thread has failed.
+    while (SUCCEEDED(pContext->hrError) && (i = ::InterlockedIncrement(&pContext->iNextChunk) - 1) < static_cast<LONG>(pContext->cChunks))
+    {
+        DWORD iChunk = pContext->rgiChunks[i];
+        DWORD64 qwChunkStart = static_cast<DWORD64>(iChunk) * pReader->cbChunk;
+        DWORD64 qwChunkEnd = qwChunkStart + pReader->rgChunks[iChunk].cbUncompressed;
+
+        hr = ReadChunk(pReader, iChunk, pbCompressed, pbChunk);
+        ExitOnFailure(hr, "Failed to read chunk for extraction.");
+
+        for (DWORD iTarget = FindFirstTarget(pContext, qwChunkStart); iTarget < pContext->cTargets && pContext->rgTargets[iTarget].pStream->qwOffset < qwChunkEnd; ++iTarget)
+        {
+            CHUNK_EXTRACT_TARGET* pTarget = pContext->rgTargets + iTarget;
+            DWORD64 qwStart = max(pTarget->pStream->qwOffset, qwChunkStart);
+            DWORD64 qwEnd = min(pTarget->pStream->qwOffset + pTarget->pStream->qwSize, qwChunkEnd);
+
+            if (qwStart < qwEnd)
+            {
+                hr = WriteAt(pTarget->hFile, qwStart - pTarget->pStream->qwOffset, pbChunk + (qwStart - qwChunkStart), static_cast<DWORD>(qwEnd - qwStart));
+                ExitOnFailure1(hr, "Failed to write file: %ls", pTarget->pRequest->wzTargetFile);
+            }
+        }
+    }
+
+LExit:
+    ReleaseMem(pbChunk);
+    ReleaseMem(pbCompressed);
+
+    if (FAILED(hr))
+    {
+        ::InterlockedCompareExchange(&pContext->hrError, hr, S_OK);
+    }
+
+    return hr;
+}
+
+//
+// FindFirstTarget - returns the first target that ends after the offset. The targets are sorted by offset
+//                   and streams do not overlap so their ends are sorted too.
+//
+static DWORD FindFirstTarget(
+    __in CHUNK_EXTRACT_CONTEXT* pContext,
+    __in DWORD64 qwOffset
+    )
+{
+    DWORD iLow = 0;
+    DWORD iHigh = pContext->cTargets;
+
+    while (iLow < iHigh)
+    {
+        DWORD iMiddle = iLow + (iHigh - iLow) / 2;
+        CHUNK_INDEX_STREAM* pStream = pContext->rgTargets[iMiddle].pStream;
+
+        if (pStream->qwOffset + pStream->qwSize > qwOffset)
+        {
+            iHigh = iMiddle;
+        }
+        else
+        {
+            iLow = iMiddle + 1;
+        }
+    }
+
+    return iLow;
+}
+
+static int __cdecl CompareTargets(
+    __in const void* pvLeft,
+    __in const void* pvRight
+    )
+{
+    const CHUNK_INDEX_STREAM* pLeft = static_cast<const CHUNK_EXTRACT_TARGET*>(pvLeft)->pStream;
+    const CHUNK_INDEX_STREAM* pRight = static_cast<const CHUNK_EXTRACT_TARGET*>(pvRight)->pStream;
+
+    // Empty streams share their offset with the next stream, order by the end too so the ends stay sorted.
+    if (pLeft->qwOffset != pRight->qwOffset)
+    {
+        return pLeft->qwOffset < pRight->qwOffset ? -1 : 1;
+    }
+
+    return pLeft->qwSize < pRight->qwSize ? -1 : pLeft->qwSize > pRight->qwSize ? 1 : 0;
+}
+
+//
+// ReadAt - reads from an offset without moving a shared file pointer, so threads can read the same handle.
+//
+static HRESULT ReadAt(
+    __in HANDLE hFile,
+    __in DWORD64 qwOffset,
+    __out_bcount(cb) LPVOID pv,
+    __in DWORD cb
+    )
+{
+    HRESULT hr = S_OK;
+    BYTE* pb = static_cast<BYTE*>(pv);
+    OVERLAPPED overlapped = { };
+    DWORD cbRead = 0;
+
+    while (cb)
+    {
+        overlapped.Offset = static_cast<DWORD>(qwOffset);
+        overlapped.OffsetHigh = static_cast<DWORD>(qwOffset >> 32);
+
+        if (!::ReadFile(hFile, pb, cb, &cbRead, &overlapped))
+        {
+            ExitWithLastError(hr, "Failed to read from container.");
+        }
+        else if (!cbRead)
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+            ExitOnRootFailure(hr, "Unexpected end of container.");
+        }
+
+        pb += cbRead;
+        cb -= cbRead;
+        qwOffset += cbRead;
+    }
+
+LExit:
+    return hr;
+}
+
+//
+// WriteAt - writes at an offset without moving a shared file pointer, so threads can write the same handle.
+//
+static HRESULT WriteAt(
+    __in HANDLE hFile,
+    __in DWORD64 qwOffset,
+    __in_bcount(cb) LPCVOID pv,
+    __in DWORD cb
+    )
+{
+    HRESULT hr = S_OK;
+    const BYTE* pb = static_cast<const BYTE*>(pv);
+    OVERLAPPED overlapped = { };
+    DWORD cbWritten = 0;
+
+    while (cb)
+    {
+        overlapped.Offset = static_cast<DWORD>(qwOffset);
+        overlapped.OffsetHigh = static_cast<DWORD>(qwOffset >> 32);
+
+        if (!::WriteFile(hFile, pb, cb, &cbWritten, &overlapped))
+        {
+            ExitWithLastError(hr, "Failed to write to file.");
+        }
+
+        pb += cbWritten;
+        cb -= cbWritten;
+        qwOffset += cbWritten;
+    }
+
+LExit:
+    return hr;
+}
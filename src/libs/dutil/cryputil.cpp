@@ -11,6 +11,24 @@ static HMODULE vhAdvApi32Dll = NULL;
 static HMODULE vhCrypt32Dll = NULL;
 static BOOL vfCrypInitialized = FALSE;
 
+#define CRYP_HASH_FILE_BUFFER_SIZE (1024 * 1024)
+
+// internal function declarations
+
+static HRESULT BeginHashRead(
+    __in HANDLE hFile,
+    __in DWORD64 qwOffset,
+    __out_bcount(CRYP_HASH_FILE_BUFFER_SIZE) BYTE* pbBuffer,
+    __inout OVERLAPPED* pOverlapped,
+    __out BOOL* pfPending
+    );
+static HRESULT EndHashRead(
+    __in HANDLE hFile,
+    __inout OVERLAPPED* pOverlapped,
+    __inout BOOL* pfPending,
+    __out DWORD* pcbRead
+    );
+
 // function definitions
 
 /********************************************************************
@@ -264,6 +282,134 @@ LExit:
     return hr;
 }
 
+/********************************************************************
+ CrypHashFileHandleWithProgress - hashes the whole file with large
+   reads. The next block is read while the current one is hashed when
+   the handle was opened with FILE_FLAG_OVERLAPPED.
+
+*********************************************************************/
+extern "C" HRESULT DAPI CrypHashFileHandleWithProgress(
+    __in HANDLE hFile,
+    __in DWORD dwProvType,
+    __in ALG_ID algid,
+    __out_bcount(cbHash) BYTE* pbHash,
+    __in DWORD cbHash,
+    __in_opt PFN_CRYPHASHPROGRESS pfnProgress,
+    __in_opt LPVOID pvContext,
+    __out_opt DWORD64* pqwBytesHashed
+    )
+{
+    HRESULT hr = S_OK;
+    HCRYPTPROV hProv = NULL;
+    HCRYPTHASH hHash = NULL;
+    BYTE* rgpbBuffer[2] = { };
+    OVERLAPPED rgOverlapped[2] = { };
+    BOOL rgfPending[2] = { };
+    LARGE_INTEGER liSize = { };
+    DWORD64 qwHashed = 0;
+    DWORD iBuffer = 0;
+    DWORD iNextBuffer = 0;
+    DWORD cbRead = 0;
+    DWORD cbIgnored = 0;
+
+    if (!::GetFileSizeEx(hFile, &liSize))
+    {
+        ExitWithLastError(hr, "Failed to get file size.");
+    }
+
+    // get handle to the crypto provider
+    if (!::CryptAcquireContextW(&hProv, NULL, NULL, dwProvType, CRYPT_VERIFYCONTEXT | CRYPT_SILENT))
+    {
+        ExitWithLastError(hr, "Failed to acquire crypto context.");
+    }
+
+    // initiate hash
+    if (!::CryptCreateHash(hProv, algid, 0, 0, &hHash))
+    {
+        ExitWithLastError(hr, "Failed to initiate hash.");
+    }
+
+    for (DWORD i = 0; i < countof(rgpbBuffer); ++i)
+    {
+        rgpbBuffer[i] = static_cast<BYTE*>(MemAlloc(CRYP_HASH_FILE_BUFFER_SIZE, FALSE));
+        ExitOnNull(rgpbBuffer[i], hr, E_OUTOFMEMORY, "Failed to allocate hash read buffer.");
+
+        rgOverlapped[i].hEvent = ::CreateEventW(NULL, TRUE, FALSE, NULL);
+        ExitOnNullWithLastError(rgOverlapped[i].hEvent, hr, "Failed to create hash read event.");
+    }
+
+    hr = BeginHashRead(hFile, qwHashed, rgpbBuffer[iBuffer], rgOverlapped + iBuffer, rgfPending + iBuffer);
+    ExitOnFailure(hr, "Failed to begin reading first data block.");
+
+    for (;;)
+    {
+        hr = EndHashRead(hFile, rgOverlapped + iBuffer, rgfPending + iBuffer, &cbRead);
+        ExitOnFailure(hr, "Failed to read data block.");
+
+        if (!cbRead)
+        {
+            break; // end of file
+        }
+
+        // start reading the next data block before hashing this one
+        iNextBuffer = (iBuffer + 1) % countof(rgpbBuffer);
+
+        hr = BeginHashRead(hFile, qwHashed + cbRead, rgpbBuffer[iNextBuffer], rgOverlapped + iNextBuffer, rgfPending + iNextBuffer);
+        ExitOnFailure(hr, "Failed to begin reading next data block.");
+
+        // hash data block
+        if (!::CryptHashData(hHash, rgpbBuffer[iBuffer], cbRead, 0))
+        {
+            ExitWithLastError(hr, "Failed to hash data block.");
+        }
+
+        qwHashed += cbRead;
+
+        if (pfnProgress)
+        {
+            hr = pfnProgress(qwHashed, static_cast<DWORD64>(liSize.QuadPart), pvContext);
+            ExitOnFailure(hr, "Hash progress callback failed.");
+        }
+
+        iBuffer = iNextBuffer;
+    }
+
+    // get hash value
+    if (!::CryptGetHashParam(hHash, HP_HASHVAL, pbHash, &cbHash, 0))
+    {
+        ExitWithLastError(hr, "Failed to get hash value.");
+    }
+
+    if (pqwBytesHashed)
+    {
+        *pqwBytesHashed = qwHashed;
+    }
+
+LExit:
+    for (DWORD i = 0; i < countof(rgpbBuffer); ++i)
+    {
+        // never free a buffer the system may still be reading into
+        if (rgfPending[i])
+        {
+            ::CancelIo(hFile);
+            ::GetOverlappedResult(hFile, rgOverlapped + i, &cbIgnored, TRUE);
+        }
+
+        ReleaseHandle(rgOverlapped[i].hEvent);
+        ReleaseMem(rgpbBuffer[i]);
+    }
+    if (hHash)
+    {
+        ::CryptDestroyHash(hHash);
+    }
+    if (hProv)
+    {
+        ::CryptReleaseContext(hProv, 0);
+    }
+
+    return hr;
+}
+
 HRESULT DAPI CrypHashBuffer(
     __in_bcount(cbBuffer) const BYTE* pbBuffer,
     __in SIZE_T cbBuffer,
@@ -377,3 +523,72 @@ LExit:
     return hr;
 }
 
+
+// internal function definitions
+
+static HRESULT BeginHashRead(
+    __in HANDLE hFile,
+    __in DWORD64 qwOffset,
+    __out_bcount(CRYP_HASH_FILE_BUFFER_SIZE) BYTE* pbBuffer,
+    __inout OVERLAPPED* pOverlapped,
+    __out BOOL* pfPending
+    )
+{
+    HRESULT hr = S_OK;
+    DWORD er = ERROR_SUCCESS;
+
+    pOverlapped->Offset = static_cast<DWORD>(qwOffset);
+    pOverlapped->OffsetHigh = static_cast<DWORD>(qwOffset >> 32);
+
+    // Synchronous handles complete the read here, overlapped handles usually return ERROR_IO_PENDING.
+    if (!::ReadFile(hFile, pbBuffer, CRYP_HASH_FILE_BUFFER_SIZE, NULL, pOverlapped))
+    {
+        er = ::GetLastError();
+        if (ERROR_HANDLE_EOF == er)
+        {
+            *pfPending = FALSE;
+            ExitFunction();
+        }
+        else if (ERROR_IO_PENDING != er)
+        {
+            ExitOnWin32Error(er, hr, "Failed to begin reading data block.");
+        }
+    }
+
+    *pfPending = TRUE;
+
+LExit:
+    return hr;
+}
+
+static HRESULT EndHashRead(
+    __in HANDLE hFile,
+    __inout OVERLAPPED* pOverlapped,
+    __inout BOOL* pfPending,
+    __out DWORD* pcbRead
+    )
+{
+    HRESULT hr = S_OK;
+    DWORD er = ERROR_SUCCESS;
+
+    *pcbRead = 0;
+
+    if (*pfPending)
+    {
+        *pfPending = FALSE;
+
+        if (!::GetOverlappedResult(hFile, pOverlapped, pcbRead, TRUE))
+        {
+            er = ::GetLastError();
+            if (ERROR_HANDLE_EOF != er)
+            {
+                ExitOnWin32Error(er, hr, "Failed to complete reading data block.");
+            }
+
+            *pcbRead = 0;
+        }
+    }
+
+LExit:
+    return hr;
+}
@@ -13,6 +13,7 @@ struct ESE_QUERY
     DWORD dwColumns;
     void *pvData[10]; // The data queried for for this column
     DWORD cbData[10]; // One for each column, describes the size of the corresponding entry in ppvData
+    DWORD cbAllocated[10]; // One for each column, the allocated size of the corresponding entry in ppvData so it can be reused
 };
 
 // Todo: convert more JET_ERR to HRESULTS here
@@ -1017,6 +1018,227 @@ LExit:
     return hr;
 }
 
+// Inserts cRows rows, setting the same cColumns columns in each with a single JetSetColumns() call per row.
+// rgValues holds cColumns values for the first row, followed by cColumns values for the second row, and so on.
+// Rows are committed every cRowsPerTransaction rows (0 inserts all rows in one transaction). If an insert fails,
+// only the rows in the current transaction are rolled back.
+HRESULT DAPI EseBulkInsertRows(
+    __in JET_SESID jsSession,
+    __in ESE_TABLE_SCHEMA tsTable,
+    __in_ecount(cColumns) const DWORD *rgdwColumns,
+    __in DWORD cColumns,
+    __in_ecount(cRows * cColumns) const ESE_COLUMN_VALUE *rgValues,
+    __in DWORD cRows,
+    __in DWORD cRowsPerTransaction
+    )
+{
+    HRESULT hr = S_OK;
+    JET_ERR jEr = JET_errSuccess;
+    JET_SETCOLUMN *rgSetColumns = NULL;
+    BOOL fInTransaction = FALSE;
+    BOOL fInUpdate = FALSE;
+    DWORD cRowsInTransaction = 0;
+    const ESE_COLUMN_VALUE *pRowValues = NULL;
+
+    if (0 == cColumns || 0 == cRows)
+    {
+        ExitFunction();
+    }
+
+    if (0 == cRowsPerTransaction)
+    {
+        cRowsPerTransaction = cRows;
+    }
+
+    // The column ids are the same for every row, so only the values change from row to row.
+    hr = MemEnsureArraySize(reinterpret_cast<void **>(&rgSetColumns), cColumns, sizeof(JET_SETCOLUMN), 0);
+    ExitOnFailure(hr, "Failed to allocate set column structures for bulk insert");
+
+    for (DWORD i = 0; i < cColumns; ++i)
+    {
+        rgSetColumns[i].columnid = tsTable.pcsColumns[rgdwColumns[i]].jcColumn;
+        rgSetColumns[i].itagSequence = 1;
+    }
+
+    for (DWORD iRow = 0; iRow < cRows; ++iRow)
+    {
+        if (!fInTransaction)
+        {
+            jEr = JetBeginTransaction(jsSession);
+            ExitOnJetFailure(jEr, hr, "Failed to begin transaction for bulk insert");
+
+            fInTransaction = TRUE;
+            cRowsInTransaction = 0;
+        }
+
+        pRowValues = rgValues + static_cast<SIZE_T>(iRow) * cColumns;
+        for (DWORD i = 0; i < cColumns; ++i)
+        {
+            rgSetColumns[i].pvData = pRowValues[i].pvData;
+            rgSetColumns[i].cbData = pRowValues[i].cbData;
+            rgSetColumns[i].err = JET_errSuccess;
+        }
+
+        jEr = JetPrepareUpdate(jsSession, tsTable.jtTable, JET_prepInsert);
+        ExitOnJetFailure1(jEr, hr, "Failed to prepare insert of bulk row: %u", iRow);
+
+        fInUpdate = TRUE;
+
+        // Warnings don't fail the call, each column reports its own result.
+        jEr = JetSetColumns(jsSession, tsTable.jtTable, rgSetColumns, cColumns);
+        if (JET_errSuccess < jEr)
+        {
+            jEr = JET_errSuccess;
+        }
+        ExitOnJetFailure1(jEr, hr, "Failed to set columns of bulk row: %u", iRow);
+
+        for (DWORD i = 0; i < cColumns; ++i)
+        {
+            if (JET_errSuccess > rgSetColumns[i].err)
+            {
+                ExitOnJetFailure1(rgSetColumns[i].err, hr, "Failed to set column: %u", rgdwColumns[i]);
+            }
+        }
+
+        jEr = JetUpdate(jsSession, tsTable.jtTable, NULL, 0, NULL);
+        ExitOnJetFailure1(jEr, hr, "Failed to insert bulk row: %u", iRow);
+
+        fInUpdate = FALSE;
+
+        ++cRowsInTransaction;
+        if (cRowsPerTransaction <= cRowsInTransaction)
+        {
+            fInTransaction = FALSE;
+
+            // Durability is only required once the whole set is loaded, so don't wait for the log flush on each batch.
+            jEr = JetCommitTransaction(jsSession, (iRow + 1 < cRows) ? JET_bitCommitLazyFlush : 0);
+            ExitOnJetFailure(jEr, hr, "Failed to commit bulk insert transaction");
+        }
+    }
+
+    if (fInTransaction)
+    {
+        fInTransaction = FALSE;
+
+        jEr = JetCommitTransaction(jsSession, 0);
+        ExitOnJetFailure(jEr, hr, "Failed to commit final bulk insert transaction");
+    }
+
+LExit:
+    if (fInUpdate)
+    {
+        JetPrepareUpdate(jsSession, tsTable.jtTable, JET_prepCancel);
+    }
+
+    if (fInTransaction)
+    {
+        JetRollback(jsSession, 0);
+    }
+
+    ReleaseMem(rgSetColumns);
+
+    return hr;
+}
+
+// Reads cColumns columns of the current record with a single JetRetrieveColumns() call. Buffers in rgBuffers
+// are grown as needed and can be passed again for the next record so they are reused. Null columns are returned
+// with a size of zero.
+HRESULT DAPI EseGetColumns(
+    __in JET_SESID jsSession,
+    __in ESE_TABLE_SCHEMA tsTable,
+    __in_ecount(cColumns) const DWORD *rgdwColumns,
+    __in DWORD cColumns,
+    __inout_ecount(cColumns) ESE_COLUMN_BUFFER *rgBuffers
+    )
+{
+    HRESULT hr = S_OK;
+    JET_ERR jEr = JET_errSuccess;
+    JET_RETRIEVECOLUMN *rgRetrieveColumns = NULL;
+    BOOL fTruncated = FALSE;
+
+    if (0 == cColumns)
+    {
+        ExitFunction();
+    }
+
+    hr = MemEnsureArraySize(reinterpret_cast<void **>(&rgRetrieveColumns), cColumns, sizeof(JET_RETRIEVECOLUMN), 0);
+    ExitOnFailure(hr, "Failed to allocate retrieve column structures");
+
+    do
+    {
+        for (DWORD i = 0; i < cColumns; ++i)
+        {
+            rgRetrieveColumns[i].columnid = tsTable.pcsColumns[rgdwColumns[i]].jcColumn;
+            rgRetrieveColumns[i].pvData = rgBuffers[i].pbData;
+            rgRetrieveColumns[i].cbData = rgBuffers[i].cbAllocated;
+            rgRetrieveColumns[i].cbActual = 0;
+            rgRetrieveColumns[i].grbit = 0;
+            rgRetrieveColumns[i].ibLongValue = 0;
+            rgRetrieveColumns[i].itagSequence = 1;
+            rgRetrieveColumns[i].columnidNextTagged = 0;
+            rgRetrieveColumns[i].err = JET_errSuccess;
+        }
+
+        // Warnings such as a truncated or null column don't fail the call, each column reports its own result.
+        jEr = JetRetrieveColumns(jsSession, tsTable.jtTable, rgRetrieveColumns, cColumns);
+        if (JET_errSuccess < jEr)
+        {
+            jEr = JET_errSuccess;
+        }
+        ExitOnJetFailure(jEr, hr, "Failed to retrieve columns from record");
+
+        // Grow any buffer that was too small and retrieve again.
+        fTruncated = FALSE;
+        for (DWORD i = 0; i < cColumns; ++i)
+        {
+            if (JET_wrnBufferTruncated == rgRetrieveColumns[i].err)
+            {
+                ReleaseNullMem(rgBuffers[i].pbData);
+                rgBuffers[i].cbAllocated = 0;
+
+                rgBuffers[i].pbData = static_cast<BYTE *>(MemAlloc(rgRetrieveColumns[i].cbActual, FALSE));
+                ExitOnNull(rgBuffers[i].pbData, hr, E_OUTOFMEMORY, "Failed to allocate memory for reading column");
+
+                rgBuffers[i].cbAllocated = rgRetrieveColumns[i].cbActual;
+                fTruncated = TRUE;
+            }
+            else if (JET_wrnColumnNull == rgRetrieveColumns[i].err)
+            {
+                rgBuffers[i].cbData = 0;
+            }
+            else
+            {
+                // Any other warning still retrieved the value.
+                if (JET_errSuccess > rgRetrieveColumns[i].err)
+                {
+                    ExitOnJetFailure1(rgRetrieveColumns[i].err, hr, "Failed to retrieve column: %u", rgdwColumns[i]);
+                }
+
+                rgBuffers[i].cbData = rgRetrieveColumns[i].cbActual;
+            }
+        }
+    } while (fTruncated);
+
+LExit:
+    ReleaseMem(rgRetrieveColumns);
+
+    return hr;
+}
+
+// Frees the data buffers filled in by EseGetColumns(), but not the array itself
+void DAPI EseFreeColumnBuffers(
+    __in_ecount(cBuffers) ESE_COLUMN_BUFFER *rgBuffers,
+    __in DWORD cBuffers
+    )
+{
+    for (DWORD i = 0; i < cBuffers; ++i)
+    {
+        ReleaseNullMem(rgBuffers[i].pbData);
+        rgBuffers[i].cbData = 0;
+        rgBuffers[i].cbAllocated = 0;
+    }
+}
+
 HRESULT DAPI EseBeginQuery(
     __in JET_SESID jsSession,
     __in JET_TABLEID jtTable,
@@ -1068,11 +1290,19 @@ HRESULT DAPI SetQueryColumn(
     jEr = JetMakeKey(peqHandle->jsSession, peqHandle->jtTable, pvData, cbData, jGrb);
     ExitOnJetFailure(jEr, hr, "Failed to begin new query");
 
-    // If the query is wildcard, setup the cached copy of pvData
+    // If the query is wildcard, setup the cached copy of pvData, reusing the buffer from a previous run of the query when it is large enough
     if (ESE_QUERY_EXACT != peqHandle->qtQueryType)
     {
-        peqHandle->pvData[peqHandle->dwColumns] = MemAlloc(cbData, FALSE);
-        ExitOnNull(peqHandle->pvData[peqHandle->dwColumns], hr, E_OUTOFMEMORY, "Failed to allocate memory");
+        if (NULL == peqHandle->pvData[peqHandle->dwColumns] || peqHandle->cbAllocated[peqHandle->dwColumns] < cbData)
+        {
+            ReleaseNullMem(peqHandle->pvData[peqHandle->dwColumns]);
+            peqHandle->cbAllocated[peqHandle->dwColumns] = 0;
+
+            peqHandle->pvData[peqHandle->dwColumns] = MemAlloc(cbData, FALSE);
+            ExitOnNull(peqHandle->pvData[peqHandle->dwColumns], hr, E_OUTOFMEMORY, "Failed to allocate memory");
+
+            peqHandle->cbAllocated[peqHandle->dwColumns] = cbData;
+        }
 
         memcpy(peqHandle->pvData[peqHandle->dwColumns], pvData, cbData);
 
@@ -1213,6 +1443,30 @@ LExit:
     return hr;
 }
 
+// Clears the key columns of a query so it can be run again with new values, keeping its key buffers
+HRESULT DAPI EseResetQuery(
+    __in ESE_QUERY_HANDLE eqhHandle
+    )
+{
+    HRESULT hr = S_OK;
+    JET_ERR jEr = JET_errSuccess;
+
+    ESE_QUERY *peqHandle = static_cast<ESE_QUERY *>(eqhHandle);
+
+    if (peqHandle->fIndexRangeSet)
+    {
+        jEr = JetSetIndexRange(peqHandle->jsSession, peqHandle->jtTable, JET_bitRangeRemove);
+        ExitOnJetFailure(jEr, hr, "Failed to release index range");
+
+        peqHandle->fIndexRangeSet = FALSE;
+    }
+
+    peqHandle->dwColumns = 0;
+
+LExit:
+    return hr;
+}
+
 HRESULT DAPI EseFinishQuery(
     __in ESE_QUERY_HANDLE eqhHandle
     )
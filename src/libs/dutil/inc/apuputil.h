@@ -71,6 +71,18 @@ HRESULT DAPI ApupAllocChainFromAtom(
     __out APPLICATION_UPDATE_CHAIN** ppChain
     );
 
+HRESULT DAPI ApupAllocChainFromAtomFile(
+    __in_z LPCWSTR wzAtomFile,
+    __in DWORD64 dw64MinimumVersion,
+    __out APPLICATION_UPDATE_CHAIN** ppChain
+    );
+
+HRESULT DAPI ApupAllocChainFromAtomString(
+    __in_z LPCWSTR wzAtomString,
+    __in DWORD64 dw64MinimumVersion,
+    __out APPLICATION_UPDATE_CHAIN** ppChain
+    );
+
 HRESULT DAPI ApupFilterChain(
     __in APPLICATION_UPDATE_CHAIN* pChain,
     __in DWORD64 dw64Version,
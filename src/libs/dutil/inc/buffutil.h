@@ -47,6 +47,18 @@ HRESULT BuffReadStream(
     __deref_out_bcount(*pcbStream) BYTE** ppbStream,
     __out SIZE_T* pcbStream
     );
+HRESULT BuffReadVarNumber64(
+    __in_bcount(cbBuffer) const BYTE* pbBuffer,
+    __in SIZE_T cbBuffer,
+    __inout SIZE_T* piBuffer,
+    __out DWORD64* pdw64
+    );
+HRESULT BuffReadVarString(
+    __in_bcount(cbBuffer) const BYTE* pbBuffer,
+    __in SIZE_T cbBuffer,
+    __inout SIZE_T* piBuffer,
+    __deref_out_z LPWSTR* pscz
+    );
 
 HRESULT BuffWriteNumber(
     __deref_out_bcount(*piBuffer) BYTE** ppbBuffer,
@@ -74,6 +86,16 @@ HRESULT BuffWriteStream(
     __in_bcount(cbStream) const BYTE* pbStream,
     __in SIZE_T cbStream
     );
+HRESULT BuffWriteVarNumber64(
+    __deref_out_bcount(*piBuffer) BYTE** ppbBuffer,
+    __inout SIZE_T* piBuffer,
+    __in DWORD64 dw64
+    );
+HRESULT BuffWriteVarString(
+    __deref_out_bcount(*piBuffer) BYTE** ppbBuffer,
+    __inout SIZE_T* piBuffer,
+    __in_z_opt LPCWSTR scz
+    );
 
 #ifdef __cplusplus
 }
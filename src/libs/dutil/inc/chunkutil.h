@@ -0,0 +1,87 @@
+#pragma once
+// Copyright (c) .NET Foundation and contributors. All rights reserved. Licensed under the Microsoft Reciprocal License. See LICENSE.TXT file in the project root for full license information.
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ReleaseChunkReader(h) if (h) { ChunkReadClose(h); }
+#define ReleaseNullChunkReader(h) if (h) { ChunkReadClose(h); h = NULL; }
+
+// amount of stream data compressed independently of the rest of the container
+#define CHUNK_DEFAULT_SIZE (1024 * 1024)
+#define CHUNK_MAX_SIZE (64 * 1024 * 1024)
+
+// structs
+typedef struct _CHUNK_EXTRACT_STREAM
+{
+    LPCWSTR wzStreamName;
+    LPCWSTR wzTargetFile;
+
+    BOOL fExtracted;    // set when the stream was found in the container and written to wzTargetFile.
+} CHUNK_EXTRACT_STREAM;
+
+
+// functions
+HRESULT DAPI ChunkWriteBegin(
+    __in_z LPCWSTR wzContainer,
+    __in DWORD cbChunk,
+    __out HANDLE* phWriter
+    );
+HRESULT DAPI ChunkWriteAddFile(
+    __in HANDLE hWriter,
+    __in_z LPCWSTR wzFile,
+    __in_z LPCWSTR wzStreamName
+    );
+HRESULT DAPI ChunkWriteFinish(
+    __in HANDLE hWriter
+    );
+void DAPI ChunkWriteCancel(
+    __in HANDLE hWriter
+    );
+
+HRESULT DAPI ChunkReadOpen(
+    __in HANDLE hFile,
+    __in DWORD64 qwOffset,
+    __in DWORD64 qwSize,
+    __out HANDLE* phReader
+    );
+DWORD DAPI ChunkReadGetStreamCount(
+    __in HANDLE hReader
+    );
+HRESULT DAPI ChunkReadGetStream(
+    __in HANDLE hReader,
+    __in DWORD iStream,
+    __out_z LPCWSTR* pwzStreamName,
+    __out_opt DWORD64* pqwSize
+    );
+HRESULT DAPI ChunkReadFindStream(
+    __in HANDLE hReader,
+    __in_z LPCWSTR wzStreamName,
+    __out DWORD* piStream
+    );
+HRESULT DAPI ChunkReadStreamToBuffer(
+    __in HANDLE hReader,
+    __in DWORD iStream,
+    __deref_out_bcount(*pcbBuffer) BYTE** ppbBuffer,
+    __out SIZE_T* pcbBuffer
+    );
+HRESULT DAPI ChunkReadStreamToFile(
+    __in HANDLE hReader,
+    __in DWORD iStream,
+    __in_z LPCWSTR wzTargetFile
+    );
+HRESULT DAPI ChunkReadStreamsToFiles(
+    __in HANDLE hReader,
+    __in_ecount(cStreams) CHUNK_EXTRACT_STREAM* rgStreams,
+    __in DWORD cStreams,
+    __in DWORD cThreads
+    );
+void DAPI ChunkReadClose(
+    __in HANDLE hReader
+    );
+
+#ifdef __cplusplus
+}
+#endif
@@ -12,6 +12,14 @@ extern "C" {
 // Use CRYPTPROTECTMEMORY_BLOCK_SIZE, because it's larger and thus more restrictive than RTL_ENCRYPT_MEMORY_SIZE.
 #define CRYP_ENCRYPT_MEMORY_SIZE CRYPTPROTECTMEMORY_BLOCK_SIZE
 #define SHA1_HASH_LEN 20
+#define SHA256_HASH_LEN 32
+#define SHA512_HASH_LEN 64
+
+typedef HRESULT (*PFN_CRYPHASHPROGRESS)(
+    __in DWORD64 qwBytesHashed,
+    __in DWORD64 qwTotalBytes,
+    __in_opt LPVOID pvContext
+    );
 
 typedef NTSTATUS (APIENTRY *PFN_RTLENCRYPTMEMORY)(
     __inout PVOID Memory,
@@ -77,6 +85,17 @@ HRESULT DAPI CrypHashFileHandle(
     __out_opt DWORD64* pqwBytesHashed
     );
 
+HRESULT DAPI CrypHashFileHandleWithProgress(
+    __in HANDLE hFile,
+    __in DWORD dwProvType,
+    __in ALG_ID algid,
+    __out_bcount(cbHash) BYTE* pbHash,
+    __in DWORD cbHash,
+    __in_opt PFN_CRYPHASHPROGRESS pfnProgress,
+    __in_opt LPVOID pvContext,
+    __out_opt DWORD64* pqwBytesHashed
+    );
+
 HRESULT DAPI CrypHashBuffer(
     __in_bcount(cbBuffer) const BYTE* pbBuffer,
     __in SIZE_T cbBuffer,
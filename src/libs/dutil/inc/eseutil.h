@@ -8,6 +8,7 @@ extern "C" {
 
 #define ReleaseEseQuery(pqh) if (pqh) { EseFinishQuery(pqh); }
 #define ReleaseNullEseQuery(pqh) if (pqh) { EseFinishQuery(pqh); pqh = NULL; }
+#define ReleaseEseColumnBuffers(rg, c) if (rg) { EseFreeColumnBuffers(rg, c); }
 
 struct ESE_COLUMN_SCHEMA
 {
@@ -43,6 +44,19 @@ typedef enum ESE_QUERY_TYPE
 
 typedef void* ESE_QUERY_HANDLE;
 
+struct ESE_COLUMN_VALUE
+{
+    const void *pvData; // NULL with a size of zero sets the column empty
+    DWORD cbData;
+};
+
+struct ESE_COLUMN_BUFFER
+{
+    BYTE *pbData;
+    DWORD cbData; // size of the value last read into pbData
+    DWORD cbAllocated;
+};
+
 HRESULT DAPI EseBeginSession(
     __out JET_INSTANCE *pjiInstance,
     __out JET_SESID *pjsSession,
@@ -181,6 +195,26 @@ HRESULT DAPI EseGetColumnString(
     __in DWORD dwColumn,
     __out LPWSTR *ppszValue
     );
+HRESULT DAPI EseBulkInsertRows(
+    __in JET_SESID jsSession,
+    __in ESE_TABLE_SCHEMA tsTable,
+    __in_ecount(cColumns) const DWORD *rgdwColumns,
+    __in DWORD cColumns,
+    __in_ecount(cRows * cColumns) const ESE_COLUMN_VALUE *rgValues,
+    __in DWORD cRows,
+    __in DWORD cRowsPerTransaction
+    );
+HRESULT DAPI EseGetColumns(
+    __in JET_SESID jsSession,
+    __in ESE_TABLE_SCHEMA tsTable,
+    __in_ecount(cColumns) const DWORD *rgdwColumns,
+    __in DWORD cColumns,
+    __inout_ecount(cColumns) ESE_COLUMN_BUFFER *rgBuffers
+    );
+void DAPI EseFreeColumnBuffers(
+    __in_ecount(cBuffers) ESE_COLUMN_BUFFER *rgBuffers,
+    __in DWORD cBuffers
+    );
 
 // Call this once for each key column in the table
 HRESULT DAPI EseBeginQuery(
@@ -210,6 +244,9 @@ HRESULT DAPI EseSetQueryColumnString(
     __in_z LPCWSTR pszString,
     __in BOOL fFinal // If this is true, all other key columns in the query will be set to "*"
     );
+HRESULT DAPI EseResetQuery(
+    __in ESE_QUERY_HANDLE eqhHandle
+    );
 HRESULT DAPI EseFinishQuery(
     __in ESE_QUERY_HANDLE eqhHandle
     );
@@ -8,6 +8,10 @@ extern "C" {
 
 
 #define ReleaseRegKey(h) if (h) { ::RegCloseKey(h); h = NULL; }
+#define ReleaseRegSnapshot(h) if (h) { RegSnapshotRelease(h); }
+#define ReleaseNullRegSnapshot(h) if (h) { RegSnapshotRelease(h); h = NULL; }
+
+typedef void* REG_SNAPSHOT_HANDLE;
 
 typedef enum REG_KEY_BITNESS
 {
@@ -226,6 +230,56 @@ HRESULT DAPI RegQueryKey(
     __out_opt DWORD* pcSubKeys,
     __out_opt DWORD* pcValues
     );
+HRESULT DAPI RegSnapshotOpen(
+    __in HKEY hkRoot,
+    __in_z LPCWSTR wzSubKey,
+    __in DWORD dwAccess,
+    __out REG_SNAPSHOT_HANDLE* phSnapshot
+    );
+HRESULT DAPI RegSnapshotInvalidate(
+    __in REG_SNAPSHOT_HANDLE hSnapshot
+    );
+HRESULT DAPI RegSnapshotGetType(
+    __in REG_SNAPSHOT_HANDLE hSnapshot,
+    __in_z_opt LPCWSTR wzName,
+    __out DWORD *pdwType
+    );
+HRESULT DAPI RegSnapshotReadValue(
+    __in REG_SNAPSHOT_HANDLE hSnapshot,
+    __in_z_opt LPCWSTR wzName,
+    __out DWORD* pdwType,
+    __deref_out_bcount(*pcbData) BYTE** ppbData,
+    __out DWORD* pcbData
+    );
+HRESULT DAPI RegSnapshotReadBinary(
+    __in REG_SNAPSHOT_HANDLE hSnapshot,
+    __in_z_opt LPCWSTR wzName,
+    __deref_out_bcount_opt(*pcbBuffer) BYTE** ppbBuffer,
+    __out SIZE_T *pcbBuffer
+    );
+HRESULT DAPI RegSnapshotReadString(
+    __in REG_SNAPSHOT_HANDLE hSnapshot,
+    __in_z_opt LPCWSTR wzName,
+    __deref_out_z LPWSTR* psczValue
+    );
+HRESULT DAPI RegSnapshotReadVersion(
+    __in REG_SNAPSHOT_HANDLE hSnapshot,
+    __in_z_opt LPCWSTR wzName,
+    __out DWORD64* pdw64Version
+    );
+HRESULT DAPI RegSnapshotReadNumber(
+    __in REG_SNAPSHOT_HANDLE hSnapshot,
+    __in_z_opt LPCWSTR wzName,
+    __out DWORD* pdwValue
+    );
+HRESULT DAPI RegSnapshotReadQword(
+    __in REG_SNAPSHOT_HANDLE hSnapshot,
+    __in_z_opt LPCWSTR wzName,
+    __out DWORD64* pqwValue
+    );
+void DAPI RegSnapshotRelease(
+    __in REG_SNAPSHOT_HANDLE hSnapshot
+    );
 
 #ifdef __cplusplus
 }
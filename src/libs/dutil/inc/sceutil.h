@@ -14,10 +14,12 @@ typedef void* SCE_DATABASE_HANDLE;
 typedef void* SCE_ROW_HANDLE;
 typedef void* SCE_QUERY_HANDLE;
 typedef void* SCE_QUERY_RESULTS_HANDLE;
+typedef void* SCE_BATCH_HANDLE;
 
 extern const int SCE_ROW_HANDLE_BYTES;
 extern const int SCE_QUERY_HANDLE_BYTES;
 extern const int SCE_QUERY_RESULTS_HANDLE_BYTES;
+extern const int SCE_BATCH_HANDLE_BYTES;
 
 #define ReleaseSceRow(prrh) if (prrh) { SceFreeRow(prrh); }
 #define ReleaseNullSceRow(prrh) if (prrh) { SceFreeRow(prrh); prrh = NULL; }
@@ -25,6 +27,8 @@ extern const int SCE_QUERY_RESULTS_HANDLE_BYTES;
 #define ReleaseNullSceQuery(pqh) if (pqh) { SceFreeQuery(pqh); pqh = NULL; }
 #define ReleaseSceQueryResults(pqh) if (pqh) { SceFreeQueryResults(pqh); }
 #define ReleaseNullSceQueryResults(pqh) if (pqh) { SceFreeQueryResults(pqh); pqh = NULL; }
+#define ReleaseSceBatchInsert(pbh) if (pbh) { SceFreeBatchInsert(pbh); }
+#define ReleaseNullSceBatchInsert(pbh) if (pbh) { SceFreeBatchInsert(pbh); pbh = NULL; }
 
 struct SCE_COLUMN_SCHEMA
 {
@@ -236,6 +240,33 @@ HRESULT DAPI SceRunQueryRange(
     __in_bcount(SCE_QUERY_BYTES) SCE_QUERY_HANDLE *psqhHandle,
     __deref_out_bcount(SCE_QUERY_RESULTS_BYTES) SCE_QUERY_RESULTS_HANDLE *psqrhHandle
     );
+HRESULT DAPI ScePrepareQuery(
+    __in SCE_DATABASE *pDatabase,
+    __in DWORD dwTableIndex,
+    __in DWORD dwIndex,
+    __deref_out_bcount(SCE_QUERY_HANDLE_BYTES) SCE_QUERY_HANDLE *psqhHandle
+    );
+HRESULT DAPI SceRunPreparedQueryExact(
+    __in_bcount(SCE_QUERY_BYTES) SCE_QUERY_HANDLE sqhHandle,
+    __deref_out_bcount(SCE_ROW_HANDLE_BYTES) SCE_ROW_HANDLE *pRowHandle
+    );
+HRESULT DAPI SceRunPreparedQueryRange(
+    __in_bcount(SCE_QUERY_BYTES) SCE_QUERY_HANDLE sqhHandle,
+    __deref_out_bcount(SCE_QUERY_RESULTS_BYTES) SCE_QUERY_RESULTS_HANDLE *psqrhHandle
+    );
+HRESULT DAPI SceBeginBatchInsert(
+    __in SCE_DATABASE *pDatabase,
+    __in DWORD dwTableIndex,
+    __in DWORD dwRowsPerTransaction,
+    __deref_out_bcount(SCE_BATCH_HANDLE_BYTES) SCE_BATCH_HANDLE *psbhHandle,
+    __deref_out_bcount(SCE_ROW_HANDLE_BYTES) SCE_ROW_HANDLE *pRowHandle
+    );
+HRESULT DAPI SceBatchInsertRow(
+    __in_bcount(SCE_BATCH_HANDLE_BYTES) SCE_BATCH_HANDLE sbhHandle
+    );
+HRESULT DAPI SceCommitBatchInsert(
+    __in_bcount(SCE_BATCH_HANDLE_BYTES) SCE_BATCH_HANDLE sbhHandle
+    );
 HRESULT DAPI SceGetNextResultRow(
     __in_bcount(SCE_QUERY_RESULTS_BYTES) SCE_QUERY_RESULTS_HANDLE sqrhHandle,
     __deref_out_bcount(SCE_ROW_HANDLE_BYTES) SCE_ROW_HANDLE *pRowHandle
@@ -255,6 +286,9 @@ void DAPI SceFreeQuery(
 void DAPI SceFreeQueryResults(
     __in_bcount(SCE_QUERY_RESULTS_BYTES) SCE_QUERY_RESULTS_HANDLE sqrhHandle
     );
+void DAPI SceFreeBatchInsert(
+    __in_bcount(SCE_BATCH_HANDLE_BYTES) SCE_BATCH_HANDLE sbhHandle
+    );
 
 #ifdef __cplusplus
 }
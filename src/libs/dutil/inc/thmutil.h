@@ -199,6 +199,7 @@ DAPI_(void) ThemeUninitialize();
 /********************************************************************
  ThemeLoadFromFile - loads a theme from a loose file.
 
+ NOTE: The file may be theme XML or a theme compiled by ThemeSaveCompiled.
  *******************************************************************/
 DAPI_(HRESULT) ThemeLoadFromFile(
     __in_z LPCWSTR wzThemeFile,
@@ -208,7 +209,8 @@ DAPI_(HRESULT) ThemeLoadFromFile(
 /********************************************************************
  ThemeLoadFromResource - loads a theme from a module's data resource.
 
- NOTE: The resource data must be UTF-8 encoded.
+ NOTE: The resource data must be UTF-8 encoded XML or a theme compiled
+       by ThemeSaveCompiled.
 *******************************************************************/
 DAPI_(HRESULT) ThemeLoadFromResource(
     __in_opt HMODULE hModule,
@@ -216,6 +218,19 @@ DAPI_(HRESULT) ThemeLoadFromResource(
     __out THEME** ppTheme
     );
 
+/********************************************************************
+ ThemeSaveCompiled - saves a loaded theme in the compiled binary format
+                     so it can be loaded without parsing XML or decoding
+                     images.
+
+ NOTE: Save the theme before calling ThemeLocalize or ThemeLoadControls
+       so the compiled theme keeps the unresolved localization strings.
+*******************************************************************/
+DAPI_(HRESULT) ThemeSaveCompiled(
+    __in const THEME* pTheme,
+    __in_z LPCWSTR wzCompiledFile
+    );
+
 /********************************************************************
  ThemeFree - frees any memory associated with a theme.
 
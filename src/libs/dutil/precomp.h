@@ -45,6 +45,7 @@
 #include "butil.h"
 #include "cabcutil.h"
 #include "cabutil.h"
+#include "chunkutil.h"
 #include "conutil.h"
 #include "cryputil.h"
 #include "eseutil.h"
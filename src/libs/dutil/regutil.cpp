@@ -17,6 +17,40 @@ static PFN_REGDELETEVALUEW vpfnRegDeleteValueW = ::RegDeleteValueW;
 static HMODULE vhAdvApi32Dll = NULL;
 static BOOL vfRegInitialized = FALSE;
 
+// Snapshot data is padded with this many zero bytes so string values are
+// always null terminated, regardless of how they were written.
+#define REG_SNAPSHOT_DATA_PADDING (2 * sizeof(WCHAR))
+
+struct REG_SNAPSHOT_VALUE
+{
+    LPWSTR sczName; // empty string for the default value.
+    DWORD dwType;
+    LPBYTE pbData;
+    DWORD cbData;
+};
+
+struct REG_SNAPSHOT
+{
+    HKEY hk;
+    BOOL fLoaded;
+
+    REG_SNAPSHOT_VALUE* rgValues;
+    DWORD cValues;
+    STRINGDICT_HANDLE sdValues;
+};
+
+static HRESULT SnapshotLoad(
+    __in REG_SNAPSHOT* pSnapshot
+    );
+static void SnapshotUninitialize(
+    __in REG_SNAPSHOT* pSnapshot
+    );
+static HRESULT SnapshotFindValue(
+    __in REG_SNAPSHOT_HANDLE hSnapshot,
+    __in_z_opt LPCWSTR wzName,
+    __out REG_SNAPSHOT_VALUE** ppValue
+    );
+
 /********************************************************************
  RegInitialize - initializes regutil
 
@@ -924,3 +958,499 @@ extern "C" HRESULT DAPI RegQueryKey(
 LExit:
     return hr;
 }
+
+
+/********************************************************************
+ RegSnapshotOpen - opens a registry key and reads all of its values in
+                   a single enumeration pass. Subsequent RegSnapshotRead*
+                   calls are served from memory until the snapshot is
+                   invalidated.
+
+ NOTE: dwAccess must include KEY_QUERY_VALUE.
+*********************************************************************/
+extern "C" HRESULT DAPI RegSnapshotOpen(
+    __in HKEY hkRoot,
+    __in_z LPCWSTR wzSubKey,
+    __in DWORD dwAccess,
+    __out REG_SNAPSHOT_HANDLE* phSnapshot
+    )
+{
+    HRESULT hr = S_OK;
+    REG_SNAPSHOT* pSnapshot = NULL;
+
+    pSnapshot = static_cast<REG_SNAPSHOT*>(MemAlloc(sizeof(REG_SNAPSHOT), TRUE));
+    ExitOnNull(pSnapshot, hr, E_OUTOFMEMORY, "Failed to allocate registry snapshot.");
+
+    hr = RegOpen(hkRoot, wzSubKey, dwAccess, &pSnapshot->hk);
+    if (E_FILENOTFOUND == hr)
+    {
+        ExitFunction();
+    }
+    ExitOnFailure1(hr, "Failed to open registry key for snapshot: %ls", wzSubKey);
+
+    hr = SnapshotLoad(pSnapshot);
+    ExitOnFailure1(hr, "Failed to read values for registry snapshot: %ls", wzSubKey);
+
+    *phSnapshot = pSnapshot;
+    pSnapshot = NULL;
+
+LExit:
+    ReleaseRegSnapshot(pSnapshot);
+
+    return hr;
+}
+
+
+/********************************************************************
+ RegSnapshotInvalidate - discards the cached values of a snapshot. The
+                         values are read again from the key on the
+                         next RegSnapshotRead* call.
+
+*********************************************************************/
+extern "C" HRESULT DAPI RegSnapshotInvalidate(
+    __in REG_SNAPSHOT_HANDLE hSnapshot
+    )
+{
+    HRESULT hr = S_OK;
+    REG_SNAPSHOT* pSnapshot = static_cast<REG_SNAPSHOT*>(hSnapshot);
+
+    ExitOnNull(pSnapshot, hr, E_INVALIDARG, "Registry snapshot not specified.");
+
+    SnapshotUninitialize(pSnapshot);
+
+LExit:
+    return hr;
+}
+
+
+/********************************************************************
+ RegSnapshotGetType - reads a registry value type from a snapshot.
+
+*********************************************************************/
+extern "C" HRESULT DAPI RegSnapshotGetType(
+    __in REG_SNAPSHOT_HANDLE hSnapshot,
+    __in_z_opt LPCWSTR wzName,
+    __out DWORD *pdwType
+    )
+{
+    HRESULT hr = S_OK;
+    REG_SNAPSHOT_VALUE* pValue = NULL;
+
+    hr = SnapshotFindValue(hSnapshot, wzName, &pValue);
+    if (E_FILENOTFOUND == hr)
+    {
+        ExitFunction();
+    }
+    ExitOnFailure(hr, "Failed to find registry value in snapshot.");
+
+    *pdwType = pValue->dwType;
+
+LExit:
+    return hr;
+}
+
+
+/********************************************************************
+ RegSnapshotReadValue - reads the type and data of a registry value of
+                        any type from a snapshot. The data is followed
+                        by null characters so strings are terminated.
+ NOTE: caller is responsible for freeing *ppbData
+*********************************************************************/
+extern "C" HRESULT DAPI RegSnapshotReadValue(
+    __in REG_SNAPSHOT_HANDLE hSnapshot,
+    __in_z_opt LPCWSTR wzName,
+    __out DWORD* pdwType,
+    __deref_out_bcount(*pcbData) BYTE** ppbData,
+    __out DWORD* pcbData
+    )
+{
+    HRESULT hr = S_OK;
+    REG_SNAPSHOT_VALUE* pValue = NULL;
+    LPBYTE pbData = NULL;
+
+    hr = SnapshotFindValue(hSnapshot, wzName, &pValue);
+    if (E_FILENOTFOUND == hr)
+    {
+        ExitFunction();
+    }
+    ExitOnFailure(hr, "Failed to find registry value in snapshot.");
+
+    pbData = static_cast<LPBYTE>(MemAlloc(pValue->cbData + REG_SNAPSHOT_DATA_PADDING, TRUE));
+    ExitOnNull(pbData, hr, E_OUTOFMEMORY, "Failed to allocate buffer for registry value.");
+
+    memcpy_s(pbData, pValue->cbData + REG_SNAPSHOT_DATA_PADDING, pValue->pbData, pValue->cbData);
+
+    *pdwType = pValue->dwType;
+    *ppbData = pbData;
+    pbData = NULL;
+    *pcbData = pValue->cbData;
+
+LExit:
+    ReleaseMem(pbData);
+
+    return hr;
+}
+
+
+/********************************************************************
+ RegSnapshotReadBinary - reads a binary registry value from a snapshot.
+ NOTE: caller is responsible for freeing *ppbBuffer
+*********************************************************************/
+extern "C" HRESULT DAPI RegSnapshotReadBinary(
+    __in REG_SNAPSHOT_HANDLE hSnapshot,
+    __in_z_opt LPCWSTR wzName,
+    __deref_out_bcount_opt(*pcbBuffer) BYTE** ppbBuffer,
+    __out SIZE_T *pcbBuffer
+    )
+{
+    HRESULT hr = S_OK;
+    REG_SNAPSHOT_VALUE* pValue = NULL;
+    LPBYTE pbBuffer = NULL;
+
+    hr = SnapshotFindValue(hSnapshot, wzName, &pValue);
+    if (E_FILENOTFOUND == hr)
+    {
+        ExitFunction();
+    }
+    ExitOnFailure(hr, "Failed to find registry value in snapshot.");
+
+    if (REG_BINARY != pValue->dwType)
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATATYPE);
+        ExitOnRootFailure1(hr, "Error reading binary registry value due to unexpected data type: %u", pValue->dwType);
+    }
+
+    // Zero-length binary values can exist
+    if (0 < pValue->cbData)
+    {
+        pbBuffer = static_cast<LPBYTE>(MemAlloc(pValue->cbData, FALSE));
+        ExitOnNull(pbBuffer, hr, E_OUTOFMEMORY, "Failed to allocate buffer for binary registry value.");
+
+        memcpy_s(pbBuffer, pValue->cbData, pValue->pbData, pValue->cbData);
+    }
+
+    *ppbBuffer = pbBuffer;
+    pbBuffer = NULL;
+    *pcbBuffer = pValue->cbData;
+
+LExit:
+    ReleaseMem(pbBuffer);
+
+    return hr;
+}
+
+
+/********************************************************************
+ RegSnapshotReadString - reads a registry value from a snapshot as a
+                         string.
+
+*********************************************************************/
+extern "C" HRESULT DAPI RegSnapshotReadString(
+    __in REG_SNAPSHOT_HANDLE hSnapshot,
+    __in_z_opt LPCWSTR wzName,
+    __deref_out_z LPWSTR* psczValue
+    )
+{
+    HRESULT hr = S_OK;
+    REG_SNAPSHOT_VALUE* pValue = NULL;
+    LPCWSTR wzValue = NULL;
+
+    hr = SnapshotFindValue(hSnapshot, wzName, &pValue);
+    if (E_FILENOTFOUND == hr)
+    {
+        ExitFunction();
+    }
+    ExitOnFailure(hr, "Failed to find registry value in snapshot.");
+
+    // The data is always padded with null characters so it is safe to treat as a string.
+    wzValue = reinterpret_cast<LPCWSTR>(pValue->pbData);
+
+    if (REG_SZ == pValue->dwType)
+    {
+        hr = StrAllocString(psczValue, wzValue, 0);
+        ExitOnFailure(hr, "Failed to copy registry value from snapshot.");
+    }
+    else if (REG_EXPAND_SZ == pValue->dwType)
+    {
+        hr = PathExpand(psczValue, wzValue, PATH_EXPAND_ENVIRONMENT);
+        ExitOnFailure1(hr, "Failed to expand registry value: %ls", wzValue);
+    }
+    else
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATATYPE);
+        ExitOnRootFailure1(hr, "Error reading string registry value due to unexpected data type: %u", pValue->dwType);
+    }
+
+LExit:
+    return hr;
+}
+
+
+/********************************************************************
+ RegSnapshotReadVersion - reads a registry value from a snapshot as a
+                          version.
+
+*********************************************************************/
+extern "C" HRESULT DAPI RegSnapshotReadVersion(
+    __in REG_SNAPSHOT_HANDLE hSnapshot,
+    __in_z_opt LPCWSTR wzName,
+    __out DWORD64* pdw64Version
+    )
+{
+    HRESULT hr = S_OK;
+    REG_SNAPSHOT_VALUE* pValue = NULL;
+    LPWSTR sczVersion = NULL;
+
+    hr = SnapshotFindValue(hSnapshot, wzName, &pValue);
+    if (E_FILENOTFOUND == hr)
+    {
+        ExitFunction();
+    }
+    ExitOnFailure(hr, "Failed to find registry value in snapshot.");
+
+    if (REG_SZ == pValue->dwType || REG_EXPAND_SZ == pValue->dwType)
+    {
+        hr = RegSnapshotReadString(hSnapshot, wzName, &sczVersion);
+        ExitOnFailure(hr, "Failed to read registry version as string.");
+
+        hr = FileVersionFromStringEx(sczVersion, 0, pdw64Version);
+        ExitOnFailure(hr, "Failed to convert registry string to version.");
+    }
+    else if (REG_QWORD == pValue->dwType && sizeof(DWORD64) == pValue->cbData)
+    {
+        memcpy_s(pdw64Version, sizeof(DWORD64), pValue->pbData, sizeof(DWORD64));
+    }
+    else // unexpected data type
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATATYPE);
+        ExitOnRootFailure1(hr, "Error reading version registry value due to unexpected data type: %u", pValue->dwType);
+    }
+
+LExit:
+    ReleaseStr(sczVersion);
+
+    return hr;
+}
+
+
+/********************************************************************
+ RegSnapshotReadNumber - reads a DWORD registry value from a snapshot.
+
+*********************************************************************/
+extern "C" HRESULT DAPI RegSnapshotReadNumber(
+    __in REG_SNAPSHOT_HANDLE hSnapshot,
+    __in_z_opt LPCWSTR wzName,
+    __out DWORD* pdwValue
+    )
+{
+    HRESULT hr = S_OK;
+    REG_SNAPSHOT_VALUE* pValue = NULL;
+
+    hr = SnapshotFindValue(hSnapshot, wzName, &pValue);
+    if (E_FILENOTFOUND == hr)
+    {
+        ExitFunction();
+    }
+    ExitOnFailure(hr, "Failed to find registry value in snapshot.");
+
+    if (REG_DWORD != pValue->dwType || sizeof(DWORD) != pValue->cbData)
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATATYPE);
+        ExitOnRootFailure1(hr, "Error reading number registry value due to unexpected data type: %u", pValue->dwType);
+    }
+
+    *pdwValue = *reinterpret_cast<DWORD*>(pValue->pbData);
+
+LExit:
+    return hr;
+}
+
+
+/********************************************************************
+ RegSnapshotReadQword - reads a QWORD registry value from a snapshot.
+
+*********************************************************************/
+extern "C" HRESULT DAPI RegSnapshotReadQword(
+    __in REG_SNAPSHOT_HANDLE hSnapshot,
+    __in_z_opt LPCWSTR wzName,
+    __out DWORD64* pqwValue
+    )
+{
+    HRESULT hr = S_OK;
+    REG_SNAPSHOT_VALUE* pValue = NULL;
+
+    hr = SnapshotFindValue(hSnapshot, wzName, &pValue);
+    if (E_FILENOTFOUND == hr)
+    {
+        ExitFunction();
+    }
+    ExitOnFailure(hr, "Failed to find registry value in snapshot.");
+
+    if (REG_QWORD != pValue->dwType || sizeof(DWORD64) != pValue->cbData)
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATATYPE);
+        ExitOnRootFailure1(hr, "Error reading qword registry value due to unexpected data type: %u", pValue->dwType);
+    }
+
+    memcpy_s(pqwValue, sizeof(DWORD64), pValue->pbData, sizeof(DWORD64));
+
+LExit:
+    return hr;
+}
+
+
+/********************************************************************
+ RegSnapshotRelease - closes the key and frees a registry snapshot.
+
+*********************************************************************/
+extern "C" void DAPI RegSnapshotRelease(
+    __in REG_SNAPSHOT_HANDLE hSnapshot
+    )
+{
+    REG_SNAPSHOT* pSnapshot = static_cast<REG_SNAPSHOT*>(hSnapshot);
+
+    if (pSnapshot)
+    {
+        SnapshotUninitialize(pSnapshot);
+        ReleaseRegKey(pSnapshot->hk);
+        MemFree(pSnapshot);
+    }
+}
+
+
+// internal helper functions
+
+static HRESULT SnapshotLoad(
+    __in REG_SNAPSHOT* pSnapshot
+    )
+{
+    HRESULT hr = S_OK;
+    DWORD er = ERROR_SUCCESS;
+    DWORD cValues = 0;
+    DWORD cchMaxName = 0;
+    DWORD cbMaxData = 0;
+    LPWSTR sczName = NULL;
+    LPBYTE pbData = NULL;
+    DWORD cchName = 0;
+    DWORD cbData = 0;
+    DWORD dwType = 0;
+    DWORD dwIndex = 0;
+    REG_SNAPSHOT_VALUE* pValue = NULL;
+
+    er = vpfnRegQueryInfoKeyW(pSnapshot->hk, NULL, NULL, NULL, NULL, NULL, NULL, &cValues, &cchMaxName, &cbMaxData, NULL, NULL);
+    ExitOnWin32Error(er, hr, "Failed to get value count and sizes of registry key.");
+
+    if (cValues)
+    {
+        hr = MemEnsureArraySize(reinterpret_cast<LPVOID*>(&pSnapshot->rgValues), cValues, sizeof(REG_SNAPSHOT_VALUE), 0);
+        ExitOnFailure(hr, "Failed to allocate registry snapshot values.");
+    }
+
+    hr = DictCreateWithEmbeddedKey(&pSnapshot->sdValues, cValues, reinterpret_cast<void**>(&pSnapshot->rgValues), offsetof(REG_SNAPSHOT_VALUE, sczName), DICT_FLAG_CASEINSENSITIVE);
+    ExitOnFailure(hr, "Failed to create registry snapshot value dictionary.");
+
+    while (TRUE)
+    {
+        // Add one because RegQueryInfoKeyW() returns the length of value names without the null terminator.
+        cchName = cchMaxName + 1;
+        cbData = cbMaxData;
+
+        hr = StrAlloc(&sczName, cchName);
+        ExitOnFailure(hr, "Failed to allocate registry value name buffer.");
+
+        ReleaseNullMem(pbData);
+        pbData = static_cast<LPBYTE>(MemAlloc(cbMaxData + REG_SNAPSHOT_DATA_PADDING, TRUE));
+        ExitOnNull(pbData, hr, E_OUTOFMEMORY, "Failed to allocate registry value data buffer.");
+
+        er = vpfnRegEnumValueW(pSnapshot->hk, dwIndex, sczName, &cchName, NULL, &dwType, pbData, &cbData);
+        if (ERROR_NO_MORE_ITEMS == er)
+        {
+            break;
+        }
+        else if (ERROR_MORE_DATA == er)
+        {
+            // A value was written since the key was queried so refresh the maximum sizes and try again.
+            er = vpfnRegQueryInfoKeyW(pSnapshot->hk, NULL, NULL, NULL, NULL, NULL, NULL, NULL, &cchMaxName, &cbMaxData, NULL, NULL);
+            ExitOnWin32Error(er, hr, "Failed to refresh value sizes of registry key.");
+
+            continue;
+        }
+        ExitOnWin32Error(er, hr, "Failed to enumerate registry value for snapshot.");
+
+        hr = MemEnsureArraySize(reinterpret_cast<LPVOID*>(&pSnapshot->rgValues), pSnapshot->cValues + 1, sizeof(REG_SNAPSHOT_VALUE), 5);
+        ExitOnFailure(hr, "Failed to grow registry snapshot values.");
+
+        pValue = pSnapshot->rgValues + pSnapshot->cValues;
+
+        hr = StrAllocString(&pValue->sczName, sczName, cchName);
+        ExitOnFailure(hr, "Failed to copy registry value name.");
+
+        pValue->dwType = dwType;
+        pValue->cbData = cbData;
+        pValue->pbData = pbData;
+        pbData = NULL;
+        ++pSnapshot->cValues;
+
+        hr = DictAddValue(pSnapshot->sdValues, pValue);
+        ExitOnFailure1(hr, "Failed to add registry value to snapshot: %ls", pValue->sczName);
+
+        ++dwIndex;
+    }
+
+    pSnapshot->fLoaded = TRUE;
+
+LExit:
+    if (FAILED(hr))
+    {
+        SnapshotUninitialize(pSnapshot);
+    }
+
+    ReleaseMem(pbData);
+    ReleaseStr(sczName);
+
+    return hr;
+}
+
+static void SnapshotUninitialize(
+    __in REG_SNAPSHOT* pSnapshot
+    )
+{
+    for (DWORD i = 0; i < pSnapshot->cValues; ++i)
+    {
+        ReleaseStr(pSnapshot->rgValues[i].sczName);
+        ReleaseMem(pSnapshot->rgValues[i].pbData);
+    }
+
+    ReleaseNullDict(pSnapshot->sdValues);
+    ReleaseNullMem(pSnapshot->rgValues);
+    pSnapshot->cValues = 0;
+    pSnapshot->fLoaded = FALSE;
+}
+
+static HRESULT SnapshotFindValue(
+    __in REG_SNAPSHOT_HANDLE hSnapshot,
+    __in_z_opt LPCWSTR wzName,
+    __out REG_SNAPSHOT_VALUE** ppValue
+    )
+{
+    HRESULT hr = S_OK;
+    REG_SNAPSHOT* pSnapshot = static_cast<REG_SNAPSHOT*>(hSnapshot);
+
+    ExitOnNull(pSnapshot, hr, E_INVALIDARG, "Registry snapshot not specified.");
+
+    if (!pSnapshot->fLoaded)
+    {
+        hr = SnapshotLoad(pSnapshot);
+        ExitOnFailure(hr, "Failed to reload registry snapshot.");
+    }
+
+    hr = DictGetValue(pSnapshot->sdValues, wzName ? wzName : L"", reinterpret_cast<void**>(ppValue));
+    if (E_NOTFOUND == hr)
+    {
+        ExitFunction1(hr = E_FILENOTFOUND);
+    }
+    ExitOnFailure(hr, "Failed to look up registry value in snapshot.");
+
+LExit:
+    return hr;
+}
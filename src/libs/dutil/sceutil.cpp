@@ -62,6 +62,14 @@ struct SCE_ROW
     BYTE *pbData;
 };
 
+// An accessor is only recreated when the bindings it was created with change
+struct SCE_ACCESSOR_CACHE
+{
+    HACCESSOR hAccessor;
+    DWORD cBinding;
+    DBBINDING *rgBinding;
+};
+
 struct SCE_QUERY
 {
     SCE_TABLE_SCHEMA *pTableSchema;
@@ -73,6 +81,13 @@ struct SCE_QUERY
     DBBINDING *rgBinding;
     SIZE_T cbOffset;
     BYTE *pbData;
+
+    // Rowset members, kept open across executions of a prepared query
+    BOOL fPrepared;
+    IRowsetIndex *pIRowsetIndex;
+    IRowset *pIRowset;
+    IAccessor *pIAccessor;
+    SCE_ACCESSOR_CACHE accessorCache;
 };
 
 struct SCE_QUERY_RESULTS
@@ -81,9 +96,23 @@ struct SCE_QUERY_RESULTS
     SCE_TABLE_SCHEMA *pTableSchema;
 };
 
+struct SCE_BATCH
+{
+    SCE_DATABASE *pDatabase;
+    DWORD dwRowsPerTransaction;
+    DWORD cRowsInTransaction;
+    BOOL fInTransaction;
+
+    SCE_ROW *pRow;
+    IAccessor *pIAccessor;
+    IRowsetChange *pIRowsetChange;
+    SCE_ACCESSOR_CACHE accessorCache;
+};
+
 extern const int SCE_ROW_HANDLE_BYTES = sizeof(SCE_ROW);
 extern const int SCE_QUERY_HANDLE_BYTES = sizeof(SCE_QUERY);
 extern const int SCE_QUERY_RESULTS_HANDLE_BYTES = sizeof(SCE_QUERY_RESULTS);
+extern const int SCE_BATCH_HANDLE_BYTES = sizeof(SCE_BATCH);
 
 // The following is the internal Sce-maintained table to tell the identifier and version of the schema
 const SCE_COLUMN_SCHEMA SCE_INTERNAL_VERSION_TABLE_VERSION_COLUMN_SCHEMA[] =
@@ -129,6 +158,19 @@ static HRESULT RunQuery(
     __in_bcount(SCE_QUERY_BYTES) SCE_QUERY_HANDLE psqhHandle,
     __out SCE_QUERY_RESULTS **ppsqrhHandle
     );
+static HRESULT EnsureAccessor(
+    __in IAccessor *pIAccessor,
+    __in_ecount(cBinding) const DBBINDING *rgBinding,
+    __in DWORD cBinding,
+    __inout SCE_ACCESSOR_CACHE *pCache
+    );
+static void ReleaseAccessorCache(
+    __in_opt IAccessor *pIAccessor,
+    __inout SCE_ACCESSOR_CACHE *pCache
+    );
+static void ResetQueryBindings(
+    __in SCE_QUERY *pQuery
+    );
 static HRESULT EnsureSchema(
     __in SCE_DATABASE *pDatabase,
     __in SCE_DATABASE_SCHEMA *pDatabaseSchema
@@ -1345,6 +1387,11 @@ void DAPI SceFreeQuery(
 {
     SCE_QUERY *pQuery = reinterpret_cast<SCE_QUERY *>(sqhHandle);
 
+    ReleaseAccessorCache(pQuery->pIAccessor, &pQuery->accessorCache);
+    ReleaseMem(pQuery->accessorCache.rgBinding);
+    ReleaseObject(pQuery->pIAccessor);
+    ReleaseObject(pQuery->pIRowset);
+    ReleaseObject(pQuery->pIRowsetIndex);
     ReleaseMem(pQuery->rgBinding);
     ReleaseMem(pQuery->pbData);
     ReleaseMem(pQuery);
@@ -1360,6 +1407,227 @@ void DAPI SceFreeQueryResults(
     ReleaseMem(pQueryResults);
 }
 
+/********************************************************************
+ ScePrepareQuery - begins a query whose rowset, index and accessor stay
+                   open across executions. Set the key columns with
+                   SceSetQueryColumn*, run it with SceRunPreparedQuery*
+                   and then set new key columns to run it again.
+
+ NOTE: rows and results returned by one execution should be released
+       before the query is run again. Free with SceFreeQuery.
+*********************************************************************/
+extern "C" HRESULT DAPI ScePrepareQuery(
+    __in SCE_DATABASE *pDatabase,
+    __in DWORD dwTableIndex,
+    __in DWORD dwIndex,
+    __deref_out_bcount(SCE_QUERY_HANDLE_BYTES) SCE_QUERY_HANDLE *psqhHandle
+    )
+{
+    HRESULT hr = S_OK;
+    SCE_QUERY *pQuery = NULL;
+
+    hr = SceBeginQuery(pDatabase, dwTableIndex, dwIndex, reinterpret_cast<SCE_QUERY_HANDLE *>(&pQuery));
+    ExitOnFailure(hr, "Failed to begin prepared query");
+
+    pQuery->fPrepared = TRUE;
+
+    *psqhHandle = static_cast<SCE_QUERY_HANDLE>(pQuery);
+
+LExit:
+    return hr;
+}
+
+extern "C" HRESULT DAPI SceRunPreparedQueryExact(
+    __in_bcount(SCE_QUERY_BYTES) SCE_QUERY_HANDLE sqhHandle,
+    __deref_out_bcount(SCE_ROW_HANDLE_BYTES) SCE_ROW_HANDLE *pRowHandle
+    )
+{
+    HRESULT hr = S_OK;
+    SCE_QUERY *pQuery = reinterpret_cast<SCE_QUERY *>(sqhHandle);
+    SCE_QUERY_RESULTS *pQueryResults = NULL;
+
+    Assert(pQuery->fPrepared);
+
+    hr = RunQuery(FALSE, sqhHandle, &pQueryResults);
+    if (E_NOTFOUND == hr)
+    {
+        ExitFunction();
+    }
+    ExitOnFailure(hr, "Failed to run prepared query exact");
+
+    hr = SceGetNextResultRow(reinterpret_cast<SCE_QUERY_RESULTS_HANDLE>(pQueryResults), pRowHandle);
+    if (E_NOTFOUND == hr)
+    {
+        ExitFunction();
+    }
+    ExitOnFailure(hr, "Failed to get next row out of prepared query results");
+
+LExit:
+    ResetQueryBindings(pQuery);
+    ReleaseSceQueryResults(pQueryResults);
+
+    return hr;
+}
+
+extern "C" HRESULT DAPI SceRunPreparedQueryRange(
+    __in_bcount(SCE_QUERY_BYTES) SCE_QUERY_HANDLE sqhHandle,
+    __deref_out_bcount(SCE_QUERY_RESULTS_BYTES) SCE_QUERY_RESULTS_HANDLE *psqrhHandle
+    )
+{
+    HRESULT hr = S_OK;
+    SCE_QUERY *pQuery = reinterpret_cast<SCE_QUERY *>(sqhHandle);
+    SCE_QUERY_RESULTS **ppQueryResults = reinterpret_cast<SCE_QUERY_RESULTS **>(psqrhHandle);
+
+    Assert(pQuery->fPrepared);
+
+    hr = RunQuery(TRUE, sqhHandle, ppQueryResults);
+    if (E_NOTFOUND == hr)
+    {
+        ExitFunction();
+    }
+    ExitOnFailure(hr, "Failed to run prepared query for range");
+
+LExit:
+    ResetQueryBindings(pQuery);
+
+    return hr;
+}
+
+/********************************************************************
+ SceBeginBatchInsert - begins inserting many rows into a table, grouping
+                       them into transactions of dwRowsPerTransaction rows.
+                       Set the columns of the returned row with
+                       SceSetColumn* and insert it with SceBatchInsertRow.
+
+ NOTE: the returned row handle is owned by the batch and must not be
+       freed by the caller. Free the batch with SceFreeBatchInsert.
+*********************************************************************/
+extern "C" HRESULT DAPI SceBeginBatchInsert(
+    __in SCE_DATABASE *pDatabase,
+    __in DWORD dwTableIndex,
+    __in DWORD dwRowsPerTransaction,
+    __deref_out_bcount(SCE_BATCH_HANDLE_BYTES) SCE_BATCH_HANDLE *psbhHandle,
+    __deref_out_bcount(SCE_ROW_HANDLE_BYTES) SCE_ROW_HANDLE *pRowHandle
+    )
+{
+    HRESULT hr = S_OK;
+    SCE_BATCH *pBatch = NULL;
+
+    pBatch = static_cast<SCE_BATCH *>(MemAlloc(sizeof(SCE_BATCH), TRUE));
+    ExitOnNull(pBatch, hr, E_OUTOFMEMORY, "Failed to allocate new sce batch");
+
+    pBatch->pDatabase = pDatabase;
+    pBatch->dwRowsPerTransaction = dwRowsPerTransaction ? dwRowsPerTransaction : 1;
+
+    hr = ScePrepareInsert(pDatabase, dwTableIndex, reinterpret_cast<SCE_ROW_HANDLE *>(&pBatch->pRow));
+    ExitOnFailure(hr, "Failed to prepare row for batch insert");
+
+    hr = pBatch->pRow->pIRowset->QueryInterface(IID_IAccessor, reinterpret_cast<void **>(&pBatch->pIAccessor));
+    ExitOnFailure(hr, "Failed to get IAccessor interface for batch insert");
+
+    hr = pBatch->pRow->pIRowset->QueryInterface(IID_IRowsetChange, reinterpret_cast<void **>(&pBatch->pIRowsetChange));
+    ExitOnFailure(hr, "Failed to get IRowsetChange interface for batch insert");
+
+    *pRowHandle = reinterpret_cast<SCE_ROW_HANDLE>(pBatch->pRow);
+    *psbhHandle = static_cast<SCE_BATCH_HANDLE>(pBatch);
+    pBatch = NULL;
+
+LExit:
+    ReleaseSceBatchInsert(pBatch);
+
+    return hr;
+}
+
+extern "C" HRESULT DAPI SceBatchInsertRow(
+    __in_bcount(SCE_BATCH_HANDLE_BYTES) SCE_BATCH_HANDLE sbhHandle
+    )
+{
+    HRESULT hr = S_OK;
+    SCE_BATCH *pBatch = reinterpret_cast<SCE_BATCH *>(sbhHandle);
+    SCE_ROW *pRow = pBatch->pRow;
+    HROW hRow = DB_NULL_HROW;
+
+    if (!pBatch->fInTransaction)
+    {
+        hr = SceBeginTransaction(pBatch->pDatabase);
+        ExitOnFailure(hr, "Failed to begin transaction for batch insert");
+
+        pBatch->fInTransaction = TRUE;
+        pBatch->cRowsInTransaction = 0;
+    }
+
+    hr = EnsureAccessor(pBatch->pIAccessor, pRow->rgBinding, pRow->dwBindingIndex, &pBatch->accessorCache);
+    ExitOnFailure(hr, "Failed to create accessor for batch insert");
+
+    hr = pBatch->pIRowsetChange->InsertRow(DB_NULL_HCHAPTER, pBatch->accessorCache.hAccessor, pRow->pbData, &hRow);
+    ExitOnFailure(hr, "Failed to insert new row in batch");
+
+    ++pBatch->cRowsInTransaction;
+    if (pBatch->dwRowsPerTransaction <= pBatch->cRowsInTransaction)
+    {
+        pBatch->fInTransaction = FALSE;
+
+        hr = SceCommitTransaction(pBatch->pDatabase);
+        ExitOnFailure(hr, "Failed to commit batch insert transaction");
+    }
+
+LExit:
+    if (DB_NULL_HROW != hRow)
+    {
+        pRow->pIRowset->ReleaseRows(1, &hRow, NULL, NULL, NULL);
+    }
+
+    // Reset the row so the caller can set the columns of the next row.
+    pRow->dwBindingIndex = 0;
+    pRow->cbOffset = 0;
+
+    return hr;
+}
+
+extern "C" HRESULT DAPI SceCommitBatchInsert(
+    __in_bcount(SCE_BATCH_HANDLE_BYTES) SCE_BATCH_HANDLE sbhHandle
+    )
+{
+    HRESULT hr = S_OK;
+    SCE_BATCH *pBatch = reinterpret_cast<SCE_BATCH *>(sbhHandle);
+
+    if (pBatch->fInTransaction)
+    {
+        pBatch->fInTransaction = FALSE;
+
+        hr = SceCommitTransaction(pBatch->pDatabase);
+        ExitOnFailure(hr, "Failed to commit batch insert transaction");
+    }
+
+LExit:
+    return hr;
+}
+
+// Rows inserted since the last commit are rolled back
+extern "C" void DAPI SceFreeBatchInsert(
+    __in_bcount(SCE_BATCH_HANDLE_BYTES) SCE_BATCH_HANDLE sbhHandle
+    )
+{
+    HRESULT hr = S_OK;
+    SCE_BATCH *pBatch = reinterpret_cast<SCE_BATCH *>(sbhHandle);
+
+    if (pBatch->fInTransaction)
+    {
+        hr = SceRollbackTransaction(pBatch->pDatabase);
+        if (FAILED(hr))
+        {
+            TraceError(hr, "Failed to roll back batch insert transaction");
+        }
+    }
+
+    ReleaseAccessorCache(pBatch->pIAccessor, &pBatch->accessorCache);
+    ReleaseMem(pBatch->accessorCache.rgBinding);
+    ReleaseObject(pBatch->pIRowsetChange);
+    ReleaseObject(pBatch->pIAccessor);
+    ReleaseSceRow(pBatch->pRow);
+    ReleaseMem(pBatch);
+}
+
 // internal function definitions
 static HRESULT RunQuery(
     __in BOOL fRange,
@@ -1370,46 +1638,46 @@ static HRESULT RunQuery(
     HRESULT hr = S_OK;
     DBID tableID = { };
     DBID indexID = { };
-    IAccessor *pIAccessor = NULL;
-    IRowsetIndex *pIRowsetIndex = NULL;
-    IRowset *pIRowset = NULL;
-    HACCESSOR hAccessor = DB_NULL_HACCESSOR;
     SCE_QUERY *pQuery = reinterpret_cast<SCE_QUERY *>(psqhHandle);
     SCE_QUERY_RESULTS *pQueryResults = NULL;
     DBPROPSET rgdbpIndexPropSet[1];
     DBPROP rgdbpIndexProp[1];
 
-    rgdbpIndexPropSet[0].cProperties     = 1;
-    rgdbpIndexPropSet[0].guidPropertySet = DBPROPSET_ROWSET;
-    rgdbpIndexPropSet[0].rgProperties    = rgdbpIndexProp;
+    // Prepared queries only open the rowset the first time they are run.
+    if (NULL == pQuery->pIRowsetIndex)
+    {
+        rgdbpIndexPropSet[0].cProperties     = 1;
+        rgdbpIndexPropSet[0].guidPropertySet = DBPROPSET_ROWSET;
+        rgdbpIndexPropSet[0].rgProperties    = rgdbpIndexProp;
 
-    rgdbpIndexProp[0].dwPropertyID       = DBPROP_IRowsetIndex;
-    rgdbpIndexProp[0].dwOptions          = DBPROPOPTIONS_REQUIRED;
-    rgdbpIndexProp[0].colid              = DB_NULLID;
-    rgdbpIndexProp[0].vValue.vt          = VT_BOOL;
-    rgdbpIndexProp[0].vValue.boolVal     = VARIANT_TRUE;
+        rgdbpIndexProp[0].dwPropertyID       = DBPROP_IRowsetIndex;
+        rgdbpIndexProp[0].dwOptions          = DBPROPOPTIONS_REQUIRED;
+        rgdbpIndexProp[0].colid              = DB_NULLID;
+        rgdbpIndexProp[0].vValue.vt          = VT_BOOL;
+        rgdbpIndexProp[0].vValue.boolVal     = VARIANT_TRUE;
 
-    tableID.eKind = DBKIND_NAME;
-    tableID.uName.pwszName = const_cast<WCHAR *>(pQuery->pTableSchema->wzName);
+        tableID.eKind = DBKIND_NAME;
+        tableID.uName.pwszName = const_cast<WCHAR *>(pQuery->pTableSchema->wzName);
 
-    indexID.eKind = DBKIND_NAME;
-    indexID.uName.pwszName = const_cast<WCHAR *>(pQuery->pIndexSchema->wzName);
+        indexID.eKind = DBKIND_NAME;
+        indexID.uName.pwszName = const_cast<WCHAR *>(pQuery->pIndexSchema->wzName);
 
-    hr = pQuery->pDatabaseInternal->pIOpenRowset->OpenRowset(NULL, &tableID, &indexID, IID_IRowsetIndex, _countof(rgdbpIndexPropSet), rgdbpIndexPropSet, (IUnknown**) &pIRowsetIndex);
-    ExitOnFailure(hr, "Failed to open IRowsetIndex");
+        hr = pQuery->pDatabaseInternal->pIOpenRowset->OpenRowset(NULL, &tableID, &indexID, IID_IRowsetIndex, _countof(rgdbpIndexPropSet), rgdbpIndexPropSet, (IUnknown**) &pQuery->pIRowsetIndex);
+        ExitOnFailure(hr, "Failed to open IRowsetIndex");
 
-    hr = pIRowsetIndex->QueryInterface(IID_IRowset, reinterpret_cast<void **>(&pIRowset));
-    ExitOnFailure(hr, "Failed to get IRowset interface from IRowsetIndex");
+        hr = pQuery->pIRowsetIndex->QueryInterface(IID_IRowset, reinterpret_cast<void **>(&pQuery->pIRowset));
+        ExitOnFailure(hr, "Failed to get IRowset interface from IRowsetIndex");
 
-    hr = pIRowset->QueryInterface(IID_IAccessor, reinterpret_cast<void **>(&pIAccessor));
-    ExitOnFailure(hr, "Failed to get IAccessor interface");
+        hr = pQuery->pIRowset->QueryInterface(IID_IAccessor, reinterpret_cast<void **>(&pQuery->pIAccessor));
+        ExitOnFailure(hr, "Failed to get IAccessor interface");
+    }
 
-    hr = pIAccessor->CreateAccessor(DBACCESSOR_ROWDATA, pQuery->dwBindingIndex, pQuery->rgBinding, 0, &hAccessor, NULL);
+    hr = EnsureAccessor(pQuery->pIAccessor, pQuery->rgBinding, pQuery->dwBindingIndex, &pQuery->accessorCache);
     ExitOnFailure(hr, "Failed to create accessor");
 
     if (!fRange)
     {
-        hr = pIRowsetIndex->Seek(hAccessor, pQuery->dwBindingIndex, pQuery->pbData, DBSEEK_FIRSTEQ);
+        hr = pQuery->pIRowsetIndex->Seek(pQuery->accessorCache.hAccessor, pQuery->dwBindingIndex, pQuery->pbData, DBSEEK_FIRSTEQ);
         if (DB_E_NOTFOUND == hr)
         {
             ExitFunction1(hr = E_NOTFOUND);
@@ -1418,7 +1686,7 @@ static HRESULT RunQuery(
     }
     else
     {
-        hr = pIRowsetIndex->SetRange(hAccessor, pQuery->dwBindingIndex, pQuery->pbData, 0, NULL, DBRANGE_MATCH);
+        hr = pQuery->pIRowsetIndex->SetRange(pQuery->accessorCache.hAccessor, pQuery->dwBindingIndex, pQuery->pbData, 0, NULL, DBRANGE_MATCH);
         if (DB_E_NOTFOUND == hr || E_NOTFOUND == hr)
         {
             ExitFunction1(hr = E_NOTFOUND);
@@ -1430,26 +1698,79 @@ static HRESULT RunQuery(
     ExitOnNull(pQueryResults, hr, E_OUTOFMEMORY, "Failed to allocate query results struct");
 
     pQueryResults->pTableSchema = pQuery->pTableSchema;
-    pQueryResults->pIRowset = pIRowset;
-    pIRowset = NULL;
+    pQueryResults->pIRowset = pQuery->pIRowset;
+    pQueryResults->pIRowset->AddRef();
 
     *ppQueryResults = pQueryResults;
     pQueryResults = NULL;
 
 LExit:
-    if (DB_NULL_HACCESSOR != hAccessor)
+    ReleaseSceQueryResults(pQueryResults);
+
+    return hr;
+}
+
+static HRESULT EnsureAccessor(
+    __in IAccessor *pIAccessor,
+    __in_ecount(cBinding) const DBBINDING *rgBinding,
+    __in DWORD cBinding,
+    __inout SCE_ACCESSOR_CACHE *pCache
+    )
+{
+    HRESULT hr = S_OK;
+    SIZE_T cbBinding = 0;
+
+    hr = ::SizeTMult(sizeof(DBBINDING), cBinding, &cbBinding);
+    ExitOnFailure1(hr, "Overflow while calculating size of bindings for accessor, bindings: %u", cBinding);
+
+    // Bindings are allocated zeroed so they can be compared bytewise.
+    if (DB_NULL_HACCESSOR != pCache->hAccessor && cBinding == pCache->cBinding && (0 == cBinding || 0 == memcmp(rgBinding, pCache->rgBinding, cbBinding)))
     {
-        pIAccessor->ReleaseAccessor(hAccessor, NULL);
+        ExitFunction();
     }
-    ReleaseObject(pIAccessor);
-    ReleaseObject(pIRowset);
-    ReleaseObject(pIRowsetIndex);
-    ReleaseMem(pQueryResults);
-    ReleaseSceQueryResults(pQueryResults);
 
+    ReleaseAccessorCache(pIAccessor, pCache);
+
+    if (0 < cBinding)
+    {
+        hr = MemEnsureArraySize(reinterpret_cast<void **>(&pCache->rgBinding), cBinding, sizeof(DBBINDING), 0);
+        ExitOnFailure(hr, "Failed to allocate cached accessor bindings");
+
+        memcpy_s(pCache->rgBinding, cbBinding, rgBinding, cbBinding);
+    }
+
+    hr = pIAccessor->CreateAccessor(DBACCESSOR_ROWDATA, cBinding, rgBinding, 0, &pCache->hAccessor, NULL);
+    ExitOnFailure(hr, "Failed to create accessor");
+
+    pCache->cBinding = cBinding;
+
+LExit:
     return hr;
 }
 
+static void ReleaseAccessorCache(
+    __in_opt IAccessor *pIAccessor,
+    __inout SCE_ACCESSOR_CACHE *pCache
+    )
+{
+    if (pIAccessor && DB_NULL_HACCESSOR != pCache->hAccessor)
+    {
+        pIAccessor->ReleaseAccessor(pCache->hAccessor, NULL);
+    }
+
+    pCache->hAccessor = DB_NULL_HACCESSOR;
+    pCache->cBinding = 0;
+}
+
+static void ResetQueryBindings(
+    __in SCE_QUERY *pQuery
+    )
+{
+    // Keep the binding and data buffers so the next execution only rebinds the key values.
+    pQuery->dwBindingIndex = 0;
+    pQuery->cbOffset = 0;
+}
+
 static HRESULT EnsureSchema(
     __in SCE_DATABASE *pDatabase,
     __in SCE_DATABASE_SCHEMA *pdsSchema
@@ -15,6 +15,10 @@ const COLORREF THEME_INVISIBLE_COLORREF = 0xFFFFFFFF;
 const DWORD GROW_WINDOW_TEXT = 250;
 const LPCWSTR THEME_WC_HYPERLINK = L"ThemeHyperLink";
 const LPCWSTR THEME_WC_STATICOWNERDRAW = L"ThemeStaticOwnerDraw";
+const DWORD THEME_COMPILED_SIGNATURE = 0x424D4854; // "THMB"
+const DWORD THEME_COMPILED_VERSION = 1;
+const DWORD THEME_COMPILED_ALIGNMENT = 4;
+const DWORD THEME_COMPILED_BUFFER_GROWTH = 64 * 1024;
 
 static Gdiplus::GdiplusStartupInput vgsi;
 static Gdiplus::GdiplusStartupOutput vgso = { };
@@ -25,6 +29,7 @@ static HMODULE vhStaticOwnerDrawRegisteredModule = NULL;
 static WNDPROC vpfnStaticOwnerDrawBaseWndProc = NULL;
 static HMODULE vhModuleRichEd = NULL;
 static HCURSOR vhCursorHand = NULL;
+static WORD vwThemeId = 0;
 
 enum INTERNAL_CONTROL_STYLE
 {
@@ -43,6 +48,129 @@ struct MEMBUFFER_FOR_RICHEDIT
     DWORD iData;
 };
 
+// Compiled themes are a single flat blob: a THEME_COMPILED_HEADER at offset zero
+// followed by 4-byte aligned data referenced by offset from the start of the blob.
+// Strings are null-terminated UTF-16, bitmaps are a BITMAPINFOHEADER (plus color
+// table for monochrome) followed by top-down DIB bits and image lists are stored
+// in ImageList_Write() format.
+struct THEME_COMPILED_REF
+{
+    DWORD dwOffset; // zero when the referenced data is absent.
+    DWORD cb;
+};
+
+struct THEME_COMPILED_HEADER
+{
+    DWORD dwSignature;
+    DWORD dwVersion;
+    DWORD cbTotal;
+
+    BOOL fAutoResize;
+    DWORD dwStyle;
+    DWORD dwFontId;
+    int nHeight;
+    int nMinimumHeight;
+    int nWidth;
+    int nMinimumWidth;
+    int nSourceX;
+    int nSourceY;
+    UINT uStringId;
+
+    THEME_COMPILED_REF caption;
+    THEME_COMPILED_REF image;
+    THEME_COMPILED_REF iconColor;
+    THEME_COMPILED_REF iconMask;
+    THEME_COMPILED_REF fonts;       // THEME_COMPILED_FONT[]
+    THEME_COMPILED_REF imageLists;  // THEME_COMPILED_IMAGELIST[]
+    THEME_COMPILED_REF pages;       // THEME_COMPILED_PAGE[]
+    THEME_COMPILED_REF controls;    // THEME_COMPILED_CONTROL[]
+};
+
+struct THEME_COMPILED_FONT
+{
+    BOOL fPresent;
+    LOGFONTW lf;
+    COLORREF crForeground;
+    COLORREF crBackground;
+};
+
+struct THEME_COMPILED_IMAGELIST
+{
+    THEME_COMPILED_REF name;
+    THEME_COMPILED_REF imageList;
+};
+
+struct THEME_COMPILED_PAGE
+{
+    WORD wId;
+    WORD wReserved;
+    THEME_COMPILED_REF name;
+    THEME_COMPILED_REF controlIndices; // DWORD[]
+};
+
+struct THEME_COMPILED_BILLBOARD
+{
+    THEME_COMPILED_REF image;
+    THEME_COMPILED_REF url;
+};
+
+struct THEME_COMPILED_COLUMN
+{
+    THEME_COMPILED_REF name;
+    UINT uStringId;
+    int nBaseWidth;
+    int nWidth;
+    BOOL fExpands;
+};
+
+struct THEME_COMPILED_TAB
+{
+    THEME_COMPILED_REF name;
+    UINT uStringId;
+};
+
+struct THEME_COMPILED_CONTROL
+{
+    THEME_CONTROL_TYPE type;
+    WORD wId;
+    WORD wPageId;
+
+    THEME_COMPILED_REF name;
+    THEME_COMPILED_REF text;
+    int nX;
+    int nY;
+    int nHeight;
+    int nWidth;
+    int nSourceX;
+    int nSourceY;
+    UINT uStringId;
+
+    THEME_COMPILED_REF image;
+    DWORD rgdwImageList[4]; // index into the theme image lists or THEME_INVALID_ID.
+
+    DWORD dwStyle;
+    DWORD dwExtendedStyle;
+    DWORD dwInternalStyle;
+
+    DWORD dwFontId;
+    DWORD dwFontHoverId;
+    DWORD dwFontSelectedId;
+
+    THEME_COMPILED_REF billboards;  // THEME_COMPILED_BILLBOARD[]
+    WORD wBillboardInterval;
+    WORD wBillboardUrls;
+    BOOL fBillboardLoops;
+
+    THEME_COMPILED_REF columns;     // THEME_COMPILED_COLUMN[]
+    THEME_COMPILED_REF tabs;        // THEME_COMPILED_TAB[]
+};
+
+struct THEME_COMPILE_BUFFER
+{
+    BYTE* pbData;
+    DWORD cbData;
+};
+
 
 // prototypes
 static HRESULT ParseTheme(
@@ -112,6 +240,88 @@ static HRESULT ParseTabs(
     __in IXMLDOMNode* pixn,
     __in THEME_CONTROL* pControl
     );
+static HRESULT CreateThemeFont(
+    __in const LOGFONTW* plf,
+    __in COLORREF crForeground,
+    __in COLORREF crBackground,
+    __in THEME_FONT* pFont
+    );
+static BOOL IsCompiledTheme(
+    __in_bcount(cbData) const BYTE* pbData,
+    __in SIZE_T cbData
+    );
+static HRESULT LoadCompiledTheme(
+    __in_bcount(cbData) const BYTE* pbData,
+    __in SIZE_T cbData,
+    __out THEME** ppTheme
+    );
+static HRESULT LoadCompiledControl(
+    __in_bcount(cbData) const BYTE* pbData,
+    __in SIZE_T cbData,
+    __in const THEME* pTheme,
+    __in const THEME_COMPILED_CONTROL* pCompiled,
+    __in THEME_CONTROL* pControl
+    );
+static HRESULT GetCompiledData(
+    __in_bcount(cbData) const BYTE* pbData,
+    __in SIZE_T cbData,
+    __in const THEME_COMPILED_REF* pRef,
+    __out const BYTE** ppb
+    );
+static HRESULT GetCompiledArray(
+    __in_bcount(cbData) const BYTE* pbData,
+    __in SIZE_T cbData,
+    __in const THEME_COMPILED_REF* pRef,
+    __in SIZE_T cbElement,
+    __out const void** ppv,
+    __out DWORD* pcElements
+    );
+static HRESULT LoadCompiledString(
+    __in_bcount(cbData) const BYTE* pbData,
+    __in SIZE_T cbData,
+    __in const THEME_COMPILED_REF* pRef,
+    __deref_out_z_opt LPWSTR* psczValue
+    );
+static HRESULT LoadCompiledBitmap(
+    __in_bcount(cbData) const BYTE* pbData,
+    __in SIZE_T cbData,
+    __in const THEME_COMPILED_REF* pRef,
+    __out HBITMAP* phBitmap
+    );
+static HRESULT LoadCompiledImageList(
+    __in_bcount(cbData) const BYTE* pbData,
+    __in SIZE_T cbData,
+    __in const THEME_COMPILED_REF* pRef,
+    __out HIMAGELIST* phImageList
+    );
+static HRESULT CompileControl(
+    __in THEME_COMPILE_BUFFER* pBuffer,
+    __in const THEME* pTheme,
+    __in const THEME_CONTROL* pControl,
+    __out THEME_COMPILED_CONTROL* pCompiled
+    );
+static HRESULT AppendCompiledData(
+    __in THEME_COMPILE_BUFFER* pBuffer,
+    __in_bcount(cb) const void* pv,
+    __in DWORD cb,
+    __out THEME_COMPILED_REF* pRef
+    );
+static HRESULT AppendCompiledString(
+    __in THEME_COMPILE_BUFFER* pBuffer,
+    __in_z_opt LPCWSTR wzValue,
+    __out THEME_COMPILED_REF* pRef
+    );
+static HRESULT AppendCompiledBitmap(
+    __in THEME_COMPILE_BUFFER* pBuffer,
+    __in_opt HBITMAP hBitmap,
+    __in WORD wBitCount,
+    __out THEME_COMPILED_REF* pRef
+    );
+static HRESULT AppendCompiledImageList(
+    __in THEME_COMPILE_BUFFER* pBuffer,
+    __in_opt HIMAGELIST hImageList,
+    __out THEME_COMPILED_REF* pRef
+    );
 static HRESULT FindImageList(
     __in THEME* pTheme,
     __in_z LPCWSTR wzImageListName,
@@ -321,21 +531,35 @@ DAPI_(HRESULT) ThemeLoadFromFile(
     )
 {
     HRESULT hr = S_OK;
+    BYTE* pbTheme = NULL;
+    DWORD cbTheme = 0;
     IXMLDOMDocument* pixd = NULL;
     LPWSTR sczRelativePath = NULL;
 
-    hr = XmlLoadDocumentFromFile(wzThemeFile, &pixd);
-    ExitOnFailure(hr, "Failed to load theme resource as XML document.");
+    hr = FileRead(&pbTheme, &cbTheme, wzThemeFile);
+    ExitOnFailure(hr, "Failed to read theme file: %ls", wzThemeFile);
+
+    if (IsCompiledTheme(pbTheme, cbTheme))
+    {
+        hr = LoadCompiledTheme(pbTheme, cbTheme, ppTheme);
+        ExitOnFailure(hr, "Failed to load compiled theme.");
+    }
+    else
+    {
+        hr = XmlLoadDocumentFromBuffer(pbTheme, cbTheme, &pixd);
+        ExitOnFailure(hr, "Failed to load theme resource as XML document.");
 
-    hr = PathGetDirectory(wzThemeFile, &sczRelativePath);
-    ExitOnFailure(hr, "Failed to get relative path from theme file.");
+        hr = PathGetDirectory(wzThemeFile, &sczRelativePath);
+        ExitOnFailure(hr, "Failed to get relative path from theme file.");
 
-    hr = ParseTheme(NULL, sczRelativePath, pixd, ppTheme);
-    ExitOnFailure(hr, "Failed to parse theme.");
+        hr = ParseTheme(NULL, sczRelativePath, pixd, ppTheme);
+        ExitOnFailure(hr, "Failed to parse theme.");
+    }
 
 LExit:
     ReleaseStr(sczRelativePath);
     ReleaseObject(pixd);
+    ReleaseMem(pbTheme);
 
     return hr;
 }
@@ -356,6 +580,15 @@ DAPI_(HRESULT) ThemeLoadFromResource(
     hr = ResReadData(hModule, szResource, &pvResource, &cbResource);
     ExitOnFailure(hr, "Failed to read theme from resource.");
 
+    // Compiled themes are used straight from the resource section.
+    if (IsCompiledTheme(reinterpret_cast<BYTE*>(pvResource), cbResource))
+    {
+        hr = LoadCompiledTheme(reinterpret_cast<BYTE*>(pvResource), cbResource, ppTheme);
+        ExitOnFailure(hr, "Failed to load compiled theme from resource.");
+
+        ExitFunction();
+    }
+
     // Ensure returned resource buffer is null-terminated.
     reinterpret_cast<BYTE *>(pvResource)[cbResource - 1] = '\0';
 
@@ -376,6 +609,170 @@ LExit:
 }
 
 
+DAPI_(HRESULT) ThemeSaveCompiled(
+    __in const THEME* pTheme,
+    __in_z LPCWSTR wzCompiledFile
+    )
+{
+    HRESULT hr = S_OK;
+    THEME_COMPILE_BUFFER buffer = { };
+    THEME_COMPILED_HEADER header = { };
+    THEME_COMPILED_REF headerRef = { };
+    ICONINFO iconInfo = { };
+    THEME_COMPILED_FONT* rgFonts = NULL;
+    THEME_COMPILED_IMAGELIST* rgImageLists = NULL;
+    THEME_COMPILED_PAGE* rgPages = NULL;
+    THEME_COMPILED_CONTROL* rgControls = NULL;
+
+    // Reserve space for the header, it is filled in last once every reference is known.
+    hr = AppendCompiledData(&buffer, &header, sizeof(header), &headerRef);
+    ExitOnFailure(hr, "Failed to reserve compiled theme header.");
+
+    header.dwSignature = THEME_COMPILED_SIGNATURE;
+    header.dwVersion = THEME_COMPILED_VERSION;
+    header.fAutoResize = pTheme->fAutoResize;
+    header.dwStyle = pTheme->dwStyle;
+    header.dwFontId = pTheme->dwFontId;
+    header.nHeight = pTheme->nHeight;
+    header.nMinimumHeight = pTheme->nMinimumHeight;
+    header.nWidth = pTheme->nWidth;
+    header.nMinimumWidth = pTheme->nMinimumWidth;
+    header.nSourceX = pTheme->nSourceX;
+    header.nSourceY = pTheme->nSourceY;
+    header.uStringId = pTheme->uStringId;
+
+    hr = AppendCompiledString(&buffer, pTheme->sczCaption, &header.caption);
+    ExitOnFailure(hr, "Failed to compile theme caption.");
+
+    hr = AppendCompiledBitmap(&buffer, pTheme->hImage, 32, &header.image);
+    ExitOnFailure(hr, "Failed to compile theme image.");
+
+    if (pTheme->hIcon)
+    {
+        if (!::GetIconInfo(static_cast<HICON>(pTheme->hIcon), &iconInfo))
+        {
+            ExitWithLastError(hr, "Failed to get theme icon information.");
+        }
+
+        hr = AppendCompiledBitmap(&buffer, iconInfo.hbmColor, 32, &header.iconColor);
+        ExitOnFailure(hr, "Failed to compile theme icon color bitmap.");
+
+        hr = AppendCompiledBitmap(&buffer, iconInfo.hbmMask, 1, &header.iconMask);
+        ExitOnFailure(hr, "Failed to compile theme icon mask bitmap.");
+    }
+
+    if (pTheme->cFonts)
+    {
+        rgFonts = static_cast<THEME_COMPILED_FONT*>(MemAlloc(sizeof(THEME_COMPILED_FONT) * pTheme->cFonts, TRUE));
+        ExitOnNull(rgFonts, hr, E_OUTOFMEMORY, "Failed to allocate compiled theme fonts.");
+
+        for (DWORD i = 0; i < pTheme->cFonts; ++i)
+        {
+            const THEME_FONT* pFont = pTheme->rgFonts + i;
+
+            // Font ids may be sparse so only the fonts that were created are present.
+            if (pFont->hFont)
+            {
+                if (!::GetObjectW(pFont->hFont, sizeof(LOGFONTW), &rgFonts[i].lf))
+                {
+                    ExitWithLastError(hr, "Failed to get theme font: %u", i);
+                }
+
+                rgFonts[i].fPresent = TRUE;
+                rgFonts[i].crForeground = pFont->crForeground;
+                rgFonts[i].crBackground = pFont->crBackground;
+            }
+        }
+
+        hr = AppendCompiledData(&buffer, rgFonts, sizeof(THEME_COMPILED_FONT) * pTheme->cFonts, &header.fonts);
+        ExitOnFailure(hr, "Failed to compile theme fonts.");
+    }
+
+    if (pTheme->cImageLists)
+    {
+        rgImageLists = static_cast<THEME_COMPILED_IMAGELIST*>(MemAlloc(sizeof(THEME_COMPILED_IMAGELIST) * pTheme->cImageLists, TRUE));
+        ExitOnNull(rgImageLists, hr, E_OUTOFMEMORY, "Failed to allocate compiled theme image lists.");
+
+        for (DWORD i = 0; i < pTheme->cImageLists; ++i)
+        {
+            hr = AppendCompiledString(&buffer, pTheme->rgImageLists[i].sczName, &rgImageLists[i].name);
+            ExitOnFailure(hr, "Failed to compile image list name.");
+
+            hr = AppendCompiledImageList(&buffer, pTheme->rgImageLists[i].hImageList, &rgImageLists[i].imageList);
+            ExitOnFailure(hr, "Failed to compile image list: %ls", pTheme->rgImageLists[i].sczName);
+        }
+
+        hr = AppendCompiledData(&buffer, rgImageLists, sizeof(THEME_COMPILED_IMAGELIST) * pTheme->cImageLists, &header.imageLists);
+        ExitOnFailure(hr, "Failed to compile theme image lists.");
+    }
+
+    if (pTheme->cPages)
+    {
+        rgPages = static_cast<THEME_COMPILED_PAGE*>(MemAlloc(sizeof(THEME_COMPILED_PAGE) * pTheme->cPages, TRUE));
+        ExitOnNull(rgPages, hr, E_OUTOFMEMORY, "Failed to allocate compiled theme pages.");
+
+        for (DWORD i = 0; i < pTheme->cPages; ++i)
+        {
+            const THEME_PAGE* pPage = pTheme->rgPages + i;
+
+            rgPages[i].wId = pPage->wId;
+
+            hr = AppendCompiledString(&buffer, pPage->sczName, &rgPages[i].name);
+            ExitOnFailure(hr, "Failed to compile page name.");
+
+            if (pPage->cControlIndices)
+            {
+                hr = AppendCompiledData(&buffer, pPage->rgdwControlIndices, sizeof(DWORD) * pPage->cControlIndices, &rgPages[i].controlIndices);
+                ExitOnFailure(hr, "Failed to compile page control indices.");
+            }
+        }
+
+        hr = AppendCompiledData(&buffer, rgPages, sizeof(THEME_COMPILED_PAGE) * pTheme->cPages, &header.pages);
+        ExitOnFailure(hr, "Failed to compile theme pages.");
+    }
+
+    if (pTheme->cControls)
+    {
+        rgControls = static_cast<THEME_COMPILED_CONTROL*>(MemAlloc(sizeof(THEME_COMPILED_CONTROL) * pTheme->cControls, TRUE));
+        ExitOnNull(rgControls, hr, E_OUTOFMEMORY, "Failed to allocate compiled theme controls.");
+
+        for (DWORD i = 0; i < pTheme->cControls; ++i)
+        {
+            hr = CompileControl(&buffer, pTheme, pTheme->rgControls + i, rgControls + i);
+            ExitOnFailure(hr, "Failed to compile control: %u", i);
+        }
+
+        hr = AppendCompiledData(&buffer, rgControls, sizeof(THEME_COMPILED_CONTROL) * pTheme->cControls, &header.controls);
+        ExitOnFailure(hr, "Failed to compile theme controls.");
+    }
+
+    header.cbTotal = buffer.cbData;
+    memcpy(buffer.pbData + headerRef.dwOffset, &header, sizeof(header));
+
+    hr = FileWrite(wzCompiledFile, FILE_ATTRIBUTE_NORMAL, buffer.pbData, buffer.cbData, NULL);
+    ExitOnFailure(hr, "Failed to write compiled theme: %ls", wzCompiledFile);
+
+LExit:
+    if (iconInfo.hbmColor)
+    {
+        ::DeleteObject(iconInfo.hbmColor);
+    }
+
+    if (iconInfo.hbmMask)
+    {
+        ::DeleteObject(iconInfo.hbmMask);
+    }
+
+    ReleaseMem(rgControls);
+    ReleaseMem(rgPages);
+    ReleaseMem(rgImageLists);
+    ReleaseMem(rgFonts);
+    ReleaseMem(buffer.pbData);
+
+    return hr;
+}
+
+
 DAPI_(void) ThemeFree(
     __in THEME* pTheme
     )
@@ -1688,8 +2085,6 @@ static HRESULT ParseTheme(
     __out THEME** ppTheme
     )
 {
-    static WORD wThemeId = 0;
-
     HRESULT hr = S_OK;
     THEME* pTheme = NULL;
     IXMLDOMElement *pThemeElement = NULL;
@@ -1700,7 +2095,7 @@ static HRESULT ParseTheme(
     pTheme = static_cast<THEME*>(MemAlloc(sizeof(THEME), TRUE));
     ExitOnNull(pTheme, hr, E_OUTOFMEMORY, "Failed to allocate memory for theme.");
 
-    pTheme->wId = ++wThemeId;
+    pTheme->wId = ++vwThemeId;
 
     // Parse the optional background resource image.
     hr = ParseImage(hModule, wzRelativePath, pThemeElement, &pTheme->hImage);
@@ -2127,22 +2522,8 @@ static HRESULT ParseFonts(
             ExitOnRootFailure(hr, "Theme font id duplicated.");
         }
 
-        pFont->hFont = ::CreateFontIndirectW(&lf);
-        ExitOnNullWithLastError(pFont->hFont, hr, "Failed to create product title font.");
-
-        pFont->crForeground = crForeground;
-        if (THEME_INVISIBLE_COLORREF != pFont->crForeground)
-        {
-            pFont->hForeground = ::CreateSolidBrush(pFont->crForeground);
-            ExitOnNullWithLastError(pFont->hForeground, hr, "Failed to create text foreground brush.");
-        }
-
-        pFont->crBackground = crBackground;
-        if (THEME_INVISIBLE_COLORREF != pFont->crBackground)
-        {
-            pFont->hBackground = ::CreateSolidBrush(pFont->crBackground);
-            ExitOnNullWithLastError(pFont->hBackground, hr, "Failed to create text background brush.");
-        }
+        hr = CreateThemeFont(&lf, crForeground, crBackground, pFont);
+        ExitOnFailure(hr, "Failed to create theme font.");
 
         ReleaseNullBSTR(bstrName);
         ReleaseNullObject(pixn);
@@ -3079,6 +3460,892 @@ LExit:
 }
 
 
+static HRESULT CreateThemeFont(
+    __in const LOGFONTW* plf,
+    __in COLORREF crForeground,
+    __in COLORREF crBackground,
+    __in THEME_FONT* pFont
+    )
+{
+    HRESULT hr = S_OK;
+
+    pFont->hFont = ::CreateFontIndirectW(plf);
+    ExitOnNullWithLastError(pFont->hFont, hr, "Failed to create product title font.");
+
+    pFont->crForeground = crForeground;
+    if (THEME_INVISIBLE_COLORREF != pFont->crForeground)
+    {
+        pFont->hForeground = ::CreateSolidBrush(pFont->crForeground);
+        ExitOnNullWithLastError(pFont->hForeground, hr, "Failed to create text foreground brush.");
+    }
+
+    pFont->crBackground = crBackground;
+    if (THEME_INVISIBLE_COLORREF != pFont->crBackground)
+    {
+        pFont->hBackground = ::CreateSolidBrush(pFont->crBackground);
+        ExitOnNullWithLastError(pFont->hBackground, hr, "Failed to create text background brush.");
+    }
+
+LExit:
+    return hr;
+}
+
+
+static BOOL IsCompiledTheme(
+    __in_bcount(cbData) const BYTE* pbData,
+    __in SIZE_T cbData
+    )
+{
+    return sizeof(THEME_COMPILED_HEADER) <= cbData && THEME_COMPILED_SIGNATURE == reinterpret_cast<const THEME_COMPILED_HEADER*>(pbData)->dwSignature;
+}
+
+
+static HRESULT LoadCompiledTheme(
+    __in_bcount(cbData) const BYTE* pbData,
+    __in SIZE_T cbData,
+    __out THEME** ppTheme
+    )
+{
+    HRESULT hr = S_OK;
+    const THEME_COMPILED_HEADER* pHeader = reinterpret_cast<const THEME_COMPILED_HEADER*>(pbData);
+    const THEME_COMPILED_FONT* rgFonts = NULL;
+    const THEME_COMPILED_IMAGELIST* rgImageLists = NULL;
+    const THEME_COMPILED_PAGE* rgPages = NULL;
+    const THEME_COMPILED_CONTROL* rgControls = NULL;
+    const DWORD* rgdwControlIndices = NULL;
+    DWORD cFonts = 0;
+    DWORD cImageLists = 0;
+    DWORD cPages = 0;
+    DWORD cControls = 0;
+    DWORD cControlIndices = 0;
+    HBITMAP hbmIconColor = NULL;
+    HBITMAP hbmIconMask = NULL;
+    ICONINFO iconInfo = { };
+    THEME* pTheme = NULL;
+
+    if (THEME_COMPILED_VERSION != pHeader->dwVersion || cbData != pHeader->cbTotal)
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+        ExitOnRootFailure(hr, "Unsupported compiled theme version %u or size mismatch.", pHeader->dwVersion);
+    }
+
+    pTheme = static_cast<THEME*>(MemAlloc(sizeof(THEME), TRUE));
+    ExitOnNull(pTheme, hr, E_OUTOFMEMORY, "Failed to allocate memory for theme.");
+
+    pTheme->wId = ++vwThemeId;
+    pTheme->fAutoResize = pHeader->fAutoResize;
+    pTheme->dwStyle = pHeader->dwStyle;
+    pTheme->dwFontId = pHeader->dwFontId;
+    pTheme->nHeight = pHeader->nHeight;
+    pTheme->nMinimumHeight = pHeader->nMinimumHeight;
+    pTheme->nWidth = pHeader->nWidth;
+    pTheme->nMinimumWidth = pHeader->nMinimumWidth;
+    pTheme->nSourceX = pHeader->nSourceX;
+    pTheme->nSourceY = pHeader->nSourceY;
+    pTheme->uStringId = pHeader->uStringId;
+
+    hr = LoadCompiledString(pbData, cbData, &pHeader->caption, &pTheme->sczCaption);
+    ExitOnFailure(hr, "Failed to load compiled theme caption.");
+
+    hr = LoadCompiledBitmap(pbData, cbData, &pHeader->image, &pTheme->hImage);
+    ExitOnFailure(hr, "Failed to load compiled theme image.");
+
+    hr = LoadCompiledBitmap(pbData, cbData, &pHeader->iconMask, &hbmIconMask);
+    ExitOnFailure(hr, "Failed to load compiled theme icon mask.");
+
+    if (hbmIconMask)
+    {
+        hr = LoadCompiledBitmap(pbData, cbData, &pHeader->iconColor, &hbmIconColor);
+        ExitOnFailure(hr, "Failed to load compiled theme icon color bitmap.");
+
+        iconInfo.fIcon = TRUE;
+        iconInfo.hbmMask = hbmIconMask;
+        iconInfo.hbmColor = hbmIconColor;
+
+        pTheme->hIcon = ::CreateIconIndirect(&iconInfo);
+        ExitOnNullWithLastError(pTheme->hIcon, hr, "Failed to create application icon.");
+    }
+
+    hr = GetCompiledArray(pbData, cbData, &pHeader->fonts, sizeof(THEME_COMPILED_FONT), reinterpret_cast<const void**>(&rgFonts), &cFonts);
+    ExitOnFailure(hr, "Failed to get compiled theme fonts.");
+
+    if (cFonts)
+    {
+        pTheme->rgFonts = static_cast<THEME_FONT*>(MemAlloc(sizeof(THEME_FONT) * cFonts, TRUE));
+        ExitOnNull(pTheme->rgFonts, hr, E_OUTOFMEMORY, "Failed to allocate theme fonts.");
+
+        pTheme->cFonts = cFonts;
+
+        for (DWORD i = 0; i < cFonts; ++i)
+        {
+            if (rgFonts[i].fPresent)
+            {
+                hr = CreateThemeFont(&rgFonts[i].lf, rgFonts[i].crForeground, rgFonts[i].crBackground, pTheme->rgFonts + i);
+                ExitOnFailure(hr, "Failed to create compiled theme font: %u", i);
+            }
+        }
+    }
+
+    if (THEME_INVALID_ID != pTheme->dwFontId && cFonts <= pTheme->dwFontId)
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+        ExitOnRootFailure(hr, "Invalid compiled theme font index: %u", pTheme->dwFontId);
+    }
+
+    hr = GetCompiledArray(pbData, cbData, &pHeader->imageLists, sizeof(THEME_COMPILED_IMAGELIST), reinterpret_cast<const void**>(&rgImageLists), &cImageLists);
+    ExitOnFailure(hr, "Failed to get compiled theme image lists.");
+
+    if (cImageLists)
+    {
+        pTheme->rgImageLists = static_cast<THEME_IMAGELIST*>(MemAlloc(sizeof(THEME_IMAGELIST) * cImageLists, TRUE));
+        ExitOnNull(pTheme->rgImageLists, hr, E_OUTOFMEMORY, "Failed to allocate theme image lists.");
+
+        pTheme->cImageLists = cImageLists;
+
+        for (DWORD i = 0; i < cImageLists; ++i)
+        {
+            hr = LoadCompiledString(pbData, cbData, &rgImageLists[i].name, &pTheme->rgImageLists[i].sczName);
+            ExitOnFailure(hr, "Failed to load compiled image list name.");
+
+            hr = LoadCompiledImageList(pbData, cbData, &rgImageLists[i].imageList, &pTheme->rgImageLists[i].hImageList);
+            ExitOnFailure(hr, "Failed to load compiled image list: %u", i);
+        }
+    }
+
+    hr = GetCompiledArray(pbData, cbData, &pHeader->controls, sizeof(THEME_COMPILED_CONTROL), reinterpret_cast<const void**>(&rgControls), &cControls);
+    ExitOnFailure(hr, "Failed to get compiled theme controls.");
+
+    if (cControls)
+    {
+        pTheme->rgControls = static_cast<THEME_CONTROL*>(MemAlloc(sizeof(THEME_CONTROL) * cControls, TRUE));
+        ExitOnNull(pTheme->rgControls, hr, E_OUTOFMEMORY, "Failed to allocate theme controls.");
+
+        pTheme->cControls = cControls;
+
+        for (DWORD i = 0; i < cControls; ++i)
+        {
+            hr = LoadCompiledControl(pbData, cbData, pTheme, rgControls + i, pTheme->rgControls + i);
+            ExitOnFailure(hr, "Failed to load compiled control: %u", i);
+        }
+    }
+
+    hr = GetCompiledArray(pbData, cbData, &pHeader->pages, sizeof(THEME_COMPILED_PAGE), reinterpret_cast<const void**>(&rgPages), &cPages);
+    ExitOnFailure(hr, "Failed to get compiled theme pages.");
+
+    if (cPages)
+    {
+        pTheme->rgPages = static_cast<THEME_PAGE*>(MemAlloc(sizeof(THEME_PAGE) * cPages, TRUE));
+        ExitOnNull(pTheme->rgPages, hr, E_OUTOFMEMORY, "Failed to allocate theme pages.");
+
+        pTheme->cPages = cPages;
+
+        for (DWORD i = 0; i < cPages; ++i)
+        {
+            THEME_PAGE* pPage = pTheme->rgPages + i;
+
+            pPage->wId = rgPages[i].wId;
+
+            hr = LoadCompiledString(pbData, cbData, &rgPages[i].name, &pPage->sczName);
+            ExitOnFailure(hr, "Failed to load compiled page name.");
+
+            hr = GetCompiledArray(pbData, cbData, &rgPages[i].controlIndices, sizeof(DWORD), reinterpret_cast<const void**>(&rgdwControlIndices), &cControlIndices);
+            ExitOnFailure(hr, "Failed to get compiled page control indices.");
+
+            if (cControlIndices)
+            {
+                for (DWORD j = 0; j < cControlIndices; ++j)
+                {
+                    if (cControls <= rgdwControlIndices[j])
+                    {
+                        hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+                        ExitOnRootFailure(hr, "Invalid compiled page control index: %u", rgdwControlIndices[j]);
+                    }
+                }
+
+                pPage->rgdwControlIndices = static_cast<DWORD*>(MemAlloc(sizeof(DWORD) * cControlIndices, FALSE));
+                ExitOnNull(pPage->rgdwControlIndices, hr, E_OUTOFMEMORY, "Failed to allocate page control indices.");
+
+                memcpy(pPage->rgdwControlIndices, rgdwControlIndices, sizeof(DWORD) * cControlIndices);
+                pPage->cControlIndices = cControlIndices;
+            }
+        }
+    }
+
+    *ppTheme = pTheme;
+    pTheme = NULL;
+
+LExit:
+    // CreateIconIndirect() copies the bitmaps so they are no longer needed.
+    if (hbmIconColor)
+    {
+        ::DeleteObject(hbmIconColor);
+    }
+
+    if (hbmIconMask)
+    {
+        ::DeleteObject(hbmIconMask);
+    }
+
+    if (pTheme)
+    {
+        ThemeFree(pTheme);
+    }
+
+    return hr;
+}
+
+
+static HRESULT LoadCompiledControl(
+    __in_bcount(cbData) const BYTE* pbData,
+    __in SIZE_T cbData,
+    __in const THEME* pTheme,
+    __in const THEME_COMPILED_CONTROL* pCompiled,
+    __in THEME_CONTROL* pControl
+    )
+{
+    HRESULT hr = S_OK;
+    const THEME_COMPILED_BILLBOARD* rgBillboards = NULL;
+    const THEME_COMPILED_COLUMN* rgColumns = NULL;
+    const THEME_COMPILED_TAB* rgTabs = NULL;
+    DWORD cBillboards = 0;
+    DWORD cColumns = 0;
+    DWORD cTabs = 0;
+    const DWORD rgdwFontIds[] = { pCompiled->dwFontId, pCompiled->dwFontHoverId, pCompiled->dwFontSelectedId };
+
+    // The font ids index the theme fonts when the control is drawn.
+    for (DWORD i = 0; i < countof(rgdwFontIds); ++i)
+    {
+        if (THEME_INVALID_ID != rgdwFontIds[i] && pTheme->cFonts <= rgdwFontIds[i])
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+            ExitOnRootFailure(hr, "Invalid compiled control font index: %u", rgdwFontIds[i]);
+        }
+    }
+
+    pControl->type = pCompiled->type;
+    pControl->wId = pCompiled->wId;
+    pControl->wPageId = pCompiled->wPageId;
+    pControl->nX = pCompiled->nX;
+    pControl->nY = pCompiled->nY;
+    pControl->nHeight = pCompiled->nHeight;
+    pControl->nWidth = pCompiled->nWidth;
+    pControl->nSourceX = pCompiled->nSourceX;
+    pControl->nSourceY = pCompiled->nSourceY;
+    pControl->uStringId = pCompiled->uStringId;
+    pControl->dwStyle = pCompiled->dwStyle;
+    pControl->dwExtendedStyle = pCompiled->dwExtendedStyle;
+    pControl->dwInternalStyle = pCompiled->dwInternalStyle;
+    pControl->dwFontId = pCompiled->dwFontId;
+    pControl->dwFontHoverId = pCompiled->dwFontHoverId;
+    pControl->dwFontSelectedId = pCompiled->dwFontSelectedId;
+    pControl->wBillboardInterval = pCompiled->wBillboardInterval;
+    pControl->wBillboardUrls = pCompiled->wBillboardUrls;
+    pControl->fBillboardLoops = pCompiled->fBillboardLoops;
+
+    for (DWORD i = 0; i < countof(pControl->rghImageList); ++i)
+    {
+        DWORD dwImageList = pCompiled->rgdwImageList[i];
+        if (THEME_INVALID_ID != dwImageList)
+        {
+            if (pTheme->cImageLists <= dwImageList)
+            {
+                hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+                ExitOnRootFailure(hr, "Invalid compiled control image list index: %u", dwImageList);
+            }
+
+            pControl->rghImageList[i] = pTheme->rgImageLists[dwImageList].hImageList;
+        }
+    }
+
+    hr = LoadCompiledString(pbData, cbData, &pCompiled->name, &pControl->sczName);
+    ExitOnFailure(hr, "Failed to load compiled control name.");
+
+    hr = LoadCompiledString(pbData, cbData, &pCompiled->text, &pControl->sczText);
+    ExitOnFailure(hr, "Failed to load compiled control text.");
+
+    hr = LoadCompiledBitmap(pbData, cbData, &pCompiled->image, &pControl->hImage);
+    ExitOnFailure(hr, "Failed to load compiled control image.");
+
+    hr = GetCompiledArray(pbData, cbData, &pCompiled->billboards, sizeof(THEME_COMPILED_BILLBOARD), reinterpret_cast<const void**>(&rgBillboards), &cBillboards);
+    ExitOnFailure(hr, "Failed to get compiled billboards.");
+
+    if (cBillboards)
+    {
+        pControl->ptbBillboards = static_cast<THEME_BILLBOARD*>(MemAlloc(sizeof(THEME_BILLBOARD) * cBillboards, TRUE));
+        ExitOnNull(pControl->ptbBillboards, hr, E_OUTOFMEMORY, "Failed to allocate billboards.");
+
+        pControl->cBillboards = cBillboards;
+
+        for (DWORD i = 0; i < cBillboards; ++i)
+        {
+            hr = LoadCompiledBitmap(pbData, cbData, &rgBillboards[i].image, &pControl->ptbBillboards[i].hImage);
+            ExitOnFailure(hr, "Failed to load compiled billboard image.");
+
+            hr = LoadCompiledString(pbData, cbData, &rgBillboards[i].url, &pControl->ptbBillboards[i].sczUrl);
+            ExitOnFailure(hr, "Failed to load compiled billboard url.");
+        }
+    }
+
+    hr = GetCompiledArray(pbData, cbData, &pCompiled->columns, sizeof(THEME_COMPILED_COLUMN), reinterpret_cast<const void**>(&rgColumns), &cColumns);
+    ExitOnFailure(hr, "Failed to get compiled columns.");
+
+    if (cColumns)
+    {
+        pControl->ptcColumns = static_cast<THEME_COLUMN*>(MemAlloc(sizeof(THEME_COLUMN) * cColumns, TRUE));
+        ExitOnNull(pControl->ptcColumns, hr, E_OUTOFMEMORY, "Failed to allocate columns.");
+
+        pControl->cColumns = cColumns;
+
+        for (DWORD i = 0; i < cColumns; ++i)
+        {
+            THEME_COLUMN* pColumn = pControl->ptcColumns + i;
+
+            pColumn->uStringId = rgColumns[i].uStringId;
+            pColumn->nBaseWidth = rgColumns[i].nBaseWidth;
+            pColumn->nWidth = rgColumns[i].nWidth;
+            pColumn->fExpands = rgColumns[i].fExpands;
+
+            hr = LoadCompiledString(pbData, cbData, &rgColumns[i].name, &pColumn->pszName);
+            ExitOnFailure(hr, "Failed to load compiled column name.");
+        }
+    }
+
+    hr = GetCompiledArray(pbData, cbData, &pCompiled->tabs, sizeof(THEME_COMPILED_TAB), reinterpret_cast<const void**>(&rgTabs), &cTabs);
+    ExitOnFailure(hr, "Failed to get compiled tabs.");
+
+    if (cTabs)
+    {
+        pControl->pttTabs = static_cast<THEME_TAB*>(MemAlloc(sizeof(THEME_TAB) * cTabs, TRUE));
+        ExitOnNull(pControl->pttTabs, hr, E_OUTOFMEMORY, "Failed to allocate tabs.");
+
+        pControl->cTabs = cTabs;
+
+        for (DWORD i = 0; i < cTabs; ++i)
+        {
+            pControl->pttTabs[i].uStringId = rgTabs[i].uStringId;
+
+            hr = LoadCompiledString(pbData, cbData, &rgTabs[i].name, &pControl->pttTabs[i].pszName);
+            ExitOnFailure(hr, "Failed to load compiled tab name.");
+        }
+    }
+
+LExit:
+    return hr;
+}
+
+
+static HRESULT GetCompiledData(
+    __in_bcount(cbData) const BYTE* pbData,
+    __in SIZE_T cbData,
+    __in const THEME_COMPILED_REF* pRef,
+    __out const BYTE** ppb
+    )
+{
+    HRESULT hr = S_OK;
+
+    *ppb = NULL;
+
+    if (!pRef->dwOffset)
+    {
+        ExitFunction();
+    }
+
+    if (pRef->dwOffset < sizeof(THEME_COMPILED_HEADER) || 0 != pRef->dwOffset % THEME_COMPILED_ALIGNMENT || cbData < pRef->dwOffset || cbData - pRef->dwOffset < pRef->cb)
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+        ExitOnRootFailure(hr, "Compiled theme data at offset %u is out of range.", pRef->dwOffset);
+    }
+
+    *ppb = pbData + pRef->dwOffset;
+
+LExit:
+    return hr;
+}
+
+
+static HRESULT GetCompiledArray(
+    __in_bcount(cbData) const BYTE* pbData,
+    __in SIZE_T cbData,
+    __in const THEME_COMPILED_REF* pRef,
+    __in SIZE_T cbElement,
+    __out const void** ppv,
+    __out DWORD* pcElements
+    )
+{
+    HRESULT hr = S_OK;
+    const BYTE* pb = NULL;
+
+    *ppv = NULL;
+    *pcElements = 0;
+
+    hr = GetCompiledData(pbData, cbData, pRef, &pb);
+    ExitOnFailure(hr, "Failed to get compiled array.");
+
+    if (pb)
+    {
+        if (0 != pRef->cb % cbElement)
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+            ExitOnRootFailure(hr, "Compiled theme array at offset %u has an invalid size.", pRef->dwOffset);
+        }
+
+        *ppv = pb;
+        *pcElements = static_cast<DWORD>(pRef->cb / cbElement);
+    }
+
+LExit:
+    return hr;
+}
+
+
+static HRESULT LoadCompiledString(
+    __in_bcount(cbData) const BYTE* pbData,
+    __in SIZE_T cbData,
+    __in const THEME_COMPILED_REF* pRef,
+    __deref_out_z_opt LPWSTR* psczValue
+    )
+{
+    HRESULT hr = S_OK;
+    LPCWSTR wzValue = NULL;
+    DWORD cchValue = 0;
+
+    hr = GetCompiledArray(pbData, cbData, pRef, sizeof(WCHAR), reinterpret_cast<const void**>(&wzValue), &cchValue);
+    ExitOnFailure(hr, "Failed to get compiled string.");
+
+    if (wzValue)
+    {
+        if (!cchValue || L'\0' != wzValue[cchValue - 1])
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+            ExitOnRootFailure(hr, "Compiled theme string at offset %u is not null terminated.", pRef->dwOffset);
+        }
+
+        // Copy the string since the theme owns (and may localize) its strings.
+        hr = StrAllocString(psczValue, wzValue, cchValue - 1);
+        ExitOnFailure(hr, "Failed to copy compiled string.");
+    }
+
+LExit:
+    return hr;
+}
+
+
+static HRESULT LoadCompiledBitmap(
+    __in_bcount(cbData) const BYTE* pbData,
+    __in SIZE_T cbData,
+    __in const THEME_COMPILED_REF* pRef,
+    __out HBITMAP* phBitmap
+    )
+{
+    HRESULT hr = S_OK;
+    const BYTE* pb = NULL;
+    const BITMAPINFOHEADER* pbmih = NULL;
+    DWORD cbHeader = 0;
+    DWORD cbBits = 0;
+    HDC hdc = NULL;
+    LPVOID pvBits = NULL;
+    HBITMAP hBitmap = NULL;
+
+    hr = GetCompiledData(pbData, cbData, pRef, &pb);
+    ExitOnFailure(hr, "Failed to get compiled bitmap.");
+
+    if (!pb)
+    {
+        ExitFunction();
+    }
+
+    pbmih = reinterpret_cast<const BITMAPINFOHEADER*>(pb);
+    if (pRef->cb < sizeof(BITMAPINFOHEADER) || sizeof(BITMAPINFOHEADER) != pbmih->biSize || BI_RGB != pbmih->biCompression ||
+        (1 != pbmih->biBitCount && 32 != pbmih->biBitCount) || 0 >= pbmih->biWidth || 0 <= pbmih->biHeight)
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+        ExitOnRootFailure(hr, "Compiled theme bitmap at offset %u is invalid.", pRef->dwOffset);
+    }
+
+    cbHeader = sizeof(BITMAPINFOHEADER) + (1 == pbmih->biBitCount ? 2 * sizeof(RGBQUAD) : 0);
+    if (pRef->cb != cbHeader + ((static_cast<DWORD64>(pbmih->biWidth) * pbmih->biBitCount + 31) / 32) * 4 * static_cast<DWORD64>(-static_cast<LONGLONG>(pbmih->biHeight)))
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+        ExitOnRootFailure(hr, "Compiled theme bitmap at offset %u has an invalid size.", pRef->dwOffset);
+    }
+
+    cbBits = pRef->cb - cbHeader;
+
+    if (32 == pbmih->biBitCount)
+    {
+        hBitmap = ::CreateDIBSection(NULL, reinterpret_cast<const BITMAPINFO*>(pbmih), DIB_RGB_COLORS, &pvBits, NULL, 0);
+        ExitOnNullWithLastError(hBitmap, hr, "Failed to create compiled theme bitmap.");
+
+        memcpy(pvBits, pb + cbHeader, cbBits);
+    }
+    else // icon masks must stay monochrome device-dependent bitmaps.
+    {
+        hBitmap = ::CreateBitmap(pbmih->biWidth, -pbmih->biHeight, 1, 1, NULL);
+        ExitOnNullWithLastError(hBitmap, hr, "Failed to create compiled theme mask bitmap.");
+
+        hdc = ::GetDC(NULL);
+        ExitOnNullWithLastError(hdc, hr, "Failed to get screen device context.");
+
+        if (!::SetDIBits(hdc, hBitmap, 0, -pbmih->biHeight, pb + cbHeader, reinterpret_cast<const BITMAPINFO*>(pbmih), DIB_RGB_COLORS))
+        {
+            ExitWithLastError(hr, "Failed to set compiled theme mask bitmap bits.");
+        }
+    }
+
+    *phBitmap = hBitmap;
+    hBitmap = NULL;
+
+LExit:
+    if (hdc)
+    {
+        ::ReleaseDC(NULL, hdc);
+    }
+
+    if (hBitmap)
+    {
+        ::DeleteObject(hBitmap);
+    }
+
+    return hr;
+}
+
+
+static HRESULT LoadCompiledImageList(
+    __in_bcount(cbData) const BYTE* pbData,
+    __in SIZE_T cbData,
+    __in const THEME_COMPILED_REF* pRef,
+    __out HIMAGELIST* phImageList
+    )
+{
+    HRESULT hr = S_OK;
+    const BYTE* pb = NULL;
+    HGLOBAL hGlobal = NULL;
+    LPVOID pv = NULL;
+    IStream* pStream = NULL;
+
+    hr = GetCompiledData(pbData, cbData, pRef, &pb);
+    ExitOnFailure(hr, "Failed to get compiled image list.");
+
+    if (!pb)
+    {
+        ExitFunction();
+    }
+
+    hGlobal = ::GlobalAlloc(GMEM_MOVEABLE, pRef->cb);
+    ExitOnNullWithLastError(hGlobal, hr, "Failed to allocate global memory.");
+
+    pv = ::GlobalLock(hGlobal);
+    ExitOnNullWithLastError(pv, hr, "Failed to lock global memory.");
+
+    memcpy(pv, pb, pRef->cb);
+
+    ::GlobalUnlock(hGlobal);
+    pv = NULL;
+
+    hr = ::CreateStreamOnHGlobal(hGlobal, TRUE, &pStream);
+    ExitOnFailure(hr, "Failed to allocate stream from global memory.");
+
+    hGlobal = NULL; // we gave the global memory to the stream object so it will close it
+
+    *phImageList = ImageList_Read(pStream);
+    ExitOnNull(*phImageList, hr, HRESULT_FROM_WIN32(ERROR_INVALID_DATA), "Failed to read compiled image list.");
+
+LExit:
+    ReleaseObject(pStream);
+
+    if (pv)
+    {
+        ::GlobalUnlock(hGlobal);
+    }
+
+    if (hGlobal)
+    {
+        ::GlobalFree(hGlobal);
+    }
+
+    return hr;
+}
+
+
+static HRESULT CompileControl(
+    __in THEME_COMPILE_BUFFER* pBuffer,
+    __in const THEME* pTheme,
+    __in const THEME_CONTROL* pControl,
+    __out THEME_COMPILED_CONTROL* pCompiled
+    )
+{
+    HRESULT hr = S_OK;
+    THEME_COMPILED_BILLBOARD* rgBillboards = NULL;
+    THEME_COMPILED_COLUMN* rgColumns = NULL;
+    THEME_COMPILED_TAB* rgTabs = NULL;
+
+    pCompiled->type = pControl->type;
+    pCompiled->wId = pControl->wId;
+    pCompiled->wPageId = pControl->wPageId;
+    pCompiled->nX = pControl->nX;
+    pCompiled->nY = pControl->nY;
+    pCompiled->nHeight = pControl->nHeight;
+    pCompiled->nWidth = pControl->nWidth;
+    pCompiled->nSourceX = pControl->nSourceX;
+    pCompiled->nSourceY = pControl->nSourceY;
+    pCompiled->uStringId = pControl->uStringId;
+    pCompiled->dwStyle = pControl->dwStyle;
+    pCompiled->dwExtendedStyle = pControl->dwExtendedStyle;
+    pCompiled->dwInternalStyle = pControl->dwInternalStyle;
+    pCompiled->dwFontId = pControl->dwFontId;
+    pCompiled->dwFontHoverId = pControl->dwFontHoverId;
+    pCompiled->dwFontSelectedId = pControl->dwFontSelectedId;
+    pCompiled->wBillboardInterval = pControl->wBillboardInterval;
+    pCompiled->wBillboardUrls = pControl->wBillboardUrls;
+    pCompiled->fBillboardLoops = pControl->fBillboardLoops;
+
+    // Image list handles are shared with the theme so store them as indices.
+    for (DWORD i = 0; i < countof(pControl->rghImageList); ++i)
+    {
+        pCompiled->rgdwImageList[i] = THEME_INVALID_ID;
+
+        for (DWORD j = 0; pControl->rghImageList[i] && j < pTheme->cImageLists; ++j)
+        {
+            if (pTheme->rgImageLists[j].hImageList == pControl->rghImageList[i])
+            {
+                pCompiled->rgdwImageList[i] = j;
+                break;
+            }
+        }
+    }
+
+    hr = AppendCompiledString(pBuffer, pControl->sczName, &pCompiled->name);
+    ExitOnFailure(hr, "Failed to compile control name.");
+
+    hr = AppendCompiledString(pBuffer, pControl->sczText, &pCompiled->text);
+    ExitOnFailure(hr, "Failed to compile control text.");
+
+    hr = AppendCompiledBitmap(pBuffer, pControl->hImage, 32, &pCompiled->image);
+    ExitOnFailure(hr, "Failed to compile control image.");
+
+    if (pControl->cBillboards)
+    {
+        rgBillboards = static_cast<THEME_COMPILED_BILLBOARD*>(MemAlloc(sizeof(THEME_COMPILED_BILLBOARD) * pControl->cBillboards, TRUE));
+        ExitOnNull(rgBillboards, hr, E_OUTOFMEMORY, "Failed to allocate compiled billboards.");
+
+        for (DWORD i = 0; i < pControl->cBillboards; ++i)
+        {
+            hr = AppendCompiledBitmap(pBuffer, pControl->ptbBillboards[i].hImage, 32, &rgBillboards[i].image);
+            ExitOnFailure(hr, "Failed to compile billboard image.");
+
+            hr = AppendCompiledString(pBuffer, pControl->ptbBillboards[i].sczUrl, &rgBillboards[i].url);
+            ExitOnFailure(hr, "Failed to compile billboard url.");
+        }
+
+        hr = AppendCompiledData(pBuffer, rgBillboards, sizeof(THEME_COMPILED_BILLBOARD) * pControl->cBillboards, &pCompiled->billboards);
+        ExitOnFailure(hr, "Failed to compile billboards.");
+    }
+
+    if (pControl->cColumns)
+    {
+        rgColumns = static_cast<THEME_COMPILED_COLUMN*>(MemAlloc(sizeof(THEME_COMPILED_COLUMN) * pControl->cColumns, TRUE));
+        ExitOnNull(rgColumns, hr, E_OUTOFMEMORY, "Failed to allocate compiled columns.");
+
+        for (DWORD i = 0; i < pControl->cColumns; ++i)
+        {
+            const THEME_COLUMN* pColumn = pControl->ptcColumns + i;
+
+            rgColumns[i].uStringId = pColumn->uStringId;
+            rgColumns[i].nBaseWidth = pColumn->nBaseWidth;
+            rgColumns[i].nWidth = pColumn->nWidth;
+            rgColumns[i].fExpands = pColumn->fExpands;
+
+            hr = AppendCompiledString(pBuffer, pColumn->pszName, &rgColumns[i].name);
+            ExitOnFailure(hr, "Failed to compile column name.");
+        }
+
+        hr = AppendCompiledData(pBuffer, rgColumns, sizeof(THEME_COMPILED_COLUMN) * pControl->cColumns, &pCompiled->columns);
+        ExitOnFailure(hr, "Failed to compile columns.");
+    }
+
+    if (pControl->cTabs)
+    {
+        rgTabs = static_cast<THEME_COMPILED_TAB*>(MemAlloc(sizeof(THEME_COMPILED_TAB) * pControl->cTabs, TRUE));
+        ExitOnNull(rgTabs, hr, E_OUTOFMEMORY, "Failed to allocate compiled tabs.");
+
+        for (DWORD i = 0; i < pControl->cTabs; ++i)
+        {
+            rgTabs[i].uStringId = pControl->pttTabs[i].uStringId;
+
+            hr = AppendCompiledString(pBuffer, pControl->pttTabs[i].pszName, &rgTabs[i].name);
+            ExitOnFailure(hr, "Failed to compile tab name.");
+        }
+
+        hr = AppendCompiledData(pBuffer, rgTabs, sizeof(THEME_COMPILED_TAB) * pControl->cTabs, &pCompiled->tabs);
+        ExitOnFailure(hr, "Failed to compile tabs.");
+    }
+
+LExit:
+    ReleaseMem(rgTabs);
+    ReleaseMem(rgColumns);
+    ReleaseMem(rgBillboards);
+
+    return hr;
+}
+
+
+static HRESULT AppendCompiledData(
+    __in THEME_COMPILE_BUFFER* pBuffer,
+    __in_bcount(cb) const void* pv,
+    __in DWORD cb,
+    __out THEME_COMPILED_REF* pRef
+    )
+{
+    HRESULT hr = S_OK;
+    DWORD dwOffset = pBuffer->cbData;
+    DWORD cbAligned = (cb + THEME_COMPILED_ALIGNMENT - 1) & ~(THEME_COMPILED_ALIGNMENT - 1);
+
+    // New memory is zeroed by MemEnsureArraySize() so the alignment padding is deterministic.
+    hr = MemEnsureArraySize(reinterpret_cast<LPVOID*>(&pBuffer->pbData), dwOffset + cbAligned, sizeof(BYTE), THEME_COMPILED_BUFFER_GROWTH);
+    ExitOnFailure(hr, "Failed to grow compiled theme buffer.");
+
+    memcpy(pBuffer->pbData + dwOffset, pv, cb);
+    pBuffer->cbData = dwOffset + cbAligned;
+
+    pRef->dwOffset = dwOffset;
+    pRef->cb = cb;
+
+LExit:
+    return hr;
+}
+
+
+static HRESULT AppendCompiledString(
+    __in THEME_COMPILE_BUFFER* pBuffer,
+    __in_z_opt LPCWSTR wzValue,
+    __out THEME_COMPILED_REF* pRef
+    )
+{
+    HRESULT hr = S_OK;
+
+    if (wzValue)
+    {
+        hr = AppendCompiledData(pBuffer, wzValue, static_cast<DWORD>((lstrlenW(wzValue) + 1) * sizeof(WCHAR)), pRef);
+        ExitOnFailure(hr, "Failed to append compiled string.");
+    }
+
+LExit:
+    return hr;
+}
+
+
+static HRESULT AppendCompiledBitmap(
+    __in THEME_COMPILE_BUFFER* pBuffer,
+    __in_opt HBITMAP hBitmap,
+    __in WORD wBitCount,
+    __out THEME_COMPILED_REF* pRef
+    )
+{
+    HRESULT hr = S_OK;
+    BITMAP bm = { };
+    HDC hdc = NULL;
+    BYTE* pbBitmap = NULL;
+    BITMAPINFOHEADER* pbmih = NULL;
+    DWORD cbHeader = sizeof(BITMAPINFOHEADER) + (1 == wBitCount ? 2 * sizeof(RGBQUAD) : 0);
+    DWORD cbBits = 0;
+
+    if (!hBitmap)
+    {
+        ExitFunction();
+    }
+
+    if (!::GetObjectW(hBitmap, sizeof(bm), &bm))
+    {
+        ExitWithLastError(hr, "Failed to get theme bitmap.");
+    }
+
+    cbBits = ((bm.bmWidth * wBitCount + 31) / 32) * 4 * bm.bmHeight;
+
+    pbBitmap = static_cast<BYTE*>(MemAlloc(cbHeader + cbBits, TRUE));
+    ExitOnNull(pbBitmap, hr, E_OUTOFMEMORY, "Failed to allocate compiled bitmap.");
+
+    pbmih = reinterpret_cast<BITMAPINFOHEADER*>(pbBitmap);
+    pbmih->biSize = sizeof(BITMAPINFOHEADER);
+    pbmih->biWidth = bm.bmWidth;
+    pbmih->biHeight = -bm.bmHeight; // top-down so the bits can be copied straight into a DIB section.
+    pbmih->biPlanes = 1;
+    pbmih->biBitCount = wBitCount;
+    pbmih->biCompression = BI_RGB;
+    pbmih->biSizeImage = cbBits;
+
+    hdc = ::GetDC(NULL);
+    ExitOnNullWithLastError(hdc, hr, "Failed to get screen device context.");
+
+    if (!::GetDIBits(hdc, hBitmap, 0, bm.bmHeight, pbBitmap + cbHeader, reinterpret_cast<BITMAPINFO*>(pbmih), DIB_RGB_COLORS))
+    {
+        ExitWithLastError(hr, "Failed to get theme bitmap bits.");
+    }
+
+    hr = AppendCompiledData(pBuffer, pbBitmap, cbHeader + cbBits, pRef);
+    ExitOnFailure(hr, "Failed to append compiled bitmap.");
+
+LExit:
+    if (hdc)
+    {
+        ::ReleaseDC(NULL, hdc);
+    }
+
+    ReleaseMem(pbBitmap);
+
+    return hr;
+}
+
+
+static HRESULT AppendCompiledImageList(
+    __in THEME_COMPILE_BUFFER* pBuffer,
+    __in_opt HIMAGELIST hImageList,
+    __out THEME_COMPILED_REF* pRef
+    )
+{
+    HRESULT hr = S_OK;
+    IStream* pStream = NULL;
+    STATSTG statstg = { };
+    HGLOBAL hGlobal = NULL;
+    LPVOID pv = NULL;
+
+    if (!hImageList)
+    {
+        ExitFunction();
+    }
+
+    hr = ::CreateStreamOnHGlobal(NULL, TRUE, &pStream);
+    ExitOnFailure(hr, "Failed to create image list stream.");
+
+    if (!ImageList_Write(hImageList, pStream))
+    {
+        hr = E_FAIL;
+        ExitOnRootFailure(hr, "Failed to write image list to stream.");
+    }
+
+    hr = pStream->Stat(&statstg, STATFLAG_NONAME);
+    ExitOnFailure(hr, "Failed to get image list stream size.");
+
+    hr = ::GetHGlobalFromStream(pStream, &hGlobal);
+    ExitOnFailure(hr, "Failed to get image list stream memory.");
+
+    pv = ::GlobalLock(hGlobal);
+    ExitOnNullWithLastError(pv, hr, "Failed to lock image list stream memory.");
+
+    hr = AppendCompiledData(pBuffer, pv, statstg.cbSize.LowPart, pRef);
+    ExitOnFailure(hr, "Failed to append compiled image list.");
+
+LExit:
+    if (pv)
+    {
+        ::GlobalUnlock(hGlobal);
+    }
+
+    ReleaseObject(pStream);
+
+    return hr;
+}
+
+
 static HRESULT FindImageList(
     __in THEME* pTheme,
     __in_z LPCWSTR wzImageListName,
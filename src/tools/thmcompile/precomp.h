@@ -0,0 +1,17 @@
+#pragma once
+// Copyright (c) .NET Foundation and contributors. All rights reserved. Licensed under the Microsoft Reciprocal License. See LICENSE.TXT file in the project root for full license information.
+
+
+#include <windows.h>
+#include <gdiplus.h>
+#include <msiquery.h>
+#include <objbase.h>
+#include <shlwapi.h>
+#include <strsafe.h>
+
+#include "dutil.h"
+#include "conutil.h"
+#include "memutil.h"
+#include "locutil.h"
+#include "strutil.h"
+#include "thmutil.h"
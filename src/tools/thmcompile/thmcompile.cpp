@@ -0,0 +1,60 @@
+// Copyright (c) .NET Foundation and contributors. All rights reserved. Licensed under the Microsoft Reciprocal License. See LICENSE.TXT file in the project root for full license information.
+
+#include "precomp.h"
+
+
+int __cdecl wmain(
+    __in int argc,
+    __in LPWSTR argv[]
+    )
+{
+    HRESULT hr = S_OK;
+    BOOL fComInitialized = FALSE;
+    BOOL fThemeInitialized = FALSE;
+    THEME* pTheme = NULL;
+
+    hr = ConsoleInitialize();
+    ExitOnFailure(hr, "Failed to initialize console.");
+
+    if (3 != argc)
+    {
+        ConsoleWriteLine(CONSOLE_COLOR_NORMAL, "usage: thmcompile.exe theme.xml compiled.thm");
+        ExitFunction1(hr = E_INVALIDARG);
+    }
+
+    hr = ::CoInitialize(NULL);
+    ExitOnFailure(hr, "Failed to initialize COM.");
+    fComInitialized = TRUE;
+
+    hr = ThemeInitialize(NULL);
+    ExitOnFailure(hr, "Failed to initialize theme manager.");
+    fThemeInitialized = TRUE;
+
+    hr = ThemeLoadFromFile(argv[1], &pTheme);
+    ExitOnFailure(hr, "Failed to load theme: %ls", argv[1]);
+
+    hr = ThemeSaveCompiled(pTheme, argv[2]);
+    ExitOnFailure(hr, "Failed to save compiled theme: %ls", argv[2]);
+
+LExit:
+    if (FAILED(hr) && E_INVALIDARG != hr)
+    {
+        ConsoleWriteError(hr, CONSOLE_COLOR_RED, "Failed to compile theme.");
+    }
+
+    ReleaseTheme(pTheme);
+
+    if (fThemeInitialized)
+    {
+        ThemeUninitialize();
+    }
+
+    if (fComInitialized)
+    {
+        ::CoUninitialize();
+    }
+
+    ConsoleUninitialize();
+
+    return hr;
+}
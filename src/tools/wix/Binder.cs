@@ -4517,6 +4517,11 @@ namespace Microsoft.Tools.WindowsInstallerXml
                     writer.WriteAttributeString("ParallelCache", "yes");
                 }
 
+                if (chain.ParallelDetect)
+                {
+                    writer.WriteAttributeString("ParallelDetect", "yes");
+                }
+
                 // Build up the list of target codes from all the MSPs in the chain.
                 List<WixBundlePatchTargetCodeRow> targetCodes = new List<WixBundlePatchTargetCodeRow>();
 
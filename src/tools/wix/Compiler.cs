@@ -21212,6 +21212,12 @@ namespace Microsoft.Tools.WindowsInstallerXml
                                 attributes |= BundleChainAttributes.ParallelCache;
                             }
                             break;
+                        case "ParallelDetect":
+                            if (YesNoType.Yes == this.core.GetAttributeYesNoValue(sourceLineNumbers, attrib))
+                            {
+                                attributes |= BundleChainAttributes.ParallelDetect;
+                            }
+                            break;
                         default:
                             this.core.UnexpectedAttribute(sourceLineNumbers, attrib);
                             break;
@@ -0,0 +1,164 @@
+// Copyright (c) .NET Foundation and contributors. All rights reserved. Licensed under the Microsoft Reciprocal License. See LICENSE.TXT file in the project root for full license information.
+
+#include "precomp.h"
+
+
+namespace Microsoft
+{
+namespace Tools
+{
+namespace WindowsInstallerXml
+{
+namespace Test
+{
+namespace Bootstrapper
+{
+    using namespace System;
+    using namespace System::IO;
+    using namespace WixTest;
+    using namespace Xunit;
+
+    public ref class ApplyTest : BurnUnitTest
+    {
+    public:
+        [NamedFact]
+        void ApplyAcquireThreadsTest()
+        {
+            const DWORD cPayloads = 4;
+            const DWORD iChangedPayload = 2;
+            HRESULT hr = S_OK;
+            BURN_VARIABLES variables = { };
+            BURN_PLAN plan = { };
+            BURN_PACKAGE package = { };
+            BURN_PAYLOAD rgPayloads[cPayloads] = { };
+            BURN_CACHE_ACTION rgCacheActions[cPayloads] = { };
+            BURN_ACQUIRE_THREAD_CONTEXT context = { };
+            HANDLE rghThreads[BURN_CACHE_MAX_ACQUIRE_THREADS] = { };
+            DWORD cThreads = 0;
+            LPWSTR sczAcquiredFrom = NULL;
+            String^ testPath = Path::Combine(Path::GetTempPath(), "ApplyAcquireThreadsTest");
+
+            try
+            {
+                Directory::CreateDirectory(Path::Combine(testPath, "source"));
+                Directory::CreateDirectory(Path::Combine(testPath, "unverified"));
+
+                hr = VariableInitialize(&variables);
+                TestThrowOnFailure(hr, L"Failed to initialize variables.");
+
+                package.sczId = L"ApplyAcquireThreadsTest.Package";
+
+                for (DWORD i = 0; i < cPayloads; ++i)
+                {
+                    String^ sourcePath = Path::Combine(testPath, String::Format("source\\{0}.txt", i));
+                    String^ unverifiedPath = Path::Combine(testPath, String::Format("unverified\\{0}", i));
+                    pin_ptr<const WCHAR> wzSourcePath = PtrToStringChars(sourcePath);
+                    pin_ptr<const WCHAR> wzUnverifiedPath = PtrToStringChars(unverifiedPath);
+
+                    File::WriteAllText(sourcePath, String::Format("payload {0}", i));
+
+                    rgPayloads[i].sczKey = L"ApplyAcquireThreadsTest.Payload";
+
+                    hr = StrAllocString(&rgPayloads[i].sczSourcePath, wzSourcePath, 0);
+                    TestThrowOnFailure(hr, L"Failed to copy source path.");
+
+                    rgCacheActions[i].type = BURN_CACHE_ACTION_TYPE_ACQUIRE_PAYLOAD;
+                    rgCacheActions[i].resolvePayload.pPackage = &package;
+                    rgCacheActions[i].resolvePayload.pPayload = rgPayloads + i;
+
+                    hr = StrAllocString(&rgCacheActions[i].resolvePayload.sczUnverifiedPath, wzUnverifiedPath, 0);
+                    TestThrowOnFailure(hr, L"Failed to copy unverified path.");
+                }
+
+                plan.rgCacheActions = rgCacheActions;
+                plan.cCacheActions = cPayloads;
+
+                hr = ApplyStartAcquireThreads(&plan, &variables, &context, rghThreads, &cThreads);
+                TestThrowOnFailure(hr, L"Failed to start acquire threads.");
+                Assert::NotEqual(0, (int)cThreads);
+
+                // The BA points one payload at another source after the threads captured the old one.
+                String^ changedSourcePath = Path::Combine(testPath, "source\\changed.txt");
+                pin_ptr<const WCHAR> wzChangedSourcePath = PtrToStringChars(changedSourcePath);
+                File::WriteAllText(changedSourcePath, "changed");
+
+                hr = StrAllocString(&rgPayloads[iChangedPayload].sczSourcePath, wzChangedSourcePath, 0);
+                TestThrowOnFailure(hr, L"Failed to change source path.");
+
+                WaitForAcquireThreads(&context);
+
+                for (DWORD i = 0; i < cPayloads; ++i)
+                {
+                    hr = ApplyTakeAcquiredContainerOrPayload(&context, i, &sczAcquiredFrom);
+                    TestThrowOnFailure(hr, L"Failed to take acquired payload.");
+
+                    if (iChangedPayload == i)
+                    {
+                        // The copy from the old source is dropped, so the cache thread acquires it again.
+                        Assert::True(NULL == sczAcquiredFrom);
+                    }
+                    else
+                    {
+                        Assert::True(NULL != sczAcquiredFrom);
+                        Assert::Equal(gcnew String(rgPayloads[i].sczSourcePath), gcnew String(sczAcquiredFrom));
+                        Assert::Equal(String::Format("payload {0}", i), File::ReadAllText(gcnew String(rgCacheActions[i].resolvePayload.sczUnverifiedPath)));
+                    }
+
+                    ReleaseNullStr(sczAcquiredFrom);
+                }
+            }
+            finally
+            {
+                if (context.pPlan)
+                {
+                    ApplyStopAcquireThreads(&context, rghThreads, cThreads);
+                }
+
+                for (DWORD i = 0; i < cPayloads; ++i)
+                {
+                    ReleaseStr(rgPayloads[i].sczSourcePath);
+                    ReleaseStr(rgCacheActions[i].resolvePayload.sczUnverifiedPath);
+                }
+
+                ReleaseStr(sczAcquiredFrom);
+                VariablesUninitialize(&variables);
+
+                if (Directory::Exists(testPath))
+                {
+                    Directory::Delete(testPath, true);
+                }
+            }
+        }
+
+    private:
+        void WaitForAcquireThreads(BURN_ACQUIRE_THREAD_CONTEXT* pContext)
+        {
+            BOOL fDone = FALSE;
+
+            while (!fDone)
+            {
+                fDone = TRUE;
+
+                ::EnterCriticalSection(&pContext->cs);
+                for (DWORD i = 0; i < pContext->cActions; ++i)
+                {
+                    BURN_ACQUIRE_STATE state = pContext->rgState[pContext->rgiActions[i]];
+                    if (BURN_ACQUIRE_STATE_ACQUIRED != state && BURN_ACQUIRE_STATE_NOT_ACQUIRED != state)
+                    {
+                        fDone = FALSE;
+                    }
+                }
+                ::LeaveCriticalSection(&pContext->cs);
+
+                if (!fDone)
+                {
+                    ::Sleep(10);
+                }
+            }
+        }
+    };
+}
+}
+}
+}
+}
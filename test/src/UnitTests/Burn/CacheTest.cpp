@@ -46,7 +46,7 @@ namespace Bootstrapper
                 payload.pbCertificateRootPublicKeyIdentifier = pb;
                 payload.cbCertificateRootPublicKeyIdentifier = cb;
 
-                hr = CacheCompletePayload(package.fPerMachine, &payload, package.sczCacheId, sczPayloadPath, FALSE);
+                hr = CacheCompletePayload(package.fPerMachine, &payload, package.sczCacheId, sczPayloadPath, FALSE, NULL, NULL);
                 Assert::True(S_OK == hr, "Failed while verifying path.");
             }
             finally
@@ -62,6 +62,331 @@ namespace Bootstrapper
                 }
             }
         }
+
+        [NamedFact]
+        void CacheContentStoreTest()
+        {
+            HRESULT hr = S_OK;
+            BURN_PAYLOAD payload = { };
+            BYTE rgbHash[SHA1_HASH_LEN] = { };
+            LPWSTR sczHash = NULL;
+            BOOL fSameFile = FALSE;
+            String^ packageCachePath = Path::Combine(Environment::GetFolderPath(Environment::SpecialFolder::LocalApplicationData), "Package Cache");
+            String^ firstCachePath = Path::Combine(packageCachePath, "Bootstrapper.CacheTest.CacheContentStoreTest.First");
+            String^ secondCachePath = Path::Combine(packageCachePath, "Bootstrapper.CacheTest.CacheContentStoreTest.Second");
+            String^ sourcePath = Path::GetTempFileName();
+            String^ storePath = nullptr;
+
+            try
+            {
+                File::WriteAllBytes(sourcePath, Text::Encoding::UTF8->GetBytes("CacheContentStoreTest"));
+
+                pin_ptr<const WCHAR> wzSourcePath = PtrToStringChars(sourcePath);
+                hr = CrypHashFile(wzSourcePath, PROV_RSA_FULL, CALG_SHA1, rgbHash, sizeof(rgbHash), NULL);
+                TestThrowOnFailure(hr, L"Failed to hash source file.");
+
+                hr = StrAllocHexEncode(rgbHash, sizeof(rgbHash), &sczHash);
+                TestThrowOnFailure(hr, L"Failed to encode hash.");
+
+                storePath = Path::Combine(packageCachePath, ".store\\" + gcnew String(sczHash));
+
+                payload.sczKey = L"CacheContentStoreTest.PayloadKey";
+                payload.sczFilePath = L"CacheContentStoreTest.File";
+                payload.pbHash = rgbHash;
+                payload.cbHash = sizeof(rgbHash);
+
+                // The first package copies and verifies the payload, which adds it to the store.
+                hr = CacheCompletePayload(FALSE, &payload, L"Bootstrapper.CacheTest.CacheContentStoreTest.First", wzSourcePath, FALSE, NULL, NULL);
+                TestThrowOnFailure(hr, L"Failed to cache payload for first package.");
+                Assert::True(File::Exists(storePath));
+
+                // The second package links to the stored content, even though the source is gone.
+                File::Delete(sourcePath);
+
+                hr = CacheCompletePayload(FALSE, &payload, L"Bootstrapper.CacheTest.CacheContentStoreTest.Second", wzSourcePath, FALSE, NULL, NULL);
+                TestThrowOnFailure(hr, L"Failed to cache payload for second package.");
+
+                pin_ptr<const WCHAR> wzFirstPath = PtrToStringChars(Path::Combine(firstCachePath, "CacheContentStoreTest.File"));
+                pin_ptr<const WCHAR> wzSecondPath = PtrToStringChars(Path::Combine(secondCachePath, "CacheContentStoreTest.File"));
+                hr = FileIsSame(wzFirstPath, wzSecondPath, &fSameFile);
+                TestThrowOnFailure(hr, L"Failed to compare cached files.");
+                Assert::True(fSameFile);
+
+                // Damaged stored content is not trusted, so caching again replaces it from the source.
+                File::WriteAllBytes(sourcePath, Text::Encoding::UTF8->GetBytes("CacheContentStoreTest"));
+                File::SetAttributes(gcnew String(wzSecondPath), FileAttributes::Normal);
+                File::WriteAllBytes(gcnew String(wzSecondPath), Text::Encoding::UTF8->GetBytes("CacheContentStoreTesX"));
+
+                hr = CacheCompletePayload(FALSE, &payload, L"Bootstrapper.CacheTest.CacheContentStoreTest.Second", wzSourcePath, FALSE, NULL, NULL);
+                TestThrowOnFailure(hr, L"Failed to repair payload for second package.");
+                Assert::Equal(gcnew String(L"CacheContentStoreTest"), File::ReadAllText(gcnew String(wzSecondPath)));
+
+                pin_ptr<const WCHAR> wzStorePath = PtrToStringChars(storePath);
+                hr = FileIsSame(wzStorePath, wzSecondPath, &fSameFile);
+                TestThrowOnFailure(hr, L"Failed to compare cached file with stored content.");
+                Assert::True(fSameFile);
+
+                // The stored content stays while any package still links to it.
+                hr = CacheRemovePackage(FALSE, L"CacheContentStoreTest.First", L"Bootstrapper.CacheTest.CacheContentStoreTest.First");
+                TestThrowOnFailure(hr, L"Failed to remove first package.");
+                Assert::True(File::Exists(storePath));
+
+                hr = CacheRemovePackage(FALSE, L"CacheContentStoreTest.Second", L"Bootstrapper.CacheTest.CacheContentStoreTest.Second");
+                TestThrowOnFailure(hr, L"Failed to remove second package.");
+                Assert::False(File::Exists(storePath));
+            }
+            finally
+            {
+                ReleaseStr(sczHash);
+
+                if (File::Exists(sourcePath))
+                {
+                    File::Delete(sourcePath);
+                }
+
+                if (Directory::Exists(firstCachePath))
+                {
+                    Directory::Delete(firstCachePath, true);
+                }
+
+                if (Directory::Exists(secondCachePath))
+                {
+                    Directory::Delete(secondCachePath, true);
+                }
+
+                if (nullptr != storePath && File::Exists(storePath))
+                {
+                    File::Delete(storePath);
+                }
+            }
+        }
+
+        [NamedFact]
+        void CacheVerifiedJournalTest()
+        {
+            HRESULT hr = S_OK;
+            BURN_PAYLOAD payload = { };
+            BYTE rgbHash[SHA1_HASH_LEN] = { };
+            LPWSTR sczHash = NULL;
+            String^ packageCachePath = Path::Combine(Environment::GetFolderPath(Environment::SpecialFolder::LocalApplicationData), "Package Cache");
+            String^ cachePath = Path::Combine(packageCachePath, "Bootstrapper.CacheTest.CacheVerifiedJournalTest");
+            String^ cachedFilePath = Path::Combine(cachePath, "CacheVerifiedJournalTest.File");
+            String^ sourcePath = Path::GetTempFileName();
+            String^ storePath = nullptr;
+            String^ recordPath = nullptr;
+            DateTime lastWriteTime;
+
+            try
+            {
+                File::WriteAllBytes(sourcePath, Text::Encoding::UTF8->GetBytes("CacheVerifiedJournalTest"));
+
+                pin_ptr<const WCHAR> wzSourcePath = PtrToStringChars(sourcePath);
+                hr = CrypHashFile(wzSourcePath, PROV_RSA_FULL, CALG_SHA1, rgbHash, sizeof(rgbHash), NULL);
+                TestThrowOnFailure(hr, L"Failed to hash source file.");
+
+                hr = StrAllocHexEncode(rgbHash, sizeof(rgbHash), &sczHash);
+                TestThrowOnFailure(hr, L"Failed to encode hash.");
+
+                // The stored content is removed before each cache below, so the cached file is
+                // verified directly instead of being linked from the content store.
+                storePath = Path::Combine(packageCachePath, ".store\\" + gcnew String(sczHash));
+
+                payload.sczKey = L"CacheVerifiedJournalTest.PayloadKey";
+                payload.sczFilePath = L"CacheVerifiedJournalTest.File";
+                payload.pbHash = rgbHash;
+                payload.cbHash = sizeof(rgbHash);
+
+                hr = CacheCompletePayload(FALSE, &payload, L"Bootstrapper.CacheTest.CacheVerifiedJournalTest", wzSourcePath, FALSE, NULL, NULL);
+                TestThrowOnFailure(hr, L"Failed to cache payload.");
+
+                // The verified file is journaled under its file identity.
+                recordPath = GetJournalRecordPath(packageCachePath, cachedFilePath);
+                Assert::True(File::Exists(recordPath));
+
+                // A file whose size changed is hashed again, so the damage is found and the file cached again.
+                File::Delete(storePath);
+                lastWriteTime = File::GetLastWriteTimeUtc(cachedFilePath);
+                File::SetAttributes(cachedFilePath, FileAttributes::Normal);
+                File::WriteAllBytes(cachedFilePath, Text::Encoding::UTF8->GetBytes("CacheVerifiedJournalTest2"));
+                File::SetLastWriteTimeUtc(cachedFilePath, lastWriteTime);
+
+                hr = CacheCompletePayload(FALSE, &payload, L"Bootstrapper.CacheTest.CacheVerifiedJournalTest", wzSourcePath, FALSE, NULL, NULL);
+                TestThrowOnFailure(hr, L"Failed to cache payload after its size changed.");
+                Assert::Equal(gcnew String(L"CacheVerifiedJournalTest"), File::ReadAllText(cachedFilePath));
+
+                // A file with the same size and last write time is accepted from its record without being hashed,
+                // which the changed content shows.
+                recordPath = GetJournalRecordPath(packageCachePath, cachedFilePath);
+                Assert::True(File::Exists(recordPath));
+
+                File::Delete(storePath);
+                lastWriteTime = File::GetLastWriteTimeUtc(cachedFilePath);
+                File::SetAttributes(cachedFilePath, FileAttributes::Normal);
+                File::WriteAllBytes(cachedFilePath, Text::Encoding::UTF8->GetBytes("CacheVerifiedJournalTesX"));
+                File::SetLastWriteTimeUtc(cachedFilePath, lastWriteTime);
+
+                hr = CacheCompletePayload(FALSE, &payload, L"Bootstrapper.CacheTest.CacheVerifiedJournalTest", wzSourcePath, FALSE, NULL, NULL);
+                TestThrowOnFailure(hr, L"Failed to cache unchanged payload.");
+                Assert::Equal(gcnew String(L"CacheVerifiedJournalTesX"), File::ReadAllText(cachedFilePath));
+                Assert::True(File::Exists(recordPath));
+
+                // A file whose last write time changed is hashed again.
+                File::Delete(storePath);
+                File::SetLastWriteTimeUtc(cachedFilePath, lastWriteTime.AddSeconds(1));
+
+                hr = CacheCompletePayload(FALSE, &payload, L"Bootstrapper.CacheTest.CacheVerifiedJournalTest", wzSourcePath, FALSE, NULL, NULL);
+                TestThrowOnFailure(hr, L"Failed to cache payload after its last write time changed.");
+                Assert::Equal(gcnew String(L"CacheVerifiedJournalTest"), File::ReadAllText(cachedFilePath));
+
+                // Removing the last package that uses the file forgets it.
+                recordPath = GetJournalRecordPath(packageCachePath, cachedFilePath);
+                Assert::True(File::Exists(recordPath));
+
+                hr = CacheRemovePackage(FALSE, L"CacheVerifiedJournalTest", L"Bootstrapper.CacheTest.CacheVerifiedJournalTest");
+                TestThrowOnFailure(hr, L"Failed to remove package.");
+                Assert::False(File::Exists(recordPath));
+            }
+            finally
+            {
+                ReleaseStr(sczHash);
+
+                if (File::Exists(sourcePath))
+                {
+                    File::Delete(sourcePath);
+                }
+
+                if (Directory::Exists(cachePath))
+                {
+                    Directory::Delete(cachePath, true);
+                }
+
+                if (nullptr != storePath && File::Exists(storePath))
+                {
+                    File::Delete(storePath);
+                }
+
+                if (nullptr != recordPath && File::Exists(recordPath))
+                {
+                    File::Delete(recordPath);
+                }
+            }
+        }
+
+        [NamedFact]
+        void CacheDetectPayloadsCachedTest()
+        {
+            HRESULT hr = S_OK;
+            const DWORD cPayloads = 10000;
+            BURN_PACKAGE package = { };
+            BURN_PAYLOAD* rgPayloads = NULL;
+            String^ cachePath = Path::Combine(Environment::GetFolderPath(Environment::SpecialFolder::LocalApplicationData), "Package Cache\\Bootstrapper.CacheTest.CacheDetectPayloadsCachedTest");
+
+            try
+            {
+                rgPayloads = static_cast<BURN_PAYLOAD*>(MemAlloc(sizeof(BURN_PAYLOAD) * cPayloads, TRUE));
+                Assert::True(NULL != rgPayloads);
+
+                package.rgPayloads = static_cast<BURN_PACKAGE_PAYLOAD*>(MemAlloc(sizeof(BURN_PACKAGE_PAYLOAD) * cPayloads, TRUE));
+                Assert::True(NULL != package.rgPayloads);
+
+                package.sczId = L"CacheDetectPayloadsCachedTest";
+                package.sczCacheId = L"Bootstrapper.CacheTest.CacheDetectPayloadsCachedTest";
+                package.fPerMachine = FALSE;
+                package.cPayloads = cPayloads;
+
+                // Lay out the cache: every hundredth payload lives in a subdirectory.
+                Directory::CreateDirectory(Path::Combine(cachePath, "sub"));
+                for (DWORD i = 0; i < cPayloads; ++i)
+                {
+                    hr = StrAllocFormatted(&rgPayloads[i].sczKey, L"Payload%u", i);
+                    TestThrowOnFailure(hr, L"Failed to allocate payload key.");
+
+                    hr = StrAllocFormatted(&rgPayloads[i].sczFilePath, L"%lspayload%u.dat", i % 100 ? L"" : L"SUB\\", i);
+                    TestThrowOnFailure(hr, L"Failed to allocate payload path.");
+
+                    rgPayloads[i].qwFileSize = i % 7;
+                    package.rgPayloads[i].pPayload = rgPayloads + i;
+
+                    // Leave the second payload out of the cache.
+                    if (1 != i)
+                    {
+                        File::WriteAllBytes(Path::Combine(cachePath, gcnew String(rgPayloads[i].sczFilePath)), gcnew array<Byte>(i % 7));
+                    }
+                }
+
+                // The first payload is cached with the wrong size.
+                ++rgPayloads[0].qwFileSize;
+
+                System::Diagnostics::Stopwatch^ stopwatch = System::Diagnostics::Stopwatch::StartNew();
+                hr = DetectPackagePayloadsCached(&package);
+                stopwatch->Stop();
+                TestThrowOnFailure(hr, L"Failed to detect cached payloads.");
+
+                Console::WriteLine("Detected {0} cached payloads in {1} ms.", cPayloads, stopwatch->ElapsedMilliseconds);
+
+                Assert::Equal((int)BURN_CACHE_STATE_PARTIAL, (int)package.cache);
+                Assert::False(package.rgPayloads[0].fCached);
+                Assert::False(package.rgPayloads[1].fCached);
+                for (DWORD i = 2; i < cPayloads; ++i)
+                {
+                    Assert::True(package.rgPayloads[i].fCached);
+                }
+
+                // Fix the layout and detect again.
+                --rgPayloads[0].qwFileSize;
+                File::WriteAllBytes(Path::Combine(cachePath, gcnew String(rgPayloads[1].sczFilePath)), gcnew array<Byte>(1));
+
+                hr = DetectPackagePayloadsCached(&package);
+                TestThrowOnFailure(hr, L"Failed to detect cached payloads again.");
+
+                Assert::Equal((int)BURN_CACHE_STATE_COMPLETE, (int)package.cache);
+                Assert::True(package.rgPayloads[0].fCached);
+                Assert::True(package.rgPayloads[1].fCached);
+
+                // Without the cache directory nothing is cached.
+                Directory::Delete(cachePath, true);
+
+                hr = DetectPackagePayloadsCached(&package);
+                TestThrowOnFailure(hr, L"Failed to detect missing cache directory.");
+
+                Assert::Equal((int)BURN_CACHE_STATE_NONE, (int)package.cache);
+            }
+            finally
+            {
+                if (rgPayloads)
+                {
+                    for (DWORD i = 0; i < cPayloads; ++i)
+                    {
+                        ReleaseStr(rgPayloads[i].sczKey);
+                        ReleaseStr(rgPayloads[i].sczFilePath);
+                    }
+                    MemFree(rgPayloads);
+                }
+                ReleaseMem(package.rgPayloads);
+
+                if (Directory::Exists(cachePath))
+                {
+                    Directory::Delete(cachePath, true);
+                }
+            }
+        }
+
+    private:
+        String^ GetJournalRecordPath(String^ packageCachePath, String^ filePath)
+        {
+            HANDLE hFile = INVALID_HANDLE_VALUE;
+            BY_HANDLE_FILE_INFORMATION fileInfo = { };
+            pin_ptr<const WCHAR> wzFilePath = PtrToStringChars(filePath);
+
+            hFile = ::CreateFileW(wzFilePath, FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, 0, NULL);
+            Assert::True(INVALID_HANDLE_VALUE != hFile);
+
+            BOOL fInfo = ::GetFileInformationByHandle(hFile, &fileInfo);
+            ReleaseFileHandle(hFile);
+            Assert::True(FALSE != fInfo);
+
+            return Path::Combine(packageCachePath, String::Format(".journal\\{0:x8}{1:x8}{2:x8}", fileInfo.dwVolumeSerialNumber, fileInfo.nFileIndexHigh, fileInfo.nFileIndexLow));
+        }
     };
 }
 }
@@ -0,0 +1,378 @@
+// Copyright (c) .NET Foundation and contributors. All rights reserved. Licensed under the Microsoft Reciprocal License. See LICENSE.TXT file in the project root for full license information.
+
+#include "precomp.h"
+
+
+namespace Microsoft
+{
+namespace Tools
+{
+namespace WindowsInstallerXml
+{
+namespace Test
+{
+namespace Bootstrapper
+{
+    using namespace System;
+    using namespace System::Diagnostics;
+    using namespace System::IO;
+    using namespace WixTest;
+    using namespace Xunit;
+
+    // Every tenth stream is left in the container to exercise skipping.
+    static BOOL IsWantedStream(DWORD iStream)
+    {
+        return 0 != iStream % 10;
+    }
+
+    public ref class ContainerTest : BurnUnitTest
+    {
+    public:
+        [NamedFact]
+        void ContainerExtractStreamsTest()
+        {
+            const DWORD cFiles = 10000;
+            HRESULT hr = S_OK;
+            HANDLE hCab = NULL;
+            BURN_CONTAINER_CONTEXT context = { };
+            BURN_CONTAINER_EXTRACT_STREAM* rgStreams = NULL;
+            LPWSTR* rgsczNames = NULL;
+            LPWSTR* rgsczTargets = NULL;
+            BYTE* pbHashes = NULL;
+            BYTE rgbSourceHash[SHA1_HASH_LEN] = { };
+            DWORD cStreams = 0;
+            String^ testPath = Path::Combine(Path::GetTempPath(), "Bootstrapper.ContainerTest.ContainerExtractStreamsTest");
+            String^ sourcePath = Path::Combine(testPath, "source");
+            String^ streamPath = Path::Combine(testPath, "stream");
+            String^ bulkPath = Path::Combine(testPath, "bulk");
+            String^ cabPath = Path::Combine(testPath, "container.cab");
+            Stopwatch^ stopwatch = nullptr;
+
+            try
+            {
+                if (Directory::Exists(testPath))
+                {
+                    Directory::Delete(testPath, true);
+                }
+
+                Directory::CreateDirectory(sourcePath);
+                Directory::CreateDirectory(streamPath);
+                Directory::CreateDirectory(bulkPath);
+
+                // Build a container of many small files, like a bundle carrying a large payload group.
+                pin_ptr<const WCHAR> wzTestPath = PtrToStringChars(testPath);
+                hr = CabCBegin(L"container.cab", wzTestPath, cFiles, 0, 0, COMPRESSION_TYPE_MSZIP, &hCab);
+                TestThrowOnFailure(hr, L"Failed to begin container.");
+
+                for (DWORD i = 0; i < cFiles; ++i)
+                {
+                    String^ name = String::Format("file{0}.txt", i);
+                    String^ filePath = Path::Combine(sourcePath, name);
+                    File::WriteAllText(filePath, String::Format("ContainerExtractStreamsTest content of stream {0}", i));
+
+                    pin_ptr<const WCHAR> wzFilePath = PtrToStringChars(filePath);
+                    pin_ptr<const WCHAR> wzName = PtrToStringChars(name);
+                    hr = CabCAddFile(wzFilePath, wzName, NULL, hCab);
+                    TestThrowOnFailure(hr, L"Failed to add file to container.");
+                }
+
+                hr = CabCFinish(hCab, NULL);
+                hCab = NULL;
+                TestThrowOnFailure(hr, L"Failed to finish container.");
+
+                // Baseline: ask for each stream in turn.
+                stopwatch = Stopwatch::StartNew();
+                ExtractStreamByStream(&context, BURN_CONTAINER_TYPE_CABINET, cabPath, streamPath);
+                stopwatch->Stop();
+                Console::WriteLine("Extracted from {0} streams one at a time: {1} ms", cFiles, stopwatch->ElapsedMilliseconds);
+
+                // Hand over all wanted streams up front.
+                rgStreams = static_cast<BURN_CONTAINER_EXTRACT_STREAM*>(MemAlloc(sizeof(BURN_CONTAINER_EXTRACT_STREAM) * cFiles, TRUE));
+                rgsczNames = static_cast<LPWSTR*>(MemAlloc(sizeof(LPWSTR) * cFiles, TRUE));
+                rgsczTargets = static_cast<LPWSTR*>(MemAlloc(sizeof(LPWSTR) * cFiles, TRUE));
+                pbHashes = static_cast<BYTE*>(MemAlloc(SHA1_HASH_LEN * cFiles, TRUE));
+                Assert::True(rgStreams && rgsczNames && rgsczTargets && pbHashes);
+
+                pin_ptr<const WCHAR> wzBulkPath = PtrToStringChars(bulkPath);
+                for (DWORD i = 0; i < cFiles; ++i)
+                {
+                    if (IsWantedStream(i))
+                    {
+                        hr = StrAllocFormatted(rgsczNames + cStreams, L"file%u.txt", i);
+                        TestThrowOnFailure(hr, L"Failed to format stream name.");
+
+                        hr = StrAllocFormatted(rgsczTargets + cStreams, L"%ls\\file%u.txt", static_cast<LPCWSTR>(wzBulkPath), i);
+                        TestThrowOnFailure(hr, L"Failed to format target path.");
+
+                        rgStreams[cStreams].wzStreamName = rgsczNames[cStreams];
+                        rgStreams[cStreams].wzTargetFile = rgsczTargets[cStreams];
+                        rgStreams[cStreams].pbHash = pbHashes + SHA1_HASH_LEN * cStreams;
+                        rgStreams[cStreams].cbHash = SHA1_HASH_LEN;
+                        ++cStreams;
+                    }
+                }
+
+                stopwatch = Stopwatch::StartNew();
+                OpenContainer(&context, BURN_CONTAINER_TYPE_CABINET, cabPath);
+
+                hr = ContainerExtractStreams(&context, rgStreams, cStreams);
+                TestThrowOnFailure(hr, L"Failed to extract streams.");
+
+                hr = ContainerClose(&context);
+                TestThrowOnFailure(hr, L"Failed to close container.");
+                stopwatch->Stop();
+                Console::WriteLine("Extracted {0} of {1} streams in a single pass: {2} ms", cStreams, cFiles, stopwatch->ElapsedMilliseconds);
+
+                // Both ways extract the same content, and the single pass hashes it on the way.
+                for (DWORD i = 0, iStream = 0; i < cFiles; ++i)
+                {
+                    String^ name = String::Format("file{0}.txt", i);
+                    String^ bulkFilePath = Path::Combine(bulkPath, name);
+
+                    if (IsWantedStream(i))
+                    {
+                        String^ expected = File::ReadAllText(Path::Combine(sourcePath, name));
+                        Assert::Equal(expected, File::ReadAllText(Path::Combine(streamPath, name)));
+                        Assert::Equal(expected, File::ReadAllText(bulkFilePath));
+                        Assert::True(rgStreams[iStream].fExtracted);
+                        Assert::True(rgStreams[iStream].fHashed);
+
+                        pin_ptr<const WCHAR> wzSourceFilePath = PtrToStringChars(Path::Combine(sourcePath, name));
+                        hr = CrypHashFile(wzSourceFilePath, PROV_RSA_FULL, CALG_SHA1, rgbSourceHash, sizeof(rgbSourceHash), NULL);
+                        TestThrowOnFailure(hr, L"Failed to hash source file.");
+                        Assert::Equal(0, memcmp(rgbSourceHash, rgStreams[iStream].pbHash, SHA1_HASH_LEN));
+
+                        ++iStream;
+                    }
+                    else
+                    {
+                        Assert::False(File::Exists(bulkFilePath));
+                    }
+                }
+            }
+            finally
+            {
+                if (hCab)
+                {
+                    CabCCancel(hCab);
+                }
+
+                if (BURN_CONTAINER_TYPE_NONE != context.type)
+                {
+                    ContainerClose(&context);
+                }
+
+                for (DWORD i = 0; i < cStreams; ++i)
+                {
+                    ReleaseStr(rgsczNames[i]);
+                    ReleaseStr(rgsczTargets[i]);
+                }
+                ReleaseMem(rgsczNames);
+                ReleaseMem(rgsczTargets);
+                ReleaseMem(rgStreams);
+                ReleaseMem(pbHashes);
+
+                if (Directory::Exists(testPath))
+                {
+                    Directory::Delete(testPath, true);
+                }
+            }
+        }
+
+        [NamedFact]
+        void ContainerChunkedExtractStreamsTest()
+        {
+            const DWORD cFiles = 1000;
+            HRESULT hr = S_OK;
+            HANDLE hWriter = NULL;
+            BURN_CONTAINER_CONTEXT context = { };
+            BURN_CONTAINER_EXTRACT_STREAM* rgStreams = NULL;
+            LPWSTR* rgsczNames = NULL;
+            LPWSTR* rgsczTargets = NULL;
+            DWORD cStreams = 0;
+            String^ testPath = Path::Combine(Path::GetTempPath(), "Bootstrapper.ContainerTest.ContainerChunkedExtractStreamsTest");
+            String^ sourcePath = Path::Combine(testPath, "source");
+            String^ streamPath = Path::Combine(testPath, "stream");
+            String^ bulkPath = Path::Combine(testPath, "bulk");
+            String^ containerPath = Path::Combine(testPath, "container.chunks");
+
+            try
+            {
+                if (Directory::Exists(testPath))
+                {
+                    Directory::Delete(testPath, true);
+                }
+
+                Directory::CreateDirectory(sourcePath);
+                Directory::CreateDirectory(streamPath);
+                Directory::CreateDirectory(bulkPath);
+
+                // Small chunks so the streams spread over many of them.
+                pin_ptr<const WCHAR> wzContainerPath = PtrToStringChars(containerPath);
+                hr = ChunkWriteBegin(wzContainerPath, 4096, &hWriter);
+                TestThrowOnFailure(hr, L"Failed to begin container.");
+
+                for (DWORD i = 0; i < cFiles; ++i)
+                {
+                    String^ name = String::Format("file{0}.txt", i);
+                    String^ filePath = Path::Combine(sourcePath, name);
+                    File::WriteAllText(filePath, String::Format("ContainerChunkedExtractStreamsTest content of stream {0}", i));
+
+                    pin_ptr<const WCHAR> wzFilePath = PtrToStringChars(filePath);
+                    pin_ptr<const WCHAR> wzName = PtrToStringChars(name);
+                    hr = ChunkWriteAddFile(hWriter, wzFilePath, wzName);
+                    TestThrowOnFailure(hr, L"Failed to add file to container.");
+                }
+
+                hr = ChunkWriteFinish(hWriter);
+                hWriter = NULL;
+                TestThrowOnFailure(hr, L"Failed to finish container.");
+
+                ExtractStreamByStream(&context, BURN_CONTAINER_TYPE_CHUNKED, containerPath, streamPath);
+
+                rgStreams = static_cast<BURN_CONTAINER_EXTRACT_STREAM*>(MemAlloc(sizeof(BURN_CONTAINER_EXTRACT_STREAM) * cFiles, TRUE));
+                rgsczNames = static_cast<LPWSTR*>(MemAlloc(sizeof(LPWSTR) * cFiles, TRUE));
+                rgsczTargets = static_cast<LPWSTR*>(MemAlloc(sizeof(LPWSTR) * cFiles, TRUE));
+                Assert::True(rgStreams && rgsczNames && rgsczTargets);
+
+                pin_ptr<const WCHAR> wzBulkPath = PtrToStringChars(bulkPath);
+                for (DWORD i = 0; i < cFiles; ++i)
+                {
+                    if (IsWantedStream(i))
+                    {
+                        hr = StrAllocFormatted(rgsczNames + cStreams, L"file%u.txt", i);
+                        TestThrowOnFailure(hr, L"Failed to format stream name.");
+
+                        hr = StrAllocFormatted(rgsczTargets + cStreams, L"%ls\\file%u.txt", static_cast<LPCWSTR>(wzBulkPath), i);
+                        TestThrowOnFailure(hr, L"Failed to format target path.");
+
+                        rgStreams[cStreams].wzStreamName = rgsczNames[cStreams];
+                        rgStreams[cStreams].wzTargetFile = rgsczTargets[cStreams];
+                        ++cStreams;
+                    }
+                }
+
+                OpenContainer(&context, BURN_CONTAINER_TYPE_CHUNKED, containerPath);
+
+                hr = ContainerExtractStreams(&context, rgStreams, cStreams);
+                TestThrowOnFailure(hr, L"Failed to extract streams.");
+
+                hr = ContainerClose(&context);
+                TestThrowOnFailure(hr, L"Failed to close container.");
+
+                // The chunks are decompressed in parallel and not hashed on the way.
+                for (DWORD i = 0, iStream = 0; i < cFiles; ++i)
+                {
+                    String^ name = String::Format("file{0}.txt", i);
+                    String^ bulkFilePath = Path::Combine(bulkPath, name);
+
+                    if (IsWantedStream(i))
+                    {
+                        String^ expected = File::ReadAllText(Path::Combine(sourcePath, name));
+                        Assert::Equal(expected, File::ReadAllText(Path::Combine(streamPath, name)));
+                        Assert::Equal(expected, File::ReadAllText(bulkFilePath));
+                        Assert::True(rgStreams[iStream].fExtracted);
+                        Assert::False(rgStreams[iStream].fHashed);
+
+                        ++iStream;
+                    }
+                    else
+                    {
+                        Assert::False(File::Exists(bulkFilePath));
+                    }
+                }
+            }
+            finally
+            {
+                if (hWriter)
+                {
+                    ChunkWriteCancel(hWriter);
+                }
+
+                if (BURN_CONTAINER_TYPE_NONE != context.type)
+                {
+                    ContainerClose(&context);
+                }
+
+                for (DWORD i = 0; i < cStreams; ++i)
+                {
+                    ReleaseStr(rgsczNames[i]);
+                    ReleaseStr(rgsczTargets[i]);
+                }
+                ReleaseMem(rgsczNames);
+                ReleaseMem(rgsczTargets);
+                ReleaseMem(rgStreams);
+
+                if (Directory::Exists(testPath))
+                {
+                    Directory::Delete(testPath, true);
+                }
+            }
+        }
+
+    private:
+        void OpenContainer(BURN_CONTAINER_CONTEXT* pContext, BURN_CONTAINER_TYPE type, String^ containerPath)
+        {
+            HRESULT hr = S_OK;
+            BURN_CONTAINER container = { };
+
+            container.type = type;
+            container.qwFileSize = (gcnew FileInfo(containerPath))->Length;
+
+            pin_ptr<const WCHAR> wzContainerPath = PtrToStringChars(containerPath);
+            hr = ContainerOpen(pContext, &container, INVALID_HANDLE_VALUE, wzContainerPath);
+            TestThrowOnFailure(hr, L"Failed to open container.");
+        }
+
+        void ExtractStreamByStream(BURN_CONTAINER_CONTEXT* pContext, BURN_CONTAINER_TYPE type, String^ containerPath, String^ targetPath)
+        {
+            HRESULT hr = S_OK;
+            LPWSTR sczStreamName = NULL;
+            LPWSTR sczTarget = NULL;
+            DWORD iStream = 0;
+
+            try
+            {
+                OpenContainer(pContext, type, containerPath);
+
+                pin_ptr<const WCHAR> wzTargetPath = PtrToStringChars(targetPath);
+                while (S_OK == (hr = ContainerNextStream(pContext, &sczStreamName)))
+                {
+                    if (IsWantedStream(iStream))
+                    {
+                        hr = StrAllocFormatted(&sczTarget, L"%ls\\%ls", static_cast<LPCWSTR>(wzTargetPath), sczStreamName);
+                        TestThrowOnFailure(hr, L"Failed to format target path.");
+
+                        hr = ContainerStreamToFile(pContext, sczTarget, NULL, 0);
+                        TestThrowOnFailure1(hr, L"Failed to extract stream: %ls", sczStreamName);
+                    }
+                    else
+                    {
+                        hr = ContainerSkipStream(pContext);
+                        TestThrowOnFailure1(hr, L"Failed to skip stream: %ls", sczStreamName);
+                    }
+
+                    ++iStream;
+                }
+
+                if (E_NOMOREITEMS == hr)
+                {
+                    hr = S_OK;
+                }
+                TestThrowOnFailure(hr, L"Failed to extract all streams.");
+
+                hr = ContainerClose(pContext);
+                TestThrowOnFailure(hr, L"Failed to close container.");
+            }
+            finally
+            {
+                ReleaseStr(sczStreamName);
+                ReleaseStr(sczTarget);
+            }
+        }
+    };
+}
+}
+}
+}
+}
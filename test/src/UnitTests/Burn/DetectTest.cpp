@@ -0,0 +1,198 @@
+// Copyright (c) .NET Foundation and contributors. All rights reserved. Licensed under the Microsoft Reciprocal License. See LICENSE.TXT file in the project root for full license information.
+
+#include "precomp.h"
+
+
+// Records the detect callbacks in the order the engine makes them.
+class CDetectTestBootstrapperApplication : public CBalBaseBootstrapperApplication
+{
+public: // IBootstrapperApplication
+    virtual STDMETHODIMP_(int) OnDetectPackageBegin(
+        __in_z LPCWSTR wzPackageId
+        )
+    {
+        Record(L"Begin", wzPackageId, NULL);
+        return IDNOACTION;
+    }
+
+    virtual STDMETHODIMP_(int) OnDetectMsiFeature(
+        __in_z LPCWSTR wzPackageId,
+        __in_z LPCWSTR wzFeatureId,
+        __in BOOTSTRAPPER_FEATURE_STATE /*state*/
+        )
+    {
+        Record(L"Feature", wzPackageId, wzFeatureId);
+        return IDNOACTION;
+    }
+
+    virtual STDMETHODIMP_(void) OnDetectPackageComplete(
+        __in_z LPCWSTR wzPackageId,
+        __in HRESULT /*hrStatus*/,
+        __in BOOTSTRAPPER_PACKAGE_STATE /*state*/
+        )
+    {
+        Record(L"Complete", wzPackageId, NULL);
+    }
+
+public:
+    LPCWSTR Callbacks()
+    {
+        return m_sczCallbacks;
+    }
+
+    BOOL CalledFromOtherThread()
+    {
+        return m_fOtherThread;
+    }
+
+private:
+    void Record(
+        __in_z LPCWSTR wzCallback,
+        __in_z LPCWSTR wzPackageId,
+        __in_z_opt LPCWSTR wzFeatureId
+        )
+    {
+        if (::GetCurrentThreadId() != m_dwThreadId)
+        {
+            m_fOtherThread = TRUE;
+        }
+
+        if (wzFeatureId)
+        {
+            StrAllocConcatFormatted(&m_sczCallbacks, L"%ls:%ls:%ls;", wzCallback, wzPackageId, wzFeatureId);
+        }
+        else
+        {
+            StrAllocConcatFormatted(&m_sczCallbacks, L"%ls:%ls;", wzCallback, wzPackageId);
+        }
+    }
+
+public:
+    CDetectTestBootstrapperApplication(
+        __in IBootstrapperEngine* pEngine,
+        __in const BOOTSTRAPPER_COMMAND* pCommand
+        ) : CBalBaseBootstrapperApplication(pEngine, pCommand)
+    {
+        m_dwThreadId = ::GetCurrentThreadId();
+        m_fOtherThread = FALSE;
+        m_sczCallbacks = NULL;
+    }
+
+    virtual ~CDetectTestBootstrapperApplication()
+    {
+        ReleaseStr(m_sczCallbacks);
+    }
+
+private:
+    DWORD m_dwThreadId;
+    BOOL m_fOtherThread;
+    LPWSTR m_sczCallbacks;
+};
+
+
+namespace Microsoft
+{
+namespace Tools
+{
+namespace WindowsInstallerXml
+{
+namespace Test
+{
+namespace Bootstrapper
+{
+    using namespace System;
+    using namespace System::Text;
+    using namespace WixTest;
+    using namespace Xunit;
+
+    public ref class DetectTest : BurnUnitTest
+    {
+    public:
+        [NamedFact]
+        void DetectParallelCallbackOrderTest()
+        {
+            HRESULT hr = S_OK;
+            BURN_ENGINE_STATE engineState = { };
+            IBootstrapperEngine* pEngineForApplication = NULL;
+            CDetectTestBootstrapperApplication* pBA = NULL;
+            StringBuilder^ chain = gcnew StringBuilder();
+            StringBuilder^ expected = gcnew StringBuilder();
+
+            ::InitializeCriticalSection(&engineState.userExperience.csEngineActive);
+            try
+            {
+                // More packages than there are detect threads, so the threads race each other and the engine thread.
+                for (DWORD i = 0; i < 20; ++i)
+                {
+                    String^ productCode = String::Concat("{A6A4F6D1-5E6A-4C1B-9E5B-7B6F0C8E", String::Format("{0:X4}", i), "}");
+
+                    chain->AppendFormat("<MsiPackage Id='Package{0}' Cache='yes' CacheId='{1}v1.0.0.0' Size='1' InstallSize='1' PerMachine='no' Permanent='no' Vital='yes' ProductCode='{1}' Language='1033' Version='1.0.0.0' DisplayInternalUI='no'>", i, productCode);
+                    expected->AppendFormat("Begin:Package{0};", i);
+
+                    // A different number of features per package shows they are not interleaved across packages.
+                    for (DWORD j = 0; j < 1 + i % 3; ++j)
+                    {
+                        chain->AppendFormat("<MsiFeature Id='Feature{0}' />", j);
+                        expected->AppendFormat("Feature:Package{0}:Feature{1};", i, j);
+                    }
+
+                    chain->Append("</MsiPackage>");
+                    expected->AppendFormat("Complete:Package{0};", i);
+
+                    // EXE packages are still detected on the engine thread between the deferred ones.
+                    if (1 == i % 4)
+                    {
+                        chain->AppendFormat("<ExePackage Id='Exe{0}' Cache='yes' CacheId='Exe{0}' Size='1' InstallSize='1' PerMachine='no' Permanent='no' Vital='yes' DetectCondition='' InstallArguments='' UninstallArguments='' RepairArguments='' Repairable='no' />", i);
+                        expected->AppendFormat("Begin:Exe{0};Complete:Exe{0};", i);
+                    }
+                }
+
+                String^ document = String::Concat(
+                    "<Bundle>"
+                    "    <UX UxDllPayloadId='ux.dll'>"
+                    "        <Payload Id='ux.dll' FilePath='ux.dll' Packaging='embedded' SourcePath='ux.dll' Hash='000000000000' />"
+                    "    </UX>"
+                    "    <Registration Id='{C0D6A2B5-3D9A-4C67-8E7E-0F3E6B1B9D41}' UpgradeCode='{C0D6A2B5-3D9A-4C67-8E7E-0F3E6B1B9D42}' Tag='foo' ProviderKey='{C0D6A2B5-3D9A-4C67-8E7E-0F3E6B1B9D41}' Version='1.0.0.0' ExecutableName='setup.exe' PerMachine='no' />"
+                    "    <Chain ParallelDetect='yes'>",
+                    chain->ToString(),
+                    "    </Chain>"
+                    "</Bundle>");
+                array<Byte>^ rgbDocument = Encoding::UTF8->GetBytes(document);
+                pin_ptr<Byte> pbDocument = &rgbDocument[0];
+
+                hr = VariableInitialize(&engineState.variables);
+                TestThrowOnFailure(hr, L"Failed to initialize variables.");
+
+                hr = ManifestLoadXmlFromBuffer(pbDocument, rgbDocument->Length, &engineState);
+                TestThrowOnFailure(hr, L"Failed to parse chain from XML.");
+
+                engineState.log.state = BURN_LOGGING_STATE_DISABLED;
+
+                hr = EngineForApplicationCreate(&engineState, ::GetCurrentThreadId(), &pEngineForApplication);
+                TestThrowOnFailure(hr, L"Failed to create engine for application.");
+
+                pBA = new CDetectTestBootstrapperApplication(pEngineForApplication, &engineState.command);
+                engineState.userExperience.pUserExperience = pBA;
+
+                hr = CoreDetect(&engineState, NULL);
+                TestThrowOnFailure(hr, L"Failed to detect.");
+
+                // The callbacks come from the engine thread in chain order, each package's
+                // features between its begin and complete.
+                Assert::False(pBA->CalledFromOtherThread());
+                Assert::Equal(expected->ToString(), gcnew String(pBA->Callbacks()));
+            }
+            finally
+            {
+                engineState.userExperience.pUserExperience = NULL;
+                ReleaseObject(pBA);
+                ReleaseObject(pEngineForApplication);
+                ::DeleteCriticalSection(&engineState.userExperience.csEngineActive);
+            }
+        }
+    };
+}
+}
+}
+}
+}
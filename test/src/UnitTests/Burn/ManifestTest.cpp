@@ -51,6 +51,39 @@ namespace Bootstrapper
                 //CoreUninitialize(&engineState);
             }
         }
+
+        [NamedFact]
+        void ManifestLoadChainFlagsTest()
+        {
+            HRESULT hr = S_OK;
+            BURN_ENGINE_STATE engineState = { };
+            try
+            {
+                LPCSTR szDocument =
+                    "<Bundle>"
+                    "    <UX UxDllPayloadId='ux.dll'>"
+                    "        <Payload Id='ux.dll' FilePath='ux.dll' Packaging='embedded' SourcePath='ux.dll' Hash='000000000000' />"
+                    "    </UX>"
+                    "    <Registration Id='{D54F896D-1952-43e6-9C67-B5652240618C}' Tag='foo' ProviderKey='foo' Version='1.0.0.0' ExecutableName='setup.exe' PerMachine='no' />"
+                    "    <Chain ParallelCache='yes' ParallelDetect='yes' />"
+                    "</Bundle>";
+
+                hr = VariableInitialize(&engineState.variables);
+                TestThrowOnFailure(hr, L"Failed to initialize variables.");
+
+                // load manifest from XML
+                hr = ManifestLoadXmlFromBuffer((BYTE*)szDocument, lstrlenA(szDocument), &engineState);
+                TestThrowOnFailure(hr, L"Failed to parse chain from XML.");
+
+                Assert::False(engineState.fDisableRollback);
+                Assert::True(engineState.fParallelCacheAndExecute);
+                Assert::True(engineState.fParallelDetect);
+            }
+            finally
+            {
+                //CoreUninitialize(&engineState);
+            }
+        }
     };
 }
 }
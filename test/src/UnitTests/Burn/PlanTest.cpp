@@ -0,0 +1,224 @@
+// Copyright (c) .NET Foundation and contributors. All rights reserved. Licensed under the Microsoft Reciprocal License. See LICENSE.TXT file in the project root for full license information.
+
+#include "precomp.h"
+
+
+namespace Microsoft
+{
+namespace Tools
+{
+namespace WindowsInstallerXml
+{
+namespace Test
+{
+namespace Bootstrapper
+{
+    using namespace System;
+    using namespace WixTest;
+    using namespace Xunit;
+
+    public ref class PlanTest : BurnUnitTest
+    {
+    public:
+        [NamedFact]
+        void PlanSplicesUnchangedPackagesTest()
+        {
+            HRESULT hr = S_OK;
+            BURN_ENGINE_STATE incrementalState = { };
+            BURN_ENGINE_STATE fullState = { };
+            BOOTSTRAPPER_REQUEST_STATE rgAllPresent[] = { BOOTSTRAPPER_REQUEST_STATE_PRESENT, BOOTSTRAPPER_REQUEST_STATE_PRESENT, BOOTSTRAPPER_REQUEST_STATE_PRESENT };
+            BOOTSTRAPPER_REQUEST_STATE rgMiddleNone[] = { BOOTSTRAPPER_REQUEST_STATE_PRESENT, BOOTSTRAPPER_REQUEST_STATE_NONE, BOOTSTRAPPER_REQUEST_STATE_PRESENT };
+            try
+            {
+                LPCSTR szDocument =
+                    "<Bundle>"
+                    "    <UX UxDllPayloadId='ux.dll'>"
+                    "        <Payload Id='ux.dll' FilePath='ux.dll' Packaging='embedded' SourcePath='ux.dll' Hash='000000000000' />"
+                    "    </UX>"
+                    "    <Registration Id='{D54F896D-1952-43e6-9C67-B5652240618C}' Tag='foo' ProviderKey='foo' Version='1.0.0.0' ExecutableName='setup.exe' PerMachine='no' />"
+                    "    <Chain>"
+                    "        <ExePackage Id='PackageA' Cache='yes' CacheId='PackageA' Size='1' InstallSize='1' PerMachine='no' Permanent='no' Vital='yes' DetectCondition='' InstallArguments='' UninstallArguments='' RepairArguments='' Repairable='no' />"
+                    "        <ExePackage Id='PackageB' Cache='yes' CacheId='PackageB' Size='1' InstallSize='1' PerMachine='no' Permanent='no' Vital='yes' DetectCondition='' InstallArguments='' UninstallArguments='' RepairArguments='' Repairable='no' />"
+                    "        <ExePackage Id='PackageC' Cache='yes' CacheId='PackageC' Size='1' InstallSize='1' PerMachine='no' Permanent='no' Vital='yes' DetectCondition='' InstallArguments='' UninstallArguments='' RepairArguments='' Repairable='no' InstallCondition='Toggle' />"
+                    "    </Chain>"
+                    "</Bundle>";
+
+                InitializeEngineState(&incrementalState, szDocument);
+                InitializeEngineState(&fullState, szDocument);
+
+                // The first plan has nothing to reuse.
+                PlanPackagesHelper(&incrementalState, rgAllPresent, FALSE);
+                Assert::Equal(0, (int)incrementalState.plan.cSplicedPackages);
+
+                // Only the packages whose inputs did not change are spliced back in.
+                PlanPackagesHelper(&incrementalState, rgMiddleNone, FALSE);
+                PlanPackagesHelper(&fullState, rgMiddleNone, TRUE);
+                Assert::Equal(2, (int)incrementalState.plan.cSplicedPackages);
+                Assert::Equal(0, (int)fullState.plan.cSplicedPackages);
+                ComparePlans(&fullState.plan, &incrementalState.plan);
+
+                // Changing a variable read by an install condition forces that package to be planned again.
+                VariableSetNumericHelper(&incrementalState.variables, L"Toggle", 1);
+                VariableSetNumericHelper(&fullState.variables, L"Toggle", 1);
+
+                PlanPackagesHelper(&incrementalState, rgAllPresent, FALSE);
+                PlanPackagesHelper(&fullState, rgAllPresent, TRUE);
+                Assert::Equal(1, (int)incrementalState.plan.cSplicedPackages);
+                ComparePlans(&fullState.plan, &incrementalState.plan);
+            }
+            finally
+            {
+                PlanReset(&incrementalState.plan, &incrementalState.packages);
+                PlanReset(&incrementalState.plan, &incrementalState.packages);
+                PlanReset(&fullState.plan, &fullState.packages);
+                PlanReset(&fullState.plan, &fullState.packages);
+            }
+        }
+
+    private:
+        void InitializeEngineState(BURN_ENGINE_STATE* pEngineState, LPCSTR szDocument)
+        {
+            HRESULT hr = S_OK;
+
+            hr = VariableInitialize(&pEngineState->variables);
+            TestThrowOnFailure(hr, L"Failed to initialize variables.");
+
+            hr = ManifestLoadXmlFromBuffer((BYTE*)szDocument, lstrlenA(szDocument), pEngineState);
+            TestThrowOnFailure(hr, L"Failed to parse chain from XML.");
+
+            pEngineState->log.state = BURN_LOGGING_STATE_DISABLED;
+
+            for (DWORD i = 0; i < pEngineState->packages.cPackages; ++i)
+            {
+                pEngineState->packages.rgPackages[i].currentState = BOOTSTRAPPER_PACKAGE_STATE_ABSENT;
+                pEngineState->packages.rgPackages[i].cache = BURN_CACHE_STATE_NONE;
+            }
+        }
+
+        void PlanPackagesHelper(BURN_ENGINE_STATE* pEngineState, BOOTSTRAPPER_REQUEST_STATE* rgRequested, BOOL fFullPlan)
+        {
+            HRESULT hr = S_OK;
+            HANDLE hSyncpointEvent = NULL;
+
+            // Resetting twice releases the previous plan so nothing can be spliced.
+            PlanReset(&pEngineState->plan, &pEngineState->packages);
+            if (fFullPlan)
+            {
+                PlanReset(&pEngineState->plan, &pEngineState->packages);
+            }
+
+            pEngineState->plan.action = BOOTSTRAPPER_ACTION_INSTALL;
+            pEngineState->plan.wzBundleId = pEngineState->registration.sczId;
+            pEngineState->plan.wzBundleProviderKey = pEngineState->registration.sczId;
+
+            for (DWORD i = 0; i < pEngineState->packages.cPackages; ++i)
+            {
+                BURN_PACKAGE* pPackage = pEngineState->packages.rgPackages + i;
+
+                // Evaluate the install condition the same way planning does before asking the BA.
+                hr = PlanDefaultPackageRequestState(pPackage->type, pPackage->currentState, !pPackage->fUninstallable, pEngineState->plan.action, &pEngineState->variables, pPackage->sczInstallCondition, BOOTSTRAPPER_RELATION_NONE, &pPackage->requested);
+                TestThrowOnFailure(hr, L"Failed to get default package request state.");
+
+                pPackage->requested = rgRequested[i];
+
+                if (BOOTSTRAPPER_REQUEST_STATE_NONE != pPackage->requested)
+                {
+                    hr = PlanExecutePackage(FALSE, BOOTSTRAPPER_DISPLAY_NONE, &pEngineState->userExperience, &pEngineState->plan, pPackage, &pEngineState->log, &pEngineState->variables, &hSyncpointEvent);
+                    TestThrowOnFailure(hr, L"Failed to plan execute package.");
+                }
+
+                if (BOOTSTRAPPER_ACTION_STATE_NONE != pPackage->execute || BOOTSTRAPPER_ACTION_STATE_NONE != pPackage->rollback)
+                {
+                    hr = PlanExecuteCheckpoint(&pEngineState->plan);
+                    TestThrowOnFailure(hr, L"Failed to append execute checkpoint.");
+                }
+            }
+
+            hr = PlanFinalizeActions(&pEngineState->plan);
+            TestThrowOnFailure(hr, L"Failed to finalize plan.");
+        }
+
+        void ComparePlans(BURN_PLAN* pExpected, BURN_PLAN* pActual)
+        {
+            Assert::Equal((int)pExpected->cExecuteActions, (int)pActual->cExecuteActions);
+            Assert::Equal((int)pExpected->cRollbackActions, (int)pActual->cRollbackActions);
+
+            for (DWORD i = 0; i < pExpected->cExecuteActions; ++i)
+            {
+                CompareActions(pExpected, pExpected->rgExecuteActions + i, pActual, pActual->rgExecuteActions + i);
+            }
+
+            for (DWORD i = 0; i < pExpected->cRollbackActions; ++i)
+            {
+                CompareActions(pExpected, pExpected->rgRollbackActions + i, pActual, pActual->rgRollbackActions + i);
+            }
+        }
+
+        void CompareActions(BURN_PLAN* pExpectedPlan, BURN_EXECUTE_ACTION* pExpected, BURN_PLAN* pActualPlan, BURN_EXECUTE_ACTION* pActual)
+        {
+            Assert::Equal((int)pExpected->type, (int)pActual->type);
+            Assert::Equal((int)pExpected->fDeleted, (int)pActual->fDeleted);
+
+            switch (pExpected->type)
+            {
+            case BURN_EXECUTE_ACTION_TYPE_EXE_PACKAGE:
+                Assert::Equal(gcnew String(pExpected->exePackage.pPackage->sczId), gcnew String(pActual->exePackage.pPackage->sczId));
+                Assert::Equal((int)pExpected->exePackage.action, (int)pActual->exePackage.action);
+                break;
+
+            case BURN_EXECUTE_ACTION_TYPE_WAIT_SYNCPOINT:
+                // The event must be one this plan's cache actions will signal.
+                Assert::True(IsSignaledSyncpoint(pExpectedPlan, pExpected->syncpoint.hEvent));
+                Assert::True(IsSignaledSyncpoint(pActualPlan, pActual->syncpoint.hEvent));
+                break;
+
+            case BURN_EXECUTE_ACTION_TYPE_CHECKPOINT:
+                // Spliced checkpoints keep their ids, so compare where each checkpoint sits instead.
+                Assert::Equal(CheckpointOrdinal(pExpectedPlan, pExpected->checkpoint.dwId), CheckpointOrdinal(pActualPlan, pActual->checkpoint.dwId));
+                break;
+            }
+        }
+
+        bool IsSignaledSyncpoint(BURN_PLAN* pPlan, HANDLE hEvent)
+        {
+            if (!hEvent)
+            {
+                return false;
+            }
+
+            for (DWORD i = 0; i < pPlan->cCacheActions; ++i)
+            {
+                if (BURN_CACHE_ACTION_TYPE_SIGNAL_SYNCPOINT == pPlan->rgCacheActions[i].type && hEvent == pPlan->rgCacheActions[i].syncpoint.hEvent)
+                {
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        int CheckpointOrdinal(BURN_PLAN* pPlan, DWORD dwId)
+        {
+            int iOrdinal = 0;
+
+            for (DWORD i = 0; i < pPlan->cExecuteActions; ++i)
+            {
+                if (BURN_EXECUTE_ACTION_TYPE_CHECKPOINT == pPlan->rgExecuteActions[i].type)
+                {
+                    if (dwId == pPlan->rgExecuteActions[i].checkpoint.dwId)
+                    {
+                        return iOrdinal;
+                    }
+
+                    ++iOrdinal;
+                }
+            }
+
+            return -1;
+        }
+    };
+}
+}
+}
+}
+}
@@ -77,7 +77,7 @@ namespace Bootstrapper
                 TestThrowOnFailure(hr, L"Failed to parse searches from XML.");
 
                 // execute searches
-                hr = SearchesExecute(&searches, &variables);
+                hr = SearchesExecute(&searches, &variables, NULL);
                 TestThrowOnFailure(hr, L"Failed to execute searches.");
 
                 // check variable values
@@ -128,7 +128,7 @@ namespace Bootstrapper
                 TestThrowOnFailure(hr, L"Failed to parse searches from XML.");
 
                 // execute searches
-                hr = SearchesExecute(&searches, &variables);
+                hr = SearchesExecute(&searches, &variables, NULL);
                 TestThrowOnFailure(hr, L"Failed to execute searches.");
 
                 // check variable values
@@ -144,6 +144,104 @@ namespace Bootstrapper
             }
         }
 
+        [NamedFact]
+        void FileSearchCacheTest()
+        {
+            HRESULT hr = S_OK;
+            IXMLDOMElement* pixeBundle = NULL;
+            BURN_VARIABLES variables = { };
+            BURN_SEARCHES searches = { };
+            ULARGE_INTEGER uliVersion1 = { };
+            ULARGE_INTEGER uliVersion2 = { };
+            BYTE* pbCache = NULL;
+            DWORD cbCache = 0;
+            const DWORD64 qwPlantedVersion = 0x0001000200030004;
+            try
+            {
+                String^ file = System::IO::Path::Combine(this->TestContext->TestDirectory, gcnew String(L"versioned.dll"));
+                String^ cacheFile = System::IO::Path::Combine(this->TestContext->TestDirectory, gcnew String(L"cache\\searches.rsc"));
+                String^ source1 = System::Reflection::Assembly::GetExecutingAssembly()->Location;
+                String^ source2 = System::IO::Path::Combine(Environment::SystemDirectory, gcnew String(L"kernel32.dll"));
+                pin_ptr<const WCHAR> wzFile = PtrToStringChars(file);
+                pin_ptr<const WCHAR> wzCacheFile = PtrToStringChars(cacheFile);
+                pin_ptr<const WCHAR> wzSource1 = PtrToStringChars(source1);
+                pin_ptr<const WCHAR> wzSource2 = PtrToStringChars(source2);
+
+                hr = FileVersion(wzSource1, &uliVersion1.HighPart, &uliVersion1.LowPart);
+                TestThrowOnFailure(hr, L"Failed to get DLL version.");
+
+                hr = FileVersion(wzSource2, &uliVersion2.HighPart, &uliVersion2.LowPart);
+                TestThrowOnFailure(hr, L"Failed to get DLL version.");
+
+                System::IO::File::Copy(source1, file, true);
+
+                LPCWSTR wzDocument =
+                    L"<Bundle>"
+                    L"    <FileSearch Id='Search1' Type='version' Path='[File]' Variable='Variable1' />"
+                    L"</Bundle>";
+
+                hr = VariableInitialize(&variables);
+                TestThrowOnFailure(hr, L"Failed to initialize variables.");
+
+                VariableSetStringHelper(&variables, L"File", wzFile);
+
+                // load XML document
+                LoadBundleXmlHelper(wzDocument, &pixeBundle);
+
+                hr = SearchesParseFromXml(&searches, pixeBundle);
+                TestThrowOnFailure(hr, L"Failed to parse searches from XML.");
+
+                // the first run finds the version and keeps it
+                hr = SearchesExecute(&searches, &variables, wzCacheFile);
+                TestThrowOnFailure(hr, L"Failed to execute searches.");
+
+                Assert::True(System::IO::File::Exists(cacheFile));
+                Assert::Equal(uliVersion1.QuadPart, VariableGetVersionHelper(&variables, L"Variable1"));
+
+                // the next run reuses it, so a different version planted in the only entry's value
+                // (the last field of the file) is what the search reports
+                hr = FileRead(&pbCache, &cbCache, wzCacheFile);
+                TestThrowOnFailure(hr, L"Failed to read search cache.");
+
+                Assert::True(sizeof(DWORD64) <= cbCache);
+                *reinterpret_cast<DWORD64*>(pbCache + cbCache - sizeof(DWORD64)) = qwPlantedVersion;
+
+                hr = FileWrite(wzCacheFile, FILE_ATTRIBUTE_NORMAL, pbCache, cbCache, NULL);
+                TestThrowOnFailure(hr, L"Failed to write search cache.");
+
+                VariableSetNumericHelper(&variables, L"Variable1", 0);
+
+                hr = SearchesExecute(&searches, &variables, wzCacheFile);
+                TestThrowOnFailure(hr, L"Failed to execute searches.");
+
+                Assert::Equal(qwPlantedVersion, VariableGetVersionHelper(&variables, L"Variable1"));
+
+                // replacing the file changes its stamp so the version is found again
+                System::IO::File::Copy(source2, file, true);
+
+                hr = SearchesExecute(&searches, &variables, wzCacheFile);
+                TestThrowOnFailure(hr, L"Failed to execute searches.");
+
+                Assert::Equal(uliVersion2.QuadPart, VariableGetVersionHelper(&variables, L"Variable1"));
+
+                // a damaged cache is ignored and rewritten
+                System::IO::File::WriteAllText(cacheFile, gcnew String(L"damaged"));
+
+                hr = SearchesExecute(&searches, &variables, wzCacheFile);
+                TestThrowOnFailure(hr, L"Failed to execute searches.");
+
+                Assert::Equal(uliVersion2.QuadPart, VariableGetVersionHelper(&variables, L"Variable1"));
+                Assert::NotEqual(gcnew String(L"damaged"), System::IO::File::ReadAllText(cacheFile));
+            }
+            finally
+            {
+                ReleaseMem(pbCache);
+                ReleaseObject(pixeBundle);
+                VariablesUninitialize(&variables);
+                SearchesUninitialize(&searches);
+            }
+        }
+
         [NamedFact]
         void RegistrySearchTest()
         {
@@ -223,7 +321,7 @@ namespace Bootstrapper
                 TestThrowOnFailure(hr, L"Failed to parse searches from XML.");
 
                 // execute searches
-                hr = SearchesExecute(&searches, &variables);
+                hr = SearchesExecute(&searches, &variables, NULL);
                 TestThrowOnFailure(hr, L"Failed to execute searches.");
 
                 // check variable values
@@ -321,7 +419,7 @@ namespace Bootstrapper
                 TestThrowOnFailure(hr, L"Failed to parse searches from XML.");
 
                 // execute searches
-                hr = SearchesExecute(&searches, &variables);
+                hr = SearchesExecute(&searches, &variables, NULL);
                 TestThrowOnFailure(hr, L"Failed to execute searches.");
 
                 // check variable values
@@ -385,7 +483,7 @@ namespace Bootstrapper
                 TestThrowOnFailure(hr, L"Failed to parse searches from XML.");
 
                 // execute searches
-                hr = SearchesExecute(&searches, &variables);
+                hr = SearchesExecute(&searches, &variables, NULL);
                 TestThrowOnFailure(hr, L"Failed to execute searches.");
 
                 // check variable values
@@ -428,7 +526,7 @@ namespace Bootstrapper
                 TestThrowOnFailure(hr, L"Failed to parse searches from XML.");
 
                 // execute searches
-                hr = SearchesExecute(&searches, &variables);
+                hr = SearchesExecute(&searches, &variables, NULL);
                 TestThrowOnFailure(hr, L"Failed to execute searches.");
             }
             finally
@@ -465,7 +563,7 @@ namespace Bootstrapper
                 TestThrowOnFailure(hr, L"Failed to parse searches from XML.");
 
                 // execute searches
-                hr = SearchesExecute(&searches, &variables);
+                hr = SearchesExecute(&searches, &variables, NULL);
                 TestThrowOnFailure(hr, L"Failed to execute searches.");
 
                 // check variable values
@@ -480,6 +578,72 @@ namespace Bootstrapper
                 SearchesUninitialize(&searches);
             }
         }
+        [NamedFact]
+        void DependentSearchesTest()
+        {
+            HRESULT hr = S_OK;
+            IXMLDOMElement* pixeBundle = NULL;
+            BURN_VARIABLES variables = { };
+            BURN_SEARCHES searches = { };
+            try
+            {
+                hr = VariableInitialize(&variables);
+                TestThrowOnFailure(hr, L"Failed to initialize variables.");
+
+                pin_ptr<const WCHAR> wzDirectory1 = PtrToStringChars(this->TestContext->TestDirectory);
+                pin_ptr<const WCHAR> wzDirectory2 = PtrToStringChars(System::IO::Path::Combine(this->TestContext->TestDirectory, gcnew String(L"none")));
+
+                VariableSetStringHelper(&variables, L"Directory1", wzDirectory1);
+                VariableSetStringHelper(&variables, L"Directory2", wzDirectory2);
+                VariableSetStringHelper(&variables, L"Indirect", L"[Path1]");
+
+                // Search2, Search3 and Search4 read what Search1 sets, Search5 sets it again after
+                // they read it and Search4 reads it through a variable so it can't run out of order.
+                String^ document = gcnew String(
+                    L"<Bundle>"
+                    L"    <DirectorySearch Id='Search1' Type='path' Path='[Directory1]' Variable='Path1' />"
+                    L"    <DirectorySearch Id='Search2' Type='exists' Path='[Path1]' Variable='Exists2' />"
+                    L"    <DirectorySearch Id='Search3' Type='exists' Path='[Directory1]' Variable='Exists3' Condition='Exists2 AND Path1' />"
+                    L"    <DirectorySearch Id='Search4' Type='exists' Path='[Indirect]' Variable='Exists4' />"
+                    L"    <DirectorySearch Id='Search5' Type='exists' Path='[Directory2]' Variable='Path1' />");
+                for (int i = 0; i < 100; ++i)
+                {
+                    document = String::Concat(document, String::Format(L"    <DirectorySearch Id='Independent{0}' Type='exists' Path='[Directory{1}]' Variable='Independent{0}' />", i, 1 + i % 2));
+                }
+                document = String::Concat(document, gcnew String(L"</Bundle>"));
+
+                pin_ptr<const WCHAR> wzDocument = PtrToStringChars(document);
+
+                // load XML document
+                LoadBundleXmlHelper(wzDocument, &pixeBundle);
+
+                hr = SearchesParseFromXml(&searches, pixeBundle);
+                TestThrowOnFailure(hr, L"Failed to parse searches from XML.");
+
+                // execute searches
+                hr = SearchesExecute(&searches, &variables, NULL);
+                TestThrowOnFailure(hr, L"Failed to execute searches.");
+
+                // check variable values
+                Assert::Equal(1ll, VariableGetNumericHelper(&variables, L"Exists2"));
+                Assert::Equal(1ll, VariableGetNumericHelper(&variables, L"Exists3"));
+                Assert::Equal(1ll, VariableGetNumericHelper(&variables, L"Exists4"));
+                Assert::Equal(0ll, VariableGetNumericHelper(&variables, L"Path1"));
+
+                for (int i = 0; i < 100; ++i)
+                {
+                    pin_ptr<const WCHAR> wzVariable = PtrToStringChars(String::Format(L"Independent{0}", i));
+                    Assert::Equal(0 == i % 2 ? 1ll : 0ll, VariableGetNumericHelper(&variables, wzVariable));
+                }
+            }
+            finally
+            {
+                ReleaseObject(pixeBundle);
+                VariablesUninitialize(&variables);
+                SearchesUninitialize(&searches);
+            }
+        }
+
         [NamedFact]
         void NoSearchesTest()
         {
@@ -503,7 +667,7 @@ namespace Bootstrapper
                 TestThrowOnFailure(hr, L"Failed to parse searches from XML.");
 
                 // execute searches
-                hr = SearchesExecute(&searches, &variables);
+                hr = SearchesExecute(&searches, &variables, NULL);
                 TestThrowOnFailure(hr, L"Failed to execute searches.");
             }
             finally
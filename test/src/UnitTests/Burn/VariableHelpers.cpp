@@ -135,19 +135,36 @@ namespace Bootstrapper
     {
         HRESULT hr = S_OK;
         BOOL f = FALSE;
+        BOOL fCached = FALSE;
+        BOOL fInterpreted = FALSE;
 
+        // the first evaluation compiles the condition, the second runs it from the cache
         hr = ConditionEvaluate(pVariables, wzCondition, &f);
         TestThrowOnFailure1(hr, L"Failed to evaluate condition: '%s'", wzCondition);
 
+        hr = ConditionEvaluate(pVariables, wzCondition, &fCached);
+        TestThrowOnFailure1(hr, L"Failed to evaluate cached condition: '%s'", wzCondition);
+
+        hr = ConditionEvaluateInterpreted(pVariables, wzCondition, &fInterpreted);
+        TestThrowOnFailure1(hr, L"Failed to interpret condition: '%s'", wzCondition);
+
+        Assert::Equal<BOOL>(fInterpreted, f);
+        Assert::Equal<BOOL>(fInterpreted, fCached);
+
         return f ? true : false;
     }
 
     bool EvaluateFailureConditionHelper(BURN_VARIABLES* pVariables, LPCWSTR wzCondition)
     {
         HRESULT hr = S_OK;
+        HRESULT hrInterpreted = S_OK;
         BOOL f = FALSE;
 
         hr = ConditionEvaluate(pVariables, wzCondition, &f);
+        hrInterpreted = ConditionEvaluateInterpreted(pVariables, wzCondition, &f);
+
+        Assert::Equal<HRESULT>(hrInterpreted, hr);
+
         return E_INVALIDDATA == hr ? true : false;
     }
 
@@ -4,6 +4,21 @@
 #undef GetTempPath
 #undef GetEnvironmentVariable
 
+
+typedef struct _VARIABLE_CONTENTION_CONTEXT
+{
+    BURN_VARIABLES* pVariables;
+    DWORD cIterations;
+    HRESULT hr;
+} VARIABLE_CONTENTION_CONTEXT;
+
+static DWORD CALLBACK VariableContentionWriterThreadProc(
+    __in LPVOID lpThreadParameter
+    );
+static DWORD CALLBACK VariableContentionReaderThreadProc(
+    __in LPVOID lpThreadParameter
+    );
+
 namespace Microsoft
 {
 namespace Tools
@@ -162,6 +177,102 @@ namespace Bootstrapper
             }
         }
 
+        [NamedFact]
+        void VariablesFormatTemplateTest()
+        {
+            HRESULT hr = S_OK;
+            IXMLDOMElement* pixeBundle = NULL;
+            BURN_VARIABLES variables = { };
+            LPWSTR scz = NULL;
+            DWORD cch = 0;
+            try
+            {
+                LPCWSTR wzDocument =
+                    L"<Bundle>"
+                    L"    <Variable Id='Secret' Type='string' Value='PASSWORD' Hidden='yes' Persisted='no' />"
+                    L"    <Variable Id='Nested' Type='string' Value='[PROP1]-[PROP2]' Hidden='no' Persisted='no' />"
+                    L"</Bundle>";
+
+                hr = VariableInitialize(&variables);
+                TestThrowOnFailure(hr, L"Failed to initialize variables.");
+
+                LoadBundleXmlHelper(wzDocument, &pixeBundle);
+
+                hr = VariablesParseFromXml(&variables, pixeBundle);
+                TestThrowOnFailure(hr, L"Failed to parse variables from XML.");
+
+                VariableSetStringHelper(&variables, L"PROP1", L"VAL1");
+                VariableSetStringHelper(&variables, L"PROP2", L"VAL2");
+                VariableSetStringHelper(&variables, L"EMPTY", L"");
+
+                // formatting the same string repeatedly reuses its compiled template, so values must still be current
+                Assert::Equal(gcnew String(L"VAL1-VAL2"), VariableFormatStringHelper(&variables, L"[Nested]"));
+                VariableSetStringHelper(&variables, L"PROP2", L"CHANGED");
+                Assert::Equal(gcnew String(L"VAL1-CHANGED"), VariableFormatStringHelper(&variables, L"[Nested]"));
+                Assert::Equal(gcnew String(L"VAL1-CHANGED"), VariableFormatStringHelper(&variables, L"[Nested]"));
+
+                // escapes only use the first character, unbalanced brackets are literal
+                Assert::Equal(gcnew String(L"a"), VariableFormatStringHelper(&variables, L"[\\abc]"));
+                Assert::Equal(gcnew String(L"]"), VariableFormatStringHelper(&variables, L"[[PROP1]]"));
+                Assert::Equal(gcnew String(L"VAL1]"), VariableFormatStringHelper(&variables, L"[PROP1]]"));
+                Assert::Equal(gcnew String(L"[]VAL1[]"), VariableFormatStringHelper(&variables, L"[][PROP1][]"));
+                Assert::Equal(gcnew String(L"VAL1 [PROP2"), VariableFormatStringHelper(&variables, L"[PROP1] [PROP2"));
+                Assert::Equal(gcnew String(L"PRE  POST"), VariableFormatStringHelper(&variables, L"PRE [EMPTY] POST"));
+
+                // braces without brackets are left alone, groups with variables follow the MSI rules
+                Assert::Equal(gcnew String(L"{GUID} VAL1"), VariableFormatStringHelper(&variables, L"{GUID} [PROP1]"));
+                Assert::Equal(gcnew String(L"}VAL1{"), VariableFormatStringHelper(&variables, L"}[PROP1]{"));
+                Assert::Equal(gcnew String(L"{"), VariableFormatStringHelper(&variables, L"[\\{]"));
+                Assert::Equal(gcnew String(L"PRE VAL1 POST"), VariableFormatStringHelper(&variables, L"PRE {[PROP1]} POST"));
+                Assert::Equal(gcnew String(L"PRE  POST"), VariableFormatStringHelper(&variables, L"PRE {[NONE]} POST"));
+
+                // hidden variables
+                Assert::Equal(gcnew String(L"pwd=PASSWORD"), VariableFormatStringHelper(&variables, L"pwd=[Secret]"));
+
+                hr = VariableFormatStringObfuscated(&variables, L"pwd=[Secret] user=[PROP1]", &scz, &cch);
+                TestThrowOnFailure(hr, L"Failed to format obfuscated string");
+
+                Assert::Equal(gcnew String(L"pwd=***** user=VAL1"), gcnew String(scz));
+                Assert::Equal((DWORD)lstrlenW(scz), cch);
+
+                // formatting into the buffer that holds the input
+                hr = StrAllocString(&scz, L"[PROP1][PROP1]", 0);
+                TestThrowOnFailure(hr, L"Failed to copy string");
+
+                hr = VariableFormatString(&variables, scz, &scz, &cch);
+                TestThrowOnFailure(hr, L"Failed to format string");
+
+                Assert::Equal(gcnew String(L"VAL1VAL1"), gcnew String(scz));
+                Assert::Equal((DWORD)8, cch);
+
+                hr = VariableFormatString(&variables, L"{[PROP1]} [PROP2]", NULL, &cch);
+                TestThrowOnFailure(hr, L"Failed to format string");
+
+                Assert::Equal((DWORD)lstrlenW(L"VAL1 CHANGED"), cch);
+
+                // a full cache starts over instead of refusing new templates
+                for (DWORD i = 0; i < 1500; ++i)
+                {
+                    hr = StrAllocFormatted(&scz, L"[PROP1]-%u", i);
+                    TestThrowOnFailure(hr, L"Failed to format template");
+
+                    Assert::Equal(String::Format("VAL1-{0}", i), VariableFormatStringHelper(&variables, scz));
+                }
+
+                cch = variables.cFormatTemplates;
+                Assert::True(0 < cch && 512 >= cch);
+
+                Assert::Equal(gcnew String(L"VAL1-1499"), VariableFormatStringHelper(&variables, scz));
+                Assert::Equal(cch, variables.cFormatTemplates);
+            }
+            finally
+            {
+                ReleaseStr(scz);
+                ReleaseObject(pixeBundle);
+                VariablesUninitialize(&variables);
+            }
+        }
+
         [NamedFact]
         void VariablesEscapeTest()
         {
@@ -346,6 +457,194 @@ namespace Bootstrapper
             }
         }
 
+        [NamedFact]
+        void VariablesCompiledConditionTest()
+        {
+            HRESULT hr = S_OK;
+            BURN_VARIABLES variables = { };
+            LPWSTR sczCondition = NULL;
+            try
+            {
+                hr = VariableInitialize(&variables);
+                TestThrowOnFailure(hr, L"Failed to initialize variables.");
+
+                // compiled conditions resolve variables that only show up after they were first evaluated
+                Assert::False(EvaluateConditionHelper(&variables, L"LATE = 1"));
+                VariableSetNumericHelper(&variables, L"LATE", 1);
+                Assert::True(EvaluateConditionHelper(&variables, L"LATE = 1"));
+
+                // and always see the current values
+                VariableSetStringHelper(&variables, L"PROP1", L"VAL1");
+                Assert::True(EvaluateConditionHelper(&variables, L"PROP1 = \"VAL1\" AND NOT PROP2"));
+                VariableSetStringHelper(&variables, L"PROP1", L"OTHER");
+                Assert::False(EvaluateConditionHelper(&variables, L"PROP1 = \"VAL1\" AND NOT PROP2"));
+                VariableSetNumericHelper(&variables, L"PROP2", 2);
+                Assert::True(EvaluateConditionHelper(&variables, L"PROP1 ~= \"other\" OR PROP2 = 2"));
+
+                // deep enough to need more than the fixed evaluation stack
+                hr = StrAllocString(&sczCondition, L"LATE = 0", 0);
+                TestThrowOnFailure(hr, L"Failed to copy condition.");
+
+                for (DWORD i = 0; i < 40; ++i)
+                {
+                    hr = StrAllocConcat(&sczCondition, L" OR (LATE = 0", 0);
+                    TestThrowOnFailure(hr, L"Failed to append condition.");
+                }
+
+                hr = StrAllocConcat(&sczCondition, L" OR LATE = 1", 0);
+                TestThrowOnFailure(hr, L"Failed to append condition.");
+
+                for (DWORD i = 0; i < 40; ++i)
+                {
+                    hr = StrAllocConcat(&sczCondition, L")", 0);
+                    TestThrowOnFailure(hr, L"Failed to append condition.");
+                }
+
+                Assert::True(EvaluateConditionHelper(&variables, sczCondition));
+
+                // more distinct conditions than the cache holds fall back to the interpreter
+                for (DWORD i = 0; i < 1000; ++i)
+                {
+                    hr = StrAllocFormatted(&sczCondition, L"LATE = %u", i);
+                    TestThrowOnFailure(hr, L"Failed to format condition.");
+
+                    Assert::Equal(1 == i, EvaluateConditionHelper(&variables, sczCondition));
+                }
+
+                // conditions that fail to compile keep failing
+                Assert::True(EvaluateFailureConditionHelper(&variables, L"PROP1 = "));
+                Assert::True(EvaluateFailureConditionHelper(&variables, L"PROP1 = "));
+            }
+            finally
+            {
+                ReleaseStr(sczCondition);
+                VariablesUninitialize(&variables);
+            }
+        }
+
+        [NamedFact]
+        void VariablesIncrementalEvaluationTest()
+        {
+            HRESULT hr = S_OK;
+            BURN_VARIABLES variables = { };
+            BURN_VARIANT value = { };
+            DWORD dwReference = 0;
+            DWORD64 qwGeneration = 0;
+            try
+            {
+                hr = VariableInitialize(&variables);
+                TestThrowOnFailure(hr, L"Failed to initialize variables.");
+
+                VariableSetNumericHelper(&variables, L"A", 1);
+
+                hr = VariableGetVariantByReference(&variables, L"A", &dwReference, &value);
+                TestThrowOnFailure(hr, L"Failed to get variable by reference.");
+
+                Assert::NotEqual<DWORD>(0, dwReference);
+
+                // only setting the variable itself moves its generation forward
+                qwGeneration = VariableGetGeneration(&variables);
+                VariableSetNumericHelper(&variables, L"B", 2);
+                Assert::False(VariableHasChangedSince(&variables, dwReference, qwGeneration) ? true : false);
+                Assert::True(VariableHasChangedSince(&variables, 0, qwGeneration) ? true : false);
+
+                qwGeneration = VariableGetGeneration(&variables);
+                VariableSetNumericHelper(&variables, L"B", 3);
+                Assert::False(VariableHasChangedSince(&variables, 0, qwGeneration) ? true : false);
+
+                VariableSetNumericHelper(&variables, L"A", 1);
+                Assert::True(VariableHasChangedSince(&variables, dwReference, qwGeneration) ? true : false);
+
+                // conditions pick up changes to the variables they read, including ones that did not exist yet
+                Assert::True(EvaluateConditionHelper(&variables, L"A = 1 AND NOT C"));
+                VariableSetNumericHelper(&variables, L"B", 4);
+                Assert::True(EvaluateConditionHelper(&variables, L"A = 1 AND NOT C"));
+                VariableSetNumericHelper(&variables, L"C", 1);
+                Assert::False(EvaluateConditionHelper(&variables, L"A = 1 AND NOT C"));
+
+                // formatted results follow variables read through nested formatting
+                VariableSetStringHelper(&variables, L"OUTER", L"<[INNER]>");
+                VariableSetStringHelper(&variables, L"INNER", L"1");
+                Assert::Equal(gcnew String(L"<1>[LATE]"), VariableFormatStringHelper(&variables, L"[OUTER][\\[]LATE[\\]][LATE]"));
+                VariableSetStringHelper(&variables, L"INNER", L"2");
+                Assert::Equal(gcnew String(L"<2>[LATE]"), VariableFormatStringHelper(&variables, L"[OUTER][\\[]LATE[\\]][LATE]"));
+                VariableSetStringHelper(&variables, L"LATE", L"3");
+                Assert::Equal(gcnew String(L"<2>[LATE]3"), VariableFormatStringHelper(&variables, L"[OUTER][\\[]LATE[\\]][LATE]"));
+                Assert::Equal(gcnew String(L"<2>"), VariableFormatStringHelper(&variables, L"[OUTER]"));
+            }
+            finally
+            {
+                BVariantUninitialize(&value);
+                VariablesUninitialize(&variables);
+            }
+        }
+
+        [NamedFact]
+        void VariablesConcurrentAccessTest()
+        {
+            HRESULT hr = S_OK;
+            const DWORD cReaders = 4;
+            const DWORD cIterations = 10000;
+            IXMLDOMElement* pixeBundle = NULL;
+            BURN_VARIABLES variables = { };
+            VARIABLE_CONTENTION_CONTEXT rgContexts[cReaders + 1] = { };
+            HANDLE rghThreads[cReaders + 1] = { };
+            try
+            {
+                LPCWSTR wzDocument =
+                    L"<Bundle>"
+                    L"    <Variable Id='Secret' Type='string' Value='shh' Hidden='yes' Persisted='no' />"
+                    L"</Bundle>";
+
+                hr = VariableInitialize(&variables);
+                TestThrowOnFailure(hr, L"Failed to initialize variables.");
+
+                LoadBundleXmlHelper(wzDocument, &pixeBundle);
+
+                hr = VariablesParseFromXml(&variables, pixeBundle);
+                TestThrowOnFailure(hr, L"Failed to parse variables from XML.");
+
+                VariableSetNumericHelper(&variables, L"Counter", 0);
+                VariableSetStringHelper(&variables, L"Label", L"count");
+                VariableSetStringHelper(&variables, L"Message", L"[Label]=[Counter]");
+
+                // the first thread writes while the rest read, format and evaluate conditions
+                for (DWORD i = 0; i <= cReaders; ++i)
+                {
+                    rgContexts[i].pVariables = &variables;
+                    rgContexts[i].cIterations = cIterations;
+
+                    rghThreads[i] = ::CreateThread(NULL, 0, 0 == i ? VariableContentionWriterThreadProc : VariableContentionReaderThreadProc, &rgContexts[i], 0, NULL);
+                    Assert::True(NULL != rghThreads[i]);
+                }
+
+                ::WaitForMultipleObjects(cReaders + 1, rghThreads, TRUE, INFINITE);
+
+                for (DWORD i = 0; i <= cReaders; ++i)
+                {
+                    TestThrowOnFailure(rgContexts[i].hr, L"Variable contention thread failed.");
+                }
+
+                Assert::Equal(static_cast<LONGLONG>(cIterations), VariableGetNumericHelper(&variables, L"Counter"));
+                Assert::Equal(String::Format(L"count={0}", cIterations), VariableGetFormattedHelper(&variables, L"Message"));
+                Assert::Equal(gcnew String(L"shh"), VariableGetStringHelper(&variables, L"Secret"));
+            }
+            finally
+            {
+                for (DWORD i = 0; i <= cReaders; ++i)
+                {
+                    if (rghThreads[i])
+                    {
+                        ::WaitForSingleObject(rghThreads[i], INFINITE);
+                        ReleaseHandle(rghThreads[i]);
+                    }
+                }
+
+                ReleaseObject(pixeBundle);
+                VariablesUninitialize(&variables);
+            }
+        }
+
         [NamedFact]
         void VariablesSerializationTest()
         {
@@ -389,6 +688,172 @@ namespace Bootstrapper
             }
         }
 
+        [NamedFact]
+        void VariablesSerializeChangesTest()
+        {
+            HRESULT hr = S_OK;
+            BYTE* pbBuffer = NULL;
+            SIZE_T cbBuffer = 0;
+            SIZE_T iBuffer = 0;
+            BURN_VARIABLES variables1 = { };
+            BURN_VARIABLES variables2 = { };
+            BURN_VARIABLES variables3 = { };
+            try
+            {
+                hr = VariableInitialize(&variables1);
+                TestThrowOnFailure(hr, L"Failed to initialize variables.");
+
+                hr = VariableInitialize(&variables2);
+                TestThrowOnFailure(hr, L"Failed to initialize variables.");
+
+                hr = VariableInitialize(&variables3);
+                TestThrowOnFailure(hr, L"Failed to initialize variables.");
+
+                VariableSetStringHelper(&variables1, L"PROP1", L"VAL1");
+                VariableSetNumericHelper(&variables1, L"PROP2", -2);
+                VariableSetVersionHelper(&variables1, L"PROP3", MAKEQWORDVERSION(1,1,1,1));
+
+                // the first sync sends everything
+                hr = VariableSerializeChanges(&variables1, &pbBuffer, &cbBuffer);
+                TestThrowOnFailure(hr, L"Failed to serialize variable changes.");
+
+                hr = VariableDeserializeChanges(&variables2, pbBuffer, cbBuffer, &iBuffer);
+                TestThrowOnFailure(hr, L"Failed to deserialize variable changes.");
+
+                VariableAcknowledgeChanges(&variables1);
+
+                Assert::Equal(gcnew String(L"VAL1"), VariableGetStringHelper(&variables2, L"PROP1"));
+                Assert::Equal(-2ll, VariableGetNumericHelper(&variables2, L"PROP2"));
+                Assert::Equal(MAKEQWORDVERSION(1,1,1,1), VariableGetVersionHelper(&variables2, L"PROP3"));
+
+                // later syncs only send what changed, by index for variables sent before
+                VariableSetStringHelper(&variables2, L"PROP1", L"LOCAL");
+                VariableSetNumericHelper(&variables1, L"PROP2", 22);
+                VariableSetStringHelper(&variables1, L"PROP4", L"VAL4");
+
+                ReleaseNullBuffer(pbBuffer);
+                cbBuffer = 0;
+                iBuffer = 0;
+
+                hr = VariableSerializeChanges(&variables1, &pbBuffer, &cbBuffer);
+                TestThrowOnFailure(hr, L"Failed to serialize variable changes.");
+
+                // a process that never saw the names can't apply it
+                hr = VariableDeserializeChanges(&variables3, pbBuffer, cbBuffer, &iBuffer);
+                Assert::Equal<HRESULT>(E_INVALIDARG, hr);
+
+                iBuffer = 0;
+                hr = VariableDeserializeChanges(&variables2, pbBuffer, cbBuffer, &iBuffer);
+                TestThrowOnFailure(hr, L"Failed to deserialize variable changes.");
+
+                VariableAcknowledgeChanges(&variables1);
+
+                Assert::Equal(gcnew String(L"LOCAL"), VariableGetStringHelper(&variables2, L"PROP1"));
+                Assert::Equal(22ll, VariableGetNumericHelper(&variables2, L"PROP2"));
+                Assert::Equal(gcnew String(L"VAL4"), VariableGetStringHelper(&variables2, L"PROP4"));
+
+                // nothing changed so only the count is sent
+                ReleaseNullBuffer(pbBuffer);
+                cbBuffer = 0;
+
+                hr = VariableSerializeChanges(&variables1, &pbBuffer, &cbBuffer);
+                TestThrowOnFailure(hr, L"Failed to serialize variable changes.");
+
+                Assert::Equal<SIZE_T>(1, cbBuffer);
+
+                // after a reset everything is sent again
+                VariableResetChanges(&variables1);
+
+                ReleaseNullBuffer(pbBuffer);
+                cbBuffer = 0;
+                iBuffer = 0;
+
+                hr = VariableSerializeChanges(&variables1, &pbBuffer, &cbBuffer);
+                TestThrowOnFailure(hr, L"Failed to serialize variable changes.");
+
+                hr = VariableDeserializeChanges(&variables3, pbBuffer, cbBuffer, &iBuffer);
+                TestThrowOnFailure(hr, L"Failed to deserialize variable changes.");
+
+                Assert::Equal(gcnew String(L"VAL1"), VariableGetStringHelper(&variables3, L"PROP1"));
+                Assert::Equal(22ll, VariableGetNumericHelper(&variables3, L"PROP2"));
+                Assert::Equal(MAKEQWORDVERSION(1,1,1,1), VariableGetVersionHelper(&variables3, L"PROP3"));
+                Assert::Equal(gcnew String(L"VAL4"), VariableGetStringHelper(&variables3, L"PROP4"));
+            }
+            finally
+            {
+                ReleaseBuffer(pbBuffer);
+                VariablesUninitialize(&variables1);
+                VariablesUninitialize(&variables2);
+                VariablesUninitialize(&variables3);
+            }
+        }
+
+        [NamedFact]
+        void VariablesManyVariablesTest()
+        {
+            HRESULT hr = S_OK;
+            const DWORD cTestVariables = 10000;
+            LPWSTR sczName = NULL;
+            LONGLONG llValue = 0;
+            BYTE* pbBuffer = NULL;
+            SIZE_T cbBuffer = 0;
+            SIZE_T iBuffer = 0;
+            BURN_VARIABLES variables1 = { };
+            BURN_VARIABLES variables2 = { };
+            try
+            {
+                hr = VariableInitialize(&variables1);
+                TestThrowOnFailure(hr, L"Failed to initialize variables.");
+
+                System::Diagnostics::Stopwatch^ stopwatch = System::Diagnostics::Stopwatch::StartNew();
+
+                // insert in descending order, the worst case for a sorted array.
+                for (DWORD i = cTestVariables; 0 < i; --i)
+                {
+                    hr = StrAllocFormatted(&sczName, L"Var%05u", i);
+                    TestThrowOnFailure(hr, L"Failed to format variable name.");
+
+                    VariableSetNumericHelper(&variables1, sczName, i);
+                }
+
+                for (DWORD i = 1; i <= cTestVariables; ++i)
+                {
+                    hr = StrAllocFormatted(&sczName, L"Var%05u", i);
+                    TestThrowOnFailure(hr, L"Failed to format variable name.");
+
+                    Assert::Equal(static_cast<LONGLONG>(i), VariableGetNumericHelper(&variables1, sczName));
+                }
+
+                stopwatch->Stop();
+                Console::WriteLine("Set and read {0} variables in {1} ms.", cTestVariables, stopwatch->ElapsedMilliseconds);
+
+                // names stay case-sensitive.
+                hr = VariableGetNumeric(&variables1, L"VAR00001", &llValue);
+                Assert::Equal(E_NOTFOUND, hr);
+
+                // serialized variables keep insertion order and round-trip.
+                hr = VariableSerialize(&variables1, FALSE, &pbBuffer, &cbBuffer);
+                TestThrowOnFailure(hr, L"Failed to serialize variables.");
+
+                hr = VariableInitialize(&variables2);
+                TestThrowOnFailure(hr, L"Failed to initialize variables.");
+
+                hr = VariableDeserialize(&variables2, FALSE, pbBuffer, cbBuffer, &iBuffer);
+                TestThrowOnFailure(hr, L"Failed to deserialize variables.");
+
+                Assert::Equal(1ll, VariableGetNumericHelper(&variables2, L"Var00001"));
+                Assert::Equal(static_cast<LONGLONG>(cTestVariables), VariableGetNumericHelper(&variables2, L"Var10000"));
+                Assert::Equal(gcnew String(L"5000"), VariableFormatStringHelper(&variables2, L"[Var05000]"));
+            }
+            finally
+            {
+                ReleaseStr(sczName);
+                ReleaseBuffer(pbBuffer);
+                VariablesUninitialize(&variables1);
+                VariablesUninitialize(&variables2);
+            }
+        }
+
         [NamedFact]
         void VariablesBuiltInTest()
         {
@@ -479,3 +944,95 @@ namespace Bootstrapper
 }
 }
 }
+
+
+static DWORD CALLBACK VariableContentionWriterThreadProc(
+    __in LPVOID lpThreadParameter
+    )
+{
+    HRESULT hr = S_OK;
+    VARIABLE_CONTENTION_CONTEXT* pContext = static_cast<VARIABLE_CONTENTION_CONTEXT*>(lpThreadParameter);
+    LPWSTR sczName = NULL;
+
+    for (DWORD i = 1; i <= pContext->cIterations; ++i)
+    {
+        hr = VariableSetNumeric(pContext->pVariables, L"Counter", i, FALSE);
+        ExitOnFailure(hr, "Failed to set counter.");
+
+        // adding variables grows the variable array while the readers are using it
+        if (0 == i % 100)
+        {
+            hr = StrAllocFormatted(&sczName, L"Added%u", i);
+            ExitOnFailure(hr, "Failed to format variable name.");
+
+            hr = VariableSetString(pContext->pVariables, sczName, L"[Counter]", FALSE);
+            ExitOnFailure(hr, "Failed to add variable.");
+        }
+    }
+
+LExit:
+    ReleaseStr(sczName);
+    pContext->hr = hr;
+
+    return FAILED(hr) ? 1 : 0;
+}
+
+static DWORD CALLBACK VariableContentionReaderThreadProc(
+    __in LPVOID lpThreadParameter
+    )
+{
+    HRESULT hr = S_OK;
+    VARIABLE_CONTENTION_CONTEXT* pContext = static_cast<VARIABLE_CONTENTION_CONTEXT*>(lpThreadParameter);
+    LONGLONG llValue = 0;
+    LONGLONG llLast = 0;
+    LPWSTR scz = NULL;
+    BOOL f = FALSE;
+
+    for (DWORD i = 0; i < pContext->cIterations; ++i)
+    {
+        // the writer only counts up, so no reader may ever see the counter go backwards
+        hr = VariableGetNumeric(pContext->pVariables, L"Counter", &llValue);
+        ExitOnFailure(hr, "Failed to get counter.");
+
+        if (llValue < llLast)
+        {
+            hr = E_UNEXPECTED;
+            ExitOnRootFailure(hr, "Counter went backwards from %I64d to %I64d.", llLast, llValue);
+        }
+        llLast = llValue;
+
+        hr = VariableGetFormatted(pContext->pVariables, L"Message", &scz);
+        ExitOnFailure(hr, "Failed to format message.");
+
+        if (0 != wcsncmp(scz, L"count=", 6) || _wtoi64(scz + 6) < llLast)
+        {
+            hr = E_UNEXPECTED;
+            ExitOnRootFailure(hr, "Unexpected formatted message: %ls", scz);
+        }
+
+        hr = ConditionEvaluate(pContext->pVariables, L"Counter >= 0 AND Label = \"count\"", &f);
+        ExitOnFailure(hr, "Failed to evaluate condition.");
+
+        if (!f)
+        {
+            hr = E_UNEXPECTED;
+            ExitOnRootFailure(hr, "Condition evaluated to false.");
+        }
+
+        // hidden values are decrypted in place while they are read
+        hr = VariableGetString(pContext->pVariables, L"Secret", &scz);
+        ExitOnFailure(hr, "Failed to get hidden variable.");
+
+        if (CSTR_EQUAL != ::CompareStringW(LOCALE_INVARIANT, 0, scz, -1, L"shh", -1))
+        {
+            hr = E_UNEXPECTED;
+            ExitOnRootFailure(hr, "Unexpected hidden value.");
+        }
+    }
+
+LExit:
+    StrSecureZeroFreeString(scz);
+    pContext->hr = hr;
+
+    return FAILED(hr) ? 1 : 0;
+}
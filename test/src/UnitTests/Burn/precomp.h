@@ -16,6 +16,8 @@
 #include <cryputil.h>
 #include <dlutil.h>
 #include <buffutil.h>
+#include <cabcutil.h>
+#include <chunkutil.h>
 #include <dirutil.h>
 #include <fileutil.h>
 #include <logutil.h>
@@ -34,6 +36,7 @@
 
 #include "IBootstrapperEngine.h"
 #include "IBootstrapperApplication.h"
+#include "BalBaseBootstrapperApplication.h"
 
 #include "platform.h"
 #include "variant.h"
@@ -46,11 +49,13 @@
 #include "catalog.h"
 #include "payload.h"
 #include "cabextract.h"
+#include "chunkextract.h"
 #include "userexperience.h"
 #include "package.h"
 #include "update.h"
 #include "pseudobundle.h"
 #include "registration.h"
+#include "detect.h"
 #include "plan.h"
 #include "pipe.h"
 #include "logging.h"
@@ -68,6 +73,8 @@
 #include "splashscreen.h"
 #include "bitsengine.h"
 
+#include "EngineForApplication.h"
+
 #pragma managed
 #include <vcclr.h>
 
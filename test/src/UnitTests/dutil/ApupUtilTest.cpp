@@ -0,0 +1,160 @@
+// Copyright (c) .NET Foundation and contributors. All rights reserved. Licensed under the Microsoft Reciprocal License. See LICENSE.TXT file in the project root for full license information.
+
+#include "precomp.h"
+
+using namespace System;
+using namespace Xunit;
+
+const LPCWSTR wzApupFeed =
+    L"<?xml version='1.0' encoding='utf-8'?>"
+    L"<feed xmlns='http://www.w3.org/2005/Atom' xmlns:as='http://appsyndication.org/2006/appsyn'>"
+    L"  <title>Test Feed</title>"
+    L"  <entry>"
+    L"    <title>1.0</title>"
+    L"    <as:version>1.0.0.0</as:version>"
+    L"    <link rel='enclosure' href='http://example.com/1.0/setup.exe' length='100'>"
+    L"      <as:digest algorithm='sha256'>0000000000000000000000000000000000000000000000000000000000000000</as:digest>"
+    L"    </link>"
+    L"  </entry>"
+    L"  <entry>"
+    L"    <title>No version</title>"
+    L"    <link rel='enclosure' href='http://example.com/none/setup.exe' length='1' />"
+    L"  </entry>"
+    L"  <entry>"
+    L"    <title>3.0</title>"
+    L"    <summary>Latest</summary>"
+    L"    <content type='text'>Fixes <b>everything</b></content>"
+    L"    <as:version>3.0.0.0</as:version>"
+    L"    <as:upgrade version='2.0.0.0'>upgrade</as:upgrade>"
+    L"    <link rel='alternate' href='http://example.com/3.0/notes.htm' />"
+    L"    <link rel='enclosure' href='http://example.com/3.0/setup.exe' length='300'>"
+    L"      <as:digest algorithm='SHA256'>0102030405060708090A0B0C0D0E0F101112131415161718191A1B1C1D1E1F20</as:digest>"
+    L"    </link>"
+    L"  </entry>"
+    L"  <entry>"
+    L"    <title>2.0</title>"
+    L"    <as:application type='exe'>{Other}</as:application>"
+    L"    <as:version>2.0.0.0</as:version>"
+    L"    <link rel='enclosure' href='http://example.com/2.0/setup.exe' length='200' />"
+    L"  </entry>"
+    L"  <as:application type='msi'>{Default}</as:application>"
+    L"</feed>";
+
+namespace DutilTests
+{
+    public ref class ApupUtil
+    {
+    public:
+        [Fact]
+        void ApupUtilStreamMatchesDocumentTest()
+        {
+            HRESULT hr = S_OK;
+            ATOM_FEED* pFeed = NULL;
+            APPLICATION_UPDATE_CHAIN* pDocumentChain = NULL;
+            APPLICATION_UPDATE_CHAIN* pStreamChain = NULL;
+
+            hr = AtomInitialize();
+            ExitOnFailure(hr, "Failed to initialize Atom.");
+
+            hr = AtomParseFromString(wzApupFeed, &pFeed);
+            ExitOnFailure(hr, "Failed to parse ATOM feed.");
+
+            hr = ApupAllocChainFromAtom(pFeed, &pDocumentChain);
+            ExitOnFailure(hr, "Failed to allocate chain from ATOM feed.");
+
+            hr = ApupAllocChainFromAtomString(wzApupFeed, 0, &pStreamChain);
+            ExitOnFailure(hr, "Failed to stream chain from ATOM feed.");
+
+            Assert::Equal(3, (int)pStreamChain->cEntries);
+            AssertChainsEqual(pDocumentChain, pStreamChain);
+
+            Assert::Equal(gcnew String(L"{Default}"), gcnew String(pStreamChain->wzDefaultApplicationId));
+            Assert::Equal(gcnew String(L"msi"), gcnew String(pStreamChain->wzDefaultApplicationType));
+            Assert::Equal(gcnew String(L"Fixes everything"), gcnew String(pStreamChain->rgEntries[0].wzContent));
+            Assert::Equal(1, (int)pStreamChain->rgEntries[0].cEnclosures);
+            Assert::Equal((BYTE)0x20, pStreamChain->rgEntries[0].rgEnclosures[0].rgbDigest[31]);
+
+        LExit:
+            ReleaseApupChain(pStreamChain);
+            ReleaseApupChain(pDocumentChain);
+            ReleaseAtomFeed(pFeed);
+            AtomUninitialize();
+        }
+
+        [Fact]
+        void ApupUtilStreamMinimumVersionTest()
+        {
+            HRESULT hr = S_OK;
+            ATOM_FEED* pFeed = NULL;
+            APPLICATION_UPDATE_CHAIN* pDocumentChain = NULL;
+            APPLICATION_UPDATE_CHAIN* pStreamChain = NULL;
+            APPLICATION_UPDATE_CHAIN* pDocumentFiltered = NULL;
+            APPLICATION_UPDATE_CHAIN* pStreamFiltered = NULL;
+            DWORD64 dw64Current = MAKEQWORDVERSION(2, 0, 0, 0);
+
+            hr = AtomInitialize();
+            ExitOnFailure(hr, "Failed to initialize Atom.");
+
+            hr = AtomParseFromString(wzApupFeed, &pFeed);
+            ExitOnFailure(hr, "Failed to parse ATOM feed.");
+
+            hr = ApupAllocChainFromAtom(pFeed, &pDocumentChain);
+            ExitOnFailure(hr, "Failed to allocate chain from ATOM feed.");
+
+            hr = ApupAllocChainFromAtomString(wzApupFeed, dw64Current, &pStreamChain);
+            ExitOnFailure(hr, "Failed to stream chain from ATOM feed.");
+
+            // Only 3.0 and 2.0 are at or above the minimum version.
+            Assert::Equal(2, (int)pStreamChain->cEntries);
+
+            hr = ApupFilterChain(pDocumentChain, dw64Current, &pDocumentFiltered);
+            ExitOnFailure(hr, "Failed to filter document chain.");
+
+            hr = ApupFilterChain(pStreamChain, dw64Current, &pStreamFiltered);
+            ExitOnFailure(hr, "Failed to filter stream chain.");
+
+            Assert::Equal(1, (int)pStreamFiltered->cEntries);
+            AssertChainsEqual(pDocumentFiltered, pStreamFiltered);
+
+        LExit:
+            ReleaseApupChain(pStreamFiltered);
+            ReleaseApupChain(pDocumentFiltered);
+            ReleaseApupChain(pStreamChain);
+            ReleaseApupChain(pDocumentChain);
+            ReleaseAtomFeed(pFeed);
+            AtomUninitialize();
+        }
+
+    private:
+        void AssertChainsEqual(APPLICATION_UPDATE_CHAIN* pExpected, APPLICATION_UPDATE_CHAIN* pActual)
+        {
+            Assert::Equal(pExpected->cEntries, pActual->cEntries);
+
+            for (DWORD i = 0; i < pExpected->cEntries; ++i)
+            {
+                APPLICATION_UPDATE_ENTRY* pExpectedEntry = pExpected->rgEntries + i;
+                APPLICATION_UPDATE_ENTRY* pActualEntry = pActual->rgEntries + i;
+
+                Assert::Equal(pExpectedEntry->dw64Version, pActualEntry->dw64Version);
+                Assert::Equal(pExpectedEntry->dw64UpgradeVersion, pActualEntry->dw64UpgradeVersion);
+                Assert::Equal(pExpectedEntry->dw64TotalSize, pActualEntry->dw64TotalSize);
+                Assert::Equal(gcnew String(pExpectedEntry->wzApplicationId), gcnew String(pActualEntry->wzApplicationId));
+                Assert::Equal(gcnew String(pExpectedEntry->wzTitle), gcnew String(pActualEntry->wzTitle));
+                Assert::Equal(gcnew String(pExpectedEntry->wzSummary), gcnew String(pActualEntry->wzSummary));
+                Assert::Equal(gcnew String(pExpectedEntry->wzContentType), gcnew String(pActualEntry->wzContentType));
+                Assert::Equal(pExpectedEntry->cEnclosures, pActualEntry->cEnclosures);
+
+                for (DWORD j = 0; j < pExpectedEntry->cEnclosures; ++j)
+                {
+                    APPLICATION_UPDATE_ENCLOSURE* pExpectedEnclosure = pExpectedEntry->rgEnclosures + j;
+                    APPLICATION_UPDATE_ENCLOSURE* pActualEnclosure = pActualEntry->rgEnclosures + j;
+
+                    Assert::Equal(gcnew String(pExpectedEnclosure->wzUrl), gcnew String(pActualEnclosure->wzUrl));
+                    Assert::Equal(pExpectedEnclosure->dw64Size, pActualEnclosure->dw64Size);
+                    Assert::Equal(pExpectedEnclosure->cbDigest, pActualEnclosure->cbDigest);
+                    Assert::True(0 == memcmp(pExpectedEnclosure->rgbDigest, pActualEnclosure->rgbDigest, pExpectedEnclosure->cbDigest));
+                }
+            }
+        }
+    };
+}
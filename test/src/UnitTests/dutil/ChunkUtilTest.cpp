@@ -0,0 +1,417 @@
+// Copyright (c) .NET Foundation and contributors. All rights reserved. Licensed under the Microsoft Reciprocal License. See LICENSE.TXT file in the project root for full license information.
+
+#include "precomp.h"
+
+using namespace System;
+using namespace System::Text;
+using namespace System::Collections::Generic;
+using namespace Xunit;
+
+namespace CfgTests
+{
+    const DWORD TEST_CHUNK_SIZE = 64 * 1024;
+
+    enum SourceContent
+    {
+        SourceContentText,
+        SourceContentRandom,
+        SourceContentZeros,
+    };
+
+    struct SourceFile
+    {
+        LPCWSTR wzName;
+        DWORD cbFile;
+        SourceContent content;
+    };
+
+    // Sizes around the chunk size so streams start, end and span chunks in every way.
+    static const SourceFile vrgSources[] =
+    {
+        { L"empty.txt", 0, SourceContentText },
+        { L"small.txt", 100, SourceContentText },
+        { L"onechunk.txt", TEST_CHUNK_SIZE, SourceContentText },
+        { L"empty2.txt", 0, SourceContentText },
+        { L"manychunks.txt", 3 * TEST_CHUNK_SIZE + 123, SourceContentText },
+        { L"random.bin", 200000, SourceContentRandom },
+        { L"zeros.bin", 300000, SourceContentZeros },
+    };
+
+    public ref class ChunkUtil
+    {
+    public:
+        [Fact]
+        void ChunkUtilRoundTripTest()
+        {
+            HRESULT hr = S_OK;
+            LPWSTR sczTempDir = NULL;
+            LPWSTR sczContainer = NULL;
+            LPWSTR sczAttached = NULL;
+            LPWSTR sczSource = NULL;
+            HANDLE hWriter = NULL;
+            HANDLE hFile = INVALID_HANDLE_VALUE;
+            HANDLE hReader = NULL;
+            BYTE* pbContainer = NULL;
+            DWORD cbContainer = 0;
+            BYTE* pbAttached = NULL;
+
+            hr = PathExpand(&sczTempDir, L"%TEMP%\\ChunkUtilTest\\", PATH_EXPAND_ENVIRONMENT);
+            ExitOnFailure(hr, "Failed to get temp dir");
+
+            hr = DirEnsureExists(sczTempDir, NULL);
+            ExitOnFailure1(hr, "Failed to ensure directory exists: %ls", sczTempDir);
+
+            hr = PathConcat(sczTempDir, L"container.chunks", &sczContainer);
+            ExitOnFailure(hr, "Failed to create path to container");
+
+            hr = ChunkWriteBegin(sczContainer, TEST_CHUNK_SIZE, &hWriter);
+            ExitOnFailure(hr, "Failed to begin container");
+
+            for (DWORD i = 0; i < countof(vrgSources); ++i)
+            {
+                ReleaseNullStr(sczSource);
+                sczSource = CreateSourceFile(sczTempDir, vrgSources + i);
+
+                hr = ChunkWriteAddFile(hWriter, sczSource, vrgSources[i].wzName);
+                ExitOnFailure1(hr, "Failed to add file to container: %ls", vrgSources[i].wzName);
+            }
+
+            // A second stream with the same name is refused and leaves the container usable.
+            hr = ChunkWriteAddFile(hWriter, sczSource, vrgSources[1].wzName);
+            Assert::Equal(HRESULT_FROM_WIN32(ERROR_DUP_NAME), hr);
+
+            hr = ChunkWriteFinish(hWriter);
+            hWriter = NULL;
+            ExitOnFailure(hr, "Failed to finish container");
+
+            hFile = ::CreateFileW(sczContainer, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+            ExitOnInvalidHandleWithLastError1(hFile, hr, "Failed to open container: %ls", sczContainer);
+
+            hr = ChunkReadOpen(hFile, 0, 0, &hReader);
+            ExitOnFailure(hr, "Failed to open container for reading");
+
+            ReleaseFileHandle(hFile);
+
+            VerifyStreams(hReader);
+            VerifyRandomAccess(hReader, sczTempDir);
+            VerifyStreamsToFiles(hReader, sczTempDir, 1);
+            VerifyStreamsToFiles(hReader, sczTempDir, 4);
+
+            ReleaseNullChunkReader(hReader);
+
+            // The same container after other data, like a container attached to a bundle.
+            hr = FileRead(&pbContainer, &cbContainer, sczContainer);
+            ExitOnFailure(hr, "Failed to read container");
+
+            pbAttached = static_cast<BYTE*>(MemAlloc(cbContainer + 1000, FALSE));
+            ExitOnNull(pbAttached, hr, E_OUTOFMEMORY, "Failed to allocate attached container");
+
+            memset(pbAttached, 0xCC, 1000);
+            memcpy(pbAttached + 1000, pbContainer, cbContainer);
+
+            hr = PathConcat(sczTempDir, L"attached.exe", &sczAttached);
+            ExitOnFailure(hr, "Failed to create path to attached container");
+
+            hr = FileWrite(sczAttached, FILE_ATTRIBUTE_NORMAL, pbAttached, cbContainer + 1000, NULL);
+            ExitOnFailure(hr, "Failed to write attached container");
+
+            hFile = ::CreateFileW(sczAttached, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+            ExitOnInvalidHandleWithLastError1(hFile, hr, "Failed to open attached container: %ls", sczAttached);
+
+            hr = ChunkReadOpen(hFile, 1000, cbContainer, &hReader);
+            ExitOnFailure(hr, "Failed to open attached container for reading");
+
+            VerifyRandomAccess(hReader, sczTempDir);
+            ReleaseNullChunkReader(hReader);
+
+            // A truncated container is refused.
+            hr = ChunkReadOpen(hFile, 1000, cbContainer - 1, &hReader);
+            Assert::True(FAILED(hr));
+            Assert::True(NULL == hReader);
+
+            ReleaseFileHandle(hFile);
+
+            // So is a container with a damaged header.
+            pbContainer[0] ^= 0xFF;
+
+            hr = FileWrite(sczAttached, FILE_ATTRIBUTE_NORMAL, pbContainer, cbContainer, NULL);
+            ExitOnFailure(hr, "Failed to write damaged container");
+
+            hFile = ::CreateFileW(sczAttached, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+            ExitOnInvalidHandleWithLastError1(hFile, hr, "Failed to open damaged container: %ls", sczAttached);
+
+            hr = ChunkReadOpen(hFile, 0, 0, &hReader);
+            Assert::Equal(HRESULT_FROM_WIN32(ERROR_INVALID_DATA), hr);
+
+            ReleaseFileHandle(hFile);
+
+            hr = DirEnsureDelete(sczTempDir, TRUE, TRUE);
+
+        LExit:
+            if (hWriter)
+            {
+                ChunkWriteCancel(hWriter);
+            }
+            ReleaseChunkReader(hReader);
+            ReleaseFileHandle(hFile);
+            ReleaseMem(pbAttached);
+            ReleaseMem(pbContainer);
+            ReleaseStr(sczSource);
+            ReleaseStr(sczAttached);
+            ReleaseStr(sczContainer);
+            ReleaseStr(sczTempDir);
+
+            return;
+        }
+
+        [Fact]
+        void ChunkUtilFailedAddTest()
+        {
+            HRESULT hr = S_OK;
+            LPWSTR sczTempDir = NULL;
+            LPWSTR sczContainer = NULL;
+            LPWSTR sczSmall = NULL;
+            LPWSTR sczLocked = NULL;
+            HANDLE hWriter = NULL;
+            HANDLE hLocked = INVALID_HANDLE_VALUE;
+            HRESULT hrAdd = S_OK;
+
+            hr = PathExpand(&sczTempDir, L"%TEMP%\\ChunkUtilFailedAddTest\\", PATH_EXPAND_ENVIRONMENT);
+            ExitOnFailure(hr, "Failed to get temp dir");
+
+            hr = DirEnsureExists(sczTempDir, NULL);
+            ExitOnFailure1(hr, "Failed to ensure directory exists: %ls", sczTempDir);
+
+            hr = PathConcat(sczTempDir, L"container.chunks", &sczContainer);
+            ExitOnFailure(hr, "Failed to create path to container");
+
+            sczSmall = CreateSourceFile(sczTempDir, vrgSources + 1);
+            sczLocked = CreateSourceFile(sczTempDir, vrgSources + 4);
+
+            // Lock all but the first chunk of the file so reading it fails once the first chunk is written.
+            hLocked = ::CreateFileW(sczLocked, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+            ExitOnInvalidHandleWithLastError1(hLocked, hr, "Failed to open file to lock: %ls", sczLocked);
+
+            if (!::LockFile(hLocked, TEST_CHUNK_SIZE, 0, vrgSources[4].cbFile - TEST_CHUNK_SIZE, 0))
+            {
+                ExitWithLastError1(hr, "Failed to lock file: %ls", sczLocked);
+            }
+
+            hr = ChunkWriteBegin(sczContainer, TEST_CHUNK_SIZE, &hWriter);
+            ExitOnFailure(hr, "Failed to begin container");
+
+            hr = ChunkWriteAddFile(hWriter, sczSmall, vrgSources[1].wzName);
+            ExitOnFailure(hr, "Failed to add file to container");
+
+            hrAdd = ChunkWriteAddFile(hWriter, sczLocked, vrgSources[4].wzName);
+            Assert::True(FAILED(hrAdd));
+
+            // Nothing more can be added and the partial container is not finished.
+            hr = ChunkWriteAddFile(hWriter, sczSmall, L"after.txt");
+            Assert::Equal(hrAdd, hr);
+
+            hr = ChunkWriteFinish(hWriter);
+            hWriter = NULL;
+            Assert::Equal(hrAdd, hr);
+            Assert::Equal(INVALID_FILE_ATTRIBUTES, ::GetFileAttributesW(sczContainer));
+
+            ReleaseFileHandle(hLocked);
+
+            hr = DirEnsureDelete(sczTempDir, TRUE, TRUE);
+
+        LExit:
+            if (hWriter)
+            {
+                ChunkWriteCancel(hWriter);
+            }
+            ReleaseFileHandle(hLocked);
+            ReleaseStr(sczLocked);
+            ReleaseStr(sczSmall);
+            ReleaseStr(sczContainer);
+            ReleaseStr(sczTempDir);
+
+            return;
+        }
+
+    private:
+        void VerifyStreams(HANDLE hReader)
+        {
+            HRESULT hr = S_OK;
+            LPCWSTR wzStreamName = NULL;
+            DWORD64 qwSize = 0;
+            DWORD iStream = 0;
+
+            Assert::Equal((DWORD)countof(vrgSources), ChunkReadGetStreamCount(hReader));
+
+            for (DWORD i = 0; i < countof(vrgSources); ++i)
+            {
+                hr = ChunkReadGetStream(hReader, i, &wzStreamName, &qwSize);
+                ExitOnFailure1(hr, "Failed to get stream: %u", i);
+
+                Assert::Equal(gcnew String(vrgSources[i].wzName), gcnew String(wzStreamName));
+                Assert::Equal((DWORD64)vrgSources[i].cbFile, qwSize);
+
+                hr = ChunkReadFindStream(hReader, vrgSources[i].wzName, &iStream);
+                ExitOnFailure1(hr, "Failed to find stream: %ls", vrgSources[i].wzName);
+
+                Assert::Equal(i, iStream);
+            }
+
+            hr = ChunkReadFindStream(hReader, L"missing.txt", &iStream);
+            Assert::Equal(E_NOTFOUND, hr);
+
+        LExit:
+            return;
+        }
+
+        void VerifyRandomAccess(HANDLE hReader, LPCWSTR wzTempDir)
+        {
+            HRESULT hr = S_OK;
+            BYTE* pbStream = NULL;
+            SIZE_T cbStream = 0;
+            LPWSTR sczTarget = NULL;
+
+            hr = PathConcat(wzTempDir, L"single.out", &sczTarget);
+            ExitOnFailure(hr, "Failed to create path to single stream target");
+
+            // Backwards, so no stream is read after the one before it.
+            for (DWORD i = countof(vrgSources); i > 0; --i)
+            {
+                hr = ChunkReadStreamToBuffer(hReader, i - 1, &pbStream, &cbStream);
+                ExitOnFailure1(hr, "Failed to read stream to buffer: %ls", vrgSources[i - 1].wzName);
+
+                VerifyContent(wzTempDir, vrgSources + i - 1, pbStream, cbStream);
+                ReleaseNullMem(pbStream);
+
+                hr = ChunkReadStreamToFile(hReader, i - 1, sczTarget);
+                ExitOnFailure1(hr, "Failed to read stream to file: %ls", vrgSources[i - 1].wzName);
+
+                VerifyFile(wzTempDir, vrgSources + i - 1, sczTarget);
+            }
+
+        LExit:
+            ReleaseMem(pbStream);
+            ReleaseStr(sczTarget);
+        }
+
+        void VerifyStreamsToFiles(HANDLE hReader, LPCWSTR wzTempDir, DWORD cThreads)
+        {
+            HRESULT hr = S_OK;
+            CHUNK_EXTRACT_STREAM rgStreams[countof(vrgSources) + 1] = { };
+            LPWSTR rgsczTargets[countof(vrgSources) + 1] = { };
+            DWORD cStreams = 0;
+
+            // Every other stream, plus one the container does not have.
+            for (DWORD i = 0; i < countof(vrgSources); i += 2)
+            {
+                hr = StrAllocFormatted(rgsczTargets + cStreams, L"%ls%ls.%u.out", wzTempDir, vrgSources[i].wzName, cThreads);
+                ExitOnFailure(hr, "Failed to format target path");
+
+                rgStreams[cStreams].wzStreamName = vrgSources[i].wzName;
+                rgStreams[cStreams].wzTargetFile = rgsczTargets[cStreams];
+                ++cStreams;
+            }
+
+            hr = StrAllocFormatted(rgsczTargets + cStreams, L"%lsmissing.%u.out", wzTempDir, cThreads);
+            ExitOnFailure(hr, "Failed to format target path");
+
+            rgStreams[cStreams].wzStreamName = L"missing.txt";
+            rgStreams[cStreams].wzTargetFile = rgsczTargets[cStreams];
+            ++cStreams;
+
+            hr = ChunkReadStreamsToFiles(hReader, rgStreams, cStreams, cThreads);
+            ExitOnFailure1(hr, "Failed to read streams to files on %u threads", cThreads);
+
+            for (DWORD i = 0; i < cStreams - 1; ++i)
+            {
+                Assert::True(rgStreams[i].fExtracted);
+                VerifyFile(wzTempDir, vrgSources + 2 * i, rgsczTargets[i]);
+            }
+
+            Assert::False(rgStreams[cStreams - 1].fExtracted);
+            Assert::Equal(INVALID_FILE_ATTRIBUTES, ::GetFileAttributesW(rgsczTargets[cStreams - 1]));
+
+        LExit:
+            for (DWORD i = 0; i < countof(rgsczTargets); ++i)
+            {
+                ReleaseStr(rgsczTargets[i]);
+            }
+        }
+
+        void VerifyFile(LPCWSTR wzTempDir, const SourceFile* pSource, LPCWSTR wzFile)
+        {
+            HRESULT hr = S_OK;
+            BYTE* pbFile = NULL;
+            DWORD cbFile = 0;
+
+            hr = FileRead(&pbFile, &cbFile, wzFile);
+            ExitOnFailure1(hr, "Failed to read extracted file: %ls", wzFile);
+
+            VerifyContent(wzTempDir, pSource, pbFile, cbFile);
+
+        LExit:
+            ReleaseMem(pbFile);
+        }
+
+        void VerifyContent(LPCWSTR wzTempDir, const SourceFile* pSource, const BYTE* pbContent, SIZE_T cbContent)
+        {
+            HRESULT hr = S_OK;
+            LPWSTR sczSource = NULL;
+            BYTE* pbSource = NULL;
+            DWORD cbSource = 0;
+
+            hr = PathConcat(wzTempDir, pSource->wzName, &sczSource);
+            ExitOnFailure(hr, "Failed to create path to source file");
+
+            hr = FileRead(&pbSource, &cbSource, sczSource);
+            ExitOnFailure1(hr, "Failed to read source file: %ls", sczSource);
+
+            Assert::Equal((SIZE_T)cbSource, cbContent);
+            Assert::True(0 == cbSource || 0 == memcmp(pbSource, pbContent, cbSource));
+
+        LExit:
+            ReleaseMem(pbSource);
+            ReleaseStr(sczSource);
+        }
+
+        LPWSTR CreateSourceFile(LPCWSTR wzTempDir, const SourceFile* pSource)
+        {
+            HRESULT hr = S_OK;
+            LPWSTR sczSource = NULL;
+            BYTE* pbSource = NULL;
+            DWORD dwSeed = pSource->cbFile;
+
+            hr = PathConcat(wzTempDir, pSource->wzName, &sczSource);
+            ExitOnFailure(hr, "Failed to create path to source file");
+
+            pbSource = static_cast<BYTE*>(MemAlloc(max(pSource->cbFile, 1UL), TRUE));
+            ExitOnNull(pbSource, hr, E_OUTOFMEMORY, "Failed to allocate source file content");
+
+            for (DWORD i = 0; i < pSource->cbFile; ++i)
+            {
+                switch (pSource->content)
+                {
+                case SourceContentText:
+                    pbSource[i] = static_cast<BYTE>('a' + (i / 7) % 26);
+                    break;
+
+                case SourceContentRandom:
+                    dwSeed = dwSeed * 1103515245 + 12345;
+                    pbSource[i] = static_cast<BYTE>(dwSeed >> 16);
+                    break;
+
+                case SourceContentZeros: // already zeroed by the allocation.
+                    break;
+                }
+            }
+
+            hr = FileWrite(sczSource, FILE_ATTRIBUTE_NORMAL, pbSource, pSource->cbFile, NULL);
+            ExitOnFailure1(hr, "Failed to write source file: %ls", sczSource);
+
+        LExit:
+            ReleaseMem(pbSource);
+
+            return sczSource;
+        }
+    };
+}
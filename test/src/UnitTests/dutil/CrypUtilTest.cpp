@@ -0,0 +1,193 @@
+// Copyright (c) .NET Foundation and contributors. All rights reserved. Licensed under the Microsoft Reciprocal License. See LICENSE.TXT file in the project root for full license information.
+
+#include "precomp.h"
+
+using namespace System;
+using namespace System::Text;
+using namespace System::Collections::Generic;
+using namespace Xunit;
+
+namespace CfgTests
+{
+    struct HashProgress
+    {
+        DWORD cCalls;
+        DWORD64 qwLastHashed;
+        DWORD64 qwTotal;
+    };
+
+    static HRESULT HashProgressRoutine(
+        __in DWORD64 qwBytesHashed,
+        __in DWORD64 qwTotalBytes,
+        __in_opt LPVOID pvContext
+        )
+    {
+        HashProgress* pProgress = static_cast<HashProgress*>(pvContext);
+
+        ++pProgress->cCalls;
+        pProgress->qwLastHashed = qwBytesHashed;
+        pProgress->qwTotal = qwTotalBytes;
+
+        return S_OK;
+    }
+
+    public ref class CrypUtil
+    {
+    public:
+        [Fact]
+        void CrypUtilHashFileTest()
+        {
+            HRESULT hr = S_OK;
+            LPWSTR sczTempDir = NULL;
+            LPWSTR sczFile = NULL;
+
+            hr = PathExpand(&sczTempDir, L"%TEMP%\\CrypUtilTest\\", PATH_EXPAND_ENVIRONMENT);
+            ExitOnFailure(hr, "Failed to get temp dir");
+
+            hr = DirEnsureExists(sczTempDir, NULL);
+            ExitOnFailure1(hr, "Failed to ensure directory exists: %ls", sczTempDir);
+
+            hr = PathConcat(sczTempDir, L"hash.bin", &sczFile);
+            ExitOnFailure(hr, "Failed to create path to test file");
+
+            // Empty, odd-sized and larger-than-one-read files.
+            TestHashFile(sczFile, 0);
+            TestHashFile(sczFile, 12345);
+            TestHashFile(sczFile, 3 * 1024 * 1024 + 17);
+
+            // Large enough to show the difference between the read strategies.
+            TestHashFile(sczFile, 256 * 1024 * 1024);
+
+            hr = DirEnsureDelete(sczTempDir, TRUE, TRUE);
+
+        LExit:
+            ReleaseStr(sczTempDir);
+            ReleaseStr(sczFile);
+
+            return;
+        }
+
+    private:
+        void TestHashFile(LPCWSTR wzFile, DWORD cbFile)
+        {
+            CreateSyntheticFile(wzFile, cbFile);
+
+            TestHashAlgorithm(wzFile, cbFile, PROV_RSA_FULL, CALG_SHA1, SHA1_HASH_LEN, "SHA-1");
+            TestHashAlgorithm(wzFile, cbFile, PROV_RSA_AES, CALG_SHA_256, SHA256_HASH_LEN, "SHA-256");
+            TestHashAlgorithm(wzFile, cbFile, PROV_RSA_AES, CALG_SHA_512, SHA512_HASH_LEN, "SHA-512");
+
+            ::DeleteFileW(wzFile);
+        }
+
+        void TestHashAlgorithm(LPCWSTR wzFile, DWORD cbFile, DWORD dwProvType, ALG_ID algid, DWORD cbHash, LPCSTR szAlgorithm)
+        {
+            HRESULT hr = S_OK;
+            HANDLE hFile = INVALID_HANDLE_VALUE;
+            BYTE rgbExpected[SHA512_HASH_LEN] = { };
+            BYTE rgbSynchronous[SHA512_HASH_LEN] = { };
+            BYTE rgbOverlapped[SHA512_HASH_LEN] = { };
+            DWORD64 qwHashed = 0;
+            HashProgress progress = { };
+            System::Diagnostics::Stopwatch^ stopwatch = nullptr;
+
+            // Baseline: the existing small-buffer synchronous hash.
+            hFile = ::CreateFileW(wzFile, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+            ExitOnInvalidHandleWithLastError1(hFile, hr, "Failed to open file: %ls", wzFile);
+
+            stopwatch = System::Diagnostics::Stopwatch::StartNew();
+            hr = CrypHashFileHandle(hFile, dwProvType, algid, rgbExpected, cbHash, &qwHashed);
+            ExitOnFailure(hr, "Failed to hash file with CrypHashFileHandle.");
+            stopwatch->Stop();
+            Console::WriteLine("{0} of {1} bytes with CrypHashFileHandle: {2} ms", gcnew String(szAlgorithm), cbFile, stopwatch->ElapsedMilliseconds);
+
+            Assert::Equal((DWORD64)cbFile, qwHashed);
+            ReleaseFileHandle(hFile);
+
+            // Double-buffered reads on a synchronous handle.
+            hFile = ::CreateFileW(wzFile, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+            ExitOnInvalidHandleWithLastError1(hFile, hr, "Failed to open file: %ls", wzFile);
+
+            stopwatch = System::Diagnostics::Stopwatch::StartNew();
+            hr = CrypHashFileHandleWithProgress(hFile, dwProvType, algid, rgbSynchronous, cbHash, HashProgressRoutine, &progress, &qwHashed);
+            ExitOnFailure(hr, "Failed to hash synchronous file with progress.");
+            stopwatch->Stop();
+            Console::WriteLine("{0} of {1} bytes with progress, synchronous handle: {2} ms", gcnew String(szAlgorithm), cbFile, stopwatch->ElapsedMilliseconds);
+
+            Assert::Equal((DWORD64)cbFile, qwHashed);
+            Assert::Equal(0, memcmp(rgbExpected, rgbSynchronous, cbHash));
+            VerifyProgress(&progress, cbFile);
+            ReleaseFileHandle(hFile);
+
+            // Double-buffered reads on an overlapped handle.
+            memset(&progress, 0, sizeof(progress));
+
+            hFile = ::CreateFileW(wzFile, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN | FILE_FLAG_OVERLAPPED, NULL);
+            ExitOnInvalidHandleWithLastError1(hFile, hr, "Failed to open file: %ls", wzFile);
+
+            stopwatch = System::Diagnostics::Stopwatch::StartNew();
+            hr = CrypHashFileHandleWithProgress(hFile, dwProvType, algid, rgbOverlapped, cbHash, HashProgressRoutine, &progress, &qwHashed);
+            ExitOnFailure(hr, "Failed to hash overlapped file with progress.");
+            stopwatch->Stop();
+            Console::WriteLine("{0} of {1} bytes with progress, overlapped handle: {2} ms", gcnew String(szAlgorithm), cbFile, stopwatch->ElapsedMilliseconds);
+
+            Assert::Equal((DWORD64)cbFile, qwHashed);
+            Assert::Equal(0, memcmp(rgbExpected, rgbOverlapped, cbHash));
+            VerifyProgress(&progress, cbFile);
+
+        LExit:
+            ReleaseFileHandle(hFile);
+        }
+
+        void VerifyProgress(HashProgress* pProgress, DWORD cbFile)
+        {
+            if (cbFile)
+            {
+                Assert::True(0 < pProgress->cCalls);
+                Assert::Equal((DWORD64)cbFile, pProgress->qwLastHashed);
+                Assert::Equal((DWORD64)cbFile, pProgress->qwTotal);
+            }
+            else
+            {
+                Assert::Equal((DWORD)0, pProgress->cCalls);
+            }
+        }
+
+        void CreateSyntheticFile(LPCWSTR wzFile, DWORD cbFile)
+        {
+            HRESULT hr = S_OK;
+            HANDLE hFile = INVALID_HANDLE_VALUE;
+            BYTE* pbBlock = NULL;
+            DWORD cbBlock = 64 * 1024;
+            DWORD cbRemaining = cbFile;
+            DWORD cbWrite = 0;
+            DWORD cbWritten = 0;
+
+            pbBlock = static_cast<BYTE*>(MemAlloc(cbBlock, FALSE));
+            ExitOnNull(pbBlock, hr, E_OUTOFMEMORY, "Failed to allocate block.");
+
+            hFile = ::CreateFileW(wzFile, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+            ExitOnInvalidHandleWithLastError1(hFile, hr, "Failed to create file: %ls", wzFile);
+
+            while (cbRemaining)
+            {
+                // Vary the content by block so a hash over a misplaced or repeated block would not match.
+                for (DWORD i = 0; i < cbBlock; ++i)
+                {
+                    pbBlock[i] = static_cast<BYTE>(((cbFile - cbRemaining) / cbBlock) * 131 + i * 31 + 7);
+                }
+
+                cbWrite = min(cbBlock, cbRemaining);
+                if (!::WriteFile(hFile, pbBlock, cbWrite, &cbWritten, NULL))
+                {
+                    ExitWithLastError1(hr, "Failed to write to file: %ls", wzFile);
+                }
+
+                cbRemaining -= cbWritten;
+            }
+
+        LExit:
+            ReleaseFileHandle(hFile);
+            ReleaseMem(pbBlock);
+        }
+    };
+}
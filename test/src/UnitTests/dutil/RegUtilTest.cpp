@@ -0,0 +1,230 @@
+// Copyright (c) .NET Foundation and contributors. All rights reserved. Licensed under the Microsoft Reciprocal License. See LICENSE.TXT file in the project root for full license information.
+
+#include "precomp.h"
+
+using namespace System;
+using namespace System::Text;
+using namespace System::Collections::Generic;
+using namespace Xunit;
+
+namespace CfgTests
+{
+    const LPCWSTR TEST_REGISTRY_KEY = L"Software\\WiX\\UnitTest\\RegUtilTest";
+    const BYTE TEST_BINARY_VALUE[] = { 0x00, 0x01, 0x02, 0xFE, 0xFF };
+
+    public ref class RegUtil
+    {
+    public:
+        [Fact]
+        void RegUtilSnapshotTest()
+        {
+            HRESULT hr = S_OK;
+            BOOL fRegInitialized = FALSE;
+            HKEY hk = NULL;
+            REG_SNAPSHOT_HANDLE hSnapshot = NULL;
+            LPWSTR sczValue = NULL;
+            LPWSTR sczSnapshotValue = NULL;
+            BYTE* pbValue = NULL;
+            SIZE_T cbValue = 0;
+            BYTE* pbSnapshotValue = NULL;
+            SIZE_T cbSnapshotValue = 0;
+            DWORD dwValue = 0;
+            DWORD dwSnapshotValue = 0;
+            DWORD64 qwValue = 0;
+            DWORD64 qwSnapshotValue = 0;
+            DWORD dwType = 0;
+            LPCWSTR rgwzNames[] = { NULL, L"String", L"Unterminated", L"Expand", L"Number", L"Qword", L"Binary", L"EmptyBinary", L"Version" };
+            LPCWSTR wzUnterminated = L"Unterminated";
+
+            hr = RegInitialize();
+            ExitOnFailure(hr, "Failed to initialize regutil.");
+            fRegInitialized = TRUE;
+
+            hr = RegDelete(HKEY_CURRENT_USER, TEST_REGISTRY_KEY, REG_KEY_DEFAULT, TRUE);
+            if (E_FILENOTFOUND == hr)
+            {
+                hr = S_OK;
+            }
+            ExitOnFailure(hr, "Failed to delete test key.");
+
+            // A key that doesn't exist has no snapshot.
+            hr = RegSnapshotOpen(HKEY_CURRENT_USER, TEST_REGISTRY_KEY, KEY_READ, &hSnapshot);
+            Assert::Equal(E_FILENOTFOUND, hr);
+            Assert::True(NULL == hSnapshot);
+
+            hr = RegCreate(HKEY_CURRENT_USER, TEST_REGISTRY_KEY, KEY_ALL_ACCESS, &hk);
+            ExitOnFailure(hr, "Failed to create test key.");
+
+            hr = RegWriteString(hk, NULL, L"Default");
+            ExitOnFailure(hr, "Failed to write default value.");
+
+            hr = RegWriteString(hk, L"String", L"Value");
+            ExitOnFailure(hr, "Failed to write string value.");
+
+            // Nothing stops a string from being written without its null terminator.
+            hr = HRESULT_FROM_WIN32(::RegSetValueExW(hk, L"Unterminated", 0, REG_SZ, reinterpret_cast<const BYTE*>(wzUnterminated), lstrlenW(wzUnterminated) * sizeof(WCHAR)));
+            ExitOnFailure(hr, "Failed to write unterminated string value.");
+
+            hr = HRESULT_FROM_WIN32(::RegSetValueExW(hk, L"Expand", 0, REG_EXPAND_SZ, reinterpret_cast<const BYTE*>(L"%TEMP%\\Expand"), sizeof(L"%TEMP%\\Expand")));
+            ExitOnFailure(hr, "Failed to write expand string value.");
+
+            hr = RegWriteNumber(hk, L"Number", 0x12345678);
+            ExitOnFailure(hr, "Failed to write number value.");
+
+            hr = RegWriteQword(hk, L"Qword", 0x0123456789ABCDEF);
+            ExitOnFailure(hr, "Failed to write qword value.");
+
+            hr = RegWriteBinary(hk, L"Binary", TEST_BINARY_VALUE, sizeof(TEST_BINARY_VALUE));
+            ExitOnFailure(hr, "Failed to write binary value.");
+
+            hr = RegWriteBinary(hk, L"EmptyBinary", NULL, 0);
+            ExitOnFailure(hr, "Failed to write empty binary value.");
+
+            hr = RegWriteString(hk, L"Version", L"1.2.3.4");
+            ExitOnFailure(hr, "Failed to write version value.");
+
+            hr = RegSnapshotOpen(HKEY_CURRENT_USER, TEST_REGISTRY_KEY, KEY_READ, &hSnapshot);
+            ExitOnFailure(hr, "Failed to open snapshot.");
+
+            for (DWORD i = 0; i < countof(rgwzNames); ++i)
+            {
+                AssertSameValue(hk, hSnapshot, rgwzNames[i]);
+            }
+
+            // The typed reads agree with the ones that query the key.
+            for (DWORD i = 0; i < 4; ++i)
+            {
+                hr = RegReadString(hk, rgwzNames[i], &sczValue);
+                ExitOnFailure1(hr, "Failed to read string value: %ls", rgwzNames[i]);
+
+                hr = RegSnapshotReadString(hSnapshot, rgwzNames[i], &sczSnapshotValue);
+                ExitOnFailure1(hr, "Failed to read string value from snapshot: %ls", rgwzNames[i]);
+
+                Assert::Equal(gcnew String(sczValue), gcnew String(sczSnapshotValue));
+            }
+
+            hr = RegReadNumber(hk, L"Number", &dwValue);
+            ExitOnFailure(hr, "Failed to read number value.");
+
+            hr = RegSnapshotReadNumber(hSnapshot, L"Number", &dwSnapshotValue);
+            ExitOnFailure(hr, "Failed to read number value from snapshot.");
+            Assert::Equal(dwValue, dwSnapshotValue);
+
+            hr = RegReadQword(hk, L"Qword", &qwValue);
+            ExitOnFailure(hr, "Failed to read qword value.");
+
+            hr = RegSnapshotReadQword(hSnapshot, L"Qword", &qwSnapshotValue);
+            ExitOnFailure(hr, "Failed to read qword value from snapshot.");
+            Assert::Equal(qwValue, qwSnapshotValue);
+
+            hr = RegReadVersion(hk, L"Version", &qwValue);
+            ExitOnFailure(hr, "Failed to read version value.");
+
+            hr = RegSnapshotReadVersion(hSnapshot, L"Version", &qwSnapshotValue);
+            ExitOnFailure(hr, "Failed to read version value from snapshot.");
+            Assert::Equal(qwValue, qwSnapshotValue);
+
+            hr = RegReadBinary(hk, L"Binary", &pbValue, &cbValue);
+            ExitOnFailure(hr, "Failed to read binary value.");
+
+            hr = RegSnapshotReadBinary(hSnapshot, L"Binary", &pbSnapshotValue, &cbSnapshotValue);
+            ExitOnFailure(hr, "Failed to read binary value from snapshot.");
+            Assert::Equal(cbValue, cbSnapshotValue);
+            Assert::Equal(0, memcmp(pbValue, pbSnapshotValue, cbValue));
+
+            // Names are case insensitive and missing values are reported the same way.
+            AssertSameValue(hk, hSnapshot, L"NUMBER");
+            AssertSameValue(hk, hSnapshot, L"Missing");
+
+            hr = RegSnapshotReadNumber(hSnapshot, L"String", &dwSnapshotValue);
+            Assert::Equal(HRESULT_FROM_WIN32(ERROR_INVALID_DATATYPE), hr);
+
+            // Changes to the key are not seen until the snapshot is invalidated.
+            hr = RegWriteString(hk, L"String", L"Changed");
+            ExitOnFailure(hr, "Failed to change string value.");
+
+            hr = HRESULT_FROM_WIN32(::RegDeleteValueW(hk, L"Number"));
+            ExitOnFailure(hr, "Failed to delete number value.");
+
+            hr = RegWriteString(hk, L"Added", L"New");
+            ExitOnFailure(hr, "Failed to add string value.");
+
+            hr = RegSnapshotReadString(hSnapshot, L"String", &sczSnapshotValue);
+            ExitOnFailure(hr, "Failed to read string value from snapshot.");
+            Assert::Equal(gcnew String(L"Value"), gcnew String(sczSnapshotValue));
+
+            hr = RegSnapshotGetType(hSnapshot, L"Number", &dwType);
+            ExitOnFailure(hr, "Failed to get type of number value from snapshot.");
+            Assert::Equal<DWORD>(REG_DWORD, dwType);
+
+            hr = RegSnapshotInvalidate(hSnapshot);
+            ExitOnFailure(hr, "Failed to invalidate snapshot.");
+
+            for (DWORD i = 0; i < countof(rgwzNames); ++i)
+            {
+                AssertSameValue(hk, hSnapshot, rgwzNames[i]);
+            }
+
+            AssertSameValue(hk, hSnapshot, L"Added");
+
+            hr = RegSnapshotGetType(hSnapshot, L"Number", &dwType);
+            Assert::Equal(E_FILENOTFOUND, hr);
+
+        LExit:
+            ReleaseStr(sczValue);
+            ReleaseStr(sczSnapshotValue);
+            ReleaseMem(pbValue);
+            ReleaseMem(pbSnapshotValue);
+            ReleaseRegSnapshot(hSnapshot);
+            ReleaseRegKey(hk);
+            RegDelete(HKEY_CURRENT_USER, TEST_REGISTRY_KEY, REG_KEY_DEFAULT, TRUE);
+
+            if (fRegInitialized)
+            {
+                RegUninitialize();
+            }
+        }
+
+    private:
+        void AssertSameValue(HKEY hk, REG_SNAPSHOT_HANDLE hSnapshot, LPCWSTR wzName)
+        {
+            HRESULT hr = S_OK;
+            DWORD er = ERROR_SUCCESS;
+            DWORD dwType = 0;
+            DWORD cbData = 0;
+            BYTE* pbData = NULL;
+            DWORD dwSnapshotType = 0;
+            DWORD cbSnapshotData = 0;
+            BYTE* pbSnapshotData = NULL;
+
+            er = ::RegQueryValueExW(hk, wzName, NULL, &dwType, NULL, &cbData);
+            hr = RegSnapshotReadValue(hSnapshot, wzName, &dwSnapshotType, &pbSnapshotData, &cbSnapshotData);
+
+            if (ERROR_FILE_NOT_FOUND == er)
+            {
+                Assert::Equal(E_FILENOTFOUND, hr);
+                ExitFunction1(hr = S_OK);
+            }
+            ExitOnWin32Error1(er, hr, "Failed to query size of registry value: %ls", wzName);
+            ExitOnFailure1(hr, "Failed to read registry value from snapshot: %ls", wzName);
+
+            pbData = static_cast<BYTE*>(MemAlloc(cbData + sizeof(WCHAR), TRUE));
+            ExitOnNull(pbData, hr, E_OUTOFMEMORY, "Failed to allocate registry value.");
+
+            er = ::RegQueryValueExW(hk, wzName, NULL, &dwType, pbData, &cbData);
+            ExitOnWin32Error1(er, hr, "Failed to query registry value: %ls", wzName);
+
+            Assert::Equal(dwType, dwSnapshotType);
+            Assert::Equal(cbData, cbSnapshotData);
+            Assert::Equal(0, memcmp(pbData, pbSnapshotData, cbData));
+
+            // The snapshot terminates strings even when the registry doesn't.
+            Assert::Equal(0, static_cast<int>(pbSnapshotData[cbSnapshotData]));
+            Assert::Equal(0, static_cast<int>(pbSnapshotData[cbSnapshotData + 1]));
+
+        LExit:
+            ReleaseMem(pbData);
+            ReleaseMem(pbSnapshotData);
+        }
+    };
+}
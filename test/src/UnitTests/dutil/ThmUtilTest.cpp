@@ -0,0 +1,207 @@
+// Copyright (c) .NET Foundation and contributors. All rights reserved. Licensed under the Microsoft Reciprocal License. See LICENSE.TXT file in the project root for full license information.
+
+#include "precomp.h"
+
+using namespace System;
+using namespace System::Text;
+using namespace System::Collections::Generic;
+using namespace Xunit;
+
+namespace CfgTests
+{
+    // The window and each control font id are filled in by the test.
+    const LPCSTR TEST_THEME_FORMAT =
+        "<?xml version='1.0' encoding='utf-8'?>"
+        "<Theme xmlns='http://wixtoolset.org/schemas/thmutil/2010'>"
+        "<Window Width='485' Height='300' HexStyle='100a0000' FontId='%u'>#(loc.Caption)</Window>"
+        "<Font Id='0' Height='-12' Weight='500' Foreground='000000' Background='FFFFFF'>Segoe UI</Font>"
+        "<Font Id='1' Height='-24' Weight='700' Foreground='FF0000' Underline='yes'>Tahoma</Font>"
+        "<Text X='11' Y='11' Width='-11' Height='64' FontId='%u' Visible='yes'>#(loc.Title)</Text>"
+        "<Page Name='Install'>"
+        "<Button Name='InstallButton' X='-91' Y='-11' Width='75' Height='23' TabStop='yes' FontId='0' HoverFontId='%u'>Install</Button>"
+        "<Checkbox Name='AcceptCheckbox' X='11' Y='-41' Width='260' Height='17' TabStop='yes' FontId='1' SelectedFontId='%u'>Accept</Checkbox>"
+        "</Page>"
+        "<Page Name='Success'>"
+        "<Text Name='SuccessText' X='11' Y='80' Width='-11' Height='30' DisablePrefix='yes'>Done</Text>"
+        "</Page>"
+        "</Theme>";
+
+    public ref class ThmUtil
+    {
+    public:
+        [Fact]
+        void ThmUtilCompiledRoundTripTest()
+        {
+            HRESULT hr = S_OK;
+            BOOL fThemeInitialized = FALSE;
+            LPWSTR sczTempDir = NULL;
+            THEME* pTheme = NULL;
+            THEME* pCompiledTheme = NULL;
+
+            hr = PathExpand(&sczTempDir, L"%TEMP%\\ThmUtilTest\\", PATH_EXPAND_ENVIRONMENT);
+            ExitOnFailure(hr, "Failed to get temp dir");
+
+            hr = DirEnsureExists(sczTempDir, NULL);
+            ExitOnFailure(hr, "Failed to ensure temp directory exists");
+
+            hr = ThemeInitialize(NULL);
+            ExitOnFailure(hr, "Failed to initialize theme manager.");
+            fThemeInitialized = TRUE;
+
+            CompileTheme(sczTempDir, 0, 1, 1, 0, &pTheme);
+
+            hr = LoadCompiledThemeFile(sczTempDir, &pCompiledTheme);
+            ExitOnFailure(hr, "Failed to load compiled theme.");
+
+            AssertSameTheme(pTheme, pCompiledTheme);
+
+            ReleaseTheme(pTheme);
+            ReleaseTheme(pCompiledTheme);
+
+            // A font id that doesn't index the theme fonts is rejected rather than used when drawing.
+            AssertFontIdRejected(sczTempDir, 2, 1, 1, 0);
+            AssertFontIdRejected(sczTempDir, 0, 2, 1, 0);
+            AssertFontIdRejected(sczTempDir, 0, 1, 5, 0);
+            AssertFontIdRejected(sczTempDir, 0, 1, 1, 0x7FFFFFFF);
+
+        LExit:
+            ReleaseTheme(pTheme);
+            ReleaseTheme(pCompiledTheme);
+
+            if (fThemeInitialized)
+            {
+                ThemeUninitialize();
+            }
+
+            DirEnsureDelete(sczTempDir, TRUE, TRUE);
+            ReleaseStr(sczTempDir);
+        }
+
+    private:
+        void CompileTheme(LPCWSTR wzTempDir, DWORD dwWindowFontId, DWORD dwTextFontId, DWORD dwHoverFontId, DWORD dwSelectedFontId, THEME** ppTheme)
+        {
+            HRESULT hr = S_OK;
+            LPSTR sczXml = NULL;
+            LPWSTR sczXmlPath = NULL;
+            LPWSTR sczCompiledPath = NULL;
+
+            hr = StrAnsiAllocFormatted(&sczXml, TEST_THEME_FORMAT, dwWindowFontId, dwTextFontId, dwHoverFontId, dwSelectedFontId);
+            ExitOnFailure(hr, "Failed to format theme XML.");
+
+            hr = PathConcat(wzTempDir, L"theme.xml", &sczXmlPath);
+            ExitOnFailure(hr, "Failed to get theme XML path.");
+
+            hr = PathConcat(wzTempDir, L"theme.thm", &sczCompiledPath);
+            ExitOnFailure(hr, "Failed to get compiled theme path.");
+
+            hr = FileWrite(sczXmlPath, FILE_ATTRIBUTE_NORMAL, reinterpret_cast<BYTE*>(sczXml), lstrlenA(sczXml), NULL);
+            ExitOnFailure(hr, "Failed to write theme XML.");
+
+            // The XML parser leaves the font ids to be checked when the controls are drawn.
+            hr = ThemeLoadFromFile(sczXmlPath, ppTheme);
+            ExitOnFailure(hr, "Failed to load theme XML.");
+
+            hr = ThemeSaveCompiled(*ppTheme, sczCompiledPath);
+            ExitOnFailure(hr, "Failed to save compiled theme.");
+
+        LExit:
+            ReleaseStr(sczCompiledPath);
+            ReleaseStr(sczXmlPath);
+            ReleaseStr(sczXml);
+        }
+
+        HRESULT LoadCompiledThemeFile(LPCWSTR wzTempDir, THEME** ppTheme)
+        {
+            HRESULT hr = S_OK;
+            LPWSTR sczCompiledPath = NULL;
+
+            hr = PathConcat(wzTempDir, L"theme.thm", &sczCompiledPath);
+            ExitOnFailure(hr, "Failed to get compiled theme path.");
+
+            hr = ThemeLoadFromFile(sczCompiledPath, ppTheme);
+
+        LExit:
+            ReleaseStr(sczCompiledPath);
+
+            return hr;
+        }
+
+        void AssertFontIdRejected(LPCWSTR wzTempDir, DWORD dwWindowFontId, DWORD dwTextFontId, DWORD dwHoverFontId, DWORD dwSelectedFontId)
+        {
+            HRESULT hr = S_OK;
+            THEME* pTheme = NULL;
+            THEME* pCompiledTheme = NULL;
+
+            CompileTheme(wzTempDir, dwWindowFontId, dwTextFontId, dwHoverFontId, dwSelectedFontId, &pTheme);
+
+            hr = LoadCompiledThemeFile(wzTempDir, &pCompiledTheme);
+            Assert::Equal(HRESULT_FROM_WIN32(ERROR_INVALID_DATA), hr);
+            Assert::True(NULL == pCompiledTheme);
+
+            ReleaseTheme(pTheme);
+            ReleaseTheme(pCompiledTheme);
+        }
+
+        void AssertSameTheme(const THEME* pExpected, const THEME* pActual)
+        {
+            Assert::Equal(pExpected->dwStyle, pActual->dwStyle);
+            Assert::Equal(pExpected->dwFontId, pActual->dwFontId);
+            Assert::Equal(pExpected->nWidth, pActual->nWidth);
+            Assert::Equal(pExpected->nHeight, pActual->nHeight);
+            Assert::Equal(gcnew String(pExpected->sczCaption), gcnew String(pActual->sczCaption));
+
+            Assert::Equal(pExpected->cFonts, pActual->cFonts);
+            for (DWORD i = 0; i < pExpected->cFonts; ++i)
+            {
+                const THEME_FONT* pExpectedFont = pExpected->rgFonts + i;
+                const THEME_FONT* pActualFont = pActual->rgFonts + i;
+                LOGFONTW lfExpected = { };
+                LOGFONTW lfActual = { };
+
+                Assert::NotEqual(0, ::GetObjectW(pExpectedFont->hFont, sizeof(lfExpected), &lfExpected));
+                Assert::NotEqual(0, ::GetObjectW(pActualFont->hFont, sizeof(lfActual), &lfActual));
+                Assert::Equal(lfExpected.lfHeight, lfActual.lfHeight);
+                Assert::Equal(lfExpected.lfWeight, lfActual.lfWeight);
+                Assert::Equal(lfExpected.lfUnderline, lfActual.lfUnderline);
+                Assert::Equal(lfExpected.lfQuality, lfActual.lfQuality);
+                Assert::Equal(gcnew String(lfExpected.lfFaceName), gcnew String(lfActual.lfFaceName));
+
+                Assert::Equal(pExpectedFont->crForeground, pActualFont->crForeground);
+                Assert::Equal(pExpectedFont->crBackground, pActualFont->crBackground);
+            }
+
+            Assert::Equal(pExpected->cPages, pActual->cPages);
+            for (DWORD i = 0; i < pExpected->cPages; ++i)
+            {
+                const THEME_PAGE* pExpectedPage = pExpected->rgPages + i;
+                const THEME_PAGE* pActualPage = pActual->rgPages + i;
+
+                Assert::Equal(pExpectedPage->wId, pActualPage->wId);
+                Assert::Equal(gcnew String(pExpectedPage->sczName), gcnew String(pActualPage->sczName));
+                Assert::Equal(pExpectedPage->cControlIndices, pActualPage->cControlIndices);
+                Assert::Equal(0, memcmp(pExpectedPage->rgdwControlIndices, pActualPage->rgdwControlIndices, sizeof(DWORD) * pExpectedPage->cControlIndices));
+            }
+
+            Assert::Equal(pExpected->cControls, pActual->cControls);
+            for (DWORD i = 0; i < pExpected->cControls; ++i)
+            {
+                const THEME_CONTROL* pExpectedControl = pExpected->rgControls + i;
+                const THEME_CONTROL* pActualControl = pActual->rgControls + i;
+
+                Assert::Equal(static_cast<int>(pExpectedControl->type), static_cast<int>(pActualControl->type));
+                Assert::Equal(pExpectedControl->wPageId, pActualControl->wPageId);
+                Assert::Equal(gcnew String(pExpectedControl->sczName), gcnew String(pActualControl->sczName));
+                Assert::Equal(gcnew String(pExpectedControl->sczText), gcnew String(pActualControl->sczText));
+                Assert::Equal(pExpectedControl->nX, pActualControl->nX);
+                Assert::Equal(pExpectedControl->nY, pActualControl->nY);
+                Assert::Equal(pExpectedControl->nWidth, pActualControl->nWidth);
+                Assert::Equal(pExpectedControl->nHeight, pActualControl->nHeight);
+                Assert::Equal(pExpectedControl->dwStyle, pActualControl->dwStyle);
+                Assert::Equal(pExpectedControl->dwInternalStyle, pActualControl->dwInternalStyle);
+                Assert::Equal(pExpectedControl->dwFontId, pActualControl->dwFontId);
+                Assert::Equal(pExpectedControl->dwFontHoverId, pActualControl->dwFontHoverId);
+                Assert::Equal(pExpectedControl->dwFontSelectedId, pActualControl->dwFontSelectedId);
+            }
+        }
+    };
+}
@@ -5,18 +5,29 @@
 #include <windows.h>
 #include <strsafe.h>
 #include <ShlObj.h>
+#include <CommCtrl.h>
 
 // Include error.h before dutil.h
 #include "error.h"
 #include <dutil.h>
 
+#include <comutil.h>
+#include <msxml2.h>
+
+#include <atomutil.h>
+#include <apuputil.h>
+#include <chunkutil.h>
+#include <cryputil.h>
 #include <dictutil.h>
 #include <dirutil.h>
 #include <fileutil.h>
 #include <iniutil.h>
+#include <locutil.h>
 #include <memutil.h>
 #include <pathutil.h>
+#include <regutil.h>
 #include <strutil.h>
+#include <thmutil.h>
 #include <uriutil.h>
 
 #pragma managed